@@ -39,6 +39,7 @@
 #include <IOKit/serial/IORS232SerialStreamSync.h>
 
 #include "AppleSCCIrDA.h"
+#include "SIRFraming.h"
 #include "IrDAComm.h"
 #include "IrDAUser.h"
 #include "IrDALog.h"
@@ -515,7 +516,7 @@ EventTraceCauseDesc gTraceEvents[] = {
 	{kLogpSCminus,          "AppleSCCIrDA: parseInputSIR - CRC error"},
 	{kLogpSEminus,          "AppleSCCIrDA: parseInputSIR - EOF early < 2 bytes of data"},
 	{kLogpStp,          "AppleSCCIrDA: parseInputSIR - parse pad state, byte="},
-	{kLogpSte,          "AppleSCCIrDA: parseInputSIR - state error"},
+	{kLogpSte,          "AppleSCCIrDA: parseInputSIR - frame too big, dropped, length="},
 	
 	{kLogpIFR,          "AppleSCCIrDA: parseInputFIR - Currently not supported"},
 	
@@ -597,178 +598,6 @@ static IOPMPowerState gOurPowerStates[kNumIrDAStates] = {
 
     OSDefineMetaClassAndStructors( AppleSCCIrDA, AppleIrDASerial );
 
-/****************************************************************************************************/
-//      CRC checking and generation (both 16 bit and 32 bit)
-/****************************************************************************************************/
-
-#define POLYNOMIAL 0xedb88320               // 32-bit CRC polynomial, with lsb bits first
-#define P 0x8408                    // The HDLC 16 bit polynomial: x**0 + x**5 + x**12 + x**16 (0x8408)
-
-#define VALID_CRC   0xDEBB20E3          // The 32 bit result after running over the CRC
-#define INITIAL_CRC 0xFFFFFFFF          // Init 32 bit crc to this before starting
-
-static unsigned long    crc_table[256];         // 32 bit table
-static UInt16       crc16_table[256];       // 16 bit table
-
-/****************************************************************************************************/
-//
-//      Function:   gen_crc32_table
-//
-//      Inputs:     
-//
-//      Outputs:    
-//
-//      Desc:       Generate the table of CRC remainders for all possible bytes
-//
-/****************************************************************************************************/
-
-void gen_crc32_table()
-{
-    int i, j;
-     unsigned long crc_accum;
-    
-    for ( i = 0;  i < 256;  i++ )
-    {
-	crc_accum = ( (unsigned long) i  );
-	for ( j = 0;  j < 8;  j++ )
-	{
-	    if ( crc_accum & 1 )
-		crc_accum = ( crc_accum >> 1 ) ^ POLYNOMIAL;
-	    else   crc_accum = ( crc_accum >> 1 );
-	}
-	crc_table[i] = crc_accum;
-    }
-    return;
-    
-}/* end gen_crc32_table */
-
-/****************************************************************************************************/
-//
-//      Function:   gen_crc16_table
-//
-//      Inputs:     
-//
-//      Outputs:    
-//
-//      Desc:       Generate the CRC16 table
-//
-/****************************************************************************************************/
-
-void gen_crc16_table()
-{
-     unsigned int b, v;
-     int i;
-    
-    for (b = 0; b < 256; b++)
-    {
-	v = b;
-	for (i = 8; i--; )
-	    v = v & 1 ? (v >> 1) ^ P : v >> 1;
-	crc16_table[b] = v;
-    }
-    
-}/* end gen_crc16_table */
-
-/****************************************************************************************************/
-//
-//      Function:   update_crc32
-//
-//      Inputs:     crc - the current crc value
-//              cp - new data
-//              len - length of the new data
-//
-//      Outputs:    crc - the new crc
-//
-//      Desc:       Update the CRC on the data block one byte at a time
-//
-/****************************************************************************************************/
-
-UInt32 update_crc32( UInt32 crc, unsigned char *cp, int len )
-{
-     int i, j;
-    
-    for ( j = 0;  j < len;  j++ )
-    {
-	i = ( (int) ( crc ^ *cp++ ) & 0xff );
-	crc = (UInt32)(( crc >> 8 ) ^ crc_table[i]);
-    }
-    return crc;
-   
-}/* end update_crc32 */
-
-/****************************************************************************************************/
-//
-//      Function:   update_crc16
-//
-//      Inputs:     crc - the current crc value
-//              cp - new data
-//              len - length of the new data
-//
-//      Outputs:    crc - the new crc
-//
-//      Desc:       Update the CRC on the data block one byte at a time
-//
-/****************************************************************************************************/
-
-UInt16 update_crc16( UInt16 crc, unsigned char *cp, int len )
-{
-
-    while (len--)
-	crc = (crc >> 8) ^ crc16_table[(crc ^ *cp++) & 0xff];
-	
-    return (crc);
-    
-}/* end update_crc16 */
-
-/****************************************************************************************************/
-//
-//      Function:   check_crc32
-//
-//      Inputs:     buf - the data 
-//              len - length of the data
-//
-//      Outputs:    bool - true (good), false (not so good)
-//
-//      Desc:       Call this to see if the crc-32 at the end of the block is valid
-//
-/****************************************************************************************************/
-
-bool check_crc32( unsigned char *buf, int len )
-{
-    unsigned long crc = INITIAL_CRC;
-    
-    crc = (UInt32)update_crc32((UInt32)crc, buf, len);
-    
-    return (crc == VALID_CRC);
-    
-}/* end check_crc32 */
-
-/****************************************************************************************************/
-//
-//      Function:   check_crc16
-//
-//      Inputs:     buf - the data 
-//              len - length of the data
-//
-//      Outputs:    bool - true (good), false (not so good)
-//
-//      Desc:       Call this to see if the crc-16 at the end of the block is valid
-//
-/****************************************************************************************************/
-
-bool check_crc16( unsigned char *buf, int len )
-{
-    UInt16 crc;
-    
-    if (len < 2) return false;          // sanity check
-    
-    crc = 0xffff;               // init crc
-    crc = update_crc16(crc, buf, len-2);    // run over the data bytes
-    crc = ~crc;                 // finalize it
-    
-    return ( ((crc & 0xff) == buf[len-2]) && ((crc >> 8)   == buf[len-1]) );
-	
-}/* end check_crc16 */
     
     
 #if LOG_DATA
@@ -1719,6 +1548,9 @@ bool AppleSCCIrDA::init( OSDictionary *dict )
 	// Skip the IORS232SerialStreamSync's super classes, they aren't 'driver side'
     
     rc = IOService::init( dict );
+#if (hasTracing > 0)
+    IrDALogInit(0);                 // matched by the IrDALogFree in free, which runs even if init fails
+#endif
     IOLogIt( 0, rc, 'init', "init" );
     
     return rc;
@@ -2010,6 +1842,9 @@ void AppleSCCIrDA::free()
 	// Skip the IORS232SerialStreamSync's super classes, they aren't 'driver side'
 	
     IOService::free();
+#if (hasTracing > 0)
+    IrDALogFree();
+#endif
     return;
     
 }/* end free */
@@ -4253,102 +4088,49 @@ void AppleSCCIrDA::parseInputBuffer( UInt32 length, UInt8 *data )
 void AppleSCCIrDA::parseInputSIR( UInt32 length, UInt8 *data )
 {
     IOReturn    rtn = kIOReturnSuccess;
-    UInt8   byte;
+    UInt32  used;
+    UInt32  frameLength;
+    int     result;
     
 //  ELG( 0, 0, 'pISR', "parseInputSIR" );
     XTRACE(kLogpISR, 0, 0);
 
-	// Loop over newly received data
+	// Loop over newly received data, stopping at the end of each frame
 
-    while (length-- > 0)
+    while (length > 0)
     {
-	byte = *data++;
+	used = ::sir_parse_input( &fParseState, fInUseBuffer, &fDataLength, SCCLapPayLoad, data, length, &result, &frameLength );
+	data += used;
+	length -= used;
 	
-	switch ( fParseState )
+	switch ( result )
 	{
-	    case kParseStateIdle:
-	    XTRACE(kLogpStI, 0, byte);
-//        ELG( fParseState, byte, 'pStI', "parseInputSIR - parse idle state" );                         
-		if (byte == 0xC0)               // Idle State - discard everything but BOF
-		{
-		    fParseState = kParseStateBOF;
-		}
-		break;                                      
-	    case kParseStateBOF:
-		XTRACE(kLogpStB, 0, byte);
-//        ELG( fParseState, byte, 'pStB', "parseInputSIR - parse BOF state" );
-		switch (byte) 
-		{
-		    case 0xC0:                  // BOF State - multiple BOFs are ignored
-			break;                                  
-		    case 0xC1:                  // BOF State - EOF is invalid   
-			fParseState = kParseStateIdle;
-			fDataLength = 0;
-			break;                      
-		    case 0x7D:                  // BOF State - ESCAPE, starts with a pad byte
-			fParseState = kParseStatePad;
-			break;                                  
-		    default:                    // BOF State - data, starts with a normal byte  
-			fInUseBuffer[fDataLength++] = byte;
-			fParseState = kParseStateData;
-			break;
-		}
-		break;                                      
-	    case kParseStateData:
-		XTRACE(kLogpStd, 0, byte);
-//        ELG( fParseState, byte, 'pStd', "parseInputSIR - parse data state" );
-		switch (byte) 
+	    case kSIRParseMore:
+		break;
+	    case kSIRParseFrame:                // EOF and the CRC checked, the frame is in fInUseBuffer
+		if ( fIrDA )
 		{
-		    case 0xC0:                  // Data State - BOF is invalid in the data section of a packet
-			fParseState = kParseStateIdle;
-			fDataLength = 0;
-			break;                  
-		    case 0xC1:                  // Data State - EOF, done with the packet, check the CRC
-			if ( fDataLength > 2 ) 
-			{
-			    if ( ::check_crc16(fInUseBuffer, fDataLength) )     // Check CRC is valid
-			    {
-				fDataLength -= 2;                   // Don't pass back the CRC
-				if ( fIrDA )
-				{
-				    LogData( kDriverIn, fDataLength, fInUseBuffer );
-				    rtn = fIrDA->ReadComplete( fInUseBuffer, fDataLength );
-				    if ( rtn != kIOReturnSuccess )
-				    {
-					ELG( 0, rtn, 'pSI-', "parseInputSIR - IrDA ReadComplete problem" );
-					XTRACE(kLogpSIminus, rtn >> 16, rtn);
-				    }
-				}                               
-			    } else {
-				ELG( 0, 0, 'pSC-', "parseInputSIR - CRC error" );
-				XTRACE(kLogpSCminus, 0, 0);
-				fICRCError++;
-			    }
-			} else {
-			    ELG( 0, 0, 'pSE-', "parseInputSIR - EOF early < 2 bytes of data" );
-			    XTRACE(kLogpSEminus, fParseState, 0);
-			}
-			fParseState = kParseStateIdle;
-			fDataLength = 0;
-			break;
-		    case 0x7D:                  // Data State - pad byte, switch to pad state
-			fParseState = kParseStatePad;
-			break;                          
-		    default:                    // Data State - by golly it's data
-			fInUseBuffer[fDataLength++] = byte;
-			break;
+		    LogData( kDriverIn, frameLength, fInUseBuffer );
+		    rtn = fIrDA->ReadComplete( fInUseBuffer, frameLength );
+		    if ( rtn != kIOReturnSuccess )
+		    {
+			ELG( 0, rtn, 'pSI-', "parseInputSIR - IrDA ReadComplete problem" );
+			XTRACE(kLogpSIminus, rtn >> 16, rtn);
+		    }
 		}
-		break;                                      
-	    case kParseStatePad:
-		XTRACE(kLogpStp, 0, byte);
-//                ELG( fParseState, byte, 'pStp', "parseInputSIR - parse pad state" );
-		fInUseBuffer[fDataLength++] = byte ^ 0x20;
-		fParseState = kParseStateData;
-		break;                                      
-	    default:
-		ELG( fParseState, byte, 'pSte', "parseInputSIR - state error" );
-		XTRACE(kLogpSte, fParseState, byte);
-		break;      
+		break;
+	    case kSIRParseCRCError:
+		ELG( 0, 0, 'pSC-', "parseInputSIR - CRC error" );
+		XTRACE(kLogpSCminus, 0, 0);
+		fICRCError++;
+		break;
+	    case kSIRParseShort:
+		ELG( 0, 0, 'pSE-', "parseInputSIR - EOF early < 2 bytes of data" );
+		XTRACE(kLogpSEminus, 0, frameLength);
+		break;
+	    default:                    // too big to be a real frame, dropped
+		XTRACE(kLogpSte, result, frameLength);
+		break;
 	}
     }
 }/* end parseInputSIR */
@@ -4437,25 +4219,18 @@ UInt32 AppleSCCIrDA::Prepare_Buffer_For_Transmit( UInt8 *fOutBuffer, UInt32 cont
 	*dest++ = 0xFF;             // change these to 0xC0 to match old spec (for testing)
     }
     *dest++ = 0xC0;             // one BOF byte after the 0xFF pad bytes
-    length = fBofsCode+1;           // review
     
     // Now copy the irlap packet, doing byte stuffing as needed
 	
     src = control_buffer;           // start of client's irlap packet
     src_length = control_length;        // grab count of client's bytes
     
-    while (src_length-- > 0)            // copy over the user bytes 
-    {
-	SIRStuff(*src++, &dest, &length);   // byte stuffing along the way
-    }
+    dest = ::sir_stuff_block(src, src_length, dest);    // byte stuffing along the way
     
     src = data_buffer;              // and again for the non-control portion
     src_length = data_length;
     
-    while (src_length-- > 0)            // copy over the user bytes
-    {
-	SIRStuff(*src++, &dest, &length);   // byte stuffing along the way
-    }
+    dest = ::sir_stuff_block(src, src_length, dest);    // byte stuffing along the way
     
 	// now we append the CRC16.  Make it from the original buffer, non-escape byte
     
@@ -4464,13 +4239,13 @@ UInt32 AppleSCCIrDA::Prepare_Buffer_For_Transmit( UInt8 *fOutBuffer, UInt32 cont
     crc16 = ::update_crc16(crc16, data_buffer, data_length);                // update w/the packet
     crc16 = ~crc16;                                 // finalize the crc
     
-    SIRStuff(crc16 >> 0, &dest, &length);   // add in the crc16, lsb then msb
-    SIRStuff(crc16 >> 8, &dest, &length);   // crc bytes are byte-stuffed too
+    dest = ::sir_stuff_byte(crc16 >> 0, dest);  // add in the crc16, lsb then msb
+    dest = ::sir_stuff_byte(crc16 >> 8, dest);  // crc bytes are byte-stuffed too
     
     // and finally end with EOF
 	
     *dest++ = 0xC1;
-    length++;
+    length = (UInt32)(dest - fOutBuffer);
     
     // length is now what we want to actually transmit
 	
@@ -4478,47 +4253,6 @@ UInt32 AppleSCCIrDA::Prepare_Buffer_For_Transmit( UInt8 *fOutBuffer, UInt32 cont
     
 }/* end Prepare_Buffer_For_Transmit */
 
-/****************************************************************************************************/
-//
-//      Method:     AppleSCCIrDA::SIRStuff
-//
-//      Inputs:     byte - data to be stuffed
-//              destptr - where to put it
-//
-//      Outputs:    lengthPtr - updated lenth
-//
-//      Desc:       Stuff byte into the output buffer in SIR mode
-//
-/****************************************************************************************************/
-
-void AppleSCCIrDA::SIRStuff(UInt8 byte, UInt8 **destPtr, UInt32 *lengthPtr)
-{
-    UInt8 *dest   = *destPtr;
-    UInt32 length = *lengthPtr;
-    
-    switch (byte) 
-    {
-	case 0xC0:                          
-	case 0xC1:
-	case 0x7D:                      
-	    *dest++ = 0x7D;         // the escape byte followed by ...
-	    *dest++ = byte ^ 0x20;      // c0 to e0, c1 to e1, 7d to 5d
-	    length += 2;
-	    break;
-				
-	default:    
-	    *dest++ = byte;         // the usual case, non-escaped byte to copy
-	    length++;
-	    break;
-    }
-	
-    *destPtr   = dest;
-    *lengthPtr = length;
-	
-    return;
-    
-}/* end SIRStuff */
-
 /* static */
 void AppleSCCIrDA::tx_thread(thread_call_param_t param0, thread_call_param_t param1)
 {
@@ -123,14 +123,6 @@ enum
     kMode_FIR                   // fast mode (1mbit, 4mbit) 
 };
 
-enum                    // parse states extracting the packet from read data
-{
-    kParseStateIdle,                // looking for BOF
-    kParseStateBOF,             // recv'd at least one BOF (0xC0, not 0xFF)
-    kParseStateData,                // recv'd a non-pad byte (after a BOF)
-    kParseStatePad              // recv'd a pad byte (after a BOF)
-};
-
 enum                                // command mode speed settings
 {
     kSetModeHP115200_1_6    = 0x4d,
@@ -276,7 +268,6 @@ private:
     void            parseInputSIR( UInt32 length, UInt8 *data );
     void            parseInputFIR( UInt32 length, UInt8 *data );
     void            parseInputReset(void);
-    void            SIRStuff(UInt8 byte, UInt8 **destPtr, UInt32 *lengthPtr);
     UInt32          Prepare_Buffer_For_Transmit(UInt8 *fOutBuffer, UInt32 control_length, UInt8 *control_buffer, UInt32 data_length, UInt8 *data_buffer );
     bool            initForPM(IOService *provider);
     
@@ -0,0 +1,540 @@
+    /* Copyright (c) 2000 Apple Computer, Inc. All rights reserved.
+     *
+     * @APPLE_LICENSE_HEADER_START@
+     * 
+     * The contents of this file constitute Original Code as defined in and
+     * are subject to the Apple Public Source License Version 1.1 (the
+     * "License").  You may not use this file except in compliance with the
+     * License.  Please obtain a copy of the License at
+     * http://www.apple.com/publicsource and read it before using this file.
+     * 
+     * This Original Code and all software distributed under the License are
+     * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+     * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+     * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+     * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+     * License for the specific language governing rights and limitations
+     * under the License.
+     * 
+     * @APPLE_LICENSE_HEADER_END@
+     */
+
+    /* SIRFraming.h - CRCs, byte stuffing and frame parsing for SIR mode IrDA. */
+    
+    /* These only depend on OSTypes.h and the C library so that they can be built into a
+       user space test as well as AppleSCCIrDA.  The CRC tables are static, so each file
+       that includes this has its own copy and has to call gen_crc16_table() and
+       gen_crc32_table() before using them. */
+
+#ifndef _SIRFRAMING_
+#define _SIRFRAMING_
+
+#include <stdint.h>
+#include <string.h>
+#include <libkern/OSTypes.h>
+
+/****************************************************************************************************/
+//      CRC checking and generation (both 16 bit and 32 bit)
+/****************************************************************************************************/
+
+#define POLYNOMIAL 0xedb88320               // 32-bit CRC polynomial, with lsb bits first
+#define CRC16_POLYNOMIAL 0x8408     // The HDLC 16 bit polynomial: x**0 + x**5 + x**12 + x**16 (0x8408)
+
+#define VALID_CRC   0xDEBB20E3          // The 32 bit result after running over the CRC
+#define INITIAL_CRC 0xFFFFFFFF          // Init 32 bit crc to this before starting
+
+#define kCRCSlices  8                   // bytes consumed per step by update_crc32/update_crc16
+
+    // Slice 0 is the usual byte-at-a-time table, slice n is the remainder of a byte
+    // followed by n zero bytes, so eight table lookups retire eight bytes at once.
+
+static UInt32       crc_table[kCRCSlices][256];     // 32 bit tables
+static UInt16       crc16_table[kCRCSlices][256];   // 16 bit tables
+
+/****************************************************************************************************/
+//
+//      Function:   gen_crc32_table
+//
+//      Inputs:     
+//
+//      Outputs:    
+//
+//      Desc:       Generate the table of CRC remainders for all possible bytes
+//
+/****************************************************************************************************/
+
+static inline void gen_crc32_table()
+{
+    int i, j;
+     unsigned long crc_accum;
+    
+    for ( i = 0;  i < 256;  i++ )
+    {
+	crc_accum = ( (unsigned long) i  );
+	for ( j = 0;  j < 8;  j++ )
+	{
+	    if ( crc_accum & 1 )
+		crc_accum = ( crc_accum >> 1 ) ^ POLYNOMIAL;
+	    else   crc_accum = ( crc_accum >> 1 );
+	}
+	crc_table[0][i] = (UInt32)crc_accum;
+    }
+    
+    for ( i = 0;  i < 256;  i++ )
+    {
+	for ( j = 1;  j < kCRCSlices;  j++ )
+	    crc_table[j][i] = ( crc_table[j-1][i] >> 8 ) ^ crc_table[0][crc_table[j-1][i] & 0xff];
+    }
+    return;
+    
+}/* end gen_crc32_table */
+
+/****************************************************************************************************/
+//
+//      Function:   gen_crc16_table
+//
+//      Inputs:     
+//
+//      Outputs:    
+//
+//      Desc:       Generate the CRC16 table
+//
+/****************************************************************************************************/
+
+static inline void gen_crc16_table()
+{
+     unsigned int b, v;
+     int i;
+    
+    for (b = 0; b < 256; b++)
+    {
+	v = b;
+	for (i = 8; i--; )
+	    v = v & 1 ? (v >> 1) ^ CRC16_POLYNOMIAL : v >> 1;
+	crc16_table[0][b] = v;
+    }
+    
+    for (b = 0; b < 256; b++)
+    {
+	for (i = 1; i < kCRCSlices; i++)
+	    crc16_table[i][b] = (crc16_table[i-1][b] >> 8) ^ crc16_table[0][crc16_table[i-1][b] & 0xff];
+    }
+    
+}/* end gen_crc16_table */
+
+/****************************************************************************************************/
+//
+//      Function:   update_crc32
+//
+//      Inputs:     crc - the current crc value
+//              cp - new data
+//              len - length of the new data
+//
+//      Outputs:    crc - the new crc
+//
+//      Desc:       Update the CRC on the data block eight bytes at a time (slice-by-8),
+//              then finish the tail one byte at a time.  The bytes are assembled
+//              by hand so this works on either byte order and any alignment.
+//
+/****************************************************************************************************/
+
+static inline UInt32 update_crc32( UInt32 crc, const unsigned char *cp, int len )
+{
+     int i;
+    
+    while ( len >= kCRCSlices )
+    {
+	crc ^= (UInt32)cp[0] | ((UInt32)cp[1] << 8) | ((UInt32)cp[2] << 16) | ((UInt32)cp[3] << 24);
+	crc = crc_table[7][crc & 0xff] ^ crc_table[6][(crc >> 8) & 0xff] ^
+	      crc_table[5][(crc >> 16) & 0xff] ^ crc_table[4][crc >> 24] ^
+	      crc_table[3][cp[4]] ^ crc_table[2][cp[5]] ^
+	      crc_table[1][cp[6]] ^ crc_table[0][cp[7]];
+	cp += kCRCSlices;
+	len -= kCRCSlices;
+    }
+    
+    while ( len-- > 0 )
+    {
+	i = ( (int) ( crc ^ *cp++ ) & 0xff );
+	crc = ( crc >> 8 ) ^ crc_table[0][i];
+    }
+    return crc;
+   
+}/* end update_crc32 */
+
+/****************************************************************************************************/
+//
+//      Function:   update_crc16
+//
+//      Inputs:     crc - the current crc value
+//              cp - new data
+//              len - length of the new data
+//
+//      Outputs:    crc - the new crc
+//
+//      Desc:       Update the CRC on the data block eight bytes at a time (slice-by-8),
+//              then finish the tail one byte at a time
+//
+/****************************************************************************************************/
+
+static inline UInt16 update_crc16( UInt16 crc, const unsigned char *cp, int len )
+{
+
+    while (len >= kCRCSlices)
+    {
+	crc ^= (UInt16)(cp[0] | (cp[1] << 8));
+	crc = crc16_table[7][crc & 0xff] ^ crc16_table[6][crc >> 8] ^
+	      crc16_table[5][cp[2]] ^ crc16_table[4][cp[3]] ^
+	      crc16_table[3][cp[4]] ^ crc16_table[2][cp[5]] ^
+	      crc16_table[1][cp[6]] ^ crc16_table[0][cp[7]];
+	cp += kCRCSlices;
+	len -= kCRCSlices;
+    }
+    
+    while (len-- > 0)
+	crc = (crc >> 8) ^ crc16_table[0][(crc ^ *cp++) & 0xff];
+	
+    return (crc);
+    
+}/* end update_crc16 */
+
+/****************************************************************************************************/
+//
+//      Function:   check_crc32
+//
+//      Inputs:     buf - the data 
+//              len - length of the data
+//
+//      Outputs:    bool - true (good), false (not so good)
+//
+//      Desc:       Call this to see if the crc-32 at the end of the block is valid
+//
+/****************************************************************************************************/
+
+static inline bool check_crc32( const unsigned char *buf, int len )
+{
+    unsigned long crc = INITIAL_CRC;
+    
+    crc = (UInt32)update_crc32((UInt32)crc, buf, len);
+    
+    return (crc == VALID_CRC);
+    
+}/* end check_crc32 */
+
+/****************************************************************************************************/
+//
+//      Function:   check_crc16
+//
+//      Inputs:     buf - the data 
+//              len - length of the data
+//
+//      Outputs:    bool - true (good), false (not so good)
+//
+//      Desc:       Call this to see if the crc-16 at the end of the block is valid
+//
+/****************************************************************************************************/
+
+static inline bool check_crc16( const unsigned char *buf, int len )
+{
+    UInt16 crc;
+    
+    if (len < 2) return false;          // sanity check
+    
+    crc = 0xffff;               // init crc
+    crc = update_crc16(crc, buf, len-2);    // run over the data bytes
+    crc = ~crc;                 // finalize it
+    
+    return ( ((crc & 0xff) == buf[len-2]) && ((crc >> 8)   == buf[len-1]) );
+	
+}/* end check_crc16 */
+
+/****************************************************************************************************/
+//
+//      Function:   sir_plain_span
+//
+//      Inputs:     cp - data 
+//              len - length of the data
+//
+//      Outputs:    UInt32 - number of leading bytes that are not BOF, EOF or CE
+//
+//      Desc:       Finds the next SIR control byte (0xC0, 0xC1 or 0x7D) a word at a time so
+//              that runs of plain data can be copied in one go.  A word that has any of
+//              the three bytes in it is finished off one byte at a time.
+//
+/****************************************************************************************************/
+
+#define kSIRWordOnes    0x01010101U
+#define kSIRWordHighs   0x80808080U
+#define SIR_HAS_ZERO_BYTE(w)    ( ((w) - kSIRWordOnes) & ~(w) & kSIRWordHighs )
+
+static inline UInt32 sir_plain_span( const UInt8 *cp, UInt32 len )
+{
+    const UInt8 *start = cp;
+    const UInt8 *end = cp + len;
+    UInt32  w;
+    
+    while ( (cp < end) && ((uintptr_t)cp & (sizeof(UInt32) - 1)) )     // byte at a time up to a word boundary
+    {
+	if ( (*cp == 0xC0) || (*cp == 0xC1) || (*cp == 0x7D) )
+	    return (UInt32)(cp - start);
+	cp++;
+    }
+    
+    while ( (end - cp) >= (int)sizeof(UInt32) )
+    {
+	w = *(const UInt32 *)cp;
+	if ( SIR_HAS_ZERO_BYTE(w ^ (0xC0 * kSIRWordOnes)) || 
+	     SIR_HAS_ZERO_BYTE(w ^ (0xC1 * kSIRWordOnes)) || 
+	     SIR_HAS_ZERO_BYTE(w ^ (0x7D * kSIRWordOnes)) )
+	    break;
+	cp += sizeof(UInt32);
+    }
+    
+    while ( cp < end )
+    {
+	if ( (*cp == 0xC0) || (*cp == 0xC1) || (*cp == 0x7D) )
+	    break;
+	cp++;
+    }
+    
+    return (UInt32)(cp - start);
+    
+}/* end sir_plain_span */
+
+/****************************************************************************************************/
+//
+//      Function:   sir_stuff_byte
+//
+//      Inputs:     byte - data to be stuffed
+//              dest - where to put it
+//
+//      Outputs:    UInt8 * - where the next byte goes
+//
+//      Desc:       Stuff a byte into the output buffer in SIR mode
+//
+/****************************************************************************************************/
+
+static inline UInt8 *sir_stuff_byte( UInt8 byte, UInt8 *dest )
+{
+    switch (byte) 
+    {
+	case 0xC0:                          
+	case 0xC1:
+	case 0x7D:                      
+	    *dest++ = 0x7D;         // the escape byte followed by ...
+	    *dest++ = byte ^ 0x20;      // c0 to e0, c1 to e1, 7d to 5d
+	    break;
+				
+	default:    
+	    *dest++ = byte;         // the usual case, non-escaped byte to copy
+	    break;
+    }
+	
+    return dest;
+    
+}/* end sir_stuff_byte */
+
+/****************************************************************************************************/
+//
+//      Function:   sir_stuff_block
+//
+//      Inputs:     src - data to be stuffed
+//              len - length of the data
+//              dest - where to put it
+//
+//      Outputs:    UInt8 * - where the next byte goes
+//
+//      Desc:       Stuff a block into the output buffer in SIR mode, copying the runs
+//              between control bytes in one go and escaping the control bytes
+//
+/****************************************************************************************************/
+
+static inline UInt8 *sir_stuff_block( const UInt8 *src, UInt32 len, UInt8 *dest )
+{
+    UInt32  run;
+    
+    while (len > 0)
+    {
+	run = sir_plain_span(src, len);
+	if (run > 0)
+	{
+	    memcpy(dest, src, run);         // the usual case, non-escaped bytes to copy
+	    dest += run;
+	    src += run;
+	    len -= run;
+	}
+	if (len > 0)
+	{
+	    dest = sir_stuff_byte(*src++, dest);    // a control byte, escape it
+	    len--;
+	}
+    }
+    
+    return dest;
+    
+}/* end sir_stuff_block */
+
+/****************************************************************************************************/
+//
+//      Function:   sir_parse_input
+//
+//      Inputs:     state - parse state, kParseStateIdle to start
+//              buffer - frame being received
+//              dataLength - bytes in buffer so far
+//              capacity - size of buffer
+//              data - data received
+//              length - length of data
+//
+//      Outputs:    UInt32 - bytes of data used
+//              result - why it stopped, see kSIRParse*
+//              frameLength - for kSIRParseFrame the length of the frame (less the CRC)
+//              in buffer, for the others the length of what was thrown away
+//
+//      Desc:       Runs the SIR receive state machine over the data until it runs out or
+//              something happens to the frame being received.  In the data state whole
+//              runs of plain bytes are copied at once.  The frame is left in buffer for
+//              the caller while the state goes back to idle, so it has to be used before
+//              the next call.
+//
+/****************************************************************************************************/
+
+enum                    // parse states extracting the packet from read data
+{
+    kParseStateIdle,                // looking for BOF
+    kParseStateBOF,             // recv'd at least one BOF (0xC0, not 0xFF)
+    kParseStateData,                // recv'd a non-pad byte (after a BOF)
+    kParseStatePad              // recv'd a pad byte (after a BOF)
+};
+
+enum                    // what sir_parse_input stopped for
+{
+    kSIRParseMore,              // used up the data, in the middle of a frame or between frames
+    kSIRParseFrame,             // a frame with a good CRC is in buffer
+    kSIRParseCRCError,              // EOF, but the CRC didn't check
+    kSIRParseShort,             // EOF with no more than the 2 CRC bytes
+    kSIRParseOverrun                // too big to be a real frame, dropped
+};
+
+static inline UInt32 sir_parse_input( UInt8 *state, UInt8 *buffer, UInt32 *dataLength, UInt32 capacity, const UInt8 *data, UInt32 length, int *result, UInt32 *frameLength )
+{
+    const UInt8 *start = data;
+    UInt8   byte;
+    UInt32  run;
+    
+    *result = kSIRParseMore;
+    *frameLength = 0;
+    
+    while (length > 0)
+    {
+	    // In the data state copy the whole run of plain bytes up to the next control byte
+	    
+	if ( *state == kParseStateData )
+	{
+	    run = sir_plain_span( data, length );
+	    if ( run > 0 )
+	    {
+		data += run;
+		length -= run;
+		if ( *dataLength + run > capacity )
+		{
+		    *result = kSIRParseOverrun;
+		    *frameLength = *dataLength + run;
+		    *state = kParseStateIdle;
+		    *dataLength = 0;
+		    break;
+		}
+		memcpy( &buffer[*dataLength], data - run, run );
+		*dataLength += run;
+		continue;
+	    }
+	}
+	
+	byte = *data++;
+	length--;
+	
+	if ( (*dataLength >= capacity) &&       // no room for another data byte, drop the frame
+	     ((*state == kParseStatePad) || ((byte != 0xC0) && (byte != 0xC1) && (byte != 0x7D))) )
+	{
+	    *result = kSIRParseOverrun;
+	    *frameLength = *dataLength + 1;
+	    *state = kParseStateIdle;
+	    *dataLength = 0;
+	    break;
+	}
+	
+	switch ( *state )
+	{
+	    case kParseStateIdle:
+		if (byte == 0xC0)               // Idle State - discard everything but BOF
+		{
+		    *state = kParseStateBOF;
+		}
+		break;                                      
+	    case kParseStateBOF:
+		switch (byte) 
+		{
+		    case 0xC0:                  // BOF State - multiple BOFs are ignored
+			break;                                  
+		    case 0xC1:                  // BOF State - EOF is invalid   
+			*state = kParseStateIdle;
+			*dataLength = 0;
+			break;                      
+		    case 0x7D:                  // BOF State - ESCAPE, starts with a pad byte
+			*state = kParseStatePad;
+			break;                                  
+		    default:                    // BOF State - data, starts with a normal byte  
+			buffer[(*dataLength)++] = byte;
+			*state = kParseStateData;
+			break;
+		}
+		break;                                      
+	    case kParseStateData:
+		switch (byte) 
+		{
+		    case 0xC0:                  // Data State - BOF is invalid in the data section of a packet
+			*state = kParseStateIdle;
+			*dataLength = 0;
+			break;                  
+		    case 0xC1:                  // Data State - EOF, done with the packet, check the CRC
+			if ( *dataLength <= 2 )
+			{
+			    *result = kSIRParseShort;
+			    *frameLength = *dataLength;
+			}
+			else if ( check_crc16(buffer, *dataLength) )
+			{
+			    *result = kSIRParseFrame;
+			    *frameLength = *dataLength - 2;         // Don't pass back the CRC
+			}
+			else
+			{
+			    *result = kSIRParseCRCError;
+			    *frameLength = *dataLength;
+			}
+			*state = kParseStateIdle;
+			*dataLength = 0;
+			return (UInt32)(data - start);
+		    case 0x7D:                  // Data State - pad byte, switch to pad state
+			*state = kParseStatePad;
+			break;                          
+		    default:                    // Data State - by golly it's data
+			buffer[(*dataLength)++] = byte;
+			break;
+		}
+		break;                                      
+	    case kParseStatePad:
+		buffer[(*dataLength)++] = byte ^ 0x20;
+		*state = kParseStateData;
+		break;                                      
+	    default:
+		*state = kParseStateIdle;
+		*dataLength = 0;
+		break;      
+	}
+    }
+    
+    return (UInt32)(data - start);
+    
+}/* end sir_parse_input */
+
+#endif /* _SIRFRAMING_ */
@@ -526,12 +526,16 @@ AppleUSBEHCI::UIMInitialize(IOService * provider)
 		if (!gotTimerThreads)
 			continue;
 		
-		/*_diagnostics = AppleUSBEHCIDiagnostics::createDiagnostics(this);
+		_diagnostics = AppleUSBDiagnostics::createDiagnostics(&_UIMDiagnostics, &_controlBulkTransactionsOut, this);
 		if( _diagnostics )
 		{
+			AppleUSBDiagnostics::AllocateEndpoints(&_UIMDiagnostics);
 			setProperty( "Statistics", _diagnostics );
-		}*/
+		}
 		
+		// controllers which can miss the port change interrupt still need the root hub timer to find changes
+		RootHubEnableChangeInterrupts(!(_errataBits & kErrataMissingPortChangeInt));
+
 		_uimInitialized = true;
 
 		registerService();									// allows the UHCI driver to know we are here
@@ -1161,9 +1165,11 @@ AppleUSBEHCI::UIMFinalize(void)
 	
 	if( _diagnostics )
 	{
+		removeProperty( "Statistics" );
 		_diagnostics->release();
 		_diagnostics = NULL;
 	}
+	AppleUSBDiagnostics::FreeEndpoints(&_UIMDiagnostics);
 
     // Need to Free any Isoch Endpoints
     //
@@ -468,7 +468,7 @@ AppleUSBEHCITTInfo::ReleaseFSBusBytes(int frame, UInt16 bytesToRelease)
 
 
 IOReturn
-AppleUSBEHCITTInfo::AllocatePeriodicBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE)
+AppleUSBEHCITTInfo::AllocatePeriodicBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE, const EHCIScheduleHSLoad *hsLoad)
 {
 	IOReturn								err;
 	int										frameIndex;
@@ -481,7 +481,7 @@ AppleUSBEHCITTInfo::AllocatePeriodicBandwidth(AppleUSBEHCISplitPeriodicEndpoint
 	if (!pSPE)
 		return kIOReturnInternalError;
 	
-	err = pSPE->FindStartFrameAndStartTime();
+	err = pSPE->FindStartFrameAndStartTime(hsLoad);
 	if (err)
 	{
 		USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCITTInfo[%p]::AllocatePeriodicBandwidth - pSPE->FindStartFrameAndStartTime returned err[%p]", this, (void*)(UInt64)err);
@@ -1054,120 +1054,46 @@ AppleUSBEHCISplitPeriodicEndpoint::SetStartFrameAndStartTime(UInt8 startFrame, U
 // FindStartFrameAndStartTime
 // This method is common to both Interrupt and Isoch endpoints
 // It determines the start_frame (in our 32 frame overall scedule) and start_time (measured in FS bytes) this transaction EP will live
+// The choice itself is made by EHCIScheduleFindSplitFrame (EHCIPeriodicSchedule.h), which also looks at where the SS and CS
+// will land on the HS bus (hsLoad) so that we don't pick a frame on the TT whose splits can't be scheduled
 //
 IOReturn
-AppleUSBEHCISplitPeriodicEndpoint::FindStartFrameAndStartTime(void)
+AppleUSBEHCISplitPeriodicEndpoint::FindStartFrameAndStartTime(const EHCIScheduleHSLoad *hsLoad)
 {
-	UInt16			tempStartTimes[kEHCIMaxPollingInterval];
-	int				frameIndex, bestFrame;
-	UInt16			bestStartTimeFound = kEHCIFSMinStartTime;
-	UInt16			bestTimeUsedFound = kEHCIFSMinStartTime;
-	UInt16			bestStartTimeFrame = kEHCIMaxPollingInterval;
-	UInt16			bestTimeUsedFrame = kEHCIMaxPollingInterval;
-	UInt32			timeUsedForBestStartTimeFrame = 0;
-	UInt32			timeUsedForBestTimeUsedFrame = 0;
-	bool			foundStartTimeCandidate = false;
-	bool			foundTimeUsedCandidate = false;
+	UInt16						tempStartTimes[kEHCIMaxPollingInterval];
+	UInt32						largeIsochMask = 0;
+	EHCIScheduleSplitRequest	request;
+	UInt8						startFrame;
+	UInt16						startTime;
+	int							frameIndex;
 	
 	USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - _FSBytesUsed (%d)", this, _FSBytesUsed);
 	// first, calculate where I would fit into each frame based on where I would be inserted in that frame
 	CalculateAllFrameStartTimes(tempStartTimes);
 	
-	for (frameIndex=0; frameIndex < _period; frameIndex++)
+	for (frameIndex=0; frameIndex < kEHCIMaxPollingInterval; frameIndex++)
 	{
-		UInt16			totalTimeUsedThisHarmonic = 0;								// the total of all time used for all EPs in this harmonic
-		UInt16			startTimeThisFrame = kEHCIFSMinStartTime;
-		int				frameIndex2;
-		bool			epWillFit = true;
-
-		// check all of the frames in the overall array which would be on the same harmonic as the earliest one
-		for (frameIndex2 = frameIndex; frameIndex2 < kEHCIMaxPollingInterval; frameIndex2 += _period)
-		{
-			// see if I will fit in this harmonic based on total time used
-			UInt16		startTimeThisHarmonic;
-			UInt16		tempTimeUsed = _myTT->_FStimeUsed[frameIndex2] + _FSBytesUsed;
-
-			if ((_FSBytesUsed > kEHCIFSLargeIsochPacket) && (_myTT->_largeIsoch[frameIndex]))
-			{
-				USBLog(1, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - second large isoc not allowed in frame %d", this, frameIndex2);
-				epWillFit = false;
-				break;				// we won't fit on this harmonic
-			}
-			
-			if (tempTimeUsed > kEHCIFSMaxFrameBytes)
-			{
-				USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - no room in frame(%d) based on time used", this, frameIndex2);
-				epWillFit = false;
-				break;				// we won't fit on this harmonic
-			}
-			
-			// now see if I will also fit based on start time
-			startTimeThisHarmonic = tempStartTimes[frameIndex2];
-			if ((startTimeThisHarmonic + _FSBytesUsed) > kEHCIFSMaxFrameBytes)
-			{
-				USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - no room in frame(%d) based on start time", this, frameIndex2);
-				epWillFit = false;
-				break;
-			}
-			
-			totalTimeUsedThisHarmonic += tempTimeUsed;
-			
-			if (startTimeThisHarmonic > startTimeThisFrame)
-				startTimeThisFrame = startTimeThisHarmonic;
-		}
-		if (epWillFit)
-		{
-			// since we indexed past the array, we know that we fit in every harmonic
-			USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - looks like we fit at frame (%d)", this, (int)frameIndex);
-			if (!foundStartTimeCandidate)
-			{
-				foundStartTimeCandidate = true;
-				bestStartTimeFound = startTimeThisFrame+1;
-			}
-			if (!foundTimeUsedCandidate)
-			{
-				foundTimeUsedCandidate = true;
-				bestTimeUsedFound = totalTimeUsedThisHarmonic+1;
-			}
-			// note. if the below is less than instead of less than or equal, then we will start at the beginning of the possible frames
-			// with <= we gravitate toward the end..
-			if (startTimeThisFrame < bestStartTimeFound)
-			{
-				bestStartTimeFound = startTimeThisFrame;
-				bestStartTimeFrame = frameIndex;
-				timeUsedForBestStartTimeFrame = totalTimeUsedThisHarmonic;
-			}
-			if (totalTimeUsedThisHarmonic < bestTimeUsedFound)
-			{
-				bestTimeUsedFound = totalTimeUsedThisHarmonic;
-				bestTimeUsedFrame = frameIndex;
-			}
-		}
+		if (_myTT->_largeIsoch[frameIndex])
+			largeIsochMask |= (1 << frameIndex);
 	}
 	
-	if (!foundStartTimeCandidate)
+	request.FSBytesUsed = _FSBytesUsed;
+	request.maxPacketSize = (_epType == kUSBIsoc) ? (UInt16)_isochEP->maxPacketSize : _intEP->_maxPacketSize;
+	request.period = _period;
+	request.isochronous = (_epType == kUSBIsoc);
+	request.input = (_direction == kUSBIn);
+	
+	if (!EHCIScheduleFindSplitFrame(&request, tempStartTimes, _myTT->_FStimeUsed, largeIsochMask, hsLoad, kEHCISchedulePolicyBestFit, &startFrame, &startTime))
 	{
-		USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - using Start Time entry found - _startFrame(%d) _startTime(%d)", this, (int)_startFrame, _startTime);
+		USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - no room on the TT for _FSBytesUsed(%d) _period(%d)", this, _FSBytesUsed, _period);
 		_startTime = 0;
 		_startFrame = kEHCIMaxPollingInterval;			// this is invalid
 		return kIOReturnNoBandwidth;
 	}
-	else
-	{
-		// now see if we got anything
-		if (bestStartTimeFound <= bestTimeUsedFound)
-		{
-			_startTime = bestStartTimeFound;
-			_startFrame = bestStartTimeFrame;
-			USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - using Start Time entry found - _startFrame(%d) _startTime(%d)", this, (int)_startFrame, _startTime);
-		}
-		else
-		{
-			_startTime = bestTimeUsedFound;
-			_startFrame = bestTimeUsedFrame;
-			USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - using Start Frame entry found - _startFrame(%d) _startTime(%d)", this, (int)_startFrame, _startTime);
-		}
-	}
+	
+	_startFrame = startFrame;
+	_startTime = startTime;
+	USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCISplitPeriodicEndpoint[%p]::FindStartFrameAndStartTime - using _startFrame(%d) _startTime(%d)", this, (int)_startFrame, _startTime);
 				
 	return kIOReturnSuccess;
 }
@@ -107,6 +107,9 @@ AppleUSBEHCI::PollInterrupts(IOUSBCompletionAction safeAction)
 		{
 			// Check to see if we are resuming the port
 			RHCheckForPortResumes();
+
+			// and let the root hub see the change now instead of on the next timer tick
+			RootHubStatusChangeInterrupt();
 		}
 		else
 		{
@@ -160,7 +163,10 @@ AppleUSBEHCI::InterruptHandler(OSObject *owner, IOInterruptEventSource * /*sourc
         // USBLog("EHCIUIM -- InterruptHandler Unimplimented not finishPending\n");
     }
 	
+	// pipes with a batch completion get everything scavengeCompletedTransactions finds in one call
+	controller->BeginCompletionBatch();
     controller->PollInterrupts();
+	controller->EndCompletionBatch();
 }
 
 
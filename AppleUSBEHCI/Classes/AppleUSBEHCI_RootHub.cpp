@@ -859,6 +859,7 @@ AppleUSBEHCI::EHCIRootHubResetPort (UInt16 port)
 	
     USBLog(5, "AppleUSBEHCI[%p]::EHCIRootHubResetPort - Setting port (%d) reset change bit to 0x%x.",  this, (uint32_t)port, (uint32_t)value);
     _rhChangeBits[port-1] |= kHubPortBeingReset;
+	RootHubSoftwareStatusChange();								// the controller has no reset change interrupt
 	
     if ( (portSC & kEHCIPortSC_Enabled) == 0)
     {
@@ -1512,6 +1513,7 @@ AppleUSBEHCI::RHCompleteResumeOnAllPorts()
 		{
 			_rhPortBeingResumed[portIndex] = false;
 			_rhChangeBits[portIndex] |= kHubPortSuspend;									// mark the suspend bit as having changed
+			RootHubSoftwareStatusChange();
 		}
 	}
 	
@@ -229,6 +229,8 @@ AppleUSBEHCI::UIMDeleteEndpoint(short functionAddress, short endpointNumber, sho
         return SimulateEDDelete( endpointNumber, direction);
     }
 	
+	AppleUSBDiagnostics::EndpointRemoved(_UIMDiagnostics.endpoints, functionAddress, endpointNumber, direction);
+	
     piEP = OSDynamicCast(AppleEHCIIsochEndpoint, FindIsochronousEndpoint(functionAddress, endpointNumber, direction, NULL));
     if (piEP)
 	{
@@ -971,6 +973,9 @@ AppleUSBEHCI::allocateTDs(AppleEHCIQueueHead* pEDQueue, IOUSBCommand *command, I
 				pTD->pShared->flags = HostToUSBLong(flags);
 				pTD->multiXferTransaction = command->GetMultiTransferTransaction();
 				pTD->finalXferInTransaction = command->GetFinalTransferInTransaction();
+				pTD->submitTime = mach_absolute_time();
+				if (!pTD->multiXferTransaction || pTD->finalXferInTransaction)
+					AppleUSBDiagnostics::EndpointSubmitted(_UIMDiagnostics.endpoints, &_UIMDiagnostics.overFlowEndpointCount, command->GetAddress(), command->GetEndpoint(), command->GetDirection());
 				if ((pEDQueue->_queueType == kEHCITypeControl) || (pEDQueue->_queueType == kEHCITypeBulk))
 					_controlBulkTransactionsOut++;
 				//if (trace)printTD(pTD);
@@ -1009,6 +1014,9 @@ AppleUSBEHCI::allocateTDs(AppleEHCIQueueHead* pEDQueue, IOUSBCommand *command, I
 		pTD->callbackOnTD = true;
 		pTD->multiXferTransaction = command->GetMultiTransferTransaction();
 		pTD->finalXferInTransaction = command->GetFinalTransferInTransaction();
+		pTD->submitTime = mach_absolute_time();
+		if (!pTD->multiXferTransaction || pTD->finalXferInTransaction)
+			AppleUSBDiagnostics::EndpointSubmitted(_UIMDiagnostics.endpoints, &_UIMDiagnostics.overFlowEndpointCount, command->GetAddress(), command->GetEndpoint(), command->GetDirection());
 		if ((pEDQueue->_queueType == kEHCITypeControl) || (pEDQueue->_queueType == kEHCITypeBulk))
 			_controlBulkTransactionsOut++;
 		pTD->logicalBuffer = CBP;
@@ -1054,6 +1062,7 @@ AppleUSBEHCI::allocateTDs(AppleEHCIQueueHead* pEDQueue, IOUSBCommand *command, I
     pTDLast->callbackOnTD = pTD1->callbackOnTD;
     pTDLast->multiXferTransaction = pTD1->multiXferTransaction;
     pTDLast->finalXferInTransaction = pTD1->finalXferInTransaction;
+    pTDLast->submitTime = pTD1->submitTime;
     //pTDLast->bufferSize = pTD1->bufferSize;
     pTDLast->traceFlag = pTD1->traceFlag;
     pTDLast->pLogicalNext = pTD1->pLogicalNext;
@@ -1380,7 +1389,17 @@ AppleUSBEHCI::EHCIUIMDoDoneQueueProcessing(EHCIGeneralTransferDescriptorPtr pHCD
 						pHCDoneTD->callbackOnTD = false;
 						
 						_UIMDiagnostics.totalBytes -= bufferSizeRemaining;
+						
+						if (!pHCDoneTD->multiXferTransaction || pHCDoneTD->finalXferInTransaction)
+						{
+							IOUSBCommand	*command = pHCDoneTD->command;
+							UInt32			reqCount = (UInt32)command->GetReqCount();
 							
+							// the command may be reused by the completion, so record it first
+							AppleUSBDiagnostics::EndpointCompleted(_UIMDiagnostics.endpoints, &_UIMDiagnostics.overFlowEndpointCount, command->GetAddress(), command->GetEndpoint(), command->GetDirection(),
+																   pHCDoneTD->submitTime, reqCount, reqCount > bufferSizeRemaining ? reqCount - bufferSizeRemaining : 0, errStatus);
+						}
+						
 						Complete(completion, errStatus, bufferSizeRemaining);
 						
 						if(pHCDoneTD->pQH)
@@ -4205,6 +4224,9 @@ AppleUSBEHCI::AddIsocFramesToSchedule(AppleEHCIIsochEndpoint	*pEP)
 			IOSimpleLockUnlock(_isochScheduleLock);
 			// OK to call USBLog, now that preemption is reenabled
 			USBLog(7, "AppleUSBEHCI[%p]::AddIsocFramesToSchedule - calling thread_call_enter1(_returnIsochDoneQueueThread) scheduledTDs = %d, deferredTDs = %d", this, (uint32_t)pEP->scheduledTDs, (uint32_t)pEP->deferredTDs);
+			// endpoints with real time completions don't need the thread call
+			if ( QueueRealTimeIsochCompletion(pEP) )
+				return;
 			bool alreadyQueued = thread_call_enter1(_returnIsochDoneQueueThread, (thread_call_param_t) pEP);
 			if ( alreadyQueued )
 			{
@@ -5113,11 +5135,12 @@ AppleUSBEHCI::AllocateInterruptBandwidth(AppleEHCIQueueHead	*pED, AppleUSBEHCITT
 	int			index;
 	UInt8		startFrame = 0xFF;
 	UInt8		startuFrame = 0xFF;						// this is unsigned, but the permanent one can be signed
-	UInt16		minBandwidthUsed = 0xFFFF;
+	UInt32		phase;
 	bool		undoAllocation = false;
 	IOReturn	err;
 	UInt16		realPollingRate, realMPS, FSbytesNeeded, HSallocation;
 	UInt32		splitFlags;
+	EHCIScheduleHSLoad	hsLoad;
 	
 	USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCI[%p]::AllocateInterruptBandwidth - pED[%p] _speed(%d)", this, pED, (int)pED->_speed);
 
@@ -5179,20 +5202,14 @@ AppleUSBEHCI::AllocateInterruptBandwidth(AppleEHCIQueueHead	*pED, AppleUSBEHCITT
 		// if _pollingRate is 2 (poll every other uFrame) we could use[0][0] or [0][1], but it has to be one of those
 		// if _polingRate is 8 (once per ms) then we could use any microframe in frame [0]
 		// if _pollingRate is 64 (once every 8 ms) then we have 64 microframes to look at, etc.
-		for (index = 0; index < pED->_pollingRate; index++)
-		{
-			if (_periodicBandwidthUsed[index / kEHCIuFramesPerFrame][index % kEHCIuFramesPerFrame] < minBandwidthUsed)
-			{
-				startFrame = index / kEHCIuFramesPerFrame;
-				startuFrame = index % kEHCIuFramesPerFrame;
-				minBandwidthUsed = _periodicBandwidthUsed[startFrame][startuFrame];
-			}
-		}
-		if ((startFrame == 0xFF) || (startuFrame == 0xFF))
+		// EHCIScheduleFindHSPhase checks every uFrame each of those would use and picks the one leaving the lowest peak
+		if (!EHCIScheduleFindHSPhase(_periodicBandwidthUsed, pED->_pollingRate, HSallocation, kEHCIHSMaxPeriodicBytesPeruFrame, kEHCISchedulePolicyBestFit, &phase))
 		{
 			USBLog(1, "AppleUSBEHCI[%p]::AllocateInterruptBandwidth - could not find bandwidth", this);
 			return kIOReturnNoBandwidth;
 		}
+		startFrame = phase / kEHCIuFramesPerFrame;
+		startuFrame = phase % kEHCIuFramesPerFrame;
 		USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCI[%p]::AllocateInterruptBandwidth - using startFrame[%d] startuFrame[%d]", this, startFrame, startuFrame);
 		pED->_startFrame = startFrame;
 		pED->_startuFrame = startuFrame;
@@ -5270,7 +5287,8 @@ AppleUSBEHCI::AllocateInterruptBandwidth(AppleEHCIQueueHead	*pED, AppleUSBEHCITT
 		}
 		
 		// this call gets the allocation needed on the Transaction Translator (the FS or LS parts)
-		err = pTT->AllocatePeriodicBandwidth(pED->_pSPE);
+		GetHSSplitLoad(pED->_pSPE, &hsLoad);
+		err = pTT->AllocatePeriodicBandwidth(pED->_pSPE, &hsLoad);
 		if (err)
 		{
 			USBLog (1, "AppleUSBEHCI[%p]::AllocateInterruptBandwidth - pTT->AllocatePeriodicBandwidth returned err(%p)", this, (void*)(UInt64)err);
@@ -5399,13 +5417,14 @@ AppleUSBEHCI::ReturnInterruptBandwidth(AppleEHCIQueueHead	*pED)
 IOReturn
 AppleUSBEHCI::AllocateIsochBandwidth(AppleEHCIIsochEndpoint	*pEP, AppleUSBEHCITTInfo *pTT)
 {
-	UInt16		minBandwidthUsed = 0xFFFF;
+	UInt32		phase;
 	UInt8		startFrame = 0xFF;
 	UInt8		startuFrame = 0xFF;						// this is unsigned, but the permanent one can be signed
 	bool		undoAllocation = false;
 	UInt16		FSbytesNeeded, HSallocation;
 	int			index;
 	IOReturn	err;
+	EHCIScheduleHSLoad	hsLoad;
 	
 	USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCI[%p]::AllocateIsochBandwidth - pEP[%p] _speed(%d) maxPacketSize(%d)", this, pEP, (int)pEP->_speed, (int)pEP->maxPacketSize);
 	
@@ -5441,20 +5460,13 @@ AppleUSBEHCI::AllocateIsochBandwidth(AppleEHCIIsochEndpoint	*pEP, AppleUSBEHCITT
 		// if _pollingRate is 2 (poll every other uFrame) we could use[0][0] or [0][1], but it has to be one of those
 		// if _polingRate is 8 (once per ms) then we could use any microframe in frame [0]
 		// if _pollingRate is 64 (once every 8 ms) then we have 64 microframes to look at, etc.
-		for (index = 0; index < (int)pEP->interval; index++)
-		{
-			if (_periodicBandwidthUsed[index / kEHCIuFramesPerFrame][index % kEHCIuFramesPerFrame] < minBandwidthUsed)
-			{
-				startFrame = index / kEHCIuFramesPerFrame;
-				startuFrame = index % kEHCIuFramesPerFrame;
-				minBandwidthUsed = _periodicBandwidthUsed[startFrame][startuFrame];
-			}
-		}
-		if ((startFrame == 0xFF) || (startuFrame == 0xFF))
+		if (!EHCIScheduleFindHSPhase(_periodicBandwidthUsed, pEP->interval, HSallocation, kEHCIHSMaxPeriodicBytesPeruFrame, kEHCISchedulePolicyBestFit, &phase))
 		{
 			USBLog(1, "AppleUSBEHCI[%p]::AllocateIsochBandwidth - could not find bandwidth", this);
 			return kIOReturnNoBandwidth;
 		}
+		startFrame = phase / kEHCIuFramesPerFrame;
+		startuFrame = phase % kEHCIuFramesPerFrame;
 		USBLog(gEHCIBandwidthLogLevel, "AppleUSBEHCI[%p]::AllocateIsochBandwidth - using startFrame[%d] startuFrame[%d]", this, startFrame, startuFrame);
 		pEP->_startFrame = startFrame;
 		pEP->_startuFrame = startuFrame;
@@ -5531,7 +5543,8 @@ AppleUSBEHCI::AllocateIsochBandwidth(AppleEHCIIsochEndpoint	*pEP, AppleUSBEHCITT
 	}
 	
 	// this call gets the allocation needed on the Transaction Translator (the FS or LS parts)
-	err = pTT->AllocatePeriodicBandwidth(pEP->pSPE);
+	GetHSSplitLoad(pEP->pSPE, &hsLoad);
+	err = pTT->AllocatePeriodicBandwidth(pEP->pSPE, &hsLoad);
 	if (err)
 	{
 		USBLog (gEHCIBandwidthLogLevel, "AppleUSBEHCI[%p]::AllocateIsochBandwidth - pTT->AllocatePeriodicBandwidth returned err(%p)", this, (void*)(UInt64)err);
@@ -5654,6 +5667,7 @@ AppleUSBEHCI::AllocateHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint
 	SInt8		startuFrame;
 	UInt8		lastCSuFrame;							// last uFrame needed for a CS
 	UInt16		SSoverhead, CSoverhead;					// number of bytes of overhead for each of these
+	EHCIScheduleHSLoad	hsLoad;
 	bool		undoAllocation = false;
 	UInt16		realMPS;
 	IOReturn	err;
@@ -5664,18 +5678,9 @@ AppleUSBEHCI::AllocateHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint
 	pSPE->_SSflags = 0;
 	pSPE->_CSflags = 0;
 	
-	if (pSPE->_direction == kUSBOut)
-	{
-		// OUT endpoints
-		SSoverhead = kEHCIHSSplitSameDirectionOverhead + kEHCIHSDataSameDirectionOverhead + _controllerThinkTime;
-		CSoverhead = (pSPE->_epType == kUSBInterrupt) ? kEHCIHSSplitChangeDirectionOverhead + kEHCIHSHandshakeOverhead + _controllerThinkTime : 0;
-	}
-	else
-	{
-		// IN endpoints
-		SSoverhead = kEHCIHSSplitSameDirectionOverhead + _controllerThinkTime;
-		CSoverhead = kEHCIHSSplitChangeDirectionOverhead + kEHCIHSDataChangeDirectionOverhead + _controllerThinkTime;
-	}
+	GetHSSplitLoad(pSPE, &hsLoad);
+	SSoverhead = hsLoad.SSoverhead;
+	CSoverhead = hsLoad.CSoverhead;
 	
 	if (pSPE->_epType == kUSBIsoc)
 	{
@@ -5860,6 +5865,7 @@ AppleUSBEHCI::ReturnHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint *
 	UInt8		lastCSuFrame;							// last uFrame needed for a CS
 	UInt16		bytesToReturn;
 	UInt16		SSoverhead, CSoverhead;					// number of bytes of overhead for each of these
+	EHCIScheduleHSLoad	hsLoad;
 	int			frameNum, uFrameNum;
 	int			effectiveFrame, effectiveuFrame;
 	int			hostuFrame, index;
@@ -5867,18 +5873,9 @@ AppleUSBEHCI::ReturnHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint *
 	UInt16		realMPS;
 	IOReturn	err;
 	
-	if (pSPE->_direction == kUSBOut)
-	{
-		// OUT endpoints
-		SSoverhead = kEHCIHSSplitSameDirectionOverhead + kEHCIHSDataSameDirectionOverhead + _controllerThinkTime;
-		CSoverhead = (pSPE->_epType == kUSBInterrupt) ? kEHCIHSSplitChangeDirectionOverhead + kEHCIHSHandshakeOverhead + _controllerThinkTime : 0;
-	}
-	else
-	{
-		// IN endpoints
-		SSoverhead = kEHCIHSSplitSameDirectionOverhead + _controllerThinkTime;
-		CSoverhead = kEHCIHSSplitChangeDirectionOverhead + kEHCIHSDataChangeDirectionOverhead + _controllerThinkTime;
-	}
+	GetHSSplitLoad(pSPE, &hsLoad);
+	SSoverhead = hsLoad.SSoverhead;
+	CSoverhead = hsLoad.CSoverhead;
 
 	if (pSPE->_epType == kUSBIsoc)
 	{
@@ -5983,6 +5980,29 @@ AppleUSBEHCI::ReturnHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint *
 
 
 
+// The HS bus as a split endpoint sees it, for the placement code in EHCIPeriodicSchedule.h and the SS/CS overheads
+void
+AppleUSBEHCI::GetHSSplitLoad(AppleUSBEHCISplitPeriodicEndpoint *pSPE, EHCIScheduleHSLoad *hsLoad)
+{
+	hsLoad->used = _periodicBandwidthUsed;
+	hsLoad->limit = kEHCIHSMaxPeriodicBytesPeruFrame;
+	
+	if (pSPE->_direction == kUSBOut)
+	{
+		// OUT endpoints
+		hsLoad->SSoverhead = kEHCIHSSplitSameDirectionOverhead + kEHCIHSDataSameDirectionOverhead + _controllerThinkTime;
+		hsLoad->CSoverhead = (pSPE->_epType == kUSBInterrupt) ? kEHCIHSSplitChangeDirectionOverhead + kEHCIHSHandshakeOverhead + _controllerThinkTime : 0;
+	}
+	else
+	{
+		// IN endpoints
+		hsLoad->SSoverhead = kEHCIHSSplitSameDirectionOverhead + _controllerThinkTime;
+		hsLoad->CSoverhead = kEHCIHSSplitChangeDirectionOverhead + kEHCIHSDataChangeDirectionOverhead + _controllerThinkTime;
+	}
+}
+
+
+
 IOReturn
 AppleUSBEHCI::AdjustSPEs(AppleUSBEHCISplitPeriodicEndpoint *pSPEChanged, bool added)
 {
@@ -39,9 +39,11 @@
 #include "../../IOUSBFamily/Headers/IOUSBControllerListElement.h"
 #include "../../IOUSBFamily/Headers/USB.h"
 #include "../../IOUSBFamily/Headers/USBHub.h"
+#include "../../IOUSBFamily/Headers/AppleUSBDiagnostics.h"
 
 #include "USBEHCI.h"
 #include "USBEHCIRootHub.h"
+#include "EHCIPeriodicSchedule.h"
 
 #define MICROSECOND		(1)
 #define MILLISECOND		(1000)
@@ -90,6 +92,7 @@ struct EHCIGeneralTransferDescriptor
 	bool									callbackOnTD;			// this TD kicks off a completion callback
 	bool									multiXferTransaction;	// this is a multi transfer (i.e. control) Xaction
 	bool									finalXferInTransaction;	// this is the final transfer (i.e. the status phase) Xaction
+	UInt64									submitTime;				// mach_absolute_time() when a callbackOnTD TD was queued, for the endpoint statistics
     USBPhysicalAddress32					pPhysical;
     EHCIGeneralTransferDescriptorPtr		pLogicalNext;
     void*									logicalBuffer;			// used for UnlockMemory
@@ -156,27 +159,8 @@ class AppleUSBEHCI : public IOUSBControllerV3
 
     OSDeclareDefaultStructors(AppleUSBEHCI)
 
-	// Structure used for statistics for UIMs.
-	typedef struct  
-	{
-		UInt64			lastNanosec;
-		UInt64			totalBytes;
-		UInt64			prevBytes;
-		UInt32			acessCount;
-		UInt32			totalErrors;
-		UInt32			prevErrors;
-		UInt32			timeouts;
-		UInt32			prevTimeouts;
-		UInt32			resets;
-		UInt32			prevResets;
-		UInt32			recoveredErrors;
-		UInt32			prevRecoveredErrors;
-		UInt32			errors2Strikes;
-		UInt32			prevErrors2Strikes;
-		UInt32			errors3Strikes;
-		UInt32			prevErrors3Strikes;
-		UInt32			controlBulkTxOut;
-	} UIMDiagnostics;
+	// Structure used for statistics for UIMs, shared with the family's AppleUSBDiagnostics which publishes it.
+	typedef AppleUSBDiagnostics::UIMDiagnostics		UIMDiagnostics;
 	
 private:
     void							showRegisters(UInt32 level, const char *s);
@@ -427,6 +411,7 @@ protected:
 	
 	IOReturn			AllocateHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE);
 	IOReturn			ReturnHSPeriodicSplitBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE);
+	void				GetHSSplitLoad(AppleUSBEHCISplitPeriodicEndpoint *pSPE, EHCIScheduleHSLoad *hsLoad);
 	
 	IOReturn			AdjustSPEs(AppleUSBEHCISplitPeriodicEndpoint *pSPEChanged, bool added);
 
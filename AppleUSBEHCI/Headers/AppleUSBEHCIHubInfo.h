@@ -47,7 +47,7 @@ public:
 	virtual void release() const;
 
 	// AppleUSBEHCITTInfo methods 
-	IOReturn	AllocatePeriodicBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE);
+	IOReturn	AllocatePeriodicBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE, const EHCIScheduleHSLoad *hsLoad);
 	IOReturn	DeallocatePeriodicBandwidth(AppleUSBEHCISplitPeriodicEndpoint *pSPE);
 	
 	// this methods help track time reserved for IN bytes after periodic CS tokens
@@ -119,7 +119,7 @@ public:
 	// debugging
 	void		print(int level);
 	
-	IOReturn	FindStartFrameAndStartTime(void);
+	IOReturn	FindStartFrameAndStartTime(const EHCIScheduleHSLoad *hsLoad);
 	IOReturn	CalculateAllFrameStartTimes(UInt16 *startTimes);
 	IOReturn	SetStartFrameAndStartTime(UInt8 startFrame, UInt16 startTime);
 	IOReturn	CheckPlacementBefore(AppleUSBEHCISplitPeriodicEndpoint *afterEP);
@@ -0,0 +1,402 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _EHCIPERIODICSCHEDULE_H
+#define _EHCIPERIODICSCHEDULE_H
+
+#include <libkern/OSTypes.h>
+#include <string.h>
+
+//================================================================================================
+//
+//	Periodic schedule placement
+//
+//	The placement decisions made by AllocateInterruptBandwidth, AllocateIsochBandwidth and
+//	AppleUSBEHCISplitPeriodicEndpoint::FindStartFrameAndStartTime.  They only look at the
+//	bandwidth tables that are passed in, so a user space driver can feed them a mix of devices
+//	and compare the two policies:
+//
+//	kEHCISchedulePolicyFirstFit is the original placement.  HS endpoints go in the phase whose
+//	first microframe is the least used, without looking at the later instances of that phase,
+//	and split endpoints go in the harmonic with the earliest start time (or least total time).
+//
+//	kEHCISchedulePolicyBestFit looks at every instance of every candidate.  A candidate is only
+//	taken if all of its instances fit, and among those the one leaving the lowest peak load wins.
+//	The peak is what matters because the endpoints that get kIOReturnNoBandwidth are the short
+//	interval ones (audio isoch, every frame) which need room in the fullest frame.  For split
+//	endpoints the HS microframes the start- and complete-splits will land in are also checked,
+//	and a harmonic whose splits fit on the HS bus is preferred over one whose splits don't.
+//
+//	The dimensions below must match kEHCIMaxPollingInterval, kEHCIuFramesPerFrame,
+//	kEHCIFSMinStartTime, kEHCIFSMaxFrameBytes, kEHCIFSLargeIsochPacket and
+//	kEHCIFSBytesPeruFrame in USBEHCI.h, which this file does not include.
+//
+//================================================================================================
+
+enum
+{
+	kEHCIScheduleFrames					= 32,
+	kEHCIScheduleuFrames				= 8,
+	kEHCIScheduleSlots					= (kEHCIScheduleFrames * kEHCIScheduleuFrames),
+	kEHCIScheduleFSMinStartTime			= 36,
+	kEHCIScheduleFSMaxFrameBytes		= 1157,
+	kEHCIScheduleFSLargeIsochPacket		= 579,
+	kEHCIScheduleFSBytesPeruFrame		= 188,
+	kEHCIScheduleMaxSplituFrames		= 16
+};
+
+enum
+{
+	kEHCISchedulePolicyFirstFit			= 0,
+	kEHCISchedulePolicyBestFit			= 1
+};
+
+typedef UInt16	EHCIScheduleHSTable[kEHCIScheduleFrames][kEHCIScheduleuFrames];
+
+// The HS bus as seen by a split endpoint: its bandwidth table and the per-token overheads
+typedef struct EHCIScheduleHSLoad
+{
+	const UInt16 (*		used)[kEHCIScheduleuFrames];		// _periodicBandwidthUsed
+	UInt16				limit;								// kEHCIHSMaxPeriodicBytesPeruFrame
+	UInt16				SSoverhead;
+	UInt16				CSoverhead;
+} EHCIScheduleHSLoad;
+
+typedef struct EHCIScheduleSplitRequest
+{
+	UInt16				FSBytesUsed;
+	UInt16				maxPacketSize;
+	UInt8				period;								// in frames
+	bool				isochronous;
+	bool				input;
+} EHCIScheduleSplitRequest;
+
+// What a split endpoint puts on the HS bus in one frame. uFrame is relative to the frame and may be -1 (the
+// last microframe of the previous frame) or 8 and up (the next frame), exactly as in AllocateHSPeriodicSplitBandwidth
+typedef struct EHCIScheduleSplitFootprint
+{
+	UInt8				numSS;
+	UInt8				numCS;
+	UInt8				count;
+	SInt8				uFrame[kEHCIScheduleMaxSplituFrames];
+	UInt16				bytes[kEHCIScheduleMaxSplituFrames];
+} EHCIScheduleSplitFootprint;
+
+//================================================================================================
+//	High speed endpoints
+//================================================================================================
+
+// Picks the microframe (0 .. interval - 1, in the 256 microframe schedule) for a HS endpoint polled every interval
+// microframes that needs bytes in each one.  Returns false if the policy found no place for it.
+static inline bool
+EHCIScheduleFindHSPhase(const UInt16 used[][kEHCIScheduleuFrames], UInt32 interval, UInt16 bytes, UInt16 limit, UInt32 policy, UInt32 *phaseOut)
+{
+	UInt32		phase;
+	UInt32		slot;
+	UInt32		bestPhase = kEHCIScheduleSlots;
+	UInt32		bestPeak = 0xFFFFFFFF;
+	UInt32		bestTotal = 0xFFFFFFFF;
+
+	if ( interval == 0 )
+		interval = 1;
+	if ( interval > kEHCIScheduleSlots )
+		interval = kEHCIScheduleSlots;
+
+	for ( phase = 0; phase < interval; phase++ )
+	{
+		UInt32	peak = 0;
+		UInt32	total = 0;
+
+		if ( policy == kEHCISchedulePolicyFirstFit )
+		{
+			peak = used[phase / kEHCIScheduleuFrames][phase % kEHCIScheduleuFrames];
+		}
+		else
+		{
+			for ( slot = phase; slot < kEHCIScheduleSlots; slot += interval )
+			{
+				UInt32	load = used[slot / kEHCIScheduleuFrames][slot % kEHCIScheduleuFrames] + bytes;
+
+				if ( load > peak )
+					peak = load;
+				total += load;
+			}
+			if ( peak > limit )
+				continue;
+		}
+
+		if ( (peak < bestPeak) || ((peak == bestPeak) && (total < bestTotal)) )
+		{
+			bestPhase = phase;
+			bestPeak = peak;
+			bestTotal = total;
+		}
+	}
+
+	if ( bestPhase == kEHCIScheduleSlots )
+		return false;
+
+	*phaseOut = bestPhase;
+	return true;
+}
+
+//================================================================================================
+//	Split endpoints
+//================================================================================================
+
+// Same SS/CS layout as AllocateHSPeriodicSplitBandwidth for an endpoint starting at startTime on the FS bus.  IN data
+// is counted at up to one microframe worth of FS bytes per CS, which is the most that routine can reserve.
+static inline void
+EHCIScheduleSplitFootprintAt(const EHCIScheduleSplitRequest *request, const EHCIScheduleHSLoad *hsLoad, UInt16 startTime, EHCIScheduleSplitFootprint *footprint)
+{
+	SInt32		startuFrame = (startTime / kEHCIScheduleFSBytesPeruFrame) - 1;
+	SInt32		realMPS = (request->maxPacketSize * 7) / 6;
+	SInt32		lastCSuFrame;
+	SInt32		uFrame;
+	SInt32		index;
+
+	if ( request->isochronous )
+	{
+		if ( !request->input )
+		{
+			footprint->numCS = 0;
+			footprint->numSS = request->maxPacketSize ? ((request->maxPacketSize - 1) / kEHCIScheduleFSBytesPeruFrame) + 1 : 1;
+		}
+		else
+		{
+			lastCSuFrame = ((startTime + request->FSBytesUsed) / kEHCIScheduleFSBytesPeruFrame) + 1;
+			footprint->numSS = 1;
+			footprint->numCS = (UInt8)(lastCSuFrame - (startuFrame + 1));
+			if ( lastCSuFrame <= 6 )
+				footprint->numCS += ((startuFrame + 1) == 0) ? 1 : 2;
+			else if ( (lastCSuFrame == 7) && ((startuFrame + 1) != 0) )
+				footprint->numCS++;
+		}
+	}
+	else
+	{
+		footprint->numSS = 1;
+		footprint->numCS = (startuFrame < 5) ? 3 : 2;
+	}
+
+	footprint->count = 0;
+	for ( index = 0, uFrame = startuFrame; (index < footprint->numSS) && (footprint->count < kEHCIScheduleMaxSplituFrames); index++, uFrame++ )
+	{
+		SInt32	data = 0;
+
+		if ( !request->input )
+		{
+			data = realMPS - (kEHCIScheduleFSBytesPeruFrame * index);
+			if ( data > kEHCIScheduleFSBytesPeruFrame )
+				data = kEHCIScheduleFSBytesPeruFrame;
+			if ( data < 0 )
+				data = 0;
+		}
+		footprint->uFrame[footprint->count] = (SInt8)uFrame;
+		footprint->bytes[footprint->count++] = (UInt16)(hsLoad->SSoverhead + data);
+	}
+
+	for ( index = 0, uFrame = startuFrame + footprint->numSS + 1; (index < footprint->numCS) && (footprint->count < kEHCIScheduleMaxSplituFrames); index++, uFrame++ )
+	{
+		SInt32	data = 0;
+
+		if ( request->input )
+			data = (realMPS > kEHCIScheduleFSBytesPeruFrame) ? kEHCIScheduleFSBytesPeruFrame : realMPS;
+
+		footprint->uFrame[footprint->count] = (SInt8)uFrame;
+		footprint->bytes[footprint->count++] = (UInt16)(hsLoad->CSoverhead + data);
+	}
+}
+
+// The highest HS microframe load if the footprint is added in every frame of the harmonic starting at firstFrame
+static inline UInt32
+EHCIScheduleSplitHSPeak(const EHCIScheduleHSLoad *hsLoad, const EHCIScheduleSplitFootprint *footprint, UInt32 firstFrame, UInt32 period)
+{
+	UInt16		added[kEHCIScheduleFrames][kEHCIScheduleuFrames];
+	UInt32		peak = 0;
+	UInt32		frame;
+	UInt32		i;
+
+	bzero(added, sizeof(added));
+	for ( frame = firstFrame; frame < kEHCIScheduleFrames; frame += period )
+	{
+		for ( i = 0; i < footprint->count; i++ )
+		{
+			SInt32	uFrame = footprint->uFrame[i];
+			UInt32	effectiveFrame = frame;
+
+			if ( uFrame < 0 )
+			{
+				effectiveFrame = (frame > 0) ? frame - 1 : kEHCIScheduleFrames - 1;
+				uFrame = kEHCIScheduleuFrames - 1;
+			}
+			else if ( uFrame >= kEHCIScheduleuFrames )
+			{
+				effectiveFrame = (frame + (uFrame / kEHCIScheduleuFrames)) % kEHCIScheduleFrames;
+				uFrame = uFrame % kEHCIScheduleuFrames;
+			}
+			added[effectiveFrame][uFrame] += footprint->bytes[i];
+		}
+	}
+
+	for ( frame = 0; frame < kEHCIScheduleFrames; frame++ )
+		for ( i = 0; i < kEHCIScheduleuFrames; i++ )
+			if ( added[frame][i] && ((UInt32)hsLoad->used[frame][i] + added[frame][i] > peak) )
+				peak = hsLoad->used[frame][i] + added[frame][i];
+
+	return peak;
+}
+
+// Picks the first frame (0 .. period - 1) and FS start time of a split endpoint on its TT.  startTimes[] is where the
+// endpoint would be inserted in each frame (CalculateAllFrameStartTimes), FStimeUsed[] and largeIsochMask (bit n set
+// if frame n already has a large isoch transaction) describe the TT.  hsLoad may be NULL, in which case only the TT
+// is considered.  Returns false if the endpoint doesn't fit on the TT.
+static inline bool
+EHCIScheduleFindSplitFrame(const EHCIScheduleSplitRequest *request, const UInt16 startTimes[], const UInt16 FStimeUsed[], UInt32 largeIsochMask, const EHCIScheduleHSLoad *hsLoad, UInt32 policy, UInt8 *startFrameOut, UInt16 *startTimeOut)
+{
+	UInt32		period = request->period ? request->period : 1;
+	UInt32		frameIndex;
+	bool		found = false;
+
+	// first fit state
+	UInt32		bestStartTimeFound = kEHCIScheduleFSMinStartTime;
+	UInt32		bestTimeUsedFound = kEHCIScheduleFSMinStartTime;
+	UInt32		bestStartTimeFrame = kEHCIScheduleFrames;
+	UInt32		bestTimeUsedFrame = kEHCIScheduleFrames;
+
+	// best fit state
+	UInt32		bestFrame = kEHCIScheduleFrames;
+	UInt32		bestStartTime = 0;
+	UInt32		bestHSFits = 0;
+	UInt32		bestFSPeak = 0xFFFFFFFF;
+	UInt32		bestHSPeak = 0xFFFFFFFF;
+
+	if ( period > kEHCIScheduleFrames )
+		period = kEHCIScheduleFrames;
+
+	for ( frameIndex = 0; frameIndex < period; frameIndex++ )
+	{
+		UInt32		totalTimeUsedThisHarmonic = 0;
+		UInt32		startTimeThisFrame = kEHCIScheduleFSMinStartTime;
+		UInt32		FSPeak = 0;
+		UInt32		frameIndex2;
+		bool		epWillFit = true;
+
+		for ( frameIndex2 = frameIndex; frameIndex2 < kEHCIScheduleFrames; frameIndex2 += period )
+		{
+			UInt32	tempTimeUsed = FStimeUsed[frameIndex2] + request->FSBytesUsed;
+
+			if ( (request->FSBytesUsed > kEHCIScheduleFSLargeIsochPacket) && (largeIsochMask & (1 << frameIndex2)) )
+				epWillFit = false;
+			else if ( tempTimeUsed > kEHCIScheduleFSMaxFrameBytes )
+				epWillFit = false;
+			else if ( ((UInt32)startTimes[frameIndex2] + request->FSBytesUsed) > kEHCIScheduleFSMaxFrameBytes )
+				epWillFit = false;
+
+			if ( !epWillFit )
+				break;
+
+			totalTimeUsedThisHarmonic += tempTimeUsed;
+			if ( tempTimeUsed > FSPeak )
+				FSPeak = tempTimeUsed;
+			if ( startTimes[frameIndex2] > startTimeThisFrame )
+				startTimeThisFrame = startTimes[frameIndex2];
+		}
+
+		if ( !epWillFit )
+			continue;
+
+		if ( policy == kEHCISchedulePolicyFirstFit )
+		{
+			if ( !found )
+			{
+				bestStartTimeFound = startTimeThisFrame + 1;
+				bestTimeUsedFound = totalTimeUsedThisHarmonic + 1;
+			}
+			if ( startTimeThisFrame < bestStartTimeFound )
+			{
+				bestStartTimeFound = startTimeThisFrame;
+				bestStartTimeFrame = frameIndex;
+			}
+			if ( totalTimeUsedThisHarmonic < bestTimeUsedFound )
+			{
+				bestTimeUsedFound = totalTimeUsedThisHarmonic;
+				bestTimeUsedFrame = frameIndex;
+			}
+		}
+		else
+		{
+			UInt32		HSPeak = 0;
+			UInt32		HSFits = 1;
+
+			if ( hsLoad )
+			{
+				EHCIScheduleSplitFootprint	footprint;
+
+				EHCIScheduleSplitFootprintAt(request, hsLoad, (UInt16)startTimeThisFrame, &footprint);
+				HSPeak = EHCIScheduleSplitHSPeak(hsLoad, &footprint, frameIndex, period);
+				HSFits = (HSPeak <= hsLoad->limit) ? 1 : 0;
+			}
+
+			if ( (bestFrame == kEHCIScheduleFrames) ||
+				 (HSFits > bestHSFits) ||
+				 ((HSFits == bestHSFits) && ((FSPeak < bestFSPeak) ||
+											 ((FSPeak == bestFSPeak) && ((HSPeak < bestHSPeak) ||
+																		 ((HSPeak == bestHSPeak) && (startTimeThisFrame < bestStartTime)))))) )
+			{
+				bestFrame = frameIndex;
+				bestStartTime = startTimeThisFrame;
+				bestHSFits = HSFits;
+				bestFSPeak = FSPeak;
+				bestHSPeak = HSPeak;
+			}
+		}
+		found = true;
+	}
+
+	if ( !found )
+		return false;
+
+	if ( policy == kEHCISchedulePolicyFirstFit )
+	{
+		if ( bestStartTimeFound <= bestTimeUsedFound )
+		{
+			*startFrameOut = (UInt8)bestStartTimeFrame;
+			*startTimeOut = (UInt16)bestStartTimeFound;
+		}
+		else
+		{
+			*startFrameOut = (UInt8)bestTimeUsedFrame;
+			*startTimeOut = (UInt16)bestTimeUsedFound;
+		}
+	}
+	else
+	{
+		*startFrameOut = (UInt8)bestFrame;
+		*startTimeOut = (UInt16)bestStartTime;
+	}
+
+	return true;
+}
+
+#endif /* _EHCIPERIODICSCHEDULE_H */
@@ -44,6 +44,7 @@
 #include <UserNotification/KUNCUserNotifications.h>
 
 #include "AppleUSBIrDA.h"
+#include "IrDACirQueue.h"
 #include "IrDAComm.h"
 #include "IrDAUser.h"
 #include "IrDALog.h"
@@ -526,7 +527,8 @@ QueueStatus AppleUSBIrDADriver::CloseQueue( CirQueue *Queue )
 //
 //      Outputs:    BytesWritten - Number of bytes actually put in the queue.
 //
-//      Desc:       Add an entire buffer to the queue.
+//      Desc:       Add an entire buffer to the queue.  Takes the lock once and lets
+//                  IrDACirQueueAdd copy the data in at most two pieces.
 //
 /****************************************************************************************************/
 
@@ -534,12 +536,14 @@ size_t AppleUSBIrDADriver::AddtoQueue( CirQueue *Queue, UInt8 *Buffer, size_t Si
 {
     size_t      BytesWritten = 0;
 
-    while ( FreeSpaceinQueue( Queue ) && (Size > BytesWritten) )
-    {
-	AddBytetoQueue( Queue, *Buffer++ );
-	BytesWritten++;
-    }
+    require(fPort && fPort->serialRequestLock, Fail);
+    IOLockLock( fPort->serialRequestLock );
 
+    BytesWritten = IrDACirQueueAdd( Queue, Buffer, Size );
+
+    IOLockUnlock( fPort->serialRequestLock );
+
+Fail:
     return BytesWritten;
     
 }/* end AddtoQueue */
@@ -552,21 +556,23 @@ size_t AppleUSBIrDADriver::AddtoQueue( CirQueue *Queue, UInt8 *Buffer, size_t Si
 //
 //      Outputs:    Buffer - Where to put the data, BytesReceived - Number of bytes actually put in Buffer.
 //
-//      Desc:       Get a buffers worth of data from the queue.
+//      Desc:       Get a buffers worth of data from the queue.  Like AddtoQueue this
+//                  takes the lock once, IrDACirQueueRemove copies out in at most two pieces.
 //
 /****************************************************************************************************/
 
 size_t AppleUSBIrDADriver::RemovefromQueue( CirQueue *Queue, UInt8 *Buffer, size_t MaxSize )
 {
     size_t      BytesReceived = 0;
-    UInt8       Value;
     
-    while( (MaxSize > BytesReceived) && (GetBytetoQueue(Queue, &Value) == queueNoError) ) 
-    {
-	*Buffer++ = Value;
-	BytesReceived++;
-    }/* end while */
+    require(fPort && fPort->serialRequestLock, Fail);
+    IOLockLock( fPort->serialRequestLock );
+
+    BytesReceived = IrDACirQueueRemove( Queue, Buffer, MaxSize );
 
+    IOLockUnlock( fPort->serialRequestLock );
+
+Fail:
     return BytesReceived;
     
 }/* end RemovefromQueue */
@@ -1057,6 +1063,9 @@ bool AppleUSBIrDADriver::init( OSDictionary *dict )
     bool    rc;
     
     rc = super::init( dict );
+#if (hasTracing > 0)
+    IrDALogInit(0);                 // matched by the IrDALogFree in free, which runs even if init fails
+#endif
     IOLogIt( (uintptr_t)IrDALogGetInfo(), rc, 'init', "init" );
     XTRACE(kLogInit, 0, rc);
     return rc;
@@ -1560,6 +1569,9 @@ void AppleUSBIrDADriver::free()
     super::free();
     
     XTRACE(kLogFree, 0xffff, 0xffff);
+#if (hasTracing > 0)
+    IrDALogFree();                  // last, the log may go away with us
+#endif
     return;
     
 }/* end free */
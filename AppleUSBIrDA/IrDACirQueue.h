@@ -0,0 +1,87 @@
+/*
+    File:       IrDACirQueue.h
+
+    Contains:   The block copies in and out of the serial side circular queues
+    
+*/
+
+
+#ifndef __IRDACIRQUEUE_H
+#define __IRDACIRQUEUE_H
+
+#include <string.h>
+#include <libkern/OSTypes.h>
+
+//
+// AddtoQueue and RemovefromQueue move a whole buffer through a CirQueue (see AppleIrDA.h)
+// while holding serialRequestLock once, instead of once per byte.  The copies are templates
+// over the queue type so they only need OSTypes.h, and can be built into a user space test
+// with a stand-in queue.  The caller holds the lock.
+//
+
+//--------------------------------------------------------------------------------
+//      IrDACirQueueAdd
+//
+//      Copies as much of buffer as fits into the queue, in at most two pieces,
+//      up to the end of the ring and then from the start.  Returns the number
+//      of bytes queued.
+//--------------------------------------------------------------------------------
+template <class Q>
+inline size_t IrDACirQueueAdd(Q *queue, const UInt8 *buffer, size_t size)
+{
+    size_t  written = 0;
+    size_t  chunk;
+    
+    if (size > queue->Size - queue->InQueue)
+	size = queue->Size - queue->InQueue;
+	
+    while (written < size) {
+	chunk = (size_t)(queue->End - queue->NextChar);     // room before the wrap
+	if (chunk > size - written)
+	    chunk = size - written;
+	    
+	memcpy(queue->NextChar, buffer + written, chunk);
+	written += chunk;
+	queue->NextChar += chunk;
+	
+	if (queue->NextChar >= queue->End)
+	    queue->NextChar = queue->Start;
+    }
+    queue->InQueue += written;
+    
+    return written;
+}
+
+//--------------------------------------------------------------------------------
+//      IrDACirQueueRemove
+//
+//      Copies up to maxSize bytes out of the queue, in at most two pieces.
+//      Returns the number of bytes taken.
+//--------------------------------------------------------------------------------
+template <class Q>
+inline size_t IrDACirQueueRemove(Q *queue, UInt8 *buffer, size_t maxSize)
+{
+    size_t  received = 0;
+    size_t  chunk;
+    
+    if (maxSize > queue->InQueue)
+	maxSize = queue->InQueue;
+	
+    while (received < maxSize) {
+	chunk = (size_t)(queue->End - queue->LastChar);     // data before the wrap
+	if (chunk > maxSize - received)
+	    chunk = maxSize - received;
+	    
+	memcpy(buffer + received, queue->LastChar, chunk);
+	received += chunk;
+	queue->LastChar += chunk;
+	
+	if (queue->LastChar >= queue->End)
+	    queue->LastChar = queue->Start;
+    }
+    queue->InQueue -= received;
+    
+    return received;
+}
+
+#endif // __IRDACIRQUEUE_H
@@ -477,6 +477,9 @@ AppleUSBOHCI::UIMInitialize(IOService * provider)
 			
 			CheckSleepCapability();
 		}
+		
+		// RHSC is enabled whenever the root hub is running, so it doesn't need to be polled
+		RootHubEnableChangeInterrupts(true);
 		_uimInitialized = true;
 		_myBusState = kUSBBusStateReset;
 		
@@ -859,13 +862,14 @@ AppleUSBOHCI::InterruptInitialize (void)
             pED->pShared->nextED = NULL;	// End of list
             _pInterruptHead[i].pHead = pED;
             _pInterruptHead[i].pHeadPhysical = pED->pPhysical;
-            _pInterruptHead[i].nodeBandwidth = 0;
         }
 		
         if (i < 32)
             ((UInt32 *)_pHCCA)[i] = (UInt32) HostToUSBLong((UInt32) _pInterruptHead[i].pHeadPhysical);
     }
 	
+    bzero(&_interruptTree, sizeof(_interruptTree));
+	
     p = 0;
     q = 32;
     // FIXME? ERIC
@@ -1655,7 +1659,14 @@ AppleUSBOHCI::finishPending()
 UInt32 
 AppleUSBOHCI::GetBandwidthAvailable()
 {
-    return _isochBandwidthAvail;
+	UInt32		isochUsed = kUSBMaxFSIsocEndpointReqCount - _isochBandwidthAvail;
+	UInt32		periodicUsed = isochUsed + OHCITreePeakLoad(&_interruptTree);
+	
+	// Isoch is still only limited by _isochBandwidthAvail, but don't promise what the busiest interrupt frame has taken
+	if (periodicUsed >= kOHCITreePeriodicFrameBytes)
+		return 0;
+	
+    return ((kOHCITreePeriodicFrameBytes - periodicUsed) < _isochBandwidthAvail) ? (kOHCITreePeriodicFrameBytes - periodicUsed) : _isochBandwidthAvail;
 }
 
 
@@ -135,6 +135,10 @@ void AppleUSBOHCI::PollInterrupts(IOUSBCompletionAction safeAction)
             }
         }
 		
+		// a real change - let the root hub see it now instead of on the next timer tick
+		if (_needToReEnableRHSCInterrupt && (_myPowerState == kUSBPowerStateOn))
+			RootHubStatusChangeInterrupt();
+		
 		if (!_needToReEnableRHSCInterrupt)
 		{
 			UInt32	interrupts;
@@ -173,10 +177,12 @@ AppleUSBOHCI::InterruptHandler(OSObject *owner, IOInterruptEventSource * /*sourc
     if (!controller || controller->isInactive() || !controller->_controllerAvailable)
         return;
 	
-    // Finish pending transactions first.
+    // Finish pending transactions first.  Pipes with a batch completion get everything from this pass in one call
     //
+	controller->BeginCompletionBatch();
     controller->finishPending();
     controller->PollInterrupts();
+	controller->EndCompletionBatch();
     controller->_filterInterruptCount = 0;
     
 }
@@ -744,6 +744,9 @@ AppleUSBOHCI::WakeControllerFromDoze(void)
 		USBLog(6, "AppleUSBOHCI[%p]::WakeControllerFromDoze -  we had received a RHSC interrupt, so waiting 21ms before proceeding", this);
 		// Wait for 20  + 1 ms for the OHCI controller to set the change bit in the root hub change register
 		IOSleep(21);
+		
+		// PollInterrupts didn't pass that RHSC on while we were dozing
+		RootHubSoftwareStatusChange();
 	}
 	else
 	{
@@ -462,6 +462,16 @@ AppleUSBOHCI::ClearRootHubPortFeature(UInt16 wValue, UInt16 wIndex)
 		_needToReEnableRHSCInterrupt = false;
 		_pOHCIRegisters->hcInterruptEnable = HostToUSBLong (kOHCIHcInterrupt_MIE | kOHCIHcInterrupt_RHSC);
 		IOSync();
+		
+		// changes which came in while RHSC was masked were acknowledged by the filter and won't interrupt again
+		for (int i = 0; i < _rootHubNumPorts; i++)
+		{
+			if ((USBToHostLong(_pOHCIRegisters->hcRhPortStatus[i]) & kOHCIHcRhPortStatus_Change) != 0)
+			{
+				RootHubSoftwareStatusChange();
+				break;
+			}
+		}
 	}
 	
     return err;
@@ -611,6 +611,7 @@ AppleUSBOHCI::UIMCreateInterruptEndpoint(
     int                                 offset;
     short								originalDirection = direction;
     UInt32								currentToggle = 0;
+    UInt32								treeBytes;
     
     USBLog(5, "AppleUSBOHCI[%p]: UIMCreateInterruptEndpoint ( Addr: %d:%d, max=%d, dir=%d, rate=%d, %s)", this,
            functionAddress, endpointNumber, maxPacketSize,direction,
@@ -671,7 +672,8 @@ AppleUSBOHCI::UIMCreateInterruptEndpoint(
                 pollingRate = 7;
     
     // Do we have room?? if so return with offset equal to location
-    if (DetermineInterruptOffset(pollingRate, maxPacketSize, &offset) == false)
+    treeBytes = OHCITreeEndpointBytes(maxPacketSize, (speed == kUSBDeviceSpeedLow));
+    if (DetermineInterruptOffset(pollingRate, treeBytes, &offset) == false)
         return(kIOReturnNoBandwidth);
     
     USBLog(5, "AppleUSBOHCI[%p]: UIMCreateInterruptEndpoint: offset = %d", this, offset);
@@ -682,7 +684,9 @@ AppleUSBOHCI::UIMCreateInterruptEndpoint(
     if (NULL == pOHCIEndpointDescriptor)
         return(-1);
     
-    _pInterruptHead[offset].nodeBandwidth += maxPacketSize;
+    OHCITreeAdd(&_interruptTree, offset, treeBytes);
+    pOHCIEndpointDescriptor->interruptNode = offset;
+    pOHCIEndpointDescriptor->interruptBytes = treeBytes;
     
 	// Write back the toggle in case we deleted the EP and recreated it
 	pOHCIEndpointDescriptor->pShared->tdQueueHeadPtr |= HostToUSBLong(currentToggle);
@@ -982,6 +986,7 @@ AppleUSBOHCI::UIMDeleteEndpoint(
     AppleOHCIEndpointDescriptorPtr	pEDQueueBack;
     UInt32			hcControl;
     UInt32			something, controlMask;
+    bool			rebalance = false;
     //	UInt32			edDirection;
 
     USBLog(5, "AppleUSBOHCI[%p] UIMDeleteEndpoint: Addr: %d, Endpoint: %d,%d", this, functionAddress,endpointNumber,direction);
@@ -1027,6 +1032,13 @@ AppleUSBOHCI::UIMDeleteEndpoint(
     // remove pointer wraps
     pEDQueueBack->pShared->nextED = pED->pShared->nextED;
     pEDQueueBack->pLogicalNext = pED->pLogicalNext;
+    
+    if (pED->interruptNode >= 0)
+    {
+        OHCITreeRemove(&_interruptTree, pED->interruptNode, pED->interruptBytes);
+        pED->interruptNode = -1;
+        rebalance = true;
+    }
 
     // clear some bit in hcControl
     hcControl = USBToHostLong(_pOHCIRegisters->hcControl);	
@@ -1066,6 +1078,10 @@ AppleUSBOHCI::UIMDeleteEndpoint(
 
     //deallocate ED
     DeallocateED(pED);
+    
+    // What's left may now fit better elsewhere
+    if (rebalance)
+        RebalanceInterruptTree();
        
 	return (kIOReturnSuccess);
 }
@@ -1160,6 +1176,8 @@ AppleUSBOHCI::AddEmptyEndPoint(
 
     
     pOHCIEndpointDescriptor = (AppleOHCIEndpointDescriptorPtr) AllocateED();
+    pOHCIEndpointDescriptor->interruptNode = -1;						// UIMCreateInterruptEndpoint sets these
+    pOHCIEndpointDescriptor->interruptBytes = 0;
     myFunctionAddress = ((UInt32) functionAddress) << kOHCIEDControl_FAPhase;
     myEndpointNumber = ((UInt32) endpointNumber) << kOHCIEDControl_ENPhase;
     myEndpointDirection = ((UInt32) direction) << kOHCIEDControl_DPhase;
@@ -1427,33 +1445,105 @@ AppleUSBOHCI::FindInterruptEndpoint(
 
 bool AppleUSBOHCI::DetermineInterruptOffset(
     UInt32          pollingRate,
-    UInt32          /* reserveBandwidth */,
+    UInt32          reserveBandwidth,
     int             *offset)
 {
-    int num;
+    UInt32	node;
 
-    num = USBToHostLong(_pOHCIRegisters->hcFmNumber) & kOHCIFmNumberMask;
-    if (pollingRate <  1)
+    // This has never refused an endpoint, it only picks where it goes
+    if (!OHCITreeFindNode(&_interruptTree, pollingRate, reserveBandwidth, kOHCITreePolicyLeastLoaded, 0, &node))
     {
         //error condition
         USBError(1,"AppleUSBOHCI::DetermineInterruptOffset pollingRate of 0 -- that's illegal!");
         return(false);
     }
-    else if (pollingRate < 2)
-        *offset = 62;
-    else if (pollingRate < 4)
-        *offset = (num%2) + 60;
-    else if (pollingRate < 8)
-        *offset = (num%4) + 56;
-    else if (pollingRate < 16)
-        *offset = (num%8) + 48;
-    else if (pollingRate < 32)
-        *offset = (num%16) + 32;
-    else
-        *offset = (num%32) + 0;
+    
+    *offset = node;
+    USBLog(6, "AppleUSBOHCI[%p]::DetermineInterruptOffset - rate %d, %d bytes -> node %d, peak frame load now %d", this, (uint32_t)pollingRate, (uint32_t)reserveBandwidth, (int)node, (uint32_t)OHCITreePeakLoad(&_interruptTree));
     return (true);
 }
 
+
+
+// Moves up to kOHCITreeMaxMoves interrupt EDs to other nodes of the same polling interval, as long as each move lowers
+// the load of the busiest frame.  Called when an interrupt ED is deleted, so that the tree doesn't stay lopsided.
+void
+AppleUSBOHCI::RebalanceInterruptTree(void)
+{
+    AppleOHCIEndpointDescriptorPtr	moved[kOHCITreeMaxMoves];
+    int								movedTo[kOHCITreeMaxMoves];
+    int								moves = 0;
+    int								i;
+
+    // The Opti errata parks dummy EDs on the 8ms nodes, so leave that tree alone
+    if (_OptiOn)
+        return;
+    
+    while (moves < kOHCITreeMaxMoves)
+    {
+        AppleOHCIEndpointDescriptorPtr	pED, pEDBack;
+        AppleOHCIEndpointDescriptorPtr	bestED = NULL, bestBack = NULL;
+        UInt32							bestPeak = OHCITreePeakLoad(&_interruptTree);
+        UInt32							bestNode = 0;
+        
+        // The 1ms node (62) has nowhere else to go
+        for (i = 0; i < kOHCITreeNodes - 1; i++)
+        {
+            pEDBack = _pInterruptHead[i].pHead;
+            for (pED = pEDBack->pLogicalNext; pED && (pED != _pInterruptHead[i].pTail); pEDBack = pED, pED = pED->pLogicalNext)
+            {
+                UInt32	node, peak;
+                
+                if ((pED->interruptNode != i) || (USBToHostLong(pED->pShared->flags) & kOHCIEDControl_K))
+                    continue;
+                
+                if (OHCITreeFindMove(&_interruptTree, i, pED->interruptBytes, &node, &peak) && (peak < bestPeak))
+                {
+                    bestED = pED;
+                    bestBack = pEDBack;
+                    bestNode = node;
+                    bestPeak = peak;
+                }
+            }
+        }
+        
+        if (!bestED)
+            break;
+        
+        // Skip and unlink it now, it goes back in once the controller can't be looking at it any more
+        bestED->pShared->flags |= HostToUSBLong(kOHCIEDControl_K);
+        bestBack->pShared->nextED = bestED->pShared->nextED;
+        bestBack->pLogicalNext = bestED->pLogicalNext;
+        
+        OHCITreeRemove(&_interruptTree, bestED->interruptNode, bestED->interruptBytes);
+        OHCITreeAdd(&_interruptTree, bestNode, bestED->interruptBytes);
+        USBLog(5, "AppleUSBOHCI[%p]::RebalanceInterruptTree - moving ED %p from node %d to %d, peak frame load %d", this, bestED, bestED->interruptNode, (int)bestNode, (uint32_t)bestPeak);
+        bestED->interruptNode = bestNode;
+        
+        moved[moves] = bestED;
+        movedTo[moves] = bestNode;
+        moves++;
+    }
+    
+    if (moves == 0)
+        return;
+    
+    // Same wait as UIMDeleteEndpoint, so the controller has finished any frame which still had these EDs linked in
+    IOSleep(2);
+    
+    for (i = 0; i < moves; i++)
+    {
+        AppleOHCIEndpointDescriptorPtr	pHead = _pInterruptHead[movedTo[i]].pHead;
+        
+        moved[i]->pShared->nextED = pHead->pShared->nextED;
+        moved[i]->pLogicalNext = pHead->pLogicalNext;
+        pHead->pLogicalNext = moved[i];
+        pHead->pShared->nextED = HostToUSBLong(moved[i]->pPhysical);
+        moved[i]->pShared->flags &= ~HostToUSBLong(kOHCIEDControl_K);
+    }
+    IOSync();
+}
+
 #pragma mark Debug Output
 void 
 AppleUSBOHCI::printTD(AppleOHCIGeneralTransferDescriptorPtr pTD, int __unused level)
@@ -38,6 +38,7 @@
 
 #include "USBOHCI.h"
 #include "USBOHCIRootHub.h"
+#include "OHCIInterruptTree.h"
 #include "AppleUSBEHCI.h"
 
 /* Convert USBLog to use kprintf debugging */
@@ -85,7 +86,6 @@ struct AppleOHCIIntHeadStruct
     AppleOHCIEndpointDescriptorPtr	pHead;
     AppleOHCIEndpointDescriptorPtr	pTail;
     IOPhysicalAddress			pHeadPhysical;
-    int					nodeBandwidth;
 };
 
 struct AppleOHCIEndpointDescriptorStruct
@@ -96,6 +96,8 @@ struct AppleOHCIEndpointDescriptorStruct
     void*							pLogicalTailP;		
     void*							pLogicalHeadP;
 	bool							pAborting;
+	SInt16							interruptNode;			// _pInterruptHead node this interrupt ED hangs off, -1 for other EDs
+	UInt16							interruptBytes;			// what it was accounted for in _interruptTree
 };
 
 struct AppleOHCIGeneralTransferDescriptorStruct
@@ -166,6 +168,7 @@ protected:
 	Ptr												_pHCCA;					// Pointer to HCCA.
 	IOBufferMemoryDescriptor *						_hccaBuffer;			// Buffer memory descriptor for the HCCA registers
     AppleOHCIIntHead								_pInterruptHead[63];	// ptr to private list of all interrupts heads 			
+    OHCIInterruptTree								_interruptTree;			// worst case load of each _pInterruptHead node
     volatile AppleOHCIEndpointDescriptorPtr			_pIsochHead;			// ptr to Isochronous list head
     volatile AppleOHCIEndpointDescriptorPtr			_pIsochTail;			// ptr to Isochronous list tail
     volatile AppleOHCIEndpointDescriptorPtr			_pBulkHead;				// ptr to Bulk list
@@ -326,6 +329,7 @@ protected:
     bool DetermineInterruptOffset(UInt32          pollingRate,
                             UInt32          reserveBandwidth,
                             int             *offset);
+    void RebalanceInterruptTree(void);
     void ReturnTransactions(
                 AppleOHCIGeneralTransferDescriptorPtr 	transaction,
                 UInt32					tail);
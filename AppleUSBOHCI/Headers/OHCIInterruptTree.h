@@ -0,0 +1,370 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _OHCIINTERRUPTTREE_H
+#define _OHCIINTERRUPTTREE_H
+
+#include <libkern/OSTypes.h>
+
+#ifndef KERNEL
+#include <stdio.h>
+#include <string.h>
+#endif
+
+//================================================================================================
+//
+//	OHCI interrupt tree placement
+//
+//	The 63 nodes of _pInterruptHead as built by AppleUSBOHCI::InterruptInitialize.  Nodes 0-31
+//	are the 32ms leaves the HCCA points at, 32-47 the 16ms nodes, 48-55 the 8ms nodes, 56-59 the
+//	4ms nodes, 60-61 the 2ms nodes and 62 the 1ms node.  Node first + k of a level with period P is
+//	visited in every frame f with (f % P) == k, so the worst case periodic load of frame f is the
+//	sum of one node from each level.
+//
+//	The model keeps the bytes and the number of EDs on each node.  Bytes are FS byte times: the max
+//	packet size plus the transaction overhead, 8 times that for a LS endpoint.
+//
+//	kOHCITreePolicyFrameNumber is the original placement, the node for the current frame number.
+//	kOHCITreePolicyLeastLoaded takes the node whose frames have the lowest peak load once the new
+//	ED is added, then the one with the fewest EDs in its busiest frame.  OHCITreeFindMove() is used
+//	to move EDs to a lighter node of the same period when one is deleted.
+//
+//	Like EHCIPeriodicSchedule.h, everything only looks at the model that is passed in, so it
+//	builds in user space.  OHCITreeSimulate() replays a sequence of creates and deletes against
+//	either policy, and OHCITreePrintComparison() prints the per frame load of both.
+//
+//================================================================================================
+
+enum
+{
+	kOHCITreeNodes					= 63,
+	kOHCITreeFrames					= 32,
+	kOHCITreeLevels					= 6,
+	kOHCITreeFSOverhead				= 13,			// FS interrupt transaction overhead in byte times (USB 2.0 5.7.4)
+	kOHCITreeLSMultiplier			= 8,
+	kOHCITreePeriodicFrameBytes		= 1350,			// 90% of the 1500 byte times in a frame
+	kOHCITreeMaxMoves				= 4				// EDs moved at most for each delete
+};
+
+enum
+{
+	kOHCITreePolicyFrameNumber		= 0,
+	kOHCITreePolicyLeastLoaded		= 1
+};
+
+typedef struct OHCIInterruptTree
+{
+	UInt32				bytes[kOHCITreeNodes];
+	UInt16				count[kOHCITreeNodes];
+} OHCIInterruptTree;
+
+// First node and period of each level, leaves first
+static const UInt8	kOHCITreeLevelFirst[kOHCITreeLevels] = { 0, 32, 48, 56, 60, 62 };
+static const UInt8	kOHCITreeLevelPeriod[kOHCITreeLevels] = { 32, 16, 8, 4, 2, 1 };
+
+static inline UInt32
+OHCITreeEndpointBytes(UInt32 maxPacketSize, bool lowSpeed)
+{
+	return (maxPacketSize + kOHCITreeFSOverhead) * (lowSpeed ? kOHCITreeLSMultiplier : 1);
+}
+
+// The level an ED polled every pollingRate ms goes in, the same rounding down DetermineInterruptOffset always used
+static inline bool
+OHCITreeLevelForRate(UInt32 pollingRate, UInt32 *firstOut, UInt32 *periodOut)
+{
+	UInt32		level;
+
+	if ( pollingRate < 1 )
+		return false;
+
+	for ( level = 0; level < kOHCITreeLevels - 1; level++ )
+	{
+		if ( pollingRate >= kOHCITreeLevelPeriod[level] )
+			break;
+	}
+
+	*firstOut = kOHCITreeLevelFirst[level];
+	*periodOut = kOHCITreeLevelPeriod[level];
+	return true;
+}
+
+static inline void
+OHCITreeLevelOfNode(UInt32 node, UInt32 *firstOut, UInt32 *periodOut)
+{
+	UInt32		level;
+
+	for ( level = kOHCITreeLevels - 1; level > 0; level-- )
+	{
+		if ( node >= kOHCITreeLevelFirst[level] )
+			break;
+	}
+
+	*firstOut = kOHCITreeLevelFirst[level];
+	*periodOut = kOHCITreeLevelPeriod[level];
+}
+
+static inline UInt32
+OHCITreeFrameLoad(const OHCIInterruptTree *tree, UInt32 frame)
+{
+	UInt32		level;
+	UInt32		load = 0;
+
+	for ( level = 0; level < kOHCITreeLevels; level++ )
+		load += tree->bytes[kOHCITreeLevelFirst[level] + (frame % kOHCITreeLevelPeriod[level])];
+
+	return load;
+}
+
+static inline UInt32
+OHCITreeFrameCount(const OHCIInterruptTree *tree, UInt32 frame)
+{
+	UInt32		level;
+	UInt32		count = 0;
+
+	for ( level = 0; level < kOHCITreeLevels; level++ )
+		count += tree->count[kOHCITreeLevelFirst[level] + (frame % kOHCITreeLevelPeriod[level])];
+
+	return count;
+}
+
+static inline UInt32
+OHCITreePeakLoad(const OHCIInterruptTree *tree)
+{
+	UInt32		frame;
+	UInt32		load;
+	UInt32		peak = 0;
+
+	for ( frame = 0; frame < kOHCITreeFrames; frame++ )
+	{
+		load = OHCITreeFrameLoad(tree, frame);
+		if ( load > peak )
+			peak = load;
+	}
+
+	return peak;
+}
+
+static inline void
+OHCITreeAdd(OHCIInterruptTree *tree, UInt32 node, UInt32 bytes)
+{
+	tree->bytes[node] += bytes;
+	tree->count[node]++;
+}
+
+static inline void
+OHCITreeRemove(OHCIInterruptTree *tree, UInt32 node, UInt32 bytes)
+{
+	tree->bytes[node] = (tree->bytes[node] > bytes) ? (tree->bytes[node] - bytes) : 0;
+	if ( tree->count[node] )
+		tree->count[node]--;
+}
+
+// The least loaded node of the level starting at first for an ED needing bytes
+static inline UInt32
+OHCITreeLeastLoadedNode(const OHCIInterruptTree *tree, UInt32 first, UInt32 period, UInt32 bytes)
+{
+	UInt32		k;
+	UInt32		frame;
+	UInt32		bestNode = first;
+	UInt32		bestPeak = 0xFFFFFFFF;
+	UInt32		bestCount = 0xFFFFFFFF;
+
+	for ( k = 0; k < period; k++ )
+	{
+		UInt32	peak = 0;
+		UInt32	count = 0;
+
+		for ( frame = k; frame < kOHCITreeFrames; frame += period )
+		{
+			UInt32	load = OHCITreeFrameLoad(tree, frame) + bytes;
+			UInt32	eds = OHCITreeFrameCount(tree, frame);
+
+			if ( load > peak )
+				peak = load;
+			if ( eds > count )
+				count = eds;
+		}
+
+		if ( (peak < bestPeak) || ((peak == bestPeak) && (count < bestCount)) )
+		{
+			bestNode = first + k;
+			bestPeak = peak;
+			bestCount = count;
+		}
+	}
+
+	return bestNode;
+}
+
+// Picks the node for a new ED polled every pollingRate ms.  frameNumber is only used by kOHCITreePolicyFrameNumber.
+static inline bool
+OHCITreeFindNode(const OHCIInterruptTree *tree, UInt32 pollingRate, UInt32 bytes, UInt32 policy, UInt32 frameNumber, UInt32 *nodeOut)
+{
+	UInt32		first;
+	UInt32		period;
+
+	if ( !OHCITreeLevelForRate(pollingRate, &first, &period) )
+		return false;
+
+	if ( policy == kOHCITreePolicyFrameNumber )
+		*nodeOut = first + (frameNumber % period);
+	else
+		*nodeOut = OHCITreeLeastLoadedNode(tree, first, period, bytes);
+
+	return true;
+}
+
+// Where the ED with bytes on node would go if it was placed again, and the tree's peak load after moving it there.
+// Returns false if it would stay where it is.
+static inline bool
+OHCITreeFindMove(const OHCIInterruptTree *tree, UInt32 node, UInt32 bytes, UInt32 *nodeOut, UInt32 *peakOut)
+{
+	OHCIInterruptTree	moved = *tree;
+	UInt32				first;
+	UInt32				period;
+	UInt32				newNode;
+
+	OHCITreeLevelOfNode(node, &first, &period);
+	if ( period == 1 )
+		return false;
+
+	OHCITreeRemove(&moved, node, bytes);
+	newNode = OHCITreeLeastLoadedNode(&moved, first, period, bytes);
+	if ( newNode == node )
+		return false;
+
+	OHCITreeAdd(&moved, newNode, bytes);
+	*nodeOut = newNode;
+	*peakOut = OHCITreePeakLoad(&moved);
+	return true;
+}
+
+//================================================================================================
+//	Simulation
+//================================================================================================
+
+// One UIMCreateInterruptEndpoint or UIMDeleteEndpoint.  A delete names the create it undoes by its index.
+typedef struct OHCITreeSimOp
+{
+	UInt32				frameNumber;						// hcFmNumber when the call was made
+	UInt16				pollingRate;						// creates only
+	UInt16				maxPacketSize;						// creates only
+	bool				lowSpeed;							// creates only
+	bool				remove;
+	UInt16				create;								// deletes only, index of the create in ops
+} OHCITreeSimOp;
+
+// Replays ops against tree, which should start out empty.  nodes must have room for count entries and gets the
+// node of every create.  With kOHCITreePolicyLeastLoaded each delete is followed by up to kOHCITreeMaxMoves moves
+// exactly as AppleUSBOHCI::RebalanceInterruptTree does them.  Returns the number of EDs moved.
+static inline UInt32
+OHCITreeSimulate(OHCIInterruptTree *tree, const OHCITreeSimOp *ops, UInt32 count, UInt32 policy, SInt16 *nodes)
+{
+	UInt32		i;
+	UInt32		j;
+	UInt32		totalMoves = 0;
+
+	for ( i = 0; i < count; i++ )
+	{
+		const OHCITreeSimOp *	op = &ops[i];
+		UInt32					node;
+
+		nodes[i] = -1;
+		if ( !op->remove )
+		{
+			if ( OHCITreeFindNode(tree, op->pollingRate, OHCITreeEndpointBytes(op->maxPacketSize, op->lowSpeed), policy, op->frameNumber, &node) )
+			{
+				OHCITreeAdd(tree, node, OHCITreeEndpointBytes(op->maxPacketSize, op->lowSpeed));
+				nodes[i] = (SInt16)node;
+			}
+			continue;
+		}
+
+		if ( (op->create >= i) || (nodes[op->create] < 0) )
+			continue;
+
+		OHCITreeRemove(tree, (UInt32)nodes[op->create], OHCITreeEndpointBytes(ops[op->create].maxPacketSize, ops[op->create].lowSpeed));
+		nodes[op->create] = -1;
+
+		if ( policy != kOHCITreePolicyLeastLoaded )
+			continue;
+
+		for ( UInt32 moves = 0; moves < kOHCITreeMaxMoves; moves++ )
+		{
+			UInt32		bestPeak = OHCITreePeakLoad(tree);
+			UInt32		bestNode = 0;
+			UInt32		best = count;
+
+			for ( j = 0; j < i; j++ )
+			{
+				UInt32	newNode;
+				UInt32	peak;
+
+				if ( ops[j].remove || (nodes[j] < 0) )
+					continue;
+
+				if ( OHCITreeFindMove(tree, (UInt32)nodes[j], OHCITreeEndpointBytes(ops[j].maxPacketSize, ops[j].lowSpeed), &newNode, &peak) && (peak < bestPeak) )
+				{
+					bestPeak = peak;
+					bestNode = newNode;
+					best = j;
+				}
+			}
+
+			if ( best == count )
+				break;
+
+			OHCITreeRemove(tree, (UInt32)nodes[best], OHCITreeEndpointBytes(ops[best].maxPacketSize, ops[best].lowSpeed));
+			OHCITreeAdd(tree, bestNode, OHCITreeEndpointBytes(ops[best].maxPacketSize, ops[best].lowSpeed));
+			nodes[best] = (SInt16)bestNode;
+			totalMoves++;
+		}
+	}
+
+	return totalMoves;
+}
+
+#ifndef KERNEL
+// Replays ops with both policies and prints the worst case periodic load of every frame, before (frame number
+// placement) and after (least loaded placement with moves on delete).  nodes is scratch space for count entries.
+static inline void
+OHCITreePrintComparison(FILE *out, const OHCITreeSimOp *ops, UInt32 count, SInt16 *nodes)
+{
+	OHCIInterruptTree	before;
+	OHCIInterruptTree	after;
+	UInt32				moves;
+	UInt32				frame;
+
+	memset(&before, 0, sizeof(before));
+	memset(&after, 0, sizeof(after));
+	OHCITreeSimulate(&before, ops, count, kOHCITreePolicyFrameNumber, nodes);
+	moves = OHCITreeSimulate(&after, ops, count, kOHCITreePolicyLeastLoaded, nodes);
+
+	fprintf(out, "frame   before    after   (byte times, %d available for periodic)\n", kOHCITreePeriodicFrameBytes);
+	for ( frame = 0; frame < kOHCITreeFrames; frame++ )
+		fprintf(out, "%5u %8u %8u\n", (unsigned)frame, (unsigned)OHCITreeFrameLoad(&before, frame), (unsigned)OHCITreeFrameLoad(&after, frame));
+	fprintf(out, " peak %8u %8u   (%u EDs moved)\n", (unsigned)OHCITreePeakLoad(&before), (unsigned)OHCITreePeakLoad(&after), (unsigned)moves);
+}
+#endif
+
+#endif /* _OHCIINTERRUPTTREE_H */
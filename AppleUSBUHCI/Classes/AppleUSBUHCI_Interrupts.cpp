@@ -119,7 +119,10 @@ AppleUSBUHCI::InterruptHandler(OSObject *owner, IOInterruptEventSource *source,
 	
     if (controller && !controller->isInactive() && controller->_controllerAvailable) 
 	{
+		// pipes with a batch completion get everything from this pass in one call
+		controller->BeginCompletionBatch();
         controller->HandleInterrupt();
+		controller->EndCompletionBatch();
     }
 #if UHCI_USE_KPRINTF
 	else
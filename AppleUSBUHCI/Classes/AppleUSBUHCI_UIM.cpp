@@ -1985,6 +1985,9 @@ AppleUSBUHCI::AddIsochFramesToSchedule(IOUSBControllerIsochEndpoint* pEP)
 			IOSimpleLockUnlock(_isochScheduleLock);
 			// OK to call USBLog, now that preemption is reenabled
             USBLog(7, "AppleUSBUHCI[%p]::AddIsochFramesToSchedule - calling the ReturnIsocDoneQueue on a separate thread", this);
+            // endpoints with real time completions don't need the thread call
+            if ( QueueRealTimeIsochCompletion(pEP) )
+                return;
             thread_call_enter1(_returnIsochDoneQueueThread, (thread_call_param_t) pEP);
 			return;
 		}
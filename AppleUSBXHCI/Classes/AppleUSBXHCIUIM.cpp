@@ -2433,7 +2433,6 @@ void AppleUSBXHCI::ClearEndpoint(int slotID, int EndpointID)
 	
 	PrintTRB(6, &t, "ClearEndpoint");
     ret = WaitForCMD(&t, kXHCITRB_ConfigureEndpoint);
-	ReleaseInputContext();
 	if((ret == CMD_NOT_COMPLETED) || (ret <= MakeXHCIErrCode(0)))
 	{
 		USBLog(1, "AppleUSBXHCI[%p]::ClearEndpoint - configure endpoint failed:%d", this, (int)ret);
@@ -2456,10 +2455,11 @@ void AppleUSBXHCI::ClearEndpoint(int slotID, int EndpointID)
 //  USBF:	1.106	AppleUSBXHCI[0xffffff80d8313000]::ClearEndpoint - Input Context 1
 //  USBF:	1.112	AppleUSBXHCI[0xffffff80d8313000]::ClearEndpoint - Input Context X
 
-		
+		ReleaseInputContext();
 		return;
 	}
 	
+	ReleaseInputContext();
 	USBLog(3, "AppleUSBXHCI[%p]::ClearEndpoint - enabling endpoint succeeded", this);
 	
     USBTrace_End(kUSBTXHCI, kTPXHCIClearEndpoint,  (uintptr_t)this, slotID, EndpointID, 0);
@@ -3751,6 +3751,10 @@ bool AppleUSBXHCI::PollEventRing2(int IRQ)
 
 			PrintEventTRB(&nextEvent, IRQ, false);
 			EnsureUsability();
+
+			// let the root hub complete its status change read now instead of on the next timer tick
+			if (_myPowerState == kUSBPowerStateOn)
+				RootHubStatusChangeInterrupt();
 		}
 		else if(type == kXHCITRB_MFWE)
         {	// MF Wrap Event
@@ -3897,7 +3901,10 @@ AppleUSBXHCI::InterruptHandler(OSObject *owner, IOInterruptEventSource * /*sourc
     }
 	
 	//controller->PrintInterrupter(5,0, "irq");
+	// pipes with a batch completion get everything completed from the event rings in one call
+	controller->BeginCompletionBatch();
     controller->PollInterrupts();
+	controller->EndCompletionBatch();
 }
 
 /* AnV - Only one interrupter fix */
@@ -4417,6 +4424,7 @@ IOReturn AppleUSBXHCI::UIMInitialize(IOService * provider)
         _AC64 = ((HCCParams & kXHCIAC64Bit) != 0);
         _Contexts64 = ((HCCParams & kXHCICSZBit) != 0);
         _contextInUse = 0;
+        _inputContextContention = 0;
 
         USBLog(3, "AppleUSBXHCI[%p]::UIMInitialize - Max primary streams:%d, AC64:%d, Context Size:%d", this, 
                (int)_maxPrimaryStreams, (int)_AC64, (int)_Contexts64);
@@ -4783,6 +4791,16 @@ IOReturn AppleUSBXHCI::UIMInitialize(IOService * provider)
 		CheckSleepCapability();
         SetPropsForBookkeeping();
 
+		// every port change raises a Port Status Change Event, so the root hub doesn't need to be polled
+		RootHubEnableChangeInterrupts(true);
+
+		_diagnostics = AppleUSBDiagnostics::createDiagnostics(&_UIMDiagnostics, NULL, this);
+		if( _diagnostics )
+		{
+			AppleUSBDiagnostics::AllocateEndpoints(&_UIMDiagnostics);
+			setProperty( "Statistics", _diagnostics );
+		}
+
         _uimInitialized = true;
 
 		registerService();
@@ -4944,6 +4962,14 @@ IOReturn AppleUSBXHCI::UIMFinalize()
 		_acpiDevice = NULL;
 	}
 	
+	if( _diagnostics )
+	{
+		removeProperty( "Statistics" );
+		_diagnostics->release();
+		_diagnostics = NULL;
+	}
+	AppleUSBDiagnostics::FreeEndpoints(&_UIMDiagnostics);
+	
 	// Cleanup some stuff
  	if (_DCBAABuffer)
 	{
@@ -5191,7 +5217,9 @@ void AppleUSBXHCI::GetInputContext(void)
 	
     if(_contextInUse > 0)
     {
-        USBLog(1, "AppleUSBXHCI[%p]::GetInputContext - context in use: %d", this, _contextInUse);
+        _inputContextContention++;
+        USBLog(1, "AppleUSBXHCI[%p]::GetInputContext - context in use: %d (contention %d)", this, _contextInUse, (int)_inputContextContention);
+        setProperty("Input Context Contention", _inputContextContention, 32);
     }
 	
     _contextInUse++;
@@ -5402,7 +5430,6 @@ IOReturn AppleUSBXHCI::AddressDevice(UInt32 slotID, UInt16 maxPacketSize, bool s
 	
 	ret = WaitForCMD(&t, kXHCITRB_AddressDevice);
 	
-	ReleaseInputContext();
 	if((ret == CMD_NOT_COMPLETED) || (ret <= MakeXHCIErrCode(0)))
 	{
 		USBLog(1, "AppleUSBXHCI[%p]::AddressDevice - Address device failed:%d", this, (int)ret);
@@ -5417,8 +5444,10 @@ IOReturn AppleUSBXHCI::AddressDevice(UInt32 slotID, UInt16 maxPacketSize, bool s
 			PrintContext(GetInputContextByIndex(2));
 		}
 		
+		ReleaseInputContext();
 		return(MungeXHCIStatus(ret, 0));
 	}
+	ReleaseInputContext();
     
 	USBLog(6, "AppleUSBXHCI[%p]::AddressDevice - Address device success: SlotState: %d USB Address: %d ", this, 
            GetSlCtxSlotState(GetSlotContext(slotID)), GetSlCtxUSBAddress(GetSlotContext(slotID)) );
@@ -5499,7 +5528,6 @@ AppleUSBXHCI::configureHub(UInt32 address, UInt32 flags)
 	//ret = WaitForCMD(&t, kXHCITRB_EvaluateContext);
 	ret = WaitForCMD(&t, kXHCITRB_ConfigureEndpoint);
 	
-	ReleaseInputContext();
 	if((ret == CMD_NOT_COMPLETED) || (ret < MakeXHCIErrCode(0)))
 	{
 		USBLog(1, "AppleUSBXHCI[%p]::configureHub - Configure endpoint failed:%d", this, (int)ret);
@@ -5514,11 +5542,12 @@ AppleUSBXHCI::configureHub(UInt32 address, UInt32 flags)
 			PrintContext(GetInputContextByIndex(2));
 		}
 		
-		
+		ReleaseInputContext();
 		return(kIOReturnInternalError);
 	}
 	else
 	{
+		ReleaseInputContext();
 		//USBLog(2, "AppleUSBXHCI[%p]::configureHub - Sucessfull, output slot context:", this);
 		//PrintContext(&_slots[slotID].deviceContext[0]);
 	}
@@ -5728,7 +5757,6 @@ IOReturn AppleUSBXHCI::UIMCreateControlEndpoint(UInt8			functionNumber,
 		
 		ret = WaitForCMD(&t, kXHCITRB_EvaluateContext);
 		
-		ReleaseInputContext();
 		if((ret == CMD_NOT_COMPLETED) || (ret <= MakeXHCIErrCode(0)))
 		{
 			USBLog(1, "AppleUSBXHCI[%p]::UIMCreateControlEndpoint 2 - Evaluate Context failed:%d", this, (int)ret);
@@ -5743,9 +5771,10 @@ IOReturn AppleUSBXHCI::UIMCreateControlEndpoint(UInt8			functionNumber,
 				PrintContext(GetInputContextByIndex(2));
 			}
 			
-			
+			ReleaseInputContext();
 			return(kIOReturnInternalError);
 		}		
+		ReleaseInputContext();
 		
         return(kIOReturnSuccess);
 	}
@@ -7771,7 +7800,6 @@ AppleUSBXHCI::CreateEndpoint(int						slotID,
     //USBLog(3, "AppleUSBXHCI[%p]::CreateEndpoint - after slotCtx", this);
     //PrintContext(&_slots[slotID].deviceContext[0]);
 	
-	ReleaseInputContext();
 	if((ret == CMD_NOT_COMPLETED) || (ret <= MakeXHCIErrCode(0)))
 	{
         if(ret == MakeXHCIErrCode(kXHCITRB_CC_ResourceErr))
@@ -7779,6 +7807,7 @@ AppleUSBXHCI::CreateEndpoint(int						slotID,
             // I think this is what we get if we run out of endpoints
             USBLog(1, "AppleUSBXHCI[%p]::CreateEndpoint - configure endpoint resource error, run out of rings? Returning: %x", this, kIOUSBEndpointCountExceeded);
             
+            ReleaseInputContext();
             return(kIOUSBEndpointCountExceeded);
         }
 		USBLog(1, "AppleUSBXHCI[%p]::CreateEndpoint - configure endpoint failed:%d", this, (int)ret);
@@ -7794,9 +7823,11 @@ AppleUSBXHCI::CreateEndpoint(int						slotID,
 			PrintContext(GetInputContextByIndex(endpointIdx+1));
 		}
 		
+		ReleaseInputContext();
 		return(kIOReturnInternalError);
 	}
 	
+	ReleaseInputContext();
 	USBLog(3, "AppleUSBXHCI[%p]::CreateEndpoint - enabling endpoint succeeded", this);
 	
     return(kIOReturnSuccess);
@@ -8753,6 +8784,190 @@ int AppleUSBXHCI::QuiesceEndpoint(int slotID, int endpointID)
 }
 
 
+//================================================================================================
+//
+//   StopAllEndpoints
+//
+//      QuiesceEndpoint on every endpoint, but with the Stop Endpoint commands for the running
+//      ones queued up to kXHCIMaxBatchedCommands at a time and waited for together, rather than
+//      waiting out each one in WaitForCMD before queueing the next.  Endpoints in any other state
+//      still go through QuiesceEndpoint.  Returns the number of Stop Endpoint commands issued.
+//
+//================================================================================================
+//
+UInt32
+AppleUSBXHCI::StopAllEndpoints(void)
+{
+	XHCIStopRequest		batch[kXHCIMaxBatchedCommands];
+	CMDComplete			callBackF = OSMemberFunctionCast(CMDComplete, this, &AppleUSBXHCI::CompleteSlotCommand);
+	UInt32				stopped = 0;
+	int					count = 0;
+	int					slot, endp;
+	
+	if ( isInactive() || _lostRegisterAccess || !_controllerAvailable )
+	{
+		USBLog(1, "AppleUSBXHCI[%p]::StopAllEndpoints - Returning early inactive: %d lost register access:%d", this, isInactive(), (int)_lostRegisterAccess);
+		return 0;
+	}
+	
+	for(slot = 0; slot<_numDeviceSlots; slot++)
+	{
+		if(_slots[slot].buffer == NULL)
+			continue;
+		
+		for(endp = 1; endp<kXHCI_Num_Contexts; endp++)
+		{
+			XHCIRing	*ring;
+			TRB			t;
+			
+			ring = GetRing(slot, endp, 0);
+			if( (ring == NULL) || (ring->TRBBuffer == NULL) )
+				continue;
+			
+			if(GetEpCtxEpState(GetEndpointContext(slot, endp)) != kXHCIEpCtx_State_Running)
+			{
+				// Halted and error endpoints need more than a stop, leave them to QuiesceEndpoint
+				QuiesceEndpoint(slot, endp);
+				continue;
+			}
+			
+			if(count == kXHCIMaxBatchedCommands)
+			{
+				stopped += FinishStopEndpoints(batch, count);
+				count = 0;
+			}
+			
+			USBLog(6, "AppleUSBXHCI[%p]::StopAllEndpoints - stopping endpoint slotID: %d endpointID: %d", this, slot, endp);
+			ClearStopTDs(slot, endp);
+			ClearTRB(&t, true);
+			SetTRBSlotID(&t, slot);
+			SetTRBEpID(&t, endp);
+			
+			if(EnqueCMD(&t, kXHCITRB_StopEndpoint, callBackF, &batch[count].result) != kIOReturnSuccess)
+			{
+				// Command ring is full, reap what we have and do this one on its own
+				stopped += FinishStopEndpoints(batch, count);
+				count = 0;
+				QuiesceEndpoint(slot, endp);
+				continue;
+			}
+			batch[count].slotID = slot;
+			batch[count].endpointID = endp;
+			count++;
+		}
+	}
+	
+	if(count != 0)
+	{
+		stopped += FinishStopEndpoints(batch, count);
+	}
+	
+	return stopped;
+}
+
+
+
+//================================================================================================
+//
+//   FinishStopEndpoints
+//
+//      Poll until every command in batch has completed (the same 500ms budget WaitForCMD gives
+//      one command), then do what StopEndpoint and QuiesceEndpoint do with each result.
+//
+//================================================================================================
+//
+UInt32
+AppleUSBXHCI::FinishStopEndpoints(XHCIStopRequest *batch, int count)
+{
+	UInt32		timeout = 500;
+	UInt32		ms = 0;
+	int			pending = count;
+	int			innercount, i;
+	
+	while(pending != 0)
+	{
+		if ( ms++ > timeout )
+		{
+			break;
+		}
+		
+		for(innercount = 0; (innercount < 1000) && (pending != 0); innercount++)
+		{
+			IODelay(1);    // 1us
+			PollForCMDCompletions(kPrimaryInterrupter);
+			
+			for(pending = 0, i = 0; i < count; i++)
+			{
+				if(*batch[i].result == CMD_NOT_COMPLETED)
+				{
+					pending++;
+				}
+			}
+		}
+	}
+	
+	if(pending != 0)
+	{
+		// Same recovery as WaitForCMD, abort whatever the command ring is stuck on
+		USBLog(1, "AppleUSBXHCI[%p]::FinishStopEndpoints - %d of %d Stop Endpoint commands not completed in %dms", this, pending, count, (int)ms);
+		Write64Reg(&_pXHCIRegisters->CRCR, kXHCI_CA, false);
+		_waitForCommandRingStoppedEvent = true;
+		
+		for (ms = 0; ((ms < 5000) && (_waitForCommandRingStoppedEvent)); ms++)
+		{
+			IODelay(1000);    // 1ms
+			PollForCMDCompletions(kPrimaryInterrupter);
+		}
+		
+		if(_waitForCommandRingStoppedEvent)
+		{
+			USBLog(1, "AppleUSBXHCI[%p]::FinishStopEndpoints - abort, command ring did not stop", this);
+		}
+	}
+	else
+	{
+		USBLog(6, "AppleUSBXHCI[%p]::FinishStopEndpoints - %d Stop Endpoint commands completed in %dms", this, count, (int)ms);
+	}
+	
+	for(i = 0; i < count; i++)
+	{
+		int			slotID = batch[i].slotID;
+		int			endpointID = batch[i].endpointID;
+		SInt32		ret = *batch[i].result;
+		int			epState;
+		
+		*batch[i].result = 0;
+		
+		if ( (ret == CMD_NOT_COMPLETED) || (ret <= MakeXHCIErrCode(0)) )
+		{
+			USBLog(1, "AppleUSBXHCI[%p]::FinishStopEndpoints - Stop Endpoint failed:%d (slot:%d, ep:%d)", this, (int)ret, slotID, endpointID);
+		}
+		
+		// If PPT
+		if ((_errataBits & kXHCIErrataPPT) != 0)
+		{
+			if(ret == kXHCITRB_CC_NOSTOP)
+			{
+				USBLog(1, "AppleUSBXHCI[%p]::FinishStopEndpoints - Stop endpoint failed with no stop (slot:%d, ep:%d) device needs to be reset", this, slotID, endpointID);
+				_slots[slotID].deviceNeedsReset = true;
+			}
+		}
+		
+		epState = GetEpCtxEpState(GetEndpointContext(slotID, endpointID));
+		if(epState != kXHCIEpCtx_State_Stopped)
+		{
+			USBLog(1, "AppleUSBXHCI[%p]::FinishStopEndpoints - state changed before endpoint stopped. (%d)", this, epState);
+			if(epState == kXHCIEpCtx_State_Halted)
+			{
+				ResetEndpoint(slotID, endpointID);
+			}
+		}
+	}
+	
+	return (UInt32)count;
+}
+
+
 
 IOReturn 
 AppleUSBXHCI::UIMAbortStream(UInt32	streamID,
@@ -9007,6 +9222,8 @@ IOReturn AppleUSBXHCI::UIMDeleteEndpoint(short				functionNumber,
 		return(kIOReturnBadArgument);
 	}
     
+	AppleUSBDiagnostics::EndpointRemoved(_UIMDiagnostics.endpoints, functionNumber, endpointNumber, direction);
+    
 	endpointIdx = GetEndpointID(endpointNumber, direction);
     
 	ringX = GetRing(slotID, endpointIdx, 0);
@@ -36,34 +36,6 @@ void kprintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
 	(typeof(*(registerPtr)))fTempReg)
 #endif
 
-OSDefineMetaClassAndStructors(AppleXHCIAsyncTransferDescriptor, OSObject)
-
-AppleXHCIAsyncTransferDescriptor *
-AppleXHCIAsyncTransferDescriptor::ForEndpoint(AppleXHCIAsyncEndpoint *epQueue)
-{
-    AppleXHCIAsyncTransferDescriptor *me = OSTypeAlloc(AppleXHCIAsyncTransferDescriptor);
-	
-    if (!me || !me->init())
-		return NULL;
-	
-	me->_endpoint = epQueue;
-	
-    return me;
-}
-
-bool
-AppleXHCIAsyncTransferDescriptor::init()
-{
-	bool		ret;
-	
-	ret = OSObject::init();
-    
-    bzero(immediateBuffer, kMaxImmediateTRBTransferSize);
-
-	return ret;
-}
-
-
 void 
 AppleXHCIAsyncTransferDescriptor::reinit()
 {
@@ -88,18 +60,14 @@ AppleXHCIAsyncTransferDescriptor::reinit()
     lastFlushedTD     = false;
     lastInRing        = false;
     remAfterThisTD    = 0;
+    submitTime        = 0;
 
     _logicalNext = NULL;				// the next element in the list
+    _logicalPrev = NULL;
     bzero(immediateBuffer, kMaxImmediateTRBTransferSize);
     
 }
 
-void									
-AppleXHCIAsyncTransferDescriptor::free(void)
-{
-	OSObject::free();
-}
-
 void
 AppleXHCIAsyncTransferDescriptor::print(int __unused level)
 {
@@ -134,10 +102,10 @@ AppleXHCIAsyncEndpoint::validateLists(int __unused level)
         if (freeATD == freeEnd)
         	break;
 
-        freeATD = (AppleXHCIAsyncTransferDescriptor*)freeATD->_logicalNext;
+        freeATD = freeATD->_logicalNext;
     }
 
-    USBLog(level, "AppleXHCIAsyncEndpoint[%p]::validateLists freeQueue count: %d ",  this, count );
+    USBLog(level, "AppleXHCIAsyncEndpoint[%p]::validateLists freeQueue count: %d arenaTDs: %d",  this, count, (int)_arenaTDs );
 }
 
 void
@@ -155,8 +123,8 @@ AppleXHCIAsyncEndpoint::print(int __unused level)
     USBLog(level, "AppleXHCIAsyncEndpoint[%p]::print - freeQueue(%lx) freeEnd(%lx) onFreeQueue(%d)", 
            this, (uintptr_t)freeQueue, (uintptr_t)freeEnd, (int)onFreeQueue);
     
-	USBLog(level, "AppleXHCIAsyncEndpoint[%p]::print - aborting(%d) maxPacketSize(%d) maxBurst(%d) actualFragmentSize(%d)", 
-           this, (int)_aborting, (int)_maxPacketSize, (int)_maxBurst, (int)_actualFragmentSize);
+	USBLog(level, "AppleXHCIAsyncEndpoint[%p]::print - aborting(%d) maxPacketSize(%d) maxBurst(%d) actualFragmentSize(%d) arenaTDs(%d)", 
+           this, (int)_aborting, (int)_maxPacketSize, (int)_maxBurst, (int)_actualFragmentSize, (int)_arenaTDs);
 }
 
 bool
@@ -221,21 +189,27 @@ AppleXHCIAsyncEndpoint::free(void)
         Complete(kIOReturnAborted);
     }
     
-    do
+    print(7);
+    
+    // The TDs all live in the arenas, so this frees them wherever they are queued
+    while (_arenas != NULL)
     {
-        AppleXHCIAsyncTransferDescriptor *freeATD = GetTDFromFreeQueue(false);
+        AppleXHCIAsyncTDArena *arena = _arenas;
         
-        if (freeATD)
-        {
-            USBLog(7,"+AppleXHCIAsyncEndpoint[%p]::free freeATD: %p ",  this, freeATD );
-
-            freeATD->release();
-            freeATD = NULL;
-        }
-        
-    } while (freeQueue != NULL);
+        USBLog(7,"+AppleXHCIAsyncEndpoint[%p]::free arena: %p count: %d",  this, arena, (int)arena->count );
+        _arenas = arena->next;
+        IOFree(arena, arena->size);
+    }
+    _arenaTDs = 0;
+    freeQueue = freeEnd = NULL;
+    onFreeQueue = 0;
     
-    print(7);
+    if (_activeByIndex)
+    {
+        IOFree(_activeByIndex, _activeByIndexCount * sizeof(AppleXHCIAsyncTransferDescriptor*));
+        _activeByIndex = NULL;
+        _activeByIndexCount = 0;
+    }
 
     USBLog(7,"-AppleXHCIAsyncEndpoint[%p]::free",  this );
     
@@ -260,10 +234,12 @@ AppleXHCIAsyncEndpoint::PutTDAtHead(AppleXHCIAsyncTransferDescriptor **qStart, A
     {
 		// at the head of the old queue
         pTD->_logicalNext = *qStart;
+        (*qStart)->_logicalPrev = pTD;
     }
     
     // no matter what we are the new head
     *qStart = pTD;
+    pTD->_logicalPrev = NULL;
 	(*qCount)++;
 }
 
@@ -283,6 +259,7 @@ AppleXHCIAsyncEndpoint::PutTD(AppleXHCIAsyncTransferDescriptor **qStart, AppleXH
     }
     
     // no matter what we are the new tail
+    pTD->_logicalPrev = (*qStart == pTD) ? NULL : *qEnd;
     *qEnd = pTD;
 	(*qCount)++;
 }
@@ -298,7 +275,10 @@ AppleXHCIAsyncEndpoint::GetTD(AppleXHCIAsyncTransferDescriptor **qStart, AppleXH
 		if (pTD == *qEnd)
 			*qStart = *qEnd = NULL;
 		else
-			*qStart = OSDynamicCast(AppleXHCIAsyncTransferDescriptor, pTD->_logicalNext);
+		{
+			*qStart = pTD->_logicalNext;
+			(*qStart)->_logicalPrev = NULL;
+		}
         
         if (*qCount == 0)
         {
@@ -312,6 +292,93 @@ AppleXHCIAsyncEndpoint::GetTD(AppleXHCIAsyncTransferDescriptor **qStart, AppleXH
     return pTD;
 }
 
+//
+//  Unlink a TD from anywhere in a queue whose _logicalPrev links are kept up to date
+//
+void 
+AppleXHCIAsyncEndpoint::RemoveTD(AppleXHCIAsyncTransferDescriptor **qStart, AppleXHCIAsyncTransferDescriptor **qEnd, AppleXHCIAsyncTransferDescriptor *pTD, UInt32 *qCount)
+{
+    if (pTD == *qStart)
+    {
+        GetTD(qStart, qEnd, qCount);
+        return;
+    }
+    
+    if (pTD->_logicalPrev == NULL)
+    {
+        USBLog(1,"AppleXHCIAsyncEndpoint[%p]::RemoveTD - TD %p is not linked",  this, pTD);
+        print(5);
+        return;
+    }
+    
+    pTD->_logicalPrev->_logicalNext = pTD->_logicalNext;
+    if (pTD == *qEnd)
+        *qEnd = pTD->_logicalPrev;
+    else
+        pTD->_logicalNext->_logicalPrev = pTD->_logicalPrev;
+    
+    pTD->_logicalPrev = NULL;
+    
+    if (*qCount == 0)
+    {
+        USBLog(1,"AppleXHCIAsyncEndpoint[%p]::RemoveTD underflow",  this);
+        print(5);
+    }
+    (*qCount)--;
+}
+
+//
+//  Carve another arena of TDs and put them on the freeQueue.  The first one also makes the
+//  completion index, now that the ring has been allocated and its size is known.
+//
+bool
+AppleXHCIAsyncEndpoint::GrowTDArena()
+{
+    AppleXHCIAsyncTDArena   *arena;
+    UInt32                  count = kAsyncMinArenaTDs;
+    UInt32                  size;
+    
+    if ((UInt32)(_ring->transferRingSize / kAsyncTRBsPerArenaTD) > count)
+    {
+        count = _ring->transferRingSize / kAsyncTRBsPerArenaTD;
+    }
+    
+    size  = (UInt32)(sizeof(AppleXHCIAsyncTDArena) + ((count - 1) * sizeof(AppleXHCIAsyncTransferDescriptor)));
+    arena = (AppleXHCIAsyncTDArena*)IOMalloc(size);
+    if (arena == NULL)
+    {
+        USBLog(1,"AppleXHCIAsyncEndpoint[%p]::GrowTDArena - could not allocate %d TDs",  this, (int)count);
+        return false;
+    }
+    
+    bzero(arena, size);
+    arena->count = count;
+    arena->size  = size;
+    arena->next  = _arenas;
+    _arenas      = arena;
+    _arenaTDs   += count;
+    
+    for (UInt32 i = 0; i < count; i++)
+    {
+        arena->tds[i]._endpoint = this;
+        PutTDonFreeQueue(&arena->tds[i]);
+    }
+    
+    if ((_activeByIndex == NULL) && (_ring->transferRingSize > 0))
+    {
+        _activeByIndex = (AppleXHCIAsyncTransferDescriptor**)IOMalloc(_ring->transferRingSize * sizeof(AppleXHCIAsyncTransferDescriptor*));
+        if (_activeByIndex)
+        {
+            bzero(_activeByIndex, _ring->transferRingSize * sizeof(AppleXHCIAsyncTransferDescriptor*));
+            _activeByIndexCount = _ring->transferRingSize;
+        }
+    }
+    
+    USBLog(6,"AppleXHCIAsyncEndpoint[%p]::GrowTDArena - (%d, %d) %d TDs, %d in all, index of %d",  this, _ring->slotID, _ring->endpointID, (int)count, (int)_arenaTDs, (int)_activeByIndexCount);
+    
+    return true;
+}
+
 void
 AppleXHCIAsyncEndpoint::PutTDonFreeQueue(AppleXHCIAsyncTransferDescriptor *pTD)
 {
@@ -323,15 +390,8 @@ AppleXHCIAsyncEndpoint::GetTDFromFreeQueue(bool allocate)
 {
     if (freeQueue == NULL && allocate)
     {
-        // Allocate TDs and add them to FreeQueue
-        for (int i=0; i < kFreeTDs; i++)
-        {
-            AppleXHCIAsyncTransferDescriptor *newATD = AppleXHCIAsyncTransferDescriptor::ForEndpoint(this);
-            if (newATD)
-            {
-                PutTDonFreeQueue(newATD);
-            }
-        }
+        // Out of TDs, carve another arena
+        GrowTDArena();
     }
 
     AppleXHCIAsyncTransferDescriptor *pFreeATD = GetTD(&freeQueue, &freeEnd, &onFreeQueue);
@@ -398,12 +458,33 @@ void
 AppleXHCIAsyncEndpoint::PutTDonActiveQueue(AppleXHCIAsyncTransferDescriptor *pTD)
 {
     PutTD(&activeQueue, &activeEnd, pTD, &onActiveQueue);
+    
+    if ((pTD->completionIndex >= 0) && ((UInt32)pTD->completionIndex < _activeByIndexCount))
+    {
+        _activeByIndex[pTD->completionIndex] = pTD;
+    }
+}
+
+void
+AppleXHCIAsyncEndpoint::RemoveTDFromActiveIndex(AppleXHCIAsyncTransferDescriptor *pTD)
+{
+    if ((pTD->completionIndex >= 0) && ((UInt32)pTD->completionIndex < _activeByIndexCount) && (_activeByIndex[pTD->completionIndex] == pTD))
+    {
+        _activeByIndex[pTD->completionIndex] = NULL;
+    }
 }
 
 AppleXHCIAsyncTransferDescriptor *
 AppleXHCIAsyncEndpoint::GetTDFromActiveQueue()
 {
-    return GetTD(&activeQueue, &activeEnd, &onActiveQueue);
+    AppleXHCIAsyncTransferDescriptor *pTD = GetTD(&activeQueue, &activeEnd, &onActiveQueue);
+    
+    if (pTD)
+    {
+        RemoveTDFromActiveIndex(pTD);
+    }
+    
+    return pTD;
 }
 
 AppleXHCIAsyncTransferDescriptor * 
@@ -413,10 +494,26 @@ AppleXHCIAsyncEndpoint::GetTDFromActiveQueueWithIndex(UInt16 completionIndex)
 
     bool    foundMatchingTD      = false;
     
-    pPrevActiveATD = pActiveATD = activeQueue;
-    
     USBLog(7, "AppleXHCIAsyncEndpoint[%p]::GetTDFromActiveQueueWithIndex trbIndex: %d", this, completionIndex);
     
+    // Every TD on the activeQueue is in the index, so this is the normal case
+    if (completionIndex < _activeByIndexCount)
+    {
+        pActiveATD = _activeByIndex[completionIndex];
+        
+        if ((pActiveATD != NULL) && (pActiveATD->completionIndex == (SInt16)completionIndex))
+        {
+            _activeByIndex[completionIndex] = NULL;
+            RemoveTD(&activeQueue, &activeEnd, pActiveATD, &onActiveQueue);
+            
+            USBLog(7, "AppleXHCIAsyncEndpoint[%p]::GetTDFromActiveQueueWithIndex activeQueue %p pActiveATD %p (indexed)", this, activeQueue, pActiveATD);
+            return pActiveATD;
+        }
+    }
+    
+    // Not in the index (it couldn't be allocated, or the ring changed size), so walk the queue
+    pPrevActiveATD = pActiveATD = activeQueue;
+    
     while (pActiveATD != NULL)
     {
         USBLog(7, "AppleXHCIAsyncEndpoint[%p]::GetTDFromActiveQueueWithIndex ATD: %p USBCommand: %p completionIndex: ( %d , %d )", 
@@ -439,22 +536,29 @@ AppleXHCIAsyncEndpoint::GetTDFromActiveQueueWithIndex(UInt16 completionIndex)
             else if (pActiveATD == activeQueue)
             {
                 // Start
-                activeQueue = OSDynamicCast(AppleXHCIAsyncTransferDescriptor, pActiveATD->_logicalNext);
+                activeQueue = pActiveATD->_logicalNext;
+                activeQueue->_logicalPrev = NULL;
             }
             else
             {
                 // Chain previous to the next and disconnect the active one.
                 pPrevActiveATD->_logicalNext = pActiveATD->_logicalNext;
+                pActiveATD->_logicalNext->_logicalPrev = pPrevActiveATD;
             }
             
+            pActiveATD->_logicalPrev = NULL;
+            RemoveTDFromActiveIndex(pActiveATD);
             foundMatchingTD = true;
             onActiveQueue--;
             break;
         }
         
+        if (pActiveATD == activeEnd)
+            break;
+        
         pPrevActiveATD  = pActiveATD;
         // next item
-        pActiveATD      = OSDynamicCast(AppleXHCIAsyncTransferDescriptor, pActiveATD->_logicalNext);
+        pActiveATD      = pActiveATD->_logicalNext;
     }
     
     if (!foundMatchingTD)
@@ -564,7 +668,7 @@ AppleXHCIAsyncEndpoint::FindNearByActiveTD(int deQueueIndex)
         }
         
         // next item
-        pActiveATD      = OSDynamicCast(AppleXHCIAsyncTransferDescriptor, pActiveATD->_logicalNext);
+        pActiveATD      = pActiveATD->_logicalNext;
     }
     
     if (!foundNearByATD)
@@ -747,6 +851,14 @@ AppleXHCIAsyncEndpoint::CreateTDs(IOUSBCommand *command, UInt16 streamID, UInt32
     pNewATD->last            = true;
 	pNewATD->remAfterThisTD  = 0;
     
+    // Control transfers only complete on the status stage, so that is the only one counted
+    if (!command->GetMultiTransferTransaction() || command->GetFinalTransferInTransaction())
+    {
+        pNewATD->submitTime = mach_absolute_time();
+        AppleUSBDiagnostics::EndpointSubmitted(_xhciUIM->_UIMDiagnostics.endpoints, &_xhciUIM->_UIMDiagnostics.overFlowEndpointCount,
+                                               command->GetAddress(), command->GetEndpoint(), command->GetDirection());
+    }
+    
     USBTrace_End( kUSBTXHCI, kTPXHCIAsyncEPCreateTD, (uintptr_t)this, numberOfTDs, sizeQueued, (uintptr_t)0);
  
     USBLog(7, "-AppleXHCIAsyncEndpoint[%p]::CreateTDs", this);
@@ -902,8 +1014,10 @@ AppleXHCIAsyncEndpoint::FlushTDsWithStatus(IOUSBCommandPtr pUSBCommand, IOReturn
             else if (pActiveATD == activeQueue)
             {
                 // Start
-                activeQueue = OSDynamicCast(AppleXHCIAsyncTransferDescriptor, pActiveATD->_logicalNext);
+                activeQueue = pActiveATD->_logicalNext;
+                activeQueue->_logicalPrev = NULL;
             }
+            RemoveTDFromActiveIndex(pActiveATD);
             
             flushedDequeueIndex = pActiveATD->completionIndex+1;
             dequeueStreamID     = pActiveATD->streamID;
@@ -1075,6 +1189,10 @@ AppleXHCIAsyncEndpoint::Complete(IOReturn status)
                         port = pDoneATD->_endpoint->_xhciUIM->getRootPortNumber(pDoneATD->_endpoint->_ring->slotID)-1;
                         pDoneATD->_endpoint->_xhciUIM->_UIMDiagnostics.portCounts[port].totalBytes += done;
                     }*/
+                    
+                    AppleUSBDiagnostics::EndpointCompleted(_xhciUIM->_UIMDiagnostics.endpoints, &_xhciUIM->_UIMDiagnostics.overFlowEndpointCount,
+                                                           pDoneATD->activeCommand->GetAddress(), pDoneATD->activeCommand->GetEndpoint(), pDoneATD->activeCommand->GetDirection(),
+                                                           pDoneATD->submitTime, (UInt32)pDoneATD->activeCommand->GetReqCount(), done, status);
 
                     _xhciUIM->Complete(completion, status, (UInt32)shortfall);
                     pDoneATD->shortfall = 0;
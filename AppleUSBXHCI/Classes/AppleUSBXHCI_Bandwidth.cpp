@@ -36,21 +36,13 @@ TTBandwidthTable::WithHubAndPort(UInt8 hubSlot, UInt8 hubPort, bool mtt)
 	TTBandwidthTable *me = OSTypeAlloc(TTBandwidthTable);
 	if (me)
 	{	
-		int			i;
-		
 		me->init();
 		
 		me->hubSlotID = hubSlot;
 		me->mtt = mtt;
 		if (mtt)
 			me->hubPortNum = hubPort;
-		for (i=0; i < kMaxIntervalTableSize; i++)
-		{
-			me->interval[i].worstCaseMPS = 0;
-			me->interval[i].totalPackets = 0;
-			me->interval[i].packetOverhead = 0;
-		}
-
+		XHCIBandwidthClearTable(me->interval);
 	}
 	return me;
 }
@@ -60,49 +52,15 @@ TTBandwidthTable::WithHubAndPort(UInt8 hubSlot, UInt8 hubPort, bool mtt)
 void
 TTBandwidthTable::AddToTable(UInt8 epSpeed, UInt8 epInterval, UInt16 mps)
 {
-	UInt16				mpsInBlocks= 0;
-	bool				forceLS = false;
-	UInt8				normalizedInterval = epInterval - 3;
-	
 	USBLog(5, "TTBandwidthTable[%p]::AddToTable: epSpeed(%d) epInterval(%d) mps(%d)", this, epSpeed, epInterval, mps);
 	
-	if ((epInterval < 3) || (epInterval >= kMaxFSIsochInterval))
+	if (!XHCIBandwidthTTAdd(interval, epSpeed, epInterval, mps))
 	{
 		USBLog(1, "TTBandwidthTable[%p]::AddToTable - invalid FS/LS interval of %d", this, epInterval);
 		return;
 	}
 	
-	if (epSpeed == kUSBDeviceSpeedLow)
-		forceLS = true;
-	
-	// convert to XHCI blocks now
-	if (forceLS)
-	{
-		mps = mps * 8;
-		USBLog(5, "TTBandwidthTable[%p]::AddToTable - LS device  new mps %d", this, mps);
-	}
-	
-	mpsInBlocks = (mps + kFSBytesPerBlock-1) / kFSBytesPerBlock;				// this is a divide by 1, but be consistent - bit stuffing is already accounted for
-
-	if (normalizedInterval == 0)
-	{
-		interval[0].worstCaseMPS += (mpsInBlocks + (forceLS ? kLSPacketOverheadInBlocks : kFSPacketOverheadInBlocks));
-	}
-	else
-	{
-		// intervals 1 and above, which are shared amongst more than 1 packet
-		interval[normalizedInterval].totalPackets++;
-		
-		// we know that the interval is > 2
-		if (mpsInBlocks > interval[normalizedInterval].worstCaseMPS)
-			interval[normalizedInterval].worstCaseMPS = mpsInBlocks;
-		
-		if (forceLS)
-			interval[normalizedInterval].packetOverhead = kLSPacketOverheadInBlocks;
-		else if (interval[normalizedInterval].packetOverhead == 0)
-			interval[normalizedInterval].packetOverhead = kFSPacketOverheadInBlocks;
-	}
-	USBLog(5, "TTBandwidthTable[%p]::AddToTable: interval[%d].worstCaseMPS(%d)", this, normalizedInterval, interval[normalizedInterval].worstCaseMPS);
+	USBLog(5, "TTBandwidthTable[%p]::AddToTable: interval[%d].worstCaseMPS(%d)", this, epInterval - 3, interval[epInterval - 3].worstCaseMPS);
 }
 
 
@@ -110,58 +68,11 @@ TTBandwidthTable::AddToTable(UInt8 epSpeed, UInt8 epInterval, UInt16 mps)
 SInt16
 TTBandwidthTable::BandwidthAvailable()
 {
-	UInt16			bandwidthUsedinBlocks = interval[0].worstCaseMPS;	// accounts for any 1ms endpoints
-	UInt32			numPacketRemainder = 0;								// from the previous interval
-	UInt32			maxPacketSizeRemainder = 0;							// from the previous interval
-	UInt32			numPacketsThisInterval = 0;
-	UInt32			packetOverhead = 0;
-	UInt32			maxBandwidthInBlocks;
-	
-	USBLog(6, "TTBandwidthTable[%p]::BandwidthAvailable - start with bandwidth used: %d", this, bandwidthUsedinBlocks);
-	
-	for (int i=1; i < kMaxIntervalTableSize; i++)
-	{
-		USBLog(6, "TTBandwidthTable[%p]::BandwidthAvailable - interval:%d pkts:%d mps:%d overhead:%d numPktRmndr:%d mpsRmndr:%d ", this, i, (int)interval[i].totalPackets, (int)interval[i].worstCaseMPS, (int)interval[i].packetOverhead, (int)numPacketRemainder, (int)maxPacketSizeRemainder);
-		
-		// first double the packets from the previous interval and add to this interval
-		numPacketRemainder = 2 * numPacketRemainder + interval[i].totalPackets;
-		
-		if (interval[i].worstCaseMPS > maxPacketSizeRemainder)
-			maxPacketSizeRemainder = interval[i].worstCaseMPS;
-		
-		// calculate how many packets will exactly fit in this interval
-		numPacketsThisInterval = numPacketRemainder >> i;
-		
-		if (interval[i].packetOverhead > packetOverhead)
-		{
-			packetOverhead = interval[i].packetOverhead;
-		}
-		
-		USBLog(6, "TTBandwidthTable[%p]::BandwidthAvailable - bandwidthUsed[%d] adding %d packets at %d blocks", this, (int)bandwidthUsedinBlocks, (int)numPacketsThisInterval, (int)(packetOverhead + maxPacketSizeRemainder));
-		bandwidthUsedinBlocks += numPacketsThisInterval * (maxPacketSizeRemainder + packetOverhead);
-		
-		numPacketRemainder = numPacketRemainder % (1 << i);
-		if (numPacketRemainder == 0)
-		{
-			maxPacketSizeRemainder = 0;
-			packetOverhead = 0;
-		}
-		else if (numPacketsThisInterval > 0)
-		{
-			maxPacketSizeRemainder = interval[i].worstCaseMPS;
-		}
-	}
+	SInt16			bandwidthAvailable = XHCIBandwidthAvailable(interval, kLSFSBandwidthLimitInBlocks);
 	
-	if (numPacketRemainder)
-	{
-		USBLog(6, "TTBandwidthTable[%p]::BandwidthAvailable - finished with pkts:%d mps:%d overhead:%d", this, (int)numPacketRemainder, (int)maxPacketSizeRemainder, (int)packetOverhead);
-		bandwidthUsedinBlocks += (packetOverhead + maxPacketSizeRemainder);
-		
-	}
+	USBLog(4, "TTBandwidthTable[%p]::BandwidthAvailable - returning bandwidth available of %d (out of %d)", this, bandwidthAvailable, kLSFSBandwidthLimitInBlocks);
 	
-	USBLog(4, "TTBandwidthTable[%p]::BandwidthAvailable - returning bandwidth available of %d (out of %d)", this, kLSFSBandwidthLimitInBlocks-bandwidthUsedinBlocks, kLSFSBandwidthLimitInBlocks);
-	
-	return kLSFSBandwidthLimitInBlocks-bandwidthUsedinBlocks;
+	return bandwidthAvailable;
 }
 
 
@@ -222,18 +133,12 @@ RootHubPortTable::WithRHPortAndSpeed(UInt8 rhPort, UInt8 rhPortSpeed)
 	RootHubPortTable *me = OSTypeAlloc(RootHubPortTable);
 	if (me)
 	{
-		int			i;
 		me->init();
 		
 		USBLog(5, "RootHubPortTable[%p]::WithRHPortAndSpeed - rhPort(%d) rhSpeed(%d)", me, rhPort, rhPortSpeed);
 		me->rhPort = rhPort;
 		me->rhPortSpeed = rhPortSpeed;
-		for (i=0; i < kMaxIntervalTableSize; i++)
-		{
-			me->interval[i].worstCaseMPS = 0;
-			me->interval[i].totalPackets = 0;
-			me->interval[i].packetOverhead = 0;
-		}
+		XHCIBandwidthClearTable(me->interval);
 	}
 	
 	return me;
@@ -244,67 +149,10 @@ RootHubPortTable::WithRHPortAndSpeed(UInt8 rhPort, UInt8 rhPortSpeed)
 void
 RootHubPortTable::AddToTable(UInt8 epInterval, UInt16 mps, UInt8 maxBurst, UInt8 mult, UInt8 epSpeed, UInt8 hubSlot, UInt8 hubPort, bool mtt)
 {
-	UInt16			mpsInBlocks = mps;
-	UInt16			packetoverhead;
-	
-	interval[epInterval].totalPackets += (maxBurst +1);
-	
-	if ((rhPortSpeed == kUSBDeviceSpeedLow) || ((rhPortSpeed == kUSBDeviceSpeedFull) && (epSpeed == kUSBDeviceSpeedLow)))
-	{
-		// this is either a LS device directly connected or a LS device connected to a FS hub which is directly connected
-		mpsInBlocks *= 8;								// convert to FS equivalent
-		mpsInBlocks += (kFSBytesPerBlock-1);			// round up
-		mpsInBlocks /= kFSBytesPerBlock;
-		packetoverhead = kLSPacketOverheadInBlocks;
-	}
-	else if (rhPortSpeed == kUSBDeviceSpeedFull)
-	{
-		// either a FS device directly connected or a FS hub with a FS device downstream
-		mpsInBlocks += (kFSBytesPerBlock-1);			// round up
-		mpsInBlocks /= kFSBytesPerBlock;
-		packetoverhead = kFSPacketOverheadInBlocks;
-	}
-	else if (rhPortSpeed == kUSBDeviceSpeedHigh)
-	{
-		// HS hub - secondary (TT) bandwidth will be taken care of on the side - just need to deal with HS bandwidth here
-		mps *= (mult+1);											// multiplier for HSHB endpoints
-		mpsInBlocks += (kHSBytesPerBlock-1);						// round up
-		mpsInBlocks /= kHSBytesPerBlock;							// bit stuffing is taken into account already
-		packetoverhead = kHSPacketOverheadInBlocks;
-	}
-	else
-	{
-		// Super Speed
-		mps *= (maxBurst * 1);										// get max burst size
-		mps *= (mult + 1);											// and account for multiplier
-		mpsInBlocks += (kSSBytesPerBlock-1);						// round up
-		mpsInBlocks /= kSSBytesPerBlock;							// encoding is taken into account already
-		packetoverhead = kSSBurstOverheadInBlocks;
-		
-	}	
-	
-	USBLog(6, "RootHubPortTable[%p]::AddToTable - adjusted numbers: interval:%d mpsInBlocks:%d overhead:%d",this, epInterval, mpsInBlocks, packetoverhead);
-	if (epInterval == 0)
-	{
-		
-		// since these packets occur every uFrame, then we will go ahead and calculate the fully loaded bandwidth with overhead
-		// and then convert to XHCI blocks. the total number of blocks depends on the rhSpeed
-		// also note.. epInterval 0 will only be for HS and SS endpoints, since others have a minimum interval of 3 (1ms)
-		// also, the root hub and the endpoint better have the same speed for interval 0!
-		
-		interval[0].worstCaseMPS += ((maxBurst+1) * (mpsInBlocks + packetoverhead));
-	}
-	else
-	{
-		// since these packets will be scheduled by the HC, we just keep track of number and mps
-		// we will then convert to blocks and add overhead later
-		if (mpsInBlocks > interval[epInterval].worstCaseMPS)
-			interval[epInterval].worstCaseMPS = mpsInBlocks;
-		
-		// a LS endpoint on a FS root hub port will have a higher packetOverhead than others, and this accounts for that
-		if (packetoverhead > interval[epInterval].packetOverhead)
-			interval[epInterval].packetOverhead = packetoverhead;
-	}
+	USBLog(6, "RootHubPortTable[%p]::AddToTable - interval:%d mps:%d maxBurst:%d mult:%d epSpeed:%d",this, epInterval, mps, maxBurst, mult, epSpeed);
+
+	// the TT gets the MPS as adjusted for the HS hub
+	mps = XHCIBandwidthPortAdd(interval, rhPortSpeed, epInterval, mps, maxBurst, mult, epSpeed);
 	
 	if (hubSlot)
 	{
@@ -362,36 +210,9 @@ RootHubPortTable::PrintTableInfo()
 SInt16			
 RootHubPortTable::BandwidthAvailable(void)
 {
-	UInt16			bandwidthUsedinBlocks = interval[0].worstCaseMPS;
-	UInt32			numPacketRemainder = 0;								// from the previous interval
-	UInt32			maxPacketSizeRemainder = 0;							// from the previous interval
-	UInt32			numPacketsThisInterval = 0;
-	UInt32			packetOverhead = 0;
-	UInt32			maxBandwidthInBlocks = 0;
+	UInt32			maxBandwidthInBlocks = XHCIBandwidthLimitInBlocks(rhPortSpeed);
 	SInt16			bandwidthAvailable = 0;
 	
-	switch (rhPortSpeed)
-	{
-		case kUSBDeviceSpeedLow:
-			maxBandwidthInBlocks = kLSFSBandwidthLimitInBlocks;
-			break;
-			
-		case kUSBDeviceSpeedFull:
-			maxBandwidthInBlocks = kLSFSBandwidthLimitInBlocks;
-			break;
-			
-		case kUSBDeviceSpeedHigh:
-			maxBandwidthInBlocks = kHSBandwidthLimitInBlocks;
-			break;
-			
-		case kUSBDeviceSpeedSuper:
-			maxBandwidthInBlocks = kSSBandwidthLimitInBlocks;
-			break;
-			
-		default:
-			break;
-	}
-	
 	USBLog(6, "RootHubPortTable[%p]::BandwidthAvailable - checking rhPort(%d) speed (%d) downstream tts (%d) BW0[%d]", this, rhPort, rhPortSpeed, ttArray ? ttArray->getCount() : 0, interval[0].worstCaseMPS);
 	
 	if (ttArray)
@@ -412,51 +233,8 @@ RootHubPortTable::BandwidthAvailable(void)
 	}
 	
 	if (bandwidthAvailable >= 0)
-	{
-		USBLog(6, "RootHubPortTable[%p]::BandwidthAvailable - start interval:0 bandwidth used:%d", this, bandwidthUsedinBlocks);
+		bandwidthAvailable = XHCIBandwidthAvailable(interval, maxBandwidthInBlocks);
 
-		for (int i=1; i < kMaxIntervalTableSize; i++)
-		{
-			USBLog(6, "RootHubPortTable[%p]::BandwidthAvailable - interval:%d pkts:%d mps:%d overhead:%d numPktRmndr:%d mpsRmndr:%d ", this, i, (int)interval[i].totalPackets, (int)interval[i].worstCaseMPS, (int)interval[i].packetOverhead, (int)numPacketRemainder, (int)maxPacketSizeRemainder);
-			
-			// first double the packets from the previous interval and add to this interval
-			numPacketRemainder = 2 * numPacketRemainder + interval[i].totalPackets;
-			
-			if (interval[i].worstCaseMPS > maxPacketSizeRemainder)
-				maxPacketSizeRemainder = interval[i].worstCaseMPS;
-			
-			// this can change on a FS root hub port due to the presence of a LS device
-			if (interval[i].packetOverhead > packetOverhead)
-				packetOverhead = interval[i].packetOverhead;
-			
-			// calculate how many packets will exactly fit in this interval
-			numPacketsThisInterval = numPacketRemainder >> i;
-			
-			if (numPacketsThisInterval)
-			{
-				USBLog(6, "RootHubPortTable[%p]::BandwidthAvailable - bandwidthUsed[%d] adding %d packets at %d blocks", this, (int)bandwidthUsedinBlocks, (int)numPacketsThisInterval, (int)(packetOverhead + maxPacketSizeRemainder));
-			}
-			bandwidthUsedinBlocks += numPacketsThisInterval * (packetOverhead + maxPacketSizeRemainder);
-			
-			numPacketRemainder = numPacketRemainder % (1 << i);
-			if (numPacketRemainder == 0)
-			{
-				maxPacketSizeRemainder = 0;
-				packetOverhead = 0;					// get to reset once we have scheduled the packets
-			}
-			else if (numPacketsThisInterval > 0)
-			{
-				maxPacketSizeRemainder = interval[i].worstCaseMPS;
-			}
-		}
-		
-		if (numPacketRemainder)
-		{
-			USBLog(6, "RootHubPortTable[%p]::BandwidthAvailable - finished with pkts:%d mps:%d overhead:%d", this, (int)numPacketRemainder, (int)maxPacketSizeRemainder, (int)packetOverhead);
-			bandwidthUsedinBlocks += (packetOverhead + maxPacketSizeRemainder);
-		}
-		bandwidthAvailable = maxBandwidthInBlocks - bandwidthUsedinBlocks;
-	}
 	USBLog(4, "RootHubPortTable[%p]::BandwidthAvailable - returning bandwidth available of %d (out of %d)", this, bandwidthAvailable, (int)maxBandwidthInBlocks);
 	return bandwidthAvailable;
 }
@@ -583,6 +361,56 @@ AppleUSBXHCI::BuildRHPortBandwidthArray(OSArray *rhPortArray)
 
 
 
+// Fills in endpoints with the enabled periodic endpoints of every slot, and returns how many there are (which can be more than capacity)
+UInt32
+AppleUSBXHCI::GatherPeriodicEndpoints(XHCIBandwidthEndpoint *endpoints, UInt32 capacity)
+{
+	UInt32			count = 0;
+	
+	for(int slot = 0; slot < _numDeviceSlots; slot++)
+	{
+		if(_slots[slot].buffer != NULL)
+		{
+			Context	*			slotContext = GetSlotContext(slot);
+			UInt8				numEpContexts = GetSlCtxEntries(slotContext);
+			
+			// start at index 2, since 0 is the slot context and 1 is the conrol ep, which is not periodic
+			for (int endp = 2; endp <= numEpContexts; endp++)
+			{
+				Context		*epContext = GetEndpointContext(slot, endp);
+				UInt8		thisEpType = GetEpCtxEpType(epContext);
+				
+				if (GetEpCtxEpState(epContext) == kXHCIEpCtx_State_Disabled)
+					continue;
+				
+				if ((thisEpType == kXHCIEpCtx_EPType_BulkIN) || (thisEpType == kXHCIEpCtx_EPType_BulkOut) || (thisEpType == kXHCIEpCtx_EPType_Control))
+					continue;
+				
+				if (count < capacity)
+				{
+					XHCIBandwidthEndpoint *	endpoint = &endpoints[count];
+					
+					endpoint->slot = slot;
+					endpoint->dci = endp;
+					endpoint->rhPort = GetSlCtxRootHubPort(slotContext);
+					endpoint->epSpeed = GetSlCtxSpeed(slotContext);
+					endpoint->epInterval = GetEPCtxInterval(epContext);
+					endpoint->maxBurst = GetEPCtxMaxBurst(epContext);
+					endpoint->mult = GetEPCtxMult(epContext);
+					endpoint->ttHubSlot = GetSlCtxTTSlot(slotContext);
+					endpoint->ttHubPort = GetSlCtxTTPort(slotContext);
+					endpoint->mtt = GetSlCtxMTT(slotContext);
+					endpoint->mps = GetEpCtxMPS(epContext);
+				}
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+
+
 #pragma mark ----------- Main Method  ---------------------
 
 IOReturn 
@@ -642,6 +470,33 @@ AppleUSBXHCI::CheckPeriodicBandwidth(int slotID, int __unused endpointIdx, UInt1
 
 
 
+static UInt32
+BandwidthBlocksToBytes(SInt16 bandwidthAvailableInBlocks, UInt8 controllingPortSpeed)
+{
+	if (bandwidthAvailableInBlocks <= 0)
+		return 0;
+	
+	switch (controllingPortSpeed)
+	{
+		case kUSBDeviceSpeedLow:
+			return (bandwidthAvailableInBlocks * kFSBytesPerBlock) / 8;
+			
+		case kUSBDeviceSpeedFull:
+			return bandwidthAvailableInBlocks * kFSBytesPerBlock;
+			
+		case kUSBDeviceSpeedHigh:
+			return bandwidthAvailableInBlocks * kHSBytesPerBlock;
+			
+		case kUSBDeviceSpeedSuper:
+			return bandwidthAvailableInBlocks * kSSBytesPerBlock;
+			
+		default:
+			return 0;
+	}
+}
+
+
+
 UInt32 		
 AppleUSBXHCI::GetBandwidthAvailable( void )
 {	
@@ -716,34 +571,7 @@ AppleUSBXHCI::GetBandwidthAvailableForDevice(IOUSBDevice *forDevice, UInt32 *pBa
 	}
 
 	
-	if (bandwidthAvailableInBlocks > 0)
-	{
-		switch (controllingPortSpeed)
-		{
-			case kUSBDeviceSpeedLow:
-				bandwidthAvailable = (bandwidthAvailableInBlocks * kFSBytesPerBlock) / 8;
-				break;
-				
-			case kUSBDeviceSpeedFull:
-				bandwidthAvailable = bandwidthAvailableInBlocks * kFSBytesPerBlock;
-				break;
-				
-			case kUSBDeviceSpeedHigh:
-				bandwidthAvailable = bandwidthAvailableInBlocks * kHSBytesPerBlock;
-				break;
-				
-			case kUSBDeviceSpeedSuper:
-				bandwidthAvailable = bandwidthAvailableInBlocks * kSSBytesPerBlock;
-				break;
-				
-			default:
-				bandwidthAvailable = 0;
-		}
-	}
-	else
-	{
-		bandwidthAvailable = 0;
-	}
+	bandwidthAvailable = BandwidthBlocksToBytes(bandwidthAvailableInBlocks, controllingPortSpeed);
 	
 	USBLog(2, "AppleUSBXHCI::GetBandwidthAvailableForRootHubPort - port(%d) portSpeed (%d) deviceSpeed(%d) - bandwidthAvailableInBlocks (%d) - returning (%d)", (int)rootHubPort, rhPortSpeed, deviceSpeed, bandwidthAvailableInBlocks, (int)bandwidthAvailable);
 	
@@ -758,3 +586,130 @@ AppleUSBXHCI::GetBandwidthAvailableForDevice(IOUSBDevice *forDevice, UInt32 *pBa
 
 
 
+// Answers "would this alternate setting fit" for IOUSBInterface::GetBandwidthAvailableForAlternateSetting.  The existing endpoints are
+// copied out of the contexts into an XHCIBandwidthModel, the device's endpoints in replaceEndpointMask are taken out, the new ones are
+// put in, and the root hub port (and TT, for a FS/LS device on a HS hub) is evaluated the same way CheckPeriodicBandwidth would
+IOReturn
+AppleUSBXHCI::GetBandwidthAvailableForEndpoints(IOUSBDevice *forDevice, UInt32 replaceEndpointMask, IOUSBEndpointProperties *endpoints, UInt32 numEndpoints, UInt32 *pBandwidthAvailable)
+{
+	IOReturn				ret = kIOReturnSuccess;
+	int						slotID = forDevice ? GetSlotID(forDevice->GetAddress()) : 0;
+	Context *				slotContext;
+	UInt8					rootHubPort;
+	UInt8					deviceSpeed;
+	UInt8					rhPortSpeed;
+	UInt8					controllingPortSpeed;
+	UInt32					numExisting;
+	UInt32					numFound;
+	UInt32					storageSize;
+	UInt32					dciMask = 0;
+	XHCIBandwidthEndpoint *	storage;
+	XHCIBandwidthEndpoint	device;
+	XHCIBandwidthModel		model;
+	SInt16					bandwidthAvailableInBlocks;
+	
+	if (!slotID || !pBandwidthAvailable || (numEndpoints && !endpoints) || (numEndpoints > kUSBMaxPipes))
+		return kIOReturnBadArgument;
+	
+	slotContext = GetSlotContext(slotID);
+	rootHubPort = GetSlCtxRootHubPort(slotContext);
+	deviceSpeed = GetSlCtxSpeed(slotContext);
+	
+	// the root hub port runs at the speed of whatever is plugged directly into it
+	rhPortSpeed = deviceSpeed;
+	for(int slot = 0; slot < _numDeviceSlots; slot++)
+	{
+		if((_slots[slot].buffer != NULL) && (GetSlCtxRouteString(GetSlotContext(slot)) == 0) && (GetSlCtxRootHubPort(GetSlotContext(slot)) == rootHubPort))
+		{
+			rhPortSpeed = GetSlCtxSpeed(GetSlotContext(slot));
+			break;
+		}
+	}
+	
+	bzero(&device, sizeof(device));
+	device.slot = slotID;
+	device.rhPort = rootHubPort;
+	device.epSpeed = deviceSpeed;
+	device.ttHubSlot = GetSlCtxTTSlot(slotContext);
+	device.ttHubPort = GetSlCtxTTPort(slotContext);
+	device.mtt = GetSlCtxMTT(slotContext);
+	
+	// room for the existing endpoints plus the new ones in the model, followed by the new ones as they are converted
+	numExisting = GatherPeriodicEndpoints(NULL, 0);
+	storageSize = (numExisting + (2 * numEndpoints) + 1) * sizeof(XHCIBandwidthEndpoint);
+	storage = (XHCIBandwidthEndpoint *)IOMalloc(storageSize);
+	if (!storage)
+		return kIOReturnNoMemory;
+	
+	// endpoints can come and go between the two passes, only use the ones which were filled in
+	numFound = GatherPeriodicEndpoints(storage, numExisting);
+	if (numFound < numExisting)
+		numExisting = numFound;
+	XHCIBandwidthModelInit(&model, storage, numExisting + numEndpoints);
+	model.count = numExisting;
+	
+	for (int ep = 1; ep < 16; ep++)
+	{
+		if (replaceEndpointMask & (1 << ep))
+			dciMask |= (1 << GetEndpointID(ep, kUSBOut));
+		if (replaceEndpointMask & (1 << (16 + ep)))
+			dciMask |= (1 << GetEndpointID(ep, kUSBIn));
+	}
+	
+	XHCIBandwidthEndpoint *	candidates = storage + numExisting + numEndpoints;
+	UInt32					numCandidates = 0;
+	
+	for (UInt32 i = 0; i < numEndpoints; i++)
+	{
+		IOUSBEndpointProperties *	props = &endpoints[i];
+		XHCIBandwidthEndpoint *		candidate = &candidates[numCandidates];
+		
+		if ((props->bTransferType != kUSBInterrupt) && (props->bTransferType != kUSBIsoc))
+			continue;
+		
+		*candidate = device;
+		candidate->dci = GetEndpointID(props->bEndpointNumber, props->bDirection);
+		candidate->epInterval = XHCIBandwidthEndpointInterval(deviceSpeed, (props->bTransferType == kUSBIsoc), props->bInterval);
+		candidate->maxBurst = props->bMaxBurst;
+		candidate->mult = props->bMult;
+		candidate->mps = props->wMaxPacketSize;
+		if (deviceSpeed == kUSBDeviceSpeedHigh)
+			XHCIBandwidthFoldHSMult(&candidate->mps, &candidate->maxBurst, &candidate->mult);
+		numCandidates++;
+	}
+	
+	USBLog(5, "AppleUSBXHCI[%p]::GetBandwidthAvailableForEndpoints - slot(%d) rhPort(%d) replacing dciMask(0x%x) with %d periodic endpoints, %d existing", this, slotID, rootHubPort, (int)dciMask, (int)numCandidates, (int)numExisting);
+	
+	XHCIBandwidthModelRemoveMask(&model, slotID, dciMask);
+	for (UInt32 i = 0; i < numCandidates; i++)
+		XHCIBandwidthModelAdd(&model, &candidates[i]);
+	
+	bandwidthAvailableInBlocks = XHCIBandwidthModelAvailable(&model, rootHubPort, rhPortSpeed, NULL);
+	controllingPortSpeed = rhPortSpeed;
+	
+	if ((bandwidthAvailableInBlocks >= 0) && (rhPortSpeed == kUSBDeviceSpeedHigh) && (deviceSpeed != kUSBDeviceSpeedHigh))
+	{
+		XHCIBandwidthInterval	ttTable[kMaxIntervalTableSize];
+		
+		// FS or LS device on a HS hub - it is the secondary bandwidth of its own TT which counts
+		XHCIBandwidthModelTTTable(&model, rhPortSpeed, &device, ttTable);
+		bandwidthAvailableInBlocks = XHCIBandwidthAvailable(ttTable, kLSFSBandwidthLimitInBlocks);
+		controllingPortSpeed = deviceSpeed;
+	}
+	else if ((rhPortSpeed == kUSBDeviceSpeedFull) && (deviceSpeed != kUSBDeviceSpeedFull))
+	{
+		// FS hub in the root port - LS device downstream
+		controllingPortSpeed = deviceSpeed;
+	}
+	
+	if (bandwidthAvailableInBlocks < 0)
+		ret = kIOReturnNoBandwidth;
+	
+	*pBandwidthAvailable = BandwidthBlocksToBytes(bandwidthAvailableInBlocks, controllingPortSpeed);
+	
+	USBLog(5, "AppleUSBXHCI[%p]::GetBandwidthAvailableForEndpoints - port(%d) portSpeed(%d) deviceSpeed(%d) - bandwidthAvailableInBlocks(%d) - returning (%d)", this, rootHubPort, rhPortSpeed, deviceSpeed, bandwidthAvailableInBlocks, (int)*pBandwidthAvailable);
+	
+	IOFree(storage, storageSize);
+	
+	return ret;
+}
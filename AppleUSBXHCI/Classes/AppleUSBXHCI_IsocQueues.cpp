@@ -920,6 +920,9 @@ AppleUSBXHCI::AddIsocFramesToSchedule(AppleXHCIIsochEndpoint* pEP)
 				IOSimpleLockUnlock(_isochScheduleLock);
 				// OK to call USBLog, now that preemption is reenabled
 				USBTrace(kUSBTXHCI, kTPXHCIAddIsochFramesToSchedule, (uintptr_t)pEP, (uint32_t)pEP->scheduledTDs, (uint32_t)pEP->deferredTDs, 2);
+				// endpoints with real time completions don't need the thread call
+				if ( QueueRealTimeIsochCompletion(pEP) )
+					return;
 				bool alreadyQueued = thread_call_enter1(_returnIsochDoneQueueThread, (thread_call_param_t) pEP);
 				if ( alreadyQueued )
 				{
@@ -22,6 +22,34 @@
 //
 //================================================================================================
 //
+#define kXHCIPowerPhaseTimingsKey		"Power Phase Timings"
+
+// Microseconds since *start, and restarts *start so consecutive phases can be timed
+static UInt32
+MicrosecondsSince(uint64_t *start)
+{
+	uint64_t	now = mach_absolute_time();
+	uint64_t	elapsed = now - *start;
+	uint64_t	nanoseconds;
+	
+	absolutetime_to_nanoseconds( *( AbsoluteTime * ) &elapsed, &nanoseconds );
+	*start = now;
+	
+	return (UInt32)(nanoseconds / 1000);
+}
+
+static void
+SetTimingProperty(OSDictionary *timings, const char *key, UInt32 value)
+{
+	OSNumber *	number = OSNumber::withNumber(value, 32);
+	
+	if (number)
+	{
+		timings->setObject(key, number);
+		number->release();
+	}
+}
+
 #ifndef XHCI_USE_KPRINTF 
 #define XHCI_USE_KPRINTF 0
 #endif
@@ -237,6 +265,7 @@ AppleUSBXHCI::RestartControllerFromReset(void)
     // TODO:: Similar to UIMInitialize, we have to collapse both together.
     if (!_uimInitialized)
     {
+        uint64_t resetStart = mach_absolute_time();
         IOReturn status = ResetController();
 
         if( status != kIOReturnSuccess )
@@ -408,6 +437,7 @@ AppleUSBXHCI::RestartControllerFromReset(void)
         
         
         _uimInitialized = true;
+        _wakeResetTime = MicrosecondsSince(&resetStart);
     }
     
     return(kIOReturnSuccess);
@@ -646,6 +676,28 @@ void AppleUSBXHCI::SetPropsForBookkeeping(void)
 		_device->setProperty(kAppleMaxPortCurrentInSleep, 0x0834, 32U);
 	if (!OSDynamicCast(OSNumber, _device->getProperty(kAppleCurrentExtraInSleep)))
 		_device->setProperty(kAppleCurrentExtraInSleep, 0x0A8C, 32U);
+
+	/*
+	 * Timings of the last sleep and wake, so slow transitions can be
+	 * attributed to a phase without turning on logging.
+	 */
+	if (_sleepQuiesceTime || _wakeRestoreTime || _wakeResetTime)
+	{
+		OSDictionary *	timings = OSDictionary::withCapacity(7);
+		
+		if (timings)
+		{
+			SetTimingProperty(timings, "Sleep Quiesce (us)", _sleepQuiesceTime);
+			SetTimingProperty(timings, "Sleep Endpoints Stopped", _sleepEndpointsStopped);
+			SetTimingProperty(timings, "Sleep Suspend (us)", _sleepSuspendTime);
+			SetTimingProperty(timings, "Sleep Save State (us)", _sleepSaveTime);
+			SetTimingProperty(timings, "Wake Restore (us)", _wakeRestoreTime);
+			SetTimingProperty(timings, "Wake Restart Endpoints (us)", _wakeRestartTime);
+			SetTimingProperty(timings, "Wake Reset (us)", _wakeResetTime);
+			setProperty(kXHCIPowerPhaseTimingsKey, timings);
+			timings->release();
+		}
+	}
 }
 
 //================================================================================================
@@ -664,6 +716,8 @@ AppleUSBXHCI::RestoreControllerStateFromSleep(void)
   UInt32 portIndex;
 	volatile UInt32 val = 0;
 	volatile UInt32 * addr;
+  uint64_t wakeStart = mach_absolute_time();
+  uint64_t phaseStart;
 
   USBLog(2, "AppleUSBXHCI[%p]::RestoreControllerStateFromSleep _myPowerState: %d _stateSaved %d", this, (uint32_t)_myPowerState, _stateSaved);
 	PrintRuntimeRegs();
@@ -829,6 +883,9 @@ AppleUSBXHCI::RestoreControllerStateFromSleep(void)
         RestartControllerFromReset();
         SantizePortsAfterPowerLoss();
 
+        _wakeRestartTime = 0;
+        _wakeRestoreTime = MicrosecondsSince(&wakeStart);
+        SetPropsForBookkeeping();
         return kIOReturnSuccess;
       } else {
 
@@ -878,7 +935,11 @@ AppleUSBXHCI::RestoreControllerStateFromSleep(void)
 
   DisableComplianceMode();
 
-  // Restart all endpoints
+  // Restart all endpoints.  The doorbell writes for the non-stream endpoints go out back to back
+  // behind a single barrier rather than StartEndpoint's pair per endpoint, the controller then
+  // restarts the rings concurrently.
+  phaseStart = mach_absolute_time();
+  IOSync();
   for(slot = 0; slot<_numDeviceSlots; slot++)
 	{
 		if(_slots[slot].buffer != NULL)
@@ -897,12 +958,14 @@ AppleUSBXHCI::RestoreControllerStateFromSleep(void)
 					else
 					{
             USBLog(5, "AppleUSBXHCI[%p]::RestoreControllerStateFromSleep - slot=%d doorbell4ep=%d", this, slot, endp);
-            StartEndpoint(slot, endp);
+            Write32Reg(&_pXHCIDoorbells[slot], endp);
 					}
 				}
 			}
 		}
 	}
+  IOSync();
+  _wakeRestartTime = MicrosecondsSince(&phaseStart);
 
   // Deal with any port with CAS (Cold Attach Status) set
 	for (portIndex=0; portIndex < _rootHubNumPorts; portIndex++)
@@ -932,6 +995,10 @@ AppleUSBXHCI::RestoreControllerStateFromSleep(void)
 		}
 	}
 
+  _wakeRestoreTime = MicrosecondsSince(&wakeStart);
+  USBLog(5, "AppleUSBXHCI[%p]::RestoreControllerStateFromSleep - restored in %dus (endpoints %dus)", this, (int)_wakeRestoreTime, (int)_wakeRestartTime);
+  SetPropsForBookkeeping();
+
   return kIOReturnSuccess;
 }
 
@@ -1083,27 +1150,11 @@ IOReturn
 AppleUSBXHCI::QuiesceAllEndpoints ( )
 {   
     IOReturn ret = kIOPMAckImplied;
-    int slot, endp;
     USBLog(5, "AppleUSBXHCI[%p]::QuiesceAllEndpoints", this);
 
     if (_resetControllerFix == true)
     {
-        for(slot = 0; slot<_numDeviceSlots; slot++)
-        {
-            if(_slots[slot].buffer != NULL)
-            {
-                for(endp = 1; endp<kXHCI_Num_Contexts; endp++)
-                {
-                    XHCIRing *ring;
-                    ring = GetRing(slot, endp, 0);
-                    if( (ring != NULL) && (ring->TRBBuffer != NULL) )
-                    {
-                        USBLog(1, "AppleUSBXHCI[%p]::QuiesceAllEndpoints calling QuiesceEndpoint = %d, %d ", this, slot, endp);
-                        QuiesceEndpoint(slot, endp);
-                    }
-                }
-            }
-        }
+        _sleepEndpointsStopped = StopAllEndpoints();
 
         return kIOReturnSuccess;
     } else {
@@ -1138,22 +1189,8 @@ AppleUSBXHCI::QuiesceAllEndpoints ( )
     }
     
     // Stop all endpoints
-    for(slot = 0; slot<_numDeviceSlots; slot++)
-    {
-        if(_slots[slot].buffer != NULL)
-        {
-            for(endp = 1; endp<kXHCI_Num_Contexts; endp++)
-            {
-                XHCIRing *ring;
-                ring = GetRing(slot, endp, 0);
-                if( (ring != NULL) && (ring->TRBBuffer != NULL) )
-                {
-                    USBLog(1, "AppleUSBXHCI[%p]::QuiesceAllEndpoints calling QuiesceEndpoint = %d, %d ", this, slot, endp);
-                    QuiesceEndpoint(slot, endp);
-                }
-            }
-        }
-    }
+    _sleepEndpointsStopped = StopAllEndpoints();
+    USBLog(5, "AppleUSBXHCI[%p]::QuiesceAllEndpoints stopped %d endpoints", this, (int)_sleepEndpointsStopped);
     
     int commandRingRunning = (int)Read64Reg(&_pXHCIRegisters->CRCR);
 	if (_lostRegisterAccess)
@@ -1214,22 +1251,31 @@ IOReturn AppleUSBXHCI::CommandStop(void)
 void
 AppleUSBXHCI::ControllerSleep ( void )
 {
+    uint64_t    phaseStart;
+    
     USBLog(5, "AppleUSBXHCI[%p]::ControllerSleep", this);
     if(_myPowerState == kUSBPowerStateLowPower)
         WakeControllerFromDoze();
     
+    phaseStart = mach_absolute_time();
     QuiesceAllEndpoints();
+    _sleepQuiesceTime = MicrosecondsSince(&phaseStart);
 
     if (_resetControllerFix == true)
     {
         CompleteSuspendOnAllPorts();
         CommandStop();
     }
+    _sleepSuspendTime = MicrosecondsSince(&phaseStart);
 
     EnableInterruptsFromController(false);
     IOSleep(1U);	// drain primary interrupts
 
+    phaseStart = mach_absolute_time();
     SaveControllerStateForSleep();
+    _sleepSaveTime = MicrosecondsSince(&phaseStart);
+    
+    USBLog(5, "AppleUSBXHCI[%p]::ControllerSleep - quiesce %dus (%d endpoints), suspend %dus, save %dus", this, (int)_sleepQuiesceTime, (int)_sleepEndpointsStopped, (int)_sleepSuspendTime, (int)_sleepSaveTime);
 }
 
 
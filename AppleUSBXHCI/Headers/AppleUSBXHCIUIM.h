@@ -20,10 +20,12 @@
 #include "../../IOUSBFamily/Headers/IOUSBLog.h"
 #include "../../IOUSBFamily/Headers/IOUSBControllerV3.h"
 #include "../../IOUSBFamily/Headers/USBTracepoints.h"
+#include "../../IOUSBFamily/Headers/AppleUSBDiagnostics.h"
 
 #include "AppleUSBXHCI_IsocQueues.h"
 #include "AppleUSBXHCI_RootHub.h"
 #include "XHCI.h"
+#include "XHCIBandwidthModel.h"
 
 
 #define kMaxImmediateTRBTransferSize        8        
@@ -225,6 +227,16 @@ typedef struct XHCICommandCompletion
 	SInt32			parameter;
 } XHCICommandCompletion;
 
+// A Stop Endpoint command queued by StopAllEndpoints, waiting to be reaped by FinishStopEndpoints
+#define kXHCIMaxBatchedCommands			64
+
+typedef struct XHCIStopRequest
+{
+	SInt32 *		result;						// &_CMDCompletions[].parameter
+	UInt8			slotID;
+	UInt8			endpointID;
+} XHCIStopRequest;
+
 typedef struct XHCIInterrupter
 {
     // Integers
@@ -277,56 +289,11 @@ protected:
     bool                                    stopPending;
 
     // AnV - Added missing code
-    enum{
-        kDiagMaxPorts = 32,
-        kXHCIMaxCompletionCodes = 256,
-        kXHCILinkStates = 16
-    };
-    typedef struct
-    {
-        UInt32          errorCount;
-        UInt32          xhciErrorCode[kXHCIMaxCompletionCodes];
-        UInt64			prevBytes;
-        UInt64			totalBytes;
-        UInt32			timeouts;
-        UInt32			prevTimeouts;
-        UInt32			prevResets;
-        UInt32			resets;
-        UInt32			enable;
-        UInt32			suspend;
-        UInt32			resume;
-        UInt32			warmReset;
-        UInt32			linkState[kXHCILinkStates];
-        UInt32			power;
-        UInt32			u1Timeout;
-        UInt32			u2Timeout;
-        UInt32			remoteWakeMask;
-    } UIMPortDiagnostics;
-
-    typedef struct
-    {
-        UInt64			lastNanosec;
-        UInt64			totalBytes;
-        UInt64			prevBytes;
-        UInt32			acessCount;
-        UInt32			totalErrors;
-        UInt32			prevErrors;
-        UInt32			timeouts;
-        UInt32			prevTimeouts;
-        UInt32			resets;
-        UInt32			prevResets;
-        UInt32			recoveredErrors;
-        UInt32			prevRecoveredErrors;
-        UInt32			errors2Strikes;
-        UInt32			prevErrors2Strikes;
-        UInt32			errors3Strikes;
-        UInt32			prevErrors3Strikes;
-        UInt32			controlBulkTxOut;
-        SInt32          numPorts;
-        UIMPortDiagnostics portCounts[kDiagMaxPorts];
-        UInt32          overFlowPortErrorCount;
-    } UIMDiagnostics;
+    // Same layout as the family's diagnostics so an AppleUSBDiagnostics object can publish it
+    typedef AppleUSBDiagnostics::UIMPortDiagnostics     UIMPortDiagnostics;
+    typedef AppleUSBDiagnostics::UIMDiagnostics         UIMDiagnostics;
     UIMDiagnostics                          _UIMDiagnostics;
+    OSObject                                *_diagnostics;                      // AppleUSBDiagnostics published as "Statistics"
 
     IOMemoryMap								*_deviceBase;
     UInt16									_vendorID;
@@ -441,6 +408,7 @@ protected:
 	UInt16									_saveChange[kMaxSavePortStatus];
     
     SInt16                                   _contextInUse;
+    UInt32                                   _inputContextContention;		// Times GetInputContext found the shared input context already in use
     
     UInt16                                  _NECControllerVersion;
     
@@ -483,6 +451,15 @@ protected:
     // Default value of the NoSleepForced key
     bool                                    _noSleepForced;
 
+    // How long the last sleep and wake took, in microseconds.  Published by SetPropsForBookkeeping
+    UInt32                                  _sleepQuiesceTime;          // QuiesceAllEndpoints
+    UInt32                                  _sleepSuspendTime;          // suspending ports and stopping the command ring
+    UInt32                                  _sleepSaveTime;             // SaveControllerStateForSleep
+    UInt32                                  _sleepEndpointsStopped;     // Stop Endpoint commands issued by the last QuiesceAllEndpoints
+    UInt32                                  _wakeRestoreTime;           // RestoreControllerStateFromSleep
+    UInt32                                  _wakeRestartTime;           // of which restarting the endpoints
+    UInt32                                  _wakeResetTime;             // RestartControllerFromReset
+
 private:
     // These methods come from Xhci.asl file from EFI
     char                                    ehciMuxedPorts[kMaxHCPortMethods][kHCPortMethodNameLen];
@@ -527,6 +504,8 @@ private:
     void ClearStopTDs(int slotID, int EndpointID);
 	int StopEndpoint(int slotID, int EndpointID);
     int QuiesceEndpoint(int slotID, int endpointID);
+    UInt32 StopAllEndpoints(void);
+    UInt32 FinishStopEndpoints(XHCIStopRequest *batch, int count);
 	void ClearEndpoint(int slotID, int EndpointID);
 	IOReturn ReturnAllTransfersAndReinitRing(int slotID, int EndpointID, UInt32 streamID);
 	IOReturn ReinitTransferRing(int slotID, int EndpointID, UInt32 streamID);
@@ -688,6 +667,7 @@ private:
 							void                        *pEP);
 	
 	IOReturn BuildRHPortBandwidthArray(OSArray *rhPortArray);
+	UInt32 GatherPeriodicEndpoints(XHCIBandwidthEndpoint *endpoints, UInt32 capacity);
 	
 	IOReturn CheckPeriodicBandwidth(int			slotID,
                                     int			endpointIdx,
@@ -1040,6 +1020,7 @@ public:
     
 	
 	virtual IOReturn    GetBandwidthAvailableForDevice(IOUSBDevice *forDevice, UInt32 *pBandwidthAvailable);
+	virtual IOReturn    GetBandwidthAvailableForEndpoints(IOUSBDevice *forDevice, UInt32 replaceEndpointMask, IOUSBEndpointProperties *endpoints, UInt32 numEndpoints, UInt32 *pBandwidthAvailable);
 
 	virtual IOReturn	UIMDeviceToBeReset(short functionAddress);
 	bool				checkEPForTimeOuts(int slot, int endp, UInt32 stream, UInt32 curFrame);
@@ -15,7 +15,6 @@
 class AppleXHCIAsyncEndpoint;
 class AppleUSBXHCI;
 
-#define kFreeTDs                        1
 #define kAsyncMaxFragmentSize           PAGE_SIZE*32      // 4K * 32 = 128K this is > the max value for TRB length field 
                                                           // but ::_createTransfer->GenerateNextPhysicalSegment takes care 
                                                           // of the range not crossing 64K boundary
@@ -23,48 +22,53 @@ class AppleUSBXHCI;
 #define kAccountForAlignment            2                 // For Event DATA trb & unaligned buffer
 #define kMinimumTDs                     1
 
+#define kAsyncTRBsPerArenaTD            4                 // An endpoint's first TD arena has one TD for every 4 TRBs in its ring,
+#define kAsyncMinArenaTDs               8                 // but at least 8.  Later arenas are the same size.
+
 // AppleXHCIAsyncTransferDescriptors - ATDs
-class AppleXHCIAsyncTransferDescriptor : public OSObject
+// These are not OSObjects.  Each endpoint carves them out of its AppleXHCIAsyncTDArenas, so nothing is
+// allocated per transfer on the I/O path.  The fields used to schedule and complete a TD come first.
+class AppleXHCIAsyncTransferDescriptor
 {
-    OSDeclareDefaultStructors(AppleXHCIAsyncTransferDescriptor)
-
 public:
-	virtual bool	init();
-	virtual void    free(void);
-    
     void print(int level);
     void reinit();
 
+    AppleXHCIAsyncTransferDescriptor	*_logicalNext;				// the next element in the list
+    AppleXHCIAsyncTransferDescriptor	*_logicalPrev;				// the previous element in the list, so RemoveTD can unlink from the middle
 	IOUSBCommand	*activeCommand;		// Lookup ID across lists.
+    AppleXHCIAsyncEndpoint              *_endpoint;
+    SInt16          completionIndex;
+    UInt16          streamID;
+	UInt32 			trbIndex;			// Say index 27 to 32 for this particular transfer in the ring
+	UInt32 			trbCount;			// For example: 20K will take 5 or 6 TRBs
 	UInt32			transferSize;		// Minimum should be maxBurst - 48K for SS or HS
+    UInt32          shortfall;
 	UInt32			remAfterThisTD;		// the remaining size in the TDs AFTER this one
 	IOByteCount     startOffset;		// From IOUSBCommand so we can tell _createTransfer where to start
-	UInt32 			trbIndex;			// Say index 27 to 32 for this particular transfer in the ring
-	UInt32 			trbCount;			// For example: 20K will take 5 or 6 TRBs
-    bool            interruptThisTD;    // 
-    bool            fragmentedTD;       // Indicates a fragmented TD. False for transfers < kAsyncMaxFragmentSize
-    UInt16          totalTDs;           // filled in the last TD to indicate the total fragments for this transfer
     UInt32          offCOverride;
-    UInt32          shortfall;
     UInt16          maxTRBs;            // = (transferSize ÷ 4K pages) + kAccountForAlignment 
-    bool            immediateTransfer;
+    UInt16          totalTDs;           // filled in the last TD to indicate the total fragments for this transfer
+    bool            interruptThisTD;    // 
+    bool            fragmentedTD;       // Indicates a fragmented TD. False for transfers < kAsyncMaxFragmentSize
     bool            last;
-    UInt8           immediateBuffer[kMaxImmediateTRBTransferSize];
-    UInt16          streamID;
-    SInt16          completionIndex;
-    
+    bool            immediateTransfer;
     bool            flushed;
     bool            lastFlushedTD;
     bool            lastInRing;
-        
-    AppleXHCIAsyncEndpoint              *_endpoint;
-    AppleXHCIAsyncTransferDescriptor	*_logicalNext;				// the next element in the list
     
-
-    // constructor method
-    static AppleXHCIAsyncTransferDescriptor 	*ForEndpoint(AppleXHCIAsyncEndpoint *endpoint);
+    UInt64          submitTime;         // mach_absolute_time() when the last TD was queued, for the endpoint statistics
+    UInt8           immediateBuffer[kMaxImmediateTRBTransferSize];
 };
 
+typedef struct AppleXHCIAsyncTDArena
+{
+    struct AppleXHCIAsyncTDArena        *next;
+    UInt32                              count;
+    UInt32                              size;                       // of the allocation
+    AppleXHCIAsyncTransferDescriptor    tds[1];                     // count of them
+} AppleXHCIAsyncTDArena;
+
 class AppleXHCIAsyncEndpoint : public OSObject
 {
     friend class AppleUSBXHCI;
@@ -111,6 +115,18 @@ public:
     UInt32                              _actualFragmentSize;
     
     AppleUSBXHCI                        *_xhciUIM;
+    
+    AppleXHCIAsyncTDArena               *_arenas;                   // where the TDs live, freed with the endpoint
+    UInt32                              _arenaTDs;                  // TDs in all of the arenas
+    
+    AppleXHCIAsyncTransferDescriptor    **_activeByIndex;           // TDs on the activeQueue by completionIndex
+    UInt32                              _activeByIndexCount;        // entries in _activeByIndex, the ring size when it was made
+
+    bool GrowTDArena();
+    
+    void RemoveTD(AppleXHCIAsyncTransferDescriptor **qStart, AppleXHCIAsyncTransferDescriptor **qEnd, AppleXHCIAsyncTransferDescriptor *pTD, UInt32 *qCount);
+    
+    void RemoveTDFromActiveIndex(AppleXHCIAsyncTransferDescriptor *pTD);
 
     void PutTDAtHead(AppleXHCIAsyncTransferDescriptor **qStart, AppleXHCIAsyncTransferDescriptor **qEnd, AppleXHCIAsyncTransferDescriptor *pTD, UInt32 *qCount);
     
@@ -13,33 +13,8 @@
 #include <libkern/c++/OSArray.h>
 
 #include "AppleUSBXHCIUIM.h"
+#include "XHCIBandwidthModel.h"
 
-enum 
-{
-	kMaxFSIsochInterval				= 18,				
-	kMaxFSLSInterruptInterval		= 10,
-	kMaxHSSSInterval				= 15,
-	kMaxIntervalTableSize			= 15,
-	
-	// these are Intels numbers of overhead measured in blocks
-	kLSPacketOverheadInBlocks		= 128,
-	kFSPacketOverheadInBlocks		= 20,
-	kHSPacketOverheadInBlocks		= 26,
-	kSSInitialOverheadInBlocks		= 32,
-	kSSBurstOverheadInBlocks		= 8,
-	
-	// these value already take into account encoding (for SS and DMI) and bit stuffing (for the others)
-	kSSBytesPerBlock				= 16,
-	kHSBytesPerBlock				= 4,
-	kFSBytesPerBlock				= 1,
-	kUplinkDMIBytesPerBlock			= 32,
-	
-	// these values already take into account the cost of bit stuffing so we can actually use normal MPS
-	// instead of adding in the bitstuffing again (Table 3 Section 2.4)
-	kLSFSBandwidthLimitInBlocks		= 1156,									// 1285 blocks (including bitstuffing) * 90% (this is per ms)
-	kHSBandwidthLimitInBlocks		= 1285,									// 1607 blocks (including bitstuffing) * 80% (this is per uSec)
-	kSSBandwidthLimitInBlocks		= 3515									// 3906 blocks * 90% (this is per uFrame)
-};
 
 
 
@@ -55,12 +30,7 @@ public:
 	UInt8			hubSlotID;
 	UInt8			hubPortNum;
 	bool			mtt;
-	struct
-	{
-		UInt8		totalPackets;						// LS packets are converted to FS packets and lumped together
-		UInt8		packetOverhead;						// LS packets will force a higher packet overhead once it gets to this interval
-		UInt16		worstCaseMPS;						// a LS packet will have to be multipled by 8 when calculating MPS
-	} interval[kMaxIntervalTableSize];
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];	// LS packets are converted to FS packets, with a higher overhead
 };
 
 
@@ -80,12 +50,7 @@ public:
 	UInt8		rhPort;								// root hub port number (1 based)
 	UInt8		rhPortSpeed;						// the speed at which this root hub port is operating
 	OSArray		*ttArray;							// keep track of any TT tables which are downstream of this RH
-	struct
-	{
-		UInt8		totalPackets;					// number of packets for this interval
-		UInt8		packetOverhead;					// a LS packet on a FS root hub port will force a higher packet overhead once it gets to this interval
-		UInt16		worstCaseMPS;					// the worst case MPS for this interval
-	} interval[kMaxIntervalTableSize];
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
 };
 
 
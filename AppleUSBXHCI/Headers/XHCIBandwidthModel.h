@@ -0,0 +1,628 @@
+//
+//  XHCIBandwidthModel.h
+//  AppleUSBXHCI
+//
+//  Copyright 2013 Apple Inc. All rights reserved.
+//
+
+#ifndef AppleUSBXHCI_XHCIBandwidthModel_h
+#define AppleUSBXHCI_XHCIBandwidthModel_h
+
+#include <libkern/OSTypes.h>
+
+//================================================================================================
+//
+//	Periodic bandwidth model
+//
+//	The arithmetic behind RootHubPortTable and TTBandwidthTable (AppleUSBXHCI_Bandwidth.cpp).
+//	Each root hub port, and each TT below a HS hub, keeps a table indexed by the XHCI interval
+//	(2^n microframes) of how many packets are scheduled at that interval and the largest of them.
+//	XHCIBandwidthBlocksUsed() folds the table into the worst case number of blocks used in one
+//	service interval of the port, which is compared against the limit for the port speed.
+//
+//	On top of the tables there is an endpoint list, XHCIBandwidthModel, which endpoints can be
+//	added to and removed from one at a time.  The tables for a port are rebuilt from the list
+//	whenever the port is evaluated, since removing the largest packet of an interval can't be
+//	undone in the table itself.  This is what AppleUSBXHCI uses to answer "would this set of
+//	endpoints fit instead of that one" without touching the hardware, and it only depends on
+//	OSTypes.h so it can be built into a user space tool and fed a made up topology.
+//
+//	Speeds are the kUSBDeviceSpeed values from USB.h and intervals are in XHCI endpoint context
+//	format (0 = 1 microframe, 3 = 1ms, etc.).  The callers must supply storage for the list.
+//
+//================================================================================================
+
+enum
+{
+	kMaxFSIsochInterval				= 18,
+	kMaxFSLSInterruptInterval		= 10,
+	kMaxHSSSInterval				= 15,
+	kMaxIntervalTableSize			= 15,
+
+	// these are Intels numbers of overhead measured in blocks
+	kLSPacketOverheadInBlocks		= 128,
+	kFSPacketOverheadInBlocks		= 20,
+	kHSPacketOverheadInBlocks		= 26,
+	kSSInitialOverheadInBlocks		= 32,
+	kSSBurstOverheadInBlocks		= 8,
+
+	// these value already take into account encoding (for SS and DMI) and bit stuffing (for the others)
+	kSSBytesPerBlock				= 16,
+	kHSBytesPerBlock				= 4,
+	kFSBytesPerBlock				= 1,
+	kUplinkDMIBytesPerBlock			= 32,
+
+	// these values already take into account the cost of bit stuffing so we can actually use normal MPS
+	// instead of adding in the bitstuffing again (Table 3 Section 2.4)
+	kLSFSBandwidthLimitInBlocks		= 1156,									// 1285 blocks (including bitstuffing) * 90% (this is per ms)
+	kHSBandwidthLimitInBlocks		= 1285,									// 1607 blocks (including bitstuffing) * 80% (this is per uSec)
+	kSSBandwidthLimitInBlocks		= 3515									// 3906 blocks * 90% (this is per uFrame)
+};
+
+// These must match kUSBDeviceSpeedLow, etc. in USB.h, which this file does not include
+enum
+{
+	kXHCIBandwidthSpeedLow			= 0,
+	kXHCIBandwidthSpeedFull			= 1,
+	kXHCIBandwidthSpeedHigh			= 2,
+	kXHCIBandwidthSpeedSuper		= 3,
+
+	kXHCIBandwidthMaxPacketSize		= 1024,									// largest base MPS of any periodic endpoint
+	kXHCIBandwidthNoHeadroom		= -1
+};
+
+typedef struct XHCIBandwidthInterval
+{
+	UInt8		totalPackets;					// number of packets for this interval
+	UInt8		packetOverhead;					// the largest per packet overhead seen at this interval
+	UInt16		worstCaseMPS;					// the worst case MPS for this interval, in blocks
+} XHCIBandwidthInterval;
+
+typedef struct XHCIBandwidthEndpoint
+{
+	UInt8		slot;							// slot and DCI identify the endpoint in the list
+	UInt8		dci;
+	UInt8		rhPort;							// root hub port number (1 based)
+	UInt8		epSpeed;
+	UInt8		epInterval;						// XHCI format
+	UInt8		maxBurst;						// 0 based
+	UInt8		mult;							// 0 based
+	UInt8		ttHubSlot;						// 0 unless the endpoint is behind a TT
+	UInt8		ttHubPort;
+	UInt8		mtt;
+	UInt16		mps;							// base MPS, without burst or mult
+} XHCIBandwidthEndpoint;
+
+typedef struct XHCIBandwidthModel
+{
+	XHCIBandwidthEndpoint *		endpoints;
+	UInt32						count;
+	UInt32						capacity;
+} XHCIBandwidthModel;
+
+static inline UInt32
+XHCIBandwidthLimitInBlocks(UInt8 portSpeed)
+{
+	switch (portSpeed)
+	{
+		case kXHCIBandwidthSpeedLow:
+		case kXHCIBandwidthSpeedFull:
+			return kLSFSBandwidthLimitInBlocks;
+
+		case kXHCIBandwidthSpeedHigh:
+			return kHSBandwidthLimitInBlocks;
+
+		case kXHCIBandwidthSpeedSuper:
+			return kSSBandwidthLimitInBlocks;
+
+		default:
+			return 0;
+	}
+}
+
+
+
+// Converts a bInterval to the XHCI interval the UIM will program for the endpoint (see UIMCreateInterruptEndpoint and CreateIsochEndpoint)
+static inline UInt8
+XHCIBandwidthEndpointInterval(UInt8 epSpeed, bool isoch, UInt8 bInterval)
+{
+	UInt8		xhciInterval;
+
+	if (isoch)
+	{
+		if (epSpeed < kXHCIBandwidthSpeedHigh)
+			return 3;									// FS isoch is always 8 microframes
+
+		return (bInterval > 1) ? (bInterval - 1) : 0;
+	}
+
+	if (epSpeed < kXHCIBandwidthSpeedHigh)
+	{
+		// FS/LS interrupt intervals are in ms, round down to a power of 2
+		if (bInterval == 0)
+			bInterval = 1;
+
+		xhciInterval = 3;
+		while (bInterval)
+		{
+			xhciInterval++;
+			bInterval >>= 1;
+		}
+		return xhciInterval - 1;
+	}
+
+	if (bInterval >= 16)
+		bInterval = 15;
+
+	return (bInterval > 1) ? (bInterval - 1) : 0;
+}
+
+
+
+// A HS high bandwidth endpoint is programmed with its mult turned into a burst (see UIMCreateInterruptEndpoint and
+// UIMCreateIsochEndpoint), so fold the descriptor's base MPS and 0 based mult the same way before putting it in a table
+static inline void
+XHCIBandwidthFoldHSMult(UInt16 *mps, UInt8 *maxBurst, UInt8 *mult)
+{
+	UInt32		fullMPS = (UInt32)*mps * (*mult + 1);
+	UInt32		burst = 0;
+
+	if (fullMPS > kXHCIBandwidthMaxPacketSize)
+	{
+		burst = (fullMPS + kXHCIBandwidthMaxPacketSize - 1) / kXHCIBandwidthMaxPacketSize;
+		fullMPS = (fullMPS + burst - 1) / burst;
+		burst--;
+	}
+
+	*mps = (UInt16)fullMPS;
+	*maxBurst = (UInt8)burst;
+	*mult = 0;
+}
+
+
+
+static inline void
+XHCIBandwidthClearTable(XHCIBandwidthInterval *interval)
+{
+	int		i;
+
+	for (i=0; i < kMaxIntervalTableSize; i++)
+	{
+		interval[i].worstCaseMPS = 0;
+		interval[i].totalPackets = 0;
+		interval[i].packetOverhead = 0;
+	}
+}
+
+
+
+// Adds an endpoint to a root hub port table.  Returns the MPS which should be added to the TT table if the endpoint is behind one
+static inline UInt16
+XHCIBandwidthPortAdd(XHCIBandwidthInterval *interval, UInt8 portSpeed, UInt8 epInterval, UInt16 mps, UInt8 maxBurst, UInt8 mult, UInt8 epSpeed)
+{
+	UInt16			mpsInBlocks = mps;
+	UInt16			packetoverhead;
+
+	// a bInterval of 16 (32768 uFrames) is past the end of the table, so count it as the longest interval we track
+	if (epInterval >= kMaxIntervalTableSize)
+		epInterval = kMaxIntervalTableSize - 1;
+
+	interval[epInterval].totalPackets += (maxBurst +1);
+
+	if ((portSpeed == kXHCIBandwidthSpeedLow) || ((portSpeed == kXHCIBandwidthSpeedFull) && (epSpeed == kXHCIBandwidthSpeedLow)))
+	{
+		// this is either a LS device directly connected or a LS device connected to a FS hub which is directly connected
+		mpsInBlocks *= 8;								// convert to FS equivalent
+		mpsInBlocks += (kFSBytesPerBlock-1);			// round up
+		mpsInBlocks /= kFSBytesPerBlock;
+		packetoverhead = kLSPacketOverheadInBlocks;
+	}
+	else if (portSpeed == kXHCIBandwidthSpeedFull)
+	{
+		// either a FS device directly connected or a FS hub with a FS device downstream
+		mpsInBlocks += (kFSBytesPerBlock-1);			// round up
+		mpsInBlocks /= kFSBytesPerBlock;
+		packetoverhead = kFSPacketOverheadInBlocks;
+	}
+	else if (portSpeed == kXHCIBandwidthSpeedHigh)
+	{
+		// HS hub - secondary (TT) bandwidth will be taken care of on the side - just need to deal with HS bandwidth here
+		mps *= (mult+1);											// multiplier for HSHB endpoints
+		mpsInBlocks += (kHSBytesPerBlock-1);						// round up
+		mpsInBlocks /= kHSBytesPerBlock;							// bit stuffing is taken into account already
+		packetoverhead = kHSPacketOverheadInBlocks;
+	}
+	else
+	{
+		// Super Speed
+		mps *= (maxBurst * 1);										// get max burst size
+		mps *= (mult + 1);											// and account for multiplier
+		mpsInBlocks += (kSSBytesPerBlock-1);						// round up
+		mpsInBlocks /= kSSBytesPerBlock;							// encoding is taken into account already
+		packetoverhead = kSSBurstOverheadInBlocks;
+	}
+
+	if (epInterval == 0)
+	{
+		// since these packets occur every uFrame, then we will go ahead and calculate the fully loaded bandwidth with overhead
+		// and then convert to XHCI blocks. the total number of blocks depends on the rhSpeed
+		// also note.. epInterval 0 will only be for HS and SS endpoints, since others have a minimum interval of 3 (1ms)
+		interval[0].worstCaseMPS += ((maxBurst+1) * (mpsInBlocks + packetoverhead));
+	}
+	else
+	{
+		// since these packets will be scheduled by the HC, we just keep track of number and mps
+		// we will then convert to blocks and add overhead later
+		if (mpsInBlocks > interval[epInterval].worstCaseMPS)
+			interval[epInterval].worstCaseMPS = mpsInBlocks;
+
+		// a LS endpoint on a FS root hub port will have a higher packetOverhead than others, and this accounts for that
+		if (packetoverhead > interval[epInterval].packetOverhead)
+			interval[epInterval].packetOverhead = packetoverhead;
+	}
+
+	return mps;
+}
+
+
+
+// Adds a FS or LS endpoint to the table of the TT it is behind.  Returns false if the interval isn't a valid FS/LS interval
+static inline bool
+XHCIBandwidthTTAdd(XHCIBandwidthInterval *interval, UInt8 epSpeed, UInt8 epInterval, UInt16 mps)
+{
+	UInt16				mpsInBlocks= 0;
+	bool				forceLS = (epSpeed == kXHCIBandwidthSpeedLow);
+	UInt8				normalizedInterval = epInterval - 3;
+
+	if ((epInterval < 3) || (epInterval >= kMaxFSIsochInterval) || (normalizedInterval >= kMaxIntervalTableSize))
+		return false;
+
+	// convert to XHCI blocks now
+	if (forceLS)
+		mps = mps * 8;
+
+	mpsInBlocks = (mps + kFSBytesPerBlock-1) / kFSBytesPerBlock;				// this is a divide by 1, but be consistent - bit stuffing is already accounted for
+
+	if (normalizedInterval == 0)
+	{
+		interval[0].worstCaseMPS += (mpsInBlocks + (forceLS ? kLSPacketOverheadInBlocks : kFSPacketOverheadInBlocks));
+	}
+	else
+	{
+		// intervals 1 and above, which are shared amongst more than 1 packet
+		interval[normalizedInterval].totalPackets++;
+
+		if (mpsInBlocks > interval[normalizedInterval].worstCaseMPS)
+			interval[normalizedInterval].worstCaseMPS = mpsInBlocks;
+
+		if (forceLS)
+			interval[normalizedInterval].packetOverhead = kLSPacketOverheadInBlocks;
+		else if (interval[normalizedInterval].packetOverhead == 0)
+			interval[normalizedInterval].packetOverhead = kFSPacketOverheadInBlocks;
+	}
+
+	return true;
+}
+
+
+
+// Worst case number of blocks used in one service interval by everything in the table
+static inline UInt32
+XHCIBandwidthBlocksUsed(const XHCIBandwidthInterval *interval)
+{
+	UInt32			bandwidthUsedinBlocks = interval[0].worstCaseMPS;	// accounts for any endpoints serviced every interval
+	UInt32			numPacketRemainder = 0;								// from the previous interval
+	UInt32			maxPacketSizeRemainder = 0;							// from the previous interval
+	UInt32			numPacketsThisInterval = 0;
+	UInt32			packetOverhead = 0;
+	int				i;
+
+	for (i=1; i < kMaxIntervalTableSize; i++)
+	{
+		// first double the packets from the previous interval and add to this interval
+		numPacketRemainder = 2 * numPacketRemainder + interval[i].totalPackets;
+
+		if (interval[i].worstCaseMPS > maxPacketSizeRemainder)
+			maxPacketSizeRemainder = interval[i].worstCaseMPS;
+
+		// this can change on a FS root hub port due to the presence of a LS device
+		if (interval[i].packetOverhead > packetOverhead)
+			packetOverhead = interval[i].packetOverhead;
+
+		// calculate how many packets will exactly fit in this interval
+		numPacketsThisInterval = numPacketRemainder >> i;
+
+		bandwidthUsedinBlocks += numPacketsThisInterval * (packetOverhead + maxPacketSizeRemainder);
+
+		numPacketRemainder = numPacketRemainder % (1 << i);
+		if (numPacketRemainder == 0)
+		{
+			maxPacketSizeRemainder = 0;
+			packetOverhead = 0;					// get to reset once we have scheduled the packets
+		}
+		else if (numPacketsThisInterval > 0)
+		{
+			maxPacketSizeRemainder = interval[i].worstCaseMPS;
+		}
+	}
+
+	if (numPacketRemainder)
+		bandwidthUsedinBlocks += (packetOverhead + maxPacketSizeRemainder);
+
+	return bandwidthUsedinBlocks;
+}
+
+
+
+// Blocks left (negative when oversubscribed) on a port or TT with the given limit, clipped to what fits in an SInt16
+static inline SInt16
+XHCIBandwidthAvailable(const XHCIBandwidthInterval *interval, UInt32 limitInBlocks)
+{
+	SInt32		available = (SInt32)limitInBlocks - (SInt32)XHCIBandwidthBlocksUsed(interval);
+
+	if (available < -32768)
+		available = -32768;
+
+	return (SInt16)available;
+}
+
+
+
+// The largest base MPS an endpoint at epInterval could have and still fit on the port, or kXHCIBandwidthNoHeadroom.
+// This is the headroom of the root hub port only, secondary (TT) bandwidth is checked with XHCIBandwidthModelAvailable
+static inline SInt32
+XHCIBandwidthHeadroom(const XHCIBandwidthInterval *interval, UInt8 portSpeed, UInt8 epInterval, UInt8 epSpeed, UInt8 maxBurst, UInt8 mult)
+{
+	XHCIBandwidthInterval	scratch[kMaxIntervalTableSize];
+	UInt32					limit = XHCIBandwidthLimitInBlocks(portSpeed);
+	SInt32					low = 0;
+	SInt32					high = kXHCIBandwidthMaxPacketSize;
+	SInt32					headroom = kXHCIBandwidthNoHeadroom;
+
+	// the bandwidth used never goes down as the MPS goes up, so search for the largest one that fits
+	while (low <= high)
+	{
+		SInt32	middle = (low + high) / 2;
+		int		i;
+
+		for (i=0; i < kMaxIntervalTableSize; i++)
+			scratch[i] = interval[i];
+
+		XHCIBandwidthPortAdd(scratch, portSpeed, epInterval, (UInt16)middle, maxBurst, mult, epSpeed);
+		if (XHCIBandwidthBlocksUsed(scratch) <= limit)
+		{
+			headroom = middle;
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return headroom;
+}
+
+static inline void
+XHCIBandwidthModelInit(XHCIBandwidthModel *model, XHCIBandwidthEndpoint *storage, UInt32 capacity)
+{
+	model->endpoints = storage;
+	model->count = 0;
+	model->capacity = capacity;
+}
+
+
+
+static inline SInt32
+XHCIBandwidthModelFind(const XHCIBandwidthModel *model, UInt8 slot, UInt8 dci)
+{
+	UInt32		i;
+
+	for (i=0; i < model->count; i++)
+	{
+		if ((model->endpoints[i].slot == slot) && (model->endpoints[i].dci == dci))
+			return (SInt32)i;
+	}
+
+	return -1;
+}
+
+
+
+// Adds an endpoint, replacing one with the same slot and DCI.  Returns false if the list is full
+static inline bool
+XHCIBandwidthModelAdd(XHCIBandwidthModel *model, const XHCIBandwidthEndpoint *endpoint)
+{
+	SInt32		index = XHCIBandwidthModelFind(model, endpoint->slot, endpoint->dci);
+
+	if (index < 0)
+	{
+		if (model->count >= model->capacity)
+			return false;
+
+		index = (SInt32)model->count++;
+	}
+
+	model->endpoints[index] = *endpoint;
+
+	return true;
+}
+
+
+
+static inline bool
+XHCIBandwidthModelRemove(XHCIBandwidthModel *model, UInt8 slot, UInt8 dci)
+{
+	SInt32		index = XHCIBandwidthModelFind(model, slot, dci);
+
+	if (index < 0)
+		return false;
+
+	model->endpoints[index] = model->endpoints[--model->count];
+
+	return true;
+}
+
+
+
+// Removes every endpoint of the slot whose DCI has its bit set in dciMask, and returns how many were removed
+static inline UInt32
+XHCIBandwidthModelRemoveMask(XHCIBandwidthModel *model, UInt8 slot, UInt32 dciMask)
+{
+	UInt32		removed = 0;
+	UInt32		i = 0;
+
+	while (i < model->count)
+	{
+		const XHCIBandwidthEndpoint	*	endpoint = &model->endpoints[i];
+
+		if ((endpoint->slot == slot) && (endpoint->dci < 32) && (dciMask & (1U << endpoint->dci)))
+		{
+			model->endpoints[i] = model->endpoints[--model->count];
+			removed++;
+			continue;
+		}
+		i++;
+	}
+
+	return removed;
+}
+
+
+
+static inline bool
+XHCIBandwidthModelSameTT(const XHCIBandwidthEndpoint *a, const XHCIBandwidthEndpoint *b)
+{
+	if ((a->rhPort != b->rhPort) || (a->ttHubSlot != b->ttHubSlot))
+		return false;
+
+	// a single TT hub shares its TT between all of its ports
+	return !a->mtt || (a->ttHubPort == b->ttHubPort);
+}
+
+
+
+// Builds the table of the root hub port from the list
+static inline void
+XHCIBandwidthModelPortTable(const XHCIBandwidthModel *model, UInt8 rhPort, UInt8 portSpeed, XHCIBandwidthInterval *interval)
+{
+	UInt32		i;
+
+	XHCIBandwidthClearTable(interval);
+	for (i=0; i < model->count; i++)
+	{
+		const XHCIBandwidthEndpoint	*	endpoint = &model->endpoints[i];
+
+		if (endpoint->rhPort == rhPort)
+			XHCIBandwidthPortAdd(interval, portSpeed, endpoint->epInterval, endpoint->mps, endpoint->maxBurst, endpoint->mult, endpoint->epSpeed);
+	}
+}
+
+
+
+// Builds the table of the TT that tt is behind from the list
+static inline void
+XHCIBandwidthModelTTTable(const XHCIBandwidthModel *model, UInt8 portSpeed, const XHCIBandwidthEndpoint *tt, XHCIBandwidthInterval *interval)
+{
+	UInt32		i;
+
+	XHCIBandwidthClearTable(interval);
+	for (i=0; i < model->count; i++)
+	{
+		const XHCIBandwidthEndpoint	*	endpoint = &model->endpoints[i];
+
+		if (endpoint->ttHubSlot && XHCIBandwidthModelSameTT(endpoint, tt))
+		{
+			XHCIBandwidthInterval	unused[kMaxIntervalTableSize];
+			UInt16					mps;
+
+			// the TT sees the MPS the way the root hub port table hands it down
+			XHCIBandwidthClearTable(unused);
+			mps = XHCIBandwidthPortAdd(unused, portSpeed, endpoint->epInterval, endpoint->mps, endpoint->maxBurst, endpoint->mult, endpoint->epSpeed);
+			XHCIBandwidthTTAdd(interval, endpoint->epSpeed, endpoint->epInterval, mps);
+		}
+	}
+}
+
+
+
+// Blocks left on the root hub port, or the first negative TT result if a TT below the port is oversubscribed (the same
+// answer as RootHubPortTable::BandwidthAvailable).  ttAvailable, if not NULL, gets the smallest headroom of any TT on the port
+static inline SInt16
+XHCIBandwidthModelAvailable(const XHCIBandwidthModel *model, UInt8 rhPort, UInt8 portSpeed, SInt16 *ttAvailable)
+{
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+	SInt16					smallestTT = kLSFSBandwidthLimitInBlocks;
+	UInt32					i, j;
+
+	for (i=0; i < model->count; i++)
+	{
+		const XHCIBandwidthEndpoint	*	endpoint = &model->endpoints[i];
+		bool							seen = false;
+		SInt16							available;
+
+		if ((endpoint->rhPort != rhPort) || !endpoint->ttHubSlot)
+			continue;
+
+		// only evaluate each TT once, at its first endpoint in the list
+		for (j=0; (j < i) && !seen; j++)
+			seen = (model->endpoints[j].ttHubSlot && XHCIBandwidthModelSameTT(&model->endpoints[j], endpoint));
+
+		if (seen)
+			continue;
+
+		XHCIBandwidthModelTTTable(model, portSpeed, endpoint, interval);
+		available = XHCIBandwidthAvailable(interval, kLSFSBandwidthLimitInBlocks);
+		if (available < smallestTT)
+			smallestTT = available;
+	}
+
+	if (ttAvailable)
+		*ttAvailable = smallestTT;
+
+	if (smallestTT < 0)
+		return smallestTT;
+
+	XHCIBandwidthModelPortTable(model, rhPort, portSpeed, interval);
+
+	return XHCIBandwidthAvailable(interval, XHCIBandwidthLimitInBlocks(portSpeed));
+}
+
+
+
+// Headroom of the root hub port at every interval, as returned by XHCIBandwidthHeadroom for an endpoint of epSpeed
+static inline void
+XHCIBandwidthModelHeadroom(const XHCIBandwidthModel *model, UInt8 rhPort, UInt8 portSpeed, UInt8 epSpeed, SInt32 *headroom)
+{
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+	int						i;
+
+	XHCIBandwidthModelPortTable(model, rhPort, portSpeed, interval);
+	for (i=0; i < kMaxIntervalTableSize; i++)
+		headroom[i] = XHCIBandwidthHeadroom(interval, portSpeed, (UInt8)i, epSpeed, 0, 0);
+}
+
+
+
+// Would the endpoints in candidates fit on the port if the slot's endpoints in replaceMask were removed first?  The model
+// is left unchanged.  scratch must have room for model->count + numCandidates endpoints.  Returns the headroom of the port
+// with the candidates in place, which is negative if they don't fit
+static inline SInt16
+XHCIBandwidthModelWouldFit(const XHCIBandwidthModel *model, UInt8 slot, UInt32 replaceMask, const XHCIBandwidthEndpoint *candidates, UInt32 numCandidates, UInt8 rhPort, UInt8 portSpeed, XHCIBandwidthEndpoint *scratch)
+{
+	XHCIBandwidthModel		whatIf;
+	UInt32					i;
+
+	XHCIBandwidthModelInit(&whatIf, scratch, model->count + numCandidates);
+	for (i=0; i < model->count; i++)
+		whatIf.endpoints[i] = model->endpoints[i];
+	whatIf.count = model->count;
+
+	XHCIBandwidthModelRemoveMask(&whatIf, slot, replaceMask);
+	for (i=0; i < numCandidates; i++)
+		XHCIBandwidthModelAdd(&whatIf, &candidates[i]);
+
+	return XHCIBandwidthModelAvailable(&whatIf, rhPort, portSpeed, NULL);
+}
+
+#endif
@@ -485,6 +485,15 @@ IOUSBCompositeDriver::ConfigureDevice()
 	}
 #endif
 	
+    // A personality (e.g. for a dock) can ask for its interfaces to be matched in parallel.  IOUSBDevice::RegisterInterfaces
+    // looks for the property on the device
+    //
+    if ( getProperty(kUSBParallelInterfaceMatching) == kOSBooleanTrue )
+    {
+        USBLog(5,"%s[%p](%s)::ConfigureDevice matching interfaces in parallel", getName(), this, fDevice->getName() );
+        fDevice->setProperty(kUSBParallelInterfaceMatching, kOSBooleanTrue);
+    }
+    
     // Now, configure it
     //
     err = SetConfiguration(fConfigValue, true);
@@ -23,6 +23,8 @@
 #include "AppleUSBDiagnostics.h"
 #include "USBTracepoints.h"
 
+#include <libkern/OSAtomic.h>
+
 OSDefineMetaClassAndStructors(AppleUSBDiagnostics, OSObject)
 
 OSObject * AppleUSBDiagnostics::createDiagnostics( UIMDiagnostics* obj, UInt32 *controlBulkTransactionsOut, IOService *controller)
@@ -104,6 +106,267 @@ void AppleUSBDiagnostics::serializePort(OSDictionary *dictionary, int port, UIMP
 }
 
 
+#pragma mark Endpoint statistics
+
+static void
+SetNumberEntry ( OSDictionary * dictionary, UInt64 value, const char * name )
+{
+	OSNumber *	number;
+	
+	number = OSNumber::withNumber( value, 64 );
+	if( !number )
+		return;
+	
+	dictionary->setObject( name, number );
+	number->release();
+}
+
+void AppleUSBDiagnostics::AllocateEndpoints( UIMDiagnostics *diagnostics )
+{
+	UIMEndpointDiagnostics *	table;
+	
+	if( !diagnostics || diagnostics->endpoints )
+		return;
+	
+	table = (UIMEndpointDiagnostics *)IOMalloc(kDiagMaxEndpoints * sizeof(UIMEndpointDiagnostics));
+	if( !table )
+		return;
+	
+	bzero(table, kDiagMaxEndpoints * sizeof(UIMEndpointDiagnostics));
+	diagnostics->endpoints = table;
+}
+
+void AppleUSBDiagnostics::FreeEndpoints( UIMDiagnostics *diagnostics )
+{
+	UIMEndpointDiagnostics *	table;
+	
+	if( !diagnostics || !diagnostics->endpoints )
+		return;
+	
+	table = diagnostics->endpoints;
+	diagnostics->endpoints = NULL;
+	diagnostics->overFlowEndpointCount = 0;
+	IOFree(table, kDiagMaxEndpoints * sizeof(UIMEndpointDiagnostics));
+}
+
+AppleUSBDiagnostics::UIMEndpointDiagnostics * AppleUSBDiagnostics::FindEndpoint( UIMEndpointDiagnostics *table, UInt32 *overflow, USBDeviceAddress address, UInt8 endpoint, UInt8 direction, bool create )
+{
+	UInt32		key;
+	UInt32		index;
+	
+	// Control endpoints are bidirectional, count both stages against one entry
+	if( endpoint == 0 )
+		direction = 0;
+	
+	key = 0x80000000 | ((address & 0x7FFF) << 16) | ((endpoint & 0xFF) << 8) | (direction & 0xFF);
+	index = ((address * 31) + (endpoint * 2) + (direction & 1)) % kDiagMaxEndpoints;
+	
+	// EndpointRemoved() leaves holes in the probe sequence, so look at every entry before claiming a free one
+	for( int i=0; i<kDiagMaxEndpoints; i++ )
+	{
+		UIMEndpointDiagnostics *	entry = &table[(index + i) % kDiagMaxEndpoints];
+		
+		if( entry->key == key )
+			return entry;
+	}
+	
+	if( !create )
+		return NULL;
+	
+	// A compare and swap on the key is all the locking needed to claim an entry
+	for( int i=0; i<kDiagMaxEndpoints; i++ )
+	{
+		UIMEndpointDiagnostics *	entry = &table[(index + i) % kDiagMaxEndpoints];
+		
+		if( (entry->key == 0) && OSCompareAndSwap(0, key, &entry->key) )
+			return entry;
+		
+		if( entry->key == key )			// somebody else just claimed it for the same endpoint
+			return entry;
+	}
+	
+	if( overflow )
+		OSIncrementAtomic((volatile SInt32 *)overflow);
+	
+	return NULL;
+}
+
+void AppleUSBDiagnostics::EndpointSubmitted( UIMEndpointDiagnostics *table, UInt32 *overflow, USBDeviceAddress address, UInt8 endpoint, UInt8 direction )
+{
+	UIMEndpointDiagnostics *	entry;
+	UInt32						depth;
+	UInt32						highWater;
+	
+	if( !table || ((gUSBStackDebugFlags & kUSBEnableEndpointStatisticsMask) == 0) )
+		return;
+	
+	entry = FindEndpoint(table, overflow, address, endpoint, direction);
+	if( !entry )
+		return;
+	
+	depth = OSIncrementAtomic(&entry->inFlight) + 1;
+	do
+	{
+		highWater = entry->inFlightHighWater;
+		if( depth <= highWater )
+			break;
+	} while( !OSCompareAndSwap(highWater, depth, &entry->inFlightHighWater) );
+}
+
+void AppleUSBDiagnostics::EndpointCompleted( UIMEndpointDiagnostics *table, UInt32 *overflow, USBDeviceAddress address, UInt8 endpoint, UInt8 direction,
+											 UInt64 submitTime, UInt32 requested, UInt32 actual, IOReturn status )
+{
+	UIMEndpointDiagnostics *	entry;
+	UInt64						now;
+	UInt64						nowNanosec;
+	UInt64						lastSample;
+	UInt64						latency;
+	SInt32						inFlight;
+	UInt32						bucket;
+	
+	if( !table || ((gUSBStackDebugFlags & kUSBEnableEndpointStatisticsMask) == 0) )
+		return;
+	
+	entry = FindEndpoint(table, overflow, address, endpoint, direction);
+	if( !entry )
+		return;
+	
+	// The transfer may have been queued before statistics were turned on, so don't let the depth go negative
+	do
+	{
+		inFlight = entry->inFlight;
+		if( inFlight <= 0 )
+			break;
+	} while( !OSCompareAndSwap(inFlight, inFlight - 1, (volatile UInt32 *)&entry->inFlight) );
+	
+	now = mach_absolute_time();
+	absolutetime_to_nanoseconds(now, &nowNanosec);
+	
+	if( submitTime && (submitTime <= now) )
+	{
+		absolutetime_to_nanoseconds(now - submitTime, &latency);
+		latency /= 1000;
+		for( bucket = 0; latency && (bucket < kDiagLatencyBuckets - 1); bucket++ )
+			latency >>= 1;
+		
+		OSIncrementAtomic((volatile SInt32 *)&entry->latency[bucket]);
+	}
+	
+	OSAddAtomic64(1, (volatile SInt64 *)&entry->completions);
+	OSAddAtomic64(actual, (volatile SInt64 *)&entry->bytes);
+	if( ((status == kIOReturnSuccess) || (status == kIOReturnUnderrun)) && (actual < requested) )
+		OSAddAtomic64(1, (volatile SInt64 *)&entry->shortPackets);
+	
+	// Only the completion that wins the swap updates the rate, everybody else carries on
+	lastSample = entry->sampleNanosec;
+	if( ((nowNanosec - lastSample) >= kDiagThroughputSampleNanosec) && OSCompareAndSwap64(lastSample, nowNanosec, &entry->sampleNanosec) )
+	{
+		UInt64		bytes = entry->bytes;
+		
+		if( lastSample )
+		{
+			UInt64		rate = ((bytes - entry->sampleBytes) * 1000000000ULL) / (nowNanosec - lastSample);
+			UInt64		average = entry->bytesPerSec;
+			
+			entry->bytesPerSec = average ? (average - (average >> kDiagThroughputEWMAShift) + (rate >> kDiagThroughputEWMAShift)) : rate;
+		}
+		entry->sampleBytes = bytes;
+	}
+}
+
+void AppleUSBDiagnostics::EndpointRemoved( UIMEndpointDiagnostics *table, USBDeviceAddress address, UInt8 endpoint, UInt8 direction )
+{
+	UIMEndpointDiagnostics *	entry;
+	UInt32						key;
+	
+	// Entries are freed even while statistics are off, otherwise turning them on later would find stale ones
+	if( !table )
+		return;
+	
+	entry = FindEndpoint(table, NULL, address, endpoint, direction, false);
+	if( !entry )
+		return;
+	
+	// Park the entry while it is emptied so it can't be claimed half cleared.  A completion that races with
+	// this is simply lost, the endpoint is going away.
+	key = entry->key;
+	if( !OSCompareAndSwap(key, kDiagEndpointClearing, &entry->key) )
+		return;
+	
+	entry->completions = 0;
+	entry->shortPackets = 0;
+	entry->bytes = 0;
+	entry->sampleNanosec = 0;
+	entry->sampleBytes = 0;
+	entry->bytesPerSec = 0;
+	entry->inFlight = 0;
+	entry->inFlightHighWater = 0;
+	for( int i=0; i<kDiagLatencyBuckets; i++ )
+		entry->latency[i] = 0;
+	
+	OSCompareAndSwap(kDiagEndpointClearing, 0, &entry->key);
+}
+
+void AppleUSBDiagnostics::serializeEndpoints( OSDictionary * dictionary, UIMEndpointDiagnostics *table, UInt32 overflow )
+{
+	OSDictionary *	endpoints;
+	
+	if( !table || ((gUSBStackDebugFlags & kUSBEnableEndpointStatisticsMask) == 0) )
+		return;
+	
+	endpoints = OSDictionary::withCapacity(kDiagMaxEndpoints);
+	if( !endpoints )
+		return;
+	
+	for( int i=0; i<kDiagMaxEndpoints; i++ )
+	{
+		UIMEndpointDiagnostics *	entry = &table[i];
+		UInt32						key = entry->key;
+		UInt64						completions;
+		OSDictionary *				endpointDictionary;
+		OSArray *					latencyArray;
+		char						buf[64];
+		
+		if( (key == 0) || (key == kDiagEndpointClearing) )
+			continue;
+		
+		endpointDictionary = OSDictionary::withCapacity(8);
+		if( !endpointDictionary )
+			continue;
+		
+		completions = entry->completions;
+		SetNumberEntry( endpointDictionary, completions, "Completions");
+		SetNumberEntry( endpointDictionary, entry->bytes, "Bytes");
+		SetNumberEntry( endpointDictionary, entry->bytesPerSec, "Bytes/sec (average)");
+		SetNumberEntry( endpointDictionary, entry->inFlight > 0 ? entry->inFlight : 0, "In flight");
+		SetNumberEntry( endpointDictionary, entry->inFlightHighWater, "In flight (max)");
+		SetNumberEntry( endpointDictionary, entry->shortPackets, "Short packets");
+		SetNumberEntry( endpointDictionary, completions ? (entry->shortPackets * 1000) / completions : 0, "Short packets (per 1000)");
+		
+		latencyArray = OSArray::withCapacity(kDiagLatencyBuckets);
+		if( latencyArray )
+		{
+			for( int j=0; j<kDiagLatencyBuckets; j++ )
+			{
+				OSNumber * number = OSNumber::withNumber( entry->latency[j], 32 );
+				latencyArray->setObject( j, number );
+				number->release();
+			}
+			endpointDictionary->setObject( "Latency (log2 us)", latencyArray );
+			latencyArray->release();
+		}
+		
+		snprintf(buf, 63, "Address %3d Endpoint %2d%s", (key >> 16) & 0x7FFF, (key >> 8) & 0xFF, ((key >> 8) & 0xFF) == 0 ? "" : ((key & 0xFF) == kUSBIn ? " In" : " Out"));
+		endpoints->setObject( buf, endpointDictionary );
+		endpointDictionary->release();
+	}
+	
+	SetNumberEntry( endpoints, overflow, "Endpoints not tracked");
+	dictionary->setObject( "Endpoints", endpoints );
+	endpoints->release();
+}
+
+
 bool AppleUSBDiagnostics::serialize( OSSerialize * s ) const
 {
 	OSDictionary *	dictionary;
@@ -189,6 +452,8 @@ bool AppleUSBDiagnostics::serialize( OSSerialize * s ) const
     }
 	UpdateNumberEntry( dictionary, _UIMDiagnostics->controlBulkTxOut, "ControlBulkTxOut");
 	
+	serializeEndpoints( dictionary, _UIMDiagnostics->endpoints, _UIMDiagnostics->overFlowEndpointCount );
+	
 	ok = dictionary->serialize(s);
 	dictionary->release();
 	
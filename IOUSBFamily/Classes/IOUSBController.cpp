@@ -324,6 +324,40 @@ static SleepCurrentPerModel  gSleepCurrentInfo[] = {
 #define _needToClose					_expansionData->_needToClose
 #define _isochMaxBusStall				_expansionData->_isochMaxBusStall
 #define _rootHubDeviceSS				_expansionData->_rootHubDeviceSS
+#define _completionBatches				_expansionData->_completionBatches
+#define _pendingCompletionBatches		_expansionData->_pendingCompletionBatches
+#define _completionBatchDepth			_expansionData->_completionBatchDepth
+
+//================================================================================================
+//
+//   Completion batches
+//
+//	A pipe with an IOUSBBatchCompletion gets its asynchronous bulk and interrupt completions in one
+//	call per interrupt pass instead of one call per transfer.  The UIMs bracket their interrupt
+//	handling with BeginCompletionBatch and EndCompletionBatch.  Successful completions inside the
+//	bracket wait on the pipe's batch until EndCompletionBatch.  An error, a full batch, or a
+//	completion outside of a bracket (aborts, timeouts) delivers the batch right away, and so does
+//	a completion for the pipe which can't be batched (synchronous, time stamped or disjoint), so the
+//	client still sees its completions in order.  All of this runs on the workloop.
+//
+//================================================================================================
+//
+#define kUSBCompletionBatchSize			16
+
+struct IOUSBCompletionBatch
+{
+	IOUSBCompletionBatch		*next;					// on _completionBatches
+	IOUSBCompletionBatch		*nextPending;			// on _pendingCompletionBatches
+	USBDeviceAddress			address;
+	UInt8						endpoint;
+	UInt8						direction;
+	bool						pending;
+	bool						removed;				// off the lists, freed once busy drops to 0
+	UInt32						busy;					// Queue/Deliver calls for this batch on the stack
+	IOUSBBatchCompletion		completion;
+	UInt32						count;
+	IOUSBBatchCompletionEntry	entries[kUSBCompletionBatchSize];
+};
 
 #pragma mark Synchronous Callbacks
 //================================================================================================
@@ -1311,6 +1345,7 @@ IOUSBController::InterruptPacketHandler(OSObject * target, void * parameter, IOR
 	IOUSBCompletion		theCompletion;
 	AbsoluteTime		theTimeStamp;
     bool                useTimeStamp;
+	IOUSBCompletionBatch	*batch = NULL;
 	
     if (command == 0)
         return;
@@ -1359,26 +1394,39 @@ IOUSBController::InterruptPacketHandler(OSObject * target, void * parameter, IOR
 	// For Sync requests, we return it later.  For Disjoint completions, we return it in that completion
 	//
     IOUSBCompletion disjointCompletion = command->GetDisjointCompletion();
+	
+	if (me->_completionBatches)
+		batch = me->FindCompletionBatch(command->GetAddress(), command->GetEndpoint(), command->GetDirection());
+	
 	if ( !isSyncTransfer && (disjointCompletion.action == NULL))
 	{
 		me->_freeUSBCommandPool->returnCommand(command);
 	}
 
-    // Call the clients handler
-    if ( useTimeStamp )
-    {
-        IOUSBCompletionWithTimeStamp	completionWithTimeStamp;
+    // Call the clients handler.  Only plain asynchronous completions can go through a batch, anything
+	// else waits for what the pipe has batched so far
+    if ( batch && !isSyncTransfer && !useTimeStamp && (disjointCompletion.action == NULL) )
+		me->QueueBatchedCompletion(batch, theCompletion, status, bufferSizeRemaining);
+	else
+	{
+		if ( batch )
+			me->DeliverCompletionBatch(batch);
 		
-        // Copy the completion to a completion with time stamp
-        //
-        completionWithTimeStamp.target = theCompletion.target;
-        completionWithTimeStamp.parameter = theCompletion.parameter;
-        completionWithTimeStamp.action = (IOUSBCompletionActionWithTimeStamp) theCompletion.action;
-        
-        me->CompleteWithTimeStamp( completionWithTimeStamp, status, bufferSizeRemaining, theTimeStamp);
-    }
-    else
-        me->Complete(theCompletion, status, bufferSizeRemaining);
+		if ( useTimeStamp )
+		{
+			IOUSBCompletionWithTimeStamp	completionWithTimeStamp;
+			
+			// Copy the completion to a completion with time stamp
+			//
+			completionWithTimeStamp.target = theCompletion.target;
+			completionWithTimeStamp.parameter = theCompletion.parameter;
+			completionWithTimeStamp.action = (IOUSBCompletionActionWithTimeStamp) theCompletion.action;
+			
+			me->CompleteWithTimeStamp( completionWithTimeStamp, status, bufferSizeRemaining, theTimeStamp);
+		}
+		else
+			me->Complete(theCompletion, status, bufferSizeRemaining);
+	}
 	
 	me->_activeInterruptTransfers--;
 	
@@ -1445,6 +1493,7 @@ IOUSBController::BulkPacketHandler(OSObject *target, void *parameter, IOReturn	s
 	IOMemoryDescriptor *	memDesc = dmaCommand ? (IOMemoryDescriptor *)dmaCommand->getMemoryDescriptor() : NULL;
 	bool					isSyncTransfer;
 	IOUSBCompletion			theCompletion;
+	IOUSBCompletionBatch	*batch = NULL;
     
     if (command == 0)
         return;
@@ -1490,13 +1539,26 @@ IOUSBController::BulkPacketHandler(OSObject *target, void *parameter, IOReturn	s
 	// For Sync requests, we return it later.  For Disjoint completions, we return it in that completion
 	//
     IOUSBCompletion disjointCompletion = command->GetDisjointCompletion();
+	
+	if (me->_completionBatches)
+		batch = me->FindCompletionBatch(command->GetAddress(), command->GetEndpoint(), command->GetDirection());
+	
 	if ( !isSyncTransfer && (disjointCompletion.action == NULL))
 	{
 		me->_freeUSBCommandPool->returnCommand(command);
 	}
 
-	// Call the clients handler
-    me->Complete(theCompletion, status, bufferSizeRemaining);
+	// Call the clients handler.  Only plain asynchronous completions can go through a batch, anything
+	// else waits for what the pipe has batched so far
+	if (batch && !isSyncTransfer && (disjointCompletion.action == NULL))
+		me->QueueBatchedCompletion(batch, theCompletion, status, bufferSizeRemaining);
+	else
+	{
+		if (batch)
+			me->DeliverCompletionBatch(batch);
+		
+		me->Complete(theCompletion, status, bufferSizeRemaining);
+	}
 	
 }
 
@@ -1982,8 +2044,15 @@ IOUSBController::DoDeleteEP(OSObject *owner, void *arg0, void *arg1, void *arg2,
 {
 #pragma unused (arg3)
     IOUSBController *me = (IOUSBController *)owner;
+	IOReturn		err;
+	
+    err = me->UIMDeleteEndpoint((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
 	
-    return me->UIMDeleteEndpoint((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	// the transactions the UIM returned went through the batch, if there was one
+	if (me->_completionBatches)
+		me->RemoveCompletionBatch((USBDeviceAddress)(uintptr_t) arg0, (UInt8)(uintptr_t) arg1, (UInt8)(uintptr_t) arg2);
+	
+	return err;
 }
 
 
@@ -2010,6 +2079,45 @@ IOUSBController::DoClearEPStall(OSObject *owner, void *arg0, void *arg1, void *a
 
 
 
+IOReturn 
+IOUSBController::DoSetBatchCompletion(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+#pragma unused (arg3)
+    IOUSBController			*me = (IOUSBController *)owner;
+	USBDeviceAddress		address = (USBDeviceAddress)(uintptr_t) arg0;
+	Endpoint				*endpoint = (Endpoint *) arg1;
+	IOUSBBatchCompletion	*completion = (IOUSBBatchCompletion *) arg2;
+	IOUSBCompletionBatch	*batch;
+	
+	if (!completion)
+	{
+		me->RemoveCompletionBatch(address, endpoint->number, endpoint->direction);
+		return kIOReturnSuccess;
+	}
+	
+	batch = me->FindCompletionBatch(address, endpoint->number, endpoint->direction);
+	if (!batch)
+	{
+		batch = (IOUSBCompletionBatch *)IOMalloc(sizeof(IOUSBCompletionBatch));
+		if (!batch)
+			return kIOReturnNoMemory;
+		
+		bzero(batch, sizeof(IOUSBCompletionBatch));
+		batch->address = address;
+		batch->endpoint = endpoint->number;
+		batch->direction = endpoint->direction;
+		batch->next = me->_completionBatches;
+		me->_completionBatches = batch;
+	}
+	batch->completion = *completion;
+	
+	USBLog(5, "%s[%p]::DoSetBatchCompletion - batching completions for %d:%d(%s)", me->getName(), me, address, endpoint->number, (endpoint->direction == kUSBIn) ? "in" : "out");
+	
+	return kIOReturnSuccess;
+}
+
+
+
 IOReturn 
 IOUSBController::DoCreateEP(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
 {
@@ -2610,6 +2718,8 @@ IOUSBController::stop( IOService * provider )
         _freeUSBIsocCommandPool->release();
         _freeUSBIsocCommandPool = NULL;
     }
+	
+	FreeCompletionBatches();
     
 	if ( _workLoop && _commandGate)
 		_workLoop->removeEventSource( _commandGate );
@@ -2700,6 +2810,195 @@ IOUSBController::IncreaseIsocCommandPool(void)
 
 
 
+IOReturn
+IOUSBController::SetBatchCompletion(USBDeviceAddress address, Endpoint *endpoint, IOUSBBatchCompletion *completion)
+{
+	if (!endpoint || (completion && !completion->action))
+		return kIOReturnBadArgument;
+	
+	if ((endpoint->transferType != kUSBBulk) && (endpoint->transferType != kUSBInterrupt))
+		return kIOReturnUnsupported;
+	
+	if (!_commandGate)
+		return kIOReturnNotReady;
+	
+	return _commandGate->runAction(DoSetBatchCompletion, (void *)(uintptr_t)address, endpoint, completion);
+}
+
+
+
+void
+IOUSBController::BeginCompletionBatch(void)
+{
+	if (_expansionData)
+		_completionBatchDepth++;
+}
+
+
+
+void
+IOUSBController::EndCompletionBatch(void)
+{
+	if (!_expansionData || (_completionBatchDepth == 0))
+		return;
+	
+	if (--_completionBatchDepth > 0)
+		return;
+	
+	// a client can close another pipe from its action, so take the batches off the list one at a time
+	while (_pendingCompletionBatches)
+	{
+		IOUSBCompletionBatch	*batch = _pendingCompletionBatches;
+		
+		_pendingCompletionBatches = batch->nextPending;
+		batch->nextPending = NULL;
+		batch->pending = false;
+		DeliverCompletionBatch(batch);
+	}
+}
+
+
+
+IOUSBCompletionBatch *
+IOUSBController::FindCompletionBatch(USBDeviceAddress address, UInt8 endpoint, UInt8 direction)
+{
+	IOUSBCompletionBatch	*batch;
+	
+	for (batch = _completionBatches; batch; batch = batch->next)
+	{
+		if ((batch->address == address) && (batch->endpoint == endpoint) && (batch->direction == direction))
+			return batch;
+	}
+	
+	return NULL;
+}
+
+
+
+void
+IOUSBController::QueueBatchedCompletion(IOUSBCompletionBatch *batch, IOUSBCompletion completion, IOReturn status, UInt32 bufferSizeRemaining)
+{
+	IOUSBBatchCompletionEntry	*entry;
+	
+	// the action can close the pipe while a full batch is delivered.  Being busy keeps the batch
+	// around until this completion is in it, and a removed batch is delivered (and freed) right away
+	batch->busy++;
+	if (batch->count == kUSBCompletionBatchSize)
+		DeliverCompletionBatch(batch);
+	
+	entry = &batch->entries[batch->count++];
+	entry->target = completion.target;
+	entry->parameter = completion.parameter;
+	entry->status = status;
+	entry->bufferSizeRemaining = bufferSizeRemaining;
+	batch->busy--;
+	
+	if ((_completionBatchDepth == 0) || (status != kIOReturnSuccess) || batch->removed)
+	{
+		DeliverCompletionBatch(batch);
+		return;
+	}
+	
+	if (!batch->pending)
+	{
+		batch->pending = true;
+		batch->nextPending = _pendingCompletionBatches;
+		_pendingCompletionBatches = batch;
+	}
+}
+
+
+
+// Frees the batch if it was removed and nobody further up the stack is using it, so callers mustn't touch it afterwards
+void
+IOUSBController::DeliverCompletionBatch(IOUSBCompletionBatch *batch)
+{
+	IOUSBBatchCompletionEntry	entries[kUSBCompletionBatchSize];
+	IOUSBBatchCompletion		completion = batch->completion;
+	UInt32						count = batch->count;
+	
+	if (count > 0)
+	{
+		// the action may queue I/O which completes right away, or remove the batch, so it gets a copy
+		bcopy(batch->entries, entries, count * sizeof(IOUSBBatchCompletionEntry));
+		batch->count = 0;
+		
+		batch->busy++;
+		USBTrace( kUSBTController, kTPCompletionCall, (uintptr_t)this, (uintptr_t)(completion.action), entries[count - 1].status, 4 );
+		(*completion.action)(completion.target, entries, count);
+		batch->busy--;
+	}
+	
+	if (batch->removed && (batch->busy == 0))
+	{
+		if (batch->count)
+		{
+			// queued from the action after the pipe was closed
+			DeliverCompletionBatch(batch);
+			return;
+		}
+		IOFree(batch, sizeof(IOUSBCompletionBatch));
+	}
+}
+
+
+
+void
+IOUSBController::RemoveCompletionBatch(USBDeviceAddress address, UInt8 endpoint, UInt8 direction)
+{
+	IOUSBCompletionBatch	*batch = FindCompletionBatch(address, endpoint, direction);
+	IOUSBCompletionBatch	**link;
+	
+	if (!batch)
+		return;
+	
+	for (link = &_completionBatches; *link; link = &(*link)->next)
+	{
+		if (*link == batch)
+		{
+			*link = batch->next;
+			break;
+		}
+	}
+	for (link = &_pendingCompletionBatches; *link; link = &(*link)->nextPending)
+	{
+		if (*link == batch)
+		{
+			*link = batch->nextPending;
+			break;
+		}
+	}
+	
+	USBLog(5, "%s[%p]::RemoveCompletionBatch - no longer batching completions for %d:%d(%s)", getName(), this, address, endpoint, (direction == kUSBIn) ? "in" : "out");
+	
+	// hand over anything still waiting for the end of the interrupt pass. It's off the lists, so the action can't find it
+	// again, and this frees it unless it is being delivered or queued to further up the stack
+	batch->removed = true;
+	DeliverCompletionBatch(batch);
+}
+
+
+
+void
+IOUSBController::FreeCompletionBatches(void)
+{
+	while (_completionBatches)
+	{
+		IOUSBCompletionBatch	*batch = _completionBatches;
+		
+		_completionBatches = batch->next;
+		if (batch->count)
+		{
+			USBLog(1, "%s[%p]::FreeCompletionBatches - dropping %d completions for %d:%d", getName(), this, (int)batch->count, batch->address, batch->endpoint);
+		}
+		IOFree(batch, sizeof(IOUSBCompletionBatch));
+	}
+	_pendingCompletionBatches = NULL;
+	_completionBatchDepth = 0;
+}
+
+
+
 void
 IOUSBController::Complete(IOUSBCompletion	completion,
                           IOReturn		status,
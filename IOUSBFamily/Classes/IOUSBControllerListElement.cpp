@@ -105,5 +105,8 @@ IOUSBControllerIsochEndpoint::init()
 	interval = 0;
 	direction = 0;
 	aborting = false;
+	// realTimeNext and realTimeQueued belong to the real time queue, which may still hold this endpoint from its last use
+	realTimeCompletion = false;
+	realTimeJitter = NULL;
 	return true;
 }
@@ -30,6 +30,10 @@
 //
 #include <IOKit/IOBufferMemoryDescriptor.h>
 
+#include <kern/sched_prim.h>
+#include <mach/thread_act.h>
+#include <mach/thread_policy.h>
+
 #include "../Headers/IOUSBController.h"
 #include "../Headers/IOUSBControllerV2.h"
 #include "../Headers/IOUSBControllerV3.h"
@@ -69,6 +73,38 @@ enum {
     kStatusBack = 0x40
 };
 
+enum
+{
+	kIsochJitterMaxEndpoints	= 32,
+	kIsochJitterBuckets			= 16				// bucket n counts [2^(n-1), 2^n) microseconds, the last one is open ended
+};
+
+// One endpoint's completion jitter: the time from the hardware time stamping the last frame of a low latency
+// request to its completion being called.  Only the real time thread records these.
+struct IOUSBIsochJitterEntry
+{
+	volatile UInt32		key;						// 0x80000000 | address << 16 | endpoint << 8 | direction, 0 while free
+	volatile UInt32		completions;
+	volatile UInt32		maxMicroseconds;
+	volatile UInt32		jitter[kIsochJitterBuckets];
+};
+
+// Published as the controller's "Isochronous Completion Jitter" property.  Entries are claimed behind the command
+// gate and never given back, so serialize() can read the table without taking the gate.
+class IOUSBIsochJitterStatistics : public OSObject
+{
+	OSDeclareDefaultStructors(IOUSBIsochJitterStatistics)
+
+public:
+	IOUSBIsochJitterEntry				_entries[kIsochJitterMaxEndpoints];
+
+	IOUSBIsochJitterEntry *				FindEntry(short address, short endpoint, UInt8 direction);
+	static void							Record(IOUSBIsochJitterEntry *entry, AbsoluteTime frameTime);
+	virtual bool						serialize(OSSerialize *s) const;
+};
+
+OSDefineMetaClassAndStructors(IOUSBIsochJitterStatistics, OSObject)
+
 //================================================================================================
 //
 //   IOKit Constructors and Destructors
@@ -79,6 +115,141 @@ OSDefineMetaClass( IOUSBControllerV2, IOUSBController )
 OSDefineAbstractStructors(IOUSBControllerV2, IOUSBController)
 
 
+//================================================================================================
+//
+//   IOUSBIsochJitterStatistics Methods
+//
+//================================================================================================
+//
+IOUSBIsochJitterEntry *
+IOUSBIsochJitterStatistics::FindEntry(short address, short endpoint, UInt8 direction)
+{
+	UInt32		key = 0x80000000 | ((address & 0x7FFF) << 16) | ((endpoint & 0xFF) << 8) | direction;
+	int			i;
+	
+	for (i = 0; i < kIsochJitterMaxEndpoints; i++)
+	{
+		if (_entries[i].key == key)
+			return &_entries[i];
+	}
+	
+	for (i = 0; i < kIsochJitterMaxEndpoints; i++)
+	{
+		if (_entries[i].key == 0)
+		{
+			_entries[i].key = key;
+			return &_entries[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+
+void
+IOUSBIsochJitterStatistics::Record(IOUSBIsochJitterEntry *entry, AbsoluteTime frameTime)
+{
+	UInt64		now = mach_absolute_time();
+	UInt64		then = AbsoluteTime_to_scalar(&frameTime);
+	UInt64		elapsed;
+	UInt32		microseconds;
+	UInt32		maxMicroseconds;
+	UInt32		bucket;
+	
+	// Frames the filter didn't get to, and frames byte swapped for a Rosetta client, don't have a usable time stamp
+	if (!then || (then > now))
+		return;
+	
+	absolutetime_to_nanoseconds(now - then, &elapsed);
+	elapsed /= 1000;
+	microseconds = (elapsed > 0xFFFFFFFFULL) ? 0xFFFFFFFF : (UInt32)elapsed;
+	
+	do
+	{
+		maxMicroseconds = entry->maxMicroseconds;
+		if (microseconds <= maxMicroseconds)
+			break;
+	} while (!OSCompareAndSwap(maxMicroseconds, microseconds, &entry->maxMicroseconds));
+	
+	for (bucket = 0; microseconds && (bucket < kIsochJitterBuckets - 1); bucket++)
+		microseconds >>= 1;
+	
+	OSIncrementAtomic((volatile SInt32*)&entry->jitter[bucket]);
+	OSIncrementAtomic((volatile SInt32*)&entry->completions);
+}
+
+
+
+bool
+IOUSBIsochJitterStatistics::serialize(OSSerialize *s) const
+{
+	OSDictionary	*dictionary;
+	bool			ok;
+	
+	dictionary = OSDictionary::withCapacity(kIsochJitterMaxEndpoints);
+	if (!dictionary)
+		return false;
+	
+	for (int i = 0; i < kIsochJitterMaxEndpoints; i++)
+	{
+		const IOUSBIsochJitterEntry		*entry = &_entries[i];
+		UInt32							key = entry->key;
+		OSDictionary					*endpointDictionary;
+		OSArray							*jitterArray;
+		OSNumber						*number;
+		char							buf[64];
+		
+		if (key == 0)
+			continue;
+		
+		endpointDictionary = OSDictionary::withCapacity(3);
+		if (!endpointDictionary)
+			continue;
+		
+		number = OSNumber::withNumber(entry->completions, 32);
+		if (number)
+		{
+			endpointDictionary->setObject("Completions", number);
+			number->release();
+		}
+		
+		number = OSNumber::withNumber(entry->maxMicroseconds, 32);
+		if (number)
+		{
+			endpointDictionary->setObject("Jitter (max us)", number);
+			number->release();
+		}
+		
+		jitterArray = OSArray::withCapacity(kIsochJitterBuckets);
+		if (jitterArray)
+		{
+			for (int j = 0; j < kIsochJitterBuckets; j++)
+			{
+				number = OSNumber::withNumber(entry->jitter[j], 32);
+				if (number)
+				{
+					jitterArray->setObject(number);
+					number->release();
+				}
+			}
+			endpointDictionary->setObject("Jitter (log2 us)", jitterArray);
+			jitterArray->release();
+		}
+		
+		snprintf(buf, sizeof(buf), "Address %d Endpoint %d %s", (key >> 16) & 0x7FFF, (key >> 8) & 0xFF, ((key & 0xFF) == kUSBIn) ? "In" : "Out");
+		dictionary->setObject(buf, endpointDictionary);
+		endpointDictionary->release();
+	}
+	
+	ok = dictionary->serialize(s);
+	dictionary->release();
+	
+	return ok;
+}
+
+
+
 //================================================================================================
 //
 //   IOUSBControllerV2 Methods
@@ -124,6 +295,19 @@ IOUSBControllerV2::start( IOService * provider )
 
 
 
+void
+IOUSBControllerV2::stop( IOService * provider )
+{
+	// The thread returns completions through _commandGate, which super::stop releases, so it has to go first.  Anything
+	// which completes after this is returned the usual way.
+	if (_v2ExpansionData)
+		StopRealTimeIsochThread();
+	
+	super::stop(provider);
+}
+
+
+
 void
 IOUSBControllerV2::free()
 {
@@ -134,6 +318,16 @@ IOUSBControllerV2::free()
         thread_call_free(_returnIsochDoneQueueThread);
     }
 	
+	if (_v2ExpansionData)
+	{
+		StopRealTimeIsochThread();
+		if (_realTimeIsochJitter)
+		{
+			_realTimeIsochJitter->release();
+			_realTimeIsochJitter = NULL;
+		}
+	}
+	
 	//  This needs to be the LAST thing we do, as it disposes of our "fake" member
     //  variables.
     //
@@ -1320,6 +1514,15 @@ IOUSBControllerV2::ReturnIsochDoneQueue(IOUSBControllerIsochEndpoint* pEP)
 	uint32_t							busFunctEP;
 	
     USBLog(7, "IOUSBControllerV2[%p]::ReturnIsocDoneQueue (%p)", this, pEP);
+	
+	// Endpoints which asked for real time completions get them on that thread.  An abort still returns the queue
+	// here, as the caller expects it to be empty when we return.
+	if (pEP->realTimeCompletion && (current_thread() != _realTimeIsochThread) && !pEP->aborting && (pEP->accumulatedStatus != kIOReturnAborted))
+	{
+		if (QueueRealTimeIsochCompletion(pEP))
+			return;
+	}
+	
 	_commandGate->runAction(GatedGetTDfromDoneQueue, pEP, &pTD);
 	
 	USBTrace_Start( kUSBTController, kTPControllerReturnIsochDoneQueue, (uintptr_t)this, (uintptr_t)pEP, (uintptr_t)pTD, 0 );
@@ -1361,6 +1564,9 @@ IOUSBControllerV2::ReturnIsochDoneQueue(IOUSBControllerIsochEndpoint* pEP)
 																pHandler, pTD->_completion.target, pTD->_completion.parameter, (void*)(UInt64)pEP->accumulatedStatus, USBStringFromReturn(pEP->accumulatedStatus), pFrames, (uint32_t)_busNumber, pEP->functionAddress,  pEP->endpointNumber);
 			
 			USBTrace( kUSBTController, kTPControllerReturnIsochDoneQueue, (uint32_t)busFunctEP, (uintptr_t)pHandler, (uint32_t)pEP->accumulatedStatus, 5);
+			
+			if (pEP->realTimeJitter && pTD->_lowLatency && pFrames)
+				IOUSBIsochJitterStatistics::Record(pEP->realTimeJitter, ((IOUSBLowLatencyIsocFrame*)pFrames)[pTD->_frameIndex + (pTD->_framesInTD ? pTD->_framesInTD - 1 : 0)].frTimeStamp);
                         
 			(*pHandler) (pTD->_completion.target,  pTD->_completion.parameter, pEP->accumulatedStatus, pFrames);
 			
@@ -1772,7 +1978,238 @@ IOUSBControllerV2::UpdateDeviceAddress(USBDeviceAddress oldDeviceAddress,
     return kIOReturnUnsupported;
 }
 
-OSMetaClassDefineReservedUnused(IOUSBControllerV2,  27);
+// this is a static method - hence no slot
+void
+IOUSBControllerV2::RealTimeIsochThread(void *arg, wait_result_t waitResult)
+{
+#pragma unused (waitResult)
+	IOUSBControllerV2					*me = (IOUSBControllerV2*)arg;
+	IOUSBControllerIsochEndpoint		*pEP, *next, *reversed;
+	thread_t							thread;
+	
+	while (true)
+	{
+		// Take everything which has been queued in one go
+		do
+		{
+			pEP = me->_realTimeIsochQueue;
+		} while (pEP && !OSCompareAndSwapPtr(pEP, NULL, (void * volatile *)&me->_realTimeIsochQueue));
+		
+		if (!pEP)
+		{
+			if (me->_realTimeIsochTerminate)
+				break;
+			
+			assert_wait((event_t)&me->_realTimeIsochQueue, THREAD_UNINT);
+			if (me->_realTimeIsochQueue || me->_realTimeIsochTerminate)
+				clear_wait(current_thread(), THREAD_AWAKENED);
+			else
+				thread_block(THREAD_CONTINUE_NULL);
+			continue;
+		}
+		
+		// The queue is a LIFO, so put the endpoints back in the order they were queued
+		reversed = NULL;
+		while (pEP)
+		{
+			next = pEP->realTimeNext;
+			pEP->realTimeNext = reversed;
+			reversed = pEP;
+			pEP = next;
+		}
+		
+		for (pEP = reversed; pEP; pEP = next)
+		{
+			next = pEP->realTimeNext;
+			pEP->realTimeNext = NULL;
+			
+			// Take the endpoint off the queue before returning its TDs, so that anything which completes meanwhile queues it again
+			OSCompareAndSwap(1, 0, &pEP->realTimeQueued);
+			me->ReturnIsochDoneQueue(pEP);
+			
+			// Drop the reference QueueRealTimeIsochCompletion took - the UIM may have deleted the endpoint meanwhile
+			pEP->release();
+		}
+	}
+	
+	// StopRealTimeIsochThread is waiting for this, after which we can't touch the controller
+	me->_realTimeIsochThreadRunning = false;
+	
+	thread = current_thread();
+	thread_deallocate(thread);
+	thread_terminate(thread);
+}
+
+
+
+IOReturn
+IOUSBControllerV2::StartRealTimeIsochThread(void)
+{
+	thread_time_constraint_policy_data_t	policy;
+	UInt64									interval;
+	thread_t								thread = THREAD_NULL;
+	kern_return_t							kr;
+	
+	if (_realTimeIsochThread)
+		return kIOReturnSuccess;
+	
+	_realTimeIsochTerminate = false;
+	_realTimeIsochThreadRunning = true;
+	kr = kernel_thread_start((thread_continue_t)RealTimeIsochThread, this, &thread);
+	if (kr != KERN_SUCCESS)
+	{
+		_realTimeIsochThreadRunning = false;
+		USBError(1, "%s[%p]::StartRealTimeIsochThread - could not start the thread (0x%x)", getName(), this, kr);
+		return kIOReturnNoResources;
+	}
+	
+	// Up to 200us in every 1ms frame, finished within 500us of being woken up
+	nanoseconds_to_absolutetime(1000000, &interval);
+	policy.period = (uint32_t)interval;
+	nanoseconds_to_absolutetime(200000, &interval);
+	policy.computation = (uint32_t)interval;
+	nanoseconds_to_absolutetime(500000, &interval);
+	policy.constraint = (uint32_t)interval;
+	policy.preemptible = TRUE;
+	
+	kr = thread_policy_set(thread, THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+	if (kr != KERN_SUCCESS)
+	{
+		USBLog(1, "%s[%p]::StartRealTimeIsochThread - could not make the thread time constraint (0x%x), completions will still use it", getName(), this, kr);
+	}
+	
+	_realTimeIsochThread = thread;
+	USBLog(3, "%s[%p]::StartRealTimeIsochThread - started thread %p", getName(), this, thread);
+	
+	return kIOReturnSuccess;
+}
+
+
+
+void
+IOUSBControllerV2::StopRealTimeIsochThread(void)
+{
+	IOUSBControllerIsochEndpoint		*pEP, *next;
+	
+	if (!_realTimeIsochThread)
+		return;
+	
+	// The thread returns whatever is still queued before it sees this
+	_realTimeIsochTerminate = true;
+	thread_wakeup((event_t)&_realTimeIsochQueue);
+	while (_realTimeIsochThreadRunning)
+		IOSleep(1);
+	
+	_realTimeIsochThread = THREAD_NULL;
+	
+	// Anybody who got past the _realTimeIsochTerminate check as the thread was leaving may still have linked an endpoint.
+	// Its TDs are returned when the UIM aborts it, so just drop the reference we took for the thread.
+	do
+	{
+		pEP = _realTimeIsochQueue;
+	} while (pEP && !OSCompareAndSwapPtr(pEP, NULL, (void * volatile *)&_realTimeIsochQueue));
+	
+	for (; pEP; pEP = next)
+	{
+		next = pEP->realTimeNext;
+		pEP->realTimeNext = NULL;
+		OSCompareAndSwap(1, 0, &pEP->realTimeQueued);
+		pEP->release();
+	}
+}
+
+
+
+bool
+IOUSBControllerV2::QueueRealTimeIsochCompletion(IOUSBControllerIsochEndpoint *pEP)
+{
+	IOUSBControllerIsochEndpoint		*head;
+	
+	if (!pEP || !pEP->realTimeCompletion || !_realTimeIsochThread || _realTimeIsochTerminate)
+		return false;
+	
+	// Only the first caller links the endpoint, anybody else knows the thread hasn't got to it yet.  The queue holds a
+	// reference, so the UIM can delete the endpoint while it is queued or while the thread is returning its TDs.
+	if (OSCompareAndSwap(0, 1, &pEP->realTimeQueued))
+	{
+		pEP->retain();
+		do
+		{
+			head = _realTimeIsochQueue;
+			pEP->realTimeNext = head;
+		} while (!OSCompareAndSwapPtr(head, pEP, (void * volatile *)&_realTimeIsochQueue));
+		
+		thread_wakeup((event_t)&_realTimeIsochQueue);
+	}
+	
+	return true;
+}
+
+
+
+IOReturn
+IOUSBControllerV2::DoSetRealTimeIsochCompletion(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+#pragma unused (arg3)
+	IOUSBControllerV2					*me = (IOUSBControllerV2*)owner;
+	USBDeviceAddress					address = (USBDeviceAddress)(uintptr_t)arg0;
+	Endpoint							*endpoint = (Endpoint*)arg1;
+	bool								enable = (bool)(uintptr_t)arg2;
+	IOUSBControllerIsochEndpoint		*pEP;
+	IOReturn							err;
+	
+	pEP = me->FindIsochronousEndpoint(address, endpoint->number, endpoint->direction, NULL);
+	if (!pEP)
+	{
+		USBLog(2, "%s[%p]::DoSetRealTimeIsochCompletion - no Isoch endpoint for %d:%d:%d", me->getName(), me, address, endpoint->number, endpoint->direction);
+		return kIOReturnNotFound;
+	}
+	
+	if (!enable)
+	{
+		// If the endpoint is already queued the thread still returns it, which is harmless
+		pEP->realTimeCompletion = false;
+		return kIOReturnSuccess;
+	}
+	
+	err = me->StartRealTimeIsochThread();
+	if (err != kIOReturnSuccess)
+		return err;
+	
+	if (!me->_realTimeIsochJitter)
+	{
+		me->_realTimeIsochJitter = new IOUSBIsochJitterStatistics;
+		if (me->_realTimeIsochJitter && !me->_realTimeIsochJitter->init())
+		{
+			me->_realTimeIsochJitter->release();
+			me->_realTimeIsochJitter = NULL;
+		}
+		if (me->_realTimeIsochJitter)
+			me->setProperty("Isochronous Completion Jitter", me->_realTimeIsochJitter);
+	}
+	
+	// Without a histogram entry the endpoint still gets real time completions, they just aren't measured
+	if (me->_realTimeIsochJitter)
+		pEP->realTimeJitter = me->_realTimeIsochJitter->FindEntry(address, endpoint->number, endpoint->direction);
+	
+	pEP->realTimeCompletion = true;
+	USBLog(5, "%s[%p]::DoSetRealTimeIsochCompletion - endpoint %d:%d:%d now completes on thread %p", me->getName(), me, address, endpoint->number, endpoint->direction, me->_realTimeIsochThread);
+	
+	return kIOReturnSuccess;
+}
+
+
+
+OSMetaClassDefineReservedUsed(IOUSBControllerV2,  27);
+IOReturn
+IOUSBControllerV2::SetRealTimeIsochCompletion(USBDeviceAddress address, Endpoint *endpoint, bool enable)
+{
+	if (!endpoint || (endpoint->transferType != kUSBIsoc))
+		return kIOReturnBadArgument;
+	
+	return _commandGate->runAction(DoSetRealTimeIsochCompletion, (void*)(uintptr_t)address, (void*)endpoint, (void*)(uintptr_t)enable);
+}
+
 OSMetaClassDefineReservedUnused(IOUSBControllerV2,  28);
 OSMetaClassDefineReservedUnused(IOUSBControllerV2,  29);
 
@@ -83,6 +83,12 @@ uint32_t *				IOUSBControllerV3::_gHibernateState;
 #define	_outstandingSSRHTrans			_v3ExpansionData->_outstandingSSRHTrans
 #define	_rootHubPortsSSStartRange		_v3ExpansionData->_rootHubPortsSSStartRange
 #define	_rootHubPortsHSStartRange		_v3ExpansionData->_rootHubPortsHSStartRange
+#define _rootHubChangeInterrupts		_v3ExpansionData->_rootHubChangeInterrupts
+#define _rootHubChangePending			_v3ExpansionData->_rootHubChangePending
+#define _rootHubTimerArmedTime			_v3ExpansionData->_rootHubTimerArmedTime
+#define _rootHubTimerWakeupsSaved		_v3ExpansionData->_rootHubTimerWakeupsSaved
+
+#define kUSBRootHubTimerWakeupsSavedKey	"Root Hub Timer Wakeups Saved"
 
 #ifndef kIOPMPCISleepResetKey
 	#define kIOPMPCISleepResetKey           "IOPMPCISleepReset"
@@ -1441,11 +1447,140 @@ IOUSBControllerV3::RootHubTimerFired(OSObject *owner, IOTimerEventSource *sender
 	}
 		
 	USBTrace( kUSBTController, kTPControllerRootHubTimer, (uintptr_t)me, (uintptr_t)me->_rootHubDevice->GetPolicyMaker(), (uintptr_t)me->_rootHubDevice->GetPolicyMaker()->getPowerState(), 4 );
+	me->RHCountSavedTimerWakeups(true);
 	me->CheckForRootHubChanges();
 	
 	// fire it up again
     if (me->_rootHubPollingRate32 && !me->isInactive() && me->_controllerAvailable)
+	{
+		me->_rootHubTimerArmedTime = mach_absolute_time();
 		me->_rootHubTimer->setTimeoutMS(me->_rootHubPollingRate32);
+	}
+}
+
+
+
+//================================================================================================
+//
+//   RHCountSavedTimerWakeups
+//
+//   Called when the root hub timer fires or is cancelled.  Counts the kUSBRootHubPollingRate
+//   firings we would have had since it was armed, less the one that just happened
+//
+//================================================================================================
+//
+void
+IOUSBControllerV3::RHCountSavedTimerWakeups(bool fired)
+{
+	uint64_t	elapsed;
+	uint64_t	elapsedNS;
+	UInt64		polls;
+	
+	if (!_rootHubChangeInterrupts || (_rootHubTimerArmedTime == 0))
+		return;
+	
+	elapsed = mach_absolute_time() - _rootHubTimerArmedTime;
+	_rootHubTimerArmedTime = 0;
+	absolutetime_to_nanoseconds( *( AbsoluteTime * ) &elapsed, &elapsedNS );
+	
+	polls = elapsedNS / (kUSBRootHubPollingRate * 1000000ULL);
+	if (fired && (polls > 0))
+		polls--;
+	
+	if (polls)
+	{
+		_rootHubTimerWakeupsSaved += polls;
+		if (fired)
+			setProperty(kUSBRootHubTimerWakeupsSavedKey, _rootHubTimerWakeupsSaved, 64);
+	}
+}
+
+
+
+//================================================================================================
+//
+//   RootHubEnableChangeInterrupts
+//
+//   Called by a UIM (usually from UIMInitialize) once it will report root hub port changes through
+//   RootHubStatusChangeInterrupt.  Takes effect the next time an interrupt read is queued
+//
+//================================================================================================
+//
+void
+IOUSBControllerV3::RootHubEnableChangeInterrupts(bool enable)
+{
+	USBLog(5, "IOUSBControllerV3(%s)[%p]::RootHubEnableChangeInterrupts - %s", getName(), this, enable ? "true" : "false");
+	_rootHubChangeInterrupts = enable;
+	if (!enable)
+		_rootHubChangePending = false;
+}
+
+
+
+//================================================================================================
+//
+//   RootHubStatusChangeInterrupt
+//
+//   Called by the UIM on the workloop when the controller reports a root hub port change, so
+//   the change is delivered now instead of on the next timer tick.  If a root hub has no interrupt
+//   read queued (the hub driver is still handling the last change), it is looked at when one is
+//
+//================================================================================================
+//
+void
+IOUSBControllerV3::RootHubStatusChangeInterrupt(void)
+{
+	bool	haveRead;
+	
+	if (!_rootHubChangeInterrupts || isInactive() || !_controllerAvailable)
+		return;
+	
+	haveRead = (_outstandingRHTrans[0].completion.action != NULL);
+	if (_controllerSpeed == kUSBDeviceSpeedSuper)
+	{
+		if (_outstandingSSRHTrans[0].completion.action != NULL)
+			haveRead = true;
+		if ((_outstandingRHTrans[0].completion.action == NULL) || (_outstandingSSRHTrans[0].completion.action == NULL))
+			_rootHubChangePending = true;
+	}
+	else if (!haveRead)
+		_rootHubChangePending = true;
+	
+	USBLog(6, "IOUSBControllerV3(%s)[%p]::RootHubStatusChangeInterrupt - haveRead(%s) pending(%s)", getName(), this, haveRead ? "true" : "false", _rootHubChangePending ? "true" : "false");
+	if (haveRead)
+		CheckForRootHubChanges();
+}
+
+
+
+//================================================================================================
+//
+//   RootHubSoftwareStatusChange
+//
+//   Called by a UIM which has set a root hub change bit itself (EHCI's reset change, say), or which
+//   has the port change interrupt masked, so no interrupt will come for the change.  The timer is
+//   only a safety net once change interrupts are enabled, so have it fire after kUSBRootHubPollingRate
+//   instead of waiting out kUSBRootHubSafetyPollingRate.  The UIM is usually in the middle of a
+//   root hub device request, which is why this goes through the timer and not CheckForRootHubChanges
+//
+//================================================================================================
+//
+void
+IOUSBControllerV3::RootHubSoftwareStatusChange(void)
+{
+	if (!_rootHubChangeInterrupts || isInactive() || !_controllerAvailable)
+		return;
+	
+	if ((_outstandingRHTrans[0].completion.action == NULL) || ((_controllerSpeed == kUSBDeviceSpeedSuper) && (_outstandingSSRHTrans[0].completion.action == NULL)))
+		_rootHubChangePending = true;
+	
+	if (_rootHubTimer && _rootHubPollingRate32)
+	{
+		USBLog(6, "IOUSBControllerV3(%s)[%p]::RootHubSoftwareStatusChange - firing the root hub timer in %d ms", getName(), this, (int)kUSBRootHubPollingRate);
+		RHCountSavedTimerWakeups(false);
+		_rootHubTimerArmedTime = mach_absolute_time();
+		_rootHubTimer->setTimeoutMS(kUSBRootHubPollingRate);		// RootHubTimerFired goes back to _rootHubPollingRate32
+	}
 }
 
 #if 0
@@ -1618,6 +1753,14 @@ IOUSBControllerV3::RHQueueTransaction(IOMemoryDescriptor *buf, UInt32 bufLen, IO
 			if ( _rootHubTransactionWasAborted )
 			{
 				USBLog(6, "IOUSBControllerV3(%s)[%p]::RHQueueTransaction  _rootHubTransactionWasAborted was true, calling CheckForRootHubChanges()", getName(), this);
+				_rootHubChangePending = false;
+				CheckForRootHubChanges();
+			}
+			else if ( _rootHubChangePending )
+			{
+				// A port change interrupt came in while nobody was listening, and the timer won't be along for a while
+				USBLog(6, "IOUSBControllerV3(%s)[%p]::RHQueueTransaction  _rootHubChangePending was true, calling CheckForRootHubChanges()", getName(), this);
+				_rootHubChangePending = false;
 				CheckForRootHubChanges();
 			}
 			
@@ -1647,8 +1790,8 @@ IOUSBControllerV3::RootHubQueueInterruptRead(IOMemoryDescriptor *buf, UInt32 buf
 	
 	USBLog(6, "IOUSBControllerV3(%s)[%p]::RootHubQueueInterruptRead, starting timer", getName(), this);
 	
-	// Start the RootHub timer
-	RootHubStartTimer32(kUSBRootHubPollingRate);
+	// Start the RootHub timer.  If the UIM tells us about port changes it is only a safety net
+	RootHubStartTimer32(_rootHubChangeInterrupts ? (uint32_t)kUSBRootHubSafetyPollingRate : (uint32_t)kUSBRootHubPollingRate);
 
 	IOUSBRootHubInterruptTransactionPtr outstandingRHXaction = _outstandingRHTrans;
 		
@@ -1748,6 +1891,8 @@ IOUSBControllerV3::RootHubStartTimer32(uint32_t pollingRate)
 	{
 		USBLog(6, "IOUSBControllerV3(%s)[%p]::RootHubStartTimer32", getName(), this);
 		
+		RHCountSavedTimerWakeups(false);					// if it was already running
+		_rootHubTimerArmedTime = mach_absolute_time();
 		_rootHubTimer->setTimeoutMS(_rootHubPollingRate32);
 	}
 	else
@@ -1775,6 +1920,7 @@ IOUSBControllerV3::RootHubStopTimer(void)
     {
 		_rootHubTimer->cancelTimeout();
 	}
+	RHCountSavedTimerWakeups(false);
 	
 	return kIOReturnSuccess;
 }
@@ -2417,6 +2563,15 @@ IOUSBControllerV3::GetBandwidthAvailableForDevice(IOUSBDevice *forDevice,  UInt3
     return ret;
 }
 
+IOReturn
+IOUSBControllerV3::GetBandwidthAvailableForEndpoints(IOUSBDevice *forDevice, UInt32 replaceEndpointMask, IOUSBEndpointProperties *endpoints, UInt32 numEndpoints, UInt32 *pBandwidthAvailable)
+{
+#pragma unused (forDevice, replaceEndpointMask, endpoints, numEndpoints, pBandwidthAvailable)
+	
+	// only controllers which keep a model of their schedule can answer this
+	return kIOReturnUnsupported;
+}
+
 IOReturn IOUSBControllerV3::GetRootHubPowerExitLatencies(IOUSBHubExitLatencies **latencies)
 {
     _v3ExpansionData->_latencies[0].vers = 1;
@@ -2486,8 +2641,8 @@ OSMetaClassDefineReservedUsed(IOUSBControllerV3,  21);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  22);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  23);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  24);
+OSMetaClassDefineReservedUsed(IOUSBControllerV3,  25);
 
-OSMetaClassDefineReservedUnused(IOUSBControllerV3,  25);
 OSMetaClassDefineReservedUnused(IOUSBControllerV3,  26);
 OSMetaClassDefineReservedUnused(IOUSBControllerV3,  27);
 OSMetaClassDefineReservedUnused(IOUSBControllerV3,  28);
@@ -49,6 +49,8 @@ extern "C" {
 #include "../Headers/IOUSBRootHubDevice.h"
 #include "../Headers/IOUSBHubPolicyMaker.h"
 #include "../Headers/USB.h"
+#include "../Headers/USBDescriptorIndex.h"
+#include "../Headers/USBDescriptorCache.h"
 
 #include <UserNotification/KUNCUserNotifications.h>
 
@@ -95,6 +97,8 @@ extern "C" {
 #define _WAKEUSB3POWERALLOCATED			_expansionData->_wakeUSB3PowerAllocated
 #define _ATTACHEDTOENCLOSUREANDUSINGEXTRAWAKEPOWER		_expansionData->_attachedToEnclosureAndUsingExtraWakePower
 #define _DEVICEISONTHUNDERBOLT				_expansionData->_deviceIsOnThunderbolt
+#define _CONFIG_DESCRIPTOR_INDEXES		_expansionData->_configDescriptorIndexes
+#define _DESCRIPTOR_CACHE_ENTRY			_expansionData->_descriptorCacheEntry
 
 
 #define kNotifyTimerDelay			60000	// in milliseconds = 60 seconds
@@ -102,6 +106,12 @@ extern "C" {
 #define kMaxTimeToWaitForReset		20000   // in milliseconds = 10 seconds
 #define kMaxTimeToWaitForSuspend	20000   // in milliseconds = 20 seconds
 #define kGetConfigDeadlineInSecs	30
+#define kUSBInterfaceMatchingTimeout	(30ULL * 1000ULL * 1000ULL * 1000ULL)		// in nanoseconds = 30 seconds, for the whole kUSBParallelInterfaceMatching barrier
+
+#define kDescriptorCacheDevice			"Device"
+#define kDescriptorCacheSerial			"Serial"
+#define kDescriptorCacheProduct			"Product"
+#define kDescriptorCacheManufacturer	"Manufacturer"
 
 typedef struct IOUSBDeviceMessage {
     UInt32			type;
@@ -131,6 +141,258 @@ __attribute__((format(printf, 1, 2)));
 //
 extern KernelDebugLevel	    gKernelDebugLevel;
 
+//================================================================================================
+//
+//   Descriptor Cache
+//
+//	 Re-enumerating a device (after a reset, a ReEnumerateDevice() or a wake that lost it) creates a new
+//	 IOUSBDevice which reads its strings and configuration descriptors over the bus all over again.  We
+//	 remember them here, keyed by locationID, VID, PID and bcdDevice, and a device whose device descriptor
+//	 and serial number match what was cached at its location reuses them (USBDescriptorCache.h has the rules).
+//	 Entries are shared by the old and new device objects, so they are only touched with gDescriptorCacheLock
+//	 held.  A SET_DESCRIPTOR request, or a ReEnumerateDevice() with kUSBReEnumerateRereadDescriptorsMask,
+//	 throws the device's entry away, since the device may come back with different descriptors.
+//
+//================================================================================================
+//
+class USBDescriptorCacheGlobals
+	{
+	public:
+		virtual ~USBDescriptorCacheGlobals(void);	// Destructor
+	};
+
+static USBDescriptorCacheGlobals	gDescriptorCacheGlobals;				// frees the cache when we are unloaded
+static IOLock *			gDescriptorCacheLock = NULL;
+static OSDictionary *	gDescriptorCache = NULL;
+
+USBDescriptorCacheGlobals::~USBDescriptorCacheGlobals ( void )
+{
+	if ( gDescriptorCache )
+	{
+		gDescriptorCache->release();
+		gDescriptorCache = NULL;
+	}
+	
+	if ( gDescriptorCacheLock )
+	{
+		IOLockFree(gDescriptorCacheLock);
+		gDescriptorCacheLock = NULL;
+	}
+}
+
+static IOLock *
+DescriptorCacheLock(void)
+{
+	if ( gDescriptorCacheLock == NULL )
+	{
+		IOLock *	lock = IOLockAlloc();
+		
+		if ( lock && !OSCompareAndSwapPtr(NULL, lock, (void * volatile *)&gDescriptorCacheLock) )
+			IOLockFree(lock);
+	}
+	return gDescriptorCacheLock;
+}
+
+// Returns the (retained) cache entry for this device, creating it if the device at this location has changed
+static OSDictionary *
+DescriptorCacheCopyEntry(UInt32 locationID, const IOUSBDeviceDescriptor *desc, const char *serial)
+{
+	IOLock *			lock = DescriptorCacheLock();
+	char				key[kUSBDescriptorCacheKeySize];
+	OSDictionary *		entry = NULL;
+	OSData *			device;
+	OSString *			serialString;
+	
+	if ( !lock )
+		return NULL;
+	
+	USBDescriptorCacheMakeKey(key, locationID, desc);
+	
+	IOLockLock(lock);
+	
+	if ( gDescriptorCache == NULL )
+		gDescriptorCache = OSDictionary::withCapacity(kUSBDescriptorCacheMaxEntries);
+	
+	if ( gDescriptorCache )
+	{
+		entry = OSDynamicCast(OSDictionary, gDescriptorCache->getObject(key));
+		if ( entry )
+		{
+			device = OSDynamicCast(OSData, entry->getObject(kDescriptorCacheDevice));
+			serialString = OSDynamicCast(OSString, entry->getObject(kDescriptorCacheSerial));
+			
+			if ( !device || !serialString || !USBDescriptorCacheEntryMatches(device->getBytesNoCopy(), device->getLength(), serialString->getCStringNoCopy(), desc, serial) )
+			{
+				USBLog(5, "IOUSBDevice::DescriptorCacheCopyEntry - device at 0x%x no longer matches its cached descriptors", (uint32_t)locationID);
+				gDescriptorCache->removeObject(key);
+				entry = NULL;
+			}
+			else
+			{
+				entry->retain();
+			}
+		}
+		
+		if ( entry == NULL )
+		{
+			if ( USBDescriptorCacheMustFlush(gDescriptorCache->getCount()) )
+			{
+				// Throw away the whole thing rather than keep track of ages, devices will just be read again
+				USBLog(5, "IOUSBDevice::DescriptorCacheCopyEntry - descriptor cache is full, flushing it");
+				gDescriptorCache->flushCollection();
+			}
+			
+			entry = OSDictionary::withCapacity(4);
+			device = OSData::withBytes(desc, sizeof(IOUSBDeviceDescriptor));
+			serialString = OSString::withCString(serial);
+			if ( entry && device && serialString )
+			{
+				entry->setObject(kDescriptorCacheDevice, device);
+				entry->setObject(kDescriptorCacheSerial, serialString);
+				gDescriptorCache->setObject(key, entry);
+			}
+			else if ( entry )
+			{
+				entry->release();
+				entry = NULL;
+			}
+			
+			if ( device )
+				device->release();
+			if ( serialString )
+				serialString->release();
+		}
+	}
+	
+	IOLockUnlock(lock);
+	
+	return entry;
+}
+
+// Removes this entry from the cache and empties it, so neither the device holding it nor the next one at its location uses it
+static void
+DescriptorCacheInvalidateEntry(OSDictionary *entry)
+{
+	OSCollectionIterator *	iter;
+	OSSymbol *				key;
+	OSSymbol *				entryKey = NULL;
+	
+	if ( !entry || !DescriptorCacheLock() )
+		return;
+	
+	IOLockLock(gDescriptorCacheLock);
+	
+	if ( gDescriptorCache )
+	{
+		iter = OSCollectionIterator::withCollection(gDescriptorCache);
+		if ( iter )
+		{
+			while ( (key = OSDynamicCast(OSSymbol, iter->getNextObject())) )
+			{
+				if ( gDescriptorCache->getObject(key) == entry )
+				{
+					entryKey = key;
+					entryKey->retain();
+					break;
+				}
+			}
+			iter->release();
+		}
+		
+		if ( entryKey )
+		{
+			gDescriptorCache->removeObject(entryKey);
+			entryKey->release();
+		}
+	}
+	entry->flushCollection();
+	
+	IOLockUnlock(gDescriptorCacheLock);
+}
+
+// Copies a cached string into buffer, returns false if it hasn't been cached yet
+static bool
+DescriptorCacheGetString(OSDictionary *entry, const char *name, char *buffer, size_t bufferSize)
+{
+	OSString *	string;
+	bool		found = false;
+	
+	if ( !entry || !DescriptorCacheLock() )
+		return false;
+	
+	IOLockLock(gDescriptorCacheLock);
+	string = OSDynamicCast(OSString, entry->getObject(name));
+	if ( string )
+	{
+		strlcpy(buffer, string->getCStringNoCopy(), bufferSize);
+		found = true;
+	}
+	IOLockUnlock(gDescriptorCacheLock);
+	
+	return found;
+}
+
+static void
+DescriptorCacheSetString(OSDictionary *entry, const char *name, const char *value)
+{
+	OSString *	string;
+	
+	if ( !entry || !DescriptorCacheLock() )
+		return;
+	
+	string = OSString::withCString(value);
+	if ( string )
+	{
+		IOLockLock(gDescriptorCacheLock);
+		entry->setObject(name, string);
+		IOLockUnlock(gDescriptorCacheLock);
+		string->release();
+	}
+}
+
+// Returns a new IOBMD holding the cached configuration descriptor, or NULL if it hasn't been cached yet
+static IOBufferMemoryDescriptor *
+DescriptorCacheCopyConfiguration(OSDictionary *entry, UInt8 index)
+{
+	IOBufferMemoryDescriptor *	configIOMD = NULL;
+	OSData *					config;
+	char						key[32];
+	
+	if ( !entry || !DescriptorCacheLock() )
+		return NULL;
+	
+	snprintf(key, sizeof(key), "Configuration %d", index);
+	
+	IOLockLock(gDescriptorCacheLock);
+	config = OSDynamicCast(OSData, entry->getObject(key));
+	if ( config )
+		configIOMD = IOBufferMemoryDescriptor::withBytes(config->getBytesNoCopy(), config->getLength(), kIODirectionIn, false);
+	IOLockUnlock(gDescriptorCacheLock);
+	
+	return configIOMD;
+}
+
+static void
+DescriptorCacheSetConfiguration(OSDictionary *entry, UInt8 index, const void *bytes, UInt32 length)
+{
+	OSData *	config;
+	char		key[32];
+	
+	if ( !entry || !DescriptorCacheLock() )
+		return;
+	
+	snprintf(key, sizeof(key), "Configuration %d", index);
+	
+	config = OSData::withBytes(bytes, length);
+	if ( config )
+	{
+		IOLockLock(gDescriptorCacheLock);
+		entry->setObject(key, config);
+		IOLockUnlock(gDescriptorCacheLock);
+		config->release();
+	}
+}
+
 //================================================================================================
 //
 //   Private IOUSBInterfaceIterator Class Definition
@@ -273,6 +535,8 @@ IOUSBDevice::start( IOService * provider )
 {
     IOReturn 		err;
     char			name[256];
+    char			serialNumber[256];
+    IOReturn		serialErr;
     UInt32			delay = 30;
     UInt32			retries = 4;
     bool			allowNumConfigsOfZero = false;
@@ -423,6 +687,11 @@ IOUSBDevice::start( IOService * provider )
         if (!_configList)
 			goto ErrorExit;
         bzero(_configList, sizeof(IOBufferMemoryDescriptor*) * _descriptor.bNumConfigurations);
+		
+		// The indexes are only an optimization, FindNextDescriptor scans the descriptor without one
+		_CONFIG_DESCRIPTOR_INDEXES = IONew(USBDescriptorIndex*, _descriptor.bNumConfigurations);
+		if (_CONFIG_DESCRIPTOR_INDEXES)
+			bzero(_CONFIG_DESCRIPTOR_INDEXES, sizeof(USBDescriptorIndex*) * _descriptor.bNumConfigurations);
     }
     else
     {
@@ -440,9 +709,38 @@ IOUSBDevice::start( IOService * provider )
 	}
 	else 
 	{	
+		// The serial number is always read from the device, and only once.  It's what tells us that this is the same device
+		// as the one in the descriptor cache.
+		//
+		serialNumber[0] = 0;
+		serialErr = kIOReturnSuccess;
+		if (_descriptor.iSerialNumber)
+			serialErr = GetStringDescriptor(_descriptor.iSerialNumber, serialNumber, sizeof(serialNumber));
+		
+		// Devices below a hub may have been here before (re-enumerated by their hub), so look for their strings and configurations
+		// in the descriptor cache.  The locationID in the key tells identical devices apart, so this includes devices without a
+		// serial number, which are most HID devices.
+		//
+		propertyObj = copyProperty(kUSBDontCacheDescriptors);
+		boolObj = OSDynamicCast( OSBoolean, propertyObj );
+		if ( USBDescriptorCacheUsable(_USBPLANE_PARENT != NULL, boolObj == kOSBooleanTrue, _descriptor.iSerialNumber, serialErr == kIOReturnSuccess) )
+		{
+			_DESCRIPTOR_CACHE_ENTRY = DescriptorCacheCopyEntry(_LOCATIONID, &_descriptor, serialNumber);
+		}
+		
+		if (propertyObj)
+			propertyObj->release();
+		
 		if (_descriptor.iProduct)
 		{
-			err = GetStringDescriptor(_descriptor.iProduct, name, sizeof(name));
+			if ( DescriptorCacheGetString(_DESCRIPTOR_CACHE_ENTRY, kDescriptorCacheProduct, name, sizeof(name)) )
+				err = kIOReturnSuccess;
+			else
+			{
+				err = GetStringDescriptor(_descriptor.iProduct, name, sizeof(name));
+				if (err == kIOReturnSuccess)
+					DescriptorCacheSetString(_DESCRIPTOR_CACHE_ENTRY, kDescriptorCacheProduct, name);
+			}
 			if (err == kIOReturnSuccess)
 			{
 				if ( name[0] != 0 )
@@ -471,7 +769,14 @@ IOUSBDevice::start( IOService * provider )
 		
 		if (_descriptor.iManufacturer)
 		{
-			err = GetStringDescriptor(_descriptor.iManufacturer, name, sizeof(name));
+			if ( DescriptorCacheGetString(_DESCRIPTOR_CACHE_ENTRY, kDescriptorCacheManufacturer, name, sizeof(name)) )
+				err = kIOReturnSuccess;
+			else
+			{
+				err = GetStringDescriptor(_descriptor.iManufacturer, name, sizeof(name));
+				if (err == kIOReturnSuccess)
+					DescriptorCacheSetString(_DESCRIPTOR_CACHE_ENTRY, kDescriptorCacheManufacturer, name);
+			}
 			if (err == kIOReturnSuccess)
 			{
 				setProperty(kUSBVendorString, name);
@@ -479,10 +784,9 @@ IOUSBDevice::start( IOService * provider )
 		}
 		if (_descriptor.iSerialNumber)
 		{
-			err = GetStringDescriptor(_descriptor.iSerialNumber, name, sizeof(name));
-			if (err == kIOReturnSuccess)
+			if (serialErr == kIOReturnSuccess)
 			{
-				setProperty(kUSBSerialNumberString, name);
+				setProperty(kUSBSerialNumberString, serialNumber);
 			}
 		}
 	}
@@ -1020,6 +1324,19 @@ IOUSBDevice::free()
 		_configList = NULL;
     }
 	
+	if (_expansionData && _CONFIG_DESCRIPTOR_INDEXES)
+	{
+		int		i;
+		for(i=0; i<_descriptor.bNumConfigurations; i++)
+			if (_CONFIG_DESCRIPTOR_INDEXES[i])
+			{
+				IOFree(_CONFIG_DESCRIPTOR_INDEXES[i], _CONFIG_DESCRIPTOR_INDEXES[i]->size);
+				_CONFIG_DESCRIPTOR_INDEXES[i] = NULL;
+			}
+		IODelete(_CONFIG_DESCRIPTOR_INDEXES, USBDescriptorIndex*, _descriptor.bNumConfigurations);
+		_CONFIG_DESCRIPTOR_INDEXES = NULL;
+	}
+	
     _currentConfigValue = 0;
 	
     //  This needs to be the LAST thing we do, as it disposes of our "fake" member
@@ -1047,6 +1364,12 @@ IOUSBDevice::free()
 			_INTERFACEARRAYLOCK = NULL;
 		}
 		
+		if ( _DESCRIPTOR_CACHE_ENTRY )
+		{
+			_DESCRIPTOR_CACHE_ENTRY->release();
+			_DESCRIPTOR_CACHE_ENTRY = NULL;
+		}
+		
         IOFree(_expansionData, sizeof(ExpansionData));
         _expansionData = NULL;
     }
@@ -1281,6 +1604,15 @@ IOUSBDevice::ReEnumerateDevice( UInt32 options )
 	
 	if (!isInactive() && _expansionData && _COMMAND_GATE && _WORKLOOP)
 	{
+		// A client which knows the device changed without changing its device descriptor or serial number (a firmware
+		// update that kept bcdDevice) asks for the new IOUSBDevice to read everything from the device.  The hub doesn't
+		// know the option.
+		if ( options & kUSBReEnumerateRereadDescriptorsMask )
+		{
+			DescriptorCacheInvalidateEntry(_DESCRIPTOR_CACHE_ENTRY);
+			options &= ~kUSBReEnumerateRereadDescriptorsMask;
+		}
+		
 		IOCommandGate *	gate = _COMMAND_GATE;
 		IOWorkLoop *	workLoop = _WORKLOOP;
 		
@@ -1487,6 +1819,46 @@ NextDescriptor(const void *desc)
 
 
 
+static USBDescriptorIndex *
+CreateDescriptorIndex(IOBufferMemoryDescriptor *configIOMD)
+{
+	USBDescriptorIndex *	index;
+	UInt16					count = 0;
+	UInt16					typeCount = 0;
+	UInt32					size;
+	
+	size = USBDescriptorIndexSize(configIOMD->getBytesNoCopy(), (UInt32)configIOMD->getLength(), &count, &typeCount);
+	if (size == 0)
+		return NULL;
+	
+	index = (USBDescriptorIndex *)IOMalloc(size);
+	if (index)
+		USBDescriptorIndexBuild(index, size, configIOMD->getBytesNoCopy(), (UInt32)configIOMD->getLength(), count, typeCount);
+	
+	return index;
+}
+
+
+
+const USBDescriptorIndex *
+IOUSBDevice::GetDescriptorIndex(const void *configDesc)
+{
+	int		i;
+	
+	if (!_configList || !_expansionData || !_CONFIG_DESCRIPTOR_INDEXES || !configDesc)
+		return NULL;
+	
+	for (i = 0; i < _descriptor.bNumConfigurations; i++)
+	{
+		if (_configList[i] && (_configList[i]->getBytesNoCopy() == configDesc))
+			return _CONFIG_DESCRIPTOR_INDEXES[i];
+	}
+	
+	return NULL;
+}
+
+
+
 const IOUSBDescriptorHeader*
 IOUSBDevice::FindNextDescriptor(const void *cur, UInt8 descType)
 {
@@ -1544,6 +1916,14 @@ IOUSBDevice::FindNextDescriptor(const void *cur, UInt8 descType)
 		hdr = (IOUSBDescriptorHeader *)cur;
     }
 	
+	if (_CONFIG_DESCRIPTOR_INDEXES && _CONFIG_DESCRIPTOR_INDEXES[configIndex])
+	{
+		const IOUSBDescriptorHeader *	next;
+		
+		if (USBDescriptorIndexFindNext(_CONFIG_DESCRIPTOR_INDEXES[configIndex], curConfDesc, cur, descType, &next))
+			return next;
+	}
+	
     do 
     {
 		IOUSBDescriptorHeader 		*lasthdr = hdr;
@@ -1585,6 +1965,7 @@ IOUSBDevice::FindNextInterfaceDescriptor(const IOUSBConfigurationDescriptor *con
 {
     IOUSBConfigurationDescriptor *configDesc = (IOUSBConfigurationDescriptor *)configDescIn;
     IOUSBInterfaceDescriptor *interface, *end;
+	const USBDescriptorIndex *index;
     
     if (!configDesc && _currentConfigValue)
         configDesc = (IOUSBConfigurationDescriptor*)FindConfig(_currentConfigValue, NULL);
@@ -1598,8 +1979,26 @@ IOUSBDevice::FindNextInterfaceDescriptor(const IOUSBConfigurationDescriptor *con
     {
 		if (((void*)intfDesc < (void*)configDesc) || (intfDesc->bDescriptorType != kUSBInterfaceDesc))
 			return kIOReturnBadArgument;
-		interface = (IOUSBInterfaceDescriptor *)NextDescriptor(intfDesc);
     }
+	
+	// If this is one of our cached configurations, just follow the chain of interface descriptors
+	index = GetDescriptorIndex(configDesc);
+	if (index)
+	{
+		const IOUSBInterfaceDescriptor *	next;
+		
+		if (USBDescriptorIndexFindNextInterface(index, configDesc, intfDesc, request, &next))
+		{
+			if (!next)
+				return kIOUSBInterfaceNotFound;
+			
+			*descOut = (IOUSBInterfaceDescriptor *)next;
+			return kIOReturnSuccess;
+		}
+	}
+	
+    if (intfDesc != NULL)
+		interface = (IOUSBInterfaceDescriptor *)NextDescriptor(intfDesc);
     else
 		interface = (IOUSBInterfaceDescriptor *)NextDescriptor(configDesc);
 	
@@ -1607,10 +2006,7 @@ IOUSBDevice::FindNextInterfaceDescriptor(const IOUSBConfigurationDescriptor *con
     {
 		if (interface->bDescriptorType == kUSBInterfaceDesc)
 		{
-			if (((request->bInterfaceClass == kIOUSBFindInterfaceDontCare) || (request->bInterfaceClass == interface->bInterfaceClass)) &&
-				((request->bInterfaceSubClass == kIOUSBFindInterfaceDontCare)  || (request->bInterfaceSubClass == interface->bInterfaceSubClass)) &&
-				((request->bInterfaceProtocol == kIOUSBFindInterfaceDontCare)  || (request->bInterfaceProtocol == interface->bInterfaceProtocol)) &&
-				((request->bAlternateSetting == kIOUSBFindInterfaceDontCare)   || (request->bAlternateSetting == interface->bAlternateSetting)))
+			if (USBInterfaceMatchesRequest(interface, request))
 			{
 				*descOut = interface;
 				return kIOReturnSuccess;
@@ -1790,6 +2186,8 @@ IOUSBDevice::GetFullConfigurationDescriptor(UInt8 index)
 						USBTrace( kUSBTDevice,  kTPDeviceGetFullConfigurationDescriptor, (uintptr_t)this, theConfigData->getLength(), 0, 10 );
 					
 						_configList[index] = localConfigIOMD;
+						if (_CONFIG_DESCRIPTOR_INDEXES)
+							_CONFIG_DESCRIPTOR_INDEXES[index] = CreateDescriptorIndex(localConfigIOMD);
 					}
 				}
 			}
@@ -1797,6 +2195,23 @@ IOUSBDevice::GetFullConfigurationDescriptor(UInt8 index)
 			propertyObj->release();
 		} 
 		
+		// If this device was enumerated before at this location, reuse the configuration descriptor we read then
+		if ( (_configList[index] == NULL) && _DESCRIPTOR_CACHE_ENTRY )
+		{
+			localConfigIOMD = DescriptorCacheCopyConfiguration(_DESCRIPTOR_CACHE_ENTRY, index);
+			if ( localConfigIOMD )
+			{
+				USBLog(5, "%s[%p]::GetFullConfigurationDescriptor - Index (%x) - using %d bytes from the descriptor cache", getName(), this, index, (uint32_t)localConfigIOMD->getLength());
+				
+				if ( index == 0 && overrideMaxPower > 0)
+					((IOUSBConfigurationDescriptor *)localConfigIOMD->getBytesNoCopy())->MaxPower = overrideMaxPower;
+				
+				_configList[index] = localConfigIOMD;
+				if (_CONFIG_DESCRIPTOR_INDEXES)
+					_CONFIG_DESCRIPTOR_INDEXES[index] = CreateDescriptorIndex(localConfigIOMD);
+			}
+		}
+		
 		if (_configList[index] == NULL) 
 		{
 			// 2755742 - workaround for a ill behaved device
@@ -1901,6 +2316,9 @@ IOUSBDevice::GetFullConfigurationDescriptor(UInt8 index)
 					localConfigIOMD->release();
 				else
 				{
+					// Cache what the device sent us, before any override
+					DescriptorCacheSetConfiguration(_DESCRIPTOR_CACHE_ENTRY, index, localConfigIOMD->getBytesNoCopy(), len);
+					
 					// See if we need to override MaxPower
 					if ( index == 0 && overrideMaxPower > 0)
 					{
@@ -1911,6 +2329,8 @@ IOUSBDevice::GetFullConfigurationDescriptor(UInt8 index)
 					}
 					
 					_configList[index] = localConfigIOMD;
+					if (_CONFIG_DESCRIPTOR_INDEXES)
+						_CONFIG_DESCRIPTOR_INDEXES[index] = CreateDescriptorIndex(localConfigIOMD);
 				}
 			}
 			
@@ -2020,19 +2440,89 @@ IOUSBDevice::RegisterInterfaces()
 		
 		OSArray *iteratorArray = OSArray::withArray(_INTERFACEARRAY, _INTERFACEARRAY->getCount());
 		int iteratorCount = iteratorArray->getCount();
+		bool parallel = false;
+		uint64_t *registerTimes = NULL;
+		uint64_t barrierStart = mach_absolute_time();
+		uint64_t elapsed, elapsedNS;
 		
 		IOLockUnlock(_INTERFACEARRAYLOCK);
 		
+		// See if the interfaces can all be matched at once
+		if ( iteratorCount > 1 )
+		{
+			OSObject * propertyObj = copyProperty(kUSBParallelInterfaceMatching);
+			if ( OSDynamicCast(OSBoolean, propertyObj) == kOSBooleanTrue )
+			{
+				registerTimes = (uint64_t *)IOMalloc(iteratorCount * sizeof(uint64_t));
+				parallel = (registerTimes != NULL);
+			}
+			if (propertyObj)
+				propertyObj->release();
+		}
+		
+		USBTrace_Start(kUSBTEnumeration, kTPEnumerationRegisterInterfaces, (uintptr_t)this, iteratorCount, parallel, 0);
+		
 		for( int i = 0; i < iteratorCount; i++ )
 		{
 			IOUSBInterface *intf = NULL;
 			if( NULL != (intf = OSDynamicCast(IOUSBInterface, iteratorArray->getObject(i))) )
 			{ 
-				USBLog(5,"%s[%p]::RegisterInterfaces  matching to interface = %p",getName(), this, intf);
-				intf->registerService(kIOServiceSynchronous);
+				uint64_t start = mach_absolute_time();
+				
+				if ( parallel )
+				{
+					// Matching and start happen on the IOKit matching threads, we wait for all of them below
+					USBLog(5,"%s[%p]::RegisterInterfaces  matching to interface = %p (asynchronously)",getName(), this, intf);
+					registerTimes[i] = start;
+					intf->registerService();
+				}
+				else
+				{
+					USBLog(5,"%s[%p]::RegisterInterfaces  matching to interface = %p",getName(), this, intf);
+					intf->registerService(kIOServiceSynchronous);
+					
+					elapsed = mach_absolute_time() - start;
+					absolutetime_to_nanoseconds(*(AbsoluteTime *)&elapsed, &elapsedNS);
+					USBTrace(kUSBTEnumeration, kTPEnumerationRegisterInterfaces, (uintptr_t)this, intf->GetInterfaceNumber(), (uint32_t)(elapsedNS / 1000), 0);
+				}
 			}
 		}
 		
+		if ( parallel )
+		{
+			// The barrier - don't return until every interface has been matched and its drivers started, the same as the synchronous case.
+			// The timeout is for all of them together, each wait only gets what the ones before it left over
+			for( int i = 0; i < iteratorCount; i++ )
+			{
+				IOUSBInterface *intf = NULL;
+				if( NULL != (intf = OSDynamicCast(IOUSBInterface, iteratorArray->getObject(i))) )
+				{
+					IOReturn kr;
+					
+					elapsed = mach_absolute_time() - barrierStart;
+					absolutetime_to_nanoseconds(*(AbsoluteTime *)&elapsed, &elapsedNS);
+					if ( elapsedNS < kUSBInterfaceMatchingTimeout )
+						kr = intf->waitQuiet(kUSBInterfaceMatchingTimeout - elapsedNS);
+					else
+						kr = (intf->getBusyState() == 0) ? kIOReturnSuccess : kIOReturnTimeout;
+					
+					elapsed = mach_absolute_time() - registerTimes[i];
+					absolutetime_to_nanoseconds(*(AbsoluteTime *)&elapsed, &elapsedNS);
+					if ( kr != kIOReturnSuccess )
+					{
+						USBLog(1,"%s[%p]::RegisterInterfaces  interface %d (%p) still matching after %qd ms (0x%x)",getName(), this, intf->GetInterfaceNumber(), intf, elapsedNS / 1000000, kr);
+					}
+					USBTrace(kUSBTEnumeration, kTPEnumerationRegisterInterfaces, (uintptr_t)this, (1 << 16) | intf->GetInterfaceNumber(), (uint32_t)(elapsedNS / 1000), kr);
+				}
+			}
+			IOFree(registerTimes, iteratorCount * sizeof(uint64_t));
+		}
+		
+		elapsed = mach_absolute_time() - barrierStart;
+		absolutetime_to_nanoseconds(*(AbsoluteTime *)&elapsed, &elapsedNS);
+		USBLog(5,"%s[%p]::RegisterInterfaces  %d interfaces registered in %qd us%s",getName(), this, iteratorCount, elapsedNS / 1000, parallel ? " (in parallel)" : "");
+		USBTrace_End(kUSBTEnumeration, kTPEnumerationRegisterInterfaces, (uintptr_t)this, (uint32_t)(elapsedNS / 1000), parallel, 0);
+		
 		iteratorArray->release();
 	}
 	else 
@@ -2983,6 +3473,11 @@ IOUSBDevice::_DeviceRequest(OSObject *target, void *arg0, void *arg1, __unused v
             {
                 me->_currentConfigValue = wValue;
             }
+            else if ( theRequest == kSetDescriptor )
+            {
+				// The device's descriptors just changed, don't hand the old ones to its next enumeration
+				DescriptorCacheInvalidateEntry(me->_DESCRIPTOR_CACHE_ENTRY);
+            }
         }
  		if ( err == kIOUSBTransactionTimeout )
 		{
@@ -3062,6 +3557,11 @@ IOUSBDevice::_DeviceRequestDesc(OSObject *target, void *arg0, void *arg1, __unus
  				USBLog(3, "%s[%p]:_DeviceRequestDesc kSetConfiguration to %d", me->getName(), me, wValue);
                 me->_currentConfigValue = wValue;
 			}
+            else if ( theRequest == kSetDescriptor )
+            {
+				// The device's descriptors just changed, don't hand the old ones to its next enumeration
+				DescriptorCacheInvalidateEntry(me->_DESCRIPTOR_CACHE_ENTRY);
+            }
         }
 		
 		if ( err == kIOUSBTransactionTimeout )
@@ -3935,6 +4435,11 @@ IOUSBDevice::_DeviceRequestWithTimeout(OSObject *target, void *arg0, void *arg1,
 				USBLog(6, "%s[%p]:_DeviceRequestWithTimeout kSetConfiguration to %d", me->getName(), me, wValue);
                 me->_currentConfigValue = wValue;
 			}
+            else if ( theRequest == kSetDescriptor )
+            {
+				// The device's descriptors just changed, don't hand the old ones to its next enumeration
+				DescriptorCacheInvalidateEntry(me->_DESCRIPTOR_CACHE_ENTRY);
+            }
         }
         return err;
     }
@@ -4012,6 +4517,11 @@ IOUSBDevice::_DeviceRequestDescWithTimeout(OSObject *target, void *arg0, void *a
 				USBLog(6, "%s[%p]:_DeviceRequestDescWithTimeout kSetConfiguration to %d", me->getName(), me, wValue);
                 me->_currentConfigValue = wValue;
             }
+            else if ( theRequest == kSetDescriptor )
+            {
+				// The device's descriptors just changed, don't hand the old ones to its next enumeration
+				DescriptorCacheInvalidateEntry(me->_DESCRIPTOR_CACHE_ENTRY);
+            }
         }
         return err;
     }
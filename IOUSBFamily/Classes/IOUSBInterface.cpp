@@ -37,10 +37,12 @@
 #include "../../IOUSBFamily/Headers/USB.h"
 #include "../../IOUSBFamily/Headers/IOUSBDevice.h"
 #include "../../IOUSBFamily/Headers/IOUSBController.h"
+#include "../../IOUSBFamily/Headers/IOUSBControllerV3.h"
 #include "../../IOUSBFamily/Headers/IOUSBInterface.h"
 #include "../../IOUSBFamily/Headers/IOUSBPipe.h"
 #include "../../IOUSBFamily/Headers/IOUSBPipeV2.h"
 #include "../../IOUSBFamily/Headers/IOUSBLog.h"
+#include "../../IOUSBFamily/Headers/USBDescriptorIndex.h"
 
 #include <IOKit/IOKitKeys.h>
 #include <IOKit/IOMessage.h>
@@ -1489,10 +1491,16 @@ const IOUSBDescriptorHeader *
 IOUSBInterface::FindNextAssociatedDescriptor(const void *current, UInt8 type)
 {
     const IOUSBDescriptorHeader *next;
+    const USBDescriptorIndex    *index;
 
     if (current == NULL)
         current = _interfaceDesc;
 
+    // The device keeps an index of each cached configuration descriptor, which answers this without a scan
+    index = _device ? _device->GetDescriptorIndex(_configDesc) : NULL;
+    if (index && USBDescriptorIndexFindNextAssociated(index, _configDesc, current, type, _bInterfaceNumber, &next))
+        return next;
+
     next = (const IOUSBDescriptorHeader *)current;
 
     while (true) 
@@ -2561,6 +2569,124 @@ IOUSBInterface::EnableRemoteWake(bool enable)
     return kIOReturnSuccess;
 }
 
+OSMetaClassDefineReservedUsed(IOUSBInterface,  10);
+IOReturn
+IOUSBInterface::GetBandwidthAvailableForAlternateSetting(UInt8 alternateSetting, UInt32 *pBandwidthAvailable)
+{
+    const IOUSBDescriptorHeader 	*next, *next2;
+    const IOUSBInterfaceDescriptor 	*ifdesc = NULL;
+    IOUSBEndpointDescriptor         *endp;
+	IOUSBEndpointProperties			endpoints[kUSBMaxPipes];
+	UInt32							numEndpoints = 0;
+	UInt32							replaceEndpointMask = 0;
+	IOUSBControllerV3				*controller;
+	IOReturn						ret;
+	
+	if (!pBandwidthAvailable)
+		return kIOReturnBadArgument;
+	
+	if (!_device || !_configDesc)
+		return kIOReturnNoDevice;
+	
+	controller = OSDynamicCast(IOUSBControllerV3, _device->GetBus());
+	if (!controller)
+		return kIOReturnUnsupported;
+	
+    next = (const IOUSBDescriptorHeader *)_configDesc;
+    while( (next = _device->FindNextDescriptor(next, kUSBInterfaceDesc)))
+    {
+        ifdesc = (const IOUSBInterfaceDescriptor *)next;
+        if ((ifdesc->bInterfaceNumber == _bInterfaceNumber) && (ifdesc->bAlternateSetting == alternateSetting))
+			break;
+		ifdesc = NULL;
+	}
+	
+	if (!ifdesc)
+	{
+		USBLog(3, "%s[%p]::GetBandwidthAvailableForAlternateSetting - no alternate setting %d", getName(), this, alternateSetting);
+		return kIOUSBInterfaceNotFound;
+	}
+	
+	next2 = next;
+	while ( (numEndpoints < kUSBMaxPipes) && (next2 = FindNextAssociatedDescriptor(next2, kUSBEndpointDesc)))
+	{
+		IOUSBEndpointProperties		*props = &endpoints[numEndpoints];
+		
+		endp = (IOUSBEndpointDescriptor*)next2;
+		props->bVersion = kUSBEndpointPropertiesVersion3;
+		props->bAlternateSetting = alternateSetting;
+		props->bEndpointNumber = endp->bEndpointAddress & kUSBPipeIDMask;
+		props->bDirection = (endp->bEndpointAddress & 0x80) ? kUSBIn : kUSBOut;
+		
+		if (GetEndpointPropertiesV3(props) == kIOReturnSuccess)
+			numEndpoints++;
+	}
+	
+	// the pipes of the current alternate setting are the ones which would go away
+	for (unsigned int i=0; i < kUSBMaxPipes; i++)
+	{
+		IOUSBPipe	*pipe = _pipeList[i];
+		
+		if (pipe)
+			replaceEndpointMask |= (1 << (pipe->GetEndpointNumber() + ((pipe->GetDirection() == kUSBIn) ? 16 : 0)));
+	}
+	
+	ret = controller->GetBandwidthAvailableForEndpoints(_device, replaceEndpointMask, endpoints, numEndpoints, pBandwidthAvailable);
+	
+	USBLog(5, "%s[%p]::GetBandwidthAvailableForAlternateSetting - alt %d (current %d) with %d endpoints - returning 0x%x, bandwidth %d", getName(), this, alternateSetting, _bAlternateSetting, (int)numEndpoints, ret, (int)*pBandwidthAvailable);
+	
+	return ret;
+}
+
+
+
+OSMetaClassDefineReservedUsed(IOUSBInterface,  11);
+IOReturn
+IOUSBInterface::FindHighestAlternateSettingThatFits(UInt8 *alternateSetting)
+{
+    const IOUSBDescriptorHeader 	*next;
+    const IOUSBInterfaceDescriptor 	*ifdesc;
+	UInt32							alternates[256 / 32];
+	UInt32							bandwidth;
+	IOReturn						ret = kIOReturnNoBandwidth;
+	
+	if (!alternateSetting)
+		return kIOReturnBadArgument;
+	
+	if (!_device || !_configDesc)
+		return kIOReturnNoDevice;
+	
+	bzero(alternates, sizeof(alternates));
+    next = (const IOUSBDescriptorHeader *)_configDesc;
+    while( (next = _device->FindNextDescriptor(next, kUSBInterfaceDesc)))
+    {
+        ifdesc = (const IOUSBInterfaceDescriptor *)next;
+        if (ifdesc->bInterfaceNumber == _bInterfaceNumber)
+			alternates[ifdesc->bAlternateSetting >> 5] |= (1 << (ifdesc->bAlternateSetting & 31));
+	}
+	
+	for (int alt = 255; alt >= 0; alt--)
+	{
+		if ((alternates[alt >> 5] & (1 << (alt & 31))) == 0)
+			continue;
+		
+		ret = GetBandwidthAvailableForAlternateSetting(alt, &bandwidth);
+		if (ret == kIOReturnSuccess)
+		{
+			*alternateSetting = alt;
+			break;
+		}
+		if (ret != kIOReturnNoBandwidth)
+			break;
+	}
+	
+	USBLog(5, "%s[%p]::FindHighestAlternateSettingThatFits - returning 0x%x, alt %d", getName(), this, ret, (ret == kIOReturnSuccess) ? *alternateSetting : -1);
+	
+	return ret;
+}
+
+
+
 void
 IOUSBInterface::joinPMtree (IOService *driver)
 {
@@ -2574,8 +2700,6 @@ OSMetaClassDefineReservedUsed(IOUSBInterface,  7);
 OSMetaClassDefineReservedUsed(IOUSBInterface,  8);
 OSMetaClassDefineReservedUsed(IOUSBInterface,  9);
 
-OSMetaClassDefineReservedUnused(IOUSBInterface,  10);
-OSMetaClassDefineReservedUnused(IOUSBInterface,  11);
 OSMetaClassDefineReservedUnused(IOUSBInterface,  12);
 OSMetaClassDefineReservedUnused(IOUSBInterface,  13);
 OSMetaClassDefineReservedUnused(IOUSBInterface,  14);
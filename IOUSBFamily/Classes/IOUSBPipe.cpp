@@ -1419,6 +1419,32 @@ IOUSBPipe::GetSyncType(void)
 
 
 
+IOReturn
+IOUSBPipe::SetBatchCompletion(IOUSBBatchCompletion * completion)
+{
+	USBLog(7,"IOUSBPipe[%p]::SetBatchCompletion(%p)", this, completion ? completion->action : NULL);
+	
+	return _controller->SetBatchCompletion(_address, &_endpoint, completion);
+}
+
+
+
+IOReturn
+IOUSBPipe::SetRealTimeIsochCompletion(bool enable)
+{
+    IOUSBControllerV2  *    controllerV2;
+	
+	USBLog(7,"IOUSBPipe[%p]::SetRealTimeIsochCompletion(%s)", this, enable ? "true" : "false");
+	
+    controllerV2 = OSDynamicCast(IOUSBControllerV2, _controller);
+	if ( (controllerV2 == NULL) || (_endpoint.transferType != kUSBIsoc) )
+		return kIOReturnUnsupported;
+	
+	return controllerV2->SetRealTimeIsochCompletion(_address, &_endpoint, enable);
+}
+
+
+
 #pragma mark Obsolete Methods
 bool 
 IOUSBPipe::InitToEndpoint(const IOUSBEndpointDescriptor *ed, UInt8 speed, USBDeviceAddress address, IOUSBController * controller)
@@ -1470,9 +1496,9 @@ OSMetaClassDefineReservedUsed(IOUSBPipe,  11);
 OSMetaClassDefineReservedUsed(IOUSBPipe,  12);
 OSMetaClassDefineReservedUsed(IOUSBPipe,  13);
 OSMetaClassDefineReservedUsed(IOUSBPipe,  14);
+OSMetaClassDefineReservedUsed(IOUSBPipe,  15);
+OSMetaClassDefineReservedUsed(IOUSBPipe,  16);
 
-OSMetaClassDefineReservedUnused(IOUSBPipe,  15);
-OSMetaClassDefineReservedUnused(IOUSBPipe,  16);
 OSMetaClassDefineReservedUnused(IOUSBPipe,  17);
 OSMetaClassDefineReservedUnused(IOUSBPipe,  18);
 OSMetaClassDefineReservedUnused(IOUSBPipe,  19);
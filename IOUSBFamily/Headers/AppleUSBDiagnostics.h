@@ -24,6 +24,7 @@
 #define _IOKIT_APPLEUSBDIAGNOSTICS_H
 
 #include <IOKit/IOService.h>
+#include <IOKit/usb/USB.h>
 
 #include "IOUSBLog.h"
 
@@ -36,7 +37,12 @@ public:
     enum{
         kDiagMaxPorts = 32,
         kXHCIMaxCompletionCodes = 256,
-        kXHCILinkStates = 16
+        kXHCILinkStates = 16,
+        kDiagMaxEndpoints = 64,
+        kDiagLatencyBuckets = 16,                           // bucket n counts latencies in [2^(n-1), 2^n) microseconds, the last one is open ended
+        kDiagThroughputSampleNanosec = 100000000,           // bytes/sec is sampled at most every 100ms
+        kDiagThroughputEWMAShift = 3,                       // each sample contributes 1/8th
+        kDiagEndpointClearing = 0x7FFFFFFF                  // key of an entry EndpointRemoved() is emptying, never matches a real key
     };
     typedef struct
     {
@@ -59,6 +65,22 @@ public:
         UInt32			remoteWakeMask;
     } UIMPortDiagnostics;
     
+    // Per-endpoint statistics, only kept while kUSBEnableEndpointStatisticsMask is set.  The UIMs update these
+    // from their completion paths without taking a lock, see EndpointSubmitted()/EndpointCompleted().
+    typedef struct
+    {
+        volatile UInt64     completions;
+        volatile UInt64     shortPackets;
+        volatile UInt64     bytes;
+        volatile UInt64     sampleNanosec;                  // time of the last bytes/sec sample
+        volatile UInt64     sampleBytes;                    // bytes at sampleNanosec
+        volatile UInt64     bytesPerSec;                    // EWMA of the sampled rate
+        volatile UInt32     key;                            // 0x80000000 | address << 16 | endpoint << 8 | direction, 0 while free, kDiagEndpointClearing while being freed
+        volatile SInt32     inFlight;
+        volatile UInt32     inFlightHighWater;
+        volatile UInt32     latency[kDiagLatencyBuckets];   // submit to complete
+    } UIMEndpointDiagnostics;
+    
     typedef struct
     {
         UInt64			lastNanosec;
@@ -81,6 +103,8 @@ public:
         SInt32          numPorts;
         UIMPortDiagnostics portCounts[kDiagMaxPorts];
         UInt32          overFlowPortErrorCount;
+        UInt32          overFlowEndpointCount;
+        UIMEndpointDiagnostics *endpoints;                  // kDiagMaxEndpoints entries, see AllocateEndpoints()
     } UIMDiagnostics;
     
 private:
@@ -95,10 +119,26 @@ public:
 	virtual bool			serialize( OSSerialize * s ) const;
     virtual void            serializePort(OSDictionary *	dictionary, int port, UIMPortDiagnostics *counts, IOService *controller) const;
 	
+	// The UIM allocates the endpoint table after createDiagnostics() and frees it in UIMFinalize().
+	static void				AllocateEndpoints( UIMDiagnostics *diagnostics );
+	static void				FreeEndpoints( UIMDiagnostics *diagnostics );
+	
+	// Called by the UIMs when a transfer is queued to the hardware and when its completion is called.  submitTime
+	// is the mach_absolute_time() the transfer was queued.  Both return immediately if endpoint statistics are off.
+	// EndpointRemoved() is called when the UIM deletes the endpoint, so that its entry can be reused and a device
+	// that later gets the same address starts from zero.
+	static void				EndpointSubmitted( UIMEndpointDiagnostics *table, UInt32 *overflow, USBDeviceAddress address, UInt8 endpoint, UInt8 direction );
+	static void				EndpointCompleted( UIMEndpointDiagnostics *table, UInt32 *overflow, USBDeviceAddress address, UInt8 endpoint, UInt8 direction,
+											   UInt64 submitTime, UInt32 requested, UInt32 actual, IOReturn status );
+	static void				EndpointRemoved( UIMEndpointDiagnostics *table, USBDeviceAddress address, UInt8 endpoint, UInt8 direction );
+	static void				serializeEndpoints( OSDictionary * dictionary, UIMEndpointDiagnostics *table, UInt32 overflow );
+	
 protected:
 	
 	virtual void			UpdateNumberEntry( OSDictionary * dictionary, UInt32 value, const char * name ) const;
 	
+	static UIMEndpointDiagnostics *	FindEndpoint( UIMEndpointDiagnostics *table, UInt32 *overflow, USBDeviceAddress address, UInt8 endpoint, UInt8 direction, bool create = true );
+	
 };
 
 #endif
\ No newline at end of file
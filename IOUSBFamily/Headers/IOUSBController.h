@@ -199,6 +199,8 @@ class IOUSBRootHubDevice;
 class IOMemoryDescriptor;
 class AppleUSBHubPort;
 
+struct IOUSBCompletionBatch;
+
 //================================================================================================
 //
 //   IOUSBController Class
@@ -261,6 +263,9 @@ protected:
         bool                _usePCIBusNumber;                   // T if we should use the PCI bus number in the calculations for USB Bus number
         UInt32              _acpiRootHubDepth;                  // depth of the root hub in the ACPI device tree, this value is either hard coded or set to
         bool                _onThunderbolt;						// T if this controller is on a Thunderbolt bus
+        IOUSBCompletionBatch	*_completionBatches;			// pipes which want their completions batched
+        IOUSBCompletionBatch	*_pendingCompletionBatches;		// batches holding completions until EndCompletionBatch
+        UInt32				_completionBatchDepth;				// BeginCompletionBatch calls without an EndCompletionBatch
     };
     ExpansionData *_expansionData;
 	
@@ -322,6 +327,12 @@ protected:
                                             void *	arg1, 
                                             void *	arg2, 
                                             void *	arg3 );
+    static IOReturn 		DoSetBatchCompletion( 
+                                            OSObject *	owner, 
+                                            void *	arg0, 
+                                            void *	arg1, 
+                                            void *	arg2, 
+                                            void *	arg3 );
                                             
     static IOReturn 		DoIOTransfer( 
                                             OSObject *	owner, 
@@ -759,6 +770,18 @@ public:
     virtual IOReturn 		ClosePipe(	USBDeviceAddress 	address,
                                         Endpoint *			endpoint );
 
+    /*!
+        @function SetBatchCompletion
+        Deliver the completions of asynchronous bulk or interrupt I/O on an endpoint through one call per interrupt pass.
+        The endpoint's batch completion goes away when the pipe is closed.
+        @param address Address of the device on the USB bus
+        @param endpoint description of endpoint
+        @param completion action to call with the completed transfers, or NULL to go back to calling each transfer's completion
+    */
+    IOReturn				SetBatchCompletion(	USBDeviceAddress		address,
+												Endpoint *				endpoint,
+												IOUSBBatchCompletion *	completion );
+
     // Controlling pipe state
     /*!
         @function abortPipe
@@ -1145,6 +1168,15 @@ public:
 protected:
     void							IncreaseIsocCommandPool();
     void							IncreaseCommandPool();
+	
+	// UIMs bracket their interrupt handling with these so that batched completions go out once per pass
+	void							BeginCompletionBatch();
+	void							EndCompletionBatch();
+	IOUSBCompletionBatch *			FindCompletionBatch(USBDeviceAddress address, UInt8 endpoint, UInt8 direction);
+	void							QueueBatchedCompletion(IOUSBCompletionBatch *batch, IOUSBCompletion completion, IOReturn status, UInt32 bufferSizeRemaining);
+	void							DeliverCompletionBatch(IOUSBCompletionBatch *batch);
+	void							RemoveCompletionBatch(USBDeviceAddress address, UInt8 endpoint, UInt8 direction);
+	void							FreeCompletionBatches();
     void							ParsePCILocation(const char *str, int *deviceNum, int *functionNum);
     int								ValueOfHexDigit(char c);
 	
@@ -58,6 +58,7 @@ public:
 
 class IOUSBControllerV2;										// needed for a parameter
 class IOUSBControllerIsochEndpoint;
+struct IOUSBIsochJitterEntry;
 
 class IOUSBControllerIsochListElement : public IOUSBControllerListElement
 {
@@ -118,6 +119,10 @@ public:
 	UInt32								interval;					// this is the decoded interval value for HS endpoints and is 1 for FS endpoints
     UInt8								direction;
 	bool								aborting;
+	bool								realTimeCompletion;			// completions are returned on the controller's real time thread
+	IOUSBIsochJitterEntry				*realTimeJitter;			// where that thread records completion jitter, NULL if the table is full
+	IOUSBControllerIsochEndpoint		*realTimeNext;				// linkage on the real time completion queue
+	volatile UInt32						realTimeQueued;				// 1 while on that queue - not reset by init()
 };
 #endif /* KERNEL */
 
@@ -40,6 +40,8 @@
 #define kLowLatencyUSB64bitPhysicalMask						0xFFFFFFFFFFFFF000ULL		// 64 bit memory aligned on a 4K boundary
 
 #ifdef KERNEL
+class IOUSBIsochJitterStatistics;
+
 /*!
     @class IOUSBControllerV2
     @abstract subclass of the IOUSBController to provide support for high speed 
@@ -71,6 +73,11 @@ protected:
 		IOUSBControllerIsochEndpoint				*_isochEPList;						// linked list of active Isoch "endpoints"
 		IOUSBControllerIsochEndpoint				*_freeIsochEPList;					// linked list of freed Isoch EP data structures
 		thread_call_t								_returnIsochDoneQueueThread;
+		thread_t									_realTimeIsochThread;				// returns completions of endpoints which asked for real time completions
+		IOUSBControllerIsochEndpoint * volatile		_realTimeIsochQueue;				// lock free LIFO of endpoints with completions for that thread
+		volatile bool								_realTimeIsochThreadRunning;
+		volatile bool								_realTimeIsochTerminate;
+		IOUSBIsochJitterStatistics					*_realTimeIsochJitter;				// published as the "Isochronous Completion Jitter" property
 	};
     V2ExpansionData *_v2ExpansionData;
 
@@ -92,9 +99,15 @@ protected:
 	#define _isochEPList						_v2ExpansionData->_isochEPList
 	#define _freeIsochEPList					_v2ExpansionData->_freeIsochEPList
 	#define _returnIsochDoneQueueThread			_v2ExpansionData->_returnIsochDoneQueueThread
+	#define _realTimeIsochThread				_v2ExpansionData->_realTimeIsochThread
+	#define _realTimeIsochQueue					_v2ExpansionData->_realTimeIsochQueue
+	#define _realTimeIsochThreadRunning			_v2ExpansionData->_realTimeIsochThreadRunning
+	#define _realTimeIsochTerminate				_v2ExpansionData->_realTimeIsochTerminate
+	#define _realTimeIsochJitter				_v2ExpansionData->_realTimeIsochJitter
 	
     virtual bool 		init( OSDictionary *  propTable );
     virtual bool 		start( IOService *  provider );
+    virtual void 		stop( IOService * provider );
     virtual void		free();
 
     static IOReturn  DoCreateEP(OSObject *owner,
@@ -112,6 +125,15 @@ protected:
                               USBDeviceAddress hubAddress,
                               int port);
 
+    static IOReturn		DoSetRealTimeIsochCompletion(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+    static void			RealTimeIsochThread(void *arg, wait_result_t waitResult);
+    IOReturn			StartRealTimeIsochThread(void);
+    void				StopRealTimeIsochThread(void);
+	
+	// Hands the endpoint's done queue to the real time thread.  Returns false if the endpoint's client didn't ask for
+	// real time completions, in which case the caller returns the done queue the usual way.
+    bool				QueueRealTimeIsochCompletion(IOUSBControllerIsochEndpoint *pEP);
+
 public:
 
        /*!
@@ -445,7 +467,21 @@ public:
                               USBDeviceAddress hubAddress,
                               int port);
     
-	OSMetaClassDeclareReservedUnused(IOUSBControllerV2,  27);
+	OSMetaClassDeclareReservedUsed(IOUSBControllerV2,  27);
+	/*!
+	 @function SetRealTimeIsochCompletion
+	 Asks for the completions of an Isochronous endpoint to be called on a time constraint thread owned by the controller
+	 instead of the thread call which is normally used. This is meant for low latency clients with 1ms service intervals,
+	 e.g. audio, which can't afford the scheduling jitter of the thread call. The time from the hardware completing the
+	 last frame of a low latency request to its completion being called is kept in a histogram per endpoint, which is
+	 published in the controller's "Isochronous Completion Jitter" property.
+	 @param address Address of the device on the USB bus
+	 @param endpoint description of the Isochronous endpoint
+	 @param enable true to use the real time thread, false to go back to the thread call
+	 @result kIOReturnNotFound if there is no such Isochronous endpoint
+	 */
+	virtual IOReturn		SetRealTimeIsochCompletion(USBDeviceAddress address, Endpoint *endpoint, bool enable);
+	
     OSMetaClassDeclareReservedUnused(IOUSBControllerV2,  28);
     OSMetaClassDeclareReservedUnused(IOUSBControllerV2,  29);
     
@@ -188,6 +188,10 @@ class IOUSBControllerV3 : public IOUSBControllerV2
 			bool								_pciPauseTransactionToken[kMaxTransactionsDuringPCIPause];	// Token use to sleep/wake threads that come in during PCI Pause
             bool                                _controllerWasResetOnSleep;
             IOUSBHubExitLatencies               _latencies[1];                          // Latencies
+            bool                                _rootHubChangeInterrupts;               // T if the UIM calls RootHubStatusChangeInterrupt, so the root hub timer is only a safety net
+            bool                                _rootHubChangePending;                  // T if a change was reported while a root hub had no interrupt read queued
+            UInt64                              _rootHubTimerArmedTime;                 // when the root hub timer was armed (absolute time), 0 if it isn't
+            UInt64                              _rootHubTimerWakeupsSaved;              // kUSBRootHubPollingRate timer firings that didn't happen because of _rootHubChangeInterrupts
 		};
 		V3ExpansionData *_v3ExpansionData;
     
@@ -566,7 +570,20 @@ public:
 	OSMetaClassDeclareReservedUsed(IOUSBControllerV3,  24);
     virtual IOReturn                GetRootHubPowerExitLatencies(IOUSBHubExitLatencies **latencies);
     
-	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  25);
+	OSMetaClassDeclareReservedUsed(IOUSBControllerV3,  25);
+    /* !
+     @function GetBandwidthAvailableForEndpoints
+     @abstract returns the bandwidth (in bytes) that would be left for a device if some of its periodic endpoints were replaced by others, without changing the schedule
+     @param forDevice The device whose endpoints would be replaced
+     @param replaceEndpointMask The endpoints of the device which would go away.  Bit n is OUT endpoint n and bit (16 + n) is IN endpoint n
+     @param endpoints The endpoints which would be created in their place, as returned by IOUSBInterface::GetEndpointPropertiesV3.  Non periodic endpoints are ignored
+     @param numEndpoints The number of entries in endpoints
+     @param pBandwidthAvailable Pointer to the holder for the bandwidth which would be left
+     @result kIOReturnNoBandwidth if the endpoints would not fit, kIOReturnUnsupported if the controller can't tell
+     */
+    virtual IOReturn                GetBandwidthAvailableForEndpoints(IOUSBDevice *forDevice, UInt32 replaceEndpointMask, IOUSBEndpointProperties *endpoints, UInt32 numEndpoints, UInt32 *pBandwidthAvailable);
+    
+
 	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  26);
 	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  27);
 	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  28);
@@ -587,6 +604,15 @@ protected:
 		IOReturn	RHQueueTransaction(IOMemoryDescriptor *buf, UInt32 bufLen, IOUSBCompletion completion, IOUSBRootHubInterruptTransactionPtr outstandingRHXaction);
 		void		RHCompleteTransaction(IOUSBRootHubInterruptTransactionPtr outstandingRHTransPtr, UInt16	rhStatusChangedBitmap, UInt16 numPorts, bool cancelTimer);
 		void		RHAbortTransaction(IOUSBRootHubInterruptTransactionPtr outstandingRHXaction);
+		void		RHCountSavedTimerWakeups(bool fired);
+	
+		// for UIMs which get an interrupt for root hub port changes.  Once enabled, the root hub timer fires every
+		// kUSBRootHubSafetyPollingRate ms instead of every kUSBRootHubPollingRate, and the UIM calls RootHubStatusChangeInterrupt
+		// from its secondary interrupt handler (on the workloop) whenever the controller reports a port change.  Change bits
+		// the UIM sets itself, which raise no interrupt, are reported with RootHubSoftwareStatusChange
+		void		RootHubEnableChangeInterrupts(bool enable);
+		void		RootHubStatusChangeInterrupt(void);
+		void		RootHubSoftwareStatusChange(void);
 		void		PMEHandler(IOInterruptEventSource * source, int count);
 };
 
@@ -52,6 +52,16 @@
 #define kAllowConfigValueOfZero		"kAllowZeroConfigValue"
 #define kAllowNumConfigsOfZero		"kAllowZeroNumConfigs"
 
+// This property keeps the configuration and string descriptors of a device out of the descriptor cache, so that
+// they are always read from the device when it is re-enumerated.  The property should be a Boolean
+//
+#define kUSBDontCacheDescriptors	"kUSBDontCacheDescriptors"
+
+// This property lets the interfaces of a device be matched at the same time instead of one after the other.  SetConfiguration
+// still doesn't return until every interface has been matched and its drivers started.  The property should be a Boolean
+//
+#define kUSBParallelInterfaceMatching	"kUSBParallelInterfaceMatching"
+
 #ifdef KERNEL
 class IOUSBController;
 class IOUSBControllerV2;
@@ -142,10 +152,13 @@ protected:
         IOService *             _interfacePowerParent;                // default parent for joinPMTree for interface drivers
         bool                    _loadingDriverAfterReEnumerate;
         bool                    _hasMSCInterface;                   // True if any of the IOUSBInterfaces are mass storage class
+        struct USBDescriptorIndex **	_configDescriptorIndexes;		// one per _configList entry, built when the config descriptor is cached
+        OSDictionary *			_descriptorCacheEntry;				// this device's entry in the descriptor cache, NULL if not cached
     };
     ExpansionData * _expansionData;
 
     const IOUSBConfigurationDescriptor *FindConfig(UInt8 configValue, UInt8 *configIndex=0);
+    const struct USBDescriptorIndex *GetDescriptorIndex(const void *configDesc);
 
     virtual IOUSBInterface * GetInterface(const IOUSBInterfaceDescriptor *interface);
 
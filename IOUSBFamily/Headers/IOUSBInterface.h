@@ -350,9 +350,28 @@ public:
 	 */
     virtual IOReturn    EnableRemoteWake(bool enable);
 
-    
-    OSMetaClassDeclareReservedUnused(IOUSBInterface,  10);
-    OSMetaClassDeclareReservedUnused(IOUSBInterface,  11);
+    OSMetaClassDeclareReservedUsed(IOUSBInterface,  10);
+    /*!
+	 @function GetBandwidthAvailableForAlternateSetting
+	 @abstract Returns the periodic bandwidth that would be left if the interface were switched to an alternate setting, without switching it.
+	 @discussion The endpoints of the current alternate setting are taken out of the controller's schedule and the interrupt and isoch endpoints
+	 of alternateSetting (see GetEndpointPropertiesV3) are put in their place.  The bandwidth is in bytes, as returned by the user client's GetBandwidthAvailable.
+	 @param alternateSetting The alternate setting to check.
+	 @param pBandwidthAvailable Pointer to a UInt32 which will hold the bandwidth that would be left.
+	 @result returns kIOReturnSuccess if the alternate setting would fit, kIOReturnNoBandwidth if it would not, and kIOReturnUnsupported if the controller can't tell.
+	 */
+    virtual IOReturn    GetBandwidthAvailableForAlternateSetting(UInt8 alternateSetting, UInt32 *pBandwidthAvailable);
+
+    OSMetaClassDeclareReservedUsed(IOUSBInterface,  11);
+    /*!
+	 @function FindHighestAlternateSettingThatFits
+	 @abstract Finds the highest numbered alternate setting of the interface whose endpoints would fit in the available periodic bandwidth.
+	 @discussion Audio and video class drivers order their alternate settings by bandwidth, so this is the one to pass to SetAlternateInterface.
+	 @param alternateSetting Pointer to a UInt8 which will hold the alternate setting.
+	 @result returns kIOReturnSuccess if one was found, kIOReturnNoBandwidth if none of them fit, and kIOReturnUnsupported if the controller can't tell.
+	 */
+    virtual IOReturn    FindHighestAlternateSettingThatFits(UInt8 *alternateSetting);
+
     OSMetaClassDeclareReservedUnused(IOUSBInterface,  12);
     OSMetaClassDeclareReservedUnused(IOUSBInterface,  13);
     OSMetaClassDeclareReservedUnused(IOUSBInterface,  14);
@@ -391,8 +391,31 @@ public:
     OSMetaClassDeclareReservedUsed(IOUSBPipe,  14);
 	virtual UInt8	GetSyncType(void);
 	
-    OSMetaClassDeclareReservedUnused(IOUSBPipe,  15);
-    OSMetaClassDeclareReservedUnused(IOUSBPipe,  16);
+    OSMetaClassDeclareReservedUsed(IOUSBPipe,  15);
+    /*!
+     @function SetBatchCompletion
+     Asks for the completions of asynchronous I/O on a bulk or interrupt pipe to be delivered together. Transfers which complete
+     during one pass of the controller's interrupt handler are reported with a single call to the action, in the order they completed,
+     which lets a driver take its locks and requeue its buffers once per pass. The action of each transfer's IOUSBCompletion is not
+     called while this is set; its target and parameter are reported in the entries instead. Errors are delivered right away.
+     Synchronous I/O and I/O with a time stamp completion are not affected.
+     @param completion describes the action to call with the completed transfers, or NULL to go back to per transfer completions.
+     @result kIOReturnUnsupported if this is not a bulk or interrupt pipe.
+     */
+	virtual IOReturn SetBatchCompletion(IOUSBBatchCompletion * completion);
+	
+    OSMetaClassDeclareReservedUsed(IOUSBPipe,  16);
+    /*!
+     @function SetRealTimeIsochCompletion
+     Asks for the completions of an Isochronous pipe to be called on a time constraint thread owned by the controller, instead of
+     the thread call which is normally used, to cut the jitter of low latency I/O with 1ms service intervals. The completion may be
+     called at any time on that thread, so it must not block. How long after the hardware finishes a low latency request its
+     completion is called is published per endpoint in the controller's "Isochronous Completion Jitter" property.
+     @param enable true to use the real time thread, false to go back to the thread call.
+     @result kIOReturnUnsupported if this is not an Isochronous pipe or the controller doesn't support it.
+     */
+	virtual IOReturn SetRealTimeIsochCompletion(bool enable);
+	
     OSMetaClassDeclareReservedUnused(IOUSBPipe,  17);
 	OSMetaClassDeclareReservedUnused(IOUSBPipe,  18);
     OSMetaClassDeclareReservedUnused(IOUSBPipe,  19);
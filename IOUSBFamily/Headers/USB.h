@@ -385,6 +385,44 @@ typedef struct IOUSBLowLatencyIsocCompletion {
     IOUSBLowLatencyIsocCompletionAction	action;
     void *				parameter;
 } IOUSBLowLatencyIsocCompletion;
+
+/*!
+    @typedef IOUSBBatchCompletionEntry
+    @discussion One completed transfer reported to an IOUSBBatchCompletionAction.
+    @param target The target from the IOUSBCompletion the transfer was queued with.
+    @param parameter The parameter from the IOUSBCompletion the transfer was queued with.
+    @param status Completion status.
+    @param bufferSizeRemaining Bytes left to be transferred.
+*/
+typedef struct IOUSBBatchCompletionEntry {
+    void *			target;
+    void *			parameter;
+    IOReturn			status;
+    UInt32			bufferSizeRemaining;
+} IOUSBBatchCompletionEntry;
+
+/*!
+    @typedef IOUSBBatchCompletionAction
+    @discussion Function called with the transfers on a pipe which completed during one pass of the controller's interrupt handler, in the order they completed.
+    @param target The target specified in the IOUSBBatchCompletion struct.
+    @param entries The completed transfers.  The array is only valid during the call.
+    @param count Number of entries, at least 1.
+*/
+typedef void (*IOUSBBatchCompletionAction)(
+                void *				target,
+                IOUSBBatchCompletionEntry	*entries,
+                UInt32				count);
+
+/*!
+    @typedef IOUSBBatchCompletion
+    @discussion Struct specifying action to perform when bulk or interrupt I/O on a pipe completes.  See IOUSBPipe::SetBatchCompletion.
+    @param target The target to pass to the action function.
+    @param action The function to call.
+*/
+typedef struct IOUSBBatchCompletion {
+    void * 			target;
+    IOUSBBatchCompletionAction	action;
+} IOUSBBatchCompletion;
 #endif
 
 /*!
@@ -1277,15 +1315,18 @@ enum {
  @constant	kUSBReEnumerateCaptureDeviceBit	Setting this bit will terminate any drivers attached to an IOUSBInterface for the device and to the IOUSBDevice itself.  It will not terminate
  any drivers attached to a Mass Storage Class IOUSBInterface.  A client needs to have the appropriate permissions in order to specify this bit.  See IOUSBLib.h
  @constant	kUSBReEnumerateReleaseDeviceBit	Setting this bit will return return any device that was captured back to the OS.  The driver for the IOUSBDevice will be loaded.  A client needs to have the appropriate permissions in order to specify this bit.  See IOUSBLib.h
+ @constant	kUSBReEnumerateRereadDescriptorsBit	Setting this bit will discard the descriptors cached for the device, so that they are read from the device again after the re-enumeration.  Use it when the device may have changed without changing its device descriptor or serial number.
  */
 #ifdef KERNEL
 typedef enum {
     kUSBAddExtraResetTimeBit            = 31,
     kUSBReEnumerateCaptureDeviceBit     = 30,
     kUSBReEnumerateReleaseDeviceBit     = 29,
+    kUSBReEnumerateRereadDescriptorsBit = 28,
     kUSBAddExtraResetTimeMask           = ( 1 << kUSBAddExtraResetTimeBit),
     kUSBReEnumerateCaptureDeviceMask    = ( 1 << kUSBReEnumerateCaptureDeviceBit),
-    kUSBReEnumerateReleaseDeviceMask    = ( 1 << kUSBReEnumerateReleaseDeviceBit)
+    kUSBReEnumerateReleaseDeviceMask    = ( 1 << kUSBReEnumerateReleaseDeviceBit),
+    kUSBReEnumerateRereadDescriptorsMask = ( 1 << kUSBReEnumerateRereadDescriptorsBit)
 } USBReEnumerateOptions;
 #endif
 
@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _USBDESCRIPTORCACHE_H
+#define _USBDESCRIPTORCACHE_H
+
+#include "USB.h"
+
+//================================================================================================
+//
+//	Descriptor cache keys and policy
+//
+//	The rules IOUSBDevice uses for its descriptor cache, kept apart from the OSDictionary the
+//	entries live in so they can be tested in user space.  An entry is keyed by the locationID,
+//	VID, PID and bcdDevice of the device.  The locationID alone tells two identical devices apart,
+//	so devices without a serial number are cached too, with an empty serial.  A device reuses the
+//	entry at its key only when its device descriptor and serial number match the cached ones,
+//	otherwise the entry is replaced.  When an entry has to be added to a full cache the whole
+//	cache is flushed rather than aged.
+//
+//================================================================================================
+
+enum
+{
+	kUSBDescriptorCacheMaxEntries	= 64,
+	kUSBDescriptorCacheKeySize		= 32
+};
+
+// key must have room for kUSBDescriptorCacheKeySize characters
+static inline void
+USBDescriptorCacheMakeKey(char *key, UInt32 locationID, const IOUSBDeviceDescriptor *desc)
+{
+	snprintf(key, kUSBDescriptorCacheKeySize, "%08x-%04x-%04x-%04x", (uint32_t)locationID, USBToHostWord(desc->idVendor), USBToHostWord(desc->idProduct), USBToHostWord(desc->bcdDevice));
+}
+
+// Whether a device can use the cache at all.  Root hubs aren't below a hub and are never re-enumerated.  A device which
+// has a serial number string we couldn't read can't be compared with what was cached, one without any is compared with "".
+static inline bool
+USBDescriptorCacheUsable(bool belowHub, bool dontCache, UInt8 iSerialNumber, bool serialRead)
+{
+	return belowHub && !dontCache && ((iSerialNumber == 0) || serialRead);
+}
+
+// Whether the cached device descriptor and serial number are those of the device now at the entry's location
+static inline bool
+USBDescriptorCacheEntryMatches(const void *cachedDevice, UInt32 cachedDeviceLength, const char *cachedSerial, const IOUSBDeviceDescriptor *desc, const char *serial)
+{
+	if ( !cachedDevice || (cachedDeviceLength != sizeof(IOUSBDeviceDescriptor)) || !cachedSerial || !serial )
+		return false;
+
+	return (memcmp(cachedDevice, desc, sizeof(IOUSBDeviceDescriptor)) == 0) && (strcmp(cachedSerial, serial) == 0);
+}
+
+// Whether the cache, holding count entries, must be flushed before another one is added
+static inline bool
+USBDescriptorCacheMustFlush(UInt32 count)
+{
+	return count >= kUSBDescriptorCacheMaxEntries;
+}
+
+#endif /* _USBDESCRIPTORCACHE_H */
@@ -0,0 +1,354 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _USBDESCRIPTORINDEX_H
+#define _USBDESCRIPTORINDEX_H
+
+#include "USB.h"
+
+//================================================================================================
+//
+//	Configuration descriptor index
+//
+//	Built once per cached configuration descriptor (IOUSBDevice::GetFullConfigurationDescriptor
+//	in the kernel, IOUSBInterfaceClass::CacheConfigDescriptor in IOUSBLib) so that the
+//	FindNextDescriptor()/FindNextAssociatedDescriptor() style walks don't have to rescan the
+//	configuration one descriptor at a time on every call.  Every descriptor gets an entry
+//	holding its offset, the next descriptor of the same type and the next interface or
+//	interface association descriptor, and the entries of each type are also kept in a sorted
+//	list so the next descriptor of any type can be found with a binary search.
+//
+//	The index walks the configuration exactly the way NextDescriptor() does, so lookups return
+//	the same descriptors the linear scans would.  The lookup routines return false when the
+//	starting descriptor isn't one the index knows about and the caller should fall back to
+//	scanning.  Everything is inline so the kernel and the user client library share it.
+//
+//================================================================================================
+
+typedef struct USBDescriptorIndexEntry
+{
+	UInt16		offset;				// from the start of the configuration descriptor
+	UInt8		type;
+	UInt8		reserved;
+	UInt16		nextOfType;			// entry of the next descriptor with the same bDescriptorType, or count
+	UInt16		nextBoundary;		// entry of the next interface or IAD, or count
+} USBDescriptorIndexEntry;
+
+typedef struct USBDescriptorIndexType
+{
+	UInt8		type;
+	UInt8		reserved;
+	UInt16		first;				// into byType[]
+	UInt16		count;
+} USBDescriptorIndexType;
+
+typedef struct USBDescriptorIndex
+{
+	UInt32						size;			// of the whole allocation
+	UInt16						length;			// of the configuration that was indexed
+	UInt16						count;
+	UInt16						typeCount;
+	volatile UInt16				hint;			// entry the last lookup returned, where the next one usually starts
+	USBDescriptorIndexEntry *	entries;
+	USBDescriptorIndexType *	types;
+	UInt16 *					byType;			// entry numbers grouped by type, in configuration order
+} USBDescriptorIndex;
+
+// Returns the number of bytes needed to index the configuration, 0 if it is unusable
+static inline UInt32
+USBDescriptorIndexSize(const void *config, UInt32 length, UInt16 *countOut, UInt16 *typeCountOut)
+{
+	const UInt8 *	bytes = (const UInt8 *)config;
+	UInt32			seen[256 / 32];
+	UInt32			offset = 0;
+	UInt32			count = 0;
+	UInt32			typeCount = 0;
+
+	if ( !config || (length < sizeof(IOUSBDescriptorHeader)) )
+		return 0;
+
+	if ( length > 0xFFFF )
+		length = 0xFFFF;
+
+	bzero(seen, sizeof(seen));
+	while ( (offset + sizeof(IOUSBDescriptorHeader)) <= length )
+	{
+		UInt8	type = bytes[offset + 1];
+
+		if ( (seen[type >> 5] & (1 << (type & 31))) == 0 )
+		{
+			seen[type >> 5] |= (1 << (type & 31));
+			typeCount++;
+		}
+		count++;
+
+		if ( bytes[offset] == 0 )
+			break;
+		offset += bytes[offset];
+	}
+
+	*countOut = (UInt16)count;
+	*typeCountOut = (UInt16)typeCount;
+
+	return (UInt32)(sizeof(USBDescriptorIndex) + (count * sizeof(USBDescriptorIndexEntry)) + (typeCount * sizeof(USBDescriptorIndexType)) + (count * sizeof(UInt16)));
+}
+
+// index must be USBDescriptorIndexSize() bytes, count and typeCount are the values it returned
+static inline void
+USBDescriptorIndexBuild(USBDescriptorIndex *index, UInt32 size, const void *config, UInt32 length, UInt16 count, UInt16 typeCount)
+{
+	const UInt8 *	bytes = (const UInt8 *)config;
+	UInt16			nextOfType[256];
+	UInt16			boundary = count;
+	UInt32			offset = 0;
+	UInt32			i;
+	UInt32			slot;
+
+	index->size = size;
+	index->length = (UInt16)(length > 0xFFFF ? 0xFFFF : length);
+	index->count = count;
+	index->typeCount = typeCount;
+	index->hint = 0;
+	index->entries = (USBDescriptorIndexEntry *)(index + 1);
+	index->types = (USBDescriptorIndexType *)(index->entries + count);
+	index->byType = (UInt16 *)(index->types + typeCount);
+
+	for ( i = 0; i < count; i++ )
+	{
+		index->entries[i].offset = (UInt16)offset;
+		index->entries[i].type = bytes[offset + 1];
+		index->entries[i].reserved = 0;
+		offset += bytes[offset];
+	}
+
+	// Chain each descriptor to the next one of its type and to the next interface boundary
+	for ( i = 0; i < 256; i++ )
+		nextOfType[i] = count;
+
+	i = count;
+	while ( i-- > 0 )
+	{
+		USBDescriptorIndexEntry *	entry = &index->entries[i];
+
+		entry->nextOfType = nextOfType[entry->type];
+		nextOfType[entry->type] = (UInt16)i;
+		entry->nextBoundary = boundary;
+		if ( (entry->type == kUSBInterfaceDesc) || (entry->type == kUSBInterfaceAssociationDesc) )
+			boundary = (UInt16)i;
+	}
+
+	// nextOfType[] now holds the first entry of each type, so walking the chains fills byType[]
+	for ( i = 0, slot = 0; (i < 256) && (slot < typeCount); i++ )
+	{
+		UInt16	entry;
+		UInt16	first = (slot == 0) ? 0 : (UInt16)(index->types[slot - 1].first + index->types[slot - 1].count);
+
+		if ( nextOfType[i] == count )
+			continue;
+
+		index->types[slot].type = (UInt8)i;
+		index->types[slot].reserved = 0;
+		index->types[slot].first = first;
+		index->types[slot].count = 0;
+		for ( entry = nextOfType[i]; entry < count; entry = index->entries[entry].nextOfType )
+			index->byType[first + index->types[slot].count++] = entry;
+		slot++;
+	}
+}
+
+// Entry number of the descriptor at desc, or -1 if it isn't the start of an indexed descriptor
+static inline SInt32
+USBDescriptorIndexLookup(const USBDescriptorIndex *index, const void *config, const void *desc)
+{
+	UInt32		offset;
+	UInt32		hint = index->hint;
+	UInt32		low = 0;
+	UInt32		high = index->count;
+
+	if ( (desc < config) || (((uintptr_t)desc - (uintptr_t)config) >= index->length) )
+		return -1;
+
+	// Walks pass back what the last lookup returned, so check that before searching.  The hint is only ever a guess,
+	// so it doesn't matter if two callers race to set it.
+	offset = (UInt32)((uintptr_t)desc - (uintptr_t)config);
+	if ( (hint < index->count) && (index->entries[hint].offset == offset) )
+		return (SInt32)hint;
+
+	while ( low < high )
+	{
+		UInt32	middle = (low + high) / 2;
+
+		if ( index->entries[middle].offset < offset )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if ( (low < index->count) && (index->entries[low].offset == offset) )
+		return (SInt32)low;
+
+	return -1;
+}
+
+// First entry after entry with bDescriptorType == type, or count
+static inline UInt32
+USBDescriptorIndexNextOfType(const USBDescriptorIndex *index, UInt32 entry, UInt8 type)
+{
+	UInt32		slot;
+
+	if ( type == kUSBAnyDesc )
+		return entry + 1;
+
+	if ( index->entries[entry].type == type )
+		return index->entries[entry].nextOfType;
+
+	for ( slot = 0; slot < index->typeCount; slot++ )
+	{
+		const USBDescriptorIndexType *	types = &index->types[slot];
+		const UInt16 *					list = &index->byType[types->first];
+		UInt32							low = 0;
+		UInt32							high = types->count;
+
+		if ( types->type != type )
+			continue;
+
+		while ( low < high )
+		{
+			UInt32	middle = (low + high) / 2;
+
+			if ( list[middle] <= entry )
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		return (low < types->count) ? list[low] : index->count;
+	}
+
+	return index->count;
+}
+
+// Same answer as FindNextDescriptor(current, type); current == NULL starts at the configuration descriptor
+// Remembers the entry that was returned for USBDescriptorIndexLookup
+static inline void
+USBDescriptorIndexSetHint(const USBDescriptorIndex *index, UInt32 entry)
+{
+	if ( entry < index->count )
+		((USBDescriptorIndex *)index)->hint = (UInt16)entry;
+}
+
+static inline bool
+USBDescriptorIndexFindNext(const USBDescriptorIndex *index, const void *config, const void *current, UInt8 type, const IOUSBDescriptorHeader **next)
+{
+	SInt32		entry = current ? USBDescriptorIndexLookup(index, config, current) : 0;
+	UInt32		found;
+
+	if ( entry < 0 )
+		return false;
+
+	found = USBDescriptorIndexNextOfType(index, (UInt32)entry, type);
+	*next = (found < index->count) ? (const IOUSBDescriptorHeader *)((const UInt8 *)config + index->entries[found].offset) : NULL;
+	USBDescriptorIndexSetHint(index, found);
+
+	return true;
+}
+
+// The test FindNextInterfaceDescriptor applies to each interface descriptor
+static inline bool
+USBInterfaceMatchesRequest(const IOUSBInterfaceDescriptor *interface, const IOUSBFindInterfaceRequest *request)
+{
+	return (((request->bInterfaceClass == kIOUSBFindInterfaceDontCare) || (request->bInterfaceClass == interface->bInterfaceClass)) &&
+			((request->bInterfaceSubClass == kIOUSBFindInterfaceDontCare) || (request->bInterfaceSubClass == interface->bInterfaceSubClass)) &&
+			((request->bInterfaceProtocol == kIOUSBFindInterfaceDontCare) || (request->bInterfaceProtocol == interface->bInterfaceProtocol)) &&
+			((request->bAlternateSetting == kIOUSBFindInterfaceDontCare) || (request->bAlternateSetting == interface->bAlternateSetting)));
+}
+
+// Same answer as FindNextInterfaceDescriptor(config, current, request); current == NULL starts at the configuration
+// descriptor.  Interfaces at or past wTotalLength are not returned, as in the scan.
+static inline bool
+USBDescriptorIndexFindNextInterface(const USBDescriptorIndex *index, const void *config, const void *current, const IOUSBFindInterfaceRequest *request, const IOUSBInterfaceDescriptor **next)
+{
+	SInt32		entry = current ? USBDescriptorIndexLookup(index, config, current) : 0;
+	UInt32		found;
+	UInt32		end = USBToHostWord(((const IOUSBConfigurationDescriptor *)config)->wTotalLength);
+
+	if ( entry < 0 )
+		return false;
+
+	*next = NULL;
+	for ( found = USBDescriptorIndexNextOfType(index, (UInt32)entry, kUSBInterfaceDesc); found < index->count; found = index->entries[found].nextOfType )
+	{
+		const IOUSBInterfaceDescriptor *	interface = (const IOUSBInterfaceDescriptor *)((const UInt8 *)config + index->entries[found].offset);
+
+		if ( index->entries[found].offset >= end )
+			break;
+
+		if ( USBInterfaceMatchesRequest(interface, request) )
+		{
+			*next = interface;
+			USBDescriptorIndexSetHint(index, found);
+			break;
+		}
+	}
+
+	return true;
+}
+
+// Same answer as the FindNextAssociatedDescriptor(current, type) walk for interface interfaceNumber
+static inline bool
+USBDescriptorIndexFindNextAssociated(const USBDescriptorIndex *index, const void *config, const void *current, UInt8 type, UInt8 interfaceNumber, const IOUSBDescriptorHeader **next)
+{
+	SInt32		entry = USBDescriptorIndexLookup(index, config, current);
+	UInt32		found;
+
+	if ( entry < 0 )
+		return false;
+
+	*next = NULL;
+	found = index->entries[entry].nextBoundary;
+	if ( type == kUSBInterfaceDesc )
+	{
+		// Alternate settings of the same interface, up to an IAD or a different interface
+		if ( (found < index->count) && (index->entries[found].type == kUSBInterfaceDesc) )
+		{
+			const IOUSBInterfaceDescriptor *	interface = (const IOUSBInterfaceDescriptor *)((const UInt8 *)config + index->entries[found].offset);
+
+			if ( interface->bInterfaceNumber == interfaceNumber )
+			{
+				*next = (const IOUSBDescriptorHeader *)interface;
+				USBDescriptorIndexSetHint(index, found);
+			}
+		}
+		return true;
+	}
+
+	entry = (SInt32)USBDescriptorIndexNextOfType(index, (UInt32)entry, type);
+	if ( (UInt32)entry < found )
+	{
+		*next = (const IOUSBDescriptorHeader *)((const UInt8 *)config + index->entries[entry].offset);
+		USBDescriptorIndexSetHint(index, (UInt32)entry);
+	}
+
+	return true;
+}
+
+#endif /* _USBDESCRIPTORINDEX_H */
@@ -192,7 +192,8 @@ enum {
 	kPrdRootHubApple			= 0x8005,	// ProductID for classic speed root hubs
 	kPrdRootHubAppleE			= 0x8006,	// ProductID for high speed root hubs
 	kPrdRootHubAppleSS			= 0x8007,	// ProductID for super speed root hubs
-	kUSBRootHubPollingRate		= 32		// Enpoint polling rate interval for root hubs
+	kUSBRootHubPollingRate		= 32,		// Enpoint polling rate interval for root hubs
+	kUSBRootHubSafetyPollingRate	= 1024		// Root hub timer interval when the UIM reports port changes from its interrupt
 };
 
 /*!
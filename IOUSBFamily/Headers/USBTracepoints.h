@@ -75,6 +75,7 @@ extern "C" {
 		kUSBUASControl					= 13,	// bit 13: Disable UAS support
         kUSBMasterAbortLogging          = 14,
         kUSBMasterAbortPanic            = 15,
+        kUSBEnableEndpointStatistics    = 16,   // bit 16 (0x10000) keeps per-endpoint latency/throughput statistics in the UIM diagnostics
 		
 		kUSBEnableDebugLoggingMask			= (1 << kUSBEnableDebugLoggingBit),     // 0x0001
 		kUSBEnableTracePointsMask			= (1 << kUSBEnableTracePointsBit),      // 0x0002
@@ -88,7 +89,8 @@ extern "C" {
 		kUSBEnableAllXHCIControllersMask	= (1 << kUSBEnableAllXHCIControllers),  // 0x1000
 		kUSBUASControlMask					= (1 << kUSBUASControl),                // 0x2000
         kUSBMasterAbortLoggingMask          = (1 << kUSBMasterAbortLogging),        // 0x4000
-        kUSBMasterAbortPanicMask            = (1 << kUSBMasterAbortPanic)           // 0x8000
+        kUSBMasterAbortPanicMask            = (1 << kUSBMasterAbortPanic),          // 0x8000
+        kUSBEnableEndpointStatisticsMask    = (1 << kUSBEnableEndpointStatistics)   // 0x10000
 	};
 	
 	
@@ -437,7 +439,8 @@ extern "C" {
 		kTPEnumerationAddDeviceResetChangeHandler	= 6,
 		kTPEnumerationRegisterService		= 7,
 		kTPEnumerationLowSpeedDevice		= 8,
-		kTPEnumerationFullSpeedDevice		= 9
+		kTPEnumerationFullSpeedDevice		= 9,
+		kTPEnumerationRegisterInterfaces	= 10
 		
 	};
 	
@@ -111,6 +111,7 @@ IOUSBInterfaceClass::IOUSBInterfaceClass()
 	fConfigLength(0),
 	fInterfaceDescriptor(NULL),
 	fConfigurations(NULL),
+	fConfigIndexes(NULL),
 	fConfigDescCacheValid(false),
 	fCurrentConfigIndex(0),
 	fNeedContiguousMemoryForLowLatencyIsoch(0),
@@ -144,6 +145,17 @@ IOUSBInterfaceClass::~IOUSBInterfaceClass()
 		fConfigDescCacheValid = false;
     }
 
+    if (fConfigIndexes)
+    {
+        int i;
+        for (i=0; i< fNumConfigurations; i++)
+            if (fConfigIndexes[i])
+			free(fConfigIndexes[i]);
+        
+		free(fConfigIndexes);
+        fConfigIndexes = NULL;
+    }
+
     if (fConnection) 
 	{
         IOServiceClose(fConnection);
@@ -471,6 +483,7 @@ IOUSBInterfaceClass::GetPropertyInfo(void)
 			{
 				fConfigurations = (IOUSBConfigurationDescriptorPtr*) malloc(fNumConfigurations * sizeof(IOUSBConfigurationDescriptorPtr));
 				bzero(fConfigurations, fNumConfigurations * sizeof(IOUSBConfigurationDescriptorPtr));
+				fConfigIndexes = (USBDescriptorIndex**) calloc(fNumConfigurations, sizeof(USBDescriptorIndex*));
 			}
 			
 			val = CFDictionaryGetValue(entryProperties, CFSTR(kUSBControllerNeedsContiguousMemoryForIsoch));
@@ -2841,6 +2854,32 @@ IOUSBInterfaceClass::CacheConfigDescriptor()
         *((char*)configPtr + configSize) = 0;
         *((char*)configPtr + configSize + 1) = 0;
         fConfigurations[i] = configPtr;
+        
+        // Index the descriptor so that FindNextDescriptor and FindNextAssociatedDescriptor don't have to rescan it
+        if (fConfigIndexes)
+        {
+            UInt16		count = 0;
+            UInt16		typeCount = 0;
+            UInt32		length = (UInt32)configSize;
+            UInt32		indexSize;
+            
+            if ( length > USBToHostWord(configPtr->wTotalLength) )
+                length = USBToHostWord(configPtr->wTotalLength);
+            
+            if (fConfigIndexes[i])
+            {
+                free(fConfigIndexes[i]);
+                fConfigIndexes[i] = NULL;
+            }
+            
+            indexSize = USBDescriptorIndexSize(configPtr, length, &count, &typeCount);
+            if (indexSize)
+            {
+                fConfigIndexes[i] = (USBDescriptorIndex *) malloc(indexSize);
+                if (fConfigIndexes[i])
+                    USBDescriptorIndexBuild(fConfigIndexes[i], indexSize, configPtr, length, count, typeCount);
+            }
+        }
     }
 	
     if ( kr == kIOReturnSuccess )
@@ -2932,6 +2971,15 @@ IOUSBInterfaceClass::FindNextDescriptor(const void * startDescriptor, UInt8 desc
         descriptorHeader = (IOUSBDescriptorHeader *)startDescriptor;
     }
 
+	// Use the index of the configuration if we have one
+	if (fConfigIndexes && fConfigIndexes[fCurrentConfigIndex])
+	{
+		const IOUSBDescriptorHeader *	next;
+		
+		if (USBDescriptorIndexFindNext(fConfigIndexes[fCurrentConfigIndex], curConfDesc, startDescriptor, descType, &next))
+			return next;
+	}
+
 	// Now, look through all the descriptors in this configuration, looking for the next one after the starting one
     do
     {
@@ -3015,6 +3063,16 @@ IOUSBInterfaceClass::FindNextAssociatedDescriptor(const void * currentDescriptor
     }
         
 
+    // The index of the current configuration can answer this directly
+    if (fConfigIndexes && fConfigIndexes[fCurrentConfigIndex])
+    {
+        if (USBDescriptorIndexFindNextAssociated(fConfigIndexes[fCurrentConfigIndex], fConfigurations[fCurrentConfigIndex], currentDescriptor, descriptorType, fInterfaceNumber, &next))
+        {
+            DEBUGPRINT("IOUSBInterfaceClass::FindNextAssociatedDescriptor returning %p from the index\n", next);
+            return (IOUSBDescriptorHeader *)next;
+        }
+    }
+
     next = ( const IOUSBDescriptorHeader *) currentDescriptor;
 
     while (true)
@@ -26,6 +26,7 @@
 
 #include "../../IOUSBFamily/Headers/IOUSBLib.h"
 #include "../../IOUSBFamily/Headers/USB.h"
+#include "../../IOUSBFamily/Headers/USBDescriptorIndex.h"
 
 #include <asl.h>
 
@@ -76,6 +77,7 @@ protected:
     UInt32								fConfigLength;
     IOUSBInterfaceDescriptorPtr			fInterfaceDescriptor;
     IOUSBConfigurationDescriptorPtr		*fConfigurations;
+    USBDescriptorIndex					**fConfigIndexes;			// one per fConfigurations entry, built by CacheConfigDescriptor
     bool								fConfigDescCacheValid;
 	UInt8								fCurrentConfigIndex;
 	bool								fNeedContiguousMemoryForLowLatencyIsoch;
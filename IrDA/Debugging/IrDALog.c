@@ -9,7 +9,9 @@
 
 
 */
-//#include <Kernel/kern/clock.h>
+#include <kern/clock.h>
+#include <kern/cpu_number.h>                // cpu_number(), from kpi.unsupported
+#include <libkern/OSAtomic.h>
 #include <IOKit/IOLib.h>
 #include "IrDALog.h"
 #include "IrDADebugging.h"
@@ -39,17 +41,47 @@
 
 char *GetCachedMsg(EventTraceCauseDesc *desc, UInt16 eventIndex);
 
-// Globals
-IrDAEventDesc fBuffer[kEntryCount+10];  // Buffer (+10 is hack so wrap race condition doesn't smash memory)
+// Each cpu adds to its own ring so loggers on different cpus don't fight over one index.  A
+// slot is reserved with an atomic increment of the ring's free running fNext, so a thread that
+// moves to another cpu, or an interrupt on the same one, still gets a slot of its own.  The
+// slot's sequence is 0 while it's being filled and reservation+1 once it's complete, which is
+// how IrDALogSnapshot tells finished entries from ones being written or overwritten.
+
+typedef struct IrDALogSlot
+{
+    volatile UInt32     fSequence;          // reservation + 1 when complete, 0 while being filled
+    UInt16              data1;
+    UInt16              data2;
+    UInt64              fTime;              // mach absolute time (0 if not stamped), converted at snapshot
+    char                *msg;
+} IrDALogSlot;
+
+typedef struct IrDALogRing
+{
+    IrDALogSlot         *fSlots;
+    volatile SInt32     fNext;              // next reservation, free running
+    UInt32              fRead;              // first reservation not yet returned by a snapshot
+    UInt32              fSnapEnd;           // fNext when the last snapshot was taken
+} IrDALogRing;
+
+IrDALogRing             gLogRings[kLogRingCount];
+UInt32                  gLogRingEntries = 0;        // slots per ring, power of 2.  0 until IrDALogInit
+UInt32                  gLogRingMask = 0;
+SInt32                  gLogUsers = 0;              // IrDALogInit calls not yet matched by IrDALogFree
+volatile SInt32         gLogWriters = 0;            // IrDALogAdd calls in progress
+UInt32                  gLogDropped = 0;            // entries overwritten before a snapshot got to them
+IrDAEventDesc           *gSnapshot = nil;           // merged copy handed to the dump tools
+UInt32                  gSnapshotEntries = 0;       // size of the above
+IORecursiveLock         *gLogLock = nil;            // guards gSnapshot, gIrDALog and the ring read state
 
 #pragma export on               // Start of public code
 #pragma mark Start Exported -------------
 
-IrDALogHdr gIrDALog = {                 // the log header
-	&fBuffer[0],                    // fEventBuffer
+IrDALogHdr gIrDALog = {                 // the log header, describes the last snapshot
+	nil,                            // fEventBuffer
 	0,                              // fEventIndex
 	0,                              // fPrintIndex
-	kEntryCount,                    // fNumEntries
+	0,                              // fNumEntries
 	true,                           // fTracingOn
 	false                           // fWrapped
 	//true                          // fWrappingEnabled
@@ -64,9 +96,9 @@ extern "C"
 #endif // __cplusplus
 void IrDALogAdd( UInt16 eventIndex, UInt16 data1, UInt16 data2, EventTraceCauseDesc * desc, Boolean timeStamp)
 {
-
-    IrDAEventDesc *logEntry;
-    UInt32 cTime;
+    IrDALogRing *ring;
+    IrDALogSlot *slot;
+    UInt32 reservation;
     
     // sanity checks
     require(eventIndex > 0, Fail);
@@ -75,6 +107,10 @@ void IrDALogAdd( UInt16 eventIndex, UInt16 data1, UInt16 data2, EventTraceCauseD
     if(!gIrDALog.fTracingOn)        // nop if tracing not enabled
 	return;
 	
+    OSIncrementAtomic(&gLogWriters);        // keeps IrDALogFree from pulling the rings out from under us
+    if (gLogRingEntries == 0)               // not allocated yet (or being freed)
+	goto Done;
+	
     eventIndex--;                   // FOO.  EventIndex is 1 based instead of zero based.
     
 #if (USE_IOLOG > 0)
@@ -84,42 +120,25 @@ void IrDALogAdd( UInt16 eventIndex, UInt16 data1, UInt16 data2, EventTraceCauseD
     }
 #endif
 
-    if( gIrDALog.fEventIndex >= gIrDALog.fNumEntries ) {    // Wrap if hit end of buffer (this one shouldn't be hit, sanity only)
-	gIrDALog.fEventIndex = 0;
-	if (gIrDALog.fEventIndex == gIrDALog.fPrintIndex)   // if newly wrapped index now matches print index
-	    gIrDALog.fWrapped = true;                       // then we've wrapped past it
-    }
+    ring = &gLogRings[cpu_number() & (kLogRingCount - 1)];
+    reservation = (UInt32)OSIncrementAtomic(&ring->fNext);     // Get the log entry & incr ptr
+    slot = &ring->fSlots[reservation & gLogRingMask];
     
-    logEntry = &gIrDALog.fEventBuffer[gIrDALog.fEventIndex++];  // Get the log entry pointer & incr ptr
-
-    if( gIrDALog.fEventIndex >= gIrDALog.fNumEntries) {     // Wrap if hit end of buffer (this one should be hit)
-	gIrDALog.fEventIndex = 0;
-    }
+    slot->fSequence = 0;                                        // mark it as being filled
+    OSMemoryBarrier();
     
-    if (gIrDALog.fEventIndex == gIrDALog.fPrintIndex)           // if the (incr'd) index matches printing index
-	gIrDALog.fWrapped = true;                               // then we've wrapped past it
-
-    //if (gIrDALog.fWrappingEnabled == false && gIrDALog.fWrapped == true)  // if not allowed to wrap
-    //  return;
-	
-    //
-    // Now that we have a record, get the current time (if requested)
-    //
-    if (timeStamp) {
-	    AbsoluteTime now;
-	    UInt64  nanoseconds;
-	    clock_get_uptime(&now);
-	    absolutetime_to_nanoseconds(now, &nanoseconds);
-	    cTime = nanoseconds / 1000;     // microseconds is plenty for me
-    }
-    else cTime = 0;
+    // Ok, stuff a log entry.  The timestamp is left in absolute time, converting
+    // it here would cost every caller a divide; the snapshot does it instead.
+    slot->data1     = data1;                                    // Stuff in the data
+    slot->data2     = data2;
+    slot->fTime     = timeStamp ? mach_absolute_time() : 0;     // log the time
+    slot->msg       = GetCachedMsg(desc, eventIndex);           // get pointer to copy of msg (or nil)
     
-    // Ok, stuff a log entry
-    logEntry->data1         = data1;                                // Stuff in the data
-    logEntry->data2         = data2;
-    logEntry->timeStamp     = cTime;                                // log the time
-    logEntry->msg           = GetCachedMsg(desc, eventIndex);       // get pointer to copy of msg (or nil)
+    OSMemoryBarrier();
+    slot->fSequence = reservation + 1;                          // and publish it
     
+Done:
+    OSDecrementAtomic(&gLogWriters);
 Fail:
     return;
     
@@ -152,6 +171,214 @@ IrDALogWrappingOff()
 }
 */
 
+// Allocate the rings.  entries is the total for all the rings (0 for kEntryCount),
+// rounded up so each ring is a power of 2.  Only the first caller allocates.
+void
+IrDALogInit(UInt32 entries)
+{
+    UInt32  perRing;
+    int     i;
+    
+    if (OSIncrementAtomic(&gLogUsers) != 0)     // already set up by another driver instance
+	return;
+    
+    gLogLock = IORecursiveLockAlloc();
+    require(gLogLock, Fail);
+    
+    if (entries == 0)
+	entries = kEntryCount;
+    
+    for (perRing = 64; perRing < (entries / kLogRingCount); perRing <<= 1)
+	continue;
+    
+    for (i = 0; i < kLogRingCount; i++) {
+	gLogRings[i].fSlots = (IrDALogSlot *)IOMalloc(perRing * sizeof(IrDALogSlot));
+	require(gLogRings[i].fSlots, Fail);
+	bzero(gLogRings[i].fSlots, perRing * sizeof(IrDALogSlot));
+	gLogRings[i].fNext = 0;
+	gLogRings[i].fRead = 0;
+	gLogRings[i].fSnapEnd = 0;
+    }
+    
+    gSnapshot = (IrDAEventDesc *)IOMalloc(perRing * kLogRingCount * sizeof(IrDAEventDesc));
+    require(gSnapshot, Fail);
+    gSnapshotEntries = perRing * kLogRingCount;
+    
+    gLogDropped = 0;
+    gLogRingMask = perRing - 1;
+    OSMemoryBarrier();
+    gLogRingEntries = perRing;                  // loggers can go now
+    return;
+    
+Fail:
+    for (i = 0; i < kLogRingCount; i++) {
+	if (gLogRings[i].fSlots) {
+	    IOFree(gLogRings[i].fSlots, perRing * sizeof(IrDALogSlot));
+	    gLogRings[i].fSlots = nil;
+	}
+    }
+    if (gLogLock) {
+	IORecursiveLockFree(gLogLock);
+	gLogLock = nil;
+    }
+    return;                                     // logging stays off, IrDALogFree still expected
+}
+
+void
+IrDALogFree(void)
+{
+    UInt32  perRing = gLogRingEntries;
+    int     i;
+    
+    if (OSDecrementAtomic(&gLogUsers) != 1)     // someone is still using it
+	return;
+    
+    gLogRingEntries = 0;                        // stop new adds
+    OSMemoryBarrier();
+    while (gLogWriters != 0)                    // and let the ones in progress finish
+	IOSleep(1);
+    
+    if (gLogLock == nil)                        // IrDALogInit failed, nothing to free
+	return;
+    
+    IrDALogLock();                              // wait out anyone reading the snapshot
+    for (i = 0; i < kLogRingCount; i++) {
+	if (gLogRings[i].fSlots) {
+	    IOFree(gLogRings[i].fSlots, perRing * sizeof(IrDALogSlot));
+	    gLogRings[i].fSlots = nil;
+	}
+    }
+    if (gSnapshot) {
+	IOFree(gSnapshot, gSnapshotEntries * sizeof(IrDAEventDesc));
+	gSnapshot = nil;
+	gSnapshotEntries = 0;
+    }
+    
+    gIrDALog.fEventBuffer = nil;
+    gIrDALog.fEventIndex = gIrDALog.fPrintIndex = gIrDALog.fNumEntries = 0;
+    IrDALogUnlock();
+    
+    IORecursiveLockFree(gLogLock);
+    gLogLock = nil;
+}
+
+// The snapshot is rebuilt in place, so whoever reads it (the user client copying
+// it out) holds the lock from IrDALogSnapshot through IrDALogReset.  Recursive so
+// the calls below can take it too.
+void
+IrDALogLock(void)
+{
+    if (gLogLock)
+	IORecursiveLockLock(gLogLock);
+}
+
+void
+IrDALogUnlock(void)
+{
+    if (gLogLock)
+	IORecursiveLockUnlock(gLogLock);
+}
+
+// Copy the slot if it's a complete entry for reservation, false if it's being
+// written or has already been reused for a later one
+static Boolean
+ReadSlot(IrDALogRing *ring, UInt32 reservation, IrDALogSlot *copy)
+{
+    IrDALogSlot *slot = &ring->fSlots[reservation & gLogRingMask];
+    UInt32      sequence;
+    
+    sequence = slot->fSequence;
+    OSMemoryBarrier();
+    *copy = *slot;
+    OSMemoryBarrier();
+    
+    return (sequence == reservation + 1) && (slot->fSequence == sequence);
+}
+
+// Merge the entries added since the last IrDALogReset from all the rings, oldest first,
+// into gSnapshot in the format the dump tools read.  The writers are never stopped.
+void
+IrDALogSnapshot(void)
+{
+    UInt32      cursor[kLogRingCount];
+    UInt64      lastTime[kLogRingCount];        // entries w/o a timestamp sort with the one before them
+    IrDALogSlot slot[kLogRingCount];
+    Boolean     have[kLogRingCount];
+    UInt32      count = 0;
+    int         i;
+    
+    OSIncrementAtomic(&gLogWriters);            // keep the rings around while we look at them
+    if (gLogRingEntries == 0)
+	goto Done;
+    
+    IrDALogLock();                              // one snapshot at a time, and not while one is being read
+    if (gSnapshot == nil)
+	goto Unlock;
+    
+    for (i = 0; i < kLogRingCount; i++) {
+	IrDALogRing *ring = &gLogRings[i];
+	
+	ring->fSnapEnd = (UInt32)ring->fNext;
+	cursor[i] = ring->fRead;
+	if ((ring->fSnapEnd - cursor[i]) > gLogRingEntries) {   // writers lapped the reader
+	    gLogDropped += (ring->fSnapEnd - cursor[i]) - gLogRingEntries;
+	    cursor[i] = ring->fSnapEnd - gLogRingEntries;
+	}
+	lastTime[i] = 0;
+	have[i] = false;
+    }
+    
+    while (count < gSnapshotEntries) {
+	int     oldest = -1;
+	UInt64  oldestTime = 0;
+	
+	// Refill the head of each ring, skipping slots that aren't usable
+	for (i = 0; i < kLogRingCount; i++) {
+	    while (!have[i] && (cursor[i] != gLogRings[i].fSnapEnd)) {
+		have[i] = ReadSlot(&gLogRings[i], cursor[i], &slot[i]);
+		if (have[i]) {
+		    if (slot[i].fTime == 0) slot[i].fTime = lastTime[i];
+		    else                    lastTime[i] = slot[i].fTime;
+		}
+		else gLogDropped++;
+		cursor[i]++;
+	    }
+	    if (have[i] && ((oldest < 0) || (slot[i].fTime < oldestTime))) {
+		oldest = i;
+		oldestTime = slot[i].fTime;
+	    }
+	}
+	if (oldest < 0)                         // all the rings are drained
+	    break;
+	
+	{
+	    IrDAEventDesc   *logEntry = &gSnapshot[count++];
+	    UInt64          nanoseconds = 0;
+	    
+	    if (oldestTime)
+		absolutetime_to_nanoseconds(oldestTime, &nanoseconds);
+	    logEntry->data1     = slot[oldest].data1;
+	    logEntry->data2     = slot[oldest].data2;
+	    logEntry->timeStamp = (UInt32)(nanoseconds / 1000);     // microseconds is plenty for me
+	    logEntry->msg       = slot[oldest].msg;
+	    have[oldest] = false;
+	}
+    }
+    
+    // Describe it the way the old single buffer was, nothing wrapped and the
+    // entries to print running from 0 up to fEventIndex
+    gIrDALog.fEventBuffer = gSnapshot;
+    gIrDALog.fEventIndex = count;
+    gIrDALog.fPrintIndex = 0;
+    gIrDALog.fNumEntries = count + 1;
+    gIrDALog.fWrapped = false;
+    
+Unlock:
+    IrDALogUnlock();
+Done:
+    OSDecrementAtomic(&gLogWriters);
+}
+
 #endif // hasTracing > 0
 
 #pragma mark Message Cache -------------
@@ -290,13 +517,17 @@ char *CopyMsg(const char *msg)
 
 IrDALogInfo gIrDALogInfo = {
 	&gIrDALog, sizeof(gIrDALog),
-	fBuffer, sizeof(fBuffer),
+	nil, 0,                                 // set to the snapshot by IrDALogGetInfo
 	gMsgBuf, sizeof(gMsgBuf) };
 	
 
 IrDALogInfo *
 IrDALogGetInfo(void)
 {
+    IrDALogLock();
+    gIrDALogInfo.eventLog = gIrDALog.fEventBuffer;
+    gIrDALogInfo.eventLogSize = gIrDALog.fEventIndex * sizeof(IrDAEventDesc);
+    IrDALogUnlock();
     return &gIrDALogInfo;
 /*
     if (info == nil) return;
@@ -312,13 +543,23 @@ IrDALogGetInfo(void)
 void
 IrDALogReset(void)
 {
+    int i;
+    
+    IrDALogLock();
+    // the entries in the last snapshot have been handed out, don't return them again
+    for (i = 0; i < kLogRingCount; i++) {
+	if ((gLogRings[i].fSnapEnd - gLogRings[i].fRead) <= (UInt32)(gLogRings[i].fNext - gLogRings[i].fRead))
+	    gLogRings[i].fRead = gLogRings[i].fSnapEnd;
+    }
+    
     gIrDALog.fEventIndex = 0;
     gIrDALog.fPrintIndex = 0;
-    gIrDALog.fNumEntries = kEntryCount;
+    gIrDALog.fNumEntries = 0;
     // don't reset fTracingOn
     //gIrDALog.fTracingOn = true;
     gIrDALog.fWrapped = false;
     // don't reset fWrappingEnabled
+    IrDALogUnlock();
 }
 
 #endif // hasTracing > 0
@@ -67,7 +67,12 @@ void    IrDALogTracingOff   ( void );
 //void  IrDALogWrappingOff();
 //void  IrDALogWrappingOn();
 
-void    IrDALogReset        ( void );
+void    IrDALogInit         ( UInt32 entries ); // allocate the rings, 0 for the default size.  One call per IrDALogFree
+void    IrDALogFree         ( void );
+void    IrDALogSnapshot     ( void );           // merge the rings into the buffer IrDALogGetInfo describes
+void    IrDALogReset        ( void );           // drop what the last snapshot returned
+void    IrDALogLock         ( void );           // hold from IrDALogSnapshot until done reading it
+void    IrDALogUnlock       ( void );
 IrDALogInfo *IrDALogGetInfo(void);
 
 #ifdef __cplusplus
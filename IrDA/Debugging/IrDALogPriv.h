@@ -8,7 +8,8 @@
 #define USE_IOLOG   0               // true if want to go to IOLog
 #define IOSLEEPTIME 25              // ms delay after each IOLog
 
-#define kEntryCount (30*1024)               // Number of log entries.   *** Change to runtime alloc?
+#define kEntryCount (30*1024)               // Default number of log entries, IrDALogInit(0) rounds this up across the rings
+#define kLogRingCount       4               // per-cpu rings (power of 2), cpu_number() picks one
 #define kMaxModuleNames     50              // max number of clients (unique module names)
 #define kMaxModuleNameLen   32              // max length of module name
 #define kMaxIndex           500             // max event index (# of msgs) per module
@@ -56,5 +56,11 @@ typedef struct
     UInt32  protcolErrs;        // ?
 } IrDAStatus;
 
+typedef struct
+{
+    UInt32  copies;             // payload copies made by CBufferSegment Getn/Putn
+    UInt32  bytesCopied;        // bytes moved by those copies
+} IrDACopyStats;
+
 
 #endif  // __IrDAStats__
\ No newline at end of file
@@ -189,8 +189,10 @@ IrComm::Write(UInt8 *buf, UInt32 length)
 	require(len > 0, Done);
 	require(len < 2047, Done);  // sanity
 	
-	pkt = BufAlloc(len + 1);
+	pkt = BufAlloc(kTTPDataHeaderSize + len + 1);
 	require(pkt, Done);
+	
+	BufHideStart(pkt, kTTPDataHeaderSize);  // leave room so tinytp can add its header w/out a copy
 		
 	rc = pkt->Put(0);           // no ircomm control info in this packet
 	check(rc == 0);             // should return the byte we're putting
@@ -202,7 +204,7 @@ IrComm::Write(UInt8 *buf, UInt32 length)
 	
 	DoDataRequest(pkt);         // send to tinytp for xmit
 	
-	BufFree(pkt);               // tinytp copies the data from us, free our copy (keep the cbuf?)
+	BufFree(pkt);               // tinytp keeps its own reference (or copy), free ours
 	
 	buf     += len;
 	written += len;
@@ -8,6 +8,7 @@
 #include "IrDAUser.h"
 #include "AppleIrDA.h"
 #include "IrDAComm.h"
+#include "CBufferSegment.h"
 #include "IrDALog.h"
 #include "IrDADebugging.h"
 
@@ -132,6 +133,9 @@ IrDAUserClient::userPostCommand(void *pIn, void *pOut, IOByteCount inputSize, IO
 	    case kIrDAUserCmd_Disable:
 		    return setIrDAState(false);
 	    
+	    case kIrDAUserCmd_GetCopyStats:
+		    return getIrDACopyStats(pIn, pOut, inputSize, outPutSize);
+	    
 	    default:
 		    IOLog("IrDA: Bad command to userPostCommand, %d\n", *input);
 	}
@@ -181,7 +185,9 @@ IrDAUserClient::getIrDALog(void *pIn, void *pOut, IOByteCount inputSize, IOByteC
 
     require(md, Fail);
     
-    info = IrDALogGetInfo();        // get the info block
+    IrDALogLock();                  // keep the snapshot still until we've copied it out
+    IrDALogSnapshot();              // merge the per-cpu rings into one buffer
+    info = IrDALogGetInfo();        // get the info block (describes the snapshot)
 		    
     //ELG(info->hdr,       info->hdrSize,       'irda', "info hdr");
     //ELG(info->eventLog,  info->eventLogSize,  'irda', "info events");
@@ -216,6 +222,7 @@ IrDAUserClient::getIrDALog(void *pIn, void *pOut, IOByteCount inputSize, IOByteC
 	// todo check return code of above before resetting the buffer
 	IrDALogReset();     // reset the buffer now
     }
+    IrDALogUnlock();
     md->release();  // free it
 
     return kIOReturnSuccess;
@@ -255,6 +262,26 @@ Fail:
     return kIOReturnBadArgument;
 }
 
+// get buffer copy counters
+//
+// input: just the command byte
+// output: IrDACopyStats returned directly to pOut
+
+IOReturn
+IrDAUserClient::getIrDACopyStats(void *pIn, void *pOut, IOByteCount inputSize, IOByteCount *outPutSize)
+{
+    IrDACopyStats *stats = (IrDACopyStats *)pOut;
+    
+    require(*outPutSize == sizeof(IrDACopyStats), Fail);
+    
+    CBufferSegment::GetCopyStats(&stats->copies, &stats->bytesCopied);
+    return kIOReturnSuccess;
+
+Fail:
+    IOLog("IrDA: Failing to get copy stats\n");
+    return kIOReturnBadArgument;
+}
+
 // set irda state
 //
 // input: just the state (true = on, false = off)
@@ -23,6 +23,7 @@ public:
     IOReturn userPostCommand(void *pIn, void *pOut, IOByteCount inputSize, IOByteCount *outPutSize);
     IOReturn getIrDALog(void *pIn, void *pOut, IOByteCount inputSize, IOByteCount *outPutSize);
     IOReturn getIrDAStatus(void *pIn, void *pOut, IOByteCount inputSize, IOByteCount *outPutSize);
+    IOReturn getIrDACopyStats(void *pIn, void *pOut, IOByteCount inputSize, IOByteCount *outPutSize);
     IOReturn setIrDAState(bool state);
     
 private:
@@ -18,7 +18,8 @@ enum {                                  // command bytes to send to the user cli
     kIrDAUserCmd_GetLog     = 0x12,     // return irdalog buffers
     kIrDAUserCmd_GetStatus  = 0x13,     // return connection status and counters
     kIrDAUserCmd_Enable     = 0x14,     // Enable the hardware and the IrDA stack
-    kIrDAUserCmd_Disable    = 0x15      // Disable the hardware and the IrDA stack
+    kIrDAUserCmd_Disable    = 0x15,     // Disable the hardware and the IrDA stack
+    kIrDAUserCmd_GetCopyStats = 0x16    // return buffer copy counters
 };
 
 enum {                                  // messageType for the callback routines
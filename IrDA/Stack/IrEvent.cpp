@@ -6,6 +6,7 @@
 */
 
 #include "IrEvent.h"
+#include "IrEventQueue.h"
 #include "CList.h"
 #include "CListIterator.h"
 #include "CBufferSegment.h"
@@ -59,13 +60,13 @@ EventTraceCauseDesc TraceEvents[] = {
     {kGrabEventBlock,               "IrEvent: Grab Event Block"},
     {kReleaseEventBlock,            "IrEvent: Release Event Block"},
     
-    {kLogReleaseErr1,               "IrEvent: Release ERROR, not on in use list, err="},
-    {kLogReleaseErr2,               "IrEvent: Release ERROR, in use list="},
-    {kLogReleaseErr3,               "IrEvent: Release ERROR, in use size, members="},
+    {kLogReleaseErr1,               "IrEvent: Release ERROR, not on in use list, event="},
+    {kLogReleaseErr2,               "IrEvent: Release ERROR, still on pending event fifo, event="},
+    {kLogReleaseErr3,               "IrEvent: Release ERROR, in use size, free size="},
 
-    {kLogGrabErr1,                  "IrEvent: Grab ERROR, failed to add to in-use list, err="},
+    {kLogGrabErr1,                  "IrEvent: Grab ERROR, event lists not initialized"},
     {kLogGrabErr2,                  "IrEvent: Grab ERROR, in use list="},
-    {kLogGrabErr3,                  "IrEvent: Grab ERROR, in use size, members="}
+    {kLogGrabErr3,                  "IrEvent: Grab ERROR, in use size, free size="}
     
     /*
     
@@ -91,11 +92,21 @@ EventTraceCauseDesc TraceEvents[] = {
 #endif
 
 //
-// review: make these static entries in the event record?
+// The event block pool.  Released blocks are kept on a free list and reused, and
+// grabbed blocks are kept on an in-use list so they can be freed when the stack
+// goes away.  Both are linked through the event blocks themselves, so grabbing
+// and releasing a block never has to search or copy a list.
 //
-CList *gFreeEventList = nil;
-CList *gInUseEventList = nil;
-void DeleteEventListItems(CList *eventlist, Boolean check_contents);
+enum {
+    kInitialFreeEvents = 16             // enough for a connected IrComm link without allocating
+};
+
+TIrEvent *gFreeEvents = nil;            // singly linked through fPoolNext
+TIrEvent *gInUseEvents = nil;           // doubly linked through fPoolNext and fPoolPrev
+UInt32    gFreeEventCount = 0;
+UInt32    gInUseEventCount = 0;
+Boolean   gEventListsReady = false;
+void DeleteEventListItems(TIrEvent *eventlist, UInt32 count, Boolean check_contents);
 
 //--------------------------------------------------------------------------------
 #define super OSObject
@@ -113,8 +124,9 @@ TIrEvent::InitEventLists()
 {
     XTRACE(kLogInitEventLists, 0, 0);
     
-    ncheck(gFreeEventList);
-    ncheck(gInUseEventList);
+    check(gEventListsReady == false);
+    ncheck(gFreeEvents);
+    ncheck(gInUseEvents);
     
     // sanity checks on sizes of overlaid classes
     // todo: switch to simple union.
@@ -137,21 +149,18 @@ TIrEvent::InitEventLists()
     XTRACE(kLogInitEventBlockList, sizeof(TIrLargestEvent), sizeof(TIrLookupEvent));
     */
     
-    // Init the lists of ir event block's
-    gFreeEventList = CList::cList();
-    require(gFreeEventList, Fail);
-    
-    gInUseEventList = CList::cList();
-    require(gInUseEventList, Fail);
+    // Prime the free list so the first burst of requests doesn't have to allocate
+    gEventListsReady = true;
+    for (int i = 0; i < kInitialFreeEvents; i++) {
+	TIrEvent *eventBlock = TIrLargestEvent::tIrLargestEvent();
+	require(eventBlock, Fail);
+	IrEventPoolPush(gFreeEvents, gFreeEventCount, eventBlock);
+    }
 
     return noErr;
 
 Fail:
-    if (gFreeEventList) gFreeEventList->release();
-    gFreeEventList->release();
-
-    if (gInUseEventList) gInUseEventList->release();
-    gInUseEventList->release();
+    DeleteEventLists();
 
     return kIrDAErrNoMemory;
 
@@ -165,56 +174,31 @@ Fail:
 void
 TIrEvent::DeleteEventLists(void)
 {
-    if (gFreeEventList) {           // free events off our free list
-	DeleteEventListItems(gFreeEventList,  false);
-	gFreeEventList->release();
-	gFreeEventList = nil;
-    }
-    if (gInUseEventList) {          // free allocated events, and their contents too
-	DeleteEventListItems(gInUseEventList, true);
-	gInUseEventList->release();
-	gInUseEventList = nil;
-    }
+    gEventListsReady = false;
+    
+    DeleteEventListItems(gFreeEvents, gFreeEventCount, false);      // free events off our free list
+    gFreeEvents = nil;
+    gFreeEventCount = 0;
+    
+    DeleteEventListItems(gInUseEvents, gInUseEventCount, true);     // free allocated events, and their contents too
+    gInUseEvents = nil;
+    gInUseEventCount = 0;
+    
 } // DeleteEventLists
 
 void
-DeleteEventListItems(CList *eventlist, Boolean check_contents)
+DeleteEventListItems(TIrEvent *eventlist, UInt32 count, Boolean check_contents)
 {
-    XTRACE(kLogDeleteEventList, check_contents, eventlist->GetArraySize());
-
-    if (eventlist->GetArraySize() > 0) {
-	TIrEvent *event;
-
-	// removing from end is much faster
-	for (int index = eventlist->GetArraySize() - 1; index >= 0 ; index--) {
-	    event = (TIrEvent*)eventlist->At(index);
-	    eventlist->RemoveAt(index);
-	    require(event, Fail);
-	    XTRACE(kLogDeleteEventList, 0, event);
-	    XTRACE(kLogDeleteEventList, 0, event->fEvent);
-	    /** this appears to not work well ...
-	    if (check_contents) {
-		switch (event->fEvent) {
-		    case kIrPutDataRequestEvent:
-		    case kIrPutDataReplyEvent:
-			{
-			    TIrPutEvent *putevent = (TIrPutEvent *)event;
-			    CBufferSegment *buf;
-			    buf = OSDynamicCast(CBufferSegment, putevent->fData);
-			    if (buf)
-				IOLog("Could have freed 0x%lx\n", (UInt32) buf);
-			    else
-				IOLog("logic err in event/buf stuff\n");
-			}
-			break;
-		}
-	    }
-	    ****/
-	    event->release();
-	}
+    XTRACE(kLogDeleteEventList, check_contents, count);
+
+    while (eventlist != nil) {
+	TIrEvent *event = eventlist;
+	
+	eventlist = event->fPoolNext;
+	XTRACE(kLogDeleteEventList, 0, event);
+	XTRACE(kLogDeleteEventList, 0, event->fEvent);
+	event->release();
     }
-Fail:
-    return;
 
 } // DeleteEventListItems
 
@@ -228,46 +212,35 @@ TIrEvent::GrabEventBlock(ULong event, ULong size)
 {
 #pragma unused(size)
     TIrEvent* eventBlock = nil;
-    IrDAErr err;
     
-    require(gFreeEventList, Fail_New_EventBlock);
-    require(gInUseEventList, Fail_New_EventBlock);
+    if (!gEventListsReady) {
+	XTRACE(kLogGrabErr1, 0, 0);
+	goto Fail_New_EventBlock;
+    }
 
     check( size <= sizeof( TIrLargestEvent ) );
 	
-    if (gFreeEventList->GetArraySize() > 0) {
-	// Pull last one off list (more efficient that way)
-	eventBlock = (TIrEvent *)gFreeEventList->Last();
-	require(eventBlock, Fail_New_EventBlock);
+    if (gFreeEvents) {
+	// Pull the first one off the free list
+	eventBlock = IrEventPoolPop(gFreeEvents, gFreeEventCount);
 	check(eventBlock->fAllocated == false);
-	gFreeEventList->RemoveLast();
     }
     else {
 	// List is empty, so allocate a new one
-	XTRACE(kAllocateEventBlock, gInUseEventList->GetArraySize(), gFreeEventList->GetArraySize());
+	XTRACE(kAllocateEventBlock, gInUseEventCount, gFreeEventCount);
 	eventBlock = TIrLargestEvent::tIrLargestEvent();
 	require(eventBlock, Fail_New_EventBlock);
     }
     
-    err = gInUseEventList->InsertLast(eventBlock);      // keep a list of allocated events
-    ncheck(err);
-    if (err) {
-	XTRACE(kLogGrabErr1, err >> 16, err);
-	XTRACE(kLogGrabErr2, 0, gInUseEventList);
-	XTRACE(kLogGrabErr3, 0, gInUseEventList->GetArraySize());
-	/*for (int index = 0; index < gInUseEventList->GetArraySize(); index++ ) {
-	    ULong member;
-	    member = (ULong)gInUseEventList->At(index);
-	    XTRACE(kLogGrabErr3, member >> 16, member);
-	}*/
-    }
-    //check(CheckAllocated(eventBlock));
+    // keep a list of allocated events
+    IrEventPoolLink(gInUseEvents, gInUseEventCount, eventBlock);
 
     eventBlock->fEvent = (UByte)event;
     eventBlock->fClient = nil;
     eventBlock->fDest   = nil;
     eventBlock->fResult = noErr;
-    eventBlock->fAllocated = true;
+    eventBlock->fQueued = false;
+    eventBlock->fQueueNext = nil;
 
 Fail_New_EventBlock:
     XTRACE( kGrabEventBlock, 0, eventBlock);
@@ -286,31 +259,23 @@ TIrEvent::ReleaseEventBlock(TIrEvent * eventBlock)
 {
     XTRACE( kReleaseEventBlock, 0, eventBlock);
     require(eventBlock, Fail);
-    require(eventBlock->fAllocated == true, Fail);
-    
-    if (gInUseEventList) {          // take it off the in-use list
-	IrDAErr err;
-	err = gInUseEventList->Remove(eventBlock);
-	ncheck(err);
-	if (err) {
-	    XTRACE(kLogReleaseErr1, err >> 16, err);
-	    XTRACE(kLogReleaseErr2, 0, gInUseEventList);
-	    XTRACE(kLogReleaseErr3, 0, gInUseEventList->GetArraySize());
-	    /*
-	    for (int index = 0; index < gInUseEventList->GetArraySize(); index++ ) {
-		ULong member;
-		member = (ULong)gInUseEventList->At(index);
-		XTRACE(kLogReleaseErr3, member >> 16, member);
-	    }*/
-	}
+    if (eventBlock->fAllocated != true) {       // not grabbed, or released twice
+	XTRACE(kLogReleaseErr1, 0, eventBlock);
+	XTRACE(kLogReleaseErr3, gInUseEventCount, gFreeEventCount);
+	goto Fail;
+    }
+    if (eventBlock->fQueued) {                  // someone is about to run it, leave it alone
+	XTRACE(kLogReleaseErr2, 0, eventBlock);
+	goto Fail;
     }
     
-    eventBlock->fAllocated = false;
+    // take it off the in-use list
+    IrEventPoolUnlink(gInUseEvents, gInUseEventCount, eventBlock);
 	    
-    if (gFreeEventList) {           // add it to the free list
-	gFreeEventList->InsertLast(eventBlock);
+    if (gEventListsReady) {                     // add it to the free list
+	IrEventPoolPush(gFreeEvents, gFreeEventCount, eventBlock);
     }
-    else {                          // this probably won't happen anymore ...
+    else {                                      // this probably won't happen anymore ...
 	eventBlock->release();
     }
     
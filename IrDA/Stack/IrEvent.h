@@ -126,12 +126,16 @@ class TIrEvent : public OSObject
 
 	    UByte           fEvent;             // X
 	    UByte           fPendEvent;         // X LSAPConn saves original request here.
-	    UByte           fAllocated;         // debugging
-	    UByte           fPadByte2;
+	    UByte           fAllocated;         // on the in-use list (grabbed and not yet released)
+	    UByte           fQueued;            // on the TIrStream pending event fifo
 	    IrDAErr         fResult;            // <
 	    
 	    TIrStream       *fClient;           // Client who initiated this task
 	    TIrStream       *fDest;             // Sream where this event is posted
+	    
+	    TIrEvent        *fQueueNext;        // next event on the pending event fifo
+	    TIrEvent        *fPoolNext;         // next event on the free or in-use list
+	    TIrEvent        *fPoolPrev;         // previous event on the in-use list
 };
 
 
@@ -0,0 +1,154 @@
+/*
+    File:       IrEventQueue.h
+
+    Contains:   The intrusive lists behind the pending event fifo and the event block pool
+    
+*/
+
+
+#ifndef __IREVENTQUEUE_H
+#define __IREVENTQUEUE_H
+
+#include <libkern/OSTypes.h>
+
+//
+// TIrStream's pending event fifo and TIrEvent's free and in-use lists are linked
+// through the event blocks themselves, see TIrEvent::fQueueNext, fPoolNext and
+// fPoolPrev.  The link operations are templates over the event type so they only
+// need OSTypes.h, and can be built into a user space test with a stand-in event.
+//
+
+//--------------------------------------------------------------------------------
+//      IrEventFifoAdd
+//
+//      Adds the event at the tail.  An event can only be on the fifo once, so
+//      returns false (and changes nothing) if it is already queued.
+//--------------------------------------------------------------------------------
+template <class T>
+inline bool IrEventFifoAdd(T *&head, T *&tail, UInt32 &count, T *event)
+{
+    if (event->fQueued)
+	return false;
+	
+    event->fQueueNext = 0;
+    event->fQueued = true;
+    
+    if (tail) tail->fQueueNext = event;
+    else      head = event;
+    tail = event;
+    count++;
+    
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+//      IrEventFifoTake
+//
+//      Takes the event at the head off the fifo, or returns nil if it is empty.
+//--------------------------------------------------------------------------------
+template <class T>
+inline T *IrEventFifoTake(T *&head, T *&tail, UInt32 &count)
+{
+    T *event = head;
+    
+    if (event) {
+	head = event->fQueueNext;
+	if (head == 0) tail = 0;
+	event->fQueueNext = 0;
+	event->fQueued = false;
+	count--;
+    }
+    
+    return event;
+}
+
+//--------------------------------------------------------------------------------
+//      IrEventFifoRemoveDest
+//
+//      Unlinks every event posted to dest, keeping the others in order, and
+//      returns how many were removed.
+//--------------------------------------------------------------------------------
+template <class T, class D>
+inline UInt32 IrEventFifoRemoveDest(T *&head, T *&tail, UInt32 &count, const D *dest)
+{
+    T       *prev = 0;
+    T       *event = head;
+    UInt32  removed = 0;
+    
+    while (event != 0) {
+	T *next = event->fQueueNext;
+	
+	if (event->fDest == dest) {
+	    if (prev) prev->fQueueNext = next;
+	    else      head = next;
+	    if (tail == event) tail = prev;
+	    event->fQueueNext = 0;
+	    event->fQueued = false;
+	    count--;
+	    removed++;
+	}
+	else prev = event;
+	event = next;
+    }
+    
+    return removed;
+}
+
+//--------------------------------------------------------------------------------
+//      IrEventPoolPush, IrEventPoolPop
+//
+//      The free list, singly linked through fPoolNext.
+//--------------------------------------------------------------------------------
+template <class T>
+inline void IrEventPoolPush(T *&list, UInt32 &count, T *event)
+{
+    event->fPoolPrev = 0;
+    event->fPoolNext = list;
+    list = event;
+    count++;
+}
+
+template <class T>
+inline T *IrEventPoolPop(T *&list, UInt32 &count)
+{
+    T *event = list;
+    
+    if (event) {
+	list = event->fPoolNext;
+	event->fPoolNext = 0;
+	count--;
+    }
+    
+    return event;
+}
+
+//--------------------------------------------------------------------------------
+//      IrEventPoolLink, IrEventPoolUnlink
+//
+//      The in-use list, doubly linked through fPoolNext and fPoolPrev so a block
+//      can be taken off it without a search.  fAllocated says a block is on it.
+//--------------------------------------------------------------------------------
+template <class T>
+inline void IrEventPoolLink(T *&list, UInt32 &count, T *event)
+{
+    event->fPoolPrev = 0;
+    event->fPoolNext = list;
+    if (list) list->fPoolPrev = event;
+    list = event;
+    count++;
+    event->fAllocated = true;
+}
+
+template <class T>
+inline void IrEventPoolUnlink(T *&list, UInt32 &count, T *event)
+{
+    if (event->fPoolPrev) event->fPoolPrev->fPoolNext = event->fPoolNext;
+    else                  list = event->fPoolNext;
+    if (event->fPoolNext) event->fPoolNext->fPoolPrev = event->fPoolPrev;
+    event->fPoolNext = 0;
+    event->fPoolPrev = 0;
+    count--;
+    event->fAllocated = false;
+}
+
+#endif // __IREVENTQUEUE_H
@@ -10,6 +10,7 @@
 
 
 #include "IrLAP.h"
+#include "IrLAPFlowControl.h"
 #include "IrLMP.h"
 #include "CList.h"
 #include "IrGlue.h"
@@ -451,6 +452,7 @@ TIrLAP::Init(TIrGlue *irda, TIrQOS *myQOS, TIrQOS* peerQOS)
 
     fLeadInCount = fMyWindowSize = fPeerWindowSize  = 0;
     fPollTimerTimeout = fFinalTimerTimeout = fWatchdogTimeout = fMinTurnAroundTimeout = 0;  
+    fRemoteBusyDelay = 0;
     fPrimary = fPutReqsPending  = false;
     fNextCmdRspToSend = fLastCmdRsp = 0;
 
@@ -463,8 +465,8 @@ TIrLAP::Init(TIrGlue *irda, TIrQOS *myQOS, TIrQOS* peerQOS)
     
     fInputInProgress = fOutputInProgress = fInBrokenBeam  = false;
     
-    fGetBufferAvail = fNumGetBuffers = 0;
-    bzero(fGetBuffers, sizeof(fGetBuffers));
+    fGetBufferAvail = fNumGetBuffers = fGetBufferSlots = 0;
+    fGetBuffers = nil;
     fInputBuffer = nil;
     
     bzero(fNickName, sizeof(fNickName));
@@ -638,6 +640,12 @@ void TIrLAP::FreeGetBuffers()
     }
     fNumGetBuffers = 0;         // no longer have any buffers available
     fGetBufferAvail = 0;        // bitmask of available buffers is zero available now
+    
+    if (fGetBuffers) {          // and the array, it's sized for the next connection's window
+	IOFree(fGetBuffers, fGetBufferSlots * sizeof(CBufferSegment*));
+	fGetBuffers = nil;
+	fGetBufferSlots = 0;
+    }
 
 } // TIrLAP::FreeGetBuffers
 
@@ -1781,11 +1789,18 @@ void TIrLAP::HandlePriReceiveStateEvent(ULong event)
 	    if (fState == kIrLAPPriReceiveState) {
 		if (RecdFinal()) {
 		    // If received final, transmitting next (after min turnaround delay)
+		    // If the peer is busy give it time to drain its buffers before polling
+		    // again.  Back off while it stays busy and close back in once it has
+		    // been taking data, so a slow peer doesn't cost a stream of RR/RNR
+		    // exchanges and a quick one isn't left idle.
 		    if( fRecdCmdRsp == kIrLAPFrameRNR ) {
-			StartTimer(fPollTimerTimeout>>2, kIrTurnaroundTimerExpiredEvent);
+			StartTimer(fRemoteBusyDelay, kIrTurnaroundTimerExpiredEvent);
+			fRemoteBusyDelay = IrLAPRemoteBusyNextDelay(fRemoteBusyDelay, fPollTimerTimeout, true);
 		    }
-		    else
+		    else {
+			fRemoteBusyDelay = IrLAPRemoteBusyNextDelay(fRemoteBusyDelay, fPollTimerTimeout, false);
 			StartTimer(fMinTurnAroundTimeout, kIrTurnaroundTimerExpiredEvent);
+		    }
 //                  StartMinTurnAroundTimer( fMinTurnAroundTimeout, kIrTurnaroundTimerExpiredEvent);
 		}
 		else {
@@ -2816,6 +2831,7 @@ IrDAErr TIrLAP::ParseNegotiateAndInitConnState(Boolean primary)
 
     fWatchdogTimeout = fPeerQOS->GetMaxTurnAroundTime() + (fPeerQOS->GetMaxTurnAroundTime() >> 2);
     fMinTurnAroundTimeout = fPeerQOS->GetMinTurnAroundTime();
+    fRemoteBusyDelay = IrLAPRemoteBusyFirstDelay(fPollTimerTimeout);    // 1/4 turnaround, then adapts
     //DebugLog(" test - setting peer min ttime to 10 ms;g");
     //fMinTurnAroundTimeout = 10;       // TEST TEST TEST new hardware
 
@@ -2844,11 +2860,18 @@ IrDAErr TIrLAP::ParseNegotiateAndInitConnState(Boolean primary)
     fMyWindowSize = (UByte)fMyQOS->GetWindowSize();
 
     // Allocate receive buffers
-    numBuffers = fMyQOS->GetWindowSize() * 2;   // FIXME - post alpha allocate extra to avoid assert
+    numBuffers = IrLAPGetBufferCount(fMyQOS->GetWindowSize());  // FIXME - post alpha allocate extra to avoid assert
     bufferSize = fMyQOS->GetDataSize()+5;       // Add room for Addr, CNTL, CRC and 1 for DMA
 
-    check(numBuffers <= (sizeof(fGetBuffers) / sizeof(fGetBuffers[0])));    // sanity
-    check(numBuffers < 32);                                                 // bitmask allocation
+    check(fGetBuffers == nil);                                              // freed at disconnect
+    
+    // Allocate the array sized from the negotiated window
+    result = kIrDAErrNoMemory;
+    fGetBuffers = (CBufferSegment**)IOMalloc(numBuffers * sizeof(CBufferSegment*));
+    XREQUIRE(fGetBuffers, Fail_BufferItem_New);
+    bzero(fGetBuffers, numBuffers * sizeof(CBufferSegment*));
+    fGetBufferSlots = numBuffers;
+    
     // Allocate buffers for receiving data
     for (fGetBufferAvail = 0, fNumGetBuffers = 0; fNumGetBuffers < numBuffers; fNumGetBuffers++) {
 	// Allocate, init buffer segment and check for errors
@@ -2858,7 +2881,7 @@ IrDAErr TIrLAP::ParseNegotiateAndInitConnState(Boolean primary)
 
 	// Add next buffer list
 	fGetBuffers[fNumGetBuffers] = bufferItem;
-	fGetBufferAvail |= (ULong) (1 << fNumGetBuffers);
+	IrLAPGetBufferGive(fGetBufferAvail, fNumGetBuffers);
     }
 
     // First my info
@@ -3174,22 +3197,18 @@ void TIrLAP::StartDataReceive()
     }
 
     else {
-	ULong flags;            // better not have more than 32 buffers 
 	ULong index;
 
 	// Set default in case no available buffer was found
 	inputBuffer = fIOBufferItem;            // use this if "local busy" condition
 
 	// Find and use an available buffer
-	for (index = 0, flags = 1; index < fNumGetBuffers; index++, flags <<= 1) {
-	    if (fGetBufferAvail & flags) {              // if this buffer free
-		fGetBufferAvail &= ~flags;              // allocate the buffer
-		inputBuffer = fGetBuffers[index];
-		//fNeedNewInputBuffer = false;
-		XTRACE(kLogStartDataRcv1, 0, inputBuffer);
-		XTRACE(kLogStartDataRcv2, flags, index);
-		break;
-	    }
+	index = IrLAPGetBufferTake(fGetBufferAvail, fNumGetBuffers);
+	if (index < fNumGetBuffers) {
+	    inputBuffer = fGetBuffers[index];
+	    //fNeedNewInputBuffer = false;
+	    XTRACE(kLogStartDataRcv1, 0, inputBuffer);
+	    XTRACE(kLogStartDataRcv2, 1 << index, index);
 	}
     }
 
@@ -3222,7 +3241,7 @@ void TIrLAP::ReleaseInputBuffer(CBufferSegment* inputBuffer)
 	if (fGetBuffers[index] == inputBuffer) {
 	    // Check for releasing a buffer twice
 	    XASSERT((fGetBufferAvail & flags) == 0);
-	    fGetBufferAvail |= flags;
+	    IrLAPGetBufferGive(fGetBufferAvail, index);
 	    bufferFound = true;
 	    XTRACE(kLogReleaseInputBuffer2, flags, index);
 	}
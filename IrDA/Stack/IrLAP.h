@@ -522,6 +522,7 @@ class TIrLAP : public TIrStream
 	    TTimeout        fFinalTimerTimeout;
 	    TTimeout        fWatchdogTimeout;
 	    TTimeout        fMinTurnAroundTimeout;
+	    TTimeout        fRemoteBusyDelay;       // Wait before polling a peer that sent RNR, adapts to how long it stays busy
 
 	    Boolean         fPrimary;
 	    //Boolean       fNeedNewInputBuffer;    // if fInputBuffer is nil, then we need a new one
@@ -552,8 +553,9 @@ class TIrLAP : public TIrStream
 
 	    ULong           fGetBufferAvail;
 	    ULong           fNumGetBuffers;
-	    CBufferSegment* fGetBuffers[15];        // Was 8, have 2*window for
+	    ULong           fGetBufferSlots;        // Size of fGetBuffers, 2*window for
 						    // a workaround
+	    CBufferSegment** fGetBuffers;           // Allocated at connect from the negotiated window
 
 	    CBufferSegment* fInputBuffer;           // either fIOBufferItem or one of fGetBuffers
 	    //CList         fPendingPuts;
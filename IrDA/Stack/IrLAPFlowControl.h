@@ -0,0 +1,104 @@
+/*
+    File:       IrLAPFlowControl.h
+
+    Contains:   The RNR backoff and the receive buffer bookkeeping behind TIrLAP
+    
+*/
+
+
+#ifndef __IRLAPFLOWCONTROL_H
+#define __IRLAPFLOWCONTROL_H
+
+#include <libkern/OSTypes.h>
+
+//
+// TIrLAP's remote busy delay and its pool of get buffers are kept here as plain inline
+// functions over the values TIrLAP keeps (fRemoteBusyDelay, fPollTimerTimeout,
+// fGetBufferAvail and fNumGetBuffers), so they only need OSTypes.h and can be driven by a
+// user space test.  Timeouts are positive milliseconds, as TTimeout is for the poll timer.
+//
+
+enum {
+    kIrLAPMaxGetBuffers     = 31        // fGetBufferAvail is a 32 bit mask, keep clear of the sign bit
+};
+
+//--------------------------------------------------------------------------------
+//      IrLAPRemoteBusyFirstDelay
+//
+//      The wait before polling a peer that answered RNR, at the start of a
+//      connection: a quarter of the poll timeout, the fixed delay it replaced.
+//--------------------------------------------------------------------------------
+inline SInt32 IrLAPRemoteBusyFirstDelay(SInt32 pollTimeout)
+{
+    return pollTimeout >> 2;
+}
+
+//--------------------------------------------------------------------------------
+//      IrLAPRemoteBusyNextDelay
+//
+//      Adapts the delay after a final response.  Doubles while the peer stays
+//      busy, up to the poll timeout, and halves once it takes data, down to
+//      1/16 of the poll timeout.
+//--------------------------------------------------------------------------------
+inline SInt32 IrLAPRemoteBusyNextDelay(SInt32 delay, SInt32 pollTimeout, bool peerBusy)
+{
+    SInt32  floor = pollTimeout >> 4;
+    
+    delay = peerBusy ? (delay << 1) : (delay >> 1);
+    
+    if (delay < floor)       delay = floor;
+    if (delay > pollTimeout) delay = pollTimeout;
+    
+    return delay;
+}
+
+//--------------------------------------------------------------------------------
+//      IrLAPGetBufferCount
+//
+//      How many get buffers to allocate for my receive window, twice the window
+//      so that a window can be received while the last one is still upstream.
+//--------------------------------------------------------------------------------
+inline UInt32 IrLAPGetBufferCount(UInt32 windowSize)
+{
+    UInt32  count = windowSize * 2;
+    
+    return (count > (UInt32)kIrLAPMaxGetBuffers) ? (UInt32)kIrLAPMaxGetBuffers : count;
+}
+
+//--------------------------------------------------------------------------------
+//      IrLAPGetBufferTake
+//
+//      Marks the lowest numbered free buffer in use and returns its index, or
+//      returns count (and changes nothing) if all of them are in use.
+//--------------------------------------------------------------------------------
+inline UInt32 IrLAPGetBufferTake(UInt32 &avail, UInt32 count)
+{
+    UInt32  index;
+    UInt32  flag;
+    
+    for (index = 0, flag = 1; index < count; index++, flag <<= 1) {
+	if (avail & flag) {
+	    avail &= ~flag;
+	    break;
+	}
+    }
+    
+    return index;
+}
+
+//--------------------------------------------------------------------------------
+//      IrLAPGetBufferGive
+//
+//      Marks a buffer free again.  Returns false if it already was.
+//--------------------------------------------------------------------------------
+inline bool IrLAPGetBufferGive(UInt32 &avail, UInt32 index)
+{
+    UInt32  flag = (UInt32)1 << index;
+    bool    wasInUse = (avail & flag) == 0;
+    
+    avail |= flag;
+    
+    return wasInUse;
+}
+
+#endif // __IRLAPFLOWCONTROL_H
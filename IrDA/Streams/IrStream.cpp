@@ -7,8 +7,8 @@
 */
 
 #include "IrStream.h"
-#include "CList.h"
 #include "IrEvent.h"
+#include "IrEventQueue.h"
 
 #if (hasTracing > 0 && hasIrStreamTracing > 0)
 
@@ -100,17 +100,17 @@ static
 EventTraceCauseDesc TraceEvents[] = {
     {kLogCreate,            "IrStream: create, obj="},
     {kLogFree,              "IrStream: free, obj="},
-    {kLogFreeQueue,         "IrStream: clist retain=, length="},
+    {kLogFreeQueue,         "IrStream: pending events="},
     {kLogInit,              "IrStream: init, obj="},
     {kLogInit2,             "IrStream: qtrace array="},
     {kLogInit3,             "IrStream: qtrace index="},
-    {kLogNewEventList,      "IrStream: new clist, obj="},
-    {kLogRetainEventList,   "IrStream: clist retain, new count="},
+    {kLogNewEventList,      "IrStream: pending event fifo empty"},
+    {kLogRetainEventList,   "IrStream: pending event fifo in use, length="},
     {kLogEnqueue,           "IrStream: enqueue irevent="},
     {kLogEnqueueThis,       "IrStream: enqueued for obj="},
     {kLogEventRecordRun,    "IrStream: run of event record at"},
     
-    {kLogCleanup1,          "IrStream: nuking event queued for us on queue"},
+    {kLogCleanup1,          "IrStream: nuking events queued for us, count="},
     {kLogCleanup2,          "IrStream: nuking event queued for us on fNextEvent"},
     
     {kGenericEnqueue,       "IrStream: Generic Enqueue Event, event="},
@@ -196,8 +196,9 @@ EventTraceCauseDesc TraceEvents[] = {
 // Define the static fields here, or the dynamic loader doesn't find them.
 //--------------------------------------------------------------------------------
 TIrEvent    *TIrStream::fCurrentEvent;          // event we're running (not on the queue)
-TIrEvent    *TIrStream::fNextEvent;             // slight optimization to keep next event off the fifo
-CList       *TIrStream::fPendingEventsList;     // add to front, take from last, event FIFO
+TIrEvent    *TIrStream::fPendingHead;           // event FIFO, take from the head
+TIrEvent    *TIrStream::fPendingTail;           //  and add at the tail
+UInt32      TIrStream::fPendingCount;           // number of events on the fifo
 
 //--------------------------------------------------------------------------------
 //      free
@@ -205,51 +206,17 @@ CList       *TIrStream::fPendingEventsList;     // add to front, take from last,
 void
 TIrStream::free()
 {
-    int list_retain_count;
+    UInt32 removed;
 
     XTRACE(kLogFree, 0, this);
+    XTRACE(kLogFreeQueue, 0, fPendingCount);
     
-    // should have a pending events list until the last stream is freed
-    require(fPendingEventsList, Fail);
-    
-    // Free the pending events list
-    list_retain_count = fPendingEventsList->getRetainCount();
-    XTRACE(kLogFreeQueue, list_retain_count, fPendingEventsList->GetArraySize());
-
-    fPendingEventsList->release();  // this stream doesn't need the list anymore
-    
-    if (list_retain_count == 1) {   // if retain count was one, then we just freed it
-	fPendingEventsList = nil;
-    }
-    
-    // this stream is going away, let's go over the (static) pending event list and
+    // this stream is going away, let's go over the (static) pending event fifo and
     // nuke anything that's queued up for us.  This doesn't normally happen unless
     // we're stopped in the middle of doing stuff.
+    removed = IrEventFifoRemoveDest(fPendingHead, fPendingTail, fPendingCount, this);
+    if (removed) XTRACE(kLogCleanup1, 0, removed);
     
-    // first check the clist (which may have just been freed)
-    if (fPendingEventsList != nil && fPendingEventsList->GetArraySize() > 0) {
-	int index;
-	// go over the list backwards to make deleting easier
-	for (index = fPendingEventsList->GetArraySize()-1; index >= 0; index--) {
-	    TIrEvent *event = (TIrEvent *)fPendingEventsList->At(index);
-	    if (event && event->fDest == this) {
-		XTRACE(kLogCleanup1, 0, event);
-		fPendingEventsList->RemoveAt(index);        // just remove it from the list
-	    }
-	}
-    }
-    // then check fNextEvent
-    if (fNextEvent && fNextEvent->fDest == this) {
-	XTRACE(kLogCleanup2, 0, fNextEvent);
-	// could call DequeueEvent, but I don't want to clobber fCurrentEvent
-	if (fPendingEventsList) {
-	    fNextEvent = (TIrEvent *)fPendingEventsList->Last();
-	    if (fNextEvent) fPendingEventsList->RemoveLast();
-	}
-	else fNextEvent = nil;
-    }
-    
-Fail:
     super::free();
 
 } // free
@@ -268,16 +235,13 @@ Boolean TIrStream::Init(TIrGlue *irda, EventTraceCauseDesc *trace, UInt16 index)
     
     fIrDA = irda;                       // save this for all our derived classes (make static?)
 
-    if (fPendingEventsList == nil) {    // if first IrStream to get init'd
-	fPendingEventsList = CList::cList();    // create the pending event list
-	require(fPendingEventsList, Fail);
-	XTRACE(kLogNewEventList, 0, fPendingEventsList);
-	check(fCurrentEvent == nil);
-	check(fNextEvent == nil);
+    // the pending event fifo is static and needs no setup, just note if someone left events on it
+    if (fPendingHead == nil) {
+	XTRACE(kLogNewEventList, 0, 0);
+	check(fPendingTail == nil && fPendingCount == 0);
     }
-    else {                              // if not the first stream, then incr the
-	fPendingEventsList->retain();       // list's in-use count!
-	XTRACE(kLogRetainEventList, 0, fPendingEventsList->getRetainCount());
+    else {
+	XTRACE(kLogRetainEventList, 0, fPendingCount);
     }
     
 #if (hasTracing > 0 && hasIrStreamTracing > 0)
@@ -316,19 +280,14 @@ IrDAErr TIrStream::EnqueueEvent(TIrEvent *eventBlock)
     
     require(eventNum > 0 && eventNum <= kIrMaxEventNumber, Fail);
 
+    // Check for cases where the same event block is being enqueued more than once, the
+    // fifo is linked through the event so it can only be on it once
+    require(eventBlock->fQueued == false, Fail);
+
     eventBlock->fDest = this;           // single queue, so keep track of destination
     
-    if (fNextEvent == nil) {
-	fNextEvent = eventBlock;
-    }
-    else {
-	// Check for cases where the same event block is being enqueued more than once
-	// Although this won't catch cases where the same event block is put on the list
-	check(eventBlock != fNextEvent);
-
-	// Add the event to the pending events list
-	fPendingEventsList->InsertFirst(eventBlock);
-    }
+    // Add the event to the end of the pending events fifo
+    IrEventFifoAdd(fPendingHead, fPendingTail, fPendingCount, eventBlock);
 
     //XASSERT(fIrDA);
     //fIrDA->NextStateMachine(this);
@@ -347,19 +306,8 @@ Fail:
 /*static*/
 void TIrStream::DequeueEvent()
 {
-    require(fPendingEventsList, Fail);
-    
-    // Next event becomes the current event
-    fCurrentEvent = fNextEvent;
-
-    // Take next event from the pending events list (if any)
-    fNextEvent = (TIrEvent *)fPendingEventsList->Last();
-    if (fNextEvent) {
-	fPendingEventsList->RemoveLast();
-    }
-
-Fail:
-    return;
+    // Take the next event off the front of the fifo (if any), it becomes the current event
+    fCurrentEvent = IrEventFifoTake(fPendingHead, fPendingTail, fPendingCount);
 
 } // TIrStream::DequeueEvent
 
@@ -44,11 +44,12 @@ protected:
 	    TIrGlue         *fIrDA;                         // most stream objects need to get back to glue
 
 private:
-	    static void         DequeueEvent();             // get the next event to run from fNextEvent or the fifo
+	    static void         DequeueEvent();             // get the next event to run off the fifo
 
 	    static TIrEvent     *fCurrentEvent;             // event we're running (not on the queue)
-	    static TIrEvent     *fNextEvent;                // slight optimization to keep next event off the fifo
-	    static CList        *fPendingEventsList;        // add to front, take from last, event FIFO
+	    static TIrEvent     *fPendingHead;              // event FIFO, linked through TIrEvent::fQueueNext,
+	    static TIrEvent     *fPendingTail;              //  add at the tail, take from the head
+	    static UInt32       fPendingCount;              // number of events on the fifo
 		    
 #if (hasTracing > 0 && hasIrStreamTracing > 0)
 	    EventTraceCauseDesc *   fTraceArray;            // Used by funky qtrace macro
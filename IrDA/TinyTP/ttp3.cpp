@@ -114,7 +114,6 @@ TTPBuf *
 TTinyTP::GetSegment(int i, TTPBuf *ttpbuf)      // extract segment
 {
     TTPBuf *seg;        // the segment wrapper
-    unsigned char *newBase;     // pointer to start of segment
     int length;                 // length of the segment
 
     check(ttpbuf);
@@ -126,8 +125,7 @@ TTinyTP::GetSegment(int i, TTPBuf *ttpbuf)      // extract segment
 	length = MaxSegSize;        // max length of a segment
     check(length);
     
-    newBase = BufBase(ttpbuf) + (i * MaxSegSize);       // starting point
-    seg = CBufferSegment::New(newBase, length);     // wrap a cbuffer around the block
+    seg = CBufferSegment::New(ttpbuf, i * MaxSegSize, length);     // wrap a cbuffer around the block
     check(seg);
     
     return seg;
@@ -166,7 +166,8 @@ ttp_pdu_connect_get_max_sdu_size(unsigned char *plist, UInt32 *max)
 
 // Make a Data PDU for sending on to LMP
 // data can be nil if sending a dataless pdu for flow control
-//   ***** This needs to be REWRITTEN w/out a buffer copy!
+// If the client left room for the header the data isn't copied, the header byte
+// is put in front of it and the caller's buffer is returned (with a new reference)
 TTPBuf *
 ttp_pdu_data(Boolean m, int credit, TTPBuf *data)
 {   int len;
@@ -175,13 +176,19 @@ ttp_pdu_data(Boolean m, int credit, TTPBuf *data)
 
     XTRACE(kPduData, m, credit);
     
+    byte = credit & 0x7f;           // sanity check credit
+    if (m) byte |= 0x80;            // turn on more bit if needed
+    
+    if (data && data->Prepend(&byte, kTTPDataHeaderSize)) {
+	data->retain();             // queue owns one ref, the client frees the other
+	return data;                // mark is already at the start
+    }
+    
     if (data) len = BufSize(data);      // current length of userdata
     else      len = 0;
     outbuf = BufAlloc(1 + len);     // make a new one with just the right size
     require(outbuf, NoMem);
 
-    byte = credit & 0x7f;           // sanity check credit
-    if (m) byte |= 0x80;            // turn on more bit if needed
     BufPut(outbuf, byte);           // set TTP overhead byte (overridden later)
     
     if (len) {                      // if have data to copy
@@ -32,8 +32,13 @@ ttp_pdu_connect_get_max_sdu_size(unsigned char *buf, UInt32 *maxsize);
 // Data PDU
 //
 
-// returns a new TTPBuf with the flag byte at the start, any data appended
-//   this needs to be designed better!
+enum {
+    kTTPDataHeaderSize = 1          // room to leave (via BufHideStart) in front of data for ttp_pdu_data
+};
+
+// returns a TTPBuf with the flag byte at the start, any data appended.  If data has
+// kTTPDataHeaderSize bytes of room in front, the byte goes there and data itself is
+// returned with another reference, otherwise the data is copied to a new buffer.
 TTPBuf *
 ttp_pdu_data(Boolean m, int credit, TTPBuf *data);
 
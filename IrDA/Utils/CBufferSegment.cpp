@@ -51,6 +51,9 @@ EventTraceCauseDesc TraceEvents[] = {
 #define super CBuffer
     OSDefineMetaClassAndStructors(CBufferSegment, CBuffer);
 
+static UInt32   gCBufferCopies;         // number of Getn/Putn payload copies
+static UInt32   gCBufferCopyBytes;      // and the bytes they moved
+
 
 //--------------------------------------------------------------------------------
 //      CBufferSegment::New
@@ -91,6 +94,31 @@ CBufferSegment * CBufferSegment::New(UByte *buffer, Size len)
     return obj;
 }
 
+//--------------------------------------------------------------------------------
+//      CBufferSegment::New
+//          Wrap len bytes of parent starting at offset (from the parent's current
+//          base) without copying them.  The parent is retained until the slice
+//          is freed, so the slice can be queued after the caller lets go of the
+//          parent.  The slice has no header room of its own.
+//--------------------------------------------------------------------------------
+CBufferSegment * CBufferSegment::New(CBufferSegment *parent, Size offset, Size len)
+{
+    CBufferSegment *obj;
+    
+    require(parent, Fail);
+    require(offset + len <= parent->GetSize(), Fail);
+    
+    obj = New(parent->GetBufferPtr() + offset, len);
+    if (obj) {
+	parent->retain();
+	obj->fParent = parent;
+    }
+    return obj;
+    
+Fail:
+    return nil;
+}
+
 //--------------------------------------------------------------------------------
 //      CBufferSegment::Delete
 //          Old naming style, just calls release
@@ -121,6 +149,11 @@ CBufferSegment::free(void)
 	fSize = 0;
     }
     
+    if (fParent) {
+	fParent->release();
+	fParent = nil;
+    }
+    
     super::free();
 }
 
@@ -133,6 +166,7 @@ Boolean CBufferSegment::Init(UByte *buffer, Size len)
     XTRACE(kLogCBInit1, 0, len);
     
     fBufBase = nil;
+    fParent = nil;
     
     if (!super::init()) return false;
     
@@ -217,6 +251,8 @@ Size CBufferSegment::Getn(UByte* p, Size n)
 	    {
 	    BlockMove(fMark, p, n);
 	    fMark += n;
+	    gCBufferCopies++;
+	    gCBufferCopyBytes += n;
 	    }
 	}
 
@@ -266,6 +302,8 @@ Size CBufferSegment::Putn(const UByte* p, Size n)
 	    {
 	    BlockMove(p, fMark, n);
 	    fMark += n;
+	    gCBufferCopies++;
+	    gCBufferCopyBytes += n;
 	    }
 	}
 
@@ -293,6 +331,37 @@ int CBufferSegment::CopyIn(const UByte* p, Size& n)
 } // CBufferSegment::CopyIn
 
 
+//--------------------------------------------------------------------------------
+//      CBufferSegment::Prepend
+//          Grow the buffer n bytes at the front into the room left by an
+//          earlier Hide(n, kPosBeg) and put the header there.  Leaves the
+//          mark at the (new) start.
+//--------------------------------------------------------------------------------
+Boolean CBufferSegment::Prepend(const UByte* p, Size n)
+{
+    if (n > GetHeadroom())
+	return false;
+
+    fBase -= n;
+    BlockMove(p, fBase, n);
+    fMark = fBase;
+
+    return true;
+
+} // CBufferSegment::Prepend
+
+
+//--------------------------------------------------------------------------------
+//      CBufferSegment::GetCopyStats
+//--------------------------------------------------------------------------------
+void CBufferSegment::GetCopyStats(UInt32 *copies, UInt32 *bytes)
+{
+    if (copies) *copies = gCBufferCopies;
+    if (bytes)  *bytes = gCBufferCopyBytes;
+
+} // CBufferSegment::GetCopyStats
+
+
 //--------------------------------------------------------------------------------
 //      CBufferSegment::Reset
 //--------------------------------------------------------------------------------
@@ -25,6 +25,7 @@ public:
 
     static CBufferSegment * New(Size len = kDefaultCBufferSize);    // allocate and init a buffer of size len
     static CBufferSegment * New(UByte *buffer, Size len);           // use existing buffer, don't alloc or free it
+    static CBufferSegment * New(CBufferSegment *parent, Size offset, Size len); // slice of parent, keeps parent retained
     void free();
     void Delete();                  // old style, same as release() for now ...
 
@@ -55,6 +56,15 @@ public:
     virtual Size    GetSize(void) const;
     virtual Boolean AtEOF(void) const;
 
+    // header room, lets a lower layer add its header in front of the data without a copy
+
+    Boolean     Prepend(const UByte* p, Size n);    // false if there isn't n bytes of room in front
+    Size        GetHeadroom(void) const;
+
+    // payload copies made by Getn/Putn, to see how often the data path touches the data
+
+    static void GetCopyStats(UInt32 *copies, UInt32 *bytes);
+
     // direct access for ... (needed anymore?)
 
     UByte*      GetBufferPtr(void);
@@ -66,6 +76,7 @@ private:
     Boolean Init(UByte *buffer, Size len);
 
     Boolean         fFreeMe;        // true if we allocated the buffer
+    CBufferSegment  *fParent;       // buffer we're a slice of, retained until we're freed
 
     UByte*          fBufBase;
     UByte*          fBufEnd;
@@ -89,6 +100,7 @@ inline Size CBufferSegment::GetBufferSize()
     { return (Size) (fEnd - fBase); }
     
 inline UInt8 *  CBufferSegment::GetBufferBase() { return fBufBase; }
+inline Size     CBufferSegment::GetHeadroom() const { return (Size) (fBase - fBufBase); }
 inline void     CBufferSegment::Delete(void)    { this->release(); return; }
 
 #endif  /*  __BUFFERSEGMENT_H   */
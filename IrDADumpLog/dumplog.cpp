@@ -171,6 +171,13 @@ DumpLocalLog()
 		DumpLog();
 	    }
 	    else printf("command/request failed 0x%x\n", kr);
+	    
+	    UInt32 copyStats[2];        // IrDACopyStats, copies and bytes
+	    size_t copyStatsSize = sizeof(copyStats);
+	    
+	    kr = doCommand(conObj, 0x16, NULL, 0, &copyStats, &copyStatsSize);     // kIrDAUserCmd_GetCopyStats
+	    if (kr == kIOReturnSuccess)
+		printf("buffer copies %u, bytes copied %u\n", (unsigned int)copyStats[0], (unsigned int)copyStats[1]);
 	    closeDevice(conObj);
 	}
 	else printf("open device failed 0x%x\n", kr);
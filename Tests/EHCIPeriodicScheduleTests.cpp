@@ -0,0 +1,459 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	EHCIPeriodicScheduleTests
+//
+//	Drives the placement code in EHCIPeriodicSchedule.h the way AllocateInterruptBandwidth,
+//	AllocateIsochBandwidth and FindStartFrameAndStartTime do, first with hand built schedules
+//	that check the individual rules, then with random mixes of devices admitted one after the
+//	other with both policies, so the two can be compared.
+//
+//================================================================================================
+
+#include "USBTestHarness.h"
+#include "../AppleUSBEHCI/Headers/EHCIPeriodicSchedule.h"
+
+// From USBEHCI.h and AppleUSBEHCI::GetHSSplitLoad, which need the kernel headers
+enum
+{
+	kHSLimit						= 6000,				// kEHCIHSMaxPeriodicBytesPeruFrame
+	kHSThinkTime					= 100,				// _controllerThinkTime
+	kHSSplitSameDirectionOverhead	= 39,
+	kHSSplitChangeDirectionOverhead	= 29,
+	kHSDataSameDirectionOverhead	= 19,
+	kHSDataChangeDirectionOverhead	= 9,
+	kHSHandshakeOverhead			= 7,
+	kFSSplitInterruptOverhead		= 13,
+	kFSSplitIsochOverhead			= 9
+};
+
+//================================================================================================
+//	High speed phase selection
+//================================================================================================
+
+static void
+TestHSEmptySchedule(void)
+{
+	EHCIScheduleHSTable		used;
+	UInt32					phase = 99;
+
+	bzero(used, sizeof(used));
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 8, 1024, kHSLimit, kEHCISchedulePolicyFirstFit, &phase));
+	USBTestCheckEqual(phase, 0);
+	phase = 99;
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 8, 1024, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheckEqual(phase, 0);
+
+	// an interval of 0 is treated as every microframe, and one longer than the schedule as the whole schedule
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 0, 1024, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheckEqual(phase, 0);
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 4096, 1024, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheck(phase < kEHCIScheduleSlots);
+}
+
+// The original placement only looked at the first instance of each phase
+static void
+TestHSLaterInstances(void)
+{
+	EHCIScheduleHSTable		used;
+	UInt32					phase = 99;
+
+	bzero(used, sizeof(used));
+	used[2][0] = kHSLimit;								// slot 16, the second instance of phase 0 for an interval of 16
+
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 16, 512, kHSLimit, kEHCISchedulePolicyFirstFit, &phase));
+	USBTestCheckEqual(phase, 0);						// and it would not fit there
+
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 16, 512, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheck(phase != 0);
+	for ( UInt32 slot = phase; slot < kEHCIScheduleSlots; slot += 16 )
+		USBTestCheck(used[slot / kEHCIScheduleuFrames][slot % kEHCIScheduleuFrames] + 512 <= kHSLimit);
+}
+
+static void
+TestHSLowestPeak(void)
+{
+	EHCIScheduleHSTable		used;
+	UInt32					phase = 99;
+
+	// every microframe has 3000 bytes except uFrame 5 of every frame, which has 1000 and one instance at 2000
+	for ( int frame = 0; frame < kEHCIScheduleFrames; frame++ )
+		for ( int uFrame = 0; uFrame < kEHCIScheduleuFrames; uFrame++ )
+			used[frame][uFrame] = (uFrame == 5) ? 1000 : 3000;
+	used[7][5] = 2000;
+
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 8, 1000, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheckEqual(phase, 5);
+
+	// with an interval of 64 the frames are split into 8 groups, and the one without frame 7 wins
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 64, 1000, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheckEqual(phase % kEHCIScheduleuFrames, 5);
+	USBTestCheck((phase / kEHCIScheduleuFrames) != 7);
+}
+
+static void
+TestHSFull(void)
+{
+	EHCIScheduleHSTable		used;
+	UInt32					phase = 99;
+
+	for ( int frame = 0; frame < kEHCIScheduleFrames; frame++ )
+		for ( int uFrame = 0; uFrame < kEHCIScheduleuFrames; uFrame++ )
+			used[frame][uFrame] = kHSLimit - 100;
+
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 8, 100, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+	USBTestCheck(!EHCIScheduleFindHSPhase(used, 8, 101, kHSLimit, kEHCISchedulePolicyBestFit, &phase));
+
+	// first fit always names a phase, the caller finds out it doesn't fit when it reserves the bandwidth
+	USBTestCheck(EHCIScheduleFindHSPhase(used, 8, 101, kHSLimit, kEHCISchedulePolicyFirstFit, &phase));
+}
+
+//================================================================================================
+//	Split endpoints
+//================================================================================================
+
+static void
+SetHSLoad(EHCIScheduleHSLoad *hsLoad, const EHCIScheduleHSTable used, bool input, bool isochronous)
+{
+	hsLoad->used = used;
+	hsLoad->limit = kHSLimit;
+	if ( !input )
+	{
+		hsLoad->SSoverhead = kHSSplitSameDirectionOverhead + kHSDataSameDirectionOverhead + kHSThinkTime;
+		hsLoad->CSoverhead = isochronous ? 0 : kHSSplitChangeDirectionOverhead + kHSHandshakeOverhead + kHSThinkTime;
+	}
+	else
+	{
+		hsLoad->SSoverhead = kHSSplitSameDirectionOverhead + kHSThinkTime;
+		hsLoad->CSoverhead = kHSSplitChangeDirectionOverhead + kHSDataChangeDirectionOverhead + kHSThinkTime;
+	}
+}
+
+static void
+SetSplitRequest(EHCIScheduleSplitRequest *request, UInt16 maxPacketSize, UInt8 period, bool isochronous, bool input)
+{
+	request->maxPacketSize = maxPacketSize;
+	request->FSBytesUsed = ((maxPacketSize * 7) / 6) + (isochronous ? kFSSplitIsochOverhead : kFSSplitInterruptOverhead);
+	request->period = period;
+	request->isochronous = isochronous;
+	request->input = input;
+}
+
+static void
+TestSplitFootprint(void)
+{
+	EHCIScheduleHSTable			used;
+	EHCIScheduleHSLoad			hsLoad;
+	EHCIScheduleSplitRequest	request;
+	EHCIScheduleSplitFootprint	footprint;
+
+	bzero(used, sizeof(used));
+
+	// isoch OUT: one SS per 188 bytes, no CS
+	SetSplitRequest(&request, 376, 1, true, false);
+	SetHSLoad(&hsLoad, used, false, true);
+	EHCIScheduleSplitFootprintAt(&request, &hsLoad, kEHCIScheduleFSMinStartTime, &footprint);
+	USBTestCheckEqual(footprint.numSS, 2);
+	USBTestCheckEqual(footprint.numCS, 0);
+	USBTestCheckEqual(footprint.count, 2);
+	USBTestCheckEqual(footprint.uFrame[0], -1);
+	USBTestCheckEqual(footprint.bytes[0], hsLoad.SSoverhead + kEHCIScheduleFSBytesPeruFrame);
+
+	// interrupt IN early in the frame: one SS and three CS
+	SetSplitRequest(&request, 8, 8, false, true);
+	SetHSLoad(&hsLoad, used, true, false);
+	EHCIScheduleSplitFootprintAt(&request, &hsLoad, kEHCIScheduleFSMinStartTime, &footprint);
+	USBTestCheckEqual(footprint.numSS, 1);
+	USBTestCheckEqual(footprint.numCS, 3);
+	USBTestCheckEqual(footprint.count, 4);
+
+	// interrupt IN starting in microframe 6: only two CS are left
+	EHCIScheduleSplitFootprintAt(&request, &hsLoad, 6 * kEHCIScheduleFSBytesPeruFrame, &footprint);
+	USBTestCheckEqual(footprint.numCS, 2);
+}
+
+static void
+TestSplitTTLimits(void)
+{
+	EHCIScheduleSplitRequest	request;
+	UInt16						startTimes[kEHCIScheduleFrames];
+	UInt16						FStimeUsed[kEHCIScheduleFrames];
+	UInt8						startFrame = 0xFF;
+	UInt16						startTime = 0;
+
+	for ( int frame = 0; frame < kEHCIScheduleFrames; frame++ )
+	{
+		FStimeUsed[frame] = 0;
+		startTimes[frame] = kEHCIScheduleFSMinStartTime;
+	}
+
+	// a large isoch packet fits once per frame
+	SetSplitRequest(&request, 600, 1, true, true);
+	USBTestCheck(EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0, NULL, kEHCISchedulePolicyBestFit, &startFrame, &startTime));
+	USBTestCheck(!EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0xFFFFFFFF, NULL, kEHCISchedulePolicyBestFit, &startFrame, &startTime));
+
+	// every 2 frames, with the even frames holding a large isoch, only frame 1 is left
+	SetSplitRequest(&request, 600, 2, true, true);
+	USBTestCheck(EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0x55555555, NULL, kEHCISchedulePolicyBestFit, &startFrame, &startTime));
+	USBTestCheckEqual(startFrame, 1);
+	USBTestCheck(EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0x55555555, NULL, kEHCISchedulePolicyFirstFit, &startFrame, &startTime));
+	USBTestCheckEqual(startFrame, 1);
+
+	// the FS frame is full in every frame of the only harmonic
+	SetSplitRequest(&request, 64, 1, false, true);
+	for ( int frame = 0; frame < kEHCIScheduleFrames; frame++ )
+		FStimeUsed[frame] = kEHCIScheduleFSMaxFrameBytes - 10;
+	USBTestCheck(!EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0, NULL, kEHCISchedulePolicyBestFit, &startFrame, &startTime));
+	USBTestCheck(!EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0, NULL, kEHCISchedulePolicyFirstFit, &startFrame, &startTime));
+}
+
+static void
+TestSplitLowestPeak(void)
+{
+	EHCIScheduleSplitRequest	request;
+	EHCIScheduleHSTable			used;
+	EHCIScheduleHSLoad			hsLoad;
+	UInt16						startTimes[kEHCIScheduleFrames];
+	UInt16						FStimeUsed[kEHCIScheduleFrames];
+	UInt8						startFrame = 0xFF;
+	UInt16						startTime = 0;
+
+	bzero(used, sizeof(used));
+	for ( int frame = 0; frame < kEHCIScheduleFrames; frame++ )
+	{
+		FStimeUsed[frame] = (frame % 4 == 2) ? 100 : 400;
+		startTimes[frame] = kEHCIScheduleFSMinStartTime + FStimeUsed[frame];
+	}
+
+	// every 4 frames, harmonic 2 is the emptiest on the TT
+	SetSplitRequest(&request, 64, 4, false, true);
+	SetHSLoad(&hsLoad, used, true, false);
+	USBTestCheck(EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0, &hsLoad, kEHCISchedulePolicyBestFit, &startFrame, &startTime));
+	USBTestCheckEqual(startFrame, 2);
+
+	// but if the HS microframes its splits would land in are full there, another harmonic is preferred
+	for ( int frame = 2; frame < kEHCIScheduleFrames; frame += 4 )
+		for ( int uFrame = 0; uFrame < kEHCIScheduleuFrames; uFrame++ )
+			used[frame][uFrame] = kHSLimit;
+	USBTestCheck(EHCIScheduleFindSplitFrame(&request, startTimes, FStimeUsed, 0, &hsLoad, kEHCISchedulePolicyBestFit, &startFrame, &startTime));
+	USBTestCheck(startFrame != 2);
+}
+
+//================================================================================================
+//	Device mixes
+//================================================================================================
+
+typedef struct HSBus
+{
+	EHCIScheduleHSTable		used;
+} HSBus;
+
+// What AllocateInterruptBandwidth/AllocateIsochBandwidth do with the chosen phase: reserve every instance, undo if one doesn't fit
+static bool
+AdmitHS(HSBus *bus, UInt32 interval, UInt16 bytes, UInt32 policy)
+{
+	UInt32	phase;
+	UInt32	slot;
+
+	if ( !EHCIScheduleFindHSPhase(bus->used, interval, bytes, kHSLimit, policy, &phase) )
+		return false;
+
+	for ( slot = phase; slot < kEHCIScheduleSlots; slot += interval )
+		if ( bus->used[slot / kEHCIScheduleuFrames][slot % kEHCIScheduleuFrames] + bytes > kHSLimit )
+			return false;
+
+	for ( slot = phase; slot < kEHCIScheduleSlots; slot += interval )
+		bus->used[slot / kEHCIScheduleuFrames][slot % kEHCIScheduleuFrames] += bytes;
+
+	return true;
+}
+
+static void
+TestHSMixes(void)
+{
+	static const UInt32		intervals[] = { 1, 2, 4, 8, 8, 8, 16, 32, 64, 128, 256 };
+	unsigned int			seed = 1;
+	UInt32					admitted[2] = { 0, 0 };
+	UInt32					offered = 0;
+	UInt32					bestWins = 0;
+	UInt32					firstWins = 0;
+
+	for ( int trial = 0; trial < 1000; trial++ )
+	{
+		HSBus		bus[2];
+		UInt32		count[2] = { 0, 0 };
+
+		bzero(bus, sizeof(bus));
+		for ( int ep = 0; ep < 40; ep++ )
+		{
+			UInt32	interval = intervals[USBTestRandom(&seed) % (sizeof(intervals) / sizeof(intervals[0]))];
+			UInt16	bytes = (UInt16)((((USBTestRandom(&seed) % 1024) + 1) * 7) / 6);
+
+			offered++;
+			for ( int policy = 0; policy < 2; policy++ )
+				if ( AdmitHS(&bus[policy], interval, bytes, policy) )
+					count[policy]++;
+		}
+		admitted[0] += count[0];
+		admitted[1] += count[1];
+		if ( count[kEHCISchedulePolicyBestFit] > count[kEHCISchedulePolicyFirstFit] )
+			bestWins++;
+		else if ( count[kEHCISchedulePolicyBestFit] < count[kEHCISchedulePolicyFirstFit] )
+			firstWins++;
+	}
+
+	printf("  HS mixes: %u endpoints offered, first fit admitted %u, best fit admitted %u (best fit ahead in %u mixes, behind in %u)\n",
+		   offered, admitted[kEHCISchedulePolicyFirstFit], admitted[kEHCISchedulePolicyBestFit], bestWins, firstWins);
+	USBTestCheck(admitted[kEHCISchedulePolicyBestFit] >= admitted[kEHCISchedulePolicyFirstFit]);
+}
+
+typedef struct TTBus
+{
+	EHCIScheduleHSTable		used;								// the HS bus
+	UInt16					FStimeUsed[kEHCIScheduleFrames];	// one TT
+	UInt32					largeIsochMask;
+} TTBus;
+
+// Places a split endpoint on the TT and reserves its FS time and its SS/CS bytes on the HS bus.  The endpoint is admitted
+// if it fits on the TT, as in the kernel, and split endpoints whose splits overflow the HS bus are counted separately.
+static bool
+AdmitSplit(TTBus *bus, const EHCIScheduleSplitRequest *request, UInt32 policy, UInt32 *hsOverflows)
+{
+	EHCIScheduleHSLoad			hsLoad;
+	EHCIScheduleSplitFootprint	footprint;
+	UInt16						startTimes[kEHCIScheduleFrames];
+	UInt8						startFrame;
+	UInt16						startTime;
+	bool						overflow = false;
+
+	for ( int frame = 0; frame < kEHCIScheduleFrames; frame++ )
+		startTimes[frame] = kEHCIScheduleFSMinStartTime + bus->FStimeUsed[frame];
+
+	SetHSLoad(&hsLoad, bus->used, request->input, request->isochronous);
+	if ( !EHCIScheduleFindSplitFrame(request, startTimes, bus->FStimeUsed, bus->largeIsochMask, &hsLoad, policy, &startFrame, &startTime) )
+		return false;
+
+	EHCIScheduleSplitFootprintAt(request, &hsLoad, startTime, &footprint);
+	for ( UInt32 frame = startFrame; frame < kEHCIScheduleFrames; frame += request->period )
+	{
+		bus->FStimeUsed[frame] += request->FSBytesUsed;
+		if ( request->FSBytesUsed > kEHCIScheduleFSLargeIsochPacket )
+			bus->largeIsochMask |= (1 << frame);
+
+		for ( int i = 0; i < footprint.count; i++ )
+		{
+			SInt32	uFrame = footprint.uFrame[i];
+			UInt32	effectiveFrame = frame;
+
+			if ( uFrame < 0 )
+			{
+				effectiveFrame = (frame > 0) ? frame - 1 : kEHCIScheduleFrames - 1;
+				uFrame = kEHCIScheduleuFrames - 1;
+			}
+			else if ( uFrame >= kEHCIScheduleuFrames )
+			{
+				effectiveFrame = (frame + (uFrame / kEHCIScheduleuFrames)) % kEHCIScheduleFrames;
+				uFrame = uFrame % kEHCIScheduleuFrames;
+			}
+			bus->used[effectiveFrame][uFrame] += footprint.bytes[i];
+			if ( bus->used[effectiveFrame][uFrame] > kHSLimit )
+				overflow = true;
+		}
+	}
+
+	if ( overflow )
+		(*hsOverflows)++;
+
+	return true;
+}
+
+// Several USB audio interfaces, webcams and HID devices behind one TT, plugged in in random order on a busy HS bus
+static void
+TestTTMixes(void)
+{
+	unsigned int			seed = 7;
+	UInt32					admitted[2] = { 0, 0 };
+	UInt32					overflows[2] = { 0, 0 };
+	UInt32					offered = 0;
+
+	for ( int trial = 0; trial < 1000; trial++ )
+	{
+		TTBus		bus[2];
+
+		// the HS bus already carries HS devices (a HS webcam and disks), the same for both policies
+		bzero(bus, sizeof(bus));
+		for ( int ep = 0; ep < 14; ep++ )
+		{
+			HSBus	hsBus;
+
+			memcpy(hsBus.used, bus[0].used, sizeof(hsBus.used));
+			AdmitHS(&hsBus, 8, (UInt16)(2000 + (USBTestRandom(&seed) % 1000)), kEHCISchedulePolicyBestFit);
+			memcpy(bus[0].used, hsBus.used, sizeof(hsBus.used));
+		}
+		memcpy(bus[1].used, bus[0].used, sizeof(bus[0].used));
+
+		for ( int ep = 0; ep < 16; ep++ )
+		{
+			EHCIScheduleSplitRequest	request;
+
+			switch ( USBTestRandom(&seed) % 5 )
+			{
+				case 0:		SetSplitRequest(&request, 196, 1, true, false);		break;		// 48 kHz stereo 16 bit out
+				case 1:		SetSplitRequest(&request, 196, 1, true, true);		break;		// and in
+				case 2:		SetSplitRequest(&request, 100, 1, true, true);		break;		// mono mic
+				case 3:		SetSplitRequest(&request, 640, 1, true, true);		break;		// FS webcam
+				default:	SetSplitRequest(&request, (USBTestRandom(&seed) & 1) ? 8 : 64, 1 << (USBTestRandom(&seed) % 4), false, true);	break;	// HID
+			}
+
+			offered++;
+			for ( int policy = 0; policy < 2; policy++ )
+				if ( AdmitSplit(&bus[policy], &request, policy, &overflows[policy]) )
+					admitted[policy]++;
+		}
+	}
+
+	printf("  TT mixes: %u endpoints offered, first fit admitted %u (%u overflowing the HS bus), best fit admitted %u (%u overflowing the HS bus)\n",
+		   offered, admitted[kEHCISchedulePolicyFirstFit], overflows[kEHCISchedulePolicyFirstFit], admitted[kEHCISchedulePolicyBestFit], overflows[kEHCISchedulePolicyBestFit]);
+	
+	// AllocateHSPeriodicSplitBandwidth doesn't fail an endpoint whose splits overflow the HS bus, but its transfers will
+	USBTestCheck((admitted[kEHCISchedulePolicyBestFit] - overflows[kEHCISchedulePolicyBestFit]) >= (admitted[kEHCISchedulePolicyFirstFit] - overflows[kEHCISchedulePolicyFirstFit]));
+	USBTestCheck(overflows[kEHCISchedulePolicyBestFit] <= overflows[kEHCISchedulePolicyFirstFit]);
+}
+
+int
+main(void)
+{
+	USBTestRun(TestHSEmptySchedule);
+	USBTestRun(TestHSLaterInstances);
+	USBTestRun(TestHSLowestPeak);
+	USBTestRun(TestHSFull);
+	USBTestRun(TestSplitFootprint);
+	USBTestRun(TestSplitTTLimits);
+	USBTestRun(TestSplitLowestPeak);
+	USBTestRun(TestHSMixes);
+	USBTestRun(TestTTMixes);
+
+	return USBTestSummary("EHCIPeriodicScheduleTests");
+}
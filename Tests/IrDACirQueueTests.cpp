@@ -0,0 +1,381 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	IrDACirQueueTests
+//
+//	Checks the block copies in AppleUSBIrDA/IrDACirQueue.h against the byte at a time queue
+//	code AppleUSBIrDADriver::AddtoQueue and RemovefromQueue used before (AddBytetoQueue and
+//	GetBytetoQueue, which AppleSCCIrDA still uses): empty and full queues, every wrap point of
+//	a small ring, and random traffic compared byte for byte and pointer for pointer.  Then
+//	times both through a 4K ring with a mutex standing in for serialRequestLock, and counts the
+//	lock acquisitions per KB each one takes.
+//
+//================================================================================================
+
+#include <time.h>
+#include <pthread.h>
+
+#include "USBTestHarness.h"
+#include "../AppleUSBIrDA/IrDACirQueue.h"
+
+enum
+{
+	kTestSmallRing		= 16,
+	kTestRing			= 4096,			// kMaxCirBufferSize
+	kTestRounds			= 200000,
+	kTestTimingBytes	= 8 * 1024 * 1024
+};
+
+struct TestQueue						// same layout as CirQueue in AppleIrDA.h
+{
+	UInt8 *		Start;
+	UInt8 *		End;
+	UInt8 *		NextChar;
+	UInt8 *		LastChar;
+	size_t		Size;
+	size_t		InQueue;
+};
+
+static pthread_mutex_t	gTestLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long	gTestLockCount;
+
+static void
+TestLock(void)
+{
+	pthread_mutex_lock(&gTestLock);
+	gTestLockCount++;
+}
+
+static void
+TestUnlock(void)
+{
+	pthread_mutex_unlock(&gTestLock);
+}
+
+static void
+TestInitQueue(TestQueue *queue, UInt8 *buffer, size_t size)
+{
+	queue->Start = buffer;
+	queue->End = buffer + size;
+	queue->Size = size;
+	queue->NextChar = buffer;
+	queue->LastChar = buffer;
+	queue->InQueue = 0;
+}
+
+// The queue code as it was, one lock per byte, and per byte free space checks on the way in
+
+static bool
+ByteAdd(TestQueue *queue, UInt8 value)
+{
+	TestLock();
+	if ((queue->NextChar == queue->LastChar) && queue->InQueue) {
+		TestUnlock();
+		return false;
+	}
+	*queue->NextChar++ = value;
+	queue->InQueue++;
+	if (queue->NextChar >= queue->End)
+		queue->NextChar = queue->Start;
+	TestUnlock();
+	return true;
+}
+
+static bool
+ByteGet(TestQueue *queue, UInt8 *value)
+{
+	TestLock();
+	if ((queue->NextChar == queue->LastChar) && !queue->InQueue) {
+		TestUnlock();
+		return false;
+	}
+	*value = *queue->LastChar++;
+	queue->InQueue--;
+	if (queue->LastChar >= queue->End)
+		queue->LastChar = queue->Start;
+	TestUnlock();
+	return true;
+}
+
+static size_t
+ByteFreeSpace(TestQueue *queue)
+{
+	size_t	free;
+	
+	TestLock();
+	free = queue->Size - queue->InQueue;
+	TestUnlock();
+	return free;
+}
+
+static size_t
+ByteAddtoQueue(TestQueue *queue, const UInt8 *buffer, size_t size)
+{
+	size_t	written = 0;
+	
+	while (ByteFreeSpace(queue) && (size > written)) {
+		ByteAdd(queue, *buffer++);
+		written++;
+	}
+	return written;
+}
+
+static size_t
+ByteRemovefromQueue(TestQueue *queue, UInt8 *buffer, size_t maxSize)
+{
+	size_t	received = 0;
+	UInt8	value;
+	
+	while ((maxSize > received) && ByteGet(queue, &value)) {
+		*buffer++ = value;
+		received++;
+	}
+	return received;
+}
+
+// AppleUSBIrDADriver::AddtoQueue and RemovefromQueue as they are now
+
+static size_t
+BlockAddtoQueue(TestQueue *queue, const UInt8 *buffer, size_t size)
+{
+	size_t	written;
+	
+	TestLock();
+	written = IrDACirQueueAdd(queue, buffer, size);
+	TestUnlock();
+	return written;
+}
+
+static size_t
+BlockRemovefromQueue(TestQueue *queue, UInt8 *buffer, size_t maxSize)
+{
+	size_t	received;
+	
+	TestLock();
+	received = IrDACirQueueRemove(queue, buffer, maxSize);
+	TestUnlock();
+	return received;
+}
+
+static void
+CheckSameState(const TestQueue *a, const UInt8 *bufferA, const TestQueue *b, const UInt8 *bufferB)
+{
+	USBTestCheckEqual(a->NextChar - bufferA, b->NextChar - bufferB);
+	USBTestCheckEqual(a->LastChar - bufferA, b->LastChar - bufferB);
+	USBTestCheckEqual(a->InQueue, b->InQueue);
+}
+
+static void
+TestEmpty(void)
+{
+	UInt8		buffer[kTestSmallRing];
+	UInt8		out[kTestSmallRing];
+	TestQueue	queue;
+	
+	TestInitQueue(&queue, buffer, sizeof(buffer));
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, sizeof(out)), 0);
+	USBTestCheckEqual(IrDACirQueueAdd(&queue, out, 0), 0);
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, 0), 0);
+	USBTestCheck(queue.NextChar == buffer);
+	USBTestCheck(queue.LastChar == buffer);
+	USBTestCheckEqual(queue.InQueue, 0);
+	
+	// Drained back to empty somewhere other than the start
+	
+	USBTestCheckEqual(IrDACirQueueAdd(&queue, out, 5), 5);
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, 10), 5);
+	USBTestCheck(queue.NextChar == buffer + 5);
+	USBTestCheck(queue.LastChar == buffer + 5);
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, 1), 0);
+}
+
+static void
+TestFull(void)
+{
+	UInt8		buffer[kTestSmallRing];
+	UInt8		in[2 * kTestSmallRing];
+	UInt8		out[2 * kTestSmallRing];
+	TestQueue	queue;
+	
+	for (size_t i = 0; i < sizeof(in); i++)
+		in[i] = (UInt8)(i + 1);
+		
+	// More than fits is cut to the free space, and a full queue takes nothing
+	
+	TestInitQueue(&queue, buffer, sizeof(buffer));
+	USBTestCheckEqual(IrDACirQueueAdd(&queue, in, sizeof(in)), kTestSmallRing);
+	USBTestCheck(queue.NextChar == queue.LastChar);
+	USBTestCheckEqual(queue.InQueue, kTestSmallRing);
+	USBTestCheckEqual(IrDACirQueueAdd(&queue, in, 1), 0);
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, sizeof(out)), kTestSmallRing);
+	USBTestCheck(memcmp(in, out, kTestSmallRing) == 0);
+	USBTestCheckEqual(queue.InQueue, 0);
+	
+	// Exactly filled from the middle of the ring, then one byte freed and refilled
+	
+	TestInitQueue(&queue, buffer, sizeof(buffer));
+	IrDACirQueueAdd(&queue, in, 7);
+	IrDACirQueueRemove(&queue, out, 7);
+	USBTestCheckEqual(IrDACirQueueAdd(&queue, in, kTestSmallRing), kTestSmallRing);
+	USBTestCheck(queue.NextChar == buffer + 7);
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, 1), 1);
+	USBTestCheckEqual(IrDACirQueueAdd(&queue, in + kTestSmallRing, 2), 1);
+	USBTestCheckEqual(IrDACirQueueRemove(&queue, out, sizeof(out)), kTestSmallRing);
+	USBTestCheck(memcmp(out, in + 1, kTestSmallRing - 1) == 0);
+	USBTestCheckEqual(out[kTestSmallRing - 1], in[kTestSmallRing]);
+}
+
+static void
+TestEveryWrapPoint(void)
+{
+	UInt8		buffer[kTestSmallRing];
+	UInt8		in[kTestSmallRing];
+	UInt8		out[kTestSmallRing + 1];
+	TestQueue	queue;
+	
+	for (size_t i = 0; i < sizeof(in); i++)
+		in[i] = (UInt8)(0xA0 + i);
+		
+	// Every starting point, every length, out in every piece size
+	
+	for (size_t offset = 0; offset < kTestSmallRing; offset++) {
+		for (size_t length = 1; length <= kTestSmallRing; length++) {
+			for (size_t piece = 1; piece <= length; piece++) {
+				size_t	got = 0;
+				
+				TestInitQueue(&queue, buffer, sizeof(buffer));
+				memset(buffer, 0, sizeof(buffer));
+				queue.NextChar = queue.LastChar = buffer + offset;
+				
+				USBTestCheckEqual(IrDACirQueueAdd(&queue, in, length), length);
+				USBTestCheck(queue.NextChar == buffer + ((offset + length) % kTestSmallRing));
+				
+				while (got < length)
+					got += IrDACirQueueRemove(&queue, out + got, piece);
+					
+				USBTestCheckEqual(got, length);
+				USBTestCheck(memcmp(in, out, length) == 0);
+				USBTestCheck(queue.LastChar == queue.NextChar);
+				USBTestCheckEqual(queue.InQueue, 0);
+			}
+		}
+	}
+}
+
+static void
+TestAgainstByteQueue(void)
+{
+	UInt8			blockBuffer[kTestSmallRing * 4 + 3];
+	UInt8			byteBuffer[sizeof(blockBuffer)];
+	UInt8			in[sizeof(blockBuffer) * 2];
+	UInt8			blockOut[sizeof(in)];
+	UInt8			byteOut[sizeof(in)];
+	TestQueue		block, byte;
+	unsigned int	seed = 36;
+	UInt8			next = 0;
+	
+	TestInitQueue(&block, blockBuffer, sizeof(blockBuffer));
+	TestInitQueue(&byte, byteBuffer, sizeof(byteBuffer));
+	
+	for (int round = 0; round < kTestRounds; round++) {
+		size_t	length = USBTestRandom(&seed) % sizeof(in);
+		
+		if (USBTestRandom(&seed) & 1) {
+			size_t	written;
+			
+			for (size_t i = 0; i < length; i++)
+				in[i] = (UInt8)(next + i);
+			written = BlockAddtoQueue(&block, in, length);
+			USBTestCheckEqual(ByteAddtoQueue(&byte, in, length), written);
+			next += (UInt8)written;
+		} else {
+			size_t	got = BlockRemovefromQueue(&block, blockOut, length);
+			
+			USBTestCheckEqual(ByteRemovefromQueue(&byte, byteOut, length), got);
+			USBTestCheck(memcmp(blockOut, byteOut, got) == 0);
+		}
+		CheckSameState(&block, blockBuffer, &byte, byteBuffer);
+	}
+}
+
+static void
+TimeOne(const char *name, size_t piece, size_t (*add)(TestQueue *, const UInt8 *, size_t),
+		size_t (*remove)(TestQueue *, UInt8 *, size_t), UInt8 *checksum)
+{
+	static UInt8	buffer[kTestRing];
+	static UInt8	in[kTestRing];
+	static UInt8	out[kTestRing];
+	TestQueue		queue;
+	size_t			moved = 0;
+	clock_t			start;
+	double			seconds;
+	
+	for (size_t i = 0; i < sizeof(in); i++)
+		in[i] = (UInt8)(i * 7);
+		
+	TestInitQueue(&queue, buffer, sizeof(buffer));
+	queue.NextChar = queue.LastChar = buffer + kTestRing / 3;		// so that the copies wrap
+	gTestLockCount = 0;
+	
+	start = clock();
+	while (moved < kTestTimingBytes) {
+		size_t	added = add(&queue, in, piece);
+		size_t	taken = remove(&queue, out, piece);
+		
+		*checksum ^= out[taken - 1];
+		moved += added;
+	}
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	
+	USBTestCheckEqual(queue.InQueue, 0);
+	printf("  %5u byte writes, %-5s %8.1f MB/s, %6.1f lock acquisitions per KB\n", (unsigned int)piece, name,
+		   (double)moved / (seconds * 1024 * 1024), (double)gTestLockCount * 1024 / moved);
+}
+
+static void
+TestTiming(void)
+{
+	static const size_t	pieces[] = { 1, 16, 64, 256, 2048 };		// single characters up to a 2K IrLAP frame
+	UInt8				blockSum = 0;
+	UInt8				byteSum = 0;
+	
+	for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+		TimeOne("block", pieces[i], BlockAddtoQueue, BlockRemovefromQueue, &blockSum);
+		TimeOne("byte", pieces[i], ByteAddtoQueue, ByteRemovefromQueue, &byteSum);
+	}
+	USBTestCheckEqual(blockSum, byteSum);
+}
+
+int
+main(void)
+{
+	USBTestRun(TestEmpty);
+	USBTestRun(TestFull);
+	USBTestRun(TestEveryWrapPoint);
+	USBTestRun(TestAgainstByteQueue);
+	USBTestRun(TestTiming);
+
+	return USBTestSummary("IrDACirQueueTests");
+}
@@ -0,0 +1,407 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	IrEventQueueTests
+//
+//	Drives the intrusive lists in IrEventQueue.h with a stand-in for TIrEvent: the pending
+//	event fifo the way TIrStream::EnqueueEvent, DequeueEvent and free use it, and the free and
+//	in-use lists the way TIrEvent::GrabEventBlock and ReleaseEventBlock do, each checked against
+//	a plain array after every operation.  Finally times the fifo against the CList it replaced,
+//	which inserted at the front of an array and took from the end.
+//
+//================================================================================================
+
+#include <time.h>
+
+#include "USBTestHarness.h"
+#include "../IrDA/Stack/IrEventQueue.h"
+
+enum
+{
+	kTestEvents			= 256,
+	kTestStreams		= 4,
+	kTestRounds			= 200000,
+	kTestPoolEvents		= 64,
+	kTestTimingDepth	= 4096,
+	kTestTimingRounds	= 200
+};
+
+struct TestStream
+{
+	int				fIndex;
+};
+
+struct TestEvent
+{
+	UInt8			fAllocated;
+	UInt8			fQueued;
+	TestStream *	fDest;
+	TestEvent *		fQueueNext;
+	TestEvent *		fPoolNext;
+	TestEvent *		fPoolPrev;
+};
+
+static TestEvent	gEvents[kTestEvents];
+static TestStream	gStreams[kTestStreams];
+
+// The fifo holds exactly the reference, in order, with a consistent tail and count
+static void
+CheckFifo(TestEvent *head, TestEvent *tail, UInt32 count, TestEvent **reference, UInt32 referenceCount)
+{
+	TestEvent *	event = head;
+	UInt32		i;
+
+	USBTestCheckEqual(count, referenceCount);
+	for (i = 0; (i < referenceCount) && event; i++, event = event->fQueueNext)
+	{
+		if (event != reference[i])
+			break;
+		if (!event->fQueued)
+			break;
+	}
+	USBTestCheckEqual(i, referenceCount);
+	USBTestCheck(event == NULL);
+	USBTestCheck(tail == (referenceCount ? reference[referenceCount - 1] : NULL));
+	USBTestCheck((head == NULL) == (tail == NULL));
+}
+
+//================================================================================================
+//	Pending event fifo
+//================================================================================================
+
+static void
+TestFifoEmpty(void)
+{
+	TestEvent *	head = NULL;
+	TestEvent *	tail = NULL;
+	UInt32		count = 0;
+
+	USBTestCheck(IrEventFifoTake(head, tail, count) == NULL);
+	USBTestCheckEqual(count, 0);
+	USBTestCheckEqual(IrEventFifoRemoveDest(head, tail, count, &gStreams[0]), 0);
+	CheckFifo(head, tail, count, NULL, 0);
+}
+
+// An event which is already queued is refused and the fifo is left alone, which is what the
+// old CList couldn't catch once the event was past fNextEvent
+static void
+TestFifoRefusesSecondAdd(void)
+{
+	TestEvent *	head = NULL;
+	TestEvent *	tail = NULL;
+	UInt32		count = 0;
+	TestEvent *	reference[3] = { &gEvents[0], &gEvents[1], &gEvents[2] };
+
+	bzero(gEvents, sizeof(gEvents));
+	for (int i = 0; i < 3; i++)
+		USBTestCheck(IrEventFifoAdd(head, tail, count, &gEvents[i]));
+
+	for (int i = 0; i < 3; i++)
+		USBTestCheck(!IrEventFifoAdd(head, tail, count, &gEvents[i]));
+	CheckFifo(head, tail, count, reference, 3);
+
+	// once taken it can go back on, at the end
+	USBTestCheck(IrEventFifoTake(head, tail, count) == &gEvents[0]);
+	USBTestCheck(!gEvents[0].fQueued && (gEvents[0].fQueueNext == NULL));
+	USBTestCheck(IrEventFifoAdd(head, tail, count, &gEvents[0]));
+	reference[0] = &gEvents[1];
+	reference[1] = &gEvents[2];
+	reference[2] = &gEvents[0];
+	CheckFifo(head, tail, count, reference, 3);
+}
+
+// Random adds, takes and stream frees against an array
+static void
+TestFifoAgainstReference(void)
+{
+	TestEvent *		head = NULL;
+	TestEvent *		tail = NULL;
+	UInt32			count = 0;
+	TestEvent *		reference[kTestEvents];
+	UInt32			referenceCount = 0;
+	unsigned int	seed = 34;
+
+	bzero(gEvents, sizeof(gEvents));
+	for (int round = 0; round < kTestRounds; round++)
+	{
+		unsigned int	op = USBTestRandom(&seed) % 16;
+
+		if (op < 8)
+		{
+			TestEvent *	event = &gEvents[USBTestRandom(&seed) % kTestEvents];
+			bool		wasQueued = event->fQueued;
+			bool		added;
+
+			if (!wasQueued)
+				event->fDest = &gStreams[USBTestRandom(&seed) % kTestStreams];
+			added = IrEventFifoAdd(head, tail, count, event);
+			USBTestCheckEqual(added, !wasQueued);
+			if (added)
+				reference[referenceCount++] = event;
+		}
+		else if (op < 15)
+		{
+			TestEvent *	event = IrEventFifoTake(head, tail, count);
+
+			if (referenceCount)
+			{
+				USBTestCheck(event == reference[0]);
+				memmove(&reference[0], &reference[1], --referenceCount * sizeof(reference[0]));
+			}
+			else
+			{
+				USBTestCheck(event == NULL);
+			}
+			if (event)
+				USBTestCheck(!event->fQueued && (event->fQueueNext == NULL));
+		}
+		else
+		{
+			TestStream *	dest = &gStreams[USBTestRandom(&seed) % kTestStreams];
+			UInt32			kept = 0;
+			UInt32			expected = 0;
+
+			for (UInt32 i = 0; i < referenceCount; i++)
+			{
+				if (reference[i]->fDest == dest)
+					expected++;
+				else
+					reference[kept++] = reference[i];
+			}
+			referenceCount = kept;
+			USBTestCheckEqual(IrEventFifoRemoveDest(head, tail, count, dest), expected);
+		}
+
+		CheckFifo(head, tail, count, reference, referenceCount);
+	}
+}
+
+// Removing the events of a stream at the head, in the middle and at the tail
+static void
+TestFifoRemoveDestEnds(void)
+{
+	for (unsigned int pattern = 0; pattern < (1U << 8); pattern++)
+	{
+		TestEvent *	head = NULL;
+		TestEvent *	tail = NULL;
+		UInt32		count = 0;
+		TestEvent *	reference[8];
+		UInt32		referenceCount = 0;
+
+		// bit i says event i goes to stream 1, everything else to stream 0
+		bzero(gEvents, sizeof(gEvents));
+		for (int i = 0; i < 8; i++)
+		{
+			gEvents[i].fDest = &gStreams[(pattern >> i) & 1];
+			IrEventFifoAdd(head, tail, count, &gEvents[i]);
+			if (!((pattern >> i) & 1))
+				reference[referenceCount++] = &gEvents[i];
+		}
+
+		USBTestCheckEqual(IrEventFifoRemoveDest(head, tail, count, &gStreams[1]), 8 - referenceCount);
+		CheckFifo(head, tail, count, reference, referenceCount);
+
+		// the tail must still be right for the next add
+		gEvents[8].fDest = &gStreams[0];
+		IrEventFifoAdd(head, tail, count, &gEvents[8]);
+		reference[referenceCount++] = &gEvents[8];
+		CheckFifo(head, tail, count, reference, referenceCount);
+	}
+}
+
+//================================================================================================
+//	Event block pool
+//================================================================================================
+
+// Every block is on exactly one of the two lists, and the in-use list links agree both ways
+static void
+CheckPool(TestEvent *freeList, UInt32 freeCount, TestEvent *inUse, UInt32 inUseCount, UInt32 allocated)
+{
+	int			seen[kTestEvents];
+	UInt32		n = 0;
+	TestEvent *	prev = NULL;
+
+	bzero(seen, sizeof(seen));
+	for (TestEvent *event = freeList; event && (n <= kTestEvents); event = event->fPoolNext, n++)
+	{
+		seen[event - gEvents]++;
+		USBTestCheck(!event->fAllocated);
+	}
+	USBTestCheckEqual(n, freeCount);
+
+	n = 0;
+	for (TestEvent *event = inUse; event && (n <= kTestEvents); event = event->fPoolNext, n++)
+	{
+		seen[event - gEvents]++;
+		USBTestCheck(event->fAllocated);
+		USBTestCheck(event->fPoolPrev == prev);
+		prev = event;
+	}
+	USBTestCheckEqual(n, inUseCount);
+
+	for (UInt32 i = 0; i < allocated; i++)
+		USBTestCheckEqual(seen[i], 1);
+}
+
+// Grab and release in a random order, the way GrabEventBlock and ReleaseEventBlock use the lists
+static void
+TestPoolAgainstReference(void)
+{
+	TestEvent *		freeList = NULL;
+	TestEvent *		inUse = NULL;
+	UInt32			freeCount = 0;
+	UInt32			inUseCount = 0;
+	UInt32			allocated = 0;
+	TestEvent *		grabbed[kTestEvents];
+	UInt32			grabbedCount = 0;
+	UInt32			peak = 0;
+	unsigned int	seed = 1034;
+
+	bzero(gEvents, sizeof(gEvents));
+
+	// InitEventLists primes the free list
+	for (allocated = 0; allocated < 16; allocated++)
+		IrEventPoolPush(freeList, freeCount, &gEvents[allocated]);
+	CheckPool(freeList, freeCount, inUse, inUseCount, allocated);
+
+	for (int round = 0; round < kTestRounds / 4; round++)
+	{
+		bool	grab = (USBTestRandom(&seed) % 2) == 0;
+
+		if (grab && (grabbedCount < kTestPoolEvents))
+		{
+			TestEvent *	event = IrEventPoolPop(freeList, freeCount);
+
+			if (event == NULL)
+			{
+				// the free list is empty, GrabEventBlock allocates a new block
+				USBTestCheckEqual(allocated, grabbedCount);
+				event = &gEvents[allocated++];
+			}
+			USBTestCheck(!event->fAllocated);
+			IrEventPoolLink(inUse, inUseCount, event);
+			grabbed[grabbedCount++] = event;
+			if (grabbedCount > peak)
+				peak = grabbedCount;
+		}
+		else if (grabbedCount)
+		{
+			UInt32		index = USBTestRandom(&seed) % grabbedCount;
+			TestEvent *	event = grabbed[index];
+
+			IrEventPoolUnlink(inUse, inUseCount, event);
+			USBTestCheck(!event->fAllocated && (event->fPoolNext == NULL) && (event->fPoolPrev == NULL));
+			IrEventPoolPush(freeList, freeCount, event);
+			grabbed[index] = grabbed[--grabbedCount];
+		}
+
+		USBTestCheckEqual(freeCount + inUseCount, allocated);
+		USBTestCheckEqual(inUseCount, grabbedCount);
+		if ((round % 16) == 0)
+			CheckPool(freeList, freeCount, inUse, inUseCount, allocated);
+	}
+	CheckPool(freeList, freeCount, inUse, inUseCount, allocated);
+
+	// released blocks are always reused before a new one is allocated, past the 16 primed ones
+	printf("  pool: %u blocks allocated, at most %u in use at once\n", (unsigned int)allocated, (unsigned int)peak);
+	USBTestCheckEqual(allocated, (peak > 16) ? peak : 16);
+}
+
+//================================================================================================
+//	Timing
+//================================================================================================
+
+// What the CList did: InsertFirst moved the whole array up, Last/RemoveLast took the end
+static void
+ArrayInsertFirst(TestEvent **array, UInt32 &count, TestEvent *event)
+{
+	memmove(&array[1], &array[0], count * sizeof(array[0]));
+	array[0] = event;
+	count++;
+}
+
+static TestEvent *
+ArrayRemoveLast(TestEvent **array, UInt32 &count)
+{
+	return count ? array[--count] : NULL;
+}
+
+static void
+TestFifoTiming(void)
+{
+	static TestEvent	events[kTestTimingDepth];
+	static TestEvent *	array[kTestTimingDepth];
+	TestEvent *			head = NULL;
+	TestEvent *			tail = NULL;
+	UInt32				count = 0;
+	UInt32				arrayCount = 0;
+	clock_t				start;
+	double				fifoTime, arrayTime;
+	UInt32				checksum = 0;
+
+	bzero(events, sizeof(events));
+
+	for (UInt32 depth = 16; depth <= kTestTimingDepth; depth *= 16)
+	{
+		start = clock();
+		for (int round = 0; round < kTestTimingRounds; round++)
+		{
+			for (UInt32 i = 0; i < depth; i++)
+				IrEventFifoAdd(head, tail, count, &events[i]);
+			for (UInt32 i = 0; i < depth; i++)
+				checksum += (IrEventFifoTake(head, tail, count) == &events[i]);
+		}
+		fifoTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		start = clock();
+		for (int round = 0; round < kTestTimingRounds; round++)
+		{
+			for (UInt32 i = 0; i < depth; i++)
+				ArrayInsertFirst(array, arrayCount, &events[i]);
+			for (UInt32 i = 0; i < depth; i++)
+				checksum += (ArrayRemoveLast(array, arrayCount) == &events[i]);
+		}
+		arrayTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		printf("  %4u queued: fifo %.1f ns per event, array %.1f ns per event\n", (unsigned int)depth,
+			   fifoTime * 1e9 / (kTestTimingRounds * depth), arrayTime * 1e9 / (kTestTimingRounds * depth));
+	}
+
+	USBTestCheckEqual(checksum, 2 * kTestTimingRounds * (16 + 256 + 4096));
+	USBTestCheckEqual(count, 0);
+}
+
+int
+main(void)
+{
+	USBTestRun(TestFifoEmpty);
+	USBTestRun(TestFifoRefusesSecondAdd);
+	USBTestRun(TestFifoAgainstReference);
+	USBTestRun(TestFifoRemoveDestEnds);
+	USBTestRun(TestPoolAgainstReference);
+	USBTestRun(TestFifoTiming);
+
+	return USBTestSummary("IrEventQueueTests");
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	IrLAPFlowControlTests
+//
+//	Checks the RNR backoff and the get buffer bookkeeping in IrDA/Stack/IrLAPFlowControl.h:
+//	the delay bounds for every poll timeout the QoS can negotiate, the get buffer count for
+//	every window, and random takes and gives against a plain array the way StartDataReceive
+//	and ReleaseInputBuffer use them.  Then runs a simulated primary against a peer that goes
+//	busy, comparing the adaptive delay with the fixed quarter poll timeout it replaced.  The
+//	link latency, RNR rate, error rate and busy time can be given on the command line:
+//
+//		IrLAPFlowControlTests [latency ms] [RNR rate] [error rate] [mean busy ms]
+//
+//================================================================================================
+
+#include <math.h>
+
+#include "USBTestHarness.h"
+#include "../IrDA/Stack/IrLAPFlowControl.h"
+
+enum
+{
+	kTestRounds			= 200000,
+	kTestExchanges		= 200000
+};
+
+static const SInt32	kTestPollTimeouts[] = { 500, 250, 100, 50 };	// IrMaxTurnTimeTable
+
+static void
+TestFirstDelay(void)
+{
+	for (size_t i = 0; i < sizeof(kTestPollTimeouts) / sizeof(kTestPollTimeouts[0]); i++)
+		USBTestCheckEqual(IrLAPRemoteBusyFirstDelay(kTestPollTimeouts[i]), kTestPollTimeouts[i] / 4);
+}
+
+static void
+TestDelayBounds(void)
+{
+	for (size_t i = 0; i < sizeof(kTestPollTimeouts) / sizeof(kTestPollTimeouts[0]); i++) {
+		SInt32	poll = kTestPollTimeouts[i];
+		SInt32	delay = IrLAPRemoteBusyFirstDelay(poll);
+		
+		// Busy doubles up to the poll timeout and stays there
+		
+		USBTestCheckEqual(IrLAPRemoteBusyNextDelay(delay, poll, true), 2 * delay);
+		for (int n = 0; n < 40; n++)
+			delay = IrLAPRemoteBusyNextDelay(delay, poll, true);
+		USBTestCheckEqual(delay, poll);
+		
+		// Not busy halves down to 1/16 and stays there
+		
+		USBTestCheckEqual(IrLAPRemoteBusyNextDelay(delay, poll, false), poll / 2);
+		for (int n = 0; n < 40; n++)
+			delay = IrLAPRemoteBusyNextDelay(delay, poll, false);
+		USBTestCheckEqual(delay, poll >> 4);
+		
+		// An unset delay (Init clears it) comes up to the floor rather than staying at zero
+		
+		USBTestCheckEqual(IrLAPRemoteBusyNextDelay(0, poll, true), poll >> 4);
+		USBTestCheckEqual(IrLAPRemoteBusyNextDelay(0, poll, false), poll >> 4);
+	}
+}
+
+static void
+TestDelayRandomWalk(void)
+{
+	unsigned int	seed = 38;
+	SInt32			poll = 500;
+	SInt32			delay = IrLAPRemoteBusyFirstDelay(poll);
+	
+	for (int round = 0; round < kTestRounds; round++) {
+		bool	busy = USBTestRandom(&seed) & 1;
+		SInt32	next = IrLAPRemoteBusyNextDelay(delay, poll, busy);
+		
+		USBTestCheck(next >= (poll >> 4));
+		USBTestCheck(next <= poll);
+		if (busy)
+			USBTestCheck((next == poll) || (next == 2 * delay) || (delay < (poll >> 4)));
+		else
+			USBTestCheck((next == (poll >> 4)) || (next == delay / 2));
+		delay = next;
+	}
+}
+
+static void
+TestGetBufferCount(void)
+{
+	// The QoS window is 1 to 7 frames, twice that is allocated
+	
+	for (UInt32 window = 1; window <= 7; window++)
+		USBTestCheckEqual(IrLAPGetBufferCount(window), 2 * window);
+		
+	// and the mask never overflows, whatever comes in
+	
+	USBTestCheckEqual(IrLAPGetBufferCount(15), 30);
+	USBTestCheckEqual(IrLAPGetBufferCount(16), kIrLAPMaxGetBuffers);
+	USBTestCheckEqual(IrLAPGetBufferCount(1000), kIrLAPMaxGetBuffers);
+}
+
+static void
+TestGetBufferTakeGive(void)
+{
+	for (UInt32 window = 1; window <= 7; window++) {
+		UInt32	count = IrLAPGetBufferCount(window);
+		UInt32	avail = 0;
+		
+		// Filled the way ParseNegotiateAndInitConnState does it
+		
+		for (UInt32 i = 0; i < count; i++)
+			USBTestCheck(IrLAPGetBufferGive(avail, i));
+		USBTestCheckEqual(avail, (1u << count) - 1);
+		
+		// Taken lowest first, then none left (local busy)
+		
+		for (UInt32 i = 0; i < count; i++)
+			USBTestCheckEqual(IrLAPGetBufferTake(avail, count), i);
+		USBTestCheckEqual(IrLAPGetBufferTake(avail, count), count);
+		USBTestCheckEqual(avail, 0);
+		
+		// A give makes that one the next taken, a second give is caught
+		
+		USBTestCheck(IrLAPGetBufferGive(avail, count - 1));
+		USBTestCheck(!IrLAPGetBufferGive(avail, count - 1));
+		USBTestCheckEqual(IrLAPGetBufferTake(avail, count), count - 1);
+	}
+}
+
+static void
+TestGetBufferAgainstReference(void)
+{
+	unsigned int	seed = 3800;
+	
+	for (UInt32 window = 1; window <= 7; window++) {
+		UInt32	count = IrLAPGetBufferCount(window);
+		UInt32	avail = 0;
+		bool	free[kIrLAPMaxGetBuffers];
+		
+		for (UInt32 i = 0; i < count; i++) {
+			IrLAPGetBufferGive(avail, i);
+			free[i] = true;
+		}
+		
+		for (int round = 0; round < kTestRounds / 7; round++) {
+			if (USBTestRandom(&seed) % 3) {
+				UInt32	expected = count;
+				
+				for (UInt32 i = 0; i < count; i++)
+					if (free[i]) { expected = i; break; }
+				USBTestCheckEqual(IrLAPGetBufferTake(avail, count), expected);
+				if (expected < count)
+					free[expected] = false;
+			} else {
+				UInt32	index = USBTestRandom(&seed) % count;
+				
+				USBTestCheckEqual(IrLAPGetBufferGive(avail, index), !free[index]);
+				free[index] = true;
+			}
+			for (UInt32 i = 0; i < count; i++)
+				USBTestCheckEqual((avail >> i) & 1, free[i]);
+			USBTestCheckEqual(avail >> count, 0);
+		}
+	}
+}
+
+// A primary moving data to a peer that now and then runs out of buffers and answers RNR
+// until its client drains them.  Each exchange costs the link latency, a lost response
+// costs the final timer (the poll timeout), and an RNR final costs the busy delay before
+// the next poll.  Losses and busy spells come from their own generators, so that both delays
+// see the same busy spells after the same windows.
+
+struct LinkConfig
+{
+	double		latency;			// ms per poll and response
+	double		rnrRate;			// chance the peer goes busy after taking a window
+	double		errorRate;			// chance a response is lost
+	double		busyMean;			// ms the peer stays busy, exponentially distributed
+	SInt32		pollTimeout;
+};
+
+struct LinkResult
+{
+	double		ms;					// to move kTestExchanges windows
+	UInt32		episodes;			// times the peer went busy
+	UInt32		rnrs;				// RNR finals received
+	UInt32		errors;				// responses lost
+	double		idle;				// ms spent waiting after the peer was ready again
+};
+
+static double
+LinkRandom(unsigned int *seed)
+{
+	return (USBTestRandom(seed) * 32768.0 + USBTestRandom(seed) + 0.5) / (32768.0 * 32768.0);
+}
+
+static LinkResult
+RunLink(const LinkConfig &config, bool adaptive)
+{
+	LinkResult		result = { 0, 0, 0, 0, 0 };
+	unsigned int	errorSeed = 1;
+	unsigned int	busySeed = 2;
+	double			now = 0;
+	double			busyUntil = 0;
+	bool			waitingOnBusy = false;
+	SInt32			delay = IrLAPRemoteBusyFirstDelay(config.pollTimeout);
+	UInt32			delivered = 0;
+	
+	while (delivered < kTestExchanges) {
+		now += config.latency;
+		
+		if (LinkRandom(&errorSeed) < config.errorRate) {
+			result.errors++;
+			now += config.pollTimeout;
+			continue;
+		}
+		
+		if (now < busyUntil) {
+			result.rnrs++;
+			now += delay;
+			if (adaptive)
+				delay = IrLAPRemoteBusyNextDelay(delay, config.pollTimeout, true);
+			continue;
+		}
+		
+		if (waitingOnBusy) {
+			if (now - config.latency > busyUntil)
+				result.idle += now - config.latency - busyUntil;
+			waitingOnBusy = false;
+		}
+		
+		delivered++;
+		if (adaptive)
+			delay = IrLAPRemoteBusyNextDelay(delay, config.pollTimeout, false);
+			
+		if (LinkRandom(&busySeed) < config.rnrRate) {
+			result.episodes++;
+			busyUntil = now - config.busyMean * log(LinkRandom(&busySeed));
+			waitingOnBusy = true;
+		}
+	}
+	
+	result.ms = now;
+	return result;
+}
+
+static void
+PrintLink(const LinkConfig &config)
+{
+	LinkResult	fixed = RunLink(config, false);
+	LinkResult	adaptive = RunLink(config, true);
+	
+	USBTestCheckEqual(fixed.episodes, adaptive.episodes);
+	USBTestCheck(fixed.episodes > 0);
+	if (fixed.episodes == 0)
+		return;
+		
+	printf("  latency %4.1f ms, RNR rate %4.2f, error rate %5.3f, busy %6.1f ms\n", config.latency, config.rnrRate,
+		   config.errorRate, config.busyMean);
+	printf("    fixed    %5.2f RNRs and %6.1f ms idle per busy spell, %6.1f windows/s\n",
+		   (double)fixed.rnrs / fixed.episodes, fixed.idle / fixed.episodes, kTestExchanges * 1000.0 / fixed.ms);
+	printf("    adaptive %5.2f RNRs and %6.1f ms idle per busy spell, %6.1f windows/s\n",
+		   (double)adaptive.rnrs / adaptive.episodes, adaptive.idle / adaptive.episodes, kTestExchanges * 1000.0 / adaptive.ms);
+}
+
+static LinkConfig	gCommandLine;
+static bool			gHaveCommandLine;
+
+static void
+TestSimulatedLink(void)
+{
+	static const double	latencies[] = { 2, 20 };
+	static const double	busyMeans[] = { 10, 100, 1000 };
+	
+	if (gHaveCommandLine) {
+		PrintLink(gCommandLine);
+		return;
+	}
+	
+	for (size_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]); l++) {
+		for (size_t b = 0; b < sizeof(busyMeans) / sizeof(busyMeans[0]); b++) {
+			LinkConfig	config = { latencies[l], 0.05, 0.0, busyMeans[b], 500 };
+			
+			PrintLink(config);
+			config.rnrRate = 0.3;
+			config.errorRate = 0.01;
+			PrintLink(config);
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	gCommandLine.latency = (argc > 1) ? atof(argv[1]) : 2;
+	gCommandLine.rnrRate = (argc > 2) ? atof(argv[2]) : 0.05;
+	gCommandLine.errorRate = (argc > 3) ? atof(argv[3]) : 0;
+	gCommandLine.busyMean = (argc > 4) ? atof(argv[4]) : 100;
+	gCommandLine.pollTimeout = 500;
+	gHaveCommandLine = (argc > 1);
+	
+	USBTestRun(TestFirstDelay);
+	USBTestRun(TestDelayBounds);
+	USBTestRun(TestDelayRandomWalk);
+	USBTestRun(TestGetBufferCount);
+	USBTestRun(TestGetBufferTakeGive);
+	USBTestRun(TestGetBufferAgainstReference);
+	USBTestRun(TestSimulatedLink);
+
+	return USBTestSummary("IrLAPFlowControlTests");
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	OHCIInterruptTreeTests
+//
+//	Drives the placement code in OHCIInterruptTree.h the way DetermineInterruptOffset and
+//	RebalanceInterruptTree do, first with small trees that check the level and frame arithmetic,
+//	then by replaying whole sequences of creates and deletes with OHCITreeSimulate under both
+//	policies, printing the per frame load of one of them with OHCITreePrintComparison.
+//
+//================================================================================================
+
+#include "USBTestHarness.h"
+#include "../AppleUSBOHCI/Headers/OHCIInterruptTree.h"
+
+//================================================================================================
+//	Tree arithmetic
+//================================================================================================
+
+static void
+TestLevelForRate(void)
+{
+	UInt32		first = 99;
+	UInt32		period = 99;
+
+	USBTestCheck(!OHCITreeLevelForRate(0, &first, &period));
+
+	// the rate is rounded down to a power of two, and anything from 32ms on is a leaf
+	USBTestCheck(OHCITreeLevelForRate(1, &first, &period));
+	USBTestCheckEqual(first, 62);
+	USBTestCheckEqual(period, 1);
+	USBTestCheck(OHCITreeLevelForRate(3, &first, &period));
+	USBTestCheckEqual(first, 60);
+	USBTestCheckEqual(period, 2);
+	USBTestCheck(OHCITreeLevelForRate(10, &first, &period));
+	USBTestCheckEqual(first, 48);
+	USBTestCheckEqual(period, 8);
+	USBTestCheck(OHCITreeLevelForRate(255, &first, &period));
+	USBTestCheckEqual(first, 0);
+	USBTestCheckEqual(period, 32);
+
+	for ( UInt32 node = 0; node < kOHCITreeNodes; node++ )
+	{
+		OHCITreeLevelOfNode(node, &first, &period);
+		USBTestCheck((node >= first) && (node < first + period));
+	}
+
+	USBTestCheckEqual(OHCITreeEndpointBytes(64, false), 77);
+	USBTestCheckEqual(OHCITreeEndpointBytes(8, true), 168);
+}
+
+static void
+TestFrameLoad(void)
+{
+	OHCIInterruptTree	tree;
+
+	memset(&tree, 0, sizeof(tree));
+
+	// a leaf is only visited in its own frame, the 4ms node 57 in frames 1, 5, 9 ... and the 1ms node in all of them
+	OHCITreeAdd(&tree, 3, 100);
+	OHCITreeAdd(&tree, 57, 10);
+	OHCITreeAdd(&tree, 62, 1);
+	for ( UInt32 frame = 0; frame < kOHCITreeFrames; frame++ )
+	{
+		UInt32	expected = 1 + ((frame % 4) == 1 ? 10 : 0) + (frame == 3 ? 100 : 0);
+
+		USBTestCheckEqual(OHCITreeFrameLoad(&tree, frame), expected);
+	}
+	USBTestCheckEqual(OHCITreePeakLoad(&tree), 101);
+	USBTestCheckEqual(OHCITreeFrameCount(&tree, 1), 2);
+
+	OHCITreeRemove(&tree, 3, 100);
+	USBTestCheckEqual(OHCITreePeakLoad(&tree), 11);
+
+	// removing more than is there leaves the node empty rather than wrapping
+	OHCITreeRemove(&tree, 3, 100);
+	USBTestCheckEqual(tree.bytes[3], 0);
+	USBTestCheckEqual(tree.count[3], 0);
+}
+
+static void
+TestFindNode(void)
+{
+	OHCIInterruptTree	tree;
+	UInt32				node = 99;
+
+	memset(&tree, 0, sizeof(tree));
+
+	// the original placement only looks at the frame number
+	USBTestCheck(OHCITreeFindNode(&tree, 8, 77, kOHCITreePolicyFrameNumber, 13, &node));
+	USBTestCheckEqual(node, 48 + (13 % 8));
+
+	// the least loaded one avoids the 8ms node whose frames already carry a leaf
+	OHCITreeAdd(&tree, 0, 500);
+	USBTestCheck(OHCITreeFindNode(&tree, 8, 77, kOHCITreePolicyLeastLoaded, 0, &node));
+	USBTestCheck(node != 48);
+	USBTestCheckEqual(OHCITreePeakLoad(&tree), 500);
+
+	// with equal peaks the node with fewer EDs in its busiest frame wins
+	memset(&tree, 0, sizeof(tree));
+	OHCITreeAdd(&tree, 60, 0);
+	USBTestCheck(OHCITreeFindNode(&tree, 2, 77, kOHCITreePolicyLeastLoaded, 0, &node));
+	USBTestCheckEqual(node, 61);
+
+	USBTestCheck(!OHCITreeFindNode(&tree, 0, 77, kOHCITreePolicyLeastLoaded, 0, &node));
+}
+
+static void
+TestFindMove(void)
+{
+	OHCIInterruptTree	tree;
+	UInt32				node = 99;
+	UInt32				peak = 0;
+
+	memset(&tree, 0, sizeof(tree));
+
+	// two 4ms EDs sharing node 56 while 57-59 are empty - one of them should move
+	OHCITreeAdd(&tree, 56, 77);
+	OHCITreeAdd(&tree, 56, 77);
+	USBTestCheck(OHCITreeFindMove(&tree, 56, 77, &node, &peak));
+	USBTestCheck((node > 56) && (node <= 59));
+	USBTestCheckEqual(peak, 77);
+
+	// one ED per node has nowhere better to go
+	OHCITreeRemove(&tree, 56, 77);
+	OHCITreeAdd(&tree, 57, 77);
+	USBTestCheck(!OHCITreeFindMove(&tree, 56, 77, &node, &peak));
+
+	// and the 1ms node is never moved
+	OHCITreeAdd(&tree, 62, 77);
+	OHCITreeAdd(&tree, 62, 77);
+	USBTestCheck(!OHCITreeFindMove(&tree, 62, 77, &node, &peak));
+}
+
+//================================================================================================
+//	Simulated sequences
+//================================================================================================
+
+// A 7 port hub full of 8ms FS HID devices enumerated back to back, so the creates come in within a few frames of each
+// other, then a few of them unplugged
+static void
+TestHubEnumeration(void)
+{
+	OHCITreeSimOp		ops[38];
+	SInt16				nodes[38];
+	OHCIInterruptTree	before;
+	OHCIInterruptTree	after;
+	UInt32				moves;
+	UInt32				count = 0;
+
+	memset(ops, 0, sizeof(ops));
+	for ( UInt32 i = 0; i < 32; i++, count++ )
+	{
+		ops[count].frameNumber = i % 4;
+		ops[count].pollingRate = 8;
+		ops[count].maxPacketSize = 64;
+	}
+	for ( UInt32 i = 0; i < 6; i++, count++ )
+	{
+		ops[count].frameNumber = 100 + i;
+		ops[count].remove = true;
+		ops[count].create = (UInt16)(i * 5);
+	}
+
+	memset(&before, 0, sizeof(before));
+	memset(&after, 0, sizeof(after));
+	OHCITreeSimulate(&before, ops, 32, kOHCITreePolicyFrameNumber, nodes);
+	OHCITreeSimulate(&after, ops, 32, kOHCITreePolicyLeastLoaded, nodes);
+
+	// all 32 EDs on 4 of the 8 nodes, against 4 on each
+	USBTestCheckEqual(OHCITreePeakLoad(&before), 8 * 77);
+	USBTestCheckEqual(OHCITreePeakLoad(&after), 4 * 77);
+
+	memset(&before, 0, sizeof(before));
+	memset(&after, 0, sizeof(after));
+	OHCITreeSimulate(&before, ops, count, kOHCITreePolicyFrameNumber, nodes);
+	moves = OHCITreeSimulate(&after, ops, count, kOHCITreePolicyLeastLoaded, nodes);
+
+	// 26 EDs left need at least 4 on one node, and the moves after each delete must get there
+	USBTestCheckEqual(OHCITreePeakLoad(&after), 4 * 77);
+	USBTestCheck(OHCITreePeakLoad(&after) < OHCITreePeakLoad(&before));
+	USBTestCheck(moves <= 6 * kOHCITreeMaxMoves);
+	for ( UInt32 i = 0; i < 6; i++ )
+		USBTestCheckEqual(nodes[i * 5], -1);
+
+	OHCITreePrintComparison(stdout, ops, count, nodes);
+}
+
+// Random mixes of HID, hub and LS devices at every polling rate, plugged and unplugged, with the same sequence replayed
+// under both policies
+static void
+TestMixes(void)
+{
+	static const UInt16		rates[] = { 1, 2, 4, 8, 8, 10, 16, 32, 255 };
+	static const UInt16		packets[] = { 1, 8, 8, 16, 64, 64 };
+	unsigned int			seed = 3;
+	UInt32					peaks[2] = { 0, 0 };
+	UInt32					totalMoves = 0;
+	UInt32					leastWins = 0;
+	UInt32					frameWins = 0;
+
+	for ( int trial = 0; trial < 1000; trial++ )
+	{
+		OHCITreeSimOp		ops[60];
+		SInt16				nodes[60];
+		OHCIInterruptTree	tree[2];
+		UInt32				frame = USBTestRandom(&seed);
+		UInt32				peak[2];
+
+		memset(ops, 0, sizeof(ops));
+		for ( UInt32 i = 0; i < 60; i++ )
+		{
+			frame += 1 + (USBTestRandom(&seed) % 50);
+			ops[i].frameNumber = frame;
+			if ( (i > 0) && ((USBTestRandom(&seed) % 4) == 0) )
+			{
+				ops[i].remove = true;
+				ops[i].create = (UInt16)(USBTestRandom(&seed) % i);
+				continue;
+			}
+			ops[i].pollingRate = rates[USBTestRandom(&seed) % (sizeof(rates) / sizeof(rates[0]))];
+			ops[i].maxPacketSize = packets[USBTestRandom(&seed) % (sizeof(packets) / sizeof(packets[0]))];
+			ops[i].lowSpeed = (ops[i].maxPacketSize <= 8) && (USBTestRandom(&seed) & 1);
+		}
+
+		memset(tree, 0, sizeof(tree));
+		OHCITreeSimulate(&tree[kOHCITreePolicyFrameNumber], ops, 60, kOHCITreePolicyFrameNumber, nodes);
+		totalMoves += OHCITreeSimulate(&tree[kOHCITreePolicyLeastLoaded], ops, 60, kOHCITreePolicyLeastLoaded, nodes);
+
+		for ( int policy = 0; policy < 2; policy++ )
+		{
+			peak[policy] = OHCITreePeakLoad(&tree[policy]);
+			peaks[policy] += peak[policy];
+		}
+		if ( peak[kOHCITreePolicyLeastLoaded] < peak[kOHCITreePolicyFrameNumber] )
+			leastWins++;
+		else if ( peak[kOHCITreePolicyLeastLoaded] > peak[kOHCITreePolicyFrameNumber] )
+			frameWins++;
+	}
+
+	printf("  mixes: mean peak frame load %u byte times by frame number, %u least loaded (least loaded lower in %u mixes, higher in %u, %u EDs moved)\n",
+		   peaks[kOHCITreePolicyFrameNumber] / 1000, peaks[kOHCITreePolicyLeastLoaded] / 1000, leastWins, frameWins, totalMoves);
+	USBTestCheck(peaks[kOHCITreePolicyLeastLoaded] < peaks[kOHCITreePolicyFrameNumber]);
+	USBTestCheck(leastWins > frameWins);
+}
+
+int
+main(void)
+{
+	USBTestRun(TestLevelForRate);
+	USBTestRun(TestFrameLoad);
+	USBTestRun(TestFindNode);
+	USBTestRun(TestFindMove);
+	USBTestRun(TestHubEnumeration);
+	USBTestRun(TestMixes);
+
+	return USBTestSummary("OHCIInterruptTreeTests");
+}
@@ -0,0 +1,543 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	SIRFramingTests
+//
+//	Checks the SIR mode code in AppleSCCIrDA/SIRFraming.h: the slice-by-8 CRC-16 and CRC-32
+//	against bit at a time references and the standard check values, the word at a time control
+//	byte scan against a byte scan, the block stuffing against stuffing a byte at a time, and
+//	whole frames built the way Prepare_Buffer_For_Transmit does and fed to sir_parse_input in
+//	random pieces the way parseInputSIR gets them.  Then times the fast paths against the byte
+//	at a time code they replaced.
+//
+//================================================================================================
+
+#include <time.h>
+
+#include "USBTestHarness.h"
+#include "../AppleSCCIrDA/SIRFraming.h"
+
+enum
+{
+	kTestMaxData		= 2048,						// largest IrLAP frame the driver sends
+	kTestCapacity		= (2 * 2048) + 40,			// SCCLapPayLoad
+	kTestRounds			= 20000,
+	kTestTimingBytes	= 1024 * 1024
+};
+
+static UInt32
+ReferenceCRC32(UInt32 crc, const UInt8 *cp, UInt32 len)
+{
+	while (len--)
+	{
+		crc ^= *cp++;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? ((crc >> 1) ^ POLYNOMIAL) : (crc >> 1);
+	}
+	return crc;
+}
+
+static UInt16
+ReferenceCRC16(UInt16 crc, const UInt8 *cp, UInt32 len)
+{
+	while (len--)
+	{
+		crc ^= *cp++;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? ((crc >> 1) ^ CRC16_POLYNOMIAL) : (crc >> 1);
+	}
+	return crc;
+}
+
+static bool
+IsControl(UInt8 byte)
+{
+	return (byte == 0xC0) || (byte == 0xC1) || (byte == 0x7D);
+}
+
+// Random data with roughly one control byte in every density bytes (none if density is 0)
+static void
+FillRandom(unsigned int *seed, UInt8 *buffer, UInt32 length, UInt32 density)
+{
+	static const UInt8	controls[3] = { 0xC0, 0xC1, 0x7D };
+
+	for (UInt32 i = 0; i < length; i++)
+	{
+		do
+			buffer[i] = (UInt8)USBTestRandom(seed);
+		while (IsControl(buffer[i]));
+
+		if (density && ((USBTestRandom(seed) % density) == 0))
+			buffer[i] = controls[USBTestRandom(seed) % 3];
+	}
+}
+
+// A frame the way Prepare_Buffer_For_Transmit builds it
+static UInt32
+BuildFrame(UInt8 *out, UInt32 bofs, const UInt8 *data, UInt32 length)
+{
+	UInt8 *	dest = out;
+	UInt16	crc16;
+
+	for (UInt32 i = 0; i < bofs; i++)
+		*dest++ = 0xFF;
+	*dest++ = 0xC0;
+
+	dest = sir_stuff_block(data, length, dest);
+
+	crc16 = ~update_crc16(0xffff, data, (int)length);
+	dest = sir_stuff_byte(crc16 >> 0, dest);
+	dest = sir_stuff_byte(crc16 >> 8, dest);
+	*dest++ = 0xC1;
+
+	return (UInt32)(dest - out);
+}
+
+//================================================================================================
+//	CRCs
+//================================================================================================
+
+static void
+TestCRCCheckValues(void)
+{
+	const UInt8 *	check = (const UInt8 *)"123456789";
+	UInt8			frame[16];
+	UInt32			crc32;
+	UInt16			crc16;
+
+	// CRC-32 as used by IrDA FIR (and Ethernet), and the CRC-16 of SIR (the X.25 FCS)
+	crc32 = update_crc32(INITIAL_CRC, check, 9) ^ 0xFFFFFFFF;
+	USBTestCheckEqual(crc32, 0xCBF43926);
+	crc16 = ~update_crc16(0xffff, check, 9);
+	USBTestCheckEqual(crc16, 0x906E);
+
+	// a block followed by its CRC, lsb first, leaves the magic remainder
+	memcpy(frame, check, 9);
+	frame[9] = crc32 & 0xff;
+	frame[10] = (crc32 >> 8) & 0xff;
+	frame[11] = (crc32 >> 16) & 0xff;
+	frame[12] = crc32 >> 24;
+	USBTestCheck(check_crc32(frame, 13));
+	USBTestCheckEqual(update_crc32(INITIAL_CRC, frame, 13), VALID_CRC);
+
+	frame[9] = crc16 & 0xff;
+	frame[10] = crc16 >> 8;
+	USBTestCheck(check_crc16(frame, 11));
+	USBTestCheck(!check_crc16(frame, 1));
+	USBTestCheck(!check_crc16(frame, 0));
+}
+
+// Every length up to a few slices past the frame size, at every alignment, and split anywhere
+static void
+TestCRCAgainstReference(void)
+{
+	static UInt8	buffer[kTestMaxData + 64];
+	unsigned int	seed = 35;
+
+	FillRandom(&seed, buffer, sizeof(buffer), 0);
+
+	for (UInt32 length = 0; length <= 64; length++)
+	{
+		for (UInt32 offset = 0; offset < 8; offset++)
+		{
+			USBTestCheckEqual(update_crc32(INITIAL_CRC, buffer + offset, (int)length), ReferenceCRC32(INITIAL_CRC, buffer + offset, length));
+			USBTestCheckEqual(update_crc16(0xffff, buffer + offset, (int)length), ReferenceCRC16(0xffff, buffer + offset, length));
+		}
+	}
+
+	for (int round = 0; round < kTestRounds; round++)
+	{
+		UInt32	offset = USBTestRandom(&seed) % 8;
+		UInt32	length = USBTestRandom(&seed) % (kTestMaxData + 1);
+		UInt32	split = length ? (USBTestRandom(&seed) % length) : 0;
+		UInt32	seed32 = ((UInt32)USBTestRandom(&seed) << 17) ^ USBTestRandom(&seed);
+		UInt16	seed16 = (UInt16)USBTestRandom(&seed);
+		UInt32	crc32 = ReferenceCRC32(seed32, buffer + offset, length);
+		UInt16	crc16 = ReferenceCRC16(seed16, buffer + offset, length);
+
+		USBTestCheckEqual(update_crc32(seed32, buffer + offset, (int)length), crc32);
+		USBTestCheckEqual(update_crc16(seed16, buffer + offset, (int)length), crc16);
+
+		// running the CRC over two pieces is the same as over the whole
+		USBTestCheckEqual(update_crc32(update_crc32(seed32, buffer + offset, (int)split), buffer + offset + split, (int)(length - split)), crc32);
+		USBTestCheckEqual(update_crc16(update_crc16(seed16, buffer + offset, (int)split), buffer + offset + split, (int)(length - split)), crc16);
+	}
+}
+
+// Flipping any one bit of a short frame, data or CRC, is caught
+static void
+TestCRC16CatchesBitFlips(void)
+{
+	UInt8			frame[40];
+	unsigned int	seed = 1035;
+
+	for (UInt32 length = 1; length <= 38; length++)
+	{
+		UInt16	crc16;
+
+		FillRandom(&seed, frame, length, 0);
+		crc16 = ~update_crc16(0xffff, frame, (int)length);
+		frame[length] = crc16 & 0xff;
+		frame[length + 1] = crc16 >> 8;
+		USBTestCheck(check_crc16(frame, (int)length + 2));
+
+		for (UInt32 bit = 0; bit < (length + 2) * 8; bit++)
+		{
+			frame[bit / 8] ^= (1 << (bit % 8));
+			USBTestCheck(!check_crc16(frame, (int)length + 2));
+			frame[bit / 8] ^= (1 << (bit % 8));
+		}
+	}
+}
+
+//================================================================================================
+//	Control byte scan and stuffing
+//================================================================================================
+
+static void
+TestPlainSpan(void)
+{
+	static UInt8	buffer[256 + 8];
+	unsigned int	seed = 2035;
+
+	for (int round = 0; round < kTestRounds; round++)
+	{
+		UInt32	density = USBTestRandom(&seed) % 64;
+		UInt32	offset = USBTestRandom(&seed) % 8;
+		UInt32	length = USBTestRandom(&seed) % 257;
+		UInt32	expected = 0;
+
+		FillRandom(&seed, buffer, sizeof(buffer), density);
+
+		// bytes that differ from a control byte in one bit, or are next to one, mustn't fool the word test
+		if ((round % 4) == 0)
+		{
+			static const UInt8	nearMisses[] = { 0xC2, 0xC3, 0xE0, 0xE1, 0x7C, 0x7E, 0x5D, 0xFD, 0x40, 0x41, 0x80, 0x00, 0xFF, 0x01 };
+
+			for (UInt32 i = 0; i < sizeof(buffer); i++)
+				if (!IsControl(buffer[i]))
+					buffer[i] = nearMisses[USBTestRandom(&seed) % sizeof(nearMisses)];
+		}
+
+		while ((expected < length) && !IsControl(buffer[offset + expected]))
+			expected++;
+
+		USBTestCheckEqual(sir_plain_span(buffer + offset, length), expected);
+	}
+}
+
+static void
+TestStuffing(void)
+{
+	static UInt8	data[kTestMaxData + 8];
+	static UInt8	block[2 * kTestMaxData + 8];
+	static UInt8	bytes[2 * kTestMaxData + 8];
+	unsigned int	seed = 3035;
+
+	for (int round = 0; round < kTestRounds / 4; round++)
+	{
+		UInt32	density = USBTestRandom(&seed) % 16;
+		UInt32	offset = USBTestRandom(&seed) % 8;
+		UInt32	length = USBTestRandom(&seed) % (kTestMaxData + 1);
+		UInt8 *	end;
+		UInt8 *	byteEnd = bytes;
+		UInt32	controls = 0;
+
+		FillRandom(&seed, data, sizeof(data), density);
+		end = sir_stuff_block(data + offset, length, block);
+		for (UInt32 i = 0; i < length; i++)
+		{
+			byteEnd = sir_stuff_byte(data[offset + i], byteEnd);
+			controls += IsControl(data[offset + i]);
+		}
+
+		// the same bytes as stuffing one at a time, one longer for every control byte, and no BOF or EOF left
+		USBTestCheckEqual(end - block, byteEnd - bytes);
+		USBTestCheck(memcmp(block, bytes, end - block) == 0);
+		USBTestCheckEqual(end - block, length + controls);
+		for (UInt8 *cp = block; cp < end; cp++)
+		{
+			USBTestCheck((*cp != 0xC0) && (*cp != 0xC1));
+			if (*cp == 0x7D)
+			{
+				cp++;
+				USBTestCheck((*cp == 0xE0) || (*cp == 0xE1) || (*cp == 0x5D));
+			}
+		}
+	}
+}
+
+//================================================================================================
+//	Receiving frames
+//================================================================================================
+
+// Frames with random data, separated by noise, fed to the parser in random sized pieces
+static void
+TestFramesRoundTrip(void)
+{
+	static UInt8	data[8][kTestMaxData];
+	static UInt8	stream[8 * (2 * kTestMaxData + 64)];
+	static UInt8	buffer[kTestCapacity];
+	UInt32			lengths[8];
+	unsigned int	seed = 4035;
+	UInt32			received = 0;
+
+	for (int round = 0; round < kTestRounds / 20; round++)
+	{
+		UInt32	frames = 1 + USBTestRandom(&seed) % 8;
+		UInt32	streamLength = 0;
+		UInt32	next = 0;
+		UInt32	dataLength = 0;
+		UInt8	state = kParseStateIdle;
+
+		for (UInt32 f = 0; f < frames; f++)
+		{
+			UInt32	noise = USBTestRandom(&seed) % 8;
+
+			// noise between frames is dropped in the idle state as long as it has no BOF in it
+			FillRandom(&seed, stream + streamLength, noise, 0);
+			streamLength += noise;
+
+			lengths[f] = 1 + USBTestRandom(&seed) % kTestMaxData;
+			FillRandom(&seed, data[f], lengths[f], USBTestRandom(&seed) % 16);
+			streamLength += BuildFrame(stream + streamLength, USBTestRandom(&seed) % 12, data[f], lengths[f]);
+		}
+
+		for (UInt32 used = 0; used < streamLength; )
+		{
+			UInt32	piece = 1 + USBTestRandom(&seed) % 300;
+			int		result;
+			UInt32	frameLength;
+			UInt32	n;
+
+			if (piece > streamLength - used)
+				piece = streamLength - used;
+
+			n = sir_parse_input(&state, buffer, &dataLength, kTestCapacity, stream + used, piece, &result, &frameLength);
+			USBTestCheck((n > 0) && (n <= piece));
+			used += n;
+
+			if (result == kSIRParseFrame)
+			{
+				USBTestCheck(next < frames);
+				if (next < frames)
+				{
+					USBTestCheckEqual(frameLength, lengths[next]);
+					USBTestCheck(memcmp(buffer, data[next], lengths[next]) == 0);
+				}
+				next++;
+				received++;
+			}
+			else
+			{
+				USBTestCheckEqual(result, kSIRParseMore);
+			}
+		}
+
+		USBTestCheckEqual(next, frames);
+		USBTestCheckEqual(state, kParseStateIdle);
+		USBTestCheckEqual(dataLength, 0);
+	}
+
+	printf("  %u frames received intact\n", (unsigned int)received);
+}
+
+static int
+ParseAll(const UInt8 *stream, UInt32 length, UInt32 capacity, UInt32 *frameLength)
+{
+	static UInt8	buffer[kTestCapacity];
+	UInt8			state = kParseStateIdle;
+	UInt32			dataLength = 0;
+	int				result = kSIRParseMore;
+
+	while (length > 0)
+	{
+		UInt32	n = sir_parse_input(&state, buffer, &dataLength, capacity, stream, length, &result, frameLength);
+
+		stream += n;
+		length -= n;
+		if (result != kSIRParseMore)
+			break;
+	}
+
+	return result;
+}
+
+static void
+TestBadFrames(void)
+{
+	static UInt8	data[kTestMaxData];
+	static UInt8	stream[2 * kTestMaxData + 64];
+	unsigned int	seed = 5035;
+	UInt32			length;
+	UInt32			frameLength;
+
+	FillRandom(&seed, data, sizeof(data), 8);
+
+	// a corrupted data byte is a CRC error, whatever byte it is changed to that isn't a control byte
+	length = BuildFrame(stream, 2, data, 100);
+	for (UInt32 i = 3; i < length - 1; i++)
+	{
+		UInt8	save = stream[i];
+
+		if (IsControl(save) || (stream[i - 1] == 0x7D))
+			continue;
+		stream[i] ^= 0x01;
+		if (!IsControl(stream[i]))
+			USBTestCheckEqual(ParseAll(stream, length, kTestCapacity, &frameLength), kSIRParseCRCError);
+		stream[i] = save;
+	}
+	USBTestCheckEqual(ParseAll(stream, length, kTestCapacity, &frameLength), kSIRParseFrame);
+	USBTestCheckEqual(frameLength, 100);
+
+	// EOF with only the CRC, or less, is short
+	{
+		const UInt8	shortFrames[3][5] = { { 0xC0, 0x11, 0xC1 }, { 0xC0, 0x11, 0x22, 0xC1 }, { 0xC0, 0xC0, 0x7D, 0x5D, 0xC1 } };
+		const UInt32	shortLengths[3] = { 3, 4, 5 };
+
+		for (int i = 0; i < 3; i++)
+			USBTestCheckEqual(ParseAll(shortFrames[i], shortLengths[i], kTestCapacity, &frameLength), kSIRParseShort);
+	}
+
+	// a frame that doesn't fit is dropped, with plain data or escaped bytes at the end
+	for (UInt32 capacity = 8; capacity < 40; capacity++)
+	{
+		length = BuildFrame(stream, 0, data, 64);
+		USBTestCheckEqual(ParseAll(stream, length, capacity, &frameLength), kSIRParseOverrun);
+		USBTestCheck(frameLength > capacity);
+
+		// and one that just fits is fine
+		length = BuildFrame(stream, 0, data, capacity - 2);
+		USBTestCheckEqual(ParseAll(stream, length, capacity, &frameLength), kSIRParseFrame);
+		USBTestCheckEqual(frameLength, capacity - 2);
+	}
+
+	// an EOF straight after the BOF is dropped without a result, and the next frame still comes through
+	{
+		UInt8	twoFrames[2 * kTestMaxData + 64] = { 0xC0, 0xC1 };
+
+		length = 2 + BuildFrame(twoFrames + 2, 1, data, 50);
+		USBTestCheckEqual(ParseAll(twoFrames, length, kTestCapacity, &frameLength), kSIRParseFrame);
+		USBTestCheckEqual(frameLength, 50);
+	}
+}
+
+//================================================================================================
+//	Timing
+//================================================================================================
+
+// What the driver did before: the CRCs a byte at a time, and SIRStuff called for every byte
+static UInt16
+ByteCRC16(UInt16 crc, const UInt8 *cp, UInt32 len)
+{
+	while (len--)
+		crc = (crc >> 8) ^ crc16_table[0][(crc ^ *cp++) & 0xff];
+	return crc;
+}
+
+static UInt32
+ByteCRC32(UInt32 crc, const UInt8 *cp, UInt32 len)
+{
+	while (len--)
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *cp++) & 0xff];
+	return crc;
+}
+
+static double
+Elapsed(clock_t start)
+{
+	return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / ((double)kTestTimingBytes * 16);
+}
+
+static void
+TestTiming(void)
+{
+	static UInt8	data[kTestTimingBytes];
+	static UInt8	out[2 * kTestTimingBytes];
+	unsigned int	seed = 6035;
+	UInt32			check32 = 0, byte32 = 0;
+	UInt16			check16 = 0, byte16 = 0;
+	UInt8 *			end = out;
+	clock_t			start;
+	double			fast, slow;
+
+	FillRandom(&seed, data, sizeof(data), 256);
+
+	start = clock();
+	for (int i = 0; i < 16; i++)
+		check16 ^= update_crc16(0xffff, data, kTestTimingBytes);
+	fast = Elapsed(start);
+	start = clock();
+	for (int i = 0; i < 16; i++)
+		byte16 ^= ByteCRC16(0xffff, data, kTestTimingBytes);
+	slow = Elapsed(start);
+	printf("  CRC-16: slice-by-8 %.2f ns/byte, byte at a time %.2f ns/byte\n", fast, slow);
+	USBTestCheckEqual(check16, byte16);
+
+	start = clock();
+	for (int i = 0; i < 16; i++)
+		check32 ^= update_crc32(INITIAL_CRC, data, kTestTimingBytes);
+	fast = Elapsed(start);
+	start = clock();
+	for (int i = 0; i < 16; i++)
+		byte32 ^= ByteCRC32(INITIAL_CRC, data, kTestTimingBytes);
+	slow = Elapsed(start);
+	printf("  CRC-32: slice-by-8 %.2f ns/byte, byte at a time %.2f ns/byte\n", fast, slow);
+	USBTestCheckEqual(check32, byte32);
+
+	// typical data, one control byte in 256
+	start = clock();
+	for (int i = 0; i < 16; i++)
+		end = sir_stuff_block(data, kTestTimingBytes, out);
+	fast = Elapsed(start);
+	start = clock();
+	for (int i = 0; i < 16; i++)
+	{
+		end = out;
+		for (UInt32 j = 0; j < kTestTimingBytes; j++)
+			end = sir_stuff_byte(data[j], end);
+	}
+	slow = Elapsed(start);
+	printf("  stuffing: block %.2f ns/byte, byte at a time %.2f ns/byte\n", fast, slow);
+	USBTestCheck(end > out);
+}
+
+int
+main(void)
+{
+	gen_crc16_table();
+	gen_crc32_table();
+
+	USBTestRun(TestCRCCheckValues);
+	USBTestRun(TestCRCAgainstReference);
+	USBTestRun(TestCRC16CatchesBitFlips);
+	USBTestRun(TestPlainSpan);
+	USBTestRun(TestStuffing);
+	USBTestRun(TestFramesRoundTrip);
+	USBTestRun(TestBadFrames);
+	USBTestRun(TestTiming);
+
+	return USBTestSummary("SIRFramingTests");
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	USBDescriptorCacheTests
+//
+//	Checks the descriptor cache rules in IOUSBFamily/Headers/USBDescriptorCache.h: the key, which
+//	devices may use the cache, and when a cached entry is reused or replaced.  Then drives a
+//	table through them the way IOUSBDevice's DescriptorCacheCopyEntry drives its OSDictionary, for
+//	hubs full of identical devices, devices swapped or updated in place and a full cache.
+//
+//================================================================================================
+
+#include "USBTestHarness.h"
+#include <IOKit/usb/USB.h>
+#include "../IOUSBFamily/Headers/USBDescriptorCache.h"
+
+static void
+MakeDevice(IOUSBDeviceDescriptor *desc, UInt16 vendor, UInt16 product, UInt16 release, UInt8 serialIndex)
+{
+	bzero(desc, sizeof(*desc));
+	desc->bLength = sizeof(*desc);
+	desc->bDescriptorType = kUSBDeviceDesc;
+	desc->bcdUSB = HostToUSBWord(0x0200);
+	desc->bMaxPacketSize0 = 64;
+	desc->idVendor = HostToUSBWord(vendor);
+	desc->idProduct = HostToUSBWord(product);
+	desc->bcdDevice = HostToUSBWord(release);
+	desc->iManufacturer = 1;
+	desc->iProduct = 2;
+	desc->iSerialNumber = serialIndex;
+	desc->bNumConfigurations = 1;
+}
+
+//================================================================================================
+//	Rules
+//================================================================================================
+
+static void
+TestKey(void)
+{
+	IOUSBDeviceDescriptor	desc;
+	IOUSBDeviceDescriptor	other;
+	char					key[kUSBDescriptorCacheKeySize];
+	char					otherKey[kUSBDescriptorCacheKeySize];
+
+	MakeDevice(&desc, 0x05AC, 0x8242, 0x0100, 0);
+	USBDescriptorCacheMakeKey(key, 0x14100000, &desc);
+	USBTestCheck(strcmp(key, "14100000-05ac-8242-0100") == 0);
+
+	// the largest values still fit
+	MakeDevice(&other, 0xFFFF, 0xFFFF, 0xFFFF, 0);
+	USBDescriptorCacheMakeKey(otherKey, 0xFFFFFFFF, &other);
+	USBTestCheck(strcmp(otherKey, "ffffffff-ffff-ffff-ffff") == 0);
+
+	// each part of the key counts
+	USBDescriptorCacheMakeKey(otherKey, 0x14200000, &desc);
+	USBTestCheck(strcmp(key, otherKey) != 0);
+	MakeDevice(&other, 0x05AD, 0x8242, 0x0100, 0);
+	USBDescriptorCacheMakeKey(otherKey, 0x14100000, &other);
+	USBTestCheck(strcmp(key, otherKey) != 0);
+	MakeDevice(&other, 0x05AC, 0x8243, 0x0100, 0);
+	USBDescriptorCacheMakeKey(otherKey, 0x14100000, &other);
+	USBTestCheck(strcmp(key, otherKey) != 0);
+	MakeDevice(&other, 0x05AC, 0x8242, 0x0101, 0);
+	USBDescriptorCacheMakeKey(otherKey, 0x14100000, &other);
+	USBTestCheck(strcmp(key, otherKey) != 0);
+
+	// and the rest of the device descriptor doesn't
+	MakeDevice(&other, 0x05AC, 0x8242, 0x0100, 3);
+	other.bMaxPacketSize0 = 8;
+	USBDescriptorCacheMakeKey(otherKey, 0x14100000, &other);
+	USBTestCheck(strcmp(key, otherKey) == 0);
+}
+
+static void
+TestUsable(void)
+{
+	USBTestCheck(USBDescriptorCacheUsable(true, false, 3, true));
+
+	// without a serial number string there is nothing to read, and the device is cached
+	USBTestCheck(USBDescriptorCacheUsable(true, false, 0, true));
+
+	USBTestCheck(!USBDescriptorCacheUsable(false, false, 3, true));			// root hub
+	USBTestCheck(!USBDescriptorCacheUsable(true, true, 3, true));			// kUSBDontCacheDescriptors
+	USBTestCheck(!USBDescriptorCacheUsable(true, true, 0, true));
+	USBTestCheck(!USBDescriptorCacheUsable(true, false, 3, false));			// serial number string that couldn't be read
+}
+
+static void
+TestMatches(void)
+{
+	IOUSBDeviceDescriptor	cached;
+	IOUSBDeviceDescriptor	desc;
+
+	MakeDevice(&cached, 0x046D, 0xC31C, 0x6400, 3);
+	desc = cached;
+	USBTestCheck(USBDescriptorCacheEntryMatches(&cached, sizeof(cached), "ABC123", &desc, "ABC123"));
+	USBTestCheck(!USBDescriptorCacheEntryMatches(&cached, sizeof(cached), "ABC123", &desc, "ABC124"));
+	USBTestCheck(!USBDescriptorCacheEntryMatches(&cached, sizeof(cached), "ABC123", &desc, ""));
+	USBTestCheck(!USBDescriptorCacheEntryMatches(&cached, sizeof(cached), "", &desc, "ABC123"));
+
+	// serial-less devices are compared on their device descriptor alone
+	MakeDevice(&cached, 0x046D, 0xC31C, 0x6400, 0);
+	desc = cached;
+	USBTestCheck(USBDescriptorCacheEntryMatches(&cached, sizeof(cached), "", &desc, ""));
+
+	// any change to the device descriptor replaces the entry
+	for ( UInt32 i = 0; i < sizeof(desc); i++ )
+	{
+		desc = cached;
+		((UInt8 *)&desc)[i] ^= 0x01;
+		USBTestCheck(!USBDescriptorCacheEntryMatches(&cached, sizeof(cached), "", &desc, ""));
+	}
+
+	// a damaged entry never matches
+	desc = cached;
+	USBTestCheck(!USBDescriptorCacheEntryMatches(&cached, sizeof(cached) - 1, "", &desc, ""));
+	USBTestCheck(!USBDescriptorCacheEntryMatches(NULL, sizeof(cached), "", &desc, ""));
+	USBTestCheck(!USBDescriptorCacheEntryMatches(&cached, sizeof(cached), NULL, &desc, ""));
+}
+
+//================================================================================================
+//	A cache
+//================================================================================================
+
+enum
+{
+	kLookupHit,
+	kLookupAdded,
+	kLookupReplaced,
+	kLookupFlushed
+};
+
+typedef struct TestEntry
+{
+	char					key[kUSBDescriptorCacheKeySize];
+	IOUSBDeviceDescriptor	desc;
+	char					serial[64];
+} TestEntry;
+
+typedef struct TestCache
+{
+	TestEntry		entries[kUSBDescriptorCacheMaxEntries];
+	UInt32			count;
+} TestCache;
+
+// DescriptorCacheCopyEntry with an array in place of the OSDictionary
+static UInt32
+Lookup(TestCache *cache, UInt32 locationID, const IOUSBDeviceDescriptor *desc, const char *serial)
+{
+	char		key[kUSBDescriptorCacheKeySize];
+	UInt32		result = kLookupAdded;
+	UInt32		i;
+
+	USBDescriptorCacheMakeKey(key, locationID, desc);
+	for ( i = 0; i < cache->count; i++ )
+	{
+		if ( strcmp(cache->entries[i].key, key) != 0 )
+			continue;
+
+		if ( USBDescriptorCacheEntryMatches(&cache->entries[i].desc, sizeof(cache->entries[i].desc), cache->entries[i].serial, desc, serial) )
+			return kLookupHit;
+
+		cache->entries[i] = cache->entries[--cache->count];
+		result = kLookupReplaced;
+		break;
+	}
+
+	if ( USBDescriptorCacheMustFlush(cache->count) )
+	{
+		cache->count = 0;
+		result = kLookupFlushed;
+	}
+
+	USBTestCheck(cache->count < kUSBDescriptorCacheMaxEntries);
+	snprintf(cache->entries[cache->count].key, sizeof(cache->entries[cache->count].key), "%s", key);
+	cache->entries[cache->count].desc = *desc;
+	snprintf(cache->entries[cache->count].serial, sizeof(cache->entries[cache->count].serial), "%s", serial);
+	cache->count++;
+
+	return result;
+}
+
+// Seven identical keyboards without serial numbers behind one hub, each re-enumerated a few times
+static void
+TestIdenticalDevices(void)
+{
+	static TestCache		cache;
+	IOUSBDeviceDescriptor	desc;
+
+	cache.count = 0;
+	MakeDevice(&desc, 0x05AC, 0x0250, 0x0224, 0);
+
+	for ( UInt32 port = 1; port <= 7; port++ )
+		USBTestCheckEqual(Lookup(&cache, 0x14100000 | (port << 16), &desc, ""), kLookupAdded);
+	USBTestCheckEqual(cache.count, 7);
+
+	for ( int round = 0; round < 3; round++ )
+		for ( UInt32 port = 1; port <= 7; port++ )
+			USBTestCheckEqual(Lookup(&cache, 0x14100000 | (port << 16), &desc, ""), kLookupHit);
+	USBTestCheckEqual(cache.count, 7);
+}
+
+// Devices which change while keeping their location
+static void
+TestChangedDevices(void)
+{
+	static TestCache		cache;
+	IOUSBDeviceDescriptor	desc;
+	IOUSBDeviceDescriptor	updated;
+
+	cache.count = 0;
+	MakeDevice(&desc, 0x0781, 0x5581, 0x0100, 3);
+
+	// another stick of the same model plugged into the same port
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &desc, "4C530001"), kLookupAdded);
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &desc, "4C530001"), kLookupHit);
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &desc, "4C530002"), kLookupReplaced);
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &desc, "4C530001"), kLookupReplaced);
+	USBTestCheckEqual(cache.count, 1);
+
+	// a firmware update that changed bcdDevice is a different key, and the old entry stays until a flush
+	updated = desc;
+	updated.bcdDevice = HostToUSBWord(0x0101);
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &updated, "4C530001"), kLookupAdded);
+	USBTestCheckEqual(cache.count, 2);
+
+	// one that kept bcdDevice but changed the rest of the device descriptor replaces the entry
+	updated = desc;
+	updated.bNumConfigurations = 2;
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &updated, "4C530001"), kLookupReplaced);
+	USBTestCheckEqual(Lookup(&cache, 0x14200000, &updated, "4C530001"), kLookupHit);
+	USBTestCheckEqual(cache.count, 2);
+
+	// a device whose serial number was blank and now isn't
+	MakeDevice(&desc, 0x1234, 0x5678, 0x0001, 3);
+	USBTestCheckEqual(Lookup(&cache, 0x14300000, &desc, ""), kLookupAdded);
+	USBTestCheckEqual(Lookup(&cache, 0x14300000, &desc, "0001"), kLookupReplaced);
+}
+
+static void
+TestFlush(void)
+{
+	static TestCache		cache;
+	IOUSBDeviceDescriptor	desc;
+
+	cache.count = 0;
+	MakeDevice(&desc, 0x05AC, 0x0250, 0x0224, 0);
+
+	for ( UInt32 i = 0; i < kUSBDescriptorCacheMaxEntries; i++ )
+		USBTestCheckEqual(Lookup(&cache, 0x14000000 + (i << 8), &desc, ""), kLookupAdded);
+	USBTestCheckEqual(cache.count, kUSBDescriptorCacheMaxEntries);
+
+	// every device is still there
+	for ( UInt32 i = 0; i < kUSBDescriptorCacheMaxEntries; i++ )
+		USBTestCheckEqual(Lookup(&cache, 0x14000000 + (i << 8), &desc, ""), kLookupHit);
+
+	// a replacement makes room for itself, so it doesn't flush
+	desc.bMaxPacketSize0 = 8;
+	USBTestCheckEqual(Lookup(&cache, 0x14000000, &desc, ""), kLookupReplaced);
+	USBTestCheckEqual(cache.count, kUSBDescriptorCacheMaxEntries);
+
+	// the 65th device throws everything else away
+	USBTestCheckEqual(Lookup(&cache, 0x15000000, &desc, ""), kLookupFlushed);
+	USBTestCheckEqual(cache.count, 1);
+	USBTestCheckEqual(Lookup(&cache, 0x14000100, &desc, ""), kLookupAdded);
+	USBTestCheckEqual(Lookup(&cache, 0x15000000, &desc, ""), kLookupHit);
+}
+
+int
+main(void)
+{
+	USBTestRun(TestKey);
+	USBTestRun(TestUsable);
+	USBTestRun(TestMatches);
+	USBTestRun(TestIdenticalDevices);
+	USBTestRun(TestChangedDevices);
+	USBTestRun(TestFlush);
+
+	return USBTestSummary("USBDescriptorCacheTests");
+}
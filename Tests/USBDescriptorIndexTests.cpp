@@ -0,0 +1,702 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	USBDescriptorIndexTests
+//
+//	Checks the configuration descriptor index in IOUSBFamily/Headers/USBDescriptorIndex.h
+//	against the NextDescriptor() scans it stands in for in IOUSBDevice::FindNextDescriptor,
+//	IOUSBDevice::FindNextInterfaceDescriptor and the FindNextAssociatedDescriptor walks of
+//	IOUSBInterface and IOUSBInterfaceClass.  Every lookup is made from every byte of hand built
+//	and randomly damaged configurations, so the index has to either give the scan's answer or
+//	decline a starting pointer it doesn't know.  Then times both on the configuration of a
+//	composite camera with a microphone.
+//
+//================================================================================================
+
+#include <time.h>
+
+#include "USBTestHarness.h"
+#include <IOKit/usb/USB.h>
+#include "../IOUSBFamily/Headers/USBDescriptorIndex.h"
+
+enum
+{
+	kTestPad					= 16,			// zeroes after every configuration, like the 2 IOUSBInterfaceClass adds
+	kTestMaxConfig				= 8192,
+	kTestTimingRounds			= 2000
+};
+
+// The descriptor types the lookups are made for
+static const UInt8	kTestTypes[] = { kUSBAnyDesc, kUSBConfDesc, kUSBInterfaceDesc, kUSBEndpointDesc, kUSBInterfaceAssociationDesc, 0x21, 0x24, 0x25, 0x30, 0x99 };
+
+//================================================================================================
+//	The scans, as in IOUSBDevice.cpp and IOUSBInterface.cpp
+//================================================================================================
+
+static const IOUSBDescriptorHeader *
+ScanNextDescriptor(const void *desc)
+{
+	const UInt8 *	next = (const UInt8 *)desc;
+
+	if ( next[0] == 0 )
+		return NULL;
+
+	return (const IOUSBDescriptorHeader *)&next[next[0]];
+}
+
+// IOUSBDevice::FindNextDescriptor once it has found the configuration
+static const IOUSBDescriptorHeader *
+ScanFindNext(const UInt8 *config, UInt32 length, const void *cur, UInt8 type)
+{
+	const IOUSBDescriptorHeader *	hdr;
+
+	if ( !cur )
+		hdr = (const IOUSBDescriptorHeader *)config;
+	else
+	{
+		if ( (cur < (const void *)config) || (((uintptr_t)cur - (uintptr_t)config) >= length) )
+			return NULL;
+		hdr = (const IOUSBDescriptorHeader *)cur;
+	}
+
+	while ( true )
+	{
+		const IOUSBDescriptorHeader *	lasthdr = hdr;
+
+		hdr = ScanNextDescriptor(hdr);
+		if ( (hdr == NULL) || (lasthdr == hdr) )
+			return NULL;
+		if ( ((uintptr_t)hdr - (uintptr_t)config) >= length )
+			return NULL;
+		if ( (type == kUSBAnyDesc) || (hdr->bDescriptorType == type) )
+			return hdr;
+	}
+}
+
+// IOUSBInterface::FindNextAssociatedDescriptor
+static const IOUSBDescriptorHeader *
+ScanFindNextAssociated(const UInt8 *config, UInt32 length, const void *current, UInt8 type, UInt8 interfaceNumber)
+{
+	const IOUSBDescriptorHeader *	next = (const IOUSBDescriptorHeader *)current;
+
+	while ( true )
+	{
+		next = ScanFindNext(config, length, next, kUSBAnyDesc);
+		if ( !next || (next->bDescriptorType == kUSBInterfaceAssociationDesc) || ((next->bDescriptorType == kUSBInterfaceDesc) && (type != kUSBInterfaceDesc)) )
+			return NULL;
+		if ( (next->bDescriptorType == kUSBInterfaceDesc) && (((const IOUSBInterfaceDescriptor *)next)->bInterfaceNumber != interfaceNumber) )
+			return NULL;
+		if ( (next->bDescriptorType == type) || (type == kUSBAnyDesc) )
+			return next;
+	}
+}
+
+// IOUSBDevice::FindNextInterfaceDescriptor without an index
+static const IOUSBInterfaceDescriptor *
+ScanFindNextInterface(const UInt8 *config, const void *current, const IOUSBFindInterfaceRequest *request)
+{
+	const UInt8 *						end = config + USBToHostWord(((const IOUSBConfigurationDescriptor *)config)->wTotalLength);
+	const IOUSBInterfaceDescriptor *	interface = (const IOUSBInterfaceDescriptor *)ScanNextDescriptor(current ? current : config);
+
+	while ( interface && ((const UInt8 *)interface < end) )
+	{
+		if ( (interface->bDescriptorType == kUSBInterfaceDesc) && USBInterfaceMatchesRequest(interface, request) )
+			return interface;
+		interface = (const IOUSBInterfaceDescriptor *)ScanNextDescriptor(interface);
+	}
+
+	return NULL;
+}
+
+//================================================================================================
+//	Building configurations
+//================================================================================================
+
+typedef struct TestConfig
+{
+	UInt8		bytes[kTestMaxConfig + kTestPad];
+	UInt32		length;
+} TestConfig;
+
+static void
+StartConfig(TestConfig *config)
+{
+	bzero(config, sizeof(*config));
+	config->bytes[0] = 9;
+	config->bytes[1] = kUSBConfDesc;
+	config->length = 9;
+}
+
+static void
+AddDescriptor(TestConfig *config, UInt8 length, UInt8 type, UInt8 b2 = 0, UInt8 b3 = 0, UInt8 b5 = 0)
+{
+	UInt8 *		desc = &config->bytes[config->length];
+
+	if ( config->length + length > kTestMaxConfig )
+		return;
+
+	desc[0] = length;
+	desc[1] = type;
+	if ( length > 2 )
+		desc[2] = b2;
+	if ( length > 3 )
+		desc[3] = b3;
+	if ( length > 5 )
+		desc[5] = b5;
+	config->length += length;
+}
+
+static void
+AddInterface(TestConfig *config, UInt8 number, UInt8 alternate, UInt8 interfaceClass)
+{
+	AddDescriptor(config, 9, kUSBInterfaceDesc, number, alternate, interfaceClass);
+}
+
+static void
+AddEndpoint(TestConfig *config, UInt8 address)
+{
+	AddDescriptor(config, 7, kUSBEndpointDesc, address, 0);
+}
+
+// wTotalLength is the length built so far unless the test wants something else
+static void
+FinishConfig(TestConfig *config, UInt32 totalLength)
+{
+	config->bytes[2] = (UInt8)(totalLength & 0xFF);
+	config->bytes[3] = (UInt8)(totalLength >> 8);
+}
+
+static USBDescriptorIndex *
+BuildIndex(const TestConfig *config, UInt32 length)
+{
+	USBDescriptorIndex *	index;
+	UInt16					count = 0;
+	UInt16					typeCount = 0;
+	UInt32					size;
+
+	size = USBDescriptorIndexSize(config->bytes, length, &count, &typeCount);
+	if ( size == 0 )
+		return NULL;
+
+	index = (USBDescriptorIndex *)malloc(size);
+	if ( index )
+		USBDescriptorIndexBuild(index, size, config->bytes, length, count, typeCount);
+
+	return index;
+}
+
+//================================================================================================
+//	Comparing every lookup
+//================================================================================================
+
+typedef struct CompareCounts
+{
+	UInt32		answered;
+	UInt32		declined;
+} CompareCounts;
+
+// Starting offsets the scans reach, which the index must know
+static void
+MarkReachable(const TestConfig *config, UInt32 length, bool *reachable)
+{
+	const IOUSBDescriptorHeader *	hdr = (const IOUSBDescriptorHeader *)config->bytes;
+
+	bzero(reachable, length);
+	while ( hdr && (((uintptr_t)hdr - (uintptr_t)config->bytes) + sizeof(IOUSBDescriptorHeader) <= length) )
+	{
+		reachable[(uintptr_t)hdr - (uintptr_t)config->bytes] = true;
+		if ( hdr->bLength == 0 )
+			break;
+		hdr = (const IOUSBDescriptorHeader *)((const UInt8 *)hdr + hdr->bLength);
+	}
+}
+
+// The scans can step onto a last descriptor with less than a header left.  They read its bDescriptorType from past the
+// end of the configuration, where the index stops, so it returns NULL for that one.
+static bool
+SameAnswer(const TestConfig *config, UInt32 length, const void *indexed, const void *scanned)
+{
+	if ( indexed == scanned )
+		return true;
+
+	return (indexed == NULL) && (((uintptr_t)scanned - (uintptr_t)config->bytes) + sizeof(IOUSBDescriptorHeader) > length);
+}
+
+static void
+CompareAll(const TestConfig *config, UInt32 length, CompareCounts *counts)
+{
+	static bool						reachable[kTestMaxConfig + kTestPad];
+	USBDescriptorIndex *			index = BuildIndex(config, length);
+	IOUSBFindInterfaceRequest		requests[3];
+	UInt32							failures = gUSBTestFailures;
+
+	USBTestCheck(index != NULL);
+	if ( !index )
+		return;
+
+	requests[0].bInterfaceClass = requests[0].bInterfaceSubClass = requests[0].bInterfaceProtocol = requests[0].bAlternateSetting = kIOUSBFindInterfaceDontCare;
+	requests[1] = requests[0];
+	requests[1].bInterfaceClass = 0x0E;
+	requests[2] = requests[0];
+	requests[2].bAlternateSetting = 1;
+
+	MarkReachable(config, length, reachable);
+
+	// Every byte of the configuration, and NULL for the configuration descriptor itself
+	for ( SInt32 offset = -1; offset < (SInt32)length; offset++ )
+	{
+		const void *	start = (offset < 0) ? NULL : (const void *)&config->bytes[offset];
+		bool			known = (offset < 0) || reachable[offset];
+
+		for ( UInt32 t = 0; t < sizeof(kTestTypes); t++ )
+		{
+			const IOUSBDescriptorHeader *	next = (const IOUSBDescriptorHeader *)1;
+
+			if ( USBDescriptorIndexFindNext(index, config->bytes, start, kTestTypes[t], &next) )
+			{
+				USBTestCheck(known);
+				USBTestCheck(SameAnswer(config, length, next, ScanFindNext(config->bytes, length, start, kTestTypes[t])));
+				counts->answered++;
+			}
+			else
+			{
+				USBTestCheck(!known);
+				counts->declined++;
+			}
+
+			if ( !start )
+				continue;
+
+			for ( UInt8 interfaceNumber = 0; interfaceNumber < 3; interfaceNumber++ )
+			{
+				next = (const IOUSBDescriptorHeader *)1;
+				if ( USBDescriptorIndexFindNextAssociated(index, config->bytes, start, kTestTypes[t], interfaceNumber, &next) )
+				{
+					USBTestCheck(known);
+					USBTestCheck(SameAnswer(config, length, next, ScanFindNextAssociated(config->bytes, length, start, kTestTypes[t], interfaceNumber)));
+					counts->answered++;
+				}
+				else
+				{
+					USBTestCheck(!known);
+					counts->declined++;
+				}
+			}
+		}
+
+		// FindNextInterfaceDescriptor only takes interface descriptors
+		if ( start && (config->bytes[offset + 1] != kUSBInterfaceDesc) )
+			continue;
+
+		for ( UInt32 r = 0; r < 3; r++ )
+		{
+			const IOUSBInterfaceDescriptor *	interface = (const IOUSBInterfaceDescriptor *)1;
+
+			if ( USBDescriptorIndexFindNextInterface(index, config->bytes, start, &requests[r], &interface) )
+			{
+				USBTestCheck(known);
+				USBTestCheck(SameAnswer(config, length, interface, ScanFindNextInterface(config->bytes, start, &requests[r])));
+				counts->answered++;
+			}
+			else
+			{
+				USBTestCheck(!known);
+				counts->declined++;
+			}
+		}
+
+		// Stop after the first mismatch of a configuration instead of reporting every byte of it
+		if ( gUSBTestFailures != (int)failures )
+			break;
+	}
+
+	// Pointers outside the configuration are never looked up
+	{
+		const IOUSBDescriptorHeader *	next;
+
+		USBTestCheck(!USBDescriptorIndexFindNext(index, config->bytes, &config->bytes[length], kUSBAnyDesc, &next));
+		USBTestCheck(!USBDescriptorIndexFindNext(index, config->bytes, &config->bytes[length + 1], kUSBAnyDesc, &next));
+		USBTestCheck(!USBDescriptorIndexFindNextAssociated(index, config->bytes, (const UInt8 *)config->bytes - 9, kUSBAnyDesc, 0, &next));
+	}
+
+	free(index);
+}
+
+// A HID keyboard with a second interface of two alternate settings, and an IAD grouping two more interfaces
+static void
+BuildSample(TestConfig *config)
+{
+	StartConfig(config);
+	AddInterface(config, 0, 0, 3);
+	AddDescriptor(config, 9, 0x21);
+	AddEndpoint(config, 0x81);
+	AddInterface(config, 1, 0, 0xFF);
+	AddInterface(config, 1, 1, 0xFF);
+	AddEndpoint(config, 0x82);
+	AddEndpoint(config, 0x02);
+	AddDescriptor(config, 8, kUSBInterfaceAssociationDesc, 2, 2);
+	AddInterface(config, 2, 0, 0x0E);
+	AddDescriptor(config, 13, 0x24, 1);
+	AddEndpoint(config, 0x83);
+	AddInterface(config, 3, 0, 0x0E);
+	AddInterface(config, 3, 1, 0x0E);
+	AddDescriptor(config, 14, 0x24, 2);
+	AddEndpoint(config, 0x84);
+	AddDescriptor(config, 6, 0x30);
+}
+
+static void
+TestWellFormed(void)
+{
+	static TestConfig	config;
+	CompareCounts		counts = { 0, 0 };
+	USBDescriptorIndex *index;
+	const IOUSBDescriptorHeader *next;
+
+	BuildSample(&config);
+	FinishConfig(&config, config.length);
+	CompareAll(&config, config.length, &counts);
+
+	// A few answers spelled out, so a scan and an index that are wrong the same way still fail
+	index = BuildIndex(&config, config.length);
+	USBTestCheck(USBDescriptorIndexFindNext(index, config.bytes, NULL, kUSBEndpointDesc, &next));
+	USBTestCheck(next == (const IOUSBDescriptorHeader *)&config.bytes[9 + 9 + 9]);
+	USBTestCheck(USBDescriptorIndexFindNextAssociated(index, config.bytes, &config.bytes[9 + 9 + 9 + 7], kUSBInterfaceDesc, 1, &next));
+	USBTestCheck(next == (const IOUSBDescriptorHeader *)&config.bytes[9 + 9 + 9 + 7 + 9]);
+	USBTestCheck(USBDescriptorIndexFindNextAssociated(index, config.bytes, &config.bytes[9 + 9 + 9 + 7 + 9 + 9 + 7], kUSBEndpointDesc, 1, &next));
+	USBTestCheck(next == NULL);
+	free(index);
+
+	USBTestCheck(counts.answered > 0);
+}
+
+static void
+TestMalformed(void)
+{
+	static TestConfig	config;
+	CompareCounts		counts = { 0, 0 };
+
+	// bLength 0 in the middle ends both walks there
+	BuildSample(&config);
+	config.bytes[9 + 9 + 9] = 0;
+	FinishConfig(&config, config.length);
+	CompareAll(&config, config.length, &counts);
+
+	// the last descriptor runs past wTotalLength
+	BuildSample(&config);
+	config.bytes[config.length - 6] = 40;
+	FinishConfig(&config, config.length);
+	CompareAll(&config, config.length, &counts);
+
+	// wTotalLength shorter than the descriptors, so FindNextInterfaceDescriptor stops early
+	BuildSample(&config);
+	FinishConfig(&config, 60);
+	CompareAll(&config, config.length, &counts);
+
+	// truncated interface and endpoint descriptors, the last one cut down to its header
+	BuildSample(&config);
+	AddDescriptor(&config, 4, kUSBEndpointDesc, 0x85);
+	AddDescriptor(&config, 5, kUSBInterfaceDesc, 1, 2);
+	AddDescriptor(&config, 2, kUSBInterfaceDesc);
+	FinishConfig(&config, config.length);
+	CompareAll(&config, config.length, &counts);
+
+	// a single byte left after the last descriptor, which is where the index returns NULL and the scan reads past the end
+	BuildSample(&config);
+	config.bytes[config.length++] = 0x07;
+	FinishConfig(&config, config.length);
+	CompareAll(&config, config.length, &counts);
+
+	// a configuration descriptor of bLength 0 and one of just a header
+	StartConfig(&config);
+	config.bytes[0] = 0;
+	FinishConfig(&config, config.length);
+	CompareAll(&config, config.length, &counts);
+	StartConfig(&config);
+	config.bytes[0] = 2;
+	CompareAll(&config, 2, &counts);
+
+	// nothing to index at all
+	{
+		UInt16	count, typeCount;
+
+		USBTestCheckEqual(USBDescriptorIndexSize(config.bytes, 1, &count, &typeCount), 0);
+		USBTestCheckEqual(USBDescriptorIndexSize(NULL, 100, &count, &typeCount), 0);
+	}
+}
+
+// Random configurations, some of them damaged by a stray byte
+static void
+TestRandom(void)
+{
+	static TestConfig	config;
+	unsigned int		seed = 11;
+	CompareCounts		counts = { 0, 0 };
+
+	for ( int trial = 0; trial < 300; trial++ )
+	{
+		UInt32	descriptors = 1 + (USBTestRandom(&seed) % 40);
+
+		StartConfig(&config);
+		for ( UInt32 i = 0; i < descriptors; i++ )
+		{
+			switch ( USBTestRandom(&seed) % 6 )
+			{
+				case 0:		AddInterface(&config, (UInt8)(USBTestRandom(&seed) % 3), (UInt8)(USBTestRandom(&seed) % 2), (USBTestRandom(&seed) & 1) ? 0x0E : 3);	break;
+				case 1:		AddDescriptor(&config, 8, kUSBInterfaceAssociationDesc, (UInt8)(USBTestRandom(&seed) % 3), 2);	break;
+				case 2:
+				case 3:		AddEndpoint(&config, (UInt8)(0x80 | (USBTestRandom(&seed) % 16)));	break;
+				default:	AddDescriptor(&config, (UInt8)(2 + (USBTestRandom(&seed) % 30)), kTestTypes[USBTestRandom(&seed) % sizeof(kTestTypes)] | 0x20, (UInt8)USBTestRandom(&seed));	break;
+			}
+		}
+
+		if ( (USBTestRandom(&seed) % 3) == 0 )
+			config.bytes[USBTestRandom(&seed) % config.length] = (UInt8)USBTestRandom(&seed);
+
+		FinishConfig(&config, (USBTestRandom(&seed) % 4) ? config.length : (USBTestRandom(&seed) % (config.length + 1)));
+		CompareAll(&config, config.length, &counts);
+	}
+
+	printf("  %u lookups answered by the index and checked against the scan, %u declined\n", (unsigned)counts.answered, (unsigned)counts.declined);
+}
+
+//================================================================================================
+//	Timing
+//================================================================================================
+
+// A UVC camera with an UAC microphone: an IAD and a video control interface with its units, a
+// video streaming interface with MJPEG and uncompressed formats of many frame sizes, then an IAD
+// for an audio control interface and an audio streaming interface with several alternate settings
+static void
+BuildCamera(TestConfig *config)
+{
+	StartConfig(config);
+
+	AddDescriptor(config, 8, kUSBInterfaceAssociationDesc, 0, 2);
+	AddInterface(config, 0, 0, 0x0E);
+	AddDescriptor(config, 13, 0x24, 1);
+	AddDescriptor(config, 18, 0x24, 2);
+	for ( int unit = 0; unit < 6; unit++ )
+		AddDescriptor(config, 27, 0x24, 6);
+	AddDescriptor(config, 9, 0x24, 3);
+	AddEndpoint(config, 0x83);
+	AddDescriptor(config, 5, 0x25, 3);
+
+	AddInterface(config, 1, 0, 0x0E);
+	AddDescriptor(config, 16, 0x24, 1);
+	for ( int format = 0; format < 2; format++ )
+	{
+		AddDescriptor(config, 27, 0x24, format ? 4 : 6);
+		for ( int frame = 0; frame < 30; frame++ )
+			AddDescriptor(config, 50, 0x24, format ? 5 : 7);
+		AddDescriptor(config, 6, 0x24, 13);
+	}
+	for ( UInt8 alternate = 1; alternate <= 11; alternate++ )
+	{
+		AddInterface(config, 1, alternate, 0x0E);
+		AddEndpoint(config, 0x81);
+	}
+
+	AddDescriptor(config, 8, kUSBInterfaceAssociationDesc, 2, 2);
+	AddInterface(config, 2, 0, 1);
+	AddDescriptor(config, 9, 0x24, 1);
+	AddDescriptor(config, 12, 0x24, 2);
+	AddDescriptor(config, 9, 0x24, 6);
+	AddDescriptor(config, 9, 0x24, 3);
+	AddInterface(config, 3, 0, 1);
+	for ( UInt8 alternate = 1; alternate <= 4; alternate++ )
+	{
+		AddInterface(config, 3, alternate, 1);
+		AddDescriptor(config, 7, 0x24, 1);
+		AddDescriptor(config, 11, 0x24, 2);
+		AddDescriptor(config, 9, kUSBEndpointDesc, 0x84);
+		AddDescriptor(config, 7, 0x25, 1);
+	}
+
+	FinishConfig(config, config->length);
+}
+
+// What a driver does when it opens the camera: list every interface, find each alternate setting's endpoints the way
+// CreatePipes does, and walk the class specific descriptors of the streaming interface.  Each lookup starts where the
+// last one stopped, so the scans only step over a few descriptors each time.
+static UInt32
+WalkCamera(const TestConfig *config, const USBDescriptorIndex *index)
+{
+	IOUSBFindInterfaceRequest			request;
+	const IOUSBInterfaceDescriptor *	interface = NULL;
+	const IOUSBDescriptorHeader *		desc;
+	UInt32								found = 0;
+
+	request.bInterfaceClass = request.bInterfaceSubClass = request.bInterfaceProtocol = request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+	while ( true )
+	{
+		const IOUSBInterfaceDescriptor *	next;
+
+		if ( !index || !USBDescriptorIndexFindNextInterface(index, config->bytes, interface, &request, &next) )
+			next = ScanFindNextInterface(config->bytes, interface, &request);
+		if ( !next )
+			break;
+		interface = next;
+		found++;
+
+		desc = (const IOUSBDescriptorHeader *)interface;
+		while ( true )
+		{
+			const IOUSBDescriptorHeader *	endpoint;
+
+			if ( !index || !USBDescriptorIndexFindNextAssociated(index, config->bytes, desc, kUSBEndpointDesc, interface->bInterfaceNumber, &endpoint) )
+				endpoint = ScanFindNextAssociated(config->bytes, config->length, desc, kUSBEndpointDesc, interface->bInterfaceNumber);
+			if ( !endpoint )
+				break;
+			desc = endpoint;
+			found++;
+		}
+	}
+
+	desc = NULL;
+	while ( true )
+	{
+		const IOUSBDescriptorHeader *	next;
+
+		if ( !index || !USBDescriptorIndexFindNext(index, config->bytes, desc, 0x24, &next) )
+			next = ScanFindNext(config->bytes, config->length, desc, 0x24);
+		if ( !next )
+			break;
+		desc = next;
+		found++;
+	}
+
+	return found;
+}
+
+// Lookups which start from the configuration descriptor or from an interface: each alternate setting of the audio
+// streaming interface by number, as FindNextAltInterface and SetAlternateInterface do, the first endpoint of the
+// configuration, and the endpoint of every alternate setting of the video streaming interface, whose first setting
+// has all the format and frame descriptors and no endpoint
+static UInt32
+SearchCamera(const TestConfig *config, const USBDescriptorIndex *index)
+{
+	IOUSBFindInterfaceRequest			request;
+	const IOUSBInterfaceDescriptor *	interface;
+	const IOUSBDescriptorHeader *		desc;
+	UInt32								found = 0;
+
+	request.bInterfaceClass = 1;
+	request.bInterfaceSubClass = request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
+	for ( UInt16 alternate = 0; alternate <= 4; alternate++ )
+	{
+		request.bAlternateSetting = alternate;
+		if ( !index || !USBDescriptorIndexFindNextInterface(index, config->bytes, NULL, &request, &interface) )
+			interface = ScanFindNextInterface(config->bytes, NULL, &request);
+		found += (interface != NULL);
+	}
+
+	if ( !index || !USBDescriptorIndexFindNext(index, config->bytes, NULL, kUSBEndpointDesc, &desc) )
+		desc = ScanFindNext(config->bytes, config->length, NULL, kUSBEndpointDesc);
+	found += (desc != NULL);
+
+	request.bInterfaceClass = 0x0E;
+	request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+	interface = NULL;
+	while ( true )
+	{
+		const IOUSBInterfaceDescriptor *	next;
+
+		if ( !index || !USBDescriptorIndexFindNextInterface(index, config->bytes, interface, &request, &next) )
+			next = ScanFindNextInterface(config->bytes, interface, &request);
+		if ( !next )
+			break;
+		interface = next;
+		if ( interface->bInterfaceNumber != 1 )
+			continue;
+
+		if ( !index || !USBDescriptorIndexFindNextAssociated(index, config->bytes, interface, kUSBEndpointDesc, 1, &desc) )
+			desc = ScanFindNextAssociated(config->bytes, config->length, interface, kUSBEndpointDesc, 1);
+		found += (desc != NULL);
+	}
+
+	return found;
+}
+
+static void
+TimeWorkload(const char *name, UInt32 (*workload)(const TestConfig *, const USBDescriptorIndex *), const TestConfig *config, const USBDescriptorIndex *index)
+{
+	clock_t		start;
+	double		scanTime, indexTime;
+	UInt32		scanFound = 0;
+	UInt32		indexFound = 0;
+
+	start = clock();
+	for ( int round = 0; round < kTestTimingRounds; round++ )
+		scanFound += (*workload)(config, NULL);
+	scanTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for ( int round = 0; round < kTestTimingRounds; round++ )
+		indexFound += (*workload)(config, index);
+	indexTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("  %s: %u descriptors found, scan %.2f us, index %.2f us\n", name, (unsigned)(scanFound / kTestTimingRounds),
+		   scanTime * 1e6 / kTestTimingRounds, indexTime * 1e6 / kTestTimingRounds);
+
+	USBTestCheckEqual(indexFound, scanFound);
+}
+
+static void
+TestTiming(void)
+{
+	static TestConfig		config;
+	USBDescriptorIndex *	index;
+	clock_t					start;
+
+	BuildCamera(&config);
+	start = clock();
+	for ( int round = 0; round < kTestTimingRounds; round++ )
+		free(BuildIndex(&config, config.length));
+	index = BuildIndex(&config, config.length);
+	USBTestCheck(index != NULL);
+	if ( !index )
+		return;
+
+	printf("  %u byte camera configuration, %u descriptors, index of %u bytes built in %.2f us\n", (unsigned)config.length, (unsigned)index->count,
+		   (unsigned)index->size, (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC / kTestTimingRounds);
+	USBTestCheck(config.length > 3000);
+
+	TimeWorkload("walk", WalkCamera, &config, index);
+	TimeWorkload("search", SearchCamera, &config, index);
+
+	free(index);
+}
+
+int
+main(void)
+{
+	USBTestRun(TestWellFormed);
+	USBTestRun(TestMalformed);
+	USBTestRun(TestRandom);
+	USBTestRun(TestTiming);
+
+	return USBTestSummary("USBDescriptorIndexTests");
+}
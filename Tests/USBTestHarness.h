@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _USBTESTHARNESS_H
+#define _USBTESTHARNESS_H
+
+//================================================================================================
+//
+//	A minimal harness for the user space tests in this directory.  Each test is a tool target
+//	(EHCIPeriodicScheduleTests, XHCIBandwidthTests, ...) that builds the kernel code it covers
+//	from its inline header or source file and exits non-zero if any check failed, so a test
+//	run is simply building and running the *Tests targets.
+//
+//================================================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int	gUSBTestChecks = 0;
+static int	gUSBTestFailures = 0;
+
+#define USBTestCheck(cond)																		\
+	do {																						\
+		gUSBTestChecks++;																		\
+		if ( !(cond) )																			\
+		{																						\
+			gUSBTestFailures++;																	\
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);			\
+		}																						\
+	} while (0)
+
+#define USBTestCheckEqual(a, b)																	\
+	do {																						\
+		long long	_a = (long long)(a);														\
+		long long	_b = (long long)(b);														\
+		gUSBTestChecks++;																		\
+		if ( _a != _b )																			\
+		{																						\
+			gUSBTestFailures++;																	\
+			fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b);	\
+		}																						\
+	} while (0)
+
+// Runs one test function and says so, so that a failure can be found in the output
+#define USBTestRun(test)																		\
+	do {																						\
+		int	_failures = gUSBTestFailures;														\
+		test();																					\
+		printf("%-50s %s\n", #test, (gUSBTestFailures == _failures) ? "ok" : "FAILED");			\
+	} while (0)
+
+// Small deterministic generator, so that the randomized tests do the same thing on every machine
+static inline unsigned int
+USBTestRandom(unsigned int *seed)
+{
+	*seed = (*seed * 1103515245) + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static inline int
+USBTestSummary(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, gUSBTestChecks, gUSBTestFailures);
+	return (gUSBTestFailures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif /* _USBTESTHARNESS_H */
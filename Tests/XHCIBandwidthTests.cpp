@@ -0,0 +1,756 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//================================================================================================
+//
+//	XHCIBandwidthTests
+//
+//	Exercises XHCIBandwidthModel.h the way CheckPeriodicBandwidth and
+//	GetBandwidthAvailableForEndpoints use it: the interval conversion for every bInterval, the
+//	interval tables and their fold into blocks, the headroom search, the endpoint list with its
+//	add/replace/remove operations against a plain reference list, the TT tables, and the HS mult
+//	fold which has to match what the UIM programs for a high bandwidth endpoint.
+//
+//================================================================================================
+
+#include "USBTestHarness.h"
+#include "../AppleUSBXHCI/Headers/XHCIBandwidthModel.h"
+
+enum
+{
+	kTestMaxEndpoints		= 64,
+	kTestRandomRounds		= 2000
+};
+
+static const UInt8	gSpeeds[] = { kXHCIBandwidthSpeedLow, kXHCIBandwidthSpeedFull, kXHCIBandwidthSpeedHigh, kXHCIBandwidthSpeedSuper };
+
+static UInt32
+TestBlocksWith(const XHCIBandwidthInterval *interval, UInt8 portSpeed, UInt8 epInterval, UInt16 mps, UInt8 maxBurst, UInt8 mult, UInt8 epSpeed)
+{
+	XHCIBandwidthInterval	scratch[kMaxIntervalTableSize];
+
+	memcpy(scratch, interval, sizeof(scratch));
+	XHCIBandwidthPortAdd(scratch, portSpeed, epInterval, mps, maxBurst, mult, epSpeed);
+
+	return XHCIBandwidthBlocksUsed(scratch);
+}
+
+// A random periodic endpoint which could legally show up on a port of portSpeed
+static void
+TestRandomEndpoint(unsigned int *seed, UInt8 portSpeed, XHCIBandwidthEndpoint *endpoint)
+{
+	bzero(endpoint, sizeof(*endpoint));
+	endpoint->epSpeed = portSpeed;
+	if ((portSpeed == kXHCIBandwidthSpeedFull) && (USBTestRandom(seed) % 4 == 0))
+		endpoint->epSpeed = kXHCIBandwidthSpeedLow;
+
+	switch (endpoint->epSpeed)
+	{
+		case kXHCIBandwidthSpeedLow:
+			endpoint->mps = 1 + USBTestRandom(seed) % 8;
+			endpoint->epInterval = 3 + USBTestRandom(seed) % 8;
+			break;
+
+		case kXHCIBandwidthSpeedFull:
+			endpoint->mps = 1 + USBTestRandom(seed) % 64;
+			endpoint->epInterval = 3 + USBTestRandom(seed) % 8;
+			break;
+
+		case kXHCIBandwidthSpeedHigh:
+			endpoint->mps = 1 + USBTestRandom(seed) % 256;
+			endpoint->epInterval = USBTestRandom(seed) % kMaxIntervalTableSize;
+			break;
+
+		default:
+			endpoint->mps = 1 + USBTestRandom(seed) % 1024;
+			endpoint->maxBurst = USBTestRandom(seed) % 4;
+			endpoint->epInterval = USBTestRandom(seed) % kMaxIntervalTableSize;
+			break;
+	}
+}
+
+//================================================================================================
+//	Interval conversion and limits
+//================================================================================================
+
+static void
+TestLimits(void)
+{
+	USBTestCheckEqual(XHCIBandwidthLimitInBlocks(kXHCIBandwidthSpeedLow), kLSFSBandwidthLimitInBlocks);
+	USBTestCheckEqual(XHCIBandwidthLimitInBlocks(kXHCIBandwidthSpeedFull), kLSFSBandwidthLimitInBlocks);
+	USBTestCheckEqual(XHCIBandwidthLimitInBlocks(kXHCIBandwidthSpeedHigh), kHSBandwidthLimitInBlocks);
+	USBTestCheckEqual(XHCIBandwidthLimitInBlocks(kXHCIBandwidthSpeedSuper), kSSBandwidthLimitInBlocks);
+	USBTestCheckEqual(XHCIBandwidthLimitInBlocks(4), 0);
+}
+
+// Every bInterval at every speed, for both transfer types
+static void
+TestEndpointInterval(void)
+{
+	for (unsigned int s = 0; s < sizeof(gSpeeds); s++)
+	{
+		UInt8	speed = gSpeeds[s];
+
+		for (unsigned int bInterval = 0; bInterval < 256; bInterval++)
+		{
+			UInt8	isoch = XHCIBandwidthEndpointInterval(speed, true, (UInt8)bInterval);
+			UInt8	interrupt = XHCIBandwidthEndpointInterval(speed, false, (UInt8)bInterval);
+
+			if (speed < kXHCIBandwidthSpeedHigh)
+			{
+				UInt32	ms = bInterval ? bInterval : 1;
+
+				// FS isoch runs every ms, FS/LS interrupt at the largest power of 2 ms not above bInterval
+				USBTestCheckEqual(isoch, 3);
+				USBTestCheck(interrupt >= 3);
+				USBTestCheck((1U << (interrupt - 3)) <= ms);
+				USBTestCheck((1U << (interrupt - 2)) > ms);
+			}
+			else
+			{
+				UInt32	expected = (bInterval > 1) ? (bInterval - 1) : 0;
+
+				USBTestCheckEqual(isoch, expected);
+				USBTestCheckEqual(interrupt, (bInterval >= 16) ? 14 : expected);
+			}
+		}
+	}
+}
+
+//================================================================================================
+//	Interval tables
+//================================================================================================
+
+static void
+TestEmptyTable(void)
+{
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+
+	memset(interval, 0xA5, sizeof(interval));
+	XHCIBandwidthClearTable(interval);
+	USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 0);
+
+	for (unsigned int s = 0; s < sizeof(gSpeeds); s++)
+		USBTestCheckEqual(XHCIBandwidthAvailable(interval, XHCIBandwidthLimitInBlocks(gSpeeds[s])), XHCIBandwidthLimitInBlocks(gSpeeds[s]));
+}
+
+// One endpoint alone costs its packets plus their overhead, whatever its interval
+static void
+TestSingleEndpointCost(void)
+{
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+
+	for (UInt8 epInterval = 0; epInterval <= kMaxIntervalTableSize; epInterval++)
+	{
+		for (UInt16 mps = 1; mps <= kXHCIBandwidthMaxPacketSize; mps++)
+		{
+			UInt32	hsBlocks = (mps + kHSBytesPerBlock - 1) / kHSBytesPerBlock;
+
+			XHCIBandwidthClearTable(interval);
+			XHCIBandwidthPortAdd(interval, kXHCIBandwidthSpeedHigh, epInterval, mps, 0, 0, kXHCIBandwidthSpeedHigh);
+			USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), hsBlocks + kHSPacketOverheadInBlocks);
+
+			if ((mps <= 64) && (epInterval >= 3))
+			{
+				XHCIBandwidthClearTable(interval);
+				XHCIBandwidthPortAdd(interval, kXHCIBandwidthSpeedFull, epInterval, mps, 0, 0, kXHCIBandwidthSpeedFull);
+				USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), mps + kFSPacketOverheadInBlocks);
+
+				// a LS device on a FS port is charged at 8 times its size and the LS overhead
+				XHCIBandwidthClearTable(interval);
+				XHCIBandwidthPortAdd(interval, kXHCIBandwidthSpeedFull, epInterval, mps, 0, 0, kXHCIBandwidthSpeedLow);
+				USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), (mps * 8) + kLSPacketOverheadInBlocks);
+			}
+		}
+	}
+}
+
+// 2^n packets every 2^n microframes cost the same as one packet every microframe
+static void
+TestIntervalsFold(void)
+{
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+
+	for (UInt8 epInterval = 1; epInterval < 8; epInterval++)
+	{
+		XHCIBandwidthClearTable(interval);
+		for (unsigned int i = 0; i < (1U << epInterval); i++)
+			XHCIBandwidthPortAdd(interval, kXHCIBandwidthSpeedHigh, epInterval, 512, 0, 0, kXHCIBandwidthSpeedHigh);
+
+		USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), (512 / kHSBytesPerBlock) + kHSPacketOverheadInBlocks);
+
+		// and one more spills into a second packet
+		XHCIBandwidthPortAdd(interval, kXHCIBandwidthSpeedHigh, epInterval, 512, 0, 0, kXHCIBandwidthSpeedHigh);
+		USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 2 * ((512 / kHSBytesPerBlock) + kHSPacketOverheadInBlocks));
+	}
+}
+
+// The order of the adds doesn't matter, and growing the MPS of the last endpoint never makes the table cheaper.
+// Adding a whole endpoint can, when its packets round an interval off (the fold drops the carried worst case MPS
+// then), so XHCIBandwidthHeadroom only relies on the MPS being monotonic
+static void
+TestTablesOrderFreeAndMonotonic(void)
+{
+	unsigned int	seed = 33;
+
+	for (int round = 0; round < kTestRandomRounds; round++)
+	{
+		UInt8					portSpeed = gSpeeds[1 + USBTestRandom(&seed) % 3];
+		XHCIBandwidthEndpoint	endpoints[16];
+		XHCIBandwidthInterval	forward[kMaxIntervalTableSize];
+		XHCIBandwidthInterval	backward[kMaxIntervalTableSize];
+		unsigned int			count = 1 + USBTestRandom(&seed) % 16;
+		XHCIBandwidthEndpoint	probe;
+		UInt32					previous = 0;
+
+		XHCIBandwidthClearTable(forward);
+		XHCIBandwidthClearTable(backward);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			XHCIBandwidthEndpoint *	ep = &endpoints[i];
+
+			TestRandomEndpoint(&seed, portSpeed, ep);
+			XHCIBandwidthPortAdd(forward, portSpeed, ep->epInterval, ep->mps, ep->maxBurst, ep->mult, ep->epSpeed);
+		}
+
+		for (unsigned int i = count; i > 0; i--)
+		{
+			XHCIBandwidthEndpoint *	ep = &endpoints[i - 1];
+
+			XHCIBandwidthPortAdd(backward, portSpeed, ep->epInterval, ep->mps, ep->maxBurst, ep->mult, ep->epSpeed);
+		}
+
+		USBTestCheck(memcmp(forward, backward, sizeof(forward)) == 0);
+
+		TestRandomEndpoint(&seed, portSpeed, &probe);
+		for (UInt16 mps = 0; mps <= kXHCIBandwidthMaxPacketSize; mps++)
+		{
+			UInt32	used = TestBlocksWith(forward, portSpeed, probe.epInterval, mps, probe.maxBurst, probe.mult, probe.epSpeed);
+
+			USBTestCheck(used >= previous);
+			previous = used;
+		}
+	}
+}
+
+static void
+TestTTAdd(void)
+{
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+
+	XHCIBandwidthClearTable(interval);
+	for (UInt8 epInterval = 0; epInterval < 3; epInterval++)
+		USBTestCheck(!XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedFull, epInterval, 64));
+	for (UInt8 epInterval = kMaxFSIsochInterval; epInterval != 0; epInterval++)
+		USBTestCheck(!XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedFull, epInterval, 64));
+	USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 0);
+
+	for (UInt8 epInterval = 3; epInterval < kMaxFSIsochInterval; epInterval++)
+	{
+		XHCIBandwidthClearTable(interval);
+		USBTestCheck(XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedFull, epInterval, 64));
+		USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 64 + kFSPacketOverheadInBlocks);
+
+		XHCIBandwidthClearTable(interval);
+		USBTestCheck(XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedLow, epInterval, 8));
+		USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 64 + kLSPacketOverheadInBlocks);
+	}
+
+	// one LS packet at an interval makes every packet of that interval pay the LS overhead
+	XHCIBandwidthClearTable(interval);
+	XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedFull, 4, 64);
+	XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedLow, 4, 8);
+	XHCIBandwidthTTAdd(interval, kXHCIBandwidthSpeedFull, 4, 64);
+	USBTestCheckEqual(interval[1].packetOverhead, kLSPacketOverheadInBlocks);
+	USBTestCheckEqual(interval[1].totalPackets, 3);
+}
+
+//================================================================================================
+//	Headroom
+//================================================================================================
+
+// The headroom is the largest MPS which fits: it fits, and one byte more doesn't
+static void
+TestHeadroomIsTight(void)
+{
+	unsigned int	seed = 1033;
+
+	for (int round = 0; round < kTestRandomRounds; round++)
+	{
+		UInt8					portSpeed = gSpeeds[1 + USBTestRandom(&seed) % 3];
+		XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+		unsigned int			count = USBTestRandom(&seed) % 24;
+		XHCIBandwidthEndpoint	probe;
+		UInt32					limit = XHCIBandwidthLimitInBlocks(portSpeed);
+		SInt32					headroom;
+
+		XHCIBandwidthClearTable(interval);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			XHCIBandwidthEndpoint	ep;
+
+			TestRandomEndpoint(&seed, portSpeed, &ep);
+			XHCIBandwidthPortAdd(interval, portSpeed, ep.epInterval, ep.mps, ep.maxBurst, ep.mult, ep.epSpeed);
+		}
+
+		TestRandomEndpoint(&seed, portSpeed, &probe);
+		headroom = XHCIBandwidthHeadroom(interval, portSpeed, probe.epInterval, probe.epSpeed, probe.maxBurst, 0);
+
+		if (headroom == kXHCIBandwidthNoHeadroom)
+		{
+			USBTestCheck(TestBlocksWith(interval, portSpeed, probe.epInterval, 0, probe.maxBurst, 0, probe.epSpeed) > limit);
+		}
+		else
+		{
+			USBTestCheck((headroom >= 0) && (headroom <= kXHCIBandwidthMaxPacketSize));
+			USBTestCheck(TestBlocksWith(interval, portSpeed, probe.epInterval, (UInt16)headroom, probe.maxBurst, 0, probe.epSpeed) <= limit);
+			if (headroom < kXHCIBandwidthMaxPacketSize)
+				USBTestCheck(TestBlocksWith(interval, portSpeed, probe.epInterval, (UInt16)(headroom + 1), probe.maxBurst, 0, probe.epSpeed) > limit);
+		}
+	}
+}
+
+static void
+TestModelHeadroomMatchesTable(void)
+{
+	XHCIBandwidthEndpoint	storage[kTestMaxEndpoints];
+	XHCIBandwidthModel		model;
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+	SInt32					headroom[kMaxIntervalTableSize];
+	unsigned int			seed = 2033;
+
+	XHCIBandwidthModelInit(&model, storage, kTestMaxEndpoints);
+	for (UInt8 dci = 2; dci < 12; dci++)
+	{
+		XHCIBandwidthEndpoint	ep;
+
+		TestRandomEndpoint(&seed, kXHCIBandwidthSpeedHigh, &ep);
+		ep.slot = 1;
+		ep.dci = dci;
+		ep.rhPort = 1 + (dci % 2);
+		USBTestCheck(XHCIBandwidthModelAdd(&model, &ep));
+	}
+
+	for (UInt8 rhPort = 1; rhPort <= 2; rhPort++)
+	{
+		XHCIBandwidthModelHeadroom(&model, rhPort, kXHCIBandwidthSpeedHigh, kXHCIBandwidthSpeedHigh, headroom);
+		XHCIBandwidthModelPortTable(&model, rhPort, kXHCIBandwidthSpeedHigh, interval);
+		for (UInt8 i = 0; i < kMaxIntervalTableSize; i++)
+			USBTestCheckEqual(headroom[i], XHCIBandwidthHeadroom(interval, kXHCIBandwidthSpeedHigh, i, kXHCIBandwidthSpeedHigh, 0, 0));
+	}
+}
+
+//================================================================================================
+//	Endpoint list
+//================================================================================================
+
+// Random adds, replaces, removes and mask removes, checked against a plain slot x DCI array
+static void
+TestModelAgainstReference(void)
+{
+	XHCIBandwidthEndpoint	storage[kTestMaxEndpoints];
+	XHCIBandwidthModel		model;
+	bool					present[8][32];
+	UInt16					mps[8][32];
+	unsigned int			seed = 3033;
+	unsigned int			expectedCount = 0;
+
+	XHCIBandwidthModelInit(&model, storage, kTestMaxEndpoints);
+	bzero(present, sizeof(present));
+	bzero(mps, sizeof(mps));
+
+	for (int round = 0; round < 20 * kTestRandomRounds; round++)
+	{
+		UInt8			slot = 1 + USBTestRandom(&seed) % 7;
+		UInt8			dci = 2 + USBTestRandom(&seed) % 30;
+		unsigned int	op = USBTestRandom(&seed) % 8;
+
+		if (op < 4)
+		{
+			XHCIBandwidthEndpoint	ep;
+			bool					added;
+
+			bzero(&ep, sizeof(ep));
+			ep.slot = slot;
+			ep.dci = dci;
+			ep.mps = 1 + USBTestRandom(&seed) % 1024;
+			added = XHCIBandwidthModelAdd(&model, &ep);
+
+			if (present[slot][dci] || (expectedCount < kTestMaxEndpoints))
+			{
+				USBTestCheck(added);
+				if (!present[slot][dci])
+					expectedCount++;
+				present[slot][dci] = true;
+				mps[slot][dci] = ep.mps;
+			}
+			else
+			{
+				USBTestCheck(!added);
+			}
+		}
+		else if (op < 7)
+		{
+			USBTestCheckEqual(XHCIBandwidthModelRemove(&model, slot, dci), present[slot][dci]);
+			if (present[slot][dci])
+				expectedCount--;
+			present[slot][dci] = false;
+		}
+		else
+		{
+			UInt32	mask = ((UInt32)USBTestRandom(&seed) << 17) ^ USBTestRandom(&seed);
+			UInt32	expectedRemoved = 0;
+
+			for (UInt8 d = 0; d < 32; d++)
+			{
+				if (present[slot][d] && (mask & (1U << d)))
+				{
+					present[slot][d] = false;
+					expectedRemoved++;
+				}
+			}
+			USBTestCheckEqual(XHCIBandwidthModelRemoveMask(&model, slot, mask), expectedRemoved);
+			expectedCount -= expectedRemoved;
+		}
+
+		USBTestCheckEqual(model.count, expectedCount);
+		if ((round % 64) == 0)
+		{
+			for (UInt8 s = 0; s < 8; s++)
+			{
+				for (UInt8 d = 0; d < 32; d++)
+				{
+					SInt32	index = XHCIBandwidthModelFind(&model, s, d);
+
+					USBTestCheckEqual(index >= 0, present[s][d]);
+					if (index >= 0)
+						USBTestCheckEqual(model.endpoints[index].mps, mps[s][d]);
+				}
+			}
+		}
+	}
+}
+
+// Removing an endpoint puts the port back exactly where it was, which the table on its own can't do
+static void
+TestModelRemoveRestores(void)
+{
+	XHCIBandwidthEndpoint	storage[kTestMaxEndpoints];
+	XHCIBandwidthModel		model;
+	unsigned int			seed = 4033;
+
+	XHCIBandwidthModelInit(&model, storage, kTestMaxEndpoints);
+	for (int round = 0; round < kTestRandomRounds; round++)
+	{
+		UInt8					portSpeed = gSpeeds[1 + USBTestRandom(&seed) % 3];
+		XHCIBandwidthEndpoint	ep;
+		SInt16					before, after;
+
+		model.count = 0;
+		for (UInt8 dci = 2; dci < 2 + (USBTestRandom(&seed) % 16); dci++)
+		{
+			TestRandomEndpoint(&seed, portSpeed, &ep);
+			ep.slot = 1;
+			ep.dci = dci;
+			ep.rhPort = 1;
+			XHCIBandwidthModelAdd(&model, &ep);
+		}
+
+		before = XHCIBandwidthModelAvailable(&model, 1, portSpeed, NULL);
+		TestRandomEndpoint(&seed, portSpeed, &ep);
+		ep.slot = 2;
+		ep.dci = 3;
+		ep.rhPort = 1;
+		XHCIBandwidthModelAdd(&model, &ep);
+		after = XHCIBandwidthModelAvailable(&model, 1, portSpeed, NULL);
+
+		// an endpoint on another port doesn't change this one
+		ep.dci = 5;
+		ep.rhPort = 2;
+		XHCIBandwidthModelAdd(&model, &ep);
+		USBTestCheckEqual(XHCIBandwidthModelAvailable(&model, 1, portSpeed, NULL), after);
+
+		USBTestCheck(XHCIBandwidthModelRemove(&model, 2, 3));
+		USBTestCheck(XHCIBandwidthModelRemove(&model, 2, 5));
+		USBTestCheckEqual(XHCIBandwidthModelAvailable(&model, 1, portSpeed, NULL), before);
+	}
+}
+
+// WouldFit leaves the model alone and gives the same answer as making the change
+static void
+TestWouldFit(void)
+{
+	XHCIBandwidthEndpoint	storage[kTestMaxEndpoints];
+	XHCIBandwidthEndpoint	copy[kTestMaxEndpoints];
+	XHCIBandwidthEndpoint	scratch[2 * kTestMaxEndpoints];
+	XHCIBandwidthModel		model;
+	unsigned int			seed = 5033;
+
+	XHCIBandwidthModelInit(&model, storage, kTestMaxEndpoints);
+	for (int round = 0; round < kTestRandomRounds; round++)
+	{
+		UInt8					portSpeed = gSpeeds[1 + USBTestRandom(&seed) % 3];
+		XHCIBandwidthEndpoint	candidates[8];
+		UInt32					numCandidates = USBTestRandom(&seed) % 8;
+		UInt32					replaceMask = ((UInt32)USBTestRandom(&seed) << 17) ^ USBTestRandom(&seed);
+		UInt32					count;
+		SInt16					wouldFit;
+
+		model.count = 0;
+		for (UInt8 dci = 2; dci < 24; dci++)
+		{
+			XHCIBandwidthEndpoint	ep;
+
+			TestRandomEndpoint(&seed, portSpeed, &ep);
+			ep.slot = 1 + (dci % 3);
+			ep.dci = dci;
+			ep.rhPort = 1 + (USBTestRandom(&seed) % 2);
+			XHCIBandwidthModelAdd(&model, &ep);
+		}
+
+		for (UInt32 i = 0; i < numCandidates; i++)
+		{
+			TestRandomEndpoint(&seed, portSpeed, &candidates[i]);
+			candidates[i].slot = 1;
+			candidates[i].dci = 2 + i;
+			candidates[i].rhPort = 1;
+		}
+
+		count = model.count;
+		memcpy(copy, storage, sizeof(copy));
+		wouldFit = XHCIBandwidthModelWouldFit(&model, 1, replaceMask, candidates, numCandidates, 1, portSpeed, scratch);
+		USBTestCheckEqual(model.count, count);
+		USBTestCheck(memcmp(copy, storage, count * sizeof(XHCIBandwidthEndpoint)) == 0);
+
+		model.capacity = kTestMaxEndpoints;
+		XHCIBandwidthModelRemoveMask(&model, 1, replaceMask);
+		for (UInt32 i = 0; i < numCandidates; i++)
+			XHCIBandwidthModelAdd(&model, &candidates[i]);
+		USBTestCheckEqual(XHCIBandwidthModelAvailable(&model, 1, portSpeed, NULL), wouldFit);
+	}
+}
+
+//================================================================================================
+//	TTs
+//================================================================================================
+
+static void
+TestSameTT(void)
+{
+	XHCIBandwidthEndpoint	a, b;
+
+	bzero(&a, sizeof(a));
+	a.rhPort = 1;
+	a.ttHubSlot = 4;
+	a.ttHubPort = 1;
+	b = a;
+	b.ttHubPort = 2;
+
+	// a single TT hub has one TT for all of its ports, a multi TT hub one per port
+	USBTestCheck(XHCIBandwidthModelSameTT(&a, &b));
+	a.mtt = b.mtt = 1;
+	USBTestCheck(!XHCIBandwidthModelSameTT(&a, &b));
+	b.ttHubPort = 1;
+	USBTestCheck(XHCIBandwidthModelSameTT(&a, &b));
+	b.ttHubSlot = 5;
+	USBTestCheck(!XHCIBandwidthModelSameTT(&a, &b));
+	b.ttHubSlot = 4;
+	b.rhPort = 2;
+	USBTestCheck(!XHCIBandwidthModelSameTT(&a, &b));
+}
+
+// FS endpoints behind a HS hub load the HS port as HS traffic and their own TT as FS traffic
+static void
+TestTTTables(void)
+{
+	XHCIBandwidthEndpoint	storage[kTestMaxEndpoints];
+	XHCIBandwidthModel		model;
+	XHCIBandwidthInterval	interval[kMaxIntervalTableSize];
+	XHCIBandwidthEndpoint	ep;
+	SInt16					smallestTT;
+	SInt16					available;
+
+	XHCIBandwidthModelInit(&model, storage, kTestMaxEndpoints);
+	bzero(&ep, sizeof(ep));
+	ep.rhPort = 1;
+	ep.epSpeed = kXHCIBandwidthSpeedFull;
+	ep.ttHubSlot = 4;
+	ep.mtt = 1;
+	ep.epInterval = 3;
+	ep.mps = 64;
+
+	// two devices on port 1 of the hub, one on port 2
+	ep.slot = 5; ep.ttHubPort = 1; ep.dci = 3;
+	XHCIBandwidthModelAdd(&model, &ep);
+	ep.slot = 6; ep.ttHubPort = 1; ep.dci = 3;
+	XHCIBandwidthModelAdd(&model, &ep);
+	ep.slot = 7; ep.ttHubPort = 2; ep.dci = 3;
+	XHCIBandwidthModelAdd(&model, &ep);
+
+	ep.ttHubPort = 1;
+	XHCIBandwidthModelTTTable(&model, kXHCIBandwidthSpeedHigh, &ep, interval);
+	USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 2 * (64 + kFSPacketOverheadInBlocks));
+	ep.ttHubPort = 2;
+	XHCIBandwidthModelTTTable(&model, kXHCIBandwidthSpeedHigh, &ep, interval);
+	USBTestCheckEqual(XHCIBandwidthBlocksUsed(interval), 64 + kFSPacketOverheadInBlocks);
+
+	available = XHCIBandwidthModelAvailable(&model, 1, kXHCIBandwidthSpeedHigh, &smallestTT);
+	USBTestCheckEqual(smallestTT, kLSFSBandwidthLimitInBlocks - 2 * (64 + kFSPacketOverheadInBlocks));
+	// on the HS port three packets every 8 microframes round up to one packet per microframe
+	USBTestCheckEqual(available, kHSBandwidthLimitInBlocks - ((64 / kHSBytesPerBlock) + kHSPacketOverheadInBlocks));
+
+	// fill the TT on hub port 1 until it is oversubscribed, the port answer is then the TT's
+	for (UInt8 dci = 4; dci < 20; dci++)
+	{
+		ep.slot = 5; ep.ttHubPort = 1; ep.dci = dci;
+		XHCIBandwidthModelAdd(&model, &ep);
+	}
+	available = XHCIBandwidthModelAvailable(&model, 1, kXHCIBandwidthSpeedHigh, &smallestTT);
+	USBTestCheck(smallestTT < 0);
+	USBTestCheckEqual(available, smallestTT);
+
+	// the same devices behind a single TT hub share one TT
+	XHCIBandwidthModelRemoveMask(&model, 5, 0xFFFFFFF0);
+	for (UInt32 i = 0; i < model.count; i++)
+		model.endpoints[i].mtt = 0;
+	XHCIBandwidthModelAvailable(&model, 1, kXHCIBandwidthSpeedHigh, &smallestTT);
+	USBTestCheckEqual(smallestTT, kLSFSBandwidthLimitInBlocks - 3 * (64 + kFSPacketOverheadInBlocks));
+}
+
+//================================================================================================
+//	HS high bandwidth endpoints
+//================================================================================================
+
+// The fold is the conversion UIMCreateInterruptEndpoint and UIMCreateIsochEndpoint do on the full MPS
+static void
+TestHSMultFold(void)
+{
+	for (UInt32 base = 1; base <= kXHCIBandwidthMaxPacketSize; base++)
+	{
+		for (UInt8 mult = 0; mult < 3; mult++)
+		{
+			UInt32	full = base * (mult + 1);
+			UInt32	uimBurst = 0;
+			UInt32	uimMPS = full;
+			UInt16	mps = (UInt16)base;
+			UInt8	maxBurst = 7;
+			UInt8	foldedMult = mult;
+
+			if (full > kXHCIBandwidthMaxPacketSize)
+			{
+				uimBurst = (full + kXHCIBandwidthMaxPacketSize - 1) / kXHCIBandwidthMaxPacketSize;
+				uimMPS = (full + uimBurst - 1) / uimBurst;
+				uimBurst--;
+			}
+
+			XHCIBandwidthFoldHSMult(&mps, &maxBurst, &foldedMult);
+			USBTestCheckEqual(mps, uimMPS);
+			USBTestCheckEqual(maxBurst, uimBurst);
+			USBTestCheckEqual(foldedMult, 0);
+			USBTestCheck(mps <= kXHCIBandwidthMaxPacketSize);
+			USBTestCheck(maxBurst <= mult);
+			USBTestCheck((UInt32)mps * (maxBurst + 1) >= full);
+		}
+	}
+}
+
+// A folded candidate costs the same as the endpoint the UIM would create, at every interval, and a
+// high bandwidth one costs more than its base MPS alone, which is what the unfolded mult was charged
+static void
+TestHSMultMatchesBurst(void)
+{
+	XHCIBandwidthInterval	empty[kMaxIntervalTableSize];
+	UInt32					undercounted = 0;
+
+	XHCIBandwidthClearTable(empty);
+	for (UInt8 epInterval = 0; epInterval < kMaxIntervalTableSize; epInterval++)
+	{
+		for (UInt32 base = 1; base <= kXHCIBandwidthMaxPacketSize; base++)
+		{
+			for (UInt8 mult = 0; mult < 3; mult++)
+			{
+				UInt16	mps = (UInt16)base;
+				UInt8	maxBurst = 0;
+				UInt8	foldedMult = mult;
+				UInt32	folded, unfolded, asCreated;
+				UInt32	full = base * (mult + 1);
+				UInt32	burst = 0;
+
+				XHCIBandwidthFoldHSMult(&mps, &maxBurst, &foldedMult);
+				folded = TestBlocksWith(empty, kXHCIBandwidthSpeedHigh, epInterval, mps, maxBurst, foldedMult, kXHCIBandwidthSpeedHigh);
+				unfolded = TestBlocksWith(empty, kXHCIBandwidthSpeedHigh, epInterval, (UInt16)base, 0, mult, kXHCIBandwidthSpeedHigh);
+
+				// what GatherPeriodicEndpoints reads back out of the endpoint context once the UIM created it
+				if (full > kXHCIBandwidthMaxPacketSize)
+				{
+					burst = (full + kXHCIBandwidthMaxPacketSize - 1) / kXHCIBandwidthMaxPacketSize;
+					full = (full + burst - 1) / burst;
+					burst--;
+				}
+				asCreated = TestBlocksWith(empty, kXHCIBandwidthSpeedHigh, epInterval, (UInt16)full, (UInt8)burst, 0, kXHCIBandwidthSpeedHigh);
+
+				USBTestCheckEqual(folded, asCreated);
+				USBTestCheck(folded >= unfolded);
+				if (mult && (folded > unfolded))
+					undercounted++;
+			}
+		}
+	}
+
+	printf("  HS high bandwidth: %u of %u interval/MPS/mult combinations were undercounted without the fold\n",
+		   undercounted, kMaxIntervalTableSize * kXHCIBandwidthMaxPacketSize * 2);
+	USBTestCheck(undercounted > 0);
+
+	// three 1024 byte transactions per microframe is most of a HS port, not a third of it
+	{
+		UInt16	mps = 1024;
+		UInt8	maxBurst = 0;
+		UInt8	mult = 2;
+
+		XHCIBandwidthFoldHSMult(&mps, &maxBurst, &mult);
+		USBTestCheckEqual(TestBlocksWith(empty, kXHCIBandwidthSpeedHigh, 0, mps, maxBurst, mult, kXHCIBandwidthSpeedHigh), 3 * ((1024 / kHSBytesPerBlock) + kHSPacketOverheadInBlocks));
+	}
+}
+
+int
+main(void)
+{
+	USBTestRun(TestLimits);
+	USBTestRun(TestEndpointInterval);
+	USBTestRun(TestEmptyTable);
+	USBTestRun(TestSingleEndpointCost);
+	USBTestRun(TestIntervalsFold);
+	USBTestRun(TestTablesOrderFreeAndMonotonic);
+	USBTestRun(TestTTAdd);
+	USBTestRun(TestHeadroomIsTight);
+	USBTestRun(TestModelHeadroomMatchesTable);
+	USBTestRun(TestModelAgainstReference);
+	USBTestRun(TestModelRemoveRestores);
+	USBTestRun(TestWouldFit);
+	USBTestRun(TestSameTT);
+	USBTestRun(TestTTTables);
+	USBTestRun(TestHSMultFold);
+	USBTestRun(TestHSMultMatchesBurst);
+
+	return USBTestSummary("XHCIBandwidthTests");
+}
@@ -37,6 +37,7 @@ g++ -W -Wall -I/System/Library/Frameworks/System.framework/PrivateHeaders -I/Sys
 
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdlib.h>
@@ -68,6 +69,7 @@ g++ -W -Wall -I/System/Library/Frameworks/System.framework/PrivateHeaders -I/Sys
 
 #include "IOUSBMassStorageClassTimestamps.h"
 #include "../IOUSBFamily/Headers/USB.h"
+#include "UMCTraceFile.h"
 
 #ifndef kd_buf
 struct kd_buf_t {
@@ -187,6 +189,13 @@ typedef struct ReturnCodeSpec
 	const char *	string;
 } ReturnCodeSpec;
 
+// One half of the capture file's double buffer
+typedef struct TraceWriteBuffer
+{
+	UMCTraceFileRecord *	records;
+	uint32_t				count;
+} TraceWriteBuffer;
+
 
 //-----------------------------------------------------------------------------
 //	Constants
@@ -266,6 +275,7 @@ static const char * kBulkOnlyStateNames[] = {	" ",
 #define kFilePathMaxSize                256
 #define kInvalid						0xdeadbeef
 #define kDivisorEntry					0xfeedface
+#define kTraceWriteBufferRecords		65536
 
 
 //-----------------------------------------------------------------------------
@@ -285,6 +295,19 @@ boolean_t			gHideBusyRejectedCommands	= FALSE;
 boolean_t           gWriteToTraceFile           = FALSE;
 boolean_t           gReadTraceFile              = FALSE;
 FILE *              gTraceFileStream			= NULL;
+volatile sig_atomic_t	gStopRequested			= 0;
+uint64_t			gWrapCount					= 0;
+
+// The collector fills gWriteBuffers[gFillBuffer] while the writer thread writes the other one
+TraceWriteBuffer	gWriteBuffers [ 2 ]			= { { NULL, 0 }, { NULL, 0 } };
+int					gFillBuffer					= 0;
+boolean_t			gWritePending				= FALSE;
+boolean_t			gWriterExit					= FALSE;
+boolean_t			gWriterStarted				= FALSE;
+uint64_t			gRecordsWritten				= 0;
+pthread_t			gWriterThread;
+pthread_mutex_t		gWriterLock					= PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t		gWriterCondition			= PTHREAD_COND_INITIALIZER;
 char				gTraceFilePath [ kFilePathMaxSize ] = { 0 };
 
 u_int8_t			fullCDB [ 16 ]				= { 0 };
@@ -309,6 +332,22 @@ CreateTraceOutputFile ( void );
 static void
 ParseTraceFile ( void );
 
+static void
+ParseCaptureFile ( FILE * traceFile, const UMCTraceFileHeader * header );
+
+static void *
+TraceWriterThread ( void * context );
+
+static void
+AppendToTraceFile ( uint64_t timestamp, uint32_t debugID, uint32_t cpuID,
+					uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4 );
+
+static void
+HandOffWriteBuffer ( boolean_t wait );
+
+static void
+StopTraceWriter ( void );
+
 static void
 ParseKernelTracePoint ( kd_buf inTracePoint );
 
@@ -377,6 +416,18 @@ main ( int argc, const char * argv[] )
 	
 	gProgramName = argv[0];
 
+	// Get program arguments.
+	ParseArguments ( argc, argv );
+	
+	// Replaying a capture doesn't touch the trace facility.
+	if ( gReadTraceFile == TRUE )
+	{
+		
+		ParseTraceFile ( );
+		return 0;
+		
+	}
+	
 	/*if (reexec_to_match_kernel() != 0)
 	{
 		
@@ -393,9 +444,6 @@ main ( int argc, const char * argv[] )
 		
 	}
 	
-	// Get program arguments.
-	ParseArguments ( argc, argv );
-	
 	bzero ( &args, sizeof ( args ) );
 	
 	args.type = kUSBTypeDebug;
@@ -462,26 +510,19 @@ main ( int argc, const char * argv[] )
 	if ( gEnableTraceOnly == FALSE )
 	{
         
-        if ( gReadTraceFile == FALSE )
+        // No, they want logging. Start main loop. When capturing, the signal
+        // handler only asks us to stop so the last records reach the file.
+        while ( gStopRequested == 0 )
         {
             
-            // No, they want logging. Start main loop.
-            while ( 1 )
-            {
-                
-                usleep ( 20 * kMicrosecondsPerMillisecond );
-                CollectTrace ( );
-                
-            }
+            usleep ( 20 * kMicrosecondsPerMillisecond );
+            CollectTrace ( );
             
         }
         
-        else
-        {
-            
-            ParseTraceFile ( );
-            
-        }
+        StopTraceWriter ( );
+        EnableTraceBuffer ( 0 );
+        RemoveTraceBuffer ( );
 		
 	}
 	
@@ -504,8 +545,8 @@ PrintUsage ( void )
     printf ( "\t-h help\n" );
     printf ( "\t-b hide rejected SCSI tasks\n" );
     printf ( "\t-d disable\n" );
-    printf ( "\t-f <file_path> write traces out directly to a file.\n" );
-    printf ( "\t-r <file_path> parses trace file\n" );
+    printf ( "\t-f <file_path> capture traces to a file (umctraceanalyze can summarize it).\n" );
+    printf ( "\t-r <file_path> replays a capture or raw trace file, doesn't need root\n" );
 				
 	printf ( "\n" );
 	
@@ -686,6 +727,15 @@ SignalHandler ( int signal )
 
 #pragma unused ( signal )
 	
+	// Let the main loop drain the capture buffers and close the file
+	if ( gWriterStarted == TRUE )
+	{
+		
+		gStopRequested = 1;
+		return;
+		
+	}
+	
 	EnableTraceBuffer ( 0 );
 	RemoveTraceBuffer ( );
 	exit ( 0 );
@@ -1033,6 +1083,18 @@ CollectTrace ( void )
 		EnableTraceBuffer ( 0 );
 		EnableTraceBuffer ( 1 );
 		
+		// The oldest tracepoints were overwritten before we could read them
+		gWrapCount++;
+		fprintf ( stderr, "%s: trace buffer wrapped (%llu), tracepoints were lost\n", gProgramName, gWrapCount );
+		
+		if ( gWriteToTraceFile == TRUE )
+		{
+			
+			AppendToTraceFile ( ( count > 0 ) ? gTraceBuffer[0].timestamp : 0, kUMCTraceFileWrapEntry, 0,
+								( uintptr_t ) gWrapCount, 0, 0, 0 );
+			
+		}
+		
 	}
 	
 	for ( index = 0; index < count; index++ )
@@ -1065,12 +1127,13 @@ CollectTrace ( void )
             if ( ( type >= 0x05278800 ) && ( type <= 0x05278BFC ) )
             {
                 
-                fwrite (    ( const void * ) & ( gTraceBuffer [ index ] ),
-                            sizeof ( kd_buf ),
-                            1,
-                            gTraceFileStream );
-                
-                fflush (    gTraceFileStream );
+#if defined(__LP64__)
+                AppendToTraceFile ( gTraceBuffer[index].timestamp, debugID, gTraceBuffer[index].cpuid,
+#else
+                AppendToTraceFile ( gTraceBuffer[index].timestamp, debugID, 0,
+#endif
+                                    gTraceBuffer[index].arg1, gTraceBuffer[index].arg2,
+                                    gTraceBuffer[index].arg3, gTraceBuffer[index].arg4 );
                 
             }
            
@@ -1078,6 +1141,12 @@ CollectTrace ( void )
 		
 	}
 	
+    // Give whatever was collected to the writer, unless it is still busy with the last batch
+    if ( gWriteToTraceFile == TRUE )
+    {
+        HandOffWriteBuffer ( FALSE );
+    }
+    
 	fflush ( 0 );
 	
 }
@@ -1095,6 +1164,7 @@ CreateTraceOutputFile ( void )
     
     char timestring [ 30 ];
     time_t currentTime = time ( NULL );
+    UMCTraceFileHeader header;
     
     // Did the user not supply a preferred file path?
     if ( gTraceFilePath[0] == 0 )
@@ -1110,10 +1180,187 @@ CreateTraceOutputFile ( void )
     }
     
     gTraceFileStream = fopen ( gTraceFilePath, "w+" );
+    if ( gTraceFileStream == NULL )
+    {
+        Quit ( "Could not create the trace file\n" );
+    }
+    
+    bzero ( &header, sizeof ( header ) );
+    header.magic        = kUMCTraceFileMagic;
+    header.version      = kUMCTraceFileVersion;
+    header.headerSize   = sizeof ( header );
+    header.divisor      = gDivisor;
+    header.recordSize   = sizeof ( UMCTraceFileRecord );
+    header.captureTime  = ( uint64_t ) currentTime;
+    
+    if ( fwrite ( &header, sizeof ( header ), 1, gTraceFileStream ) != 1 )
+    {
+        Quit ( "Could not write the trace file header\n" );
+    }
+    
+    gWriteBuffers[0].records = ( UMCTraceFileRecord * ) malloc ( kTraceWriteBufferRecords * sizeof ( UMCTraceFileRecord ) );
+    gWriteBuffers[1].records = ( UMCTraceFileRecord * ) malloc ( kTraceWriteBufferRecords * sizeof ( UMCTraceFileRecord ) );
+    if ( ( gWriteBuffers[0].records == NULL ) || ( gWriteBuffers[1].records == NULL ) )
+    {
+        Quit ( "Can't allocate memory for the trace file buffers\n" );
+    }
+    
+    if ( pthread_create ( &gWriterThread, NULL, TraceWriterThread, NULL ) != 0 )
+    {
+        Quit ( "Can't start the trace file writer\n" );
+    }
+    
+    gWriterStarted = TRUE;
     
 }
 
 
+//-----------------------------------------------------------------------------
+//	AppendToTraceFile
+//-----------------------------------------------------------------------------
+
+static void
+AppendToTraceFile ( uint64_t timestamp, uint32_t debugID, uint32_t cpuID,
+					uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4 )
+{
+	
+	TraceWriteBuffer *		buffer = &gWriteBuffers[gFillBuffer];
+	UMCTraceFileRecord *	record;
+	
+	// Only wait for the writer when both halves are full
+	if ( buffer->count == kTraceWriteBufferRecords )
+	{
+		
+		HandOffWriteBuffer ( TRUE );
+		buffer = &gWriteBuffers[gFillBuffer];
+		
+	}
+	
+	// The kext only logs 32 bit arguments
+	record = &buffer->records[buffer->count++];
+	record->timestamp	= timestamp;
+	record->arg1		= ( uint32_t ) arg1;
+	record->arg2		= ( uint32_t ) arg2;
+	record->arg3		= ( uint32_t ) arg3;
+	record->arg4		= ( uint32_t ) arg4;
+	record->debugid		= debugID;
+	record->cpuid		= cpuID;
+	
+}
+
+
+//-----------------------------------------------------------------------------
+//	HandOffWriteBuffer - swaps the halves if the writer is free, or when wait
+//	is set, after it finishes
+//-----------------------------------------------------------------------------
+
+static void
+HandOffWriteBuffer ( boolean_t wait )
+{
+	
+	if ( gWriteBuffers[gFillBuffer].count == 0 )
+		return;
+	
+	pthread_mutex_lock ( &gWriterLock );
+	
+	if ( ( gWritePending == TRUE ) && ( wait == FALSE ) )
+	{
+		
+		pthread_mutex_unlock ( &gWriterLock );
+		return;
+		
+	}
+	
+	while ( gWritePending == TRUE )
+		pthread_cond_wait ( &gWriterCondition, &gWriterLock );
+	
+	gFillBuffer ^= 1;
+	gWriteBuffers[gFillBuffer].count = 0;
+	gWritePending = TRUE;
+	
+	pthread_cond_broadcast ( &gWriterCondition );
+	pthread_mutex_unlock ( &gWriterLock );
+	
+}
+
+
+//-----------------------------------------------------------------------------
+//	TraceWriterThread
+//-----------------------------------------------------------------------------
+
+static void *
+TraceWriterThread ( void * context )
+{
+	
+#pragma unused ( context )
+	
+	pthread_mutex_lock ( &gWriterLock );
+	
+	while ( 1 )
+	{
+		
+		TraceWriteBuffer *	buffer;
+		
+		while ( ( gWritePending == FALSE ) && ( gWriterExit == FALSE ) )
+			pthread_cond_wait ( &gWriterCondition, &gWriterLock );
+		
+		if ( gWritePending == FALSE )
+			break;
+		
+		// The collector doesn't touch this half until gWritePending is cleared
+		buffer = &gWriteBuffers[gFillBuffer ^ 1];
+		pthread_mutex_unlock ( &gWriterLock );
+		
+		if ( fwrite ( buffer->records, sizeof ( UMCTraceFileRecord ), buffer->count, gTraceFileStream ) != buffer->count )
+			fprintf ( stderr, "%s: error %d writing the trace file\n", gProgramName, errno );
+		
+		fflush ( gTraceFileStream );
+		
+		pthread_mutex_lock ( &gWriterLock );
+		gRecordsWritten += buffer->count;
+		gWritePending = FALSE;
+		pthread_cond_broadcast ( &gWriterCondition );
+		
+	}
+	
+	pthread_mutex_unlock ( &gWriterLock );
+	
+	return NULL;
+	
+}
+
+
+//-----------------------------------------------------------------------------
+//	StopTraceWriter
+//-----------------------------------------------------------------------------
+
+static void
+StopTraceWriter ( void )
+{
+	
+	if ( gWriterStarted == FALSE )
+		return;
+	
+	gWriterStarted = FALSE;
+	
+	HandOffWriteBuffer ( TRUE );
+	
+	pthread_mutex_lock ( &gWriterLock );
+	gWriterExit = TRUE;
+	pthread_cond_broadcast ( &gWriterCondition );
+	pthread_mutex_unlock ( &gWriterLock );
+	
+	pthread_join ( gWriterThread, NULL );
+	
+	fclose ( gTraceFileStream );
+	gTraceFileStream = NULL;
+	
+	fprintf ( stderr, "%s: wrote %llu tracepoints to %s, trace buffer wrapped %llu times\n",
+			  gProgramName, gRecordsWritten, gTraceFilePath, gWrapCount );
+	
+}
+
+
 //-----------------------------------------------------------------------------
 //	ParseTraceFile
 //-----------------------------------------------------------------------------
@@ -1123,14 +1370,33 @@ ParseTraceFile ( )
 {
     
     FILE * traceFile;
+    UMCTraceFileHeader header;
     
     traceFile = fopen ( gTraceFilePath, "r" );
     kd_buf kp;
 	bzero( &kp, sizeof ( kd_buf ) );
+	bzero( &header, sizeof ( header ) );
 	
 	if ( traceFile )
 	{
         
+        // Captures start with a header, older files are bare kd_bufs
+        if ( ( fread ( &header, sizeof ( header ), 1, traceFile ) == 1 ) && ( header.magic == kUMCTraceFileMagic ) )
+        {
+            
+            ParseCaptureFile ( traceFile, &header );
+            fclose ( traceFile );
+            return;
+            
+        }
+        
+        if ( header.magic == kUMCTraceFileSwappedMagic )
+        {
+            Quit ( "The trace file was captured on a machine with the other byte order\n" );
+        }
+        
+        rewind ( traceFile );
+        
 		while ( fread ( &kp, sizeof ( kd_buf ), 1, traceFile ) )
 		{
             
@@ -1174,6 +1440,62 @@ ParseTraceFile ( )
 }
 
 
+//-----------------------------------------------------------------------------
+//	ParseCaptureFile - feeds a capture through the live parser
+//-----------------------------------------------------------------------------
+
+static void
+ParseCaptureFile ( FILE * traceFile, const UMCTraceFileHeader * header )
+{
+    
+    UMCTraceFileRecord	record;
+    time_t				captureTime = ( time_t ) header->captureTime;
+    
+    if ( ( header->version != kUMCTraceFileVersion ) || ( header->recordSize < sizeof ( record ) ) )
+    {
+        Quit ( "Unsupported trace file version\n" );
+    }
+    
+    gDivisor = header->divisor;
+    printf ( "Capture started %s", ctime ( &captureTime ) );
+    printf ( "Found divisor %f\n", gDivisor );
+    
+    fseek ( traceFile, header->headerSize, SEEK_SET );
+    
+    while ( fread ( &record, sizeof ( record ), 1, traceFile ) == 1 )
+    {
+        
+        kd_buf tracepoint;
+        
+        // Skip anything a later version appends to each record
+        if ( header->recordSize > sizeof ( record ) )
+        {
+            fseek ( traceFile, header->recordSize - sizeof ( record ), SEEK_CUR );
+        }
+        
+        if ( record.debugid == kUMCTraceFileWrapEntry )
+        {
+            
+            printf ( "*** Trace buffer wrapped (%u), tracepoints were lost here ***\n", record.arg1 );
+            continue;
+            
+        }
+        
+        bzero ( &tracepoint, sizeof ( tracepoint ) );
+        tracepoint.timestamp	= record.timestamp;
+        tracepoint.arg1			= record.arg1;
+        tracepoint.arg2			= record.arg2;
+        tracepoint.arg3			= record.arg3;
+        tracepoint.arg4			= record.arg4;
+        tracepoint.debugid		= record.debugid;
+        
+        ParseKernelTracePoint ( tracepoint );
+        
+    }
+    
+}
+
+
 //-----------------------------------------------------------------------------
 //	StringFromReturnCode
 //-----------------------------------------------------------------------------
@@ -1614,19 +1936,26 @@ Quit ( const char * s )
 	USBSysctlArgs	args;
 	int				error;
 	
-	if ( gTraceEnabled == TRUE )
-		EnableTraceBuffer ( 0 );
-	
-	if ( gSetRemoveFlag == TRUE )
-		RemoveTraceBuffer ( );
-	
-	args.type = kUSBTypeDebug;
-	args.debugFlags = 0;
-	
-	error = sysctlbyname ( USBMASS_SYSCTL, NULL, NULL, &args, sizeof ( args ) );
-	if ( error != 0 )
+	if ( gReadTraceFile == FALSE )
 	{
-		fprintf ( stderr, "sysctlbyname failed to set old UMC trace flags back\n" );
+		
+		StopTraceWriter ( );
+		
+		if ( gTraceEnabled == TRUE )
+			EnableTraceBuffer ( 0 );
+		
+		if ( gSetRemoveFlag == TRUE )
+			RemoveTraceBuffer ( );
+		
+		args.type = kUSBTypeDebug;
+		args.debugFlags = 0;
+		
+		error = sysctlbyname ( USBMASS_SYSCTL, NULL, NULL, &args, sizeof ( args ) );
+		if ( error != 0 )
+		{
+			fprintf ( stderr, "sysctlbyname failed to set old UMC trace flags back\n" );
+		}
+		
 	}
 	
 	fprintf ( stderr, "%s: ", gProgramName );
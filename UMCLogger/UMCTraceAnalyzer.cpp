@@ -0,0 +1,1523 @@
+/*
+ * Copyright (c) 2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * "Portions Copyright (c) 1999 Apple Inc.  All Rights
+ * Reserved.  This file contains Original Code and/or Modifications of
+ * Original Code as defined in and that are subject to the Apple Public
+ * Source License Version 1.0 (the 'License').	You may not use this file
+ * except in compliance with the License.  Please obtain a copy of the
+ * License at http://www.apple.com/publicsource and read it before using
+ * this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License."
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//-----------------------------------------------------------------------------
+//	umctraceanalyze
+//
+//	Offline SCSI task analysis of the captures written by 'UMCLogger -f' (and
+//	of the older raw kd_buf files).
+//	Each task is rebuilt from its mass storage tracepoints (busy rejections,
+//	CDB, CBW, stalls, resets and the completion) and the tasks are then
+//	summarized per device:
+//
+//		umctraceanalyze tasks [options] raw-file		one line per SCSI task
+//		umctraceanalyze devices [options] raw-file		IOPS, throughput and latency percentiles
+//		umctraceanalyze queue [options] raw-file		queue depth and utilization per interval
+//		umctraceanalyze gaps [options] raw-file			idle periods between tasks
+//
+//	Only POSIX interfaces are used so it builds anywhere, e.g.:
+//
+//		c++ -O2 -o umctraceanalyze UMCTraceAnalyzer.cpp
+//-----------------------------------------------------------------------------
+
+
+//-----------------------------------------------------------------------------
+//	Includes
+//-----------------------------------------------------------------------------
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UMCTraceFile.h"
+
+
+//-----------------------------------------------------------------------------
+//	Constants
+//-----------------------------------------------------------------------------
+
+// Mass storage tracepoint layout (see IOUSBMassStorageClassTimestamps.h).  Only
+// the codes the analyzer needs are repeated here so that this file does not
+// depend on the kernel headers.  Keep them in sync.
+#define kUMCTraceFirstDebugID			0x05278800
+#define kUMCTraceLastDebugID			0x05278BFC
+#define UMCTraceIsUMC(type)				( ( (type) >= kUMCTraceFirstDebugID ) && ( (type) <= kUMCTraceLastDebugID ) )
+#define UMCTraceCode(type)				( ( (type) >> 2 ) & 0xFF )
+
+enum
+{
+	kUMCAbortedTask						= 0x00,
+	kUMCCompleteSCSICommand				= 0x01,
+	kUMCCDBLog1							= 0x0C,
+	kUMCCDBLog2							= 0x0D,
+	kUMCClearEndPointStall				= 0x0E,
+	kUMCUSBDeviceResetReturned			= 0x13,
+	kUMCAbortCurrentSCSITask			= 0x14,
+	kUMCCBICommandAlreadyInProgress		= 0x41,
+	kUMCCBISendSCSICommandReturned		= 0x42,
+	kUMCBOCommandAlreadyInProgress		= 0x83,
+	kUMCBOSendSCSICommandReturned		= 0x84,
+	kUMCBOCBWDescription				= 0x85,
+	kUMCBOCompletion					= 0x89
+};
+
+// Raw kd_buf file entries that are not tracepoints (see UMCLogger.cpp)
+#define kRawInvalidEntry				0xdeadbeef
+#define kRawDivisorEntry				0xfeedface
+
+#define kDefaultDivisor					1000.0			// nanosecond timebase
+#define kDefaultBlockSize				512
+#define kDefaultIntervalMilliseconds	1000
+#define kDefaultGapMicroseconds			1000
+#define kMicrosecondsPerMillisecond		1000
+#define kAnalyzerMaxOpenTasks			256
+#define kAnalyzerMaxDevices				64
+
+#define kSCSIServiceResponseTaskComplete	2
+#define kSCSITaskStatusGood					0
+
+enum
+{
+	kFormatText		= 0,
+	kFormatCSV		= 1
+};
+
+enum
+{
+	kTaskDispatched		= 0x01,
+	kTaskCompleted		= 0x02,
+	kTaskAborted		= 0x04,
+	kTaskCDB1			= 0x10,
+	kTaskCDB2			= 0x20
+};
+
+#define	elog(x...)						fprintf(stderr, x)
+
+
+//-----------------------------------------------------------------------------
+//	Structures
+//-----------------------------------------------------------------------------
+
+// kd_buf as written by a 64 bit UMCLogger before captures had a header
+typedef struct RawRecord
+{
+	uint64_t	timestamp;
+	uint64_t	arg1;
+	uint64_t	arg2;
+	uint64_t	arg3;
+	uint64_t	arg4;
+	uint64_t	arg5;
+	uint32_t	debugid;
+	uint32_t	cpuid;
+	uint64_t	unused;
+} RawRecord;
+
+typedef struct SCSITask
+{
+	uint32_t	device;					// IOUSBMassStorageClass instance, truncated to 32 bits by the kext
+	uint32_t	request;				// SCSITaskIdentifier, likewise
+	uint64_t	submitted;				// first time the task was seen, a busy rejection or the CDB
+	uint64_t	dispatched;				// accepted by the transport (CDB logged)
+	uint64_t	completed;
+	uint32_t	cbwTag;
+	uint32_t	sendStatus;
+	uint32_t	busyRetries;			// rejected because the transport was already busy
+	uint32_t	stalls;
+	uint32_t	resets;
+	uint32_t	transportErrors;		// Bulk-Only state machine steps that failed
+	uint8_t		cdb[16];
+	uint8_t		lun;
+	uint8_t		serviceResponse;
+	uint8_t		taskStatus;
+	uint8_t		flags;
+} SCSITask;
+
+typedef struct TaskArray
+{
+	SCSITask *	tasks;
+	uint64_t	count;
+	uint64_t	capacity;
+} TaskArray;
+
+typedef struct CommandInfo
+{
+	uint8_t		opcode;
+	uint8_t		direction;				// 0 none, 1 read, 2 write
+	const char *	name;
+} CommandInfo;
+
+typedef struct DecodedCDB
+{
+	const char *	name;
+	uint8_t			direction;
+	uint64_t		lba;
+	uint32_t		blocks;
+} DecodedCDB;
+
+typedef struct DepthEvent
+{
+	uint64_t	time;
+	int32_t		queued;					// change in tasks outstanding
+	int32_t		inFlight;				// change in tasks on the transport
+} DepthEvent;
+
+typedef struct AnalyzerOptions
+{
+	int			format;
+	double		divisor;				// timestamp / divisor = microseconds, 0 to use the file's
+	uint32_t	blockSize;
+	uint32_t	intervalMilliseconds;
+	uint32_t	gapMicroseconds;
+	uint32_t	device;
+	bool		filterDevice;
+} AnalyzerOptions;
+
+typedef struct Trace
+{
+	TaskArray	tasks;
+	uint64_t	open[kAnalyzerMaxOpenTasks];	// indexes into tasks of tasks not yet completed
+	uint32_t	openCount;
+	uint32_t	devices[kAnalyzerMaxDevices];
+	uint32_t	deviceCount;
+	uint64_t	firstTimestamp;
+	uint64_t	lastTimestamp;
+	uint64_t	records;
+	uint64_t	unmatchedCompletions;
+	uint64_t	droppedOpenTasks;
+	uint64_t	wraps;					// times the kernel buffer wrapped during the capture
+	double		divisor;
+} Trace;
+
+
+//-----------------------------------------------------------------------------
+//	Globals
+//-----------------------------------------------------------------------------
+
+static const CommandInfo	kCommands[] =
+{
+	{ 0x00, 0, "TEST_UNIT_READY" },
+	{ 0x03, 0, "REQUEST_SENSE" },
+	{ 0x08, 1, "READ_6" },
+	{ 0x0A, 2, "WRITE_6" },
+	{ 0x12, 0, "INQUIRY" },
+	{ 0x15, 0, "MODE_SELECT_6" },
+	{ 0x1A, 0, "MODE_SENSE_6" },
+	{ 0x1B, 0, "START_STOP_UNIT" },
+	{ 0x1E, 0, "PREVENT_ALLOW_MEDIUM_REMOVAL" },
+	{ 0x23, 0, "READ_FORMAT_CAPACITIES" },
+	{ 0x25, 0, "READ_CAPACITY" },
+	{ 0x28, 1, "READ_10" },
+	{ 0x2A, 2, "WRITE_10" },
+	{ 0x2F, 0, "VERIFY_10" },
+	{ 0x35, 0, "SYNCHRONIZE_CACHE" },
+	{ 0x43, 0, "READ_TOC_PMA_ATIP" },
+	{ 0x46, 0, "GET_CONFIGURATION" },
+	{ 0x4A, 0, "GET_EVENT_STATUS_NOTIFICATION" },
+	{ 0x55, 0, "MODE_SELECT_10" },
+	{ 0x5A, 0, "MODE_SENSE_10" },
+	{ 0x88, 1, "READ_16" },
+	{ 0x8A, 2, "WRITE_16" },
+	{ 0x9E, 0, "SERVICE_ACTION_IN" },
+	{ 0xA0, 0, "REPORT_LUNS" },
+	{ 0xA8, 1, "READ_12" },
+	{ 0xAA, 2, "WRITE_12" },
+	{ 0xBE, 1, "READ_CD" }
+};
+
+
+//-----------------------------------------------------------------------------
+//	Prototypes
+//-----------------------------------------------------------------------------
+
+static void			PrintUsage ( const char * programName );
+static int			LoadTrace ( const char * path, const AnalyzerOptions * options, Trace * trace );
+static void			ProcessRecord ( Trace * trace, const RawRecord * record );
+static SCSITask *	FindOpenTask ( Trace * trace, uint32_t device, uint32_t request, bool dispatchedOnly );
+static SCSITask *	OpenTask ( Trace * trace, uint32_t device, uint32_t request, uint64_t timestamp );
+static void			CloseTask ( Trace * trace, SCSITask * task );
+static void			NoteDevice ( Trace * trace, uint32_t device );
+static void			DecodeCDB ( const SCSITask * task, DecodedCDB * decoded );
+static double		Microseconds ( const Trace * trace, uint64_t timestamp );
+static double		Elapsed ( const Trace * trace, uint64_t start, uint64_t end );
+static bool			TaskSelected ( const SCSITask * task, const AnalyzerOptions * options );
+static int			CompareSamples ( const void * a, const void * b );
+static int			CompareEvents ( const void * a, const void * b );
+static double		Percentile ( const double * sorted, uint64_t count, double fraction );
+static int			DoTasks ( const Trace * trace, const AnalyzerOptions * options );
+static int			DoDevices ( const Trace * trace, const AnalyzerOptions * options );
+static int			DoQueue ( const Trace * trace, const AnalyzerOptions * options );
+static int			DoGaps ( const Trace * trace, const AnalyzerOptions * options );
+static int			CompareDispatch ( const void * a, const void * b );
+
+
+//-----------------------------------------------------------------------------
+//	Main
+//-----------------------------------------------------------------------------
+
+int
+main ( int argc, char * const argv[] )
+{
+
+	AnalyzerOptions		options;
+	Trace				trace;
+	const char *		command;
+	int					error;
+	int					c;
+	struct option		long_options[] =
+	{
+		{ "format",		required_argument,	0, 'f' },
+		{ "divisor",	required_argument,	0, 'd' },
+		{ "block-size",	required_argument,	0, 'b' },
+		{ "interval",	required_argument,	0, 'i' },
+		{ "gap",		required_argument,	0, 'g' },
+		{ "device",		required_argument,	0, 'D' },
+		{ "help",		no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+
+	memset ( &options, 0, sizeof ( options ) );
+	options.format = kFormatText;
+	options.blockSize = kDefaultBlockSize;
+	options.intervalMilliseconds = kDefaultIntervalMilliseconds;
+	options.gapMicroseconds = kDefaultGapMicroseconds;
+
+	if ( argc < 2 )
+	{
+		PrintUsage ( argv[0] );
+		return 1;
+	}
+
+	command = argv[1];
+	optind = 2;
+
+	while ( ( c = getopt_long ( argc, argv, "f:d:b:i:g:D:h", long_options, NULL ) ) != -1 )
+	{
+
+		switch ( c )
+		{
+
+			case 'f':
+			{
+
+				if ( strcmp ( optarg, "csv" ) == 0 )
+					options.format = kFormatCSV;
+				else if ( strcmp ( optarg, "text" ) == 0 )
+					options.format = kFormatText;
+				else
+				{
+					elog ( "Unknown format '%s'\n", optarg );
+					return 1;
+				}
+
+			}
+			break;
+
+			case 'd':
+				options.divisor = strtod ( optarg, NULL );
+				break;
+
+			case 'b':
+				options.blockSize = ( uint32_t ) strtoul ( optarg, NULL, 0 );
+				break;
+
+			case 'i':
+				options.intervalMilliseconds = ( uint32_t ) strtoul ( optarg, NULL, 0 );
+				break;
+
+			case 'g':
+				options.gapMicroseconds = ( uint32_t ) strtoul ( optarg, NULL, 0 );
+				break;
+
+			case 'D':
+				options.device = ( uint32_t ) strtoul ( optarg, NULL, 0 );
+				options.filterDevice = true;
+				break;
+
+			default:
+				PrintUsage ( argv[0] );
+				return 1;
+
+		}
+
+	}
+
+	if ( ( optind != argc - 1 ) || ( options.blockSize == 0 ) || ( options.intervalMilliseconds == 0 ) )
+	{
+		PrintUsage ( argv[0] );
+		return 1;
+	}
+
+	error = LoadTrace ( argv[optind], &options, &trace );
+	if ( error != 0 )
+	{
+		elog ( "Could not read %s: %s\n", argv[optind], strerror ( error ) );
+		return 1;
+	}
+
+	if ( strcmp ( command, "tasks" ) == 0 )
+		error = DoTasks ( &trace, &options );
+	else if ( strcmp ( command, "devices" ) == 0 )
+		error = DoDevices ( &trace, &options );
+	else if ( strcmp ( command, "queue" ) == 0 )
+		error = DoQueue ( &trace, &options );
+	else if ( strcmp ( command, "gaps" ) == 0 )
+		error = DoGaps ( &trace, &options );
+	else
+	{
+		PrintUsage ( argv[0] );
+		error = EINVAL;
+	}
+
+	free ( trace.tasks.tasks );
+
+	return ( error == 0 ) ? 0 : 1;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	PrintUsage
+//-----------------------------------------------------------------------------
+
+static void
+PrintUsage ( const char * programName )
+{
+
+	elog ( "\n" );
+	elog ( "Usage: %s tasks|devices|queue|gaps [options] raw-file\n\n", programName );
+	elog ( "\ttasks    one line per SCSI task: CDB, LBA, length, timing, status and retries\n" );
+	elog ( "\tdevices  per device IOPS, throughput and latency percentiles\n" );
+	elog ( "\tqueue    per device queue depth and transport utilization over time\n" );
+	elog ( "\tgaps     periods where a device had no task in flight\n\n" );
+	elog ( "\t--format=text|csv     output format (tasks, queue and gaps)\n" );
+	elog ( "\t--divisor=n           timestamp divisor to microseconds, if the file has none (default %.0f)\n", kDefaultDivisor );
+	elog ( "\t--block-size=n        bytes per logical block for throughput (default %u)\n", kDefaultBlockSize );
+	elog ( "\t--interval=ms         queue depth interval (default %u)\n", kDefaultIntervalMilliseconds );
+	elog ( "\t--gap=us              smallest idle period reported (default %u)\n", kDefaultGapMicroseconds );
+	elog ( "\t--device=n            only this IOUSBMassStorageClass instance\n" );
+	elog ( "\n" );
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	LoadTrace - reads the raw file and rebuilds the SCSI tasks
+//-----------------------------------------------------------------------------
+
+static int
+LoadTrace ( const char * path, const AnalyzerOptions * options, Trace * trace )
+{
+
+	FILE *				file;
+	RawRecord			record;
+	UMCTraceFileHeader	header;
+	double				fileDivisor = 0.0;
+
+	memset ( trace, 0, sizeof ( *trace ) );
+	memset ( &header, 0, sizeof ( header ) );
+
+	file = fopen ( path, "rb" );
+	if ( file == NULL )
+		return errno;
+
+	if ( ( fread ( &header, sizeof ( header ), 1, file ) == 1 ) && ( header.magic == kUMCTraceFileMagic ) )
+	{
+
+		UMCTraceFileRecord	compact;
+
+		if ( ( header.version != kUMCTraceFileVersion ) || ( header.recordSize < sizeof ( compact ) ) )
+		{
+			fclose ( file );
+			return EINVAL;
+		}
+
+		fileDivisor = header.divisor;
+		fseek ( file, header.headerSize, SEEK_SET );
+
+		while ( fread ( &compact, sizeof ( compact ), 1, file ) == 1 )
+		{
+
+			if ( header.recordSize > sizeof ( compact ) )
+				fseek ( file, header.recordSize - sizeof ( compact ), SEEK_CUR );
+
+			if ( compact.debugid == kUMCTraceFileWrapEntry )
+			{
+				trace->wraps++;
+				continue;
+			}
+
+			memset ( &record, 0, sizeof ( record ) );
+			record.timestamp = compact.timestamp;
+			record.arg1 = compact.arg1;
+			record.arg2 = compact.arg2;
+			record.arg3 = compact.arg3;
+			record.arg4 = compact.arg4;
+			record.debugid = compact.debugid;
+			record.cpuid = compact.cpuid;
+
+			ProcessRecord ( trace, &record );
+
+		}
+
+		goto Done;
+
+	}
+
+	// Captured on a big endian machine
+	if ( header.magic == kUMCTraceFileSwappedMagic )
+	{
+		fclose ( file );
+		return EINVAL;
+	}
+
+	rewind ( file );
+
+	while ( fread ( &record, sizeof ( record ), 1, file ) == 1 )
+	{
+
+		if ( record.debugid == kRawInvalidEntry )
+			continue;
+
+		if ( record.debugid == kRawDivisorEntry )
+		{
+			fileDivisor = ( double ) record.timestamp;
+			continue;
+		}
+
+		ProcessRecord ( trace, &record );
+
+	}
+
+
+Done:
+
+
+	fclose ( file );
+
+	if ( options->divisor > 0.0 )
+		trace->divisor = options->divisor;
+	else if ( fileDivisor > 0.0 )
+		trace->divisor = fileDivisor;
+	else
+		trace->divisor = kDefaultDivisor;
+
+	return 0;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	ProcessRecord
+//-----------------------------------------------------------------------------
+
+static void
+ProcessRecord ( Trace * trace, const RawRecord * record )
+{
+
+	uint32_t		type	= record->debugid & ~0x3;
+	uint32_t		device	= ( uint32_t ) record->arg1;
+	uint64_t		now		= record->timestamp;
+	SCSITask *		task;
+
+	if ( !UMCTraceIsUMC ( type ) )
+		return;
+
+	if ( trace->records++ == 0 )
+		trace->firstTimestamp = now;
+	if ( now > trace->lastTimestamp )
+		trace->lastTimestamp = now;
+
+	switch ( UMCTraceCode ( type ) )
+	{
+
+		case kUMCBOCommandAlreadyInProgress:
+		case kUMCCBICommandAlreadyInProgress:
+		{
+
+			// The SCSI layer will send the same task again once the current one completes
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, false );
+			if ( task == NULL )
+				task = OpenTask ( trace, device, ( uint32_t ) record->arg2, now );
+			if ( task != NULL )
+				task->busyRetries++;
+
+		}
+		break;
+
+		case kUMCCDBLog1:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, false );
+			if ( ( task != NULL ) && ( task->flags & kTaskDispatched ) )
+			{
+				// Never saw the previous completion, the record was lost
+				CloseTask ( trace, task );
+				task = NULL;
+			}
+
+			if ( task == NULL )
+				task = OpenTask ( trace, device, ( uint32_t ) record->arg2, now );
+
+			if ( task != NULL )
+			{
+
+				// The kext packs the CDB little endian, 4 bytes per argument
+				for ( int i = 0; i < 4; i++ )
+				{
+					task->cdb[i]		= ( uint8_t )( record->arg3 >> ( i * 8 ) );
+					task->cdb[i + 4]	= ( uint8_t )( record->arg4 >> ( i * 8 ) );
+				}
+				task->dispatched = now;
+				task->flags |= kTaskDispatched | kTaskCDB1;
+
+			}
+
+		}
+		break;
+
+		case kUMCCDBLog2:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, true );
+			if ( task != NULL )
+			{
+
+				for ( int i = 0; i < 4; i++ )
+				{
+					task->cdb[i + 8]	= ( uint8_t )( record->arg3 >> ( i * 8 ) );
+					task->cdb[i + 12]	= ( uint8_t )( record->arg4 >> ( i * 8 ) );
+				}
+				task->flags |= kTaskCDB2;
+
+			}
+
+		}
+		break;
+
+		case kUMCBOCBWDescription:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, true );
+			if ( task != NULL )
+			{
+				task->lun = ( uint8_t ) record->arg3;
+				task->cbwTag = ( uint32_t ) record->arg4;
+			}
+
+		}
+		break;
+
+		case kUMCBOSendSCSICommandReturned:
+		case kUMCCBISendSCSICommandReturned:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, true );
+			if ( task != NULL )
+				task->sendStatus = ( uint32_t ) record->arg3;
+
+		}
+		break;
+
+		case kUMCBOCompletion:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg4, true );
+			if ( ( task != NULL ) && ( ( uint32_t ) record->arg2 != 0 ) )
+				task->transportErrors++;
+
+		}
+		break;
+
+		case kUMCClearEndPointStall:
+		{
+
+			// Recovery is done on behalf of whatever task is on the bus
+			task = FindOpenTask ( trace, device, 0, true );
+			if ( task != NULL )
+				task->stalls++;
+
+		}
+		break;
+
+		case kUMCUSBDeviceResetReturned:
+		{
+
+			task = FindOpenTask ( trace, device, 0, true );
+			if ( task != NULL )
+				task->resets++;
+
+		}
+		break;
+
+		case kUMCAbortedTask:
+		case kUMCAbortCurrentSCSITask:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, false );
+			if ( task != NULL )
+				task->flags |= kTaskAborted;
+
+		}
+		break;
+
+		case kUMCCompleteSCSICommand:
+		{
+
+			task = FindOpenTask ( trace, device, ( uint32_t ) record->arg2, false );
+			if ( task == NULL )
+			{
+				// Dispatched before the trace started
+				trace->unmatchedCompletions++;
+				break;
+			}
+
+			task->completed = now;
+			task->serviceResponse = ( uint8_t ) record->arg3;
+			task->taskStatus = ( uint8_t ) record->arg4;
+			task->flags |= kTaskCompleted;
+			if ( task->dispatched == 0 )
+				task->dispatched = task->submitted;
+			CloseTask ( trace, task );
+
+		}
+		break;
+
+		default:
+			break;
+
+	}
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	FindOpenTask - request 0 with dispatchedOnly matches the device's task on the bus
+//-----------------------------------------------------------------------------
+
+static SCSITask *
+FindOpenTask ( Trace * trace, uint32_t device, uint32_t request, bool dispatchedOnly )
+{
+
+	uint32_t	index;
+
+	for ( index = 0; index < trace->openCount; index++ )
+	{
+
+		SCSITask * task = &trace->tasks.tasks[trace->open[index]];
+
+		if ( task->device != device )
+			continue;
+
+		if ( dispatchedOnly && !( task->flags & kTaskDispatched ) )
+			continue;
+
+		if ( ( request == 0 ) || ( task->request == request ) )
+			return task;
+
+	}
+
+	return NULL;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	OpenTask
+//-----------------------------------------------------------------------------
+
+static SCSITask *
+OpenTask ( Trace * trace, uint32_t device, uint32_t request, uint64_t timestamp )
+{
+
+	TaskArray *		array = &trace->tasks;
+	SCSITask *		task;
+
+	if ( array->count == array->capacity )
+	{
+
+		uint64_t		capacity	= array->capacity ? array->capacity * 2 : 4096;
+		SCSITask *		tasks		= ( SCSITask * ) realloc ( array->tasks, capacity * sizeof ( SCSITask ) );
+
+		if ( tasks == NULL )
+			return NULL;
+
+		array->tasks = tasks;
+		array->capacity = capacity;
+
+	}
+
+	// Too many tasks that never complete, give up on the oldest one
+	if ( trace->openCount == kAnalyzerMaxOpenTasks )
+	{
+		memmove ( &trace->open[0], &trace->open[1], ( kAnalyzerMaxOpenTasks - 1 ) * sizeof ( trace->open[0] ) );
+		trace->openCount--;
+		trace->droppedOpenTasks++;
+	}
+
+	task = &array->tasks[array->count];
+	memset ( task, 0, sizeof ( *task ) );
+	task->device = device;
+	task->request = request;
+	task->submitted = timestamp;
+
+	trace->open[trace->openCount++] = array->count++;
+	NoteDevice ( trace, device );
+
+	return task;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	CloseTask
+//-----------------------------------------------------------------------------
+
+static void
+CloseTask ( Trace * trace, SCSITask * task )
+{
+
+	uint64_t	which = ( uint64_t )( task - trace->tasks.tasks );
+	uint32_t	index;
+
+	for ( index = 0; index < trace->openCount; index++ )
+	{
+
+		if ( trace->open[index] == which )
+		{
+			memmove ( &trace->open[index], &trace->open[index + 1], ( trace->openCount - index - 1 ) * sizeof ( trace->open[0] ) );
+			trace->openCount--;
+			break;
+		}
+
+	}
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	NoteDevice
+//-----------------------------------------------------------------------------
+
+static void
+NoteDevice ( Trace * trace, uint32_t device )
+{
+
+	uint32_t	index;
+
+	for ( index = 0; index < trace->deviceCount; index++ )
+	{
+		if ( trace->devices[index] == device )
+			return;
+	}
+
+	if ( trace->deviceCount < kAnalyzerMaxDevices )
+		trace->devices[trace->deviceCount++] = device;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	DecodeCDB - command name, and LBA and transfer length for the block commands
+//-----------------------------------------------------------------------------
+
+static void
+DecodeCDB ( const SCSITask * task, DecodedCDB * decoded )
+{
+
+	const uint8_t *		cdb = task->cdb;
+	uint32_t			index;
+
+	memset ( decoded, 0, sizeof ( *decoded ) );
+	decoded->name = "UNKNOWN";
+
+	for ( index = 0; index < sizeof ( kCommands ) / sizeof ( kCommands[0] ); index++ )
+	{
+
+		if ( kCommands[index].opcode == cdb[0] )
+		{
+			decoded->name = kCommands[index].name;
+			decoded->direction = kCommands[index].direction;
+			break;
+		}
+
+	}
+
+	switch ( cdb[0] )
+	{
+
+		case 0x08:		// READ_6
+		case 0x0A:		// WRITE_6
+		{
+
+			decoded->lba = ( ( uint32_t )( cdb[1] & 0x1F ) << 16 ) | ( ( uint32_t ) cdb[2] << 8 ) | cdb[3];
+			decoded->blocks = ( cdb[4] == 0 ) ? 256 : cdb[4];
+
+		}
+		break;
+
+		case 0x28:		// READ_10
+		case 0x2A:		// WRITE_10
+		{
+
+			decoded->lba = ( ( uint32_t ) cdb[2] << 24 ) | ( ( uint32_t ) cdb[3] << 16 ) | ( ( uint32_t ) cdb[4] << 8 ) | cdb[5];
+			decoded->blocks = ( ( uint32_t ) cdb[7] << 8 ) | cdb[8];
+
+		}
+		break;
+
+		case 0xA8:		// READ_12
+		case 0xAA:		// WRITE_12
+		{
+
+			decoded->lba = ( ( uint32_t ) cdb[2] << 24 ) | ( ( uint32_t ) cdb[3] << 16 ) | ( ( uint32_t ) cdb[4] << 8 ) | cdb[5];
+			decoded->blocks = ( ( uint32_t ) cdb[6] << 24 ) | ( ( uint32_t ) cdb[7] << 16 ) | ( ( uint32_t ) cdb[8] << 8 ) | cdb[9];
+
+		}
+		break;
+
+		case 0x88:		// READ_16
+		case 0x8A:		// WRITE_16
+		{
+
+			if ( task->flags & kTaskCDB2 )
+			{
+
+				for ( index = 2; index < 10; index++ )
+					decoded->lba = ( decoded->lba << 8 ) | cdb[index];
+				decoded->blocks = ( ( uint32_t ) cdb[10] << 24 ) | ( ( uint32_t ) cdb[11] << 16 ) | ( ( uint32_t ) cdb[12] << 8 ) | cdb[13];
+
+			}
+
+		}
+		break;
+
+		default:
+			break;
+
+	}
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	Helpers
+//-----------------------------------------------------------------------------
+
+static double
+Microseconds ( const Trace * trace, uint64_t timestamp )
+{
+	return ( double )( timestamp - trace->firstTimestamp ) / trace->divisor;
+}
+
+static double
+Elapsed ( const Trace * trace, uint64_t start, uint64_t end )
+{
+	return ( end > start ) ? ( double )( end - start ) / trace->divisor : 0.0;
+}
+
+static bool
+TaskSelected ( const SCSITask * task, const AnalyzerOptions * options )
+{
+	return !options->filterDevice || ( task->device == options->device );
+}
+
+static int
+CompareSamples ( const void * a, const void * b )
+{
+
+	double first = *( const double * ) a;
+	double second = *( const double * ) b;
+
+	return ( first < second ) ? -1 : ( ( first > second ) ? 1 : 0 );
+
+}
+
+static int
+CompareEvents ( const void * a, const void * b )
+{
+
+	const DepthEvent * first = ( const DepthEvent * ) a;
+	const DepthEvent * second = ( const DepthEvent * ) b;
+
+	if ( first->time != second->time )
+		return ( first->time < second->time ) ? -1 : 1;
+
+	// Completions before submissions at the same instant
+	return ( first->queued + first->inFlight ) - ( second->queued + second->inFlight );
+
+}
+
+// Nearest rank
+static double
+Percentile ( const double * sorted, uint64_t count, double fraction )
+{
+
+	uint64_t	rank;
+
+	if ( count == 0 )
+		return 0.0;
+
+	rank = ( uint64_t )( fraction * count + 0.999999 );
+	if ( rank == 0 )
+		rank = 1;
+	if ( rank > count )
+		rank = count;
+
+	return sorted[rank - 1];
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	DoTasks
+//-----------------------------------------------------------------------------
+
+static int
+DoTasks ( const Trace * trace, const AnalyzerOptions * options )
+{
+
+	uint64_t	index;
+
+	if ( options->format == kFormatCSV )
+		printf ( "submitted_us,wait_us,service_us,device,request,lun,tag,command,cdb,lba,blocks,send_status,response,status,busy_retries,stalls,resets,transport_errors,state\n" );
+	else
+		printf ( "%14s %10s %10s %-10s %-10s %3s %-24s %12s %8s %4s %4s %5s %6s %6s  %s\n",
+				 "submitted(us)", "wait(us)", "service(us)", "device", "request", "lun",
+				 "command", "lba", "blocks", "resp", "stat", "busy", "stalls", "resets", "state" );
+
+	for ( index = 0; index < trace->tasks.count; index++ )
+	{
+
+		const SCSITask *	task = &trace->tasks.tasks[index];
+		DecodedCDB			decoded;
+		const char *		state;
+		double				wait;
+		double				service;
+
+		if ( !TaskSelected ( task, options ) )
+			continue;
+
+		DecodeCDB ( task, &decoded );
+
+		if ( !( task->flags & kTaskCompleted ) )
+			state = ( task->flags & kTaskDispatched ) ? "incomplete" : "never-dispatched";
+		else if ( task->flags & kTaskAborted )
+			state = "aborted";
+		else if ( ( task->serviceResponse != kSCSIServiceResponseTaskComplete ) || ( task->taskStatus != kSCSITaskStatusGood ) )
+			state = "error";
+		else
+			state = "ok";
+
+		wait = Elapsed ( trace, task->submitted, task->dispatched );
+		service = ( task->flags & kTaskCompleted ) ? Elapsed ( trace, task->dispatched, task->completed ) : 0.0;
+
+		if ( options->format == kFormatCSV )
+		{
+
+			printf ( "%.3f,%.3f,%.3f,0x%08x,0x%08x,%u,%u,%s,",
+					 Microseconds ( trace, task->submitted ), wait, service, task->device, task->request,
+					 task->lun, task->cbwTag, decoded.name );
+			for ( int i = 0; i < 16; i++ )
+				printf ( "%02x", task->cdb[i] );
+			printf ( ",%llu,%u,0x%x,%u,0x%02x,%u,%u,%u,%u,%s\n",
+					 ( unsigned long long ) decoded.lba, decoded.blocks, task->sendStatus, task->serviceResponse, task->taskStatus,
+					 task->busyRetries, task->stalls, task->resets, task->transportErrors, state );
+
+		}
+
+		else
+		{
+
+			printf ( "%14.3f %10.3f %10.3f 0x%08x 0x%08x %3u %-24.24s %12llu %8u %4u 0x%02x %5u %6u %6u  %s\n",
+					 Microseconds ( trace, task->submitted ), wait, service, task->device, task->request,
+					 task->lun, decoded.name, ( unsigned long long ) decoded.lba, decoded.blocks,
+					 task->serviceResponse, task->taskStatus, task->busyRetries, task->stalls, task->resets, state );
+
+		}
+
+	}
+
+	return 0;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	DoDevices
+//-----------------------------------------------------------------------------
+
+static int
+DoDevices ( const Trace * trace, const AnalyzerOptions * options )
+{
+
+	double *	latency;
+	double *	service;
+	uint32_t	which;
+
+	latency = ( double * ) malloc ( ( trace->tasks.count + 1 ) * sizeof ( double ) );
+	service = ( double * ) malloc ( ( trace->tasks.count + 1 ) * sizeof ( double ) );
+	if ( ( latency == NULL ) || ( service == NULL ) )
+	{
+		free ( latency );
+		free ( service );
+		return ENOMEM;
+	}
+
+	printf ( "%llu tracepoints, %.3f ms, divisor %.3f\n", ( unsigned long long ) trace->records,
+			 Elapsed ( trace, trace->firstTimestamp, trace->lastTimestamp ) / kMicrosecondsPerMillisecond, trace->divisor );
+	if ( trace->wraps )
+		printf ( "the kernel trace buffer wrapped %llu times, some tasks are incomplete\n", ( unsigned long long ) trace->wraps );
+	if ( trace->unmatchedCompletions || trace->droppedOpenTasks )
+		printf ( "%llu completions without a task, %llu tasks dropped while open\n",
+				 ( unsigned long long ) trace->unmatchedCompletions, ( unsigned long long ) trace->droppedOpenTasks );
+
+	for ( which = 0; which < trace->deviceCount; which++ )
+	{
+
+		uint32_t	device		= trace->devices[which];
+		uint64_t	count		= 0;
+		uint64_t	completed	= 0;
+		uint64_t	errors		= 0;
+		uint64_t	reads		= 0;
+		uint64_t	writes		= 0;
+		uint64_t	readBlocks	= 0;
+		uint64_t	writeBlocks	= 0;
+		uint64_t	retried		= 0;
+		uint64_t	busyRetries	= 0;
+		uint64_t	recoveries	= 0;
+		uint64_t	first		= UINT64_MAX;
+		uint64_t	last		= 0;
+		double		busy		= 0.0;
+		double		outstanding	= 0.0;
+		double		span;
+		double		seconds;
+		uint64_t	index;
+
+		if ( options->filterDevice && ( device != options->device ) )
+			continue;
+
+		for ( index = 0; index < trace->tasks.count; index++ )
+		{
+
+			const SCSITask *	task = &trace->tasks.tasks[index];
+			DecodedCDB			decoded;
+
+			if ( task->device != device )
+				continue;
+
+			count++;
+			if ( task->submitted < first )
+				first = task->submitted;
+
+			if ( task->busyRetries )
+				retried++;
+			busyRetries += task->busyRetries;
+			recoveries += task->stalls + task->resets;
+
+			if ( !( task->flags & kTaskCompleted ) )
+				continue;
+
+			if ( task->completed > last )
+				last = task->completed;
+
+			if ( ( task->serviceResponse != kSCSIServiceResponseTaskComplete ) || ( task->taskStatus != kSCSITaskStatusGood ) )
+				errors++;
+
+			DecodeCDB ( task, &decoded );
+			if ( decoded.direction == 1 )
+			{
+				reads++;
+				readBlocks += decoded.blocks;
+			}
+			else if ( decoded.direction == 2 )
+			{
+				writes++;
+				writeBlocks += decoded.blocks;
+			}
+
+			latency[completed] = Elapsed ( trace, task->submitted, task->completed );
+			service[completed] = Elapsed ( trace, task->dispatched, task->completed );
+			busy += service[completed];
+			outstanding += latency[completed];
+			completed++;
+
+		}
+
+		qsort ( latency, completed, sizeof ( double ), CompareSamples );
+		qsort ( service, completed, sizeof ( double ), CompareSamples );
+
+		span = ( last > first ) ? Elapsed ( trace, first, last ) : 0.0;
+		seconds = span / ( kMicrosecondsPerMillisecond * kMicrosecondsPerMillisecond );
+
+		printf ( "\nDevice 0x%08x\n", device );
+		printf ( "  tasks %llu, completed %llu, errors %llu, reads %llu, writes %llu\n",
+				 ( unsigned long long ) count, ( unsigned long long ) completed, ( unsigned long long ) errors,
+				 ( unsigned long long ) reads, ( unsigned long long ) writes );
+		printf ( "  busy rejections %llu on %llu tasks, stall/reset recoveries %llu\n",
+				 ( unsigned long long ) busyRetries, ( unsigned long long ) retried, ( unsigned long long ) recoveries );
+
+		if ( seconds > 0.0 )
+		{
+
+			// Mean queue depth is the time every task spent outstanding over the active span (Little's law)
+			printf ( "  %.3f ms active: %.1f IOPS, read %.2f MB/s, write %.2f MB/s, transport busy %.1f%%, mean queue depth %.2f\n",
+					 span / kMicrosecondsPerMillisecond, completed / seconds,
+					 ( double ) readBlocks * options->blockSize / ( seconds * 1000000.0 ),
+					 ( double ) writeBlocks * options->blockSize / ( seconds * 1000000.0 ),
+					 100.0 * busy / span, outstanding / span );
+
+		}
+
+		if ( completed > 0 )
+		{
+
+			printf ( "  %-12s %10s %10s %10s %10s %10s %10s\n", "(us)", "min", "p50", "p90", "p99", "p99.9", "max" );
+			printf ( "  %-12s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", "latency", latency[0],
+					 Percentile ( latency, completed, 0.50 ), Percentile ( latency, completed, 0.90 ),
+					 Percentile ( latency, completed, 0.99 ), Percentile ( latency, completed, 0.999 ), latency[completed - 1] );
+			printf ( "  %-12s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", "service", service[0],
+					 Percentile ( service, completed, 0.50 ), Percentile ( service, completed, 0.90 ),
+					 Percentile ( service, completed, 0.99 ), Percentile ( service, completed, 0.999 ), service[completed - 1] );
+
+		}
+
+	}
+
+	free ( latency );
+	free ( service );
+
+	return 0;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	DoQueue - time weighted queue depth per interval
+//
+//	A task is queued from the first time it is seen until it completes, and on
+//	the transport from its CDB until it completes.  The transports only take one
+//	task at a time, so a queue depth above one means the SCSI layer had tasks
+//	waiting behind a busy device.  Tasks that never complete count until the end
+//	of the trace.
+//-----------------------------------------------------------------------------
+
+static int
+DoQueue ( const Trace * trace, const AnalyzerOptions * options )
+{
+
+	DepthEvent *	events;
+	uint64_t		intervalTicks;
+	uint64_t		binCount;
+	double *		queuedArea;
+	double *		flightArea;
+	uint32_t *		maxQueued;
+	uint64_t *		completions;
+	uint64_t *		blocks;
+	uint32_t		which;
+	int				error = 0;
+
+	intervalTicks = ( uint64_t )( ( double ) options->intervalMilliseconds * kMicrosecondsPerMillisecond * trace->divisor );
+	if ( intervalTicks == 0 )
+		intervalTicks = 1;
+	binCount = ( ( trace->lastTimestamp - trace->firstTimestamp ) / intervalTicks ) + 1;
+
+	events		= ( DepthEvent * ) malloc ( ( trace->tasks.count * 3 + 1 ) * sizeof ( DepthEvent ) );
+	queuedArea	= ( double * ) malloc ( binCount * sizeof ( double ) );
+	flightArea	= ( double * ) malloc ( binCount * sizeof ( double ) );
+	maxQueued	= ( uint32_t * ) malloc ( binCount * sizeof ( uint32_t ) );
+	completions	= ( uint64_t * ) malloc ( binCount * sizeof ( uint64_t ) );
+	blocks		= ( uint64_t * ) malloc ( binCount * sizeof ( uint64_t ) );
+	if ( !events || !queuedArea || !flightArea || !maxQueued || !completions || !blocks )
+	{
+		error = ENOMEM;
+		goto Exit;
+	}
+
+	if ( options->format == kFormatCSV )
+		printf ( "device,start_ms,mean_queue_depth,max_queue_depth,transport_busy_pct,iops,mb_per_s\n" );
+
+	for ( which = 0; which < trace->deviceCount; which++ )
+	{
+
+		uint32_t	device		= trace->devices[which];
+		uint64_t	eventCount	= 0;
+		uint64_t	index;
+		uint64_t	bin;
+		uint64_t	cursor		= trace->firstTimestamp;
+		int32_t		queued		= 0;
+		int32_t		inFlight	= 0;
+		double		seconds		= ( double ) options->intervalMilliseconds / kMicrosecondsPerMillisecond;
+
+		if ( options->filterDevice && ( device != options->device ) )
+			continue;
+
+		memset ( queuedArea, 0, binCount * sizeof ( double ) );
+		memset ( flightArea, 0, binCount * sizeof ( double ) );
+		memset ( maxQueued, 0, binCount * sizeof ( uint32_t ) );
+		memset ( completions, 0, binCount * sizeof ( uint64_t ) );
+		memset ( blocks, 0, binCount * sizeof ( uint64_t ) );
+
+		for ( index = 0; index < trace->tasks.count; index++ )
+		{
+
+			const SCSITask *	task	= &trace->tasks.tasks[index];
+			uint64_t			end		= ( task->flags & kTaskCompleted ) ? task->completed : trace->lastTimestamp;
+
+			if ( task->device != device )
+				continue;
+
+			events[eventCount].time = task->submitted;
+			events[eventCount].queued = 1;
+			events[eventCount++].inFlight = 0;
+
+			if ( task->flags & kTaskDispatched )
+			{
+				events[eventCount].time = task->dispatched;
+				events[eventCount].queued = 0;
+				events[eventCount++].inFlight = 1;
+			}
+
+			events[eventCount].time = end;
+			events[eventCount].queued = -1;
+			events[eventCount++].inFlight = ( task->flags & kTaskDispatched ) ? -1 : 0;
+
+			if ( task->flags & kTaskCompleted )
+			{
+
+				DecodedCDB	decoded;
+
+				DecodeCDB ( task, &decoded );
+				bin = ( task->completed - trace->firstTimestamp ) / intervalTicks;
+				completions[bin]++;
+				if ( decoded.direction != 0 )
+					blocks[bin] += decoded.blocks;
+
+			}
+
+		}
+
+		qsort ( events, eventCount, sizeof ( DepthEvent ), CompareEvents );
+
+		// Sweep the events, splitting each constant depth period across the intervals it covers
+		for ( index = 0; index < eventCount; index++ )
+		{
+
+			uint64_t	time = events[index].time;
+
+			while ( cursor < time )
+			{
+
+				uint64_t	binEnd;
+				uint64_t	until;
+
+				bin = ( cursor - trace->firstTimestamp ) / intervalTicks;
+				binEnd = trace->firstTimestamp + ( bin + 1 ) * intervalTicks;
+				until = ( time < binEnd ) ? time : binEnd;
+
+				queuedArea[bin] += ( double ) queued * ( until - cursor );
+				flightArea[bin] += ( double ) inFlight * ( until - cursor );
+				if ( ( queued > 0 ) && ( ( uint32_t ) queued > maxQueued[bin] ) )
+					maxQueued[bin] = ( uint32_t ) queued;
+				cursor = until;
+
+			}
+
+			queued += events[index].queued;
+			inFlight += events[index].inFlight;
+
+			bin = ( time - trace->firstTimestamp ) / intervalTicks;
+			if ( ( queued > 0 ) && ( ( uint32_t ) queued > maxQueued[bin] ) )
+				maxQueued[bin] = ( uint32_t ) queued;
+
+		}
+
+		if ( options->format == kFormatText )
+		{
+			printf ( "\nDevice 0x%08x, %u ms intervals\n", device, options->intervalMilliseconds );
+			printf ( "  %12s %10s %9s %8s %10s %10s\n", "start(ms)", "mean depth", "max depth", "busy %", "IOPS", "MB/s" );
+		}
+
+		for ( bin = 0; bin < binCount; bin++ )
+		{
+
+			double	start	= ( double ) bin * options->intervalMilliseconds;
+			double	depth	= queuedArea[bin] / intervalTicks;
+			double	busy	= 100.0 * flightArea[bin] / intervalTicks;
+			double	iops	= completions[bin] / seconds;
+			double	mbps	= ( double ) blocks[bin] * options->blockSize / ( seconds * 1000000.0 );
+
+			if ( options->format == kFormatCSV )
+				printf ( "0x%08x,%.0f,%.3f,%u,%.1f,%.1f,%.3f\n", device, start, depth, maxQueued[bin], busy, iops, mbps );
+			else
+				printf ( "  %12.0f %10.3f %9u %8.1f %10.1f %10.3f\n", start, depth, maxQueued[bin], busy, iops, mbps );
+
+		}
+
+	}
+
+
+Exit:
+
+
+	free ( events );
+	free ( queuedArea );
+	free ( flightArea );
+	free ( maxQueued );
+	free ( completions );
+	free ( blocks );
+
+	return error;
+
+}
+
+
+//-----------------------------------------------------------------------------
+//	DoGaps - periods with nothing on the transport between two tasks
+//-----------------------------------------------------------------------------
+
+static const SCSITask *		gSortTasks = NULL;
+
+static int
+CompareDispatch ( const void * a, const void * b )
+{
+
+	const SCSITask * first = &gSortTasks[*( const uint64_t * ) a];
+	const SCSITask * second = &gSortTasks[*( const uint64_t * ) b];
+
+	if ( first->dispatched != second->dispatched )
+		return ( first->dispatched < second->dispatched ) ? -1 : 1;
+
+	return 0;
+
+}
+
+static int
+DoGaps ( const Trace * trace, const AnalyzerOptions * options )
+{
+
+	uint64_t *		order;
+	uint32_t		which;
+
+	order = ( uint64_t * ) malloc ( ( trace->tasks.count + 1 ) * sizeof ( uint64_t ) );
+	if ( order == NULL )
+		return ENOMEM;
+
+	gSortTasks = trace->tasks.tasks;
+
+	if ( options->format == kFormatCSV )
+		printf ( "device,idle_start_us,idle_us,previous_command,next_command,next_waiting_us\n" );
+	else
+		printf ( "%-10s %14s %12s %-24s %-24s %s\n", "device", "idle at(us)", "idle(us)", "after", "before", "next task waiting(us)" );
+
+	for ( which = 0; which < trace->deviceCount; which++ )
+	{
+
+		uint32_t			device		= trace->devices[which];
+		uint64_t			count		= 0;
+		uint64_t			gaps		= 0;
+		uint64_t			index;
+		uint64_t			lastEnd		= 0;
+		const SCSITask *	previous	= NULL;
+		double				idle		= 0.0;
+		double				span;
+
+		if ( options->filterDevice && ( device != options->device ) )
+			continue;
+
+		for ( index = 0; index < trace->tasks.count; index++ )
+		{
+
+			const SCSITask * task = &trace->tasks.tasks[index];
+
+			if ( ( task->device == device ) && ( task->flags & kTaskDispatched ) )
+				order[count++] = index;
+
+		}
+
+		qsort ( order, count, sizeof ( uint64_t ), CompareDispatch );
+
+		for ( index = 0; index < count; index++ )
+		{
+
+			const SCSITask *	task = &trace->tasks.tasks[order[index]];
+			uint64_t			end = ( task->flags & kTaskCompleted ) ? task->completed : trace->lastTimestamp;
+
+			if ( ( previous != NULL ) && ( task->dispatched > lastEnd ) )
+			{
+
+				double		gap = Elapsed ( trace, lastEnd, task->dispatched );
+
+				idle += gap;
+
+				if ( gap >= options->gapMicroseconds )
+				{
+
+					DecodedCDB	before;
+					DecodedCDB	after;
+					double		waiting;
+
+					// A task that was already rejected as busy when the transport went idle points at host side delay
+					DecodeCDB ( previous, &before );
+					DecodeCDB ( task, &after );
+					waiting = ( task->submitted < task->dispatched ) ? Elapsed ( trace, task->submitted, task->dispatched ) : 0.0;
+
+					if ( options->format == kFormatCSV )
+						printf ( "0x%08x,%.3f,%.3f,%s,%s,%.3f\n", device, Microseconds ( trace, lastEnd ), gap, before.name, after.name, waiting );
+					else
+						printf ( "0x%08x %14.3f %12.3f %-24.24s %-24.24s %.3f\n", device, Microseconds ( trace, lastEnd ), gap, before.name, after.name, waiting );
+
+					gaps++;
+
+				}
+
+			}
+
+			if ( end > lastEnd )
+			{
+				lastEnd = end;
+				previous = task;
+			}
+
+		}
+
+		if ( ( options->format == kFormatText ) && ( count > 1 ) )
+		{
+
+			span = Elapsed ( trace, trace->tasks.tasks[order[0]].dispatched, lastEnd );
+			printf ( "0x%08x: %llu gaps of %u us or more, idle %.3f of %.3f ms (%.1f%%)\n\n", device,
+					 ( unsigned long long ) gaps, options->gapMicroseconds, idle / kMicrosecondsPerMillisecond,
+					 span / kMicrosecondsPerMillisecond, ( span > 0.0 ) ? 100.0 * idle / span : 0.0 );
+
+		}
+
+	}
+
+	free ( order );
+
+	return 0;
+
+}
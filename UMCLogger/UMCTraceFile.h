@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2013 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * "Portions Copyright (c) 1999 Apple Inc.  All Rights
+ * Reserved.  This file contains Original Code and/or Modifications of
+ * Original Code as defined in and that are subject to the Apple Public
+ * Source License Version 1.0 (the 'License').	You may not use this file
+ * except in compliance with the License.  Please obtain a copy of the
+ * License at http://www.apple.com/publicsource and read it before using
+ * this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License."
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __UMC_TRACE_FILE_H__
+#define __UMC_TRACE_FILE_H__
+
+//-----------------------------------------------------------------------------
+//	UMCLogger capture format
+//
+//	'UMCLogger -f' writes a UMCTraceFileHeader followed by UMCTraceFileRecords.
+//	The mass storage tracepoints only ever carry 32 bit arguments, so a record
+//	is half the size of a 64 bit kd_buf and is the same on every architecture.
+//	Everything is in the byte order of the machine that wrote the file, which
+//	readers can tell from the magic.
+//
+//	Besides tracepoints the record stream may contain a wrap entry, written in
+//	front of the first record read after the kernel reported KDBG_WRAPPED.
+//	Tracepoints were lost at that point.
+//
+//	This header only uses POSIX types so that 'UMCLogger -r' and the offline
+//	analyzer (UMCTraceAnalyzer.cpp) share it.
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#define kUMCTraceFileMagic				0x54434D55		/* 'UMCT' on a little endian disk */
+#define kUMCTraceFileSwappedMagic		0x554D4354
+#define kUMCTraceFileVersion			1
+
+// debugid values of records that are not tracepoints
+#define kUMCTraceFileWrapEntry			0xfeedfeed		/* arg1 = number of wraps so far */
+
+#pragma pack(push, 4)
+
+typedef struct UMCTraceFileHeader
+{
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	headerSize;
+	double		divisor;				// timestamp / divisor = microseconds
+	uint32_t	recordSize;
+	uint32_t	reserved;
+	uint64_t	captureTime;			// time ( ) when the capture started
+} UMCTraceFileHeader;
+
+typedef struct UMCTraceFileRecord
+{
+	uint64_t	timestamp;
+	uint32_t	arg1;
+	uint32_t	arg2;
+	uint32_t	arg3;
+	uint32_t	arg4;
+	uint32_t	debugid;
+	uint32_t	cpuid;
+} UMCTraceFileRecord;
+
+#pragma pack(pop)
+
+#endif	/* __UMC_TRACE_FILE_H__ */
@@ -0,0 +1,1009 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//—————————————————————————————————————————————————————————————————————————————
+//	usbtraceanalyze
+//
+//	Offline analysis of indexed USB traces.  Only depends on POSIX so traces
+//	recorded on a customer machine can be examined anywhere:
+//
+//		usbtraceanalyze import raw-file indexed-file
+//		usbtraceanalyze info indexed-file
+//		usbtraceanalyze query [--bus=n] [--addr=n] [--ep=n] [--start=us] [--end=us] [--group=n] indexed-file
+//		usbtraceanalyze latency [--bus=n] [--addr=n] [--ep=n] [--start=us] [--end=us] indexed-file
+//		usbtraceanalyze transfers [--format=csv|json] [options] indexed-file
+//		usbtraceanalyze endpoints [--format=text|csv|json] [options] indexed-file
+//		usbtraceanalyze timeline [--format=text|csv|json] [options] indexed-file
+//—————————————————————————————————————————————————————————————————————————————
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "USBTraceIndex.h"
+#include "USBTraceTransfers.h"
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Constants
+//—————————————————————————————————————————————————————————————————————————————
+
+#define kAnalyzerMaxEndpoints			1024			// power of two
+#define kAnalyzerPendingDepth			64				// outstanding transfers tracked per endpoint
+#define kAnalyzerHistogramBuckets		24				// log2 microsecond buckets, 1us .. 8s
+#define kAnalyzerPercentileCount		5
+
+enum
+{
+	kFormatText		= 0,
+	kFormatCSV		= 1,
+	kFormatJSON		= 2
+};
+
+#define	elog(x...)						fprintf(stderr, x)
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Types
+//—————————————————————————————————————————————————————————————————————————————
+
+typedef struct EndpointLatency
+{
+	uint32_t	key;					// packed direction and USBTraceDeviceKey()
+	uint32_t	inUse;
+	uint32_t	pendingHead;
+	uint32_t	pendingCount;
+	uint64_t	pending[kAnalyzerPendingDepth];
+	uint64_t	completed;
+	uint64_t	unmatched;
+	double		minimum;
+	double		maximum;
+	double		total;
+	uint64_t	histogram[kAnalyzerHistogramBuckets];
+} EndpointLatency;
+
+typedef struct LatencyContext
+{
+	const USBTraceReader *	reader;
+	EndpointLatency *		endpoints;
+	uint32_t				endpointCount;
+} LatencyContext;
+
+typedef struct SampleArray
+{
+	float *		samples;
+	uint64_t	count;
+	uint64_t	capacity;
+} SampleArray;
+
+typedef struct EndpointStats
+{
+	uint32_t	key;
+	uint32_t	inUse;
+	uint32_t	type;
+	uint64_t	transfers;
+	uint64_t	bytes;
+	uint64_t	errors;
+	uint64_t	stalls;
+	uint64_t	retries;
+	uint64_t	incomplete;
+	uint64_t	firstSubmit;
+	uint64_t	lastComplete;
+	SampleArray	queueTimes;				// microseconds
+	SampleArray	wireTimes;
+} EndpointStats;
+
+typedef struct TransferContext
+{
+	const USBTraceReader *	reader;
+	const USBTraceQuery *	query;
+	int						format;
+	uint64_t				printed;
+	EndpointStats *			endpoints;				// kAnalyzerMaxEndpoints entries, endpoints command only
+	uint64_t				transfers;
+	uint64_t				events;
+} TransferContext;
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Prototypes
+//—————————————————————————————————————————————————————————————————————————————
+
+static void PrintUsage ( const char * programName );
+static int DoImport ( int argc, char * const argv[] );
+static int DoInfo ( const USBTraceReader * reader );
+static int DoQuery ( const USBTraceReader * reader, const USBTraceQuery * query );
+static int DoLatency ( const USBTraceReader * reader, const USBTraceQuery * query );
+static bool PrintRecord ( const USBTraceRecord * record, uint32_t chunk, void * context );
+static bool CollectLatency ( const USBTraceRecord * record, uint32_t chunk, void * context );
+static EndpointLatency * LookupEndpoint ( LatencyContext * context, uint32_t key );
+static int DoTransfers ( const USBTraceReader * reader, const USBTraceQuery * query, const char * command, int format );
+static bool FeedBuilder ( const USBTraceRecord * record, uint32_t chunk, void * context );
+static bool TransferMatches ( const TransferContext * context, uint32_t key );
+static void PrintTransfer ( const USBTraceTransfer * transfer, void * context );
+static void PrintEvent ( const USBTraceEvent * event, void * context );
+static void AccumulateTransfer ( const USBTraceTransfer * transfer, void * context );
+static void AccumulateEvent ( const USBTraceEvent * event, void * context );
+static EndpointStats * LookupEndpointStats ( TransferContext * context, uint32_t key );
+static void PrintEndpointStats ( TransferContext * context );
+static bool AppendSample ( SampleArray * array, float sample );
+static int CompareSamples ( const void * a, const void * b );
+
+//———————————————————————————————————————————————————————————————————————————
+//	Main
+//———————————————————————————————————————————————————————————————————————————
+
+int main ( int argc, char * const argv[] )
+{
+	USBTraceReader		reader;
+	USBTraceQuery		query;
+	const char *		command;
+	double				startUsecs = -1;
+	double				endUsecs = -1;
+	int					format = -1;
+	int					c;
+	int					error;
+	struct option		long_options[] =
+	{
+		{ "bus",		required_argument,	0, 'b' },
+		{ "addr",		required_argument,	0, 'a' },
+		{ "ep",			required_argument,	0, 'e' },
+		{ "start",		required_argument,	0, 's' },
+		{ "end",		required_argument,	0, 'E' },
+		{ "group",		required_argument,	0, 'g' },
+		{ "format",		required_argument,	0, 'f' },
+		{ "help",		no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+
+	if ( argc < 2 )
+		PrintUsage( argv[0] );
+
+	command = argv[1];
+
+	if ( strcmp( command, "import" ) == 0 )
+		return DoImport( argc - 1, argv + 1 );
+
+	USBTraceQueryInit( &query );
+
+	optind = 2;
+	while ( ( c = getopt_long( argc, argv, "b:a:e:s:E:g:f:h?", long_options, NULL ) ) != -1 )
+	{
+		switch ( c )
+		{
+			case 'b':
+				query.bus = (uint32_t)strtoul( optarg, NULL, 0 );
+				break;
+
+			case 'a':
+				query.address = (uint32_t)strtoul( optarg, NULL, 0 );
+				break;
+
+			case 'e':
+				query.endpoint = (uint32_t)strtoul( optarg, NULL, 0 );
+				break;
+
+			case 's':
+				startUsecs = strtod( optarg, NULL );
+				break;
+
+			case 'E':
+				endUsecs = strtod( optarg, NULL );
+				break;
+
+			case 'g':
+				query.groupMask |= 1ULL << ( strtoul( optarg, NULL, 0 ) & 63 );
+				break;
+
+			case 'f':
+				if ( strcmp( optarg, "text" ) == 0 )
+					format = kFormatText;
+				else if ( strcmp( optarg, "csv" ) == 0 )
+					format = kFormatCSV;
+				else if ( strcmp( optarg, "json" ) == 0 )
+					format = kFormatJSON;
+				else
+					PrintUsage( argv[0] );
+				break;
+
+			default:
+				PrintUsage( argv[0] );
+				break;
+		}
+	}
+
+	if ( optind >= argc )
+		PrintUsage( argv[0] );
+
+	error = USBTraceReaderOpen( &reader, argv[optind] );
+	if ( error )
+	{
+		elog( "Could not open indexed trace '%s': %s\n", argv[optind], strerror( error ) );
+		return 1;
+	}
+
+	// Times on the command line are microseconds from the start of the trace
+	if ( startUsecs >= 0 )
+		query.startTime = USBTraceMicrosecondsToTimestamp( &reader, startUsecs );
+	if ( endUsecs >= 0 )
+		query.endTime = USBTraceMicrosecondsToTimestamp( &reader, endUsecs );
+
+	if ( strcmp( command, "info" ) == 0 )
+		error = DoInfo( &reader );
+	else if ( strcmp( command, "query" ) == 0 )
+		error = DoQuery( &reader, &query );
+	else if ( strcmp( command, "latency" ) == 0 )
+		error = DoLatency( &reader, &query );
+	else if ( strcmp( command, "transfers" ) == 0 || strcmp( command, "endpoints" ) == 0 || strcmp( command, "timeline" ) == 0 )
+		error = DoTransfers( &reader, &query, command, format );
+	else
+		PrintUsage( argv[0] );
+
+	USBTraceReaderClose( &reader );
+
+	return error ? 1 : 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	PrintUsage
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+PrintUsage ( const char * programName )
+{
+	elog( "\n" );
+	elog( "Usage: %s COMMAND [OPTIONS] file\n", programName );
+	elog( "\n" );
+	elog( "COMMANDS\n" );
+	elog( "\timport raw-file indexed-file\n" );
+	elog( "\t\t Convert a file written with 'usbtracer --write' to the indexed format.\n" );
+	elog( "\tinfo\n" );
+	elog( "\t\t Print the header, chunk and endpoint tables.\n" );
+	elog( "\tquery\n" );
+	elog( "\t\t Print all tracepoints matching the options.\n" );
+	elog( "\tlatency\n" );
+	elog( "\t\t Print a submit to completion latency histogram for each endpoint.\n" );
+	elog( "\ttransfers\n" );
+	elog( "\t\t Export one record per transfer with its queue (submit to queued) and wire (queued to completion) times.\n" );
+	elog( "\tendpoints\n" );
+	elog( "\t\t Print throughput, queue and wire time percentiles, errors, stalls and retries for each endpoint.\n" );
+	elog( "\ttimeline\n" );
+	elog( "\t\t Print the error, stall, retry, clear stall and XHCI ring stop events in time order.\n" );
+	elog( "\n" );
+	elog( "OPTIONS\n" );
+	elog( "\t--bus=n, --addr=n, --ep=n\n" );
+	elog( "\t\t Only consider tracepoints for this bus, device address and endpoint.\n" );
+	elog( "\t--start=us, --end=us\n" );
+	elog( "\t\t Only consider tracepoints in this window, in microseconds from the start of the trace.\n" );
+	elog( "\t--group=n\n" );
+	elog( "\t\t Only consider tracepoints of this USB group. May be repeated.\n" );
+	elog( "\t--format=text|csv|json\n" );
+	elog( "\t\t Output format for transfers (csv by default), endpoints and timeline (text by default).\n" );
+	elog( "\n" );
+
+	exit( 1 );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	DoImport
+//———————————————————————————————————————————————————————————————————————————
+
+static int
+DoImport ( int argc, char * const argv[] )
+{
+	int error;
+
+	if ( argc != 3 )
+	{
+		elog( "import needs a raw file and an output file\n" );
+		return 1;
+	}
+
+	error = USBTraceImportRawFile( argv[1], argv[2] );
+	if ( error )
+		elog( "Could not import '%s': %s\n", argv[1], strerror( error ) );
+
+	return error ? 1 : 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	DoInfo
+//———————————————————————————————————————————————————————————————————————————
+
+static int
+DoInfo ( const USBTraceReader * reader )
+{
+	const USBTraceFileHeader *	header = reader->header;
+	uint32_t					index;
+
+	printf( "records:\t%llu\n", (unsigned long long)header->recordCount );
+	printf( "chunks:\t\t%u x %u records\n", header->chunkCount, header->recordsPerChunk );
+	printf( "cpus:\t\t%u\n", header->cpuCount );
+	printf( "divisor:\t%f\n", header->divisor );
+	printf( "duration:\t%.3f us\n", USBTraceTimestampToMicroseconds( reader, header->lastTimestamp ) );
+
+	printf( "\nendpoints:\n" );
+	for ( index = 0; index < header->deviceCount; index++ )
+	{
+		const USBTraceDeviceEntry * device = &reader->devices[index];
+
+		printf( "\tbus %3u addr %3u ep %3u\t%10llu records\tchunks %u-%u\n",
+				USBTraceKeyBus( device->key ), USBTraceKeyAddress( device->key ), USBTraceKeyEndpoint( device->key ),
+				(unsigned long long)device->recordCount, device->firstChunk, device->lastChunk );
+	}
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	DoQuery
+//———————————————————————————————————————————————————————————————————————————
+
+static bool
+PrintRecord ( const USBTraceRecord * record, uint32_t chunk, void * context )
+{
+	const USBTraceReader *	reader = (const USBTraceReader *)context;
+	uint32_t				debugid = record->debugid;
+	uint32_t				qualifier = USBTraceQualifier( debugid );
+	const char *			qualString = qualifier == kUSBTraceQualifierStart ? "->" : ( qualifier == kUSBTraceQualifierEnd ? "<-" : "  " );
+
+	if ( USBTraceIsUSB( debugid ) )
+	{
+		const char * group = USBTraceReaderString( reader, USBTraceGroup( debugid ) );
+
+		printf( "%14.3f %2u %s %-20s %3u  %16llx  %16llx  %16llx  %16llx  0x%016llx\n",
+				USBTraceTimestampToMicroseconds( reader, record->timestamp ), record->cpuid, qualString,
+				group ? group : USBTraceGroupName( USBTraceGroup( debugid ) ), USBTraceCode( debugid ),
+				(unsigned long long)record->arg1, (unsigned long long)record->arg2, (unsigned long long)record->arg3,
+				(unsigned long long)record->arg4, (unsigned long long)record->thread );
+	}
+	else
+	{
+		printf( "%14.3f %2u %s 0x%08x               %16llx  %16llx  %16llx  %16llx  0x%016llx\n",
+				USBTraceTimestampToMicroseconds( reader, record->timestamp ), record->cpuid, qualString, debugid & ~0x3U,
+				(unsigned long long)record->arg1, (unsigned long long)record->arg2, (unsigned long long)record->arg3,
+				(unsigned long long)record->arg4, (unsigned long long)record->thread );
+	}
+
+	return true;
+}
+
+static int
+DoQuery ( const USBTraceReader * reader, const USBTraceQuery * query )
+{
+	uint64_t matched = USBTraceReaderForEach( reader, query, PrintRecord, (void *)reader );
+
+	elog( "%llu matching records\n", (unsigned long long)matched );
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	DoLatency
+//	- pairs each Bulk/InterruptTransaction start with the next packet handler
+//	  callback on the same endpoint
+//———————————————————————————————————————————————————————————————————————————
+
+static EndpointLatency *
+LookupEndpoint ( LatencyContext * context, uint32_t key )
+{
+	uint32_t	slot = ( key * 0x9E3779B1 ) & ( kAnalyzerMaxEndpoints - 1 );
+	uint32_t	probe;
+
+	for ( probe = 0; probe < kAnalyzerMaxEndpoints; probe++ )
+	{
+		EndpointLatency * endpoint = &context->endpoints[( slot + probe ) & ( kAnalyzerMaxEndpoints - 1 )];
+
+		if ( endpoint->inUse && endpoint->key == key )
+			return endpoint;
+
+		if ( !endpoint->inUse )
+		{
+			endpoint->key = key;
+			endpoint->inUse = 1;
+			endpoint->minimum = 1e300;
+			context->endpointCount++;
+			return endpoint;
+		}
+	}
+
+	return NULL;
+}
+
+static bool
+CollectLatency ( const USBTraceRecord * record, uint32_t chunk, void * ctx )
+{
+	LatencyContext *	context = (LatencyContext *)ctx;
+	EndpointLatency *	endpoint;
+	uint32_t			debugid = record->debugid;
+	uint32_t			code = USBTraceCode( debugid );
+	uint32_t			key;
+
+	if ( !USBTraceRecordDeviceKey( record, &key ) )
+		return true;
+
+	if ( ( code == kUSBTraceBulkTransaction || code == kUSBTraceInterruptTransaction ) && USBTraceQualifier( debugid ) == kUSBTraceQualifierStart )
+	{
+		endpoint = LookupEndpoint( context, key );
+		if ( endpoint == NULL )
+			return true;
+
+		if ( endpoint->pendingCount == kAnalyzerPendingDepth )
+		{
+			// Drop the oldest submit, it will never be matched
+			endpoint->pendingHead = ( endpoint->pendingHead + 1 ) % kAnalyzerPendingDepth;
+			endpoint->pendingCount--;
+			endpoint->unmatched++;
+		}
+
+		endpoint->pending[( endpoint->pendingHead + endpoint->pendingCount ) % kAnalyzerPendingDepth] = record->timestamp;
+		endpoint->pendingCount++;
+	}
+	else if ( code == kUSBTraceBulkPacketHandler || code == kUSBTraceInterruptPacketHandler )
+	{
+		double		usecs;
+		uint32_t	bucket = 0;
+
+		endpoint = LookupEndpoint( context, key );
+		if ( endpoint == NULL )
+			return true;
+
+		if ( endpoint->pendingCount == 0 )
+		{
+			endpoint->unmatched++;
+			return true;
+		}
+
+		usecs = (double)( record->timestamp - endpoint->pending[endpoint->pendingHead] ) / context->reader->header->divisor;
+		endpoint->pendingHead = ( endpoint->pendingHead + 1 ) % kAnalyzerPendingDepth;
+		endpoint->pendingCount--;
+
+		while ( bucket < kAnalyzerHistogramBuckets - 1 && usecs >= (double)( 1ULL << ( bucket + 1 ) ) )
+			bucket++;
+
+		endpoint->histogram[bucket]++;
+		endpoint->completed++;
+		endpoint->total += usecs;
+		if ( usecs < endpoint->minimum )
+			endpoint->minimum = usecs;
+		if ( usecs > endpoint->maximum )
+			endpoint->maximum = usecs;
+	}
+
+	return true;
+}
+
+static int
+DoLatency ( const USBTraceReader * reader, const USBTraceQuery * query )
+{
+	LatencyContext		context;
+	USBTraceQuery		controllerQuery = *query;
+	uint32_t			index;
+
+	context.reader = reader;
+	context.endpointCount = 0;
+	context.endpoints = (EndpointLatency *)calloc( kAnalyzerMaxEndpoints, sizeof(EndpointLatency) );
+	if ( context.endpoints == NULL )
+		return ENOMEM;
+
+	// Only controller tracepoints carry the submit and completion points
+	controllerQuery.groupMask = 1ULL << kUSBTraceGroupController;
+	USBTraceReaderForEach( reader, &controllerQuery, CollectLatency, &context );
+
+	for ( index = 0; index < kAnalyzerMaxEndpoints; index++ )
+	{
+		EndpointLatency *	endpoint = &context.endpoints[index];
+		uint32_t			bucket;
+		uint64_t			largest = 0;
+
+		if ( !endpoint->inUse || endpoint->completed == 0 )
+			continue;
+
+		printf( "bus %u addr %u ep %u %s: %llu transfers, %llu unmatched, min %.1f us, avg %.1f us, max %.1f us\n",
+				USBTraceKeyBus( endpoint->key ), USBTraceKeyAddress( endpoint->key ), USBTraceKeyEndpoint( endpoint->key ),
+				USBTraceKeyDirection( endpoint->key ) == 1 ? "in" : "out",
+				(unsigned long long)endpoint->completed, (unsigned long long)endpoint->unmatched,
+				endpoint->minimum, endpoint->total / endpoint->completed, endpoint->maximum );
+
+		for ( bucket = 0; bucket < kAnalyzerHistogramBuckets; bucket++ )
+		{
+			if ( endpoint->histogram[bucket] > largest )
+				largest = endpoint->histogram[bucket];
+		}
+
+		for ( bucket = 0; bucket < kAnalyzerHistogramBuckets; bucket++ )
+		{
+			int bar;
+
+			if ( endpoint->histogram[bucket] == 0 )
+				continue;
+
+			printf( "\t< %9llu us %10llu ", 1ULL << ( bucket + 1 ), (unsigned long long)endpoint->histogram[bucket] );
+			for ( bar = 0; bar < (int)( 50 * endpoint->histogram[bucket] / largest ); bar++ )
+				printf( "*" );
+			printf( "\n" );
+		}
+	}
+
+	free( context.endpoints );
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	DoTransfers
+//	- runs the controller, pipe and XHCI interrupt tracepoints through a
+//	  USBTraceTransferBuilder and exports the transfers, per endpoint
+//	  statistics or events.  Bus, address and endpoint options are applied to
+//	  the reconstructed transfers because the *Transaction end tracepoints
+//	  that complete a submit carry no endpoint.
+//———————————————————————————————————————————————————————————————————————————
+
+static bool
+FeedBuilder ( const USBTraceRecord * record, uint32_t chunk, void * context )
+{
+	USBTraceTransferBuilderAdd( (USBTraceTransferBuilder *)context, record );
+
+	return true;
+}
+
+static bool
+TransferMatches ( const TransferContext * context, uint32_t key )
+{
+	const USBTraceQuery * query = context->query;
+
+	if ( key == kUSBTraceAnyValue )
+		return query->bus == kUSBTraceAnyValue && query->address == kUSBTraceAnyValue && query->endpoint == kUSBTraceAnyValue;
+
+	if ( query->bus != kUSBTraceAnyValue && USBTraceKeyBus( key ) != query->bus && USBTraceKeyBus( key ) != kUSBTraceUnknownBus )
+		return false;
+	if ( query->address != kUSBTraceAnyValue && USBTraceKeyAddress( key ) != query->address )
+		return false;
+	if ( query->endpoint != kUSBTraceAnyValue && USBTraceKeyEndpoint( key ) != query->endpoint )
+		return false;
+
+	return true;
+}
+
+static int
+DoTransfers ( const USBTraceReader * reader, const USBTraceQuery * query, const char * command, int format )
+{
+	TransferContext				context;
+	USBTraceQuery				builderQuery = *query;
+	USBTraceTransferBuilder *	builder;
+	bool						endpoints = ( strcmp( command, "endpoints" ) == 0 );
+	bool						transfers = ( strcmp( command, "transfers" ) == 0 );
+	uint32_t					index;
+
+	memset( &context, 0, sizeof(context) );
+	context.reader = reader;
+	context.query = query;
+	context.format = ( format >= 0 ) ? format : ( transfers ? kFormatCSV : kFormatText );
+
+	if ( transfers && context.format == kFormatText )
+		context.format = kFormatCSV;
+
+	if ( endpoints )
+	{
+		context.endpoints = (EndpointStats *)calloc( kAnalyzerMaxEndpoints, sizeof(EndpointStats) );
+		if ( context.endpoints == NULL )
+			return ENOMEM;
+
+		builder = USBTraceTransferBuilderCreate( AccumulateTransfer, AccumulateEvent, &context );
+	}
+	else
+	{
+		builder = USBTraceTransferBuilderCreate( transfers ? PrintTransfer : NULL, transfers ? NULL : PrintEvent, &context );
+	}
+
+	if ( builder == NULL )
+	{
+		free( context.endpoints );
+		return ENOMEM;
+	}
+
+	if ( context.format == kFormatJSON && !endpoints )
+		printf( "[\n" );
+	else if ( context.format == kFormatCSV && transfers )
+		printf( "submit_us,bus,address,endpoint,direction,type,requested,actual,status,status_name,queue_us,wire_us,total_us,retry,not_queued,no_completion\n" );
+	else if ( context.format == kFormatCSV && !endpoints )
+		printf( "time_us,bus,address,endpoint,event,value,object\n" );
+
+	builderQuery.groupMask = ( 1ULL << kUSBTraceGroupController ) | ( 1ULL << kUSBTraceGroupPipe ) | ( 1ULL << kUSBTraceGroupXHCIInterrupts );
+	builderQuery.bus = kUSBTraceAnyValue;
+	builderQuery.address = kUSBTraceAnyValue;
+	builderQuery.endpoint = kUSBTraceAnyValue;
+
+	USBTraceReaderForEach( reader, &builderQuery, FeedBuilder, builder );
+	USBTraceTransferBuilderFlush( builder );
+
+	if ( context.format == kFormatJSON && !endpoints )
+		printf( "\n]\n" );
+
+	if ( endpoints )
+	{
+		PrintEndpointStats( &context );
+
+		for ( index = 0; index < kAnalyzerMaxEndpoints; index++ )
+		{
+			free( context.endpoints[index].queueTimes.samples );
+			free( context.endpoints[index].wireTimes.samples );
+		}
+		free( context.endpoints );
+	}
+
+	elog( "%llu transfers, %llu events, %llu completions without a submit\n", (unsigned long long)context.transfers,
+		  (unsigned long long)context.events, (unsigned long long)USBTraceTransferBuilderUnmatched( builder ) );
+
+	USBTraceTransferBuilderDestroy( builder );
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	PrintTransfer
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+PrintTransfer ( const USBTraceTransfer * transfer, void * ctx )
+{
+	TransferContext *	context = (TransferContext *)ctx;
+	double				divisor = context->reader->header->divisor;
+	const char *		statusName = USBTraceStatusName( transfer->status );
+	char				queue[32] = "";
+	char				wire[32] = "";
+	char				total[32] = "";
+
+	if ( !TransferMatches( context, transfer->key ) )
+		return;
+
+	context->transfers++;
+
+	if ( transfer->queuedTime )
+		snprintf( queue, sizeof(queue), "%.3f", (double)( transfer->queuedTime - transfer->submitTime ) / divisor );
+	if ( transfer->queuedTime && transfer->completeTime )
+		snprintf( wire, sizeof(wire), "%.3f", (double)( transfer->completeTime - transfer->queuedTime ) / divisor );
+	if ( transfer->completeTime )
+		snprintf( total, sizeof(total), "%.3f", (double)( transfer->completeTime - transfer->submitTime ) / divisor );
+
+	if ( context->format == kFormatJSON )
+	{
+		printf( "%s\t{ \"submit_us\": %.3f, \"bus\": %u, \"address\": %u, \"endpoint\": %u, \"direction\": \"%s\", \"type\": \"%s\", "
+				"\"requested\": %u, \"actual\": %u, \"status\": \"0x%08x\", \"status_name\": %s%s%s, "
+				"\"queue_us\": %s, \"wire_us\": %s, \"total_us\": %s, \"retry\": %s, \"not_queued\": %s, \"no_completion\": %s }",
+				context->printed++ ? ",\n" : "",
+				USBTraceTimestampToMicroseconds( context->reader, transfer->submitTime ),
+				USBTraceKeyBus( transfer->key ), USBTraceKeyAddress( transfer->key ), USBTraceKeyEndpoint( transfer->key ),
+				USBTraceKeyDirection( transfer->key ) == 1 ? "in" : "out", USBTraceTransferTypeName( transfer->type ),
+				transfer->requested, transfer->actual, transfer->status,
+				statusName ? "\"" : "", statusName ? statusName : "null", statusName ? "\"" : "",
+				queue[0] ? queue : "null", wire[0] ? wire : "null", total[0] ? total : "null",
+				( transfer->flags & kUSBTraceTransferRetry ) ? "true" : "false",
+				( transfer->flags & kUSBTraceTransferNotQueued ) ? "true" : "false",
+				( transfer->flags & kUSBTraceTransferNoCompletion ) ? "true" : "false" );
+	}
+	else
+	{
+		printf( "%.3f,%u,%u,%u,%s,%s,%u,%u,0x%08x,%s,%s,%s,%s,%d,%d,%d\n",
+				USBTraceTimestampToMicroseconds( context->reader, transfer->submitTime ),
+				USBTraceKeyBus( transfer->key ), USBTraceKeyAddress( transfer->key ), USBTraceKeyEndpoint( transfer->key ),
+				USBTraceKeyDirection( transfer->key ) == 1 ? "in" : "out", USBTraceTransferTypeName( transfer->type ),
+				transfer->requested, transfer->actual, transfer->status, statusName ? statusName : "",
+				queue, wire, total,
+				( transfer->flags & kUSBTraceTransferRetry ) ? 1 : 0,
+				( transfer->flags & kUSBTraceTransferNotQueued ) ? 1 : 0,
+				( transfer->flags & kUSBTraceTransferNoCompletion ) ? 1 : 0 );
+	}
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	PrintEvent
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+PrintEvent ( const USBTraceEvent * event, void * ctx )
+{
+	TransferContext *	context = (TransferContext *)ctx;
+	double				usecs = USBTraceTimestampToMicroseconds( context->reader, event->timestamp );
+	const char *		statusName = USBTraceStatusName( (uint32_t)event->value );
+	char				where[48];
+
+	if ( !TransferMatches( context, event->key ) )
+		return;
+
+	context->events++;
+
+	if ( context->format == kFormatJSON )
+	{
+		printf( "%s\t{ \"time_us\": %.3f, ", context->printed++ ? ",\n" : "", usecs );
+		if ( event->key != kUSBTraceAnyValue )
+		{
+			if ( USBTraceKeyBus( event->key ) != kUSBTraceUnknownBus )
+				printf( "\"bus\": %u, ", USBTraceKeyBus( event->key ) );
+			printf( "\"address\": %u, \"endpoint\": %u, ", USBTraceKeyAddress( event->key ), USBTraceKeyEndpoint( event->key ) );
+		}
+		printf( "\"event\": \"%s\", \"value\": \"0x%llx\", \"object\": \"0x%llx\" }", USBTraceEventName( event->kind ),
+				(unsigned long long)event->value, (unsigned long long)event->object );
+		return;
+	}
+
+	if ( context->format == kFormatCSV )
+	{
+		if ( event->key == kUSBTraceAnyValue )
+			printf( "%.3f,,,,%s,0x%llx,0x%llx\n", usecs, USBTraceEventName( event->kind ), (unsigned long long)event->value, (unsigned long long)event->object );
+		else if ( USBTraceKeyBus( event->key ) == kUSBTraceUnknownBus )
+			printf( "%.3f,,%u,%u,%s,0x%llx,0x%llx\n", usecs, USBTraceKeyAddress( event->key ), USBTraceKeyEndpoint( event->key ),
+					USBTraceEventName( event->kind ), (unsigned long long)event->value, (unsigned long long)event->object );
+		else
+			printf( "%.3f,%u,%u,%u,%s,0x%llx,0x%llx\n", usecs, USBTraceKeyBus( event->key ), USBTraceKeyAddress( event->key ), USBTraceKeyEndpoint( event->key ),
+					USBTraceEventName( event->kind ), (unsigned long long)event->value, (unsigned long long)event->object );
+		return;
+	}
+
+	if ( event->key == kUSBTraceAnyValue )
+		snprintf( where, sizeof(where), "xhci ep 0x%llx", (unsigned long long)event->object );
+	else if ( USBTraceKeyBus( event->key ) == kUSBTraceUnknownBus )
+		snprintf( where, sizeof(where), "bus ? addr %u ep %u", USBTraceKeyAddress( event->key ), USBTraceKeyEndpoint( event->key ) );
+	else
+		snprintf( where, sizeof(where), "bus %u addr %u ep %u %s", USBTraceKeyBus( event->key ), USBTraceKeyAddress( event->key ),
+				  USBTraceKeyEndpoint( event->key ), USBTraceKeyDirection( event->key ) == 1 ? "in" : "out" );
+
+	if ( event->kind == kUSBTraceEventRingStopped )
+		printf( "%14.3f  %-12s %-28s condition code %llu\n", usecs, USBTraceEventName( event->kind ), where, (unsigned long long)event->value );
+	else if ( event->kind == kUSBTraceEventError || event->kind == kUSBTraceEventStall || event->kind == kUSBTraceEventSyncError )
+		printf( "%14.3f  %-12s %-28s 0x%08llx %s\n", usecs, USBTraceEventName( event->kind ), where, (unsigned long long)event->value, statusName ? statusName : "" );
+	else
+		printf( "%14.3f  %-12s %s\n", usecs, USBTraceEventName( event->kind ), where );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	Endpoint statistics
+//———————————————————————————————————————————————————————————————————————————
+
+static bool
+AppendSample ( SampleArray * array, float sample )
+{
+	if ( array->count == array->capacity )
+	{
+		uint64_t	capacity = array->capacity ? array->capacity * 2 : 1024;
+		float *		samples = (float *)realloc( array->samples, capacity * sizeof(float) );
+
+		if ( samples == NULL )
+			return false;
+
+		array->samples = samples;
+		array->capacity = capacity;
+	}
+
+	array->samples[array->count++] = sample;
+
+	return true;
+}
+
+static int
+CompareSamples ( const void * a, const void * b )
+{
+	float first = *(const float *)a;
+	float second = *(const float *)b;
+
+	return ( first < second ) ? -1 : ( ( first > second ) ? 1 : 0 );
+}
+
+static EndpointStats *
+LookupEndpointStats ( TransferContext * context, uint32_t key )
+{
+	uint32_t	slot = ( key * 0x9E3779B1 ) & ( kAnalyzerMaxEndpoints - 1 );
+	uint32_t	probe;
+
+	for ( probe = 0; probe < kAnalyzerMaxEndpoints; probe++ )
+	{
+		EndpointStats * endpoint = &context->endpoints[( slot + probe ) & ( kAnalyzerMaxEndpoints - 1 )];
+
+		if ( endpoint->inUse && endpoint->key == key )
+			return endpoint;
+
+		if ( !endpoint->inUse )
+		{
+			endpoint->key = key;
+			endpoint->inUse = 1;
+			return endpoint;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+AccumulateTransfer ( const USBTraceTransfer * transfer, void * ctx )
+{
+	TransferContext *	context = (TransferContext *)ctx;
+	double				divisor = context->reader->header->divisor;
+	EndpointStats *		endpoint;
+
+	if ( !TransferMatches( context, transfer->key ) )
+		return;
+
+	endpoint = LookupEndpointStats( context, transfer->key );
+	if ( endpoint == NULL )
+		return;
+
+	context->transfers++;
+
+	if ( endpoint->transfers++ == 0 || transfer->submitTime < endpoint->firstSubmit )
+		endpoint->firstSubmit = transfer->submitTime;
+
+	endpoint->type = transfer->type;
+
+	if ( transfer->flags & kUSBTraceTransferNoCompletion )
+	{
+		endpoint->incomplete++;
+		return;
+	}
+
+	if ( transfer->status != 0 )
+		endpoint->errors++;
+	if ( transfer->flags & kUSBTraceTransferRetry )
+		endpoint->retries++;
+
+	if ( transfer->completeTime > endpoint->lastComplete )
+		endpoint->lastComplete = transfer->completeTime;
+
+	endpoint->bytes += transfer->actual;
+
+	if ( transfer->queuedTime )
+	{
+		AppendSample( &endpoint->queueTimes, (float)( (double)( transfer->queuedTime - transfer->submitTime ) / divisor ) );
+		if ( transfer->completeTime )
+			AppendSample( &endpoint->wireTimes, (float)( (double)( transfer->completeTime - transfer->queuedTime ) / divisor ) );
+	}
+}
+
+static void
+AccumulateEvent ( const USBTraceEvent * event, void * ctx )
+{
+	TransferContext *	context = (TransferContext *)ctx;
+	EndpointStats *		endpoint;
+
+	if ( event->kind != kUSBTraceEventStall || !TransferMatches( context, event->key ) )
+		return;
+
+	context->events++;
+
+	endpoint = LookupEndpointStats( context, event->key );
+	if ( endpoint )
+		endpoint->stalls++;
+}
+
+static void
+PrintEndpointStats ( TransferContext * context )
+{
+	static const double	kPercentiles[kAnalyzerPercentileCount] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+	static const char *	kPercentileNames[kAnalyzerPercentileCount] = { "p50", "p90", "p99", "p99.9", "max" };
+	uint32_t			index;
+	uint64_t			printed = 0;
+
+	if ( context->format == kFormatJSON )
+		printf( "[\n" );
+	else if ( context->format == kFormatCSV )
+		printf( "bus,address,endpoint,direction,type,transfers,bytes,mb_per_s,errors,stalls,retries,incomplete,"
+				"queue_p50_us,queue_p90_us,queue_p99_us,queue_p999_us,queue_max_us,wire_p50_us,wire_p90_us,wire_p99_us,wire_p999_us,wire_max_us\n" );
+
+	for ( index = 0; index < kAnalyzerMaxEndpoints; index++ )
+	{
+		EndpointStats *	endpoint = &context->endpoints[index];
+		SampleArray *	arrays[2] = { &endpoint->queueTimes, &endpoint->wireTimes };
+		double			values[2][kAnalyzerPercentileCount];
+		double			elapsed;
+		double			throughput = 0;
+		int				which;
+		int				p;
+
+		if ( !endpoint->inUse || endpoint->transfers == 0 )
+			continue;
+
+		// bytes per microsecond is MB/s
+		elapsed = ( endpoint->lastComplete > endpoint->firstSubmit ) ? (double)( endpoint->lastComplete - endpoint->firstSubmit ) / context->reader->header->divisor : 0;
+		if ( elapsed > 0 )
+			throughput = (double)endpoint->bytes / elapsed;
+
+		for ( which = 0; which < 2; which++ )
+		{
+			SampleArray * array = arrays[which];
+
+			if ( array->count )
+				qsort( array->samples, array->count, sizeof(float), CompareSamples );
+
+			for ( p = 0; p < kAnalyzerPercentileCount; p++ )
+			{
+				uint64_t rank = (uint64_t)( kPercentiles[p] / 100.0 * array->count + 0.5 );
+
+				if ( rank > 0 )
+					rank--;
+				if ( rank >= array->count )
+					rank = array->count ? array->count - 1 : 0;
+
+				values[which][p] = array->count ? array->samples[rank] : -1;
+			}
+		}
+
+		if ( context->format == kFormatJSON )
+		{
+			printf( "%s\t{ \"bus\": %u, \"address\": %u, \"endpoint\": %u, \"direction\": \"%s\", \"type\": \"%s\", \"transfers\": %llu, \"bytes\": %llu, "
+					"\"mb_per_s\": %.3f, \"errors\": %llu, \"stalls\": %llu, \"retries\": %llu, \"incomplete\": %llu",
+					printed ? ",\n" : "", USBTraceKeyBus( endpoint->key ), USBTraceKeyAddress( endpoint->key ), USBTraceKeyEndpoint( endpoint->key ),
+					USBTraceKeyDirection( endpoint->key ) == 1 ? "in" : "out", USBTraceTransferTypeName( endpoint->type ),
+					(unsigned long long)endpoint->transfers, (unsigned long long)endpoint->bytes, throughput,
+					(unsigned long long)endpoint->errors, (unsigned long long)endpoint->stalls, (unsigned long long)endpoint->retries,
+					(unsigned long long)endpoint->incomplete );
+
+			for ( which = 0; which < 2; which++ )
+			{
+				printf( ", \"%s_us\": {", which ? "wire" : "queue" );
+				for ( p = 0; p < kAnalyzerPercentileCount; p++ )
+					printf( "%s \"%s\": %.3f", p ? "," : "", kPercentileNames[p], values[which][p] );
+				printf( " }" );
+			}
+			printf( " }" );
+		}
+		else if ( context->format == kFormatCSV )
+		{
+			printf( "%u,%u,%u,%s,%s,%llu,%llu,%.3f,%llu,%llu,%llu,%llu",
+					USBTraceKeyBus( endpoint->key ), USBTraceKeyAddress( endpoint->key ), USBTraceKeyEndpoint( endpoint->key ),
+					USBTraceKeyDirection( endpoint->key ) == 1 ? "in" : "out", USBTraceTransferTypeName( endpoint->type ),
+					(unsigned long long)endpoint->transfers, (unsigned long long)endpoint->bytes, throughput,
+					(unsigned long long)endpoint->errors, (unsigned long long)endpoint->stalls, (unsigned long long)endpoint->retries,
+					(unsigned long long)endpoint->incomplete );
+
+			for ( which = 0; which < 2; which++ )
+				for ( p = 0; p < kAnalyzerPercentileCount; p++ )
+					printf( ",%.3f", values[which][p] );
+			printf( "\n" );
+		}
+		else
+		{
+			printf( "bus %u addr %u ep %u %s %s: %llu transfers, %llu bytes, %.3f MB/s, %llu errors, %llu stalls, %llu retries, %llu incomplete\n",
+					USBTraceKeyBus( endpoint->key ), USBTraceKeyAddress( endpoint->key ), USBTraceKeyEndpoint( endpoint->key ),
+					USBTraceKeyDirection( endpoint->key ) == 1 ? "in" : "out", USBTraceTransferTypeName( endpoint->type ),
+					(unsigned long long)endpoint->transfers, (unsigned long long)endpoint->bytes, throughput,
+					(unsigned long long)endpoint->errors, (unsigned long long)endpoint->stalls, (unsigned long long)endpoint->retries,
+					(unsigned long long)endpoint->incomplete );
+
+			for ( which = 0; which < 2; which++ )
+			{
+				printf( "\t%s us:", which ? "wire " : "queue" );
+				for ( p = 0; p < kAnalyzerPercentileCount; p++ )
+				{
+					if ( values[which][p] < 0 )
+						printf( "  %s -", kPercentileNames[p] );
+					else
+						printf( "  %s %.1f", kPercentileNames[p], values[which][p] );
+				}
+				printf( "\n" );
+			}
+		}
+
+		printed++;
+	}
+
+	if ( context->format == kFormatJSON )
+		printf( "\n]\n" );
+}
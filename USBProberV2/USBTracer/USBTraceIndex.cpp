@@ -0,0 +1,787 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Includes
+//—————————————————————————————————————————————————————————————————————————————
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "USBTraceIndex.h"
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Types
+//—————————————————————————————————————————————————————————————————————————————
+
+struct USBTraceWriter
+{
+	FILE *					file;
+	USBTraceFileHeader		header;
+	USBTraceRecord *		chunkRecords;
+	uint32_t				chunkRecordCount;
+	USBTraceChunkEntry *	chunks;
+	uint32_t				chunkCapacity;
+	USBTraceDeviceEntry *	devices;
+	uint32_t				deviceCount;
+	uint8_t *				strings;
+	uint32_t				stringSize;
+	uint32_t				stringCapacity;
+	uint32_t				stringCount;
+	uint32_t				maxCPU;
+};
+
+// Legacy raw files are arrays of LP64 kd_buf records (see USBTracer.h)
+typedef struct USBTraceRawRecord64
+{
+	uint64_t	timestamp;
+	uint64_t	arg1;
+	uint64_t	arg2;
+	uint64_t	arg3;
+	uint64_t	arg4;
+	uint64_t	arg5;
+	uint32_t	debugid;
+	uint32_t	cpuid;
+	uint64_t	unused;
+} USBTraceRawRecord64;
+
+#define kUSBTraceRawInvalid			0xdeadbeef
+#define kUSBTraceRawDivisorEntry	0xfeedface
+
+static const char * gUSBTraceGroupNames[64] =
+{
+	"Controller", "ControllerUserClient", "Device", "DeviceUserClient", "Hub", "HubPort", "HSHubUserClient", "HID",
+	"Pipe", "InterfaceUserClient", "Enumeration", "UHCI", "UHCIUIM", "UHCIInterrupts", "OHCI", "OHCIInterrupts",
+	"OHCIDumpQs", NULL, NULL, NULL, "EHCI", NULL, "EHCIHubInfo", "EHCIInterrupts",
+	"EHCIDumpQs", NULL, NULL, NULL, "XHCI", "XHCIInterrupts", "XHCIRootHubs", "XHCIPrintTRB",
+	NULL, NULL, NULL, "HubPolicyMaker", "CompositeDriver", NULL, NULL, NULL,
+	NULL, NULL, "OutstandingIO", NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, "AudioDriver", NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Helpers
+//—————————————————————————————————————————————————————————————————————————————
+
+static inline uint32_t
+DeviceBloomHash ( uint32_t key, int which )
+{
+	// Direction is not part of the bloom key so that queries can ignore it
+	uint32_t h = ( key & 0x00FFFFFF ) * ( which ? 0x9E3779B1 : 0x85EBCA77 );
+	h ^= h >> 15;
+	return h & ( kUSBTraceDeviceBloomWords * 64 - 1 );
+}
+
+static inline void
+DeviceBloomAdd ( uint64_t * bloom, uint32_t key )
+{
+	uint32_t bit;
+
+	bit = DeviceBloomHash( key, 0 );
+	bloom[bit >> 6] |= 1ULL << ( bit & 63 );
+	bit = DeviceBloomHash( key, 1 );
+	bloom[bit >> 6] |= 1ULL << ( bit & 63 );
+}
+
+static inline bool
+DeviceBloomTest ( const uint64_t * bloom, uint32_t key )
+{
+	uint32_t bit0 = DeviceBloomHash( key, 0 );
+	uint32_t bit1 = DeviceBloomHash( key, 1 );
+
+	return ( bloom[bit0 >> 6] & ( 1ULL << ( bit0 & 63 ) ) ) && ( bloom[bit1 >> 6] & ( 1ULL << ( bit1 & 63 ) ) );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceRecordDeviceKey
+//	- returns true and the packed (direction, bus, address, endpoint) key if the
+//	  tracepoint identifies a single endpoint
+//———————————————————————————————————————————————————————————————————————————
+
+bool
+USBTraceRecordDeviceKey ( const USBTraceRecord * record, uint32_t * key )
+{
+	uint32_t	debugid = record->debugid;
+
+	if ( !USBTraceIsUSB( debugid ) || USBTraceGroup( debugid ) != kUSBTraceGroupController )
+		return false;
+
+	switch ( USBTraceCode( debugid ) )
+	{
+		case kUSBTraceControlTransaction:
+		case kUSBTraceInterruptTransaction:
+		case kUSBTraceBulkTransaction:
+			// The start tracepoint carries the key in arg2, the medial one in arg1, the end none
+			if ( USBTraceQualifier( debugid ) == kUSBTraceQualifierStart )
+				*key = (uint32_t)record->arg2;
+			else if ( USBTraceQualifier( debugid ) == kUSBTraceQualifierNone )
+				*key = (uint32_t)record->arg1;
+			else
+				return false;
+			return true;
+
+		case kUSBTraceControllerControlPacketHandler:
+			// The medial ones report split errors and carry no key
+			if ( USBTraceQualifier( debugid ) == kUSBTraceQualifierNone )
+				return false;
+			*key = (uint32_t)record->arg2;
+			return true;
+
+		case kUSBTraceDoIOTransferIntrSync:
+		case kUSBTraceDoIOTransferBulkSync:
+		case kUSBTraceInterruptPacketHandler:
+		case kUSBTraceBulkPacketHandler:
+			*key = (uint32_t)record->arg2;
+			return true;
+
+		case kUSBTraceInterruptTransactionData:
+		case kUSBTraceBulkTransactionData:
+		case kUSBTraceControlPacketHandlerData:
+		case kUSBTraceBulkPacketHandlerData:
+		case kUSBTraceInterruptPacketHandlerData:
+			*key = (uint32_t)record->arg1;
+			return true;
+
+		default:
+			break;
+	}
+
+	return false;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceGroupName
+//———————————————————————————————————————————————————————————————————————————
+
+const char *
+USBTraceGroupName ( uint32_t group )
+{
+	if ( group < 64 && gUSBTraceGroupNames[group] )
+		return gUSBTraceGroupNames[group];
+
+	return "Unknown";
+}
+
+#pragma mark Writer
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceWriterCreate
+//———————————————————————————————————————————————————————————————————————————
+
+USBTraceWriter *
+USBTraceWriterCreate ( const char * path, double divisor )
+{
+	USBTraceWriter *	writer;
+	uint32_t			group;
+
+	writer = (USBTraceWriter *)calloc( 1, sizeof(USBTraceWriter) );
+	if ( writer == NULL )
+		return NULL;
+
+	writer->chunkRecords = (USBTraceRecord *)malloc( kUSBTraceRecordsPerChunk * sizeof(USBTraceRecord) );
+	writer->devices = (USBTraceDeviceEntry *)calloc( kUSBTraceMaxDevices, sizeof(USBTraceDeviceEntry) );
+	writer->file = fopen( path, "wb+" );
+
+	if ( writer->chunkRecords == NULL || writer->devices == NULL || writer->file == NULL )
+	{
+		if ( writer->file )
+			fclose( writer->file );
+		free( writer->chunkRecords );
+		free( writer->devices );
+		free( writer );
+		return NULL;
+	}
+
+	writer->header.magic = kUSBTraceFileMagic;
+	writer->header.version = kUSBTraceFileVersion;
+	writer->header.headerSize = sizeof(USBTraceFileHeader);
+	writer->header.divisor = divisor;
+	writer->header.recordsPerChunk = kUSBTraceRecordsPerChunk;
+	writer->header.firstTimestamp = UINT64_MAX;
+
+	// The header is rewritten by USBTraceWriterClose() once the offsets are known
+	if ( fwrite( &writer->header, sizeof(USBTraceFileHeader), 1, writer->file ) != 1 )
+	{
+		fclose( writer->file );
+		free( writer->chunkRecords );
+		free( writer->devices );
+		free( writer );
+		return NULL;
+	}
+
+	for ( group = 0; group < 64; group++ )
+	{
+		if ( gUSBTraceGroupNames[group] )
+			USBTraceWriterAddString( writer, group, gUSBTraceGroupNames[group] );
+	}
+
+	return writer;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceWriterSetDivisor
+//———————————————————————————————————————————————————————————————————————————
+
+void
+USBTraceWriterSetDivisor ( USBTraceWriter * writer, double divisor )
+{
+	writer->header.divisor = divisor;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceWriterFlushChunk
+//———————————————————————————————————————————————————————————————————————————
+
+static int
+USBTraceWriterFlushChunk ( USBTraceWriter * writer )
+{
+	USBTraceChunkEntry *	chunk;
+	uint32_t				index;
+	off_t					offset;
+
+	if ( writer->chunkRecordCount == 0 )
+		return 0;
+
+	if ( writer->header.chunkCount == writer->chunkCapacity )
+	{
+		uint32_t				capacity = writer->chunkCapacity ? writer->chunkCapacity * 2 : 64;
+		USBTraceChunkEntry *	chunks = (USBTraceChunkEntry *)realloc( writer->chunks, capacity * sizeof(USBTraceChunkEntry) );
+
+		if ( chunks == NULL )
+			return ENOMEM;
+
+		writer->chunks = chunks;
+		writer->chunkCapacity = capacity;
+	}
+
+	offset = ftello( writer->file );
+	if ( offset < 0 )
+		return errno;
+
+	chunk = &writer->chunks[writer->header.chunkCount];
+	bzero( chunk, sizeof(USBTraceChunkEntry) );
+	chunk->firstTimestamp = UINT64_MAX;
+	chunk->recordOffset = (uint64_t)offset;
+	chunk->recordCount = writer->chunkRecordCount;
+
+	for ( index = 0; index < writer->chunkRecordCount; index++ )
+	{
+		const USBTraceRecord *	record = &writer->chunkRecords[index];
+		uint32_t				key;
+		uint32_t				device;
+
+		if ( record->timestamp < chunk->firstTimestamp )
+			chunk->firstTimestamp = record->timestamp;
+		if ( record->timestamp > chunk->lastTimestamp )
+			chunk->lastTimestamp = record->timestamp;
+
+		chunk->cpuMask |= 1U << ( record->cpuid & 31 );
+
+		if ( USBTraceIsUSB( record->debugid ) )
+			chunk->groupMask |= 1ULL << USBTraceGroup( record->debugid );
+
+		if ( !USBTraceRecordDeviceKey( record, &key ) )
+			continue;
+
+		DeviceBloomAdd( chunk->deviceBloom, key );
+
+		// Device table is small, a linear search is fine
+		key &= 0x00FFFFFF;
+		for ( device = 0; device < writer->deviceCount; device++ )
+		{
+			if ( writer->devices[device].key == key )
+				break;
+		}
+
+		if ( device == writer->deviceCount )
+		{
+			if ( writer->deviceCount == kUSBTraceMaxDevices )
+				continue;
+
+			writer->devices[device].key = key;
+			writer->devices[device].firstChunk = writer->header.chunkCount;
+			writer->deviceCount++;
+		}
+
+		writer->devices[device].lastChunk = writer->header.chunkCount;
+		writer->devices[device].recordCount++;
+	}
+
+	if ( fwrite( writer->chunkRecords, sizeof(USBTraceRecord), writer->chunkRecordCount, writer->file ) != writer->chunkRecordCount )
+		return errno ? errno : EIO;
+
+	if ( chunk->firstTimestamp < writer->header.firstTimestamp )
+		writer->header.firstTimestamp = chunk->firstTimestamp;
+	if ( chunk->lastTimestamp > writer->header.lastTimestamp )
+		writer->header.lastTimestamp = chunk->lastTimestamp;
+
+	writer->header.chunkCount++;
+	writer->chunkRecordCount = 0;
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceWriterAppend
+//———————————————————————————————————————————————————————————————————————————
+
+int
+USBTraceWriterAppend ( USBTraceWriter * writer, const USBTraceRecord * record )
+{
+	writer->chunkRecords[writer->chunkRecordCount++] = *record;
+	writer->header.recordCount++;
+
+	if ( record->cpuid > writer->maxCPU )
+		writer->maxCPU = record->cpuid;
+
+	if ( writer->chunkRecordCount == kUSBTraceRecordsPerChunk )
+		return USBTraceWriterFlushChunk( writer );
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceWriterAddString
+//———————————————————————————————————————————————————————————————————————————
+
+int
+USBTraceWriterAddString ( USBTraceWriter * writer, uint32_t id, const char * string )
+{
+	USBTraceStringEntry		entry;
+	uint32_t				needed;
+
+	entry.id = id;
+	entry.length = (uint32_t)strlen( string );
+	needed = ( sizeof(USBTraceStringEntry) + entry.length + 1 + 3 ) & ~3U;
+
+	if ( writer->stringSize + needed > writer->stringCapacity )
+	{
+		uint32_t	capacity = ( writer->stringCapacity + needed ) * 2;
+		uint8_t *	strings = (uint8_t *)realloc( writer->strings, capacity );
+
+		if ( strings == NULL )
+			return ENOMEM;
+
+		writer->strings = strings;
+		writer->stringCapacity = capacity;
+	}
+
+	bzero( writer->strings + writer->stringSize, needed );
+	memcpy( writer->strings + writer->stringSize, &entry, sizeof(entry) );
+	memcpy( writer->strings + writer->stringSize + sizeof(entry), string, entry.length );
+	writer->stringSize += needed;
+	writer->stringCount++;
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceWriterClose
+//———————————————————————————————————————————————————————————————————————————
+
+int
+USBTraceWriterClose ( USBTraceWriter * writer )
+{
+	int		error;
+	off_t	offset;
+
+	error = USBTraceWriterFlushChunk( writer );
+
+	// A short write anywhere fails the whole file, the header is only written once everything else made it
+	if ( error == 0 )
+	{
+		offset = ftello( writer->file );
+		writer->header.chunkIndexOffset = (uint64_t)offset;
+		if ( offset < 0 || fwrite( writer->chunks, sizeof(USBTraceChunkEntry), writer->header.chunkCount, writer->file ) != writer->header.chunkCount )
+			error = errno ? errno : EIO;
+	}
+
+	if ( error == 0 )
+	{
+		offset = ftello( writer->file );
+		writer->header.deviceIndexOffset = (uint64_t)offset;
+		writer->header.deviceCount = writer->deviceCount;
+		if ( offset < 0 || fwrite( writer->devices, sizeof(USBTraceDeviceEntry), writer->deviceCount, writer->file ) != writer->deviceCount )
+			error = errno ? errno : EIO;
+	}
+
+	if ( error == 0 )
+	{
+		offset = ftello( writer->file );
+		writer->header.stringTableOffset = (uint64_t)offset;
+		writer->header.stringCount = writer->stringCount;
+		writer->header.stringTableSize = writer->stringSize;
+		if ( offset < 0 || fwrite( writer->strings, 1, writer->stringSize, writer->file ) != writer->stringSize )
+			error = errno ? errno : EIO;
+	}
+
+	if ( error == 0 )
+	{
+		writer->header.cpuCount = writer->maxCPU + 1;
+		if ( writer->header.recordCount == 0 )
+			writer->header.firstTimestamp = 0;
+
+		if ( fseeko( writer->file, 0, SEEK_SET ) != 0 || fwrite( &writer->header, sizeof(USBTraceFileHeader), 1, writer->file ) != 1 )
+			error = errno ? errno : EIO;
+	}
+
+	if ( fclose( writer->file ) != 0 && error == 0 )
+		error = errno;
+
+	free( writer->chunkRecords );
+	free( writer->chunks );
+	free( writer->devices );
+	free( writer->strings );
+	free( writer );
+
+	return error;
+}
+
+#pragma mark Reader
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceReaderOpen
+//———————————————————————————————————————————————————————————————————————————
+
+int
+USBTraceReaderOpen ( USBTraceReader * reader, const char * path )
+{
+	struct stat					info;
+	const USBTraceFileHeader *	header;
+	void *						base;
+	uint32_t					chunk;
+
+	bzero( reader, sizeof(USBTraceReader) );
+	reader->fd = -1;
+
+	reader->fd = open( path, O_RDONLY );
+	if ( reader->fd < 0 )
+		return errno;
+
+	if ( fstat( reader->fd, &info ) != 0 || (size_t)info.st_size < sizeof(USBTraceFileHeader) )
+	{
+		USBTraceReaderClose( reader );
+		return EINVAL;
+	}
+
+	base = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, reader->fd, 0 );
+	if ( base == MAP_FAILED )
+	{
+		int error = errno;
+		USBTraceReaderClose( reader );
+		return error;
+	}
+
+	reader->base = (const uint8_t *)base;
+	reader->length = (size_t)info.st_size;
+	header = (const USBTraceFileHeader *)reader->base;
+
+	// Written on a machine of the other byte order
+	if ( header->magic == kUSBTraceFileSwappedMagic )
+	{
+		USBTraceReaderClose( reader );
+		return ENOTSUP;
+	}
+
+	if ( header->magic != kUSBTraceFileMagic || header->version != kUSBTraceFileVersion || header->headerSize != sizeof(USBTraceFileHeader) ||
+		 header->chunkIndexOffset + (uint64_t)header->chunkCount * sizeof(USBTraceChunkEntry) > reader->length ||
+		 header->deviceIndexOffset + (uint64_t)header->deviceCount * sizeof(USBTraceDeviceEntry) > reader->length ||
+		 header->stringTableOffset + header->stringTableSize > reader->length )
+	{
+		USBTraceReaderClose( reader );
+		return EINVAL;
+	}
+
+	reader->header = header;
+	reader->chunks = (const USBTraceChunkEntry *)( reader->base + header->chunkIndexOffset );
+	reader->devices = (const USBTraceDeviceEntry *)( reader->base + header->deviceIndexOffset );
+	reader->strings = reader->base + header->stringTableOffset;
+
+	for ( chunk = 0; chunk < header->chunkCount; chunk++ )
+	{
+		if ( reader->chunks[chunk].recordOffset + (uint64_t)reader->chunks[chunk].recordCount * sizeof(USBTraceRecord) > reader->length )
+		{
+			USBTraceReaderClose( reader );
+			return EINVAL;
+		}
+	}
+
+	// Chunks are scanned front to back
+	madvise( base, reader->length, MADV_SEQUENTIAL );
+
+	return 0;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceReaderClose
+//———————————————————————————————————————————————————————————————————————————
+
+void
+USBTraceReaderClose ( USBTraceReader * reader )
+{
+	if ( reader->base )
+		munmap( (void *)reader->base, reader->length );
+
+	if ( reader->fd >= 0 )
+		close( reader->fd );
+
+	bzero( reader, sizeof(USBTraceReader) );
+	reader->fd = -1;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceReaderChunkRecords
+//———————————————————————————————————————————————————————————————————————————
+
+const USBTraceRecord *
+USBTraceReaderChunkRecords ( const USBTraceReader * reader, uint32_t chunk )
+{
+	return (const USBTraceRecord *)( reader->base + reader->chunks[chunk].recordOffset );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceReaderString
+//———————————————————————————————————————————————————————————————————————————
+
+const char *
+USBTraceReaderString ( const USBTraceReader * reader, uint32_t id )
+{
+	uint32_t	offset = 0;
+
+	while ( offset + sizeof(USBTraceStringEntry) <= reader->header->stringTableSize )
+	{
+		const USBTraceStringEntry *	entry = (const USBTraceStringEntry *)( reader->strings + offset );
+		uint32_t					size = ( sizeof(USBTraceStringEntry) + entry->length + 1 + 3 ) & ~3U;
+
+		if ( offset + size > reader->header->stringTableSize )
+			break;
+
+		if ( entry->id == id )
+			return (const char *)( entry + 1 );
+
+		offset += size;
+	}
+
+	return NULL;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceQueryInit
+//———————————————————————————————————————————————————————————————————————————
+
+void
+USBTraceQueryInit ( USBTraceQuery * query )
+{
+	query->startTime = 0;
+	query->endTime = UINT64_MAX;
+	query->groupMask = 0;
+	query->bus = kUSBTraceAnyValue;
+	query->address = kUSBTraceAnyValue;
+	query->endpoint = kUSBTraceAnyValue;
+}
+
+static inline bool
+QueryWantsDevice ( const USBTraceQuery * query )
+{
+	return query->bus != kUSBTraceAnyValue || query->address != kUSBTraceAnyValue || query->endpoint != kUSBTraceAnyValue;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceChunkMayMatch
+//———————————————————————————————————————————————————————————————————————————
+
+bool
+USBTraceChunkMayMatch ( const USBTraceChunkEntry * chunk, const USBTraceQuery * query )
+{
+	if ( chunk->lastTimestamp < query->startTime || chunk->firstTimestamp > query->endTime )
+		return false;
+
+	if ( query->groupMask && ( chunk->groupMask & query->groupMask ) == 0 )
+		return false;
+
+	// The bloom filter can only be used when the whole key is known
+	if ( query->bus != kUSBTraceAnyValue && query->address != kUSBTraceAnyValue && query->endpoint != kUSBTraceAnyValue )
+	{
+		if ( !DeviceBloomTest( chunk->deviceBloom, USBTraceDeviceKey( query->bus, query->address, query->endpoint ) ) )
+			return false;
+	}
+
+	return true;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceRecordMatches
+//———————————————————————————————————————————————————————————————————————————
+
+bool
+USBTraceRecordMatches ( const USBTraceRecord * record, const USBTraceQuery * query )
+{
+	uint32_t	key;
+
+	if ( record->timestamp < query->startTime || record->timestamp > query->endTime )
+		return false;
+
+	if ( query->groupMask )
+	{
+		if ( !USBTraceIsUSB( record->debugid ) || ( query->groupMask & ( 1ULL << USBTraceGroup( record->debugid ) ) ) == 0 )
+			return false;
+	}
+
+	if ( QueryWantsDevice( query ) )
+	{
+		if ( !USBTraceRecordDeviceKey( record, &key ) )
+			return false;
+
+		if ( query->bus != kUSBTraceAnyValue && USBTraceKeyBus( key ) != query->bus )
+			return false;
+		if ( query->address != kUSBTraceAnyValue && USBTraceKeyAddress( key ) != query->address )
+			return false;
+		if ( query->endpoint != kUSBTraceAnyValue && USBTraceKeyEndpoint( key ) != query->endpoint )
+			return false;
+	}
+
+	return true;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceReaderForEach
+//	- walks the records matching query, skipping every chunk whose index
+//	  entry rules it out, and returns the number of records visited
+//———————————————————————————————————————————————————————————————————————————
+
+uint64_t
+USBTraceReaderForEach ( const USBTraceReader * reader, const USBTraceQuery * query, USBTraceRecordCallback callback, void * context )
+{
+	uint64_t	matched = 0;
+	uint32_t	chunk;
+
+	for ( chunk = 0; chunk < reader->header->chunkCount; chunk++ )
+	{
+		const USBTraceRecord *	records;
+		uint32_t				index;
+
+		if ( !USBTraceChunkMayMatch( &reader->chunks[chunk], query ) )
+			continue;
+
+		records = USBTraceReaderChunkRecords( reader, chunk );
+
+		for ( index = 0; index < reader->chunks[chunk].recordCount; index++ )
+		{
+			if ( !USBTraceRecordMatches( &records[index], query ) )
+				continue;
+
+			matched++;
+			if ( !callback( &records[index], chunk, context ) )
+				return matched;
+		}
+	}
+
+	return matched;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	Time conversion
+//———————————————————————————————————————————————————————————————————————————
+
+uint64_t
+USBTraceMicrosecondsToTimestamp ( const USBTraceReader * reader, double usecs )
+{
+	return reader->header->firstTimestamp + (uint64_t)( usecs * reader->header->divisor );
+}
+
+double
+USBTraceTimestampToMicroseconds ( const USBTraceReader * reader, uint64_t timestamp )
+{
+	return (double)( timestamp - reader->header->firstTimestamp ) / reader->header->divisor;
+}
+
+#pragma mark Import
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceImportRawFile
+//	- converts a file written by 'usbtracer -w' on a 64 bit machine
+//———————————————————————————————————————————————————————————————————————————
+
+int
+USBTraceImportRawFile ( const char * rawPath, const char * indexedPath )
+{
+	FILE *					file;
+	USBTraceWriter *		writer;
+	USBTraceRawRecord64		raw;
+	USBTraceRecord			record;
+	double					divisor = 1000.0;
+	off_t					start = 0;
+	int						error = 0;
+
+	file = fopen( rawPath, "rb" );
+	if ( file == NULL )
+		return errno;
+
+	// The divisor entry is prepended by the writer, pick it up before creating the index
+	if ( fread( &raw, sizeof(raw), 1, file ) == 1 && raw.debugid == kUSBTraceRawDivisorEntry )
+	{
+		divisor = (double)raw.timestamp;
+		start = sizeof(raw);
+	}
+	fseeko( file, start, SEEK_SET );
+
+	writer = USBTraceWriterCreate( indexedPath, divisor );
+	if ( writer == NULL )
+	{
+		fclose( file );
+		return errno ? errno : ENOMEM;
+	}
+
+	while ( error == 0 && fread( &raw, sizeof(raw), 1, file ) == 1 )
+	{
+		if ( raw.debugid == kUSBTraceRawInvalid || raw.debugid == kUSBTraceRawDivisorEntry )
+			continue;
+
+		record.timestamp = raw.timestamp;
+		record.arg1 = raw.arg1;
+		record.arg2 = raw.arg2;
+		record.arg3 = raw.arg3;
+		record.arg4 = raw.arg4;
+		record.thread = raw.arg5;
+		record.debugid = raw.debugid;
+		record.cpuid = raw.cpuid;
+
+		error = USBTraceWriterAppend( writer, &record );
+	}
+
+	fclose( file );
+
+	if ( error == 0 )
+		return USBTraceWriterClose( writer );
+
+	USBTraceWriterClose( writer );
+	return error;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __USBTRACEINDEX_H__
+#define __USBTRACEINDEX_H__
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Indexed trace file format
+//
+//	The raw format written by 'usbtracer -w' is a flat array of kd_buf records
+//	whose layout depends on the architecture of the machine that wrote it.  The
+//	indexed format only uses fixed size fields, so it is the same for 32 and 64
+//	bit writers, and is laid out as:
+//
+//		USBTraceFileHeader
+//		USBTraceRecord[]			grouped into chunks of recordsPerChunk records
+//		USBTraceChunkEntry[]		one per chunk, at chunkIndexOffset
+//		USBTraceDeviceEntry[]		one per bus/address/endpoint seen, at deviceIndexOffset
+//		string table				at stringTableOffset
+//
+//	Everything is in the byte order of the machine that wrote the file, which
+//	readers can tell from the magic.  The reader maps the file and hands out
+//	pointers into it, so it refuses files of the other byte order (ENOTSUP)
+//	rather than swapping them.  Offsets are 64 bit throughout.
+//
+//	This file, and USBTraceIndex.cpp, only use
+//	POSIX interfaces so the reader and the analyzer (USBTraceAnalyzer.cpp) can
+//	be built on any host, e.g.:
+//
+//		c++ -O2 -o usbtraceanalyze USBTraceAnalyzer.cpp USBTraceIndex.cpp USBTraceTransfers.cpp
+//—————————————————————————————————————————————————————————————————————————————
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define kUSBTraceFileMagic				0x58425355		/* 'USBX' on a little endian disk */
+#define kUSBTraceFileSwappedMagic		0x55534258
+#define kUSBTraceFileVersion			1
+#define kUSBTraceRecordsPerChunk		65536
+#define kUSBTraceDeviceBloomWords		4				/* 256 bit bloom filter per chunk */
+#define kUSBTraceMaxDevices				4096
+#define kUSBTraceAnyValue				0xFFFFFFFF
+
+//—————————————————————————————————————————————————————————————————————————————
+//	USB tracepoint code layout (see USBTracepoints.h)
+//	Only the values needed to index and analyze a trace are repeated here so that
+//	this file does not depend on the IOKit headers.  Keep them in sync.
+//—————————————————————————————————————————————————————————————————————————————
+
+#define kUSBTraceDebugIDClassMask		0xFFFF0000
+#define kUSBTraceDebugIDUSBClass		0x052D0000		/* DBG_IOKIT, DBG_IOUSB */
+#define USBTraceGroup(debugid)			( ( (debugid) >> 10 ) & 0x3F )
+#define USBTraceCode(debugid)			( ( (debugid) >> 2 ) & 0xFF )
+#define USBTraceQualifier(debugid)		( (debugid) & 0x3 )
+#define USBTraceIsUSB(debugid)			( ( (debugid) & kUSBTraceDebugIDClassMask ) == kUSBTraceDebugIDUSBClass )
+
+enum
+{
+	kUSBTraceQualifierNone				= 0,
+	kUSBTraceQualifierStart				= 1,
+	kUSBTraceQualifierEnd				= 2
+};
+
+enum
+{
+	// kUSBTController
+	kUSBTraceGroupController			= 0,
+	kUSBTraceControllerControlPacketHandler	= 2,
+	kUSBTraceControlTransaction			= 27,
+	kUSBTraceInterruptTransaction		= 28,
+	kUSBTraceInterruptTransactionData	= 29,
+	kUSBTraceBulkTransaction			= 30,
+	kUSBTraceBulkTransactionData		= 31,
+	kUSBTraceInterruptPacketHandler		= 33,
+	kUSBTraceBulkPacketHandler			= 34,
+	kUSBTraceControlPacketHandlerData	= 36,
+	kUSBTraceDoIOTransferIntrSync		= 37,
+	kUSBTraceDoIOTransferBulkSync		= 38,
+	kUSBTraceBulkPacketHandlerData		= 39,
+	kUSBTraceInterruptPacketHandlerData	= 40,
+
+	// kUSBTPipe
+	kUSBTraceGroupPipe					= 8,
+	kUSBTracePipeClearPipeStall			= 11,
+
+	// kUSBTXHCIInterrupts
+	kUSBTraceGroupXHCIInterrupts		= 29,
+	kUSBTraceXHCIFilterEventRing		= 14
+};
+
+// Bus, address, endpoint and direction are packed by the controller tracepoints as
+// ((direction << 24) | (busNumber << 16) | (address << 8) | endpoint)
+#define USBTraceDeviceKey(bus, addr, ep)	( ( ( (bus) & 0xFF ) << 16 ) | ( ( (addr) & 0xFF ) << 8 ) | ( (ep) & 0xFF ) )
+#define USBTraceKeyBus(key)					( ( (key) >> 16 ) & 0xFF )
+#define USBTraceKeyAddress(key)				( ( (key) >> 8 ) & 0xFF )
+#define USBTraceKeyEndpoint(key)			( (key) & 0xFF )
+#define USBTraceKeyDirection(key)			( ( (key) >> 24 ) & 0xFF )
+
+//—————————————————————————————————————————————————————————————————————————————
+//	On-disk types
+//—————————————————————————————————————————————————————————————————————————————
+
+#pragma pack(push, 8)
+
+typedef struct USBTraceFileHeader
+{
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	headerSize;
+	double		divisor;				// timestamp / divisor = microseconds
+	uint32_t	cpuCount;
+	uint32_t	recordsPerChunk;
+	uint64_t	recordCount;
+	uint64_t	firstTimestamp;
+	uint64_t	lastTimestamp;
+	uint64_t	chunkIndexOffset;
+	uint32_t	chunkCount;
+	uint32_t	deviceCount;
+	uint64_t	deviceIndexOffset;
+	uint64_t	stringTableOffset;
+	uint32_t	stringCount;
+	uint32_t	stringTableSize;
+} USBTraceFileHeader;
+
+typedef struct USBTraceRecord
+{
+	uint64_t	timestamp;
+	uint64_t	arg1;
+	uint64_t	arg2;
+	uint64_t	arg3;
+	uint64_t	arg4;
+	uint64_t	thread;
+	uint32_t	debugid;
+	uint32_t	cpuid;
+} USBTraceRecord;
+
+typedef struct USBTraceChunkEntry
+{
+	uint64_t	firstTimestamp;			// smallest timestamp in the chunk
+	uint64_t	lastTimestamp;			// largest timestamp in the chunk
+	uint64_t	recordOffset;			// file offset of the first record
+	uint32_t	recordCount;
+	uint32_t	cpuMask;				// bit n set if CPU n (mod 32) logged in this chunk
+	uint64_t	groupMask;				// bit n set if USB group n is present
+	uint64_t	deviceBloom[kUSBTraceDeviceBloomWords];
+} USBTraceChunkEntry;
+
+typedef struct USBTraceDeviceEntry
+{
+	uint32_t	key;					// USBTraceDeviceKey()
+	uint32_t	firstChunk;
+	uint32_t	lastChunk;
+	uint32_t	reserved;
+	uint64_t	recordCount;
+} USBTraceDeviceEntry;
+
+// Each string table entry is { uint32_t id; uint32_t length; char string[length + 1] }
+// padded to a 4 byte boundary.  Ids below 64 name the USB tracepoint groups; other ids
+// are reserved for tracepoint descriptions keyed by debugid.
+typedef struct USBTraceStringEntry
+{
+	uint32_t	id;
+	uint32_t	length;
+} USBTraceStringEntry;
+
+#pragma pack(pop)
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Writer
+//—————————————————————————————————————————————————————————————————————————————
+
+typedef struct USBTraceWriter USBTraceWriter;
+
+USBTraceWriter *	USBTraceWriterCreate ( const char * path, double divisor );
+void				USBTraceWriterSetDivisor ( USBTraceWriter * writer, double divisor );
+int					USBTraceWriterAppend ( USBTraceWriter * writer, const USBTraceRecord * record );
+int					USBTraceWriterAddString ( USBTraceWriter * writer, uint32_t id, const char * string );
+int					USBTraceWriterClose ( USBTraceWriter * writer );
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Reader
+//—————————————————————————————————————————————————————————————————————————————
+
+typedef struct USBTraceReader
+{
+	int							fd;
+	const uint8_t *				base;
+	size_t						length;
+	const USBTraceFileHeader *	header;
+	const USBTraceChunkEntry *	chunks;
+	const USBTraceDeviceEntry *	devices;
+	const uint8_t *				strings;
+} USBTraceReader;
+
+typedef struct USBTraceQuery
+{
+	uint64_t	startTime;				// absolute timestamps, inclusive; 0 / UINT64_MAX for open ranges
+	uint64_t	endTime;
+	uint64_t	groupMask;				// USB groups of interest, 0 for all records
+	uint32_t	bus;					// kUSBTraceAnyValue to match any
+	uint32_t	address;
+	uint32_t	endpoint;
+} USBTraceQuery;
+
+// Return false to stop the iteration
+typedef bool ( *USBTraceRecordCallback ) ( const USBTraceRecord * record, uint32_t chunk, void * context );
+
+int						USBTraceReaderOpen ( USBTraceReader * reader, const char * path );
+void					USBTraceReaderClose ( USBTraceReader * reader );
+const USBTraceRecord *	USBTraceReaderChunkRecords ( const USBTraceReader * reader, uint32_t chunk );
+const char *			USBTraceReaderString ( const USBTraceReader * reader, uint32_t id );
+uint64_t				USBTraceReaderForEach ( const USBTraceReader * reader, const USBTraceQuery * query, USBTraceRecordCallback callback, void * context );
+bool					USBTraceChunkMayMatch ( const USBTraceChunkEntry * chunk, const USBTraceQuery * query );
+bool					USBTraceRecordMatches ( const USBTraceRecord * record, const USBTraceQuery * query );
+
+void					USBTraceQueryInit ( USBTraceQuery * query );
+uint64_t				USBTraceMicrosecondsToTimestamp ( const USBTraceReader * reader, double usecs );
+double					USBTraceTimestampToMicroseconds ( const USBTraceReader * reader, uint64_t timestamp );
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Helpers shared with the analyzer
+//—————————————————————————————————————————————————————————————————————————————
+
+bool					USBTraceRecordDeviceKey ( const USBTraceRecord * record, uint32_t * key );
+const char *			USBTraceGroupName ( uint32_t group );
+int						USBTraceImportRawFile ( const char * rawPath, const char * indexedPath );
+
+#endif /* __USBTRACEINDEX_H__ */
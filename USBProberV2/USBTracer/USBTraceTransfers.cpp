@@ -0,0 +1,619 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Includes
+//—————————————————————————————————————————————————————————————————————————————
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "USBTraceTransfers.h"
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Constants
+//—————————————————————————————————————————————————————————————————————————————
+
+#define kBuilderMaxEndpoints			4096			// power of two
+#define kBuilderMaxThreads				1024			// power of two
+#define kBuilderPendingDepth			64				// outstanding transfers tracked per endpoint
+
+#define kUSBTraceDirectionIn			1
+#define kUSBTraceStatusSuccess			0x00000000
+#define kUSBTraceStatusUnderrun			0xe00002e7
+#define kUSBTraceStatusAborted			0xe00002eb
+#define kUSBTraceStatusNotResponding	0xe00002ed
+#define kUSBTraceStatusSplitError		0xe000404b
+#define kUSBTraceStatusPipeStalled		0xe000404f
+#define kUSBTraceStatusReturned			0xe0004050
+#define kUSBTraceStatusTimeout			0xe0004051
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Types
+//—————————————————————————————————————————————————————————————————————————————
+
+typedef struct PendingTransfer
+{
+	USBTraceTransfer	transfer;
+	uint32_t			sequence;
+	uint32_t			controlStages;			// ControlPacketHandler calls so far
+	uint32_t			controlStatus;			// what IOUSBCommand::GetStatus() would say
+} PendingTransfer;
+
+typedef struct BuilderEndpoint
+{
+	uint32_t			key;
+	uint32_t			inUse;
+	uint32_t			lastFailed;
+	uint32_t			nextSequence;
+	uint32_t			pendingHead;
+	uint32_t			pendingCount;
+	PendingTransfer		pending[kBuilderPendingDepth];
+} BuilderEndpoint;
+
+// The start and end of a *Transaction are traced by the submitting thread, the
+// end carries no endpoint so remember what each thread last submitted
+typedef struct BuilderThread
+{
+	uint64_t			thread;
+	uint32_t			inUse;
+	uint32_t			endpoint;				// index into endpoints
+	uint32_t			sequence;
+} BuilderThread;
+
+struct USBTraceTransferBuilder
+{
+	USBTraceTransferCallback	transferCallback;
+	USBTraceEventCallback		eventCallback;
+	void *						context;
+	BuilderEndpoint *			endpoints;
+	BuilderThread *				threads;
+	uint64_t					unmatched;
+};
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Helpers
+//—————————————————————————————————————————————————————————————————————————————
+
+static BuilderEndpoint *
+LookupEndpoint ( USBTraceTransferBuilder * builder, uint32_t key, bool create )
+{
+	uint32_t	slot = ( key * 0x9E3779B1 ) & ( kBuilderMaxEndpoints - 1 );
+	uint32_t	probe;
+
+	for ( probe = 0; probe < kBuilderMaxEndpoints; probe++ )
+	{
+		BuilderEndpoint * endpoint = &builder->endpoints[( slot + probe ) & ( kBuilderMaxEndpoints - 1 )];
+
+		if ( endpoint->inUse && endpoint->key == key )
+			return endpoint;
+
+		if ( !endpoint->inUse )
+		{
+			if ( !create )
+				return NULL;
+
+			endpoint->key = key;
+			endpoint->inUse = 1;
+			return endpoint;
+		}
+	}
+
+	return NULL;
+}
+
+static BuilderThread *
+LookupThread ( USBTraceTransferBuilder * builder, uint64_t thread, bool create )
+{
+	uint32_t	slot = ( (uint32_t)( thread >> 4 ) * 0x9E3779B1 ) & ( kBuilderMaxThreads - 1 );
+	uint32_t	probe;
+
+	for ( probe = 0; probe < kBuilderMaxThreads; probe++ )
+	{
+		BuilderThread * entry = &builder->threads[( slot + probe ) & ( kBuilderMaxThreads - 1 )];
+
+		if ( entry->inUse && entry->thread == thread )
+			return entry;
+
+		if ( !entry->inUse )
+		{
+			if ( !create )
+				return NULL;
+
+			entry->thread = thread;
+			entry->inUse = 1;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+PostEvent ( USBTraceTransferBuilder * builder, uint64_t timestamp, uint32_t key, uint32_t kind, uint64_t value, uint64_t object )
+{
+	USBTraceEvent	event;
+
+	if ( builder->eventCallback == NULL )
+		return;
+
+	event.timestamp = timestamp;
+	event.key = key;
+	event.kind = kind;
+	event.value = value;
+	event.object = object;
+
+	builder->eventCallback( &event, builder->context );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	RemovePending
+//	- removes entry position (0 = oldest) from the endpoint's FIFO and hands
+//	  the transfer to the client
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+RemovePending ( USBTraceTransferBuilder * builder, BuilderEndpoint * endpoint, uint32_t position )
+{
+	uint32_t	index;
+
+	if ( builder->transferCallback )
+		builder->transferCallback( &endpoint->pending[( endpoint->pendingHead + position ) % kBuilderPendingDepth].transfer, builder->context );
+
+	if ( position == 0 )
+	{
+		endpoint->pendingHead = ( endpoint->pendingHead + 1 ) % kBuilderPendingDepth;
+	}
+	else
+	{
+		for ( index = position; index + 1 < endpoint->pendingCount; index++ )
+		{
+			endpoint->pending[( endpoint->pendingHead + index ) % kBuilderPendingDepth] =
+				endpoint->pending[( endpoint->pendingHead + index + 1 ) % kBuilderPendingDepth];
+		}
+	}
+
+	endpoint->pendingCount--;
+}
+
+static bool
+FindPending ( const BuilderEndpoint * endpoint, uint32_t sequence, uint32_t * position )
+{
+	uint32_t	index;
+
+	for ( index = endpoint->pendingCount; index > 0; index-- )
+	{
+		if ( endpoint->pending[( endpoint->pendingHead + index - 1 ) % kBuilderPendingDepth].sequence == sequence )
+		{
+			*position = index - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	Submit
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+Submit ( USBTraceTransferBuilder * builder, const USBTraceRecord * record, uint32_t key, uint32_t type )
+{
+	BuilderEndpoint *	endpoint = LookupEndpoint( builder, key, true );
+	BuilderThread *		thread;
+	PendingTransfer *	pending;
+
+	if ( endpoint == NULL )
+		return;
+
+	// Control transfers are serialized per endpoint, so an older one still here was never seen to finish
+	if ( ( type == kUSBTraceTransferControl && endpoint->pendingCount > 0 ) || endpoint->pendingCount == kBuilderPendingDepth )
+	{
+		endpoint->pending[endpoint->pendingHead].transfer.flags |= kUSBTraceTransferNoCompletion;
+		RemovePending( builder, endpoint, 0 );
+	}
+
+	pending = &endpoint->pending[( endpoint->pendingHead + endpoint->pendingCount ) % kBuilderPendingDepth];
+	endpoint->pendingCount++;
+
+	memset( pending, 0, sizeof(*pending) );
+	pending->sequence = endpoint->nextSequence++;
+	pending->transfer.submitTime = record->timestamp;
+	pending->transfer.key = key;
+	pending->transfer.type = type;
+
+	if ( type == kUSBTraceTransferControl )
+	{
+		pending->transfer.setup = ( (uint64_t)( record->arg3 & 0xFFFFFFFF ) << 32 ) | ( record->arg4 & 0xFFFFFFFF );
+		pending->transfer.requested = (uint32_t)( record->arg4 & 0xFFFF );
+	}
+	else
+	{
+		pending->transfer.requested = (uint32_t)record->arg3;
+	}
+
+	if ( endpoint->lastFailed )
+	{
+		pending->transfer.flags |= kUSBTraceTransferRetry;
+		endpoint->lastFailed = 0;
+		PostEvent( builder, record->timestamp, key, kUSBTraceEventRetry, 0, 0 );
+	}
+
+	thread = LookupThread( builder, record->thread, true );
+	if ( thread )
+	{
+		thread->endpoint = (uint32_t)( endpoint - builder->endpoints );
+		thread->sequence = pending->sequence;
+	}
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	Queued
+//	- the *Transaction end, arg2 is the error returned by the UIM
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+Queued ( USBTraceTransferBuilder * builder, const USBTraceRecord * record )
+{
+	BuilderThread *		thread = LookupThread( builder, record->thread, false );
+	BuilderEndpoint *	endpoint;
+	PendingTransfer *	pending;
+	uint32_t			position;
+
+	if ( thread == NULL )
+		return;
+
+	endpoint = &builder->endpoints[thread->endpoint];
+	if ( !FindPending( endpoint, thread->sequence, &position ) )
+		return;			// already completed
+
+	pending = &endpoint->pending[( endpoint->pendingHead + position ) % kBuilderPendingDepth];
+	pending->transfer.queuedTime = record->timestamp;
+
+	if ( (uint32_t)record->arg2 != kUSBTraceStatusSuccess )
+	{
+		pending->transfer.status = (uint32_t)record->arg2;
+		pending->transfer.flags |= kUSBTraceTransferNotQueued;
+		endpoint->lastFailed = 1;
+		PostEvent( builder, record->timestamp, pending->transfer.key, kUSBTraceEventError, pending->transfer.status, 0 );
+		RemovePending( builder, endpoint, position );
+	}
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	Complete
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+Complete ( USBTraceTransferBuilder * builder, BuilderEndpoint * endpoint, uint64_t timestamp, uint32_t actual, uint32_t status )
+{
+	USBTraceTransfer *	transfer;
+
+	if ( endpoint == NULL || endpoint->pendingCount == 0 )
+	{
+		builder->unmatched++;
+		return;
+	}
+
+	transfer = &endpoint->pending[endpoint->pendingHead].transfer;
+	transfer->completeTime = timestamp;
+	transfer->actual = actual;
+	transfer->status = status;
+	if ( transfer->queuedTime == 0 )
+		transfer->flags |= kUSBTraceTransferNoQueuedTime;
+
+	endpoint->lastFailed = ( status != kUSBTraceStatusSuccess );
+	if ( status == kUSBTraceStatusPipeStalled )
+		PostEvent( builder, timestamp, transfer->key, kUSBTraceEventStall, status, 0 );
+	else if ( status != kUSBTraceStatusSuccess )
+		PostEvent( builder, timestamp, transfer->key, kUSBTraceEventError, status, 0 );
+
+	RemovePending( builder, endpoint, 0 );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	LookupControl
+//	- ControlPacketHandler keys carry no direction, ControlTransaction ones do.
+//	  Control transfers are serialized per endpoint so at most one has any.
+//———————————————————————————————————————————————————————————————————————————
+
+static BuilderEndpoint *
+LookupControl ( USBTraceTransferBuilder * builder, uint32_t key )
+{
+	BuilderEndpoint * endpoint = LookupEndpoint( builder, ( key & 0x00FFFFFF ) | ( kUSBTraceDirectionIn << 24 ), false );
+
+	if ( endpoint == NULL || endpoint->pendingCount == 0 )
+		endpoint = LookupEndpoint( builder, key & 0x00FFFFFF, false );
+
+	return endpoint;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	ControlStage
+//	- the ControlPacketHandler start, traced for every stage (setup, data,
+//	  status) whatever its outcome: arg3 is the stage's status and arg4 the
+//	  bytes it left untransferred.  Follows how the handler folds the stage
+//	  status into the command's.
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+ControlStage ( USBTraceTransferBuilder * builder, const USBTraceRecord * record )
+{
+	BuilderEndpoint *	endpoint = LookupControl( builder, (uint32_t)record->arg2 );
+	PendingTransfer *	pending;
+	uint32_t			status = (uint32_t)record->arg3;
+
+	if ( endpoint == NULL || endpoint->pendingCount == 0 )
+		return;
+
+	pending = &endpoint->pending[endpoint->pendingHead];
+	pending->controlStages++;
+
+	// Setup comes back first, so the data stage, if there is one, is the second
+	if ( pending->controlStages == 2 && pending->transfer.requested > 0 )
+	{
+		uint32_t remaining = (uint32_t)record->arg4;
+
+		pending->transfer.actual = ( remaining < pending->transfer.requested ) ? pending->transfer.requested - remaining : 0;
+	}
+
+	if ( status == kUSBTraceStatusSuccess )
+		return;
+
+	if ( status != kUSBTraceStatusReturned && status != kUSBTraceStatusAborted && status != kUSBTraceStatusTimeout )
+		pending->controlStatus = ( status == kUSBTraceStatusSplitError ) ? kUSBTraceStatusNotResponding : status;
+	else if ( pending->controlStatus == kUSBTraceStatusSuccess )
+		pending->controlStatus = ( status == kUSBTraceStatusReturned ) ? kUSBTraceStatusAborted : status;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	ControlStageDone
+//	- the ControlPacketHandler end: arg3 is the stages still outstanding and
+//	  arg4 the stage's status.  The transfer completes when none are left.
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+ControlStageDone ( USBTraceTransferBuilder * builder, const USBTraceRecord * record )
+{
+	BuilderEndpoint *	endpoint = LookupControl( builder, (uint32_t)record->arg2 );
+	PendingTransfer *	pending;
+	uint32_t			status;
+
+	if ( (uint32_t)record->arg3 != 0 )
+		return;
+
+	if ( endpoint == NULL || endpoint->pendingCount == 0 )
+	{
+		builder->unmatched++;
+		return;
+	}
+
+	pending = &endpoint->pending[endpoint->pendingHead];
+
+	// A short packet is not reported as an error
+	status = ( (uint32_t)record->arg4 == kUSBTraceStatusUnderrun ) ? kUSBTraceStatusSuccess : pending->controlStatus;
+
+	Complete( builder, endpoint, record->timestamp, pending->transfer.actual, status );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceTransferBuilderCreate
+//———————————————————————————————————————————————————————————————————————————
+
+USBTraceTransferBuilder *
+USBTraceTransferBuilderCreate ( USBTraceTransferCallback transferCallback, USBTraceEventCallback eventCallback, void * context )
+{
+	USBTraceTransferBuilder * builder = (USBTraceTransferBuilder *)calloc( 1, sizeof(USBTraceTransferBuilder) );
+
+	if ( builder == NULL )
+		return NULL;
+
+	builder->transferCallback = transferCallback;
+	builder->eventCallback = eventCallback;
+	builder->context = context;
+	builder->endpoints = (BuilderEndpoint *)calloc( kBuilderMaxEndpoints, sizeof(BuilderEndpoint) );
+	builder->threads = (BuilderThread *)calloc( kBuilderMaxThreads, sizeof(BuilderThread) );
+
+	if ( builder->endpoints == NULL || builder->threads == NULL )
+	{
+		USBTraceTransferBuilderDestroy( builder );
+		return NULL;
+	}
+
+	return builder;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceTransferBuilderAdd
+//———————————————————————————————————————————————————————————————————————————
+
+void
+USBTraceTransferBuilderAdd ( USBTraceTransferBuilder * builder, const USBTraceRecord * record )
+{
+	uint32_t	debugid = record->debugid;
+	uint32_t	qualifier = USBTraceQualifier( debugid );
+	uint32_t	key;
+
+	if ( !USBTraceIsUSB( debugid ) )
+		return;
+
+	switch ( USBTraceGroup( debugid ) )
+	{
+		case kUSBTraceGroupController:
+			switch ( USBTraceCode( debugid ) )
+			{
+				case kUSBTraceControlTransaction:
+				case kUSBTraceBulkTransaction:
+				case kUSBTraceInterruptTransaction:
+					if ( qualifier == kUSBTraceQualifierStart )
+					{
+						uint32_t code = USBTraceCode( debugid );
+
+						Submit( builder, record, (uint32_t)record->arg2, code == kUSBTraceControlTransaction ? kUSBTraceTransferControl :
+								( code == kUSBTraceBulkTransaction ? kUSBTraceTransferBulk : kUSBTraceTransferInterrupt ) );
+					}
+					else if ( qualifier == kUSBTraceQualifierEnd )
+					{
+						Queued( builder, record );
+					}
+					break;
+
+				case kUSBTraceBulkPacketHandler:
+				case kUSBTraceInterruptPacketHandler:
+					key = (uint32_t)record->arg2;
+					Complete( builder, LookupEndpoint( builder, key, false ), record->timestamp, (uint32_t)record->arg3, (uint32_t)record->arg4 );
+					break;
+
+				case kUSBTraceControllerControlPacketHandler:
+					if ( qualifier == kUSBTraceQualifierStart )
+						ControlStage( builder, record );
+					else if ( qualifier == kUSBTraceQualifierEnd )
+						ControlStageDone( builder, record );
+					break;
+
+				case kUSBTraceDoIOTransferIntrSync:
+				case kUSBTraceDoIOTransferBulkSync:
+					if ( qualifier == kUSBTraceQualifierEnd && (uint32_t)record->arg3 != kUSBTraceStatusSuccess )
+						PostEvent( builder, record->timestamp, (uint32_t)record->arg2, kUSBTraceEventSyncError, (uint32_t)record->arg3, 0 );
+					break;
+
+				default:
+					break;
+			}
+			break;
+
+		case kUSBTraceGroupPipe:
+			// The pipe only knows its address and endpoint number
+			if ( USBTraceCode( debugid ) == kUSBTracePipeClearPipeStall && qualifier == kUSBTraceQualifierStart )
+				PostEvent( builder, record->timestamp, USBTraceDeviceKey( kUSBTraceUnknownBus, record->arg2, record->arg3 ), kUSBTraceEventClearStall, 0, record->arg1 );
+			break;
+
+		case kUSBTraceGroupXHCIInterrupts:
+			if ( USBTraceCode( debugid ) == kUSBTraceXHCIFilterEventRing && qualifier == kUSBTraceQualifierNone && record->arg4 == 4 )
+				PostEvent( builder, record->timestamp, kUSBTraceAnyValue, kUSBTraceEventRingStopped, record->arg3, record->arg2 );
+			break;
+
+		default:
+			break;
+	}
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceTransferBuilderFlush
+//	- hands every transfer still outstanding to the client
+//———————————————————————————————————————————————————————————————————————————
+
+void
+USBTraceTransferBuilderFlush ( USBTraceTransferBuilder * builder )
+{
+	uint32_t	index;
+
+	for ( index = 0; index < kBuilderMaxEndpoints; index++ )
+	{
+		BuilderEndpoint * endpoint = &builder->endpoints[index];
+
+		while ( endpoint->inUse && endpoint->pendingCount > 0 )
+		{
+			endpoint->pending[endpoint->pendingHead].transfer.flags |= kUSBTraceTransferNoCompletion;
+			RemovePending( builder, endpoint, 0 );
+		}
+	}
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	USBTraceTransferBuilderDestroy
+//———————————————————————————————————————————————————————————————————————————
+
+void
+USBTraceTransferBuilderDestroy ( USBTraceTransferBuilder * builder )
+{
+	if ( builder == NULL )
+		return;
+
+	free( builder->endpoints );
+	free( builder->threads );
+	free( builder );
+}
+
+uint64_t
+USBTraceTransferBuilderUnmatched ( const USBTraceTransferBuilder * builder )
+{
+	return builder->unmatched;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	Names
+//———————————————————————————————————————————————————————————————————————————
+
+const char *
+USBTraceTransferTypeName ( uint32_t type )
+{
+	switch ( type )
+	{
+		case kUSBTraceTransferControl:		return "control";
+		case kUSBTraceTransferBulk:			return "bulk";
+		case kUSBTraceTransferInterrupt:	return "interrupt";
+		default:							return "unknown";
+	}
+}
+
+const char *
+USBTraceEventName ( uint32_t kind )
+{
+	switch ( kind )
+	{
+		case kUSBTraceEventError:			return "error";
+		case kUSBTraceEventStall:			return "stall";
+		case kUSBTraceEventRetry:			return "retry";
+		case kUSBTraceEventClearStall:		return "clear-stall";
+		case kUSBTraceEventSyncError:		return "sync-error";
+		case kUSBTraceEventRingStopped:		return "ring-stopped";
+		default:							return "unknown";
+	}
+}
+
+// The statuses a completion is likely to carry, see IOReturn.h and USB.h
+const char *
+USBTraceStatusName ( uint32_t status )
+{
+	switch ( status )
+	{
+		case 0x00000000:	return "success";
+		case 0xe00002d6:	return "timeout";
+		case 0xe00002e7:	return "underrun";
+		case 0xe00002e8:	return "overrun";
+		case 0xe00002e9:	return "device-error";
+		case 0xe00002eb:	return "aborted";
+		case 0xe00002ec:	return "no-bandwidth";
+		case 0xe00002ed:	return "not-responding";
+		case 0xe000400c:	return "buffer-overrun";
+		case 0xe000400d:	return "buffer-underrun";
+		case 0xe0004010:	return "link-error";
+		case 0xe000404b:	return "split-error";
+		case 0xe000404f:	return "stalled";
+		case 0xe0004050:	return "returned";
+		case 0xe0004051:	return "transaction-timeout";
+		default:			return NULL;
+	}
+}
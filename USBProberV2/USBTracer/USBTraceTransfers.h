@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2013 Apple Inc.  All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __USBTRACETRANSFERS_H__
+#define __USBTRACETRANSFERS_H__
+
+//—————————————————————————————————————————————————————————————————————————————
+//	Transfer reconstruction
+//
+//	Feeds tracepoints, in timestamp order, through a builder which pairs them
+//	into one record per transfer:
+//
+//		submitTime		Control/Bulk/InterruptTransaction start
+//		queuedTime		the matching end, once the UIM has queued the transfer
+//		completeTime	the Bulk/InterruptPacketHandler, or the ControlPacketHandler
+//						end that finished the last stage of a control transfer
+//
+//	so queue time is queuedTime - submitTime and wire time is completeTime -
+//	queuedTime.  Failed completions, stalls, resubmits after a failure, pipe
+//	stall clears and XHCI ring stops are reported as separate events.
+//—————————————————————————————————————————————————————————————————————————————
+
+#include "USBTraceIndex.h"
+
+#define kUSBTraceUnknownBus				0xFF			// bus field of keys built from pipe tracepoints
+
+enum
+{
+	kUSBTraceTransferControl			= 0,
+	kUSBTraceTransferBulk				= 1,
+	kUSBTraceTransferInterrupt			= 2
+};
+
+enum
+{
+	kUSBTraceTransferRetry				= 0x01,			// previous transfer on the endpoint failed
+	kUSBTraceTransferNotQueued			= 0x02,			// the UIM refused the transfer, status is its error
+	kUSBTraceTransferNoCompletion		= 0x04,			// no completion was traced before the end of the trace
+	kUSBTraceTransferNoQueuedTime		= 0x08			// completed before the submitting thread traced the end
+};
+
+enum
+{
+	kUSBTraceEventError					= 0,			// transfer completed with an error
+	kUSBTraceEventStall					= 1,			// transfer completed with kIOUSBPipeStalled
+	kUSBTraceEventRetry					= 2,			// transfer submitted after a failed one
+	kUSBTraceEventClearStall			= 3,			// IOUSBPipe::ClearPipeStall
+	kUSBTraceEventSyncError				= 4,			// synchronous DoIOTransfer returned an error
+	kUSBTraceEventRingStopped			= 5				// XHCI isoc ring stopped, value is the condition code
+};
+
+typedef struct USBTraceTransfer
+{
+	uint64_t	submitTime;
+	uint64_t	queuedTime;				// 0 if unknown
+	uint64_t	completeTime;			// 0 if unknown
+	uint64_t	setup;					// control only: (bmRequestType << 56) | (bRequest << 48) | (wValue << 32) | (wIndex << 16) | wLength
+	uint32_t	key;					// packed direction and USBTraceDeviceKey()
+	uint32_t	type;
+	uint32_t	requested;
+	uint32_t	actual;
+	uint32_t	status;
+	uint32_t	flags;
+} USBTraceTransfer;
+
+typedef struct USBTraceEvent
+{
+	uint64_t	timestamp;
+	uint64_t	value;					// status, error or condition code
+	uint64_t	object;					// XHCI endpoint for kUSBTraceEventRingStopped
+	uint32_t	key;
+	uint32_t	kind;
+} USBTraceEvent;
+
+typedef void ( *USBTraceTransferCallback ) ( const USBTraceTransfer * transfer, void * context );
+typedef void ( *USBTraceEventCallback ) ( const USBTraceEvent * event, void * context );
+
+typedef struct USBTraceTransferBuilder USBTraceTransferBuilder;
+
+USBTraceTransferBuilder *	USBTraceTransferBuilderCreate ( USBTraceTransferCallback transferCallback, USBTraceEventCallback eventCallback, void * context );
+void						USBTraceTransferBuilderAdd ( USBTraceTransferBuilder * builder, const USBTraceRecord * record );
+void						USBTraceTransferBuilderFlush ( USBTraceTransferBuilder * builder );
+void						USBTraceTransferBuilderDestroy ( USBTraceTransferBuilder * builder );
+uint64_t					USBTraceTransferBuilderUnmatched ( const USBTraceTransferBuilder * builder );
+
+const char *				USBTraceTransferTypeName ( uint32_t type );
+const char *				USBTraceEventName ( uint32_t kind );
+const char *				USBTraceStatusName ( uint32_t status );
+
+#endif /* __USBTRACETRANSFERS_H__ */
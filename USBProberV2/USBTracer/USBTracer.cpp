@@ -45,7 +45,7 @@ boolean_t			gPrintGroup					= TRUE;
 boolean_t			gPrintMethod				= TRUE;
 boolean_t			gPrintUSBP					= TRUE;
 boolean_t			gPrintRHTimerFired			= FALSE;
-int					gNumIndentTabs				= 0;
+__thread int		gNumIndentTabs				= 0;
 boolean_t			gPrintIndent				= FALSE;
 uint32_t			gTraceBufferSize			= kTraceBufferSampleSize;
 uint32_t			gSavedFWDebugMask			= 0;
@@ -55,33 +55,40 @@ boolean_t			gOuputRaw					= FALSE;
 boolean_t			gShouldReadRawFile			= FALSE;
 char				gLogFilePath[kFilePathMaxSize];
 FILE *				gLogFileStream				= NULL;
+boolean_t			gShouldWriteIndex			= FALSE;
+char				gIndexFilePath[kFilePathMaxSize];
+USBTraceWriter *	gIndexWriter				= NULL;
 char				gCodesFilePath[kFilePathMaxSize];
-FILE *				gCodesFileStream			= NULL;
+__thread FILE *		gCodesFileStream			= NULL;
 unsigned int		gRegTypeInterest			= KDBG_RANGETYPE;
 unsigned int		gRegTypeValue1				= 0;
 unsigned int		gRegTypeValue2				= -1;
 boolean_t			gBasicFormatting			= FALSE;
 uint64_t			gStartingAbsTime			= 0;
-uint64_t			gLastTimeStamp				= -1;
+__thread uint64_t	gLastTimeStamp				= -1;
 boolean_t			gPrintNoSep					= FALSE;
 uint32_t			gSavedUSBDebugMask			= 0;
 boolean_t			gDump						= FALSE;
 
-int64_t 			gCurrent_usecs				= 0;
-int64_t 			gPrev_usecs					= 0;
-int64_t				gDelta_usecs					= 0;
+__thread int64_t	gCurrent_usecs				= 0;
+__thread int64_t	gPrev_usecs					= 0;
+__thread int64_t	gDelta_usecs				= 0;
+__thread FILE *		gOutputStream				= NULL;		/* NULL means stdout; decode workers write to a private buffer */
+__thread DecodeStatics	gDecodeStatics;
+uint32_t			gDecodeThreads				= 0;		/* 0 means one per CPU */
+uint64_t			gBenchmarkRecords			= 0;
 
 static void PrintBufferSettings ( void )
 {
 	kbufinfo_t bufinfo = { 0, 0, 0, 0, 0 };
 	GetTraceBufferInfo( &bufinfo );
 	
-	printf("The kernel buffer settings are:\n");
-	printf("\tentries:\t%d\n", bufinfo.nkdbufs);	// nkdbufs isn't the actual buffer size, only what's been set. Call reinit to actually use.
-	printf("\tflags:\t\t0x%x\n", bufinfo.flags);
-	printf("\tnolog:\t\t%d\n", bufinfo.nolog);
-	printf("\tbufid:\t\t%d\n", bufinfo.bufid);
-	printf("\tthreads:\t%d\n", bufinfo.nkdthreads);
+	fprintf( OutputStream(), "The kernel buffer settings are:\n");
+	fprintf( OutputStream(), "\tentries:\t%d\n", bufinfo.nkdbufs);	// nkdbufs isn't the actual buffer size, only what's been set. Call reinit to actually use.
+	fprintf( OutputStream(), "\tflags:\t\t0x%x\n", bufinfo.flags);
+	fprintf( OutputStream(), "\tnolog:\t\t%d\n", bufinfo.nolog);
+	fprintf( OutputStream(), "\tbufid:\t\t%d\n", bufinfo.bufid);
+	fprintf( OutputStream(), "\tthreads:\t%d\n", bufinfo.nkdthreads);
 }
 
 #pragma mark Functions
@@ -111,6 +118,12 @@ int main(int argc, const char * argv[])
 	// Get program arguments.
 	ParseArguments ( argc, argv );
 	
+	if ( gBenchmarkRecords )
+	{
+		RunDecodeBenchmark( gBenchmarkRecords );
+		exit(0);
+	}
+	
 	// Collect trace into auto-allocated buffer
 	if ( gDump )
 	{
@@ -123,7 +136,19 @@ int main(int argc, const char * argv[])
 	
 	if ( gShouldReadRawFile )
 	{
+		if ( gShouldWriteIndex )
+		{
+			// The divisor is updated from the raw file's divisor entry
+			gIndexWriter = USBTraceWriterCreate( gIndexFilePath, gDivisor );
+			if ( gIndexWriter == NULL )
+				Quit( "Can't open index file!\n" );
+		}
+		
 		ReadRawFile(gLogFilePath);
+		
+		if ( gIndexWriter && USBTraceWriterClose( gIndexWriter ) != 0 )
+			elog( "Error writing index file '%s'\n", gIndexFilePath );
+		
 		exit( 0 );
 	}
 	
@@ -158,6 +183,13 @@ int main(int argc, const char * argv[])
 	if ( gVerbose )
 		PrintBufferSettings();
 	
+	if ( gShouldWriteIndex )
+	{
+		gIndexWriter = USBTraceWriterCreate( gIndexFilePath, gDivisor );
+		if ( gIndexWriter == NULL )
+			Quit( "Can't open index file!\n" );
+	}
+	
 	// Enable the trace buffer.
 	EnableTraceBuffer ( 1 );
 	
@@ -254,6 +286,15 @@ PrintUsage ( void )
 	elog ( "\t--read=path-to-file, -r path-to-file\n");
 	elog ( "\t\t Read tracepoints from a raw format file\n");	
 	
+	elog ( "\t--index=path-to-file, -x path-to-file\n");
+	elog ( "\t\t Also write tracepoints to an indexed file for usbtraceanalyze. With --read, converts the raw file.\n");
+	
+	elog ( "\t--threads=count, -j count\n");
+	elog ( "\t\t Decode large buffers on count threads. Defaults to one per CPU, 1 disables.\n");
+	
+	elog ( "\t--benchmark=count, -z count\n");
+	elog ( "\t\t Time serial and parallel decoding of count synthetic tracepoints, then exit.\n");
+	
 	elog ( "\t--cpu, -C\n");
 	elog ( "\t\t Display CPU numbers.\n");
 	
@@ -319,6 +360,9 @@ ParseArguments ( int argc, const char * argv[] )
 		{ "nolog",			no_argument,		0, 'L' },
 		{ "write",			optional_argument,	0, 'w' },
 		{ "read",			required_argument,	0, 'r' },
+		{ "index",			required_argument,	0, 'x' },
+		{ "threads",		required_argument,	0, 'j' },
+		{ "benchmark",		required_argument,	0, 'z' },
 		{ "cpu",			no_argument,		0, 'C' },
 		{ "thread",			no_argument,		0, 'H' },
 		{ "interest",		required_argument,	0, 'I' },
@@ -339,7 +383,7 @@ ParseArguments ( int argc, const char * argv[] )
 		return;
 	}
 	
-    while ( ( c = getopt_long ( argc, ( char * const * ) argv , "b:ad::ctsgmufiTLw::r:CHI:1:2:BSDvVh?", long_options, NULL  ) ) != -1 )
+    while ( ( c = getopt_long ( argc, ( char * const * ) argv , "b:ad::ctsgmufiTLw::r:x:j:z:CHI:1:2:BSDvVh?", long_options, NULL  ) ) != -1 )
 	{
 		switch ( c )
 		{
@@ -462,6 +506,24 @@ ParseArguments ( int argc, const char * argv[] )
 				vlog( "Will read raw data from file %s\n", gLogFilePath );
 				break;
 				
+			case 'x':
+				if ( strlcpy(gIndexFilePath, optarg, sizeof(gIndexFilePath)) >= sizeof(gIndexFilePath) )
+					Quit( "File path length of index file is too long\n");
+				
+				gShouldWriteIndex = TRUE;
+				vlog( "Will write indexed trace to file %s\n", gIndexFilePath );
+				break;
+				
+			case 'j':
+				gDecodeThreads = (uint32_t)strtoul(optarg, NULL, 0);
+				vlog( "Will decode on %u threads\n", gDecodeThreads );
+				break;
+				
+			case 'z':
+				gBenchmarkRecords = strtoull(optarg, NULL, 0);
+				vlog( "Will benchmark decoding of %llu synthetic tracepoints\n", gBenchmarkRecords );
+				break;
+				
 			case 'C':
 				gPrintCPU = TRUE;	
 				vlog( "Will display CPU number\n");
@@ -869,7 +931,6 @@ static void
 CollectTrace ( void )
 {
 	int				mib[6];
-	int 			index;
 	int				count;
 	size_t 			needed;
 	kbufinfo_t 		bufinfo = { 0, 0, 0, 0, 0 };
@@ -901,10 +962,7 @@ CollectTrace ( void )
 		vlog( "Buffer has wrapped.\n");
 	}
 	
-	for ( index = 0; index < count; index++ )
-	{
-		ProcessTracepoint( gTraceBuffer[index] );
-	}
+	ProcessTracepoints( gTraceBuffer, count );
 	
 	fflush ( 0 );
 }	
@@ -921,7 +979,6 @@ CollectWithAlloc( void )
 	int				reenable = 0;
 	int				mib[6];
 	size_t 			needed;
-	int 			index;
     kbufinfo_t		bufinfo = {0, 0, 0, 0, 0};
 	
 	// Get kernel buffer information
@@ -962,10 +1019,7 @@ CollectWithAlloc( void )
 	
 	kd = (kd_buf *) buffer;
 	
-	for ( index = 0; index < needed; index++ )
-	{
-		ProcessTracepoint( kd[index] );
-	}
+	ProcessTracepoints( kd, needed );
 	
 	fflush ( 0 );
 }
@@ -1112,6 +1166,337 @@ ProcessTracepoint( kd_buf tracepoint )
 	{
 		CollectTraceBasic( tracepoint );
 	}
+	
+	gNumIndentTabs += IndentDelta( debugID );
+}
+
+#pragma mark Parallel Decoding
+
+//———————————————————————————————————————————————————————————————————————————
+//	ProcessTracepoints
+//	- decodes a buffer of tracepoints in order.  Large buffers are split into
+//	  chunks which are decoded concurrently into private buffers and then
+//	  written out in their original (timestamp) order.
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+ProcessTracepoints( kd_buf * tracepoints, size_t count )
+{
+	size_t	index;
+	
+	if ( gIndexWriter )
+	{
+		for ( index = 0; index < count; index++ )
+			AppendToIndexFile( &tracepoints[index] );
+	}
+	
+	if ( count >= kDecodeParallelThreshold && GetDecodeThreadCount() > 1 )
+	{
+		ProcessTracepointsParallel( tracepoints, count );
+	}
+	else
+	{
+		for ( index = 0; index < count; index++ )
+			ProcessTracepoint( tracepoints[index] );
+	}
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	GetDecodeThreadCount
+//———————————————————————————————————————————————————————————————————————————
+
+static uint32_t
+GetDecodeThreadCount ( void )
+{
+	if ( gDecodeThreads == 0 )
+	{
+		int		cpus = 1;
+		size_t	size = sizeof(cpus);
+		
+		if ( sysctlbyname( "hw.ncpu", &cpus, &size, NULL, 0 ) != 0 || cpus < 1 )
+			cpus = 1;
+		
+		gDecodeThreads = cpus;
+	}
+	
+	return gDecodeThreads;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	DecodeWorker
+//	- All decoder state (timestamp deltas, indentation, gDecodeStatics) is
+//	  thread local.  Each chunk is primed by replaying the tracepoints just
+//	  before it with the output thrown away, then its indentation is set from
+//	  the prepass in ProcessTracepointsParallel.  That is only a guess of the
+//	  state a serial decode would be in, so the state the chunk started from and
+//	  the state it ended in are kept for ProcessTracepointsParallel to check.
+//———————————————————————————————————————————————————————————————————————————
+
+static void *
+DecodeWorker ( void * arg )
+{
+	DecodeBatch *	batch = ( DecodeBatch * ) arg;
+	FILE *			savedOutputStream = gOutputStream;		// only set when ProcessTracepointsParallel calls this directly
+	FILE *			savedCodesFileStream = gCodesFileStream;
+	uint32_t		chunkIndex;
+	size_t			index;
+	
+	gCodesFileStream = NULL;
+	if ( gCodesFilePath[0] != 0 )
+		gCodesFileStream = fopen( gCodesFilePath, "r" );
+	
+	while ( ( chunkIndex = __sync_fetch_and_add( &batch->nextChunk, 1 ) ) < batch->chunkCount )
+	{
+		DecodeChunk *	chunk = &batch->chunks[chunkIndex];
+		
+		gOutputStream = open_memstream( &chunk->output, &chunk->outputSize );
+		if ( gOutputStream == NULL )
+			continue;		// ProcessTracepointsParallel will decode it inline
+		
+		SetDecodeState( &chunk->seed );
+		
+		for ( index = chunk->warmup; index > 0; index-- )
+			ProcessTracepoint( chunk->records[-(ssize_t)index] );
+		
+		fflush( gOutputStream );
+		chunk->skip = chunk->outputSize;
+		gNumIndentTabs = chunk->indent;
+		GetDecodeState( &chunk->start );
+		
+		for ( index = 0; index < chunk->count; index++ )
+			ProcessTracepoint( chunk->records[index] );
+		
+		GetDecodeState( &chunk->end );
+		fclose( gOutputStream );
+		gOutputStream = NULL;
+	}
+	
+	if ( gCodesFileStream )
+		fclose( gCodesFileStream );
+	
+	gCodesFileStream = savedCodesFileStream;
+	gOutputStream = savedOutputStream;
+	
+	return NULL;
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	ProcessTracepointsParallel
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+ProcessTracepointsParallel( kd_buf * tracepoints, size_t count )
+{
+	uint32_t		threadCount = GetDecodeThreadCount();
+	uint32_t		batchSize = threadCount * kDecodeChunksPerThread;
+	size_t			chunkCount = ( count + kDecodeChunkSize - 1 ) / kDecodeChunkSize;
+	size_t			firstChunk;
+	kd_buf *		sorted = NULL;
+	pthread_t *		threads;
+	DecodeChunk *	chunks;
+	DecodeBatch		batch;
+	DecodeState		state;
+	int				indent = gNumIndentTabs;
+	size_t			redecoded = 0;
+	size_t			index;
+	
+	// kdebug hands back tracepoints merged by timestamp, but make sure before chunking
+	for ( index = 1; index < count; index++ )
+	{
+		if ( kdbg_get_timestamp( &tracepoints[index] ) < kdbg_get_timestamp( &tracepoints[index - 1] ) )
+			break;
+	}
+	
+	if ( index < count )
+	{
+		sorted = ( kd_buf * ) malloc( count * sizeof(kd_buf) );
+		if ( sorted == NULL )
+			Quit( "can't allocate memory to sort tracepoints\n" );
+		
+		memcpy( sorted, tracepoints, count * sizeof(kd_buf) );
+		mergesort( sorted, count, sizeof(kd_buf), CompareTracepointTimestamps );
+		tracepoints = sorted;
+	}
+	
+	threads = ( pthread_t * ) malloc( threadCount * sizeof(pthread_t) );
+	chunks = ( DecodeChunk * ) malloc( batchSize * sizeof(DecodeChunk) );
+	if ( threads == NULL || chunks == NULL )
+		Quit( "can't allocate memory for decode workers\n" );
+	
+	if ( !gStartingAbsTime )
+	{
+		gStartingAbsTime = kdbg_get_timestamp( &tracepoints[0] );
+		gLastTimeStamp = gStartingAbsTime;
+	}
+	
+	// The exact state of a serial decode at the start of the next chunk to be written out
+	GetDecodeState( &state );
+	
+	for ( firstChunk = 0; firstChunk < chunkCount; firstChunk += batchSize )
+	{
+		uint32_t	thread;
+		uint32_t	started = 0;
+		
+		bzero( &batch, sizeof(batch) );
+		bzero( chunks, batchSize * sizeof(DecodeChunk) );
+		batch.chunks = chunks;
+		batch.chunkCount = ( uint32_t )MIN( (size_t)batchSize, chunkCount - firstChunk );
+		
+		// Indentation prepass, only looks at the debugid
+		for ( thread = 0; thread < batch.chunkCount; thread++ )
+		{
+			DecodeChunk *	chunk = &chunks[thread];
+			size_t			start = ( firstChunk + thread ) * kDecodeChunkSize;
+			
+			chunk->records = &tracepoints[start];
+			chunk->count = MIN( (size_t)kDecodeChunkSize, count - start );
+			chunk->indent = indent;
+			
+			// Exact for the first chunk of the batch, a guess the warmup refines for the others.  The seed
+			// already has everything before the batch, so the warmup must not reach back past its start.
+			memcpy( &chunk->seed, &state, sizeof(DecodeState) );
+			chunk->warmup = ( thread == 0 ) ? 0 : kDecodeWarmupSize;
+			
+			for ( index = 0; index < chunk->count; index++ )
+				indent += IndentDelta( chunk->records[index].debugid );
+		}
+		
+		for ( thread = 0; thread < MIN( threadCount, batch.chunkCount ); thread++ )
+		{
+			if ( pthread_create( &threads[thread], NULL, DecodeWorker, &batch ) != 0 )
+				break;
+			started++;
+		}
+		
+		// Fall back to decoding on this thread if no worker could be started
+		if ( started == 0 )
+			DecodeWorker( &batch );
+		
+		for ( thread = 0; thread < started; thread++ )
+			pthread_join( threads[thread], NULL );
+		
+		// A chunk's output is only used if it was decoded from the state the chunk before it really
+		// ended in.  Otherwise, e.g. a START more than the warmup before the seam, decode it again here.
+		for ( thread = 0; thread < batch.chunkCount; thread++ )
+		{
+			DecodeChunk * chunk = &chunks[thread];
+			
+			if ( chunk->output && memcmp( &chunk->start, &state, sizeof(DecodeState) ) == 0 )
+			{
+				fwrite( chunk->output + chunk->skip, 1, chunk->outputSize - chunk->skip, OutputStream() );
+				memcpy( &state, &chunk->end, sizeof(DecodeState) );
+			}
+			else
+			{
+				SetDecodeState( &state );
+				for ( index = 0; index < chunk->count; index++ )
+					ProcessTracepoint( chunk->records[index] );
+				GetDecodeState( &state );
+				redecoded++;
+			}
+			
+			free( chunk->output );
+		}
+	}
+	
+	// Leave the state where the serial decode would have for the next buffer
+	SetDecodeState( &state );
+	
+	if ( redecoded )
+		vlog( "Decoded %lu of %lu chunks again on the main thread to match a serial decode\n", (unsigned long)redecoded, (unsigned long)chunkCount );
+	
+	free( chunks );
+	free( threads );
+	free( sorted );
+}
+
+static int
+CompareTracepointTimestamps ( const void * a, const void * b )
+{
+	uint64_t first = kdbg_get_timestamp( ( kd_buf * ) a );
+	uint64_t second = kdbg_get_timestamp( ( kd_buf * ) b );
+	
+	return ( first < second ) ? -1 : ( ( first > second ) ? 1 : 0 );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	RunDecodeBenchmark
+//	- decodes a synthetic trace made of a representative mix of controller,
+//	  pipe, hub and UIM tracepoints, serially and then on all decode threads,
+//	  with the output discarded.
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+RunDecodeBenchmark ( uint64_t records )
+{
+	static const uint32_t	kBenchmarkIDs[] =
+	{
+		USB_TRACE( kUSBTController, kTPBulkTransaction, DBG_FUNC_START ),
+		USB_TRACE( kUSBTController, kTPBulkTransaction, DBG_FUNC_END ),
+		USB_CONTROLLER_TRACE( kTPBulkPacketHandler ),
+		USB_TRACE( kUSBTController, kTPInterruptTransaction, DBG_FUNC_START ),
+		USB_TRACE( kUSBTController, kTPInterruptTransaction, DBG_FUNC_END ),
+		USB_CONTROLLER_TRACE( kTPInterruptPacketHandler ),
+		USB_TRACE( kUSBTPipe, kTPBulkPipeRead, DBG_FUNC_START ),
+		USB_TRACE( kUSBTPipe, kTPBulkPipeRead, DBG_FUNC_END ),
+		USB_HUB_TRACE( kTPHubGetPortStatus ),
+		USB_XHCI_INTERRUPTS_TRACE( kTPXHCIFilterEventRing ),
+		USB_EHCI_INTERRUPTS_TRACE( kTPEHCIInterruptsPrimaryInterruptFilter ),
+		USB_TRACE( 63, 1, DBG_FUNC_NONE )
+	};
+	const size_t		kBatchRecords = 4 * 1024 * 1024;
+	size_t				batchRecords = ( size_t )MIN( records, (uint64_t)kBatchRecords );
+	kd_buf *			buffer;
+	uint32_t			savedThreads = GetDecodeThreadCount();
+	double				seconds[2];
+	int					pass;
+	size_t				index;
+	
+	buffer = ( kd_buf * ) calloc( batchRecords, sizeof(kd_buf) );
+	gOutputStream = fopen( "/dev/null", "w" );
+	if ( buffer == NULL || gOutputStream == NULL )
+		Quit( "can't set up benchmark\n" );
+	
+	for ( index = 0; index < batchRecords; index++ )
+	{
+		kd_buf * tracepoint = &buffer[index];
+		
+		kdbg_set_timestamp_and_cpu( tracepoint, 1000000 + index * 250, ( int )( index & 7 ) );
+		tracepoint->debugid = kBenchmarkIDs[index % ( sizeof(kBenchmarkIDs) / sizeof(kBenchmarkIDs[0]) )];
+		tracepoint->arg1 = 0xffffff8012345000ULL;
+		tracepoint->arg2 = ( 1 << 24 ) | ( 0x14 << 16 ) | ( ( index & 0xF ) << 8 ) | 2;
+		tracepoint->arg3 = 512;
+		tracepoint->arg4 = 0;
+		tracepoint->arg5 = 0xffffff8023456000ULL + ( index & 3 ) * 0x1000;
+	}
+	
+	for ( pass = 0; pass < 2; pass++ )
+	{
+		struct timeval	start, end;
+		uint64_t		remaining = records;
+		
+		gDecodeThreads = ( pass == 0 ) ? 1 : savedThreads;
+		gettimeofday( &start, NULL );
+		
+		while ( remaining > 0 )
+		{
+			size_t batch = ( size_t )MIN( remaining, (uint64_t)batchRecords );
+			
+			ProcessTracepoints( buffer, batch );
+			remaining -= batch;
+		}
+		
+		gettimeofday( &end, NULL );
+		seconds[pass] = ( end.tv_sec - start.tv_sec ) + ( end.tv_usec - start.tv_usec ) / 1000000.0;
+		
+		elog( "%u thread(s): %llu records in %.2f s, %.0f records/s\n", gDecodeThreads, records, seconds[pass], records / seconds[pass] );
+	}
+	
+	elog( "speedup: %.2fx\n", seconds[0] / seconds[1] );
+	
+	fclose( gOutputStream );
+	gOutputStream = NULL;
+	free( buffer );
 }
 
 
@@ -1940,7 +2325,7 @@ CollectTraceController( kd_buf tracepoint )
         
         case USB_CONTROLLER_TRACE(kTPControllerPutTDOnDoneQueue):
             {
-                static  int     recursionLevel;
+                int &   recursionLevel = gDecodeStatics.putTDRecursionLevel;
                 
                 if ( qualifier == DBG_FUNC_START ) 
                 {
@@ -4296,6 +4681,21 @@ CollectTraceEnumeration	( kd_buf tracepoint )
 			log(info, "Enumeration", "EHCI Root Hub", parg1, "Found full speed device, giving it to companion");
 			break;
 			
+		case USB_ENUMERATION_TRACE( kTPEnumerationRegisterInterfaces ):
+			if ( qualifier == DBG_FUNC_START )
+			{
+				log(info, "Enumeration", "RegisterInterfaces", parg1, "Registering %d interfaces%s", arg2, arg3 ? " in parallel" : "" );
+			}
+			else if ( qualifier == DBG_FUNC_END )
+			{
+				log(info, "Enumeration", "RegisterInterfaces", parg1, "All interfaces matched and started after %d us", arg2 );
+			}
+			else
+			{
+				log(info, "Enumeration", "RegisterInterfaces", parg1, "Interface %d matched and started in %d us%s (0x%x)", (arg2 & 0xFF), arg3, (arg2 & 0x10000) ? " in parallel" : "", arg4 );
+			}
+			break;
+			
 		default:
 			CollectTraceUnknown( tracepoint );
 			break;	
@@ -6401,7 +6801,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
             
         case USB_XHCI_TRACE( kTPXHCIStopEndpoint ):
 			{
-				static uint64_t			startTime;
+				uint64_t &		startTime = gDecodeStatics.stopEndpointStart;
 				
 				if ( qualifier == DBG_FUNC_START ) 
 				{
@@ -6426,7 +6826,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
             
         case USB_XHCI_TRACE( kTPXHCIReturnAllTransfers ):
             {
- 				static uint64_t			startTime;
+ 				uint64_t &		startTime = gDecodeStatics.returnAllTransfersStart;
                 
                 if ( qualifier == DBG_FUNC_START )
                 {
@@ -6694,7 +7094,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
             
         case USB_XHCI_TRACE(kTPXHCIQuiesceEndpoint):
 			{
-				static uint64_t			startTime;
+				uint64_t &		startTime = gDecodeStatics.quiesceEndpointStart;
 				
 				if ( qualifier == DBG_FUNC_START ) 
 				{
@@ -6742,8 +7142,11 @@ CollectTraceXHCI ( kd_buf tracepoint )
 
         case USB_XHCI_TRACE(kTPXHCIAbortIsochEP):
             {
-                static int outslot, inslot, activetds, ontodolist, deferredtds, scheduledtds, onproducerq, consumer, producer, onreversedlist, ondonequeue;
-                static uintptr_t pEP, todo, deferred, donequeue, ring;
+                DecodeStatics & st = gDecodeStatics;
+                int & outslot = st.abortIsochOutSlot, & inslot = st.abortIsochInSlot, & activetds = st.abortIsochActiveTDs, & ontodolist = st.abortIsochOnToDoList;
+                int & deferredtds = st.abortIsochDeferredTDs, & scheduledtds = st.abortIsochScheduledTDs, & onproducerq = st.abortIsochOnProducerQ;
+                int & consumer = st.abortIsochConsumer, & producer = st.abortIsochProducer, & onreversedlist = st.abortIsochOnReversedList, & ondonequeue = st.abortIsochOnDoneQueue;
+                uintptr_t & pEP = st.abortIsochPEP, & todo = st.abortIsochTodo, & deferred = st.abortIsochDeferred, & donequeue = st.abortIsochDoneQueue, & ring = st.abortIsochRing;
                 
                 if (qualifier == DBG_FUNC_START)
                 {
@@ -7055,7 +7458,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
 
         case USB_XHCI_TRACE( kTPXHCIUIMCreateIsocEndpoint ):
 			{
-				static uint64_t		startTime;
+				uint64_t &		startTime = gDecodeStatics.createIsocEndpointStart;
 				
 				if ( qualifier == DBG_FUNC_START ) 
 				{
@@ -7157,7 +7560,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
 			
         case USB_XHCI_TRACE( kTPXHCIUIMAbortStream ):
 			{
-				static uint64_t		startTime;
+				uint64_t &		startTime = gDecodeStatics.abortStreamStart;
 				
 				if ( qualifier == DBG_FUNC_START ) 
 				{
@@ -7174,7 +7577,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
 			
         case USB_XHCI_TRACE( kTPXHCIUIMClearEndpointStall ):
 			{
-				static uint64_t		startTime;
+				uint64_t &		startTime = gDecodeStatics.clearEndpointStallStart;
 				
 				if ( qualifier == DBG_FUNC_START ) 
 				{
@@ -7191,7 +7594,7 @@ CollectTraceXHCI ( kd_buf tracepoint )
 			
         case USB_XHCI_TRACE( kTPXHCIDeleteIsochEP ):
 			{
-				static uint64_t		startTime;
+				uint64_t &		startTime = gDecodeStatics.deleteIsochEPStart;
 				
 				if ( qualifier == DBG_FUNC_START ) 
 				{
@@ -7333,8 +7736,8 @@ CollectTraceXHCIPrintTRB	( kd_buf tracepoint )
 		// USBTrace_End(kUSBTXHCIPrintTRB, kTPXHCIPrintTRBTransfer, trb->offs8, trb->offsC, indexInRing, 0);
 		case USB_XHCI_PRINTTRB_TRACE( kTPXHCIPrintTRBTransfer ):
 		{
-			static uintptr_t	xhci, xferRing;
-			static int			offs0, offs4;
+			uintptr_t &	xhci = gDecodeStatics.trbTransferXHCI, & xferRing = gDecodeStatics.trbTransferRing;
+			int &		offs0 = gDecodeStatics.trbTransferOffs0, & offs4 = gDecodeStatics.trbTransferOffs4;
 			
 			if ( qualifier == DBG_FUNC_START ) 
 			{
@@ -7377,8 +7780,8 @@ CollectTraceXHCIPrintTRB	( kd_buf tracepoint )
 			
 		case USB_XHCI_PRINTTRB_TRACE(kTPXHCIPrintTRBEvent):
 		{
-			static uintptr_t	xhci;
-			static int			irq, offs0, offs4;
+			uintptr_t &	xhci = gDecodeStatics.trbEventXHCI;
+			int &		irq = gDecodeStatics.trbEventIRQ, & offs0 = gDecodeStatics.trbEventOffs0, & offs4 = gDecodeStatics.trbEventOffs4;
 			
             // Note, if we want to support multiple XHCI controllers, we will have to modify this to keep track
             // of which controller did the START and if it is the same controller doing the END
@@ -7412,8 +7815,8 @@ CollectTraceXHCIPrintTRB	( kd_buf tracepoint )
 			
 		case USB_XHCI_PRINTTRB_TRACE(kTPXHCIPrintTRBCommand):
 		{
-			static uintptr_t	xhci;
-			static int			offs0, offs4;
+			uintptr_t &	xhci = gDecodeStatics.trbCommandXHCI;
+			int &		offs0 = gDecodeStatics.trbCommandOffs0, & offs4 = gDecodeStatics.trbCommandOffs4;
 			
 			// Note, if we want to support multiple XHCI controllers, we will have to modify this to keep track
             // of which controller did the START and if it is the same controller doing the END
@@ -7650,8 +8053,9 @@ CollectTraceXHCIInterrupts	( kd_buf tracepoint )
 	uintptr_t						parg1, parg2, parg3, parg4;
 	uint32_t						arg1, arg2, arg3, arg4;
 	time_t							currentTime;
-	static uint64_t					pollStartTime, filterStartTime, filterRingStartTime;
-	static uint32_t					trbCopyCount, trbNoCopyCount;
+	uint64_t &						pollStartTime = gDecodeStatics.pollStartTime, & filterStartTime = gDecodeStatics.filterStartTime;
+	uint64_t &						filterRingStartTime = gDecodeStatics.filterRingStartTime;
+	uint32_t &						trbCopyCount = gDecodeStatics.trbCopyCount, & trbNoCopyCount = gDecodeStatics.trbNoCopyCount;
 	
 	
 	debugID = tracepoint.debugid;
@@ -7890,13 +8294,12 @@ CollectTraceAudioDriver ( kd_buf tracepoint )
 			break;
 			
 		case USB_AUDIO_DRIVER_TRACE( kTPAudioDriverCoalesce ):
-			static	uint32_t auaTime = 0;
 #ifdef __LP64__
 			log( info, "AUAudio", "CoalesceInputSamples", 0, "Read:  frameListPtr: 0x%x, frActCount: %d, frStatus:0x%x, frTimeStamp: 0x%qx", arg1, arg2, arg3, (uint64_t)parg4);
 #else
-			log( info, "AUAudio", "CoalesceInputSamples", 0, "Read:  frameListPtr: 0x%x, frActCount: %d, frStatus:0x%x, frTimeStamp.lo: 0x%x ( %qd ) delta: %d", arg1, arg2, arg3, arg4, (uint64_t)arg4, arg4-auaTime);
+			log( info, "AUAudio", "CoalesceInputSamples", 0, "Read:  frameListPtr: 0x%x, frActCount: %d, frStatus:0x%x, frTimeStamp.lo: 0x%x ( %qd ) delta: %d", arg1, arg2, arg3, arg4, (uint64_t)arg4, arg4-gDecodeStatics.auaTime);
 #endif
-			auaTime = arg4;
+			gDecodeStatics.auaTime = arg4;
 			
 			break;
 			
@@ -7927,53 +8330,61 @@ CollectTraceAudioDriver ( kd_buf tracepoint )
 static void
 ReadRawFile( const char * filepath )
 {
-	FILE * file = fopen( filepath, "r");
+	int				fd;
+	struct stat		info;
+	kd_buf *		records;
+	size_t			count;
+	size_t			index;
+	size_t			runStart = 0;
+	
+	fd = open( filepath, O_RDONLY );
+	if ( fd < 0 || fstat( fd, &info ) != 0 )
+		Quit( "Could not open raw file to read!\n");
+	
+	count = ( size_t )info.st_size / sizeof(kd_buf);
+	if ( count == 0 )
+	{
+		close( fd );
+		return;
+	}
+	
+	// Map the file rather than reading it a record at a time, the decoder walks it in place
+	records = ( kd_buf * ) mmap( NULL, count * sizeof(kd_buf), PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( records == ( kd_buf * ) MAP_FAILED )
+		Quit( "Could not map raw file to read!\n");
 	
-	kd_buf kp;
-	bzero( &kp, sizeof(kd_buf) );
+	madvise( records, count * sizeof(kd_buf), MADV_SEQUENTIAL );
 	
-	if ( file )
+	for ( index = 0; index <= count; index++ )
 	{
-		while ( fread( &kp, sizeof(kd_buf), 1, file ) )
+		if ( index < count && records[index].debugid != kInvalid && records[index].debugid != kDivisorEntry )
+			continue;
+		
+		// send the tracepoints since the last special entry to be processed
+		if ( index > runStart )
+			ProcessTracepoints( &records[runStart], index - runStart );
+		
+		runStart = index + 1;
+		
+		if ( index == count )
+			break;
+		
+		if ( records[index].debugid == kInvalid )
 		{
-			kd_buf tracepoint;
-			bzero( &tracepoint, sizeof(kd_buf) );
-			
-			if ( kp.debugid == kInvalid )
-			{
-				vlog( "Found an invalid entry in raw file.\n");
-				continue;
-			}
+			vlog( "Found an invalid entry in raw file.\n");
+		}
+		else
+		{
+			gDivisor = (double)(records[index].timestamp);
+			vlog("Found divisor %f as 0x%llx\n", gDivisor, records[index].timestamp);
 			
-			if ( kp.debugid == kDivisorEntry )
-			{
-				gDivisor = (double)(kp.timestamp);
-				vlog("Found divisor %f as 0x%llx\n", gDivisor, kp.timestamp);
-			}
-			else
-			{
-				tracepoint.timestamp = kp.timestamp;	// don't mask before writing
-				tracepoint.arg1 = kp.arg1;
-				tracepoint.arg2 = kp.arg2;
-				tracepoint.arg3 = kp.arg3;
-				tracepoint.arg4 = kp.arg4;
-				tracepoint.arg5 = kp.arg5;
-				tracepoint.debugid = kp.debugid;
-#if defined(__LP64__)
-				kdbg_set_cpu(&tracepoint, kp.cpuid);
-#endif
-				
-				// vlog("0x%llx 0x%08x %8lx  %8lx  %8lx  %8lx\n", tracepoint.timestamp, tracepoint.debugid, tracepoint.arg1, tracepoint.arg2, tracepoint.arg3, tracepoint.arg4 );
-				
-				// send tracepoint to be processed
-				ProcessTracepoint( tracepoint );
-			}
+			if ( gIndexWriter )
+				USBTraceWriterSetDivisor( gIndexWriter, gDivisor );
 		}
-		
-		fclose( file );
 	}
-	else
-		Quit( "Could not open raw file to read!\n");
+	
+	munmap( records, count * sizeof(kd_buf) );
+	close( fd );
 }
 
 //———————————————————————————————————————————————————————————————————————————
@@ -8036,10 +8447,10 @@ CollectToRawFile ( FILE * file )
 		fwrite( (const void *)&rawkd, sizeof(kd_buf), 1, file );
 		if ( errno )
 			elog("Error %d occurred writing data with debugid 0x%x and timestamp 0x%llx\n", errno, rawkd.debugid, kdbg_get_timestamp(&gTraceBuffer[index]));
-		
-		// send tracepoint to be processed as well
-		ProcessTracepoint( gTraceBuffer[index] );
 	}
+	
+	// send tracepoints to be processed as well
+	ProcessTracepoints( gTraceBuffer, count );
 }
 
 //———————————————————————————————————————————————————————————————————————————
@@ -8062,6 +8473,33 @@ PrependDivisorEntry ( FILE * file )
 		elog("Error %d writing divisor data\n", errno);
 }
 
+//———————————————————————————————————————————————————————————————————————————
+//	AppendToIndexFile
+//———————————————————————————————————————————————————————————————————————————
+
+static void
+AppendToIndexFile ( kd_buf * tracepoint )
+{
+	USBTraceRecord	record;
+	int				error;
+	
+	if ( tracepoint->debugid == kInvalid )
+		return;
+	
+	record.timestamp = kdbg_get_timestamp(tracepoint);
+	record.arg1 = tracepoint->arg1;
+	record.arg2 = tracepoint->arg2;
+	record.arg3 = tracepoint->arg3;
+	record.arg4 = tracepoint->arg4;
+	record.thread = tracepoint->arg5;
+	record.debugid = tracepoint->debugid;
+	record.cpuid = kdbg_get_cpu(tracepoint);
+	
+	error = USBTraceWriterAppend( gIndexWriter, &record );
+	if ( error )
+		elog("Error %d occurred writing data with debugid 0x%x to the index file\n", error, record.debugid);
+}
+
 #pragma mark Convenience
 
 static void
@@ -8110,7 +8548,7 @@ CollectTraceUnknown ( kd_buf tracepoint )
 	
 	if ( (debugID & 0xFFFF0000) == kTPAllUSB )
 	{
-		printf(
+		fprintf( OutputStream(),
 #ifdef __LP64__
 			   "%s %s F-0x%04x|%02u|%03u  %16lx  %16lx  %16lx  %16lx  0x%16lx  %2u\n",
 #else
@@ -8141,7 +8579,7 @@ CollectTraceUnknown ( kd_buf tracepoint )
 		}
 		else
 		{
-			printf(
+			fprintf( OutputStream(),
 #ifdef __LP64__
 				   "%s %s U-0x%04x|%02u|%03u  %16lx  %16lx  %16lx  %16lx  0x%16lx  %2u\n",
 #else
@@ -8272,7 +8710,7 @@ CollectTraceBasic ( kd_buf tracepoint )
 			snprintf(description, 64, "%s", digits);	// pad string
 		}
 		
-		printf(
+		fprintf( OutputStream(),
 #ifdef __LP64__
 			   "%10.1f %5.1f  %-30s %16lx  %16lx  %16lx  %16lx  0x%016lx  %2u\n",
 #else
@@ -8283,7 +8721,7 @@ CollectTraceBasic ( kd_buf tracepoint )
 	}
 	else
 	{
-		printf(
+		fprintf( OutputStream(),
 #ifdef __LP64__
 			   "%10.1f %5.1f  0x%08x  %16lx  %16lx  %16lx  %16lx  0x%016lx  %2u\n",
 #else
@@ -8322,7 +8760,9 @@ ConvertTimestamp ( uint64_t timestamp, char * timestring )
 	{
 		currentTime = time ( NULL );
 		
-		snprintf(timestring, 40, "%-8.8s [%8lld][%10lld us]", &( ctime ( &currentTime )[11] ), gCurrent_usecs, gDelta_usecs );
+		char ctimestring[26];
+		
+		snprintf(timestring, 40, "%-8.8s [%8lld][%10lld us]", &( ctime_r ( &currentTime, ctimestring )[11] ), gCurrent_usecs, gDelta_usecs );
 		
 	}
 	else if ( gTimeStampMask & kTimeStampKernel )
@@ -8352,18 +8792,18 @@ PrintHeader ( trace_info info, const char * group, const char * method, uintptr_
 	char timestring[kTimeStringSize];
 	
 	if ( gTimeStampMask & kTimeStampKernel )
-		printf ( "%s ", ConvertTimestamp( timestamp, timestring ) );
+		fprintf( OutputStream(), "%s ", ConvertTimestamp( timestamp, timestring ) );
 	
 	if ( gPrintCPU )
 	{
 		uint32_t cpu = info.cpuid;
-		printf( "%-2u ", cpu);
+		fprintf( OutputStream(), "%-2u ", cpu);
 	}
 	
 	if ( gPrintThread )
 	{
 		uintptr_t thread = info.thread;
-		printf(
+		fprintf( OutputStream(),
 #ifdef __LP64__
 			   "0x%016lx ",
 #else
@@ -8373,25 +8813,25 @@ PrintHeader ( trace_info info, const char * group, const char * method, uintptr_
 	}
 	
 	if ( gPrintCodes )
-		printf ("0x%08x ", debugID);
+		fprintf( OutputStream(), "0x%08x ", debugID);
 	
 	uint32_t qualifier = debugID & 0x3;
 	
 	if ( qualifier == DBG_FUNC_START )
 	{
-		printf( "%s ", kPrintStartToken );
+		fprintf( OutputStream(), "%s ", kPrintStartToken );
 		if ( gPrintIndent )
-			IndentIn( gNumIndentTabs );
+			Indent( gNumIndentTabs );
 	}
 	else if ( qualifier == DBG_FUNC_END )
 	{
-		printf( "%s ", kPrintEndToken );
+		fprintf( OutputStream(), "%s ", kPrintEndToken );
 		if ( gPrintIndent )
-			IndentOut( gNumIndentTabs );
+			Indent( gNumIndentTabs );
 	}
 	else
 	{
-		printf( "%s ", kPrintMedialToken );
+		fprintf( OutputStream(), "%s ", kPrintMedialToken );
 		if ( gPrintIndent )
 			Indent( gNumIndentTabs );
 	}
@@ -8401,22 +8841,22 @@ PrintHeader ( trace_info info, const char * group, const char * method, uintptr_
 	
 	if ( gPrintNoSep )
 	{
-		printf( "%s ", description );
+		fprintf( OutputStream(), "%s ", description );
 	}
 	else
 	{
 		if ( !gPrintMethod )
-			printf( "%-10s ", description );
+			fprintf( OutputStream(), "%-10s ", description );
 		else
-			printf( "%-30s ", description );
+			fprintf( OutputStream(), "%-30s ", description );
 	}
 	
 	if ( gPrintUSBP )
 	{
 #ifdef __LP64__
-		printf("(0x%16.016qx) ", (uint64_t)fwim);
+		fprintf( OutputStream(), "(0x%16.016qx) ", (uint64_t)fwim);
 #else
-		printf("(0x%8.08x) ", (uint32_t)fwim);
+		fprintf( OutputStream(), "(0x%8.08x) ", (uint32_t)fwim);
 #endif
 	}
 	
@@ -8434,30 +8874,64 @@ Indent ( int numOfTabs )
 	
 	for ( i = 0; i < gNumIndentTabs; i++ )
 	{
-		printf( " ");
+		fprintf( OutputStream(), " ");
 	}
 }
 
 //———————————————————————————————————————————————————————————————————————————
-//	IndentIn
+//	IndentDelta
+//	- how a tracepoint changes the indentation of the tracepoints after it.
+//	  Only depends on the debugid so that the decode workers can compute the
+//	  indentation at the start of their chunk without decoding what precedes it.
 //———————————————————————————————————————————————————————————————————————————
 
-static void
-IndentIn ( int numOfTabs )
+static int
+IndentDelta ( uint32_t debugID )
 {
-	Indent( numOfTabs );
-	gNumIndentTabs++;
+	uint32_t qualifier = debugID & 0x3;
+	
+	if ( gBasicFormatting || qualifier == DBG_FUNC_NONE )
+		return 0;
+	
+	if ( (debugID & 0xFFFF0000) != kTPAllUSB && !( (gPrintMask & kPrintMaskAllTracepoints) && gCodesFilePath[0] != 0 ) )
+		return 0;
+	
+	return ( qualifier == DBG_FUNC_START ) ? 1 : -1;
 }
 
 //———————————————————————————————————————————————————————————————————————————
-//	IndentOut
+//	GetDecodeState, SetDecodeState
+//	- snapshot and restore the calling thread's decoder state.  Snapshots are
+//	  compared with memcmp, so they are zeroed first.
 //———————————————————————————————————————————————————————————————————————————
 
 static void
-IndentOut ( int numOfTabs )
+GetDecodeState ( DecodeState * state )
+{
+	bzero( state, sizeof(DecodeState) );
+	state->lastTimeStamp = gLastTimeStamp;
+	state->prevUsecs = gPrev_usecs;
+	state->indent = gNumIndentTabs;
+	memcpy( &state->statics, &gDecodeStatics, sizeof(DecodeStatics) );
+}
+
+static void
+SetDecodeState ( const DecodeState * state )
+{
+	gLastTimeStamp = state->lastTimeStamp;
+	gPrev_usecs = state->prevUsecs;
+	gNumIndentTabs = state->indent;
+	memcpy( &gDecodeStatics, &state->statics, sizeof(DecodeStatics) );
+}
+
+//———————————————————————————————————————————————————————————————————————————
+//	OutputStream
+//———————————————————————————————————————————————————————————————————————————
+
+FILE *
+OutputStream ( void )
 {
-	Indent( numOfTabs );
-	gNumIndentTabs--;
+	return gOutputStream ? gOutputStream : stdout;
 }
 
 //———————————————————————————————————————————————————————————————————————————
@@ -8473,6 +8947,13 @@ Quit ( const char * s )
 	if ( gLogFileStream )
 		fclose( gLogFileStream );
 	
+	if ( gIndexWriter )
+	{
+		if ( USBTraceWriterClose( gIndexWriter ) != 0 )
+			elog( "Error writing index file '%s'\n", gIndexFilePath );
+		gIndexWriter = NULL;
+	}
+	
 	if ( gTraceEnabled == TRUE )
 		EnableTraceBuffer ( 0 );
 	
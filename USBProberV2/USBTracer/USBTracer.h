@@ -44,6 +44,10 @@
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 //#include <libutil.h>		// for reexec_to_match_kernel()
 #include <mach/mach_host.h> // for host_info()
@@ -800,6 +804,7 @@ typedef struct {
 
 #include "USBTracepoints.h"
 #include "IOUSBFamilyInfoPlist.pch"
+#include "USBTraceIndex.h"
 
 #define DEBUG 			0
 
@@ -807,7 +812,7 @@ typedef struct {
 	#define	USBTRACE_VERSION "100.4.0"
 #endif
 
-#define log(a,b,c,d,x,...)			if ( PrintHeader(a,b,c,d) ) { if (x){fprintf(stdout,x, ##__VA_ARGS__);} fprintf(stdout, "\n"); }
+#define log(a,b,c,d,x,...)			if ( PrintHeader(a,b,c,d) ) { if (x){fprintf(OutputStream(),x, ##__VA_ARGS__);} fprintf(OutputStream(), "\n"); }
 #define logs(a,b,c,x...)			log(a,b,c,0,x...)
 #define	vlog(x...)					if ( gVerbose ) { fprintf(stdout,x); }
 #define	elog(x...)					fprintf(stderr, x)
@@ -832,6 +837,10 @@ typedef struct {
 #define kInvalid						0xdeadbeef
 #define kDivisorEntry					0xfeedface
 #define kKernelTraceCodes				"/usr/local/share/misc/trace.codes"
+#define kDecodeChunkSize				65536
+#define kDecodeWarmupSize				1024
+#define kDecodeChunksPerThread			4
+#define kDecodeParallelThreshold		( 2 * kDecodeChunkSize )
 
 //—————————————————————————————————————————————————————————————————————————————
 //	Types
@@ -844,6 +853,60 @@ typedef struct {
 	uint32_t	cpuid;
 } trace_info;
 
+/* State the Collect* functions keep between related tracepoints, e.g. the START time of a command */
+typedef struct {
+	uint64_t	stopEndpointStart;
+	uint64_t	returnAllTransfersStart;
+	uint64_t	quiesceEndpointStart;
+	uint64_t	createIsocEndpointStart;
+	uint64_t	abortStreamStart;
+	uint64_t	clearEndpointStallStart;
+	uint64_t	deleteIsochEPStart;
+	uint64_t	pollStartTime;
+	uint64_t	filterStartTime;
+	uint64_t	filterRingStartTime;
+	uintptr_t	abortIsochPEP, abortIsochTodo, abortIsochDeferred, abortIsochDoneQueue, abortIsochRing;
+	uintptr_t	trbTransferXHCI, trbTransferRing;
+	uintptr_t	trbEventXHCI;
+	uintptr_t	trbCommandXHCI;
+	int			abortIsochOutSlot, abortIsochInSlot, abortIsochActiveTDs, abortIsochOnToDoList, abortIsochDeferredTDs, abortIsochScheduledTDs;
+	int			abortIsochOnProducerQ, abortIsochConsumer, abortIsochProducer, abortIsochOnReversedList, abortIsochOnDoneQueue;
+	int			trbTransferOffs0, trbTransferOffs4;
+	int			trbEventIRQ, trbEventOffs0, trbEventOffs4;
+	int			trbCommandOffs0, trbCommandOffs4;
+	int			putTDRecursionLevel;
+	uint32_t	trbCopyCount;
+	uint32_t	trbNoCopyCount;
+	uint32_t	auaTime;
+} DecodeStatics;
+
+/* Everything a decode depends on besides the tracepoints themselves */
+typedef struct {
+	uint64_t		lastTimeStamp;		/* gLastTimeStamp */
+	int64_t			prevUsecs;			/* gPrev_usecs */
+	int				indent;				/* gNumIndentTabs */
+	DecodeStatics	statics;
+} DecodeState;
+
+typedef struct {
+	const kd_buf *	records;		/* first tracepoint of the chunk */
+	size_t			count;
+	size_t			warmup;			/* tracepoints before records replayed to guess the decoder state */
+	int				indent;			/* gNumIndentTabs at the first tracepoint, exact */
+	DecodeState		seed;			/* state the warmup starts from */
+	DecodeState		start;			/* guessed state at the first tracepoint */
+	DecodeState		end;			/* state after the last tracepoint, given start */
+	char *			output;
+	size_t			outputSize;
+	size_t			skip;			/* output produced by the warmup */
+} DecodeChunk;
+
+typedef struct {
+	DecodeChunk *		chunks;
+	uint32_t			chunkCount;
+	volatile uint32_t	nextChunk;
+} DecodeBatch;
+
 // Constants that define the different power states
 enum
 {
@@ -1335,6 +1398,12 @@ static void PrintUsage ( void );
 static void CollectTrace ( void );
 static void CollectWithAlloc( void );
 static void ProcessTracepoint( kd_buf tracepoint );
+static void ProcessTracepoints( kd_buf * tracepoints, size_t count );
+static void ProcessTracepointsParallel( kd_buf * tracepoints, size_t count );
+static uint32_t GetDecodeThreadCount ( void );
+static void * DecodeWorker ( void * arg );
+static int CompareTracepointTimestamps ( const void * a, const void * b );
+static void RunDecodeBenchmark ( uint64_t records );
 
 static void CollectTraceController( kd_buf tracepoint );		
 static void CollectTraceControllerUserClient( kd_buf tracepoint );
@@ -1379,6 +1448,7 @@ static void CollectCodeFile ( void );
 static void ReadRawFile( const char * filepath );
 static void CollectToRawFile ( FILE * file );
 static void PrependDivisorEntry ( FILE * file );
+static void AppendToIndexFile ( kd_buf * tracepoint );
 static void CollectTraceUnknown ( kd_buf tracepoint );
 static char * DecodeID ( uint32_t id, char * string, const int max );
 static void CollectTraceBasic ( kd_buf tracepoint );
@@ -1387,8 +1457,10 @@ static char * ConvertTimestamp ( uint64_t timestamp, char * timestring );
 static bool PrintHeader ( trace_info info, const char * group, const char * method, uintptr_t theThis );
 static void TabIndent ( int numOfTabs );
 static void Indent ( int numOfTabs );
-static void IndentIn ( int numOfTabs );
-static void IndentOut ( int numOfTabs );
+static int IndentDelta ( uint32_t debugID );
+static void GetDecodeState ( DecodeState * state );
+static void SetDecodeState ( const DecodeState * state );
+FILE * OutputStream ( void );
 
 const char * DecodeUSBTransferType( uint32_t type );
 const char * DecodeUSBPowerState( uint32_t type );